@@ -62,6 +62,7 @@ class MapgetRecipe(ConanFile):
             self.requires("picosha2/cci.20220808", transitive_headers=True)
         if self.options.with_service or self.options.with_httplib:
             self.requires("rocksdb/9.1.0")
+            self.requires("zstd/1.5.6")
         if self.options.with_wheel:
             self.requires("pybind11/2.11.1")
 
@@ -24,6 +24,7 @@ if (MAPGET_CONAN)
   endif()
   if (WANTS_ROCKSDB)
     find_package(RocksDB     CONFIG REQUIRED)
+    find_package(zstd        CONFIG REQUIRED)
   endif()
 else()
   FetchContent_Declare(glm
@@ -106,6 +107,22 @@ else()
     endblock()
   endif()
 
+  if (WANTS_ROCKSDB AND NOT TARGET libzstd_static)
+    block()
+      set(ZSTD_BUILD_PROGRAMS NO CACHE BOOL "zstd without programs")
+      set(ZSTD_BUILD_TESTS NO CACHE BOOL "zstd without tests")
+      set(ZSTD_BUILD_SHARED NO CACHE BOOL "zstd as static library")
+      FetchContent_Declare(zstd
+        GIT_REPOSITORY "https://github.com/facebook/zstd.git"
+        GIT_TAG        "v1.5.6"
+        GIT_SHALLOW    ON
+        SOURCE_SUBDIR  build/cmake)
+      FetchContent_MakeAvailable(zstd)
+      target_include_directories(libzstd_static INTERFACE "${zstd_SOURCE_DIR}/lib")
+      add_library(zstd::libzstd_static ALIAS libzstd_static)
+    endblock()
+  endif()
+
   if (NOT TARGET simfil)
     set(SIMFIL_WITH_MODEL_JSON YES CACHE BOOL "Simfil with JSON support")
     set(SIMFIL_SHARED          NO  CACHE BOOL "Simfil as static library")
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace mapget {
+
+/**
+ * Content-Encoding of zstd compressed tile responses. Clients request it
+ * by listing it in their Accept-Encoding header, see acceptsEncoding().
+ */
+constexpr auto ZstdContentEncoding = "zstd";
+
+/**
+ * Check whether an Accept-Encoding header value lists the given encoding.
+ * An encoding with a quality value of zero is not accepted.
+ */
+bool acceptsEncoding(std::string_view const& acceptEncoding, std::string_view const& encoding);
+
+/**
+ * Streaming zstd compression of a response body. Each call to compress()
+ * flushes its output, so that the client can decode all data which was
+ * sent so far. A stream of tile layers is thus still delivered progressively.
+ */
+class ZstdStreamCompressor
+{
+public:
+    explicit ZstdStreamCompressor(int level = 3);
+    ~ZstdStreamCompressor();
+
+    /**
+     * Compress the given bytes and append the output to the result.
+     * With endOfStream, the zstd frame is closed.
+     */
+    void compress(std::string_view const& bytes, std::string& result, bool endOfStream = false);
+
+    /**
+     * Compress the given bytes without flushing: Output which is ready is
+     * appended to the result, the rest follows with the next compress().
+     */
+    void compressBuffered(std::string_view const& bytes, std::string& result);
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+/**
+ * Streaming zstd decompression of a response body, which may arrive
+ * in chunks of any size.
+ */
+class ZstdStreamDecompressor
+{
+public:
+    ZstdStreamDecompressor();
+    ~ZstdStreamDecompressor();
+
+    /** Decompress the given bytes and append the output to the result. */
+    void decompress(std::string_view const& bytes, std::string& result);
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+}  // namespace mapget
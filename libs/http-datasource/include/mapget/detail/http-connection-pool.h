@@ -0,0 +1,138 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace httplib {
+class Client;
+}
+
+namespace mapget {
+
+/**
+ * Pool of keep-alive HTTP connections to one or more endpoints which
+ * serve the same content. A connection is checked out for one request,
+ * and returned to the pool afterwards, so a stuck request never delays
+ * another one. Each request goes to the healthy endpoint with the least
+ * outstanding requests. An endpoint on which a request failed is backed
+ * off exponentially, and probed by the health check before it is
+ * used again.
+ */
+class HttpConnectionPool
+{
+public:
+    struct Endpoint
+    {
+        std::string host_;
+        uint16_t port_ = 0;
+    };
+
+    /**
+     * Check whether an endpoint which failed is usable again, using the
+     * given connection. Without a health check, the next request decides.
+     */
+    using HealthCheckFun = std::function<bool(size_t endpointIndex, httplib::Client& client)>;
+
+    /**
+     * Connection which is checked out of the pool. It is returned to the
+     * pool when it is destroyed, unless it was marked as failed.
+     */
+    class Connection
+    {
+    public:
+        Connection(Connection&& other) noexcept;
+        Connection& operator=(Connection&&) = delete;
+        ~Connection();
+
+        [[nodiscard]] httplib::Client& client() const { return *client_; }
+
+        /** Index of the endpoint of the connection. */
+        [[nodiscard]] size_t endpoint() const { return endpoint_; }
+
+        /**
+         * Mark the request on the connection as failed, e.g. because the
+         * endpoint did not answer. The connection is then closed, and the
+         * endpoint is backed off.
+         */
+        void setFailed() { failed_ = true; }
+
+    private:
+        friend class HttpConnectionPool;
+        Connection(HttpConnectionPool* pool, size_t endpoint, std::unique_ptr<httplib::Client> client);
+
+        HttpConnectionPool* pool_ = nullptr;
+        size_t endpoint_ = 0;
+        std::unique_ptr<httplib::Client> client_;
+        bool failed_ = false;
+    };
+
+    /**
+     * Construct a pool for the given endpoints, which keeps up to
+     * maxIdleConnections idle connections per endpoint.
+     */
+    HttpConnectionPool(std::vector<Endpoint> endpoints, size_t maxIdleConnections, HealthCheckFun healthCheck = {});
+    ~HttpConnectionPool();
+
+    /**
+     * Check out a connection to the healthy endpoint with the least outstanding
+     * requests, other than the excluded one. A failed endpoint whose backoff
+     * has passed is probed first. Returns no connection if there is no
+     * healthy endpoint.
+     */
+    std::optional<Connection> acquire(std::optional<size_t> excludedEndpoint = {});
+
+    /** Back off an endpoint, e.g. one which was unreachable at startup. */
+    void setFailed(size_t endpoint);
+
+    /**
+     * Replace an endpoint, e.g. by the new port of a restarted server.
+     * The new endpoint is probed before it gets requests.
+     */
+    void setEndpoint(size_t index, Endpoint endpoint);
+
+    [[nodiscard]] std::vector<Endpoint> endpoints() const;
+
+    /** Backoff of an endpoint after its first failure, which doubles with each further failure. */
+    static constexpr std::chrono::milliseconds MinBackoff{100};
+
+    /** Longest backoff of an endpoint. */
+    static constexpr std::chrono::milliseconds MaxBackoff{10000};
+
+    /** Connection timeout of a health check. */
+    static constexpr std::chrono::milliseconds HealthCheckTimeout{2000};
+
+private:
+    struct EndpointState
+    {
+        std::vector<std::unique_ptr<httplib::Client>> idleConnections_;
+        size_t outstandingRequests_ = 0;
+        uint32_t failures_ = 0;  // Consecutive failures, zero if the endpoint is healthy
+        std::chrono::steady_clock::time_point retryAt_;
+        bool probing_ = false;  // Whether the health check is running
+    };
+
+    // Return a checked out connection.
+    void release(size_t endpoint, std::unique_ptr<httplib::Client> client, bool failed);
+    // Back off an endpoint after a failure. Requires mutex_.
+    void recordFailure(EndpointState& state);
+    // Run the health check of a failed endpoint.
+    bool probe(size_t index, Endpoint const& endpoint) const;
+    // Create a keep-alive connection to an endpoint.
+    static std::unique_ptr<httplib::Client> newConnection(Endpoint const& endpoint);
+
+    size_t maxIdleConnections_ = 0;
+    HealthCheckFun healthCheck_;
+
+    mutable std::mutex mutex_;  // Mutex for endpoints_, states_ and nextEndpoint_
+    std::vector<Endpoint> endpoints_;
+    std::vector<EndpointState> states_;
+    size_t nextEndpoint_ = 0;  // Endpoint at which the search starts, to balance ties
+};
+
+}
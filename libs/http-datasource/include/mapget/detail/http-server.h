@@ -35,6 +35,13 @@ public:
        uint16_t port = 0,
        uint32_t waitMs = 100);
 
+    /**
+     * Set the number of threads which handle the connections of the server.
+     * Must be called before go(). Connections beyond those wait in a queue.
+     * With zero, the default, httplib's default number of threads is used.
+     */
+    void setThreadPoolSize(size_t numThreads);
+
     /**
      * Returns true if the server is currently running.
      */
@@ -84,6 +91,13 @@ protected:
      */
     void printPortToStdOut(bool enabled);
 
+    /**
+     * Derived servers can use this to announce more about themselves in
+     * the "Running on port <port>" message, e.g. to a parent process.
+     * The text is appended to the port.
+     */
+    [[nodiscard]] virtual std::string portMessageSuffix() const { return {}; }
+
 private:
     struct Impl;
     std::unique_ptr<Impl> impl_;
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+namespace mapget {
+
+/**
+ * Ring buffer in a named shared memory segment, through which a data source
+ * process passes tile blobs to the service which started it, instead of
+ * sending them over loopback HTTP. The data source creates the ring, and
+ * copies each response body into it as a region. The HTTP response then
+ * only carries frames which locate the regions, see writeFrame(). The
+ * service opens the ring by its name, reads the regions in place, and
+ * releases them, so that their space is reused.
+ *
+ * Only the creating process allocates regions. Regions which are not
+ * released within AbandonedRegionTimeout, e.g. because the client
+ * disconnected before it got the response, are reused as well. A reader
+ * which is still reading such a region fails it, see FrameReader.
+ * Shared memory is only supported on POSIX systems.
+ */
+class SharedMemoryRing
+{
+public:
+    /** Request and response header which selects the shared memory transport. */
+    static constexpr auto TransportHeader = "X-Mapget-Transport";
+    static constexpr auto TransportName = "shm";
+
+    /** Default capacity of the ring of a data source server. */
+    static constexpr size_t DefaultCapacity = 64 * 1024 * 1024;
+
+    /** Age after which an unreleased region is reused. */
+    static constexpr std::chrono::seconds AbandonedRegionTimeout{30};
+
+    /**
+     * Create a ring with a unique name. Returns null if shared memory
+     * is not available on the platform, or could not be created.
+     */
+    static std::unique_ptr<SharedMemoryRing> create(size_t capacity);
+
+    /** Open the ring of another process by its name. Throws on failure. */
+    static std::unique_ptr<SharedMemoryRing> open(std::string const& name);
+
+    /** Unmaps the ring, and removes its name if it was created here. */
+    ~SharedMemoryRing();
+
+    [[nodiscard]] std::string const& name() const;
+    [[nodiscard]] size_t capacity() const;
+
+    /**
+     * Remove the name of the ring, so that its memory is freed once
+     * both processes unmapped it. Later open() calls fail.
+     */
+    void unlink();
+
+    /**
+     * Append a frame for the bytes to a response body. The bytes are
+     * copied into a region of the ring if there is space, otherwise
+     * the frame carries them inline.
+     */
+    void writeFrame(std::string_view const& bytes, std::string& body);
+
+    /** Change the age after which the creating process reuses an unreleased region. */
+    void setAbandonedRegionTimeout(std::chrono::nanoseconds timeout);
+
+    /**
+     * Reads the frames of a response body, which may arrive in chunks
+     * of any size, and passes the bytes of each frame on. Regions are
+     * released once the callback returned. Throws if a region was
+     * reused before or while it was read, as it was abandoned.
+     */
+    class FrameReader
+    {
+    public:
+        explicit FrameReader(std::shared_ptr<SharedMemoryRing> ring);
+        void read(std::string_view const& bytes, std::function<void(std::string_view)> const& onBytes);
+
+    private:
+        std::shared_ptr<SharedMemoryRing> ring_;
+        std::string pending_;  // Bytes of an incomplete frame
+    };
+
+private:
+    struct Frame;
+    struct BlockHeader;
+    struct Impl;
+
+    explicit SharedMemoryRing(std::unique_ptr<Impl> impl);
+
+    // Copy bytes into a new region, and describe it in the frame. Returns
+    // false if the ring has no space for them.
+    bool allocate(std::string_view const& bytes, Frame& frame);
+    // Reuse the space of released and abandoned regions. Requires writerMutex_.
+    void reclaim();
+    // Mark the region of a frame as being read, and get its bytes. Throws
+    // if it is out of bounds, or was reused.
+    [[nodiscard]] std::string_view region(Frame const& frame);
+    // Release the region of a frame which is being read. Returns false
+    // if it was reused meanwhile.
+    bool release(Frame const& frame);
+
+    std::unique_ptr<Impl> impl_;
+
+    // State of the creating process, which allocates the regions.
+    std::mutex writerMutex_;
+    uint64_t head_ = 0;  // Position of the next region, increasing beyond the capacity
+    uint64_t tail_ = 0;  // Position of the oldest region which is not reclaimed
+    uint64_t nextSequence_ = 1;
+    std::chrono::nanoseconds abandonedRegionTimeout_ = AbandonedRegionTimeout;
+};
+
+}
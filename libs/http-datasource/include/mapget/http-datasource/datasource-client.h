@@ -3,9 +3,16 @@
 #include "mapget/model/sourcedatalayer.h"
 #include "mapget/model/featurelayer.h"
 #include "mapget/service/datasource.h"
+#include "mapget/service/executor.h"
+#include "mapget/detail/http-connection-pool.h"
+#include "mapget/detail/shared-memory-ring.h"
 #include "httplib.h"
 
+#include <chrono>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
 #include <condition_variable>
 
 namespace TinyProcessLib {
@@ -21,10 +28,16 @@ namespace mapget
 class RemoteDataSource : public DataSource
 {
 public:
+    /** Default timeout for connecting to an endpoint and fetching its info. */
+    static constexpr std::chrono::seconds DefaultInfoTimeout{5};
+
     /**
-     * Construct from joint host:port string.
+     * Construct from joint host:port string, or from a comma-separated
+     * list of them for a source with several endpoints.
      */
-    static std::shared_ptr<RemoteDataSource> fromHostPort(std::string const& hostPort);
+    static std::shared_ptr<RemoteDataSource> fromHostPort(
+        std::string const& hostPort,
+        std::chrono::milliseconds infoTimeout = DefaultInfoTimeout);
 
     /**
      * Construct a DataSource with the host and port of
@@ -33,39 +46,141 @@ public:
      */
     RemoteDataSource(std::string const& host, uint16_t port);
 
+    /**
+     * Construct a DataSource with several endpoints, e.g. replicas of the
+     * same DataSourceServer behind separate ports. Each request goes to the
+     * endpoint with the least outstanding requests. The endpoints must serve
+     * the same map, and have distinct node IDs. Throws if none of them
+     * answers within the info timeout, the others are used once they
+     * are reachable.
+     */
+    explicit RemoteDataSource(
+        std::vector<HttpConnectionPool::Endpoint> const& endpoints,
+        std::chrono::milliseconds infoTimeout = DefaultInfoTimeout);
+
+    /**
+     * Replace an endpoint, e.g. by the new port of a restarted server.
+     * It gets requests once its info was fetched.
+     */
+    void setEndpoint(size_t index, HttpConnectionPool::Endpoint endpoint);
+
+    /**
+     * Receive the tiles of an endpoint on the same machine through its
+     * shared memory ring, see DataSourceServer::setSharedMemoryCapacity().
+     * A null ring switches back to HTTP responses.
+     */
+    void setSharedMemory(size_t endpoint, std::shared_ptr<SharedMemoryRing> ring);
+
     // DataSource method overrides
     DataSourceInfo info() override;
     void fill(TileFeatureLayer::Ptr const& featureTile) override;
     void fill(TileSourceDataLayer::Ptr const& blobTile) override;
-    TileLayer::Ptr get(MapTileKey const& k, Cache::Ptr& cache, DataSourceInfo const& info) override;
+    void fill(TileBinaryLayer::Ptr const& binaryTile) override;
+    TileLayer::Ptr get(
+        MapTileKey const& k,
+        Cache::Ptr& cache,
+        DataSourceInfo const& info,
+        CancellationToken::Ptr const& cancellation = {}) override;
+    /**
+     * Fetch the tiles of a batch, see getBatchAsync(...), and wait for them.
+     */
+    std::vector<TileLayer::Ptr> get(
+        std::vector<MapTileKey> const& keys,
+        Cache::Ptr& cache,
+        DataSourceInfo const& info,
+        std::vector<CancellationToken::Ptr> const& cancellations = {}) override;
+    void getAsync(
+        MapTileKey const& k,
+        Cache::Ptr const& cache,
+        DataSourceInfo const& info,
+        std::function<void(TileLayer::Ptr)> onResult,
+        CancellationToken::Ptr const& cancellation = {}) override;
+    /**
+     * Fetch the tiles of a batch for the same layer with a single `/tiles`
+     * request on the request threads, of which the tiles are read while they
+     * arrive. Tiles which are missing from the response, and all tiles of
+     * remote sources without the endpoint, are fetched in parallel using `/tile`.
+     */
+    void getBatchAsync(
+        std::vector<MapTileKey> const& keys,
+        Cache::Ptr const& cache,
+        DataSourceInfo const& info,
+        std::function<void(std::vector<TileLayer::Ptr>)> onResult,
+        std::vector<CancellationToken::Ptr> const& cancellations = {}) override;
     std::vector<LocateResponse> locate(const mapget::LocateRequest &req) override;
+    std::vector<std::vector<LocateResponse>> locate(std::vector<LocateRequest> const& requests) override;
 
 private:
+    // Fetch the info of an endpoint, and record its node ID. Throws if
+    // the endpoint serves a different map. Used as the health check.
+    bool fetchInfo(size_t endpoint, httplib::Client& client);
+    // Node ID of an endpoint, for its string pool offset.
+    std::string endpointNodeId(size_t endpoint);
+    // Shared memory ring of an endpoint, or null.
+    std::shared_ptr<SharedMemoryRing> sharedMemory(size_t endpoint);
+    // Send a request through a pooled connection. A request which gets
+    // no response is sent once more to another endpoint.
+    httplib::Result send(
+        std::function<httplib::Result(httplib::Client&, size_t endpoint)> const& request,
+        std::function<bool()> const& isCancelled = {});
+
+    // Fetch the tiles of a batch through `/tiles`, and set the received ones in the result.
+    void getBatch(
+        std::vector<MapTileKey> const& keys,
+        Cache::Ptr& cache,
+        DataSourceInfo const& info,
+        std::vector<CancellationToken::Ptr> const& cancellations,
+        std::vector<TileLayer::Ptr>& result);
+
     // DataSourceInfo is fetched in the constructor
     DataSourceInfo info_;
 
     // Error string, written in get() and set in fill().
     std::string error_;
 
-    // Multiple http clients allow parallel GET requests
-    std::vector<httplib::Client> httpClients_;
-    std::atomic_uint64_t nextClient_{0};
+    // Node ID and shared memory ring of each endpoint. The node ID
+    // is empty while the endpoint was never reached.
+    std::mutex endpointsMutex_;
+    std::vector<std::string> endpointNodeIds_;
+    std::vector<std::shared_ptr<SharedMemoryRing>> sharedMemory_;
+
+    // Keep-alive connections to the endpoints, which allow parallel requests.
+    std::unique_ptr<HttpConnectionPool> connections_;
+
+    // Cleared once the remote source turned out to have no `/tiles` endpoint.
+    std::atomic_bool batchEndpointAvailable_{true};
+
+    // Runs the blocking tile requests of getAsync() and getBatchAsync(), one thread per parallel request.
+    // Declared last, so that running requests finish before the connections are destroyed.
+    std::unique_ptr<Executor> requestExecutor_;
 };
 
 /**
  * Remote data source which manages the lifetime of the associated data source
- * server process. Starts the server executable, waits until the server is running
+ * server processes. Starts the server executable, waits until the server is running
  * and ready to serve data, and stops it when it is deleted.
  * Parses the server's "Running on port <port>" message to determine the port.
+ * Several processes of the same executable may be started, e.g. for data sources
+ * which only use one core each. They are presented as a single data source, with
+ * the info and node ID of the first process, and tile jobs are spread over them.
+ * Processes which exit are restarted.
  */
 class RemoteDataSourceProcess : public DataSource
 {
 public:
+    /** Default timeout for the processes to report their port. */
+    static constexpr std::chrono::seconds DefaultStartTimeout{10};
+
     /**
-     * Construct a remote data source with a command-line command.
-     * Throws if the connection fails for any reason or times out after 10 seconds.
+     * Construct a remote data source with a command-line command, which
+     * is run by the given number of processes. Throws if the connection
+     * fails for any reason, or if the processes did not report their
+     * port within the start timeout.
      */
-    RemoteDataSourceProcess(std::string const& commandLine);
+    explicit RemoteDataSourceProcess(
+        std::string const& commandLine,
+        size_t numProcesses = 1,
+        std::chrono::milliseconds startTimeout = DefaultStartTimeout);
 
     /**
      * Destructor ensures that the server process is terminated.
@@ -76,14 +191,54 @@ public:
     DataSourceInfo info() override;
     void fill(TileFeatureLayer::Ptr const& featureTile) override;
     void fill(TileSourceDataLayer::Ptr const& sourceDataLayer) override;
-    TileLayer::Ptr get(MapTileKey const& k, Cache::Ptr& cache, DataSourceInfo const& info) override;
+    void fill(TileBinaryLayer::Ptr const& binaryTile) override;
+    TileLayer::Ptr get(
+        MapTileKey const& k,
+        Cache::Ptr& cache,
+        DataSourceInfo const& info,
+        CancellationToken::Ptr const& cancellation = {}) override;
+    std::vector<TileLayer::Ptr> get(
+        std::vector<MapTileKey> const& keys,
+        Cache::Ptr& cache,
+        DataSourceInfo const& info,
+        std::vector<CancellationToken::Ptr> const& cancellations = {}) override;
+    void getAsync(
+        MapTileKey const& k,
+        Cache::Ptr const& cache,
+        DataSourceInfo const& info,
+        std::function<void(TileLayer::Ptr)> onResult,
+        CancellationToken::Ptr const& cancellation = {}) override;
+    void getBatchAsync(
+        std::vector<MapTileKey> const& keys,
+        Cache::Ptr const& cache,
+        DataSourceInfo const& info,
+        std::function<void(std::vector<TileLayer::Ptr>)> onResult,
+        std::vector<CancellationToken::Ptr> const& cancellations = {}) override;
     std::vector<LocateResponse> locate(const mapget::LocateRequest &req) override;
+    std::vector<std::vector<LocateResponse>> locate(std::vector<LocateRequest> const& requests) override;
+
+    /** Interval at which exited processes are restarted. */
+    static constexpr std::chrono::seconds SupervisionInterval{1};
 
 private:
+    // Start the process at the given index.
+    std::unique_ptr<TinyProcessLib::Process> startProcess(size_t index);
+    // Restart processes which exited, until stopping_ is set.
+    void superviseProcesses();
+    // Kill all processes, and wait until they exited.
+    void stopProcesses();
+    // Open the shared memory ring of a process, or return null on failure.
+    static std::shared_ptr<SharedMemoryRing> openSharedMemory(std::string const& name);
+
+    std::string commandLine_;
     std::unique_ptr<RemoteDataSource> remoteSource_;
-    std::unique_ptr<TinyProcessLib::Process> process_;
-    std::mutex mutex_;
+    std::vector<std::unique_ptr<TinyProcessLib::Process>> processes_;
+    std::mutex mutex_;  // Mutex for ports_, sharedMemory_, stopping_ and processes_ after startup
     std::condition_variable cv_;
+    std::vector<std::optional<uint16_t>> ports_;  // Port of each process, once it was reported
+    std::vector<std::shared_ptr<SharedMemoryRing>> sharedMemory_;  // Ring of each process, or null
+    bool stopping_ = false;
+    std::thread supervisor_;
 };
 
 }
@@ -1,9 +1,11 @@
 #pragma once
 
 #include <functional>
+#include "mapget/model/binarylayer.h"
 #include "mapget/model/sourcedatalayer.h"
 #include "mapget/model/featurelayer.h"
 #include "mapget/detail/http-server.h"
+#include "mapget/service/cache.h"
 #include "mapget/service/locate.h"
 
 namespace mapget
@@ -31,10 +33,23 @@ public:
      * The callback argument is a fresh Tile*Layer instance, which the callback
      * must fill according to the set Tile*Layer's layer info and tile id.
      * If an error occurs while filling the tile, the callback can use
-     * TileLayer::setError(...) to signal the error downstream.
+     * TileLayer::setError(...) to signal the error downstream. If the client
+     * disconnects, TileLayer::isCancelled() returns true, so expensive
+     * callbacks may stop early.
      */
     DataSourceServer& onTileFeatureRequest(std::function<void(TileFeatureLayer::Ptr)> const&);
     DataSourceServer& onTileSourceDataRequest(std::function<void(TileSourceDataLayer::Ptr)> const&);
+    DataSourceServer& onTileBinaryRequest(std::function<void(TileBinaryLayer::Ptr)> const&);
+
+    /**
+     * Set the callback which fills a batch of up to DataSourceInfo::maxBatchSize_
+     * feature tiles of the same layer at once, like DataSource::fill(...) for
+     * a batch. It is invoked for the tiles of a `/tiles`-request, which are
+     * streamed to the client batch by batch. Without it, the tiles are filled
+     * one by one using the onTileFeatureRequest() callback.
+     */
+    DataSourceServer&
+    onTileFeatureBatchRequest(std::function<void(std::vector<TileFeatureLayer::Ptr> const&)> const&);
 
     /**
      * Set the callback which will be invoked when a `/locate`-request is received.
@@ -44,6 +59,33 @@ public:
     DataSourceServer&
     onLocateRequest(std::function<std::vector<LocateResponse>(LocateRequest const&)> const&);
 
+    /**
+     * Set the capacity of the shared memory ring, through which the service
+     * which started this server as a RemoteDataSourceProcess receives the
+     * tiles. The ring is announced in the "Running on port" message. Must be
+     * called before go(). Zero disables the ring, then all tiles are sent
+     * over HTTP. Defaults to SharedMemoryRing::DefaultCapacity.
+     */
+    DataSourceServer& setSharedMemoryCapacity(size_t bytes);
+
+    /**
+     * Set a cache for the filled tiles, so that repeated requests, e.g. from
+     * several mapget services, do not fill the same tile again. Tiles expire
+     * by the ttl of their layer. The tiles use the string pool of the cache
+     * from now on, so it must be called before go(). By default, there is
+     * no cache. Either way, concurrent requests for the same tile wait for
+     * a single fill.
+     */
+    DataSourceServer& setCache(Cache::Ptr cache);
+
+    /**
+     * Set the number of threads which run the fill callbacks. Requests wait
+     * for a fill thread, so this bounds the number of concurrent fills, which
+     * is otherwise only bounded by the HTTP thread pool. Must be called before
+     * go(). Zero fills the tiles on the HTTP threads, which is the default.
+     */
+    DataSourceServer& setFillThreadPoolSize(size_t numThreads);
+
     /**
      * Get the DataSourceInfo metadata which this instance was constructed with.
      */
@@ -51,6 +93,7 @@ public:
 
 private:
     void setup(httplib::Server&) override;
+    [[nodiscard]] std::string portMessageSuffix() const override;
 
     struct Impl;
     std::unique_ptr<Impl> impl_;
@@ -1,33 +1,189 @@
 #include "datasource-client.h"
+#include "mapget/detail/http-compression.h"
 #include "mapget/model/sourcedatalayer.h"
 #include "process.hpp"
 #include "mapget/log.h"
+#include "mapget/service/tracing.h"
 
+#include <algorithm>
 #include <chrono>
+#include <future>
 #include <regex>
+#include <unordered_map>
 
 namespace mapget
 {
 
+namespace
+{
+
+/**
+ * Limits the read timeout of a pooled client to the time which is left
+ * until a deadline, e.g. that of the tiles' cancellation tokens, see
+ * CancellationToken::setDeadline(). The default timeout is restored
+ * once the request is done.
+ */
+class DeadlineTimeout
+{
+public:
+    DeadlineTimeout(httplib::Client& client, std::optional<std::chrono::steady_clock::time_point> deadline)
+        : client_(client)
+    {
+        using namespace std::chrono;
+        if (!deadline)
+            return;
+        auto const defaultTimeout =
+            seconds(CPPHTTPLIB_READ_TIMEOUT_SECOND) + microseconds(CPPHTTPLIB_READ_TIMEOUT_USECOND);
+        auto remaining = std::max(duration_cast<microseconds>(*deadline - steady_clock::now()), microseconds(1000));
+        if (remaining >= defaultTimeout)
+            return;
+        client_.set_read_timeout(remaining);
+        limited_ = true;
+    }
+
+    ~DeadlineTimeout()
+    {
+        if (limited_)
+            client_.set_read_timeout(CPPHTTPLIB_READ_TIMEOUT_SECOND, CPPHTTPLIB_READ_TIMEOUT_USECOND);
+    }
+
+    DeadlineTimeout(DeadlineTimeout const&) = delete;
+    DeadlineTimeout& operator=(DeadlineTimeout const&) = delete;
+
+private:
+    httplib::Client& client_;
+    bool limited_ = false;
+};
+
+/** Latest deadline of the given tokens, nullopt if any of them has none. */
+std::optional<std::chrono::steady_clock::time_point> latestDeadline(
+    std::vector<CancellationToken::Ptr> const& cancellations,
+    size_t numTiles)
+{
+    if (cancellations.size() != numTiles || numTiles == 0)
+        return {};
+    std::optional<std::chrono::steady_clock::time_point> result;
+    for (auto const& cancellation : cancellations) {
+        auto deadline = cancellation ? cancellation->deadline() : std::nullopt;
+        if (!deadline)
+            return {};
+        result = result ? std::max(*result, *deadline) : *deadline;
+    }
+    return result;
+}
+
+}  // namespace
+
 RemoteDataSource::RemoteDataSource(const std::string& host, uint16_t port)
+    : RemoteDataSource(std::vector<HttpConnectionPool::Endpoint>{{host, port}})
+{
+}
+
+RemoteDataSource::RemoteDataSource(
+    std::vector<HttpConnectionPool::Endpoint> const& endpoints,
+    std::chrono::milliseconds infoTimeout)
+    : endpointNodeIds_(endpoints.size()), sharedMemory_(endpoints.size())
+{
+    // Fetch data source info from the first reachable endpoint.
+    std::vector<bool> reachable;
+    for (auto i = 0u; i < endpoints.size(); ++i) {
+        httplib::Client client(endpoints[i].host_, endpoints[i].port_);
+        client.set_connection_timeout(infoTimeout);
+        client.set_read_timeout(infoTimeout);
+        try {
+            reachable.push_back(fetchInfo(i, client));
+        }
+        catch (std::exception& e) {
+            if (endpoints.size() == 1)
+                throw;
+            log().warn("Remote data source {}:{} is unusable: {}", endpoints[i].host_, endpoints[i].port_, e.what());
+            reachable.push_back(false);
+        }
+    }
+    if (info_.mapId_.empty())
+        raise("Failed to fetch datasource info.");
+
+    // Keep a connection per parallel request of an endpoint. Endpoints which
+    // did not answer are backed off, and used once their /info is available.
+    // Each endpoint may run the parallel jobs of the source.
+    auto maxParallelRequests = static_cast<size_t>(std::max(info_.maxParallelJobs_, 1));
+    info_.maxParallelJobs_ = static_cast<int>(maxParallelRequests * endpoints.size());
+    connections_ = std::make_unique<HttpConnectionPool>(
+        endpoints,
+        maxParallelRequests,
+        [this](size_t endpoint, httplib::Client& client) { return fetchInfo(endpoint, client); });
+    for (auto i = 0u; i < endpoints.size(); ++i) {
+        if (!reachable[i])
+            connections_->setFailed(i);
+    }
+    requestExecutor_ = std::make_unique<Executor>(maxParallelRequests * endpoints.size());
+}
+
+bool RemoteDataSource::fetchInfo(size_t endpoint, httplib::Client& client)
 {
-    // Fetch data source info.
-    httplib::Client client(host, port);
     auto fetchedInfoJson = client.Get("/info");
     if (!fetchedInfoJson || fetchedInfoJson->status >= 300)
-        raise("Failed to fetch datasource info.");
-    info_ = DataSourceInfo::fromJson(nlohmann::json::parse(fetchedInfoJson->body));
+        return false;
+    auto fetchedInfo = DataSourceInfo::fromJson(nlohmann::json::parse(fetchedInfoJson->body));
 
-    if (info_.nodeId_.empty()) {
+    if (fetchedInfo.nodeId_.empty()) {
         // Unique node IDs are required for the string pool offsets.
         raise(
             fmt::format("Remote data source is missing node ID! Source info: {}",
                 fetchedInfoJson->body));
     }
 
-    // Create as many clients as parallel requests are allowed.
-    for (auto i = 0; i < std::max(info_.maxParallelJobs_, 1); ++i)
-        httpClients_.emplace_back(host, port);
+    std::lock_guard lock(endpointsMutex_);
+    if (info_.mapId_.empty())
+        info_ = fetchedInfo;
+    else if (fetchedInfo.mapId_ != info_.mapId_)
+        raise(fmt::format("Remote data source serves map {} instead of {}.", fetchedInfo.mapId_, info_.mapId_));
+
+    // The endpoints have separate string pools, which must not share a node ID.
+    for (auto i = 0u; i < endpointNodeIds_.size(); ++i) {
+        if (i != endpoint && endpointNodeIds_[i] == fetchedInfo.nodeId_)
+            raise(fmt::format("Remote data source endpoints share the node ID {}.", fetchedInfo.nodeId_));
+    }
+    endpointNodeIds_[endpoint] = fetchedInfo.nodeId_;
+    return true;
+}
+
+std::string RemoteDataSource::endpointNodeId(size_t endpoint)
+{
+    std::lock_guard lock(endpointsMutex_);
+    return endpointNodeIds_[endpoint];
+}
+
+void RemoteDataSource::setSharedMemory(size_t endpoint, std::shared_ptr<SharedMemoryRing> ring)
+{
+    std::lock_guard lock(endpointsMutex_);
+    sharedMemory_[endpoint] = std::move(ring);
+}
+
+std::shared_ptr<SharedMemoryRing> RemoteDataSource::sharedMemory(size_t endpoint)
+{
+    std::lock_guard lock(endpointsMutex_);
+    return sharedMemory_[endpoint];
+}
+
+httplib::Result RemoteDataSource::send(
+    std::function<httplib::Result(httplib::Client&, size_t endpoint)> const& request,
+    std::function<bool()> const& isCancelled)
+{
+    // A request which gets no response is sent once more to another endpoint.
+    httplib::Result result{nullptr, httplib::Error::Connection};
+    std::optional<size_t> failedEndpoint;
+    for (auto attempt = 0; attempt < 2; ++attempt) {
+        auto connection = connections_->acquire(failedEndpoint);
+        if (!connection)
+            break;
+        result = request(connection->client(), connection->endpoint());
+        if (result || (isCancelled && isCancelled()))
+            break;
+        connection->setFailed();
+        failedEndpoint = connection->endpoint();
+    }
+    return result;
 }
 
 DataSourceInfo RemoteDataSource::info()
@@ -47,18 +203,54 @@ void RemoteDataSource::fill(const TileSourceDataLayer::Ptr& blobTile)
     blobTile->setError(fmt::format("Error while contacting remote data source: {}", error_));
 }
 
-TileLayer::Ptr
-RemoteDataSource::get(const MapTileKey& k, Cache::Ptr& cache, const DataSourceInfo& info)
+void RemoteDataSource::fill(const TileBinaryLayer::Ptr& binaryTile)
 {
-    // Round-robin usage of http clients to facilitate parallel requests.
-    auto& client = httpClients_[(nextClient_++) % httpClients_.size()];
+    // If we get here, an error occurred.
+    binaryTile->setError(fmt::format("Error while contacting remote data source: {}", error_));
+}
 
-    // Send a GET tile request.
-    auto tileResponse = client.Get(fmt::format(
-        "/tile?layer={}&tileId={}&stringPoolOffset={}",
-        k.layerId_,
-        k.tileId_.value_,
-        cachedStringPoolOffset(info.nodeId_, cache)));
+TileLayer::Ptr RemoteDataSource::get(
+    const MapTileKey& k,
+    Cache::Ptr& cache,
+    const DataSourceInfo& info,
+    CancellationToken::Ptr const& cancellation)
+{
+    auto isCancelled = [&cancellation]() { return cancellation && cancellation->isCancelled(); };
+    if (isCancelled())
+        return nullptr;
+
+    // The trace context is passed on to the remote server,
+    // which records its spans as children of this one.
+    Span span("mapget.remote.get", TraceContext::current(), SpanKind::Client);
+    span.setAttribute("mapget.tile", k.toString());
+    httplib::Headers headers{{"Accept-Encoding", ZstdContentEncoding}};
+    if (span.context().isValid())
+        headers.emplace(TraceParentHeader, span.context().toTraceParent());
+
+    // Send a GET tile request. The download is stopped if the tile is
+    // cancelled, which closes the connection to the remote server. A tile
+    // with a deadline waits for the server no longer than until then.
+    std::shared_ptr<SharedMemoryRing> ring;
+    auto tileResponse = send(
+        [&](httplib::Client& client, size_t endpoint)
+        {
+            DeadlineTimeout timeout(client, cancellation ? cancellation->deadline() : std::nullopt);
+            ring = sharedMemory(endpoint);
+            auto endpointHeaders = headers;
+            if (ring)
+                endpointHeaders.emplace(SharedMemoryRing::TransportHeader, SharedMemoryRing::TransportName);
+            return client.Get(
+                fmt::format(
+                    "/tile?layer={}&tileId={}&stringPoolOffset={}",
+                    k.layerId_,
+                    k.tileId_.value_,
+                    cachedStringPoolOffset(endpointNodeId(endpoint), cache)),
+                endpointHeaders,
+                [&isCancelled](uint64_t, uint64_t) { return !isCancelled(); });
+        },
+        isCancelled);
+    if (isCancelled())
+        return nullptr;
 
     // Check that the response is OK.
     if (!tileResponse || tileResponse->status >= 300) {
@@ -80,10 +272,11 @@ RemoteDataSource::get(const MapTileKey& k, Cache::Ptr& cache, const DataSourceIn
         else {
             error_ = "No remote response.";
         }
+        span.setError(error_);
 
         // Use tile instantiation logic of the base class,
         // the error is then set in fill().
-        return DataSource::get(k, cache, info);
+        return DataSource::get(k, cache, info, cancellation);
     }
 
     // Check the response body for expected content.
@@ -92,19 +285,283 @@ RemoteDataSource::get(const MapTileKey& k, Cache::Ptr& cache, const DataSourceIn
         [&](auto&& mapId, auto&& layerId) { return info.getLayer(std::string(layerId)); },
         [&](auto&& tile) { result = tile; },
         cache);
-    reader.read(tileResponse->body);
+    if (tileResponse->get_header_value(SharedMemoryRing::TransportHeader) == SharedMemoryRing::TransportName) {
+        if (!ring)
+            raise("Remote data source sent a tile through unknown shared memory.");
+        SharedMemoryRing::FrameReader(ring).read(tileResponse->body, [&](auto&& bytes) { reader.read(bytes); });
+    }
+    else if (tileResponse->get_header_value("Content-Encoding") == ZstdContentEncoding) {
+        std::string body;
+        ZstdStreamDecompressor().decompress(tileResponse->body, body);
+        reader.read(std::make_shared<const std::string>(std::move(body)));
+    }
+    else {
+        // Binary layers refer to their payload in the shared body.
+        reader.read(std::make_shared<const std::string>(std::move(tileResponse->body)));
+    }
 
     return result;
 }
 
-std::vector<LocateResponse> RemoteDataSource::locate(const LocateRequest& req)
+std::vector<TileLayer::Ptr> RemoteDataSource::get(
+    std::vector<MapTileKey> const& keys,
+    Cache::Ptr& cache,
+    DataSourceInfo const& info,
+    std::vector<CancellationToken::Ptr> const& cancellations)
+{
+    std::promise<std::vector<TileLayer::Ptr>> result;
+    auto received = result.get_future();
+    getBatchAsync(
+        keys,
+        cache,
+        info,
+        [&result](std::vector<TileLayer::Ptr> layers) { result.set_value(std::move(layers)); },
+        cancellations);
+    return received.get();
+}
+
+void RemoteDataSource::getBatchAsync(
+    std::vector<MapTileKey> const& keys,
+    Cache::Ptr const& cache,
+    DataSourceInfo const& info,
+    std::function<void(std::vector<TileLayer::Ptr>)> onResult,
+    std::vector<CancellationToken::Ptr> const& cancellations)
+{
+    requestExecutor_->post(
+        [this,
+         keys,
+         cachePtr = cache,
+         info,
+         onResult = std::move(onResult),
+         cancellations,
+         trace = TraceContext::current()]() mutable
+        {
+            TraceScope traceScope(trace);
+            auto cancellationAt = [&cancellations](size_t i)
+            { return i < cancellations.size() ? cancellations[i] : CancellationToken::Ptr{}; };
+            auto isCancelled = [&](size_t i) { return cancellationAt(i) && cancellationAt(i)->isCancelled(); };
+
+            std::vector<TileLayer::Ptr> result(keys.size());
+            auto isLayerBatch = keys.size() > 1 && std::all_of(
+                keys.begin(), keys.end(), [&keys](auto const& k) {
+                    return k.layer_ == keys.front().layer_ && k.layerId_ == keys.front().layerId_;
+                });
+            if (isLayerBatch && batchEndpointAvailable_) {
+                try {
+                    getBatch(keys, cachePtr, info, cancellations, result);
+                }
+                catch (std::exception& e) {
+                    log().error("Could not fetch remote tile batch: {}", e.what());
+                }
+            }
+
+            std::vector<size_t> missing;
+            for (auto i = 0u; i < keys.size(); ++i) {
+                if (!result[i] && !isCancelled(i))
+                    missing.emplace_back(i);
+            }
+            if (missing.empty()) {
+                onResult(std::move(result));
+                return;
+            }
+
+            // The remaining tiles are fetched one by one, in parallel on the request
+            // threads. This task does not wait for them, as it runs on one of these
+            // threads: the last received tile passes the result on.
+            struct Pending
+            {
+                std::mutex mutex;
+                std::vector<TileLayer::Ptr> result;
+                size_t numPending = 0;
+                std::function<void(std::vector<TileLayer::Ptr>)> onResult;
+            };
+            auto pending = std::make_shared<Pending>();
+            pending->result = std::move(result);
+            pending->numPending = missing.size();
+            pending->onResult = std::move(onResult);
+            for (auto i : missing) {
+                getAsync(
+                    keys[i],
+                    cachePtr,
+                    info,
+                    [pending, i](TileLayer::Ptr layer)
+                    {
+                        {
+                            std::lock_guard lock(pending->mutex);
+                            pending->result[i] = std::move(layer);
+                            if (--pending->numPending > 0)
+                                return;
+                        }
+                        pending->onResult(std::move(pending->result));
+                    },
+                    cancellationAt(i));
+            }
+        });
+}
+
+void RemoteDataSource::getBatch(
+    std::vector<MapTileKey> const& keys,
+    Cache::Ptr& cache,
+    DataSourceInfo const& info,
+    std::vector<CancellationToken::Ptr> const& cancellations,
+    std::vector<TileLayer::Ptr>& result)
+{
+    // The download is stopped once all tiles are cancelled.
+    auto allCancelled = [&cancellations, &keys]()
+    {
+        return cancellations.size() == keys.size() && std::all_of(
+            cancellations.begin(), cancellations.end(), [](auto const& c) { return c && c->isCancelled(); });
+    };
+
+    // A batch is not sent again, as the tiles are read while they arrive.
+    // The tiles which were not received are then fetched one by one.
+    auto connection = connections_->acquire();
+    if (!connection)
+        return;
+
+    Span span("mapget.remote.get-batch", TraceContext::current(), SpanKind::Client);
+    span.setAttribute("mapget.layer", keys.front().layerId_);
+    span.setAttribute("mapget.batch_size", static_cast<int64_t>(keys.size()));
+    httplib::Headers headers{{"Accept-Encoding", ZstdContentEncoding}};
+    if (span.context().isValid())
+        headers.emplace(TraceParentHeader, span.context().toTraceParent());
+    auto ring = sharedMemory(connection->endpoint());
+    if (ring)
+        headers.emplace(SharedMemoryRing::TransportHeader, SharedMemoryRing::TransportName);
+
+    std::string tileIds;
+    for (auto const& k : keys) {
+        if (!tileIds.empty())
+            tileIds += ',';
+        tileIds += std::to_string(k.tileId_.value_);
+    }
+
+    // The tiles are read while they arrive, so that the string pool
+    // updates of the stream are applied to the cache in order.
+    std::unordered_map<uint64_t, TileLayer::Ptr> receivedTiles;
+    std::vector<uint64_t> regionTileIds;  // Tiles of the shared memory region which is being read
+    TileLayerStream::Reader reader(
+        [&](auto&& mapId, auto&& layerId) { return info.getLayer(std::string(layerId)); },
+        [&](auto&& tile)
+        {
+            receivedTiles[tile->tileId().value_] = tile;
+            regionTileIds.push_back(tile->tileId().value_);
+        },
+        cache);
+    int status = 0;
+    std::unique_ptr<ZstdStreamDecompressor> decompressor;
+    std::unique_ptr<SharedMemoryRing::FrameReader> frameReader;
+    std::string decompressed;
+    try {
+        DeadlineTimeout timeout(connection->client(), latestDeadline(cancellations, keys.size()));
+        auto tilesResponse = connection->client().Get(
+            fmt::format(
+                "/tiles?layer={}&tileIds={}&stringPoolOffset={}",
+                keys.front().layerId_,
+                tileIds,
+                cachedStringPoolOffset(endpointNodeId(connection->endpoint()), cache)),
+            headers,
+            [&](httplib::Response const& response)
+            {
+                status = response.status;
+                if (response.get_header_value(SharedMemoryRing::TransportHeader) == SharedMemoryRing::TransportName) {
+                    if (!ring)
+                        raise("Remote data source sent tiles through unknown shared memory.");
+                    frameReader = std::make_unique<SharedMemoryRing::FrameReader>(ring);
+                }
+                else if (response.get_header_value("Content-Encoding") == ZstdContentEncoding)
+                    decompressor = std::make_unique<ZstdStreamDecompressor>();
+                return true;
+            },
+            [&](const char* data, size_t size)
+            {
+                if (status != 200)
+                    return true;
+                std::string_view bytes(data, size);
+                if (frameReader) {
+                    try {
+                        frameReader->read(bytes, [&](auto&& regionBytes) {
+                            regionTileIds.clear();
+                            reader.read(regionBytes);
+                        });
+                    }
+                    catch (...) {
+                        // The tiles of a region which was reused while it was read are dropped.
+                        for (auto tileId : regionTileIds)
+                            receivedTiles.erase(tileId);
+                        throw;
+                    }
+                }
+                else if (decompressor) {
+                    decompressed.clear();
+                    decompressor->decompress(bytes, decompressed);
+                    reader.read(decompressed);
+                }
+                else
+                    reader.read(bytes);
+                return !allCancelled();
+            });
+        if (!tilesResponse && !allCancelled()) {
+            connection->setFailed();
+            span.setError(httplib::to_string(tilesResponse.error()));
+        }
+    }
+    catch (std::exception& e) {
+        log().warn("Could not read the tiles of layer {}: {}", keys.front().layerId_, e.what());
+        span.setError(e.what());
+    }
+
+    // Remote sources of older versions have no /tiles endpoint.
+    if (status == 404) {
+        log().debug("Remote data source has no /tiles endpoint, fetching tiles one by one.");
+        batchEndpointAvailable_ = false;
+    }
+    for (auto i = 0u; i < keys.size(); ++i) {
+        auto it = receivedTiles.find(keys[i].tileId_.value_);
+        if (it != receivedTiles.end())
+            result[i] = it->second;
+    }
+}
+
+void RemoteDataSource::setEndpoint(size_t index, HttpConnectionPool::Endpoint endpoint)
 {
-    // Round-robin usage of http clients to facilitate parallel requests.
-    auto& client = httpClients_[(nextClient_++) % httpClients_.size()];
+    connections_->setEndpoint(index, std::move(endpoint));
+}
 
-    // Send a GET tile request.
-    auto locateResponse = client.Post(
-        fmt::format("/locate"), req.serialize().dump(), "application/json");
+void RemoteDataSource::getAsync(
+    MapTileKey const& k,
+    Cache::Ptr const& cache,
+    DataSourceInfo const& info,
+    std::function<void(TileLayer::Ptr)> onResult,
+    CancellationToken::Ptr const& cancellation)
+{
+    requestExecutor_->post(
+        [this,
+         k,
+         cachePtr = cache,
+         info,
+         onResult = std::move(onResult),
+         cancellation,
+         trace = TraceContext::current()]() mutable
+        {
+            TraceScope traceScope(trace);
+            TileLayer::Ptr result;
+            try {
+                result = get(k, cachePtr, info, cancellation);
+            }
+            catch (std::exception& e) {
+                log().error("Could not fetch remote tile {}: {}", k.toString(), e.what());
+            }
+            onResult(std::move(result));
+        });
+}
+
+std::vector<LocateResponse> RemoteDataSource::locate(const LocateRequest& req)
+{
+    // Send a POST locate request.
+    auto locateResponse = send(
+        [&](httplib::Client& client, size_t)
+        { return client.Post("/locate", req.serialize().dump(), "application/json"); });
 
     // Check that the response is OK.
     if (!locateResponse || locateResponse->status >= 300) {
@@ -129,18 +586,115 @@ std::vector<LocateResponse> RemoteDataSource::locate(const LocateRequest& req)
     return responseVector;
 }
 
-std::shared_ptr<RemoteDataSource> RemoteDataSource::fromHostPort(const std::string& hostPort)
+std::vector<std::vector<LocateResponse>> RemoteDataSource::locate(std::vector<LocateRequest> const& requests)
+{
+    // Send all requests as one JSON array.
+    auto requestsJson = nlohmann::json::array();
+    for (auto const& req : requests)
+        requestsJson.emplace_back(req.serialize());
+    auto locateResponse = send(
+        [&](httplib::Client& client, size_t)
+        { return client.Post("/locate", requestsJson.dump(), "application/json"); });
+
+    // Remote sources without batch support reject the array,
+    // so fall back to one request per locate call.
+    if (!locateResponse || locateResponse->status >= 300)
+        return DataSource::locate(requests);
+    auto responseJson = nlohmann::json::parse(locateResponse->body);
+    if (!responseJson.is_array() || responseJson.size() != requests.size())
+        return DataSource::locate(requests);
+
+    // Parse the resulting responses for each request.
+    std::vector<std::vector<LocateResponse>> result;
+    result.reserve(requests.size());
+    for (auto const& responsesJson : responseJson) {
+        auto& responseVector = result.emplace_back();
+        for (auto const& responseJsonAlternative : responsesJson)
+            responseVector.emplace_back(responseJsonAlternative);
+    }
+    return result;
+}
+
+std::shared_ptr<RemoteDataSource> RemoteDataSource::fromHostPort(
+    std::string const& hostPort,
+    std::chrono::milliseconds infoTimeout)
+{
+    std::vector<HttpConnectionPool::Endpoint> endpoints;
+    size_t start = 0;
+    while (start < hostPort.size()) {
+        auto end = std::min(hostPort.find(',', start), hostPort.size());
+        auto endpoint = hostPort.substr(start, end - start);
+        start = end + 1;
+        auto delimiterPos = endpoint.find(':');
+        std::string dsHost = endpoint.substr(0, delimiterPos);
+        int dsPort = std::stoi(endpoint.substr(delimiterPos + 1, endpoint.size()));
+        log().info("Connecting to datasource at {}:{}.", dsHost, dsPort);
+        endpoints.push_back({dsHost, static_cast<uint16_t>(dsPort)});
+    }
+    return std::make_shared<RemoteDataSource>(endpoints, infoTimeout);
+}
+
+RemoteDataSourceProcess::RemoteDataSourceProcess(
+    std::string const& commandLine,
+    size_t numProcesses,
+    std::chrono::milliseconds startTimeout)
+    : commandLine_(commandLine),
+      ports_(std::max<size_t>(numProcesses, 1)),
+      sharedMemory_(ports_.size())
 {
-    auto delimiterPos = hostPort.find(':');
-    std::string dsHost = hostPort.substr(0, delimiterPos);
-    int dsPort = std::stoi(hostPort.substr(delimiterPos + 1, hostPort.size()));
-    log().info("Connecting to datasource at {}:{}.", dsHost, dsPort);
-    return std::make_shared<RemoteDataSource>(dsHost, dsPort);
+    for (auto i = 0u; i < ports_.size(); ++i)
+        processes_.emplace_back(startProcess(i));
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto allStarted = [this]
+    { return std::all_of(ports_.begin(), ports_.end(), [](auto const& port) { return port.has_value(); }); };
+#if defined(NDEBUG)
+    if (!cv_.wait_for(lock, startTimeout, allStarted))
+    {
+        lock.unlock();
+        stopProcesses();
+        raise(
+            "Timeout waiting for the child process to initialize the remote data source.");
+    }
+#else
+    log().warn("Using Debug build: will wait forever!");
+    cv_.wait(lock, allStarted);
+#endif
+
+    std::vector<HttpConnectionPool::Endpoint> endpoints;
+    for (auto const& port : ports_)
+        endpoints.push_back({"127.0.0.1", *port});
+    lock.unlock();
+    try {
+        remoteSource_ = std::make_unique<RemoteDataSource>(endpoints);
+        lock.lock();
+        for (auto i = 0u; i < sharedMemory_.size(); ++i)
+            remoteSource_->setSharedMemory(i, sharedMemory_[i]);
+        lock.unlock();
+    }
+    catch (...) {
+        stopProcesses();
+        throw;
+    }
+    supervisor_ = std::thread([this] { superviseProcesses(); });
+}
+
+RemoteDataSourceProcess::~RemoteDataSourceProcess()
+{
+    if (supervisor_.joinable()) {
+        {
+            std::lock_guard lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_all();
+        supervisor_.join();
+    }
+    stopProcesses();
 }
 
-RemoteDataSourceProcess::RemoteDataSourceProcess(std::string const& commandLine)
+std::unique_ptr<TinyProcessLib::Process> RemoteDataSourceProcess::startProcess(size_t index)
 {
-    auto stderrCallback = [this](const char* bytes, size_t n)
+    auto stderrCallback = [](const char* bytes, size_t n)
     {
         auto output = std::string(bytes, n);
         // Trim trailing newline/whitespace.
@@ -148,54 +702,88 @@ RemoteDataSourceProcess::RemoteDataSourceProcess(std::string const& commandLine)
         std::cerr << output << std::endl;
     };
 
-    auto stdoutCallback = [this](const char* bytes, size_t n)
+    auto stdoutCallback = [this, index](const char* bytes, size_t n)
     {
         auto output = std::string(bytes, n);
         // Trim trailing newline/whitespace.
         output.erase(output.find_last_not_of(" \n\r\t")+1);
-        if (!remoteSource_) {
-            // Extract port number from the message "Running on port <port>".
-            std::regex port_regex(R"(Running on port (\d+))");
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!ports_[index]) {
+            // Extract port number from the message "Running on port <port>",
+            // which may name the shared memory ring of the process.
+            std::regex port_regex(R"(Running on port (\d+)(?:, shared memory (\S+))?)");
             std::smatch matches;
             if (std::regex_search(output, matches, port_regex)) {
                 if (matches.size() > 1) {
-                    std::lock_guard<std::mutex> lock(mutex_);
                     uint16_t port = std::stoi(matches.str(1));
-                    remoteSource_ = std::make_unique<RemoteDataSource>("127.0.0.1", port);
+                    ports_[index] = port;
+                    sharedMemory_[index] = matches[2].matched ? openSharedMemory(matches.str(2)) : nullptr;
+                    // A restarted process gets requests once it is reachable.
+                    if (remoteSource_) {
+                        remoteSource_->setSharedMemory(index, sharedMemory_[index]);
+                        remoteSource_->setEndpoint(index, {"127.0.0.1", port});
+                    }
                     cv_.notify_all();
                 }
                 return;
             }
         }
+        lock.unlock();
 
         log().debug("datasource stdout: {}", output);
     };
 
-    process_ = std::make_unique<TinyProcessLib::Process>(
-        commandLine,
+    return std::make_unique<TinyProcessLib::Process>(
+        commandLine_,
         "",
         stdoutCallback,
         stderrCallback,
         true);
+}
+
+std::shared_ptr<SharedMemoryRing> RemoteDataSourceProcess::openSharedMemory(std::string const& name)
+{
+    try {
+        std::shared_ptr<SharedMemoryRing> ring = SharedMemoryRing::open(name);
+        // The mapping stays valid, and the memory is freed with the
+        // last mapping, even if one of the processes crashes.
+        ring->unlink();
+        return ring;
+    }
+    catch (std::exception const& e) {
+        log().warn("Receiving tiles over HTTP instead of shared memory: {}", e.what());
+        return nullptr;
+    }
+}
 
+void RemoteDataSourceProcess::superviseProcesses()
+{
     std::unique_lock<std::mutex> lock(mutex_);
-#if defined(NDEBUG)
-    if (!cv_.wait_for(lock, std::chrono::seconds(10), [this] { return remoteSource_ != nullptr; }))
-    {
-        raise(
-            "Timeout waiting for the child process to initialize the remote data source.");
+    while (!cv_.wait_for(lock, SupervisionInterval, [this] { return stopping_; })) {
+        for (auto i = 0u; i < processes_.size(); ++i) {
+            int exitStatus = 0;
+            if (!processes_[i]->try_get_exit_status(exitStatus))
+                continue;
+            log().warn("Data source process {} exited with status {}, restarting it.", i, exitStatus);
+            auto exitedProcess = std::move(processes_[i]);
+            ports_[i].reset();
+            // The output of the exited process is read to its end without the lock.
+            lock.unlock();
+            exitedProcess.reset();
+            auto process = startProcess(i);
+            lock.lock();
+            processes_[i] = std::move(process);
+        }
     }
-#else
-    log().warn("Using Debug build: will wait forever!");
-    cv_.wait(lock, [this] { return remoteSource_ != nullptr; });
-#endif
 }
 
-RemoteDataSourceProcess::~RemoteDataSourceProcess()
+void RemoteDataSourceProcess::stopProcesses()
 {
-    if (process_) {
-        process_->kill(true);
-        process_->get_exit_status();
+    for (auto& process : processes_) {
+        if (process) {
+            process->kill(true);
+            process->get_exit_status();
+        }
     }
 }
 
@@ -221,12 +809,57 @@ void RemoteDataSourceProcess::fill(TileSourceDataLayer::Ptr const& sourceDataLay
     remoteSource_->fill(sourceDataLayer);
 }
 
-TileLayer::Ptr
-RemoteDataSourceProcess::get(MapTileKey const& k, Cache::Ptr& cache, DataSourceInfo const& info)
+void RemoteDataSourceProcess::fill(TileBinaryLayer::Ptr const& binaryTile)
+{
+    if (!remoteSource_)
+        raise("Remote data source is not initialized.");
+    remoteSource_->fill(binaryTile);
+}
+
+TileLayer::Ptr RemoteDataSourceProcess::get(
+    MapTileKey const& k,
+    Cache::Ptr& cache,
+    DataSourceInfo const& info,
+    CancellationToken::Ptr const& cancellation)
+{
+    if (!remoteSource_)
+        raise("Remote data source is not initialized.");
+    return remoteSource_->get(k, cache, info, cancellation);
+}
+
+std::vector<TileLayer::Ptr> RemoteDataSourceProcess::get(
+    std::vector<MapTileKey> const& keys,
+    Cache::Ptr& cache,
+    DataSourceInfo const& info,
+    std::vector<CancellationToken::Ptr> const& cancellations)
+{
+    if (!remoteSource_)
+        raise("Remote data source is not initialized.");
+    return remoteSource_->get(keys, cache, info, cancellations);
+}
+
+void RemoteDataSourceProcess::getAsync(
+    MapTileKey const& k,
+    Cache::Ptr const& cache,
+    DataSourceInfo const& info,
+    std::function<void(TileLayer::Ptr)> onResult,
+    CancellationToken::Ptr const& cancellation)
 {
     if (!remoteSource_)
         raise("Remote data source is not initialized.");
-    return remoteSource_->get(k, cache, info);
+    remoteSource_->getAsync(k, cache, info, std::move(onResult), cancellation);
+}
+
+void RemoteDataSourceProcess::getBatchAsync(
+    std::vector<MapTileKey> const& keys,
+    Cache::Ptr const& cache,
+    DataSourceInfo const& info,
+    std::function<void(std::vector<TileLayer::Ptr>)> onResult,
+    std::vector<CancellationToken::Ptr> const& cancellations)
+{
+    if (!remoteSource_)
+        raise("Remote data source is not initialized.");
+    remoteSource_->getBatchAsync(keys, cache, info, std::move(onResult), cancellations);
 }
 
 std::vector<LocateResponse> RemoteDataSourceProcess::locate(const LocateRequest& req)
@@ -236,4 +869,12 @@ std::vector<LocateResponse> RemoteDataSourceProcess::locate(const LocateRequest&
     return remoteSource_->locate(req);
 }
 
+std::vector<std::vector<LocateResponse>>
+RemoteDataSourceProcess::locate(std::vector<LocateRequest> const& requests)
+{
+    if (!remoteSource_)
+        raise("Remote data source is not initialized.");
+    return remoteSource_->locate(requests);
+}
+
 }
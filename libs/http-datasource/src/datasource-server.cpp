@@ -1,17 +1,104 @@
 #include "datasource-server.h"
+#include "mapget/detail/http-compression.h"
 #include "mapget/detail/http-server.h"
+#include "mapget/detail/shared-memory-ring.h"
 #include "mapget/model/sourcedatalayer.h"
 #include "mapget/model/featurelayer.h"
 #include "mapget/model/info.h"
 #include "mapget/model/layer.h"
 #include "mapget/model/stream.h"
+#include "mapget/service/executor.h"
+#include "mapget/service/tracing.h"
+#include "mapget/log.h"
 
 #include "httplib.h"
+#include <algorithm>
+#include <future>
 #include <memory>
 #include <stdexcept>
+#include <string_view>
+#include <unordered_map>
 
 namespace mapget {
 
+namespace
+{
+
+// Whether an If-None-Match header lists the given entity tag. Tags
+// are compared weakly, i.e. a W/ prefix does not matter.
+bool matchesETag(std::string_view ifNoneMatch, std::string_view eTag)
+{
+    auto weak = [](std::string_view tag) { return tag.substr(0, 2) == "W/" ? tag.substr(2) : tag; };
+    size_t start = 0;
+    while (start < ifNoneMatch.size()) {
+        auto end = ifNoneMatch.find(',', start);
+        if (end == std::string_view::npos)
+            end = ifNoneMatch.size();
+        auto tag = ifNoneMatch.substr(start, end - start);
+        start = end + 1;
+        auto begin = tag.find_first_not_of(" \t");
+        if (begin == std::string_view::npos)
+            continue;
+        tag = tag.substr(begin, tag.find_last_not_of(" \t") - begin + 1);
+        if (tag == "*" || weak(tag) == weak(eTag))
+            return true;
+    }
+    return false;
+}
+
+// Whether the client of a request reads responses from the shared memory ring.
+bool acceptsSharedMemory(httplib::Request const& req, SharedMemoryRing const* ring)
+{
+    return ring && req.get_header_value(SharedMemoryRing::TransportHeader) == SharedMemoryRing::TransportName;
+}
+
+// Set a tile response, which is zstd compressed if the client accepts it,
+// or passed through the shared memory ring.
+void setTileContent(
+    httplib::Request const& req,
+    httplib::Response& res,
+    std::string content,
+    char const* contentType,
+    SharedMemoryRing* ring = nullptr)
+{
+    if (acceptsSharedMemory(req, ring)) {
+        std::string frames;
+        ring->writeFrame(content, frames);
+        res.set_header(SharedMemoryRing::TransportHeader, SharedMemoryRing::TransportName);
+        res.set_content(std::move(frames), contentType);
+        return;
+    }
+    res.set_header("Vary", "Accept-Encoding");
+    if (acceptsEncoding(req.get_header_value("Accept-Encoding"), ZstdContentEncoding)) {
+        std::string compressed;
+        ZstdStreamCompressor().compress(content, compressed, true);
+        res.set_header("Content-Encoding", ZstdContentEncoding);
+        content = std::move(compressed);
+    }
+    res.set_content(std::move(content), contentType);
+}
+
+}
+
+namespace
+{
+
+/**
+ * Get a function which checks whether the client of a request has
+ * disconnected. Older httplib versions cannot tell, then the
+ * returned function is empty.
+ */
+template <typename Request>
+std::function<bool()> connectionClosedCheck(Request const& req)
+{
+    if constexpr (requires { req.is_connection_closed; })
+        return req.is_connection_closed;
+    else
+        return {};
+}
+
+}  // namespace
+
 struct DataSourceServer::Impl
 {
     DataSourceInfo info_;
@@ -23,22 +110,275 @@ struct DataSourceServer::Impl
     {
         throw std::runtime_error("TileSourceDataLayer callback is unset!");
     };
+    std::function<void(TileBinaryLayer::Ptr)> tileBinaryCallback_ = [](auto&&)
+    {
+        throw std::runtime_error("TileBinaryLayer callback is unset!");
+    };
+    std::function<void(std::vector<TileFeatureLayer::Ptr> const&)> tileFeatureBatchCallback_;
     std::function<std::vector<LocateResponse>(const LocateRequest&)> locateCallback_;
     std::shared_ptr<StringPool> strings_;
 
+    // Ring through which a parent process may receive the tiles.
+    size_t sharedMemoryCapacity_ = SharedMemoryRing::DefaultCapacity;
+    std::unique_ptr<SharedMemoryRing> sharedMemory_;
+
+    // Optional cache of the filled tiles, see setCache().
+    Cache::Ptr cache_;
+
+    // Threads which run the fill callbacks, or null to fill on the HTTP threads.
+    size_t fillThreadPoolSize_ = 0;
+    std::unique_ptr<Executor> fillExecutor_;
+
+    /**
+     * Fill of a tile, whose result further requests for the tile wait for.
+     * The fill is cancelled once all of its requests are cancelled.
+     */
+    struct RunningFill
+    {
+        std::shared_future<std::shared_ptr<TileLayer>> result_;
+        std::vector<CancellationToken::Ptr> requests_;
+    };
+    std::mutex runningFillsMutex_;  // Mutex for runningFills_ and the requests_ of its entries
+    std::unordered_map<MapTileKey, std::shared_ptr<RunningFill>, MapTileKey::Hash> runningFills_;
+
     explicit Impl(DataSourceInfo info)
         : info_(std::move(info)), strings_(std::make_shared<StringPool>(info_.nodeId_))
     {
     }
+
+    // Create an empty tile of the given layer, which is cancelled with the token.
+    std::shared_ptr<TileLayer> newTile(
+        std::shared_ptr<LayerInfo> const& layer,
+        TileId tileId,
+        CancellationToken::Ptr const& cancellation)
+    {
+        std::shared_ptr<TileLayer> result;
+        switch (layer->type_) {
+        case mapget::LayerType::Features:
+            result = std::make_shared<TileFeatureLayer>(tileId, info_.nodeId_, info_.mapId_, layer, strings_);
+            break;
+        case mapget::LayerType::SourceData:
+            result = std::make_shared<TileSourceDataLayer>(tileId, info_.nodeId_, info_.mapId_, layer, strings_);
+            break;
+        case mapget::LayerType::Heightmap:
+        case mapget::LayerType::OrthoImage:
+        case mapget::LayerType::GLTF:
+            result = std::make_shared<TileBinaryLayer>(tileId, info_.nodeId_, info_.mapId_, layer);
+            break;
+        default:
+            throw std::runtime_error(fmt::format("Unsupported layer type {}", (int)layer->type_));
+        }
+        result->setCancellation(cancellation);
+        return result;
+    }
+
+    // Number of tiles of a layer which are filled by one fill(...) call.
+    [[nodiscard]] size_t batchSize(LayerInfo const& layer) const
+    {
+        if (layer.type_ != mapget::LayerType::Features || !tileFeatureBatchCallback_)
+            return 1;
+        return static_cast<size_t>(std::max(info_.maxBatchSize_, 1));
+    }
+
+    // Get the tiles of a layer from the cache, or fill them. Tiles which
+    // another request fills already are not filled again, their result is
+    // waited for instead. Null entries are tiles whose fill was cancelled.
+    std::vector<std::shared_ptr<TileLayer>> getTiles(
+        std::shared_ptr<LayerInfo> const& layer,
+        std::vector<TileId> const& tileIds,
+        CancellationToken::Ptr const& cancellation)
+    {
+        std::vector<std::shared_ptr<TileLayer>> result(tileIds.size());
+        std::vector<MapTileKey> keys(tileIds.size());
+        std::vector<std::pair<size_t, std::shared_future<std::shared_ptr<TileLayer>>>> waiting;
+        std::vector<size_t> filled;
+        std::vector<std::shared_ptr<TileLayer>> tiles;
+        std::vector<std::promise<std::shared_ptr<TileLayer>>> promises;
+
+        for (auto i = 0u; i < tileIds.size(); ++i) {
+            auto& key = keys[i];
+            key.layer_ = layer->type_;
+            key.mapId_ = info_.mapId_;
+            key.layerId_ = layer->layerId_;
+            key.tileId_ = tileIds[i];
+            if (cache_ && (result[i] = cache_->getTileLayer(key, info_)))
+                continue;
+
+            std::unique_lock lock(runningFillsMutex_);
+            if (auto it = runningFills_.find(key); it != runningFills_.end()) {
+                it->second->requests_.emplace_back(cancellation);
+                waiting.emplace_back(i, it->second->result_);
+                continue;
+            }
+            auto running = std::make_shared<RunningFill>();
+            running->requests_.emplace_back(cancellation);
+            running->result_ = promises.emplace_back().get_future().share();
+            runningFills_.emplace(key, running);
+            lock.unlock();
+
+            filled.emplace_back(i);
+            tiles.emplace_back(newTile(layer, tileIds[i], std::make_shared<CancellationToken>(
+                [this, running]
+                {
+                    std::lock_guard lock(runningFillsMutex_);
+                    return std::all_of(
+                        running->requests_.begin(),
+                        running->requests_.end(),
+                        [](auto const& request) { return request && request->isCancelled(); });
+                })));
+        }
+
+        std::exception_ptr error;
+        try {
+            runFill(tiles);
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+
+        // Completed tiles are cached before their fills are finished,
+        // so that later requests find them in either place.
+        for (auto& tile : tiles) {
+            if (tile->isCancelled())
+                tile.reset();
+            else {
+                tile->setCancellation({});
+                if (cache_ && !error)
+                    cache_->putTileLayer(tile);
+            }
+        }
+        {
+            std::lock_guard lock(runningFillsMutex_);
+            for (auto i : filled)
+                runningFills_.erase(keys[i]);
+        }
+        for (auto j = 0u; j < filled.size(); ++j) {
+            if (error)
+                promises[j].set_exception(error);
+            else
+                promises[j].set_value(result[filled[j]] = tiles[j]);
+        }
+        if (error)
+            std::rethrow_exception(error);
+
+        for (auto& [i, runningResult] : waiting)
+            result[i] = runningResult.get();
+        return result;
+    }
+
+    // Fill tiles on the fill threads, if there are any.
+    void runFill(std::vector<std::shared_ptr<TileLayer>> const& tiles)
+    {
+        if (!fillExecutor_ || tiles.empty()) {
+            fill(tiles);
+            return;
+        }
+        std::promise<void> done;
+        fillExecutor_->post(
+            [&]
+            {
+                try {
+                    fill(tiles);
+                    done.set_value();
+                }
+                catch (...) {
+                    done.set_exception(std::current_exception());
+                }
+            });
+        done.get_future().get();
+    }
+
+    // Fill tiles of the same layer through the callbacks. Feature tiles
+    // are passed to the batch callback at once, if there is one.
+    void fill(std::vector<std::shared_ptr<TileLayer>> const& tiles)
+    {
+        if (tiles.empty())
+            return;
+        if (tiles.front()->layerInfo()->type_ == mapget::LayerType::SourceData) {
+            for (auto const& tile : tiles) {
+                if (!tile->isCancelled())
+                    tileSourceDataCallback_(std::static_pointer_cast<TileSourceDataLayer>(tile));
+            }
+            return;
+        }
+        if (tiles.front()->layerInfo()->type_ != mapget::LayerType::Features) {
+            for (auto const& tile : tiles) {
+                if (!tile->isCancelled())
+                    tileBinaryCallback_(std::static_pointer_cast<TileBinaryLayer>(tile));
+            }
+            return;
+        }
+
+        std::vector<TileFeatureLayer::Ptr> featureTiles;
+        featureTiles.reserve(tiles.size());
+        for (auto const& tile : tiles)
+            featureTiles.emplace_back(std::static_pointer_cast<TileFeatureLayer>(tile));
+        if (tileFeatureBatchCallback_ && featureTiles.size() > 1) {
+            tileFeatureBatchCallback_(featureTiles);
+            return;
+        }
+        for (auto const& featureTile : featureTiles) {
+            if (!featureTile->isCancelled())
+                tileFeatureCallback_(featureTile);
+        }
+    }
+};
+
+namespace
+{
+
+/**
+ * State of a /tiles response, which is streamed while its tiles are
+ * filled. All tiles share the string pool offsets, so each tile is
+ * only sent with the strings which the previous tiles did not have.
+ */
+struct TilesResponseState
+{
+    std::shared_ptr<LayerInfo> layer_;
+    std::vector<TileId> tileIds_;
+    size_t nextTile_ = 0;
+    CancellationToken::Ptr cancellation_;
+    TraceContext trace_;
+
+    TileLayerStream::StringPoolOffsetMap stringPoolOffsets_;
+    std::string buffer_;
+    std::unique_ptr<TileLayerStream::Writer> writer_;
+    std::unique_ptr<ZstdStreamCompressor> compressor_;
+    SharedMemoryRing* sharedMemory_ = nullptr;
+    std::string compressedBuffer_;
 };
 
+// Parse a comma-separated list of tile ids.
+std::vector<TileId> parseTileIds(std::string_view tileIds)
+{
+    std::vector<TileId> result;
+    size_t start = 0;
+    while (start < tileIds.size()) {
+        auto end = tileIds.find(',', start);
+        if (end == std::string_view::npos)
+            end = tileIds.size();
+        if (end > start)
+            result.emplace_back(std::stoull(std::string(tileIds.substr(start, end - start))));
+        start = end + 1;
+    }
+    return result;
+}
+
+}  // namespace
+
 DataSourceServer::DataSourceServer(DataSourceInfo const& info)
     : HttpServer(), impl_(new Impl(info))
 {
     printPortToStdOut(true);
 }
 
-DataSourceServer::~DataSourceServer() = default;
+DataSourceServer::~DataSourceServer()
+{
+    // Running requests may wait for the fill threads, which are
+    // stopped with the Impl.
+    if (isRunning())
+        stop();
+}
 
 DataSourceServer&
 DataSourceServer::onTileFeatureRequest(std::function<void(TileFeatureLayer::Ptr)> const& callback)
@@ -54,6 +394,20 @@ DataSourceServer::onTileSourceDataRequest(std::function<void(TileSourceDataLayer
     return *this;
 }
 
+DataSourceServer&
+DataSourceServer::onTileBinaryRequest(std::function<void(TileBinaryLayer::Ptr)> const& callback)
+{
+    impl_->tileBinaryCallback_ = callback;
+    return *this;
+}
+
+DataSourceServer& DataSourceServer::onTileFeatureBatchRequest(
+    std::function<void(std::vector<TileFeatureLayer::Ptr> const&)> const& callback)
+{
+    impl_->tileFeatureBatchCallback_ = callback;
+    return *this;
+}
+
 DataSourceServer& DataSourceServer::onLocateRequest(
     const std::function<std::vector<LocateResponse>(const LocateRequest&)>& callback)
 {
@@ -61,12 +415,45 @@ DataSourceServer& DataSourceServer::onLocateRequest(
     return *this;
 }
 
+DataSourceServer& DataSourceServer::setSharedMemoryCapacity(size_t bytes)
+{
+    impl_->sharedMemoryCapacity_ = bytes;
+    return *this;
+}
+
+DataSourceServer& DataSourceServer::setCache(Cache::Ptr cache)
+{
+    impl_->cache_ = std::move(cache);
+    // Cached tiles refer to the strings of the cache's pool.
+    impl_->strings_ = impl_->cache_ ? impl_->cache_->getStringPool(impl_->info_.nodeId_)
+                                    : std::make_shared<StringPool>(impl_->info_.nodeId_);
+    return *this;
+}
+
+DataSourceServer& DataSourceServer::setFillThreadPoolSize(size_t numThreads)
+{
+    impl_->fillThreadPoolSize_ = numThreads;
+    return *this;
+}
+
 DataSourceInfo const& DataSourceServer::info() {
     return impl_->info_;
 }
 
+std::string DataSourceServer::portMessageSuffix() const
+{
+    if (!impl_->sharedMemory_)
+        return {};
+    return fmt::format(", shared memory {}", impl_->sharedMemory_->name());
+}
+
 void DataSourceServer::setup(httplib::Server& server)
 {
+    if (impl_->sharedMemoryCapacity_ > 0)
+        impl_->sharedMemory_ = SharedMemoryRing::create(impl_->sharedMemoryCapacity_);
+    if (impl_->fillThreadPoolSize_ > 0)
+        impl_->fillExecutor_ = std::make_unique<Executor>(impl_->fillThreadPoolSize_);
+
     // Set up GET /tile endpoint
     server.Get(
         "/tile",
@@ -85,48 +472,147 @@ void DataSourceServer::setup(httplib::Server& server)
             if (req.has_param("responseType"))
                 responseType = req.get_param_value("responseType");
 
-            // Create response TileFeatureLayer.
-            auto tileLayer = [&]() -> std::shared_ptr<TileLayer> {
-                switch (layer->type_) {
-                case mapget::LayerType::Features: {
-                    auto tileFeatureLayer = std::make_shared<TileFeatureLayer>(
-                        tileIdParam,
-                        impl_->info_.nodeId_,
-                        impl_->info_.mapId_,
-                        layer,
-                        impl_->strings_);
-                    impl_->tileFeatureCallback_(tileFeatureLayer);
-                    return tileFeatureLayer;
-                }
-                case mapget::LayerType::SourceData: {
-                    auto tileSourceLayer = std::make_shared<TileSourceDataLayer>(
-                        tileIdParam,
-                        impl_->info_.nodeId_,
-                        impl_->info_.mapId_,
-                        layer,
-                        impl_->strings_);
-                    impl_->tileSourceDataCallback_(tileSourceLayer);
-                    return tileSourceLayer;
-                }
-                default:
-                    throw std::runtime_error(fmt::format("Unsupported layer type {}", (int)layer->type_));
-                }
-            }();
+            // Spans of the tile are children of the requesting client's span.
+            Span span(
+                "mapget.datasource-server.tile",
+                TraceContext::fromTraceParent(req.get_header_value(TraceParentHeader)).value_or(TraceContext{}),
+                SpanKind::Server);
+            span.setAttribute("mapget.layer", layerIdParam);
+            span.setAttribute("mapget.tile_id", static_cast<int64_t>(tileIdParam.value_));
+            TraceScope traceScope(span.context());
+
+            // The tile is cancelled if the requesting client disconnects.
+            auto cancellation = std::make_shared<CancellationToken>(connectionClosedCheck(req));
+
+            // Get the tile from the cache, or fill it.
+            auto tileLayer = impl_->getTiles(layer, {tileIdParam}, cancellation).front();
+
+            // Nobody is there to receive a cancelled tile.
+            if (!tileLayer || cancellation->isCancelled()) {
+                res.status = 499;  // Client Closed Request.
+                return;
+            }
+
+            // A client which holds a tile with the same content gets no body.
+            // The tag is weak, as the body also depends on the encoding.
+            auto eTag = "W/" + tileLayer->eTag();
+            res.set_header("ETag", eTag);
+            if (matchesETag(req.get_header_value("If-None-Match"), eTag)) {
+                res.status = 304;  // Not Modified.
+                return;
+            }
 
             // Serialize TileLayer using TileLayerStream.
+            Span serializeSpan("mapget.serialize");
             if (responseType == "binary") {
-                std::stringstream content;
+                std::string content;
                 TileLayerStream::StringPoolOffsetMap stringPoolOffsets{
                     {impl_->info_.nodeId_, stringPoolOffsetParam}};
                 TileLayerStream::Writer layerWriter{
-                    [&](auto&& msg, auto&& msgType) { content << msg; },
+                    [&](std::string_view header, std::string_view body, TileLayerStream::MessageType)
+                    { content.append(header).append(body); },
                     stringPoolOffsets};
                 layerWriter.write(tileLayer);
-                res.set_content(content.str(), "application/binary");
+                setTileContent(req, res, std::move(content), "application/binary", impl_->sharedMemory_.get());
+            }
+            else {
+                std::string content;
+                tileLayer->writeJson(content);
+                setTileContent(req, res, std::move(content), "application/json");
+            }
+        });
+
+    // Set up GET /tiles endpoint, which streams the tiles of one layer
+    // in the order of their ids.
+    server.Get(
+        "/tiles",
+        [this](const httplib::Request& req, httplib::Response& res) {
+            auto state = std::make_shared<TilesResponseState>();
+            state->layer_ = impl_->info_.getLayer(req.get_param_value("layer"));
+            state->tileIds_ = parseTileIds(req.get_param_value("tileIds"));
+            auto stringPoolOffsetParam = (simfil::StringId)0;
+            if (req.has_param("stringPoolOffset"))
+                stringPoolOffsetParam = (simfil::StringId)
+                    std::stoul(req.get_param_value("stringPoolOffset"));
+            state->stringPoolOffsets_ = {{impl_->info_.nodeId_, stringPoolOffsetParam}};
+            state->writer_ = std::make_unique<TileLayerStream::Writer>(
+                [state = state.get()](std::string_view header, std::string_view body, TileLayerStream::MessageType)
+                { state->buffer_.append(header).append(body); },
+                state->stringPoolOffsets_);
+
+            // The tiles are cancelled if the requesting client disconnects.
+            state->cancellation_ = std::make_shared<CancellationToken>(connectionClosedCheck(req));
+            state->trace_ = TraceContext::fromTraceParent(req.get_header_value(TraceParentHeader))
+                .value_or(TraceContext{});
+
+            if (acceptsSharedMemory(req, impl_->sharedMemory_.get())) {
+                state->sharedMemory_ = impl_->sharedMemory_.get();
+                res.set_header(SharedMemoryRing::TransportHeader, SharedMemoryRing::TransportName);
             }
             else {
-                res.set_content(nlohmann::to_string(tileLayer->toJson()), "application/json");
+                res.set_header("Vary", "Accept-Encoding");
+                if (acceptsEncoding(req.get_header_value("Accept-Encoding"), ZstdContentEncoding)) {
+                    state->compressor_ = std::make_unique<ZstdStreamCompressor>();
+                    res.set_header("Content-Encoding", ZstdContentEncoding);
+                }
             }
+
+            // Each call of the provider fills one batch of tiles, and sends
+            // them. The zstd stream is flushed after each batch, so that the
+            // client can decode the received tiles while the others are filled.
+            res.set_content_provider(
+                "application/binary",
+                [this, state](size_t, httplib::DataSink& sink)
+                {
+                    try {
+                        auto begin = state->nextTile_;
+                        auto end = std::min(begin + impl_->batchSize(*state->layer_), state->tileIds_.size());
+                        state->nextTile_ = end;
+
+                        Span span("mapget.datasource-server.tiles", state->trace_, SpanKind::Server);
+                        span.setAttribute("mapget.layer", state->layer_->layerId_);
+                        span.setAttribute("mapget.batch_size", static_cast<int64_t>(end - begin));
+                        TraceScope traceScope(span.context());
+
+                        auto tiles = impl_->getTiles(
+                            state->layer_,
+                            {state->tileIds_.begin() + begin, state->tileIds_.begin() + end},
+                            state->cancellation_);
+
+                        // Nobody is there to receive cancelled tiles.
+                        if (state->cancellation_->isCancelled() ||
+                            std::any_of(tiles.begin(), tiles.end(), [](auto const& tile) { return !tile; }))
+                            return false;
+
+                        auto allDone = end == state->tileIds_.size();
+                        state->buffer_.clear();
+                        for (auto const& tile : tiles)
+                            state->writer_->write(tile);
+                        if (allDone)
+                            state->writer_->sendEndOfStream();
+
+                        std::string_view bytes = state->buffer_;
+                        if (state->sharedMemory_) {
+                            state->compressedBuffer_.clear();
+                            state->sharedMemory_->writeFrame(bytes, state->compressedBuffer_);
+                            bytes = state->compressedBuffer_;
+                        }
+                        else if (state->compressor_) {
+                            state->compressedBuffer_.clear();
+                            state->compressor_->compress(bytes, state->compressedBuffer_, allDone);
+                            bytes = state->compressedBuffer_;
+                        }
+                        if (!bytes.empty() && !sink.write(bytes.data(), bytes.size()))
+                            return false;
+                        if (allDone)
+                            sink.done();
+                        return true;
+                    }
+                    catch (std::exception& e) {
+                        log().error("Could not stream tiles of layer {}: {}", state->layer_->layerId_, e.what());
+                        return false;
+                    }
+                });
         });
 
     // Set up GET /info endpoint
@@ -141,13 +627,29 @@ void DataSourceServer::setup(httplib::Server& server)
     server.Post(
         "/locate",
         [this](const httplib::Request& req, httplib::Response& res) {
-            LocateRequest parsedReq(nlohmann::json::parse(req.body));
-            auto responseJson = nlohmann::json::array();
-
-            if (impl_->locateCallback_) {
-                for (auto const& response : impl_->locateCallback_(parsedReq)) {
-                    responseJson.emplace_back(response.serialize());
+            auto locate = [this](nlohmann::json const& requestJson)
+            {
+                LocateRequest parsedReq(requestJson);
+                auto responseJson = nlohmann::json::array();
+                if (impl_->locateCallback_) {
+                    for (auto const& response : impl_->locateCallback_(parsedReq)) {
+                        responseJson.emplace_back(response.serialize());
+                    }
                 }
+                return responseJson;
+            };
+
+            // A JSON array is a batch of requests, which is answered
+            // with one list of responses per request.
+            auto requestJson = nlohmann::json::parse(req.body);
+            nlohmann::json responseJson;
+            if (requestJson.is_array()) {
+                responseJson = nlohmann::json::array();
+                for (auto const& batchRequestJson : requestJson)
+                    responseJson.emplace_back(locate(batchRequestJson));
+            }
+            else {
+                responseJson = locate(requestJson);
             }
 
             res.set_content(responseJson.dump(), "application/json");
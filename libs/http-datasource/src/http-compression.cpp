@@ -0,0 +1,123 @@
+#include "mapget/detail/http-compression.h"
+#include "mapget/log.h"
+
+#include <zstd.h>
+
+namespace mapget
+{
+
+namespace
+{
+
+std::string_view trim(std::string_view s)
+{
+    auto begin = s.find_first_not_of(" \t");
+    if (begin == std::string_view::npos)
+        return {};
+    auto end = s.find_last_not_of(" \t");
+    return s.substr(begin, end - begin + 1);
+}
+
+}
+
+bool acceptsEncoding(std::string_view const& acceptEncoding, std::string_view const& encoding)
+{
+    size_t start = 0;
+    while (start <= acceptEncoding.size()) {
+        auto end = acceptEncoding.find(',', start);
+        if (end == std::string_view::npos)
+            end = acceptEncoding.size();
+        auto entry = acceptEncoding.substr(start, end - start);
+        start = end + 1;
+
+        // An entry is `name` or `name;q=<quality>`.
+        auto paramsPos = entry.find(';');
+        auto name = trim(entry.substr(0, paramsPos));
+        if (name != encoding && name != "*")
+            continue;
+        if (paramsPos == std::string_view::npos)
+            return true;
+        auto params = trim(entry.substr(paramsPos + 1));
+        if (params.substr(0, 2) != "q=")
+            return true;
+        auto quality = trim(params.substr(2));
+        return quality.find_first_not_of("0.") != std::string_view::npos;
+    }
+    return false;
+}
+
+struct ZstdStreamCompressor::Impl
+{
+    std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> context_{ZSTD_createCCtx(), &ZSTD_freeCCtx};
+};
+
+ZstdStreamCompressor::ZstdStreamCompressor(int level) : impl_(std::make_unique<Impl>())
+{
+    if (!impl_->context_)
+        raise("Could not create a zstd compression context.");
+    ZSTD_CCtx_setParameter(impl_->context_.get(), ZSTD_c_compressionLevel, level);
+}
+
+ZstdStreamCompressor::~ZstdStreamCompressor() = default;
+
+void ZstdStreamCompressor::compress(std::string_view const& bytes, std::string& result, bool endOfStream)
+{
+    ZSTD_inBuffer input{bytes.data(), bytes.size(), 0};
+    auto mode = endOfStream ? ZSTD_e_end : ZSTD_e_flush;
+    size_t remaining = 0;
+    do {
+        auto offset = result.size();
+        result.resize(offset + ZSTD_CStreamOutSize());
+        ZSTD_outBuffer output{result.data() + offset, result.size() - offset, 0};
+        remaining = ZSTD_compressStream2(impl_->context_.get(), &output, &input, mode);
+        if (ZSTD_isError(remaining))
+            raiseFmt("Could not compress response: {}", ZSTD_getErrorName(remaining));
+        result.resize(offset + output.pos);
+    } while (remaining > 0);
+}
+
+void ZstdStreamCompressor::compressBuffered(std::string_view const& bytes, std::string& result)
+{
+    ZSTD_inBuffer input{bytes.data(), bytes.size(), 0};
+    while (input.pos < input.size) {
+        auto offset = result.size();
+        result.resize(offset + ZSTD_CStreamOutSize());
+        ZSTD_outBuffer output{result.data() + offset, result.size() - offset, 0};
+        auto hint = ZSTD_compressStream2(impl_->context_.get(), &output, &input, ZSTD_e_continue);
+        if (ZSTD_isError(hint))
+            raiseFmt("Could not compress response: {}", ZSTD_getErrorName(hint));
+        result.resize(offset + output.pos);
+    }
+}
+
+struct ZstdStreamDecompressor::Impl
+{
+    std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> context_{ZSTD_createDCtx(), &ZSTD_freeDCtx};
+};
+
+ZstdStreamDecompressor::ZstdStreamDecompressor() : impl_(std::make_unique<Impl>())
+{
+    if (!impl_->context_)
+        raise("Could not create a zstd decompression context.");
+}
+
+ZstdStreamDecompressor::~ZstdStreamDecompressor() = default;
+
+void ZstdStreamDecompressor::decompress(std::string_view const& bytes, std::string& result)
+{
+    ZSTD_inBuffer input{bytes.data(), bytes.size(), 0};
+    bool outputFull = false;
+    // A full output buffer may leave decompressed bytes in the context.
+    while (input.pos < input.size || outputFull) {
+        auto offset = result.size();
+        result.resize(offset + ZSTD_DStreamOutSize());
+        ZSTD_outBuffer output{result.data() + offset, result.size() - offset, 0};
+        auto status = ZSTD_decompressStream(impl_->context_.get(), &output, &input);
+        if (ZSTD_isError(status))
+            raiseFmt("Could not decompress response: {}", ZSTD_getErrorName(status));
+        outputFull = output.pos == output.size;
+        result.resize(offset + output.pos);
+    }
+}
+
+}  // namespace mapget
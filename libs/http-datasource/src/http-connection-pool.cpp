@@ -0,0 +1,178 @@
+#include "mapget/detail/http-connection-pool.h"
+#include "mapget/log.h"
+
+#include "httplib.h"
+#include <algorithm>
+
+namespace mapget {
+
+HttpConnectionPool::Connection::Connection(
+    HttpConnectionPool* pool,
+    size_t endpoint,
+    std::unique_ptr<httplib::Client> client)
+    : pool_(pool), endpoint_(endpoint), client_(std::move(client))
+{
+}
+
+HttpConnectionPool::Connection::Connection(Connection&& other) noexcept
+    : pool_(other.pool_), endpoint_(other.endpoint_), client_(std::move(other.client_)), failed_(other.failed_)
+{
+    other.pool_ = nullptr;
+}
+
+HttpConnectionPool::Connection::~Connection()
+{
+    if (pool_)
+        pool_->release(endpoint_, std::move(client_), failed_);
+}
+
+HttpConnectionPool::HttpConnectionPool(
+    std::vector<Endpoint> endpoints,
+    size_t maxIdleConnections,
+    HealthCheckFun healthCheck)
+    : maxIdleConnections_(maxIdleConnections),
+      healthCheck_(std::move(healthCheck)),
+      endpoints_(std::move(endpoints)),
+      states_(endpoints_.size())
+{
+    if (endpoints_.empty())
+        raise("A connection pool needs at least one endpoint.");
+}
+
+HttpConnectionPool::~HttpConnectionPool() = default;
+
+std::optional<HttpConnectionPool::Connection> HttpConnectionPool::acquire(std::optional<size_t> excludedEndpoint)
+{
+    std::unique_lock lock(mutex_);
+    auto const numEndpoints = states_.size();
+
+    // Probe the failed endpoint which is due for a retry the longest,
+    // so that it gets requests again once it is healthy.
+    std::optional<size_t> probed;
+    auto const now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < numEndpoints; ++i) {
+        auto const& state = states_[i];
+        if (i == excludedEndpoint || !state.failures_ || state.probing_ || now < state.retryAt_)
+            continue;
+        if (!probed || state.retryAt_ < states_[*probed].retryAt_)
+            probed = i;
+    }
+    if (probed) {
+        auto endpoint = endpoints_[*probed];
+        states_[*probed].probing_ = true;
+        lock.unlock();
+        auto healthy = probe(*probed, endpoint);
+        lock.lock();
+
+        auto& state = states_[*probed];
+        state.probing_ = false;
+        if (!healthy)
+            recordFailure(state);
+        else if (state.failures_) {
+            log().info("Endpoint {}:{} is available again.", endpoint.host_, endpoint.port_);
+            state.failures_ = 0;
+        }
+    }
+
+    // Healthy endpoint with the least outstanding requests. The search
+    // starts at a rotating endpoint, so that ties are balanced.
+    std::optional<size_t> best;
+    for (size_t n = 0; n < numEndpoints; ++n) {
+        auto i = (nextEndpoint_ + n) % numEndpoints;
+        if (i == excludedEndpoint || states_[i].failures_)
+            continue;
+        if (!best || states_[i].outstandingRequests_ < states_[*best].outstandingRequests_)
+            best = i;
+    }
+    nextEndpoint_ = (nextEndpoint_ + 1) % numEndpoints;
+    if (!best)
+        return {};
+
+    auto& state = states_[*best];
+    ++state.outstandingRequests_;
+    std::unique_ptr<httplib::Client> client;
+    if (!state.idleConnections_.empty()) {
+        client = std::move(state.idleConnections_.back());
+        state.idleConnections_.pop_back();
+    }
+    auto endpoint = endpoints_[*best];
+    lock.unlock();
+    if (!client)
+        client = newConnection(endpoint);
+    return Connection(this, *best, std::move(client));
+}
+
+void HttpConnectionPool::setFailed(size_t endpoint)
+{
+    std::lock_guard lock(mutex_);
+    recordFailure(states_[endpoint]);
+}
+
+void HttpConnectionPool::setEndpoint(size_t index, Endpoint endpoint)
+{
+    std::lock_guard lock(mutex_);
+    endpoints_[index] = std::move(endpoint);
+    // The new endpoint is probed by the next request.
+    auto& state = states_[index];
+    state.idleConnections_.clear();
+    state.failures_ = std::max(state.failures_, 1u);
+    state.retryAt_ = {};
+}
+
+std::vector<HttpConnectionPool::Endpoint> HttpConnectionPool::endpoints() const
+{
+    std::lock_guard lock(mutex_);
+    return endpoints_;
+}
+
+void HttpConnectionPool::release(size_t endpoint, std::unique_ptr<httplib::Client> client, bool failed)
+{
+    std::unique_lock lock(mutex_);
+    auto& state = states_[endpoint];
+    --state.outstandingRequests_;
+    if (failed) {
+        if (!state.failures_)
+            log().warn("Endpoint {}:{} failed, backing off.", endpoints_[endpoint].host_, endpoints_[endpoint].port_);
+        recordFailure(state);
+    }
+    else if (!state.failures_ && state.idleConnections_.size() < maxIdleConnections_)
+        state.idleConnections_.push_back(std::move(client));
+    // The connection, if not kept, is closed outside of the lock.
+    lock.unlock();
+    client.reset();
+}
+
+void HttpConnectionPool::recordFailure(EndpointState& state)
+{
+    ++state.failures_;
+    auto backoff = MinBackoff * (1 << std::min(state.failures_ - 1, 16u));
+    state.retryAt_ = std::chrono::steady_clock::now() + std::min<std::chrono::milliseconds>(backoff, MaxBackoff);
+    // The idle connections to a failed endpoint are likely broken as well.
+    state.idleConnections_.clear();
+}
+
+bool HttpConnectionPool::probe(size_t index, Endpoint const& endpoint) const
+{
+    if (!healthCheck_)
+        return true;
+    // The probe connects with a short timeout, so that an endpoint
+    // which does not answer delays the probing request only briefly.
+    httplib::Client client(endpoint.host_, endpoint.port_);
+    client.set_connection_timeout(std::chrono::duration_cast<std::chrono::seconds>(HealthCheckTimeout).count());
+    try {
+        return healthCheck_(index, client);
+    }
+    catch (std::exception& e) {
+        log().warn("Health check of {}:{} failed: {}", endpoint.host_, endpoint.port_, e.what());
+        return false;
+    }
+}
+
+std::unique_ptr<httplib::Client> HttpConnectionPool::newConnection(Endpoint const& endpoint)
+{
+    auto client = std::make_unique<httplib::Client>(endpoint.host_, endpoint.port_);
+    client->set_keep_alive(true);
+    return client;
+}
+
+}
@@ -1,5 +1,6 @@
 #include "mapget/detail/http-server.h"
 #include "mapget/log.h"
+#include "mapget/service/tracing.h"
 
 #include "httplib.h"
 #include <csignal>
@@ -19,6 +20,7 @@ struct HttpServer::Impl
     httplib::Server server_;
     std::thread serverThread_;
     uint16_t port_ = 0;
+    size_t numThreads_ = 0;
     bool setupWasCalled_ = false;
     bool printPortToStdout_ = false;
 
@@ -50,6 +52,16 @@ void HttpServer::go(
     uint32_t waitMs)
 {
     if (!impl_->setupWasCalled_) {
+        // Recorded spans of this process are exported in OTLP/JSON format.
+        impl_->server_.Get(
+            "/traces",
+            [](const httplib::Request&, httplib::Response& res)
+            {
+                res.set_content(
+                    Tracer::toOtlpJson(Tracer::instance().takeSpans()).dump(),
+                    "application/json");
+            });
+
         // Allow derived class to set up the server
         setup(impl_->server_);
         impl_->setupWasCalled_ = true;
@@ -58,6 +70,11 @@ void HttpServer::go(
     if (impl_->server_.is_running() || impl_->serverThread_.joinable())
         raise("HttpServer is already running");
 
+    if (impl_->numThreads_ > 0) {
+        impl_->server_.new_task_queue = [numThreads = impl_->numThreads_]
+        { return new httplib::ThreadPool(numThreads); };
+    }
+
     if (port == 0) {
         impl_->port_ = impl_->server_.bind_to_any_port(interfaceAddr);
     }
@@ -70,9 +87,9 @@ void HttpServer::go(
         [this, interfaceAddr]
         {
             if (impl_->printPortToStdout_)
-                std::cout << "====== Running on port " << impl_->port_ << " ======" << std::endl;
+                std::cout << "====== Running on port " << impl_->port_ << portMessageSuffix() << " ======" << std::endl;
             else
-                log().info("====== Running on port {} ======", impl_->port_);
+                log().info("====== Running on port {}{} ======", impl_->port_, portMessageSuffix());
             impl_->server_.listen_after_bind();
         });
 
@@ -81,6 +98,10 @@ void HttpServer::go(
         raise(fmt::format("Could not start HttpServer on {}:{}", interfaceAddr, port));
 }
 
+void HttpServer::setThreadPoolSize(size_t numThreads) {
+    impl_->numThreads_ = numThreads;
+}
+
 bool HttpServer::isRunning() {
     return impl_->server_.is_running();
 }
@@ -0,0 +1,322 @@
+#include "mapget/detail/shared-memory-ring.h"
+#include "mapget/log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <random>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace mapget {
+
+namespace
+{
+
+constexpr uint64_t RingMagic = 0x676e69722d746567ull;  // "get-ring"
+constexpr size_t HeaderBytes = 64;
+constexpr size_t BlockAlignment = 32;
+
+// Frame offset of bytes which follow the frame inline.
+constexpr uint64_t InlineFrame = ~uint64_t(0);
+
+// The state of a block keeps the sequence number of its region in the
+// bits above the BlockState, so that a state change of a region cannot be
+// applied to the region which later reuses its space.
+enum BlockState : uint64_t { BlockInUse = 1, BlockReleased = 2, BlockReading = 3 };
+constexpr uint64_t BlockStateBits = 2;
+constexpr uint64_t BlockStateMask = (uint64_t(1) << BlockStateBits) - 1;
+
+uint64_t blockState(uint64_t sequence, BlockState state)
+{
+    return (sequence << BlockStateBits) | state;
+}
+
+struct RingHeader
+{
+    uint64_t magic_ = RingMagic;
+    uint64_t capacity_ = 0;
+};
+
+size_t alignUp(size_t n)
+{
+    return (n + BlockAlignment - 1) & ~(BlockAlignment - 1);
+}
+
+int64_t nowNs()
+{
+    // Monotonic clocks agree between the processes of a machine.
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}  // namespace
+
+struct SharedMemoryRing::Frame
+{
+    uint64_t offset_ = 0;  // Offset of the region's block, or InlineFrame
+    uint64_t size_ = 0;
+    uint64_t sequence_ = 0;  // Sequence number of the region's block
+};
+
+struct SharedMemoryRing::BlockHeader
+{
+    std::atomic<uint64_t> state_;  // See blockState()
+    uint64_t size_;
+    int64_t writtenAtNs_;
+    uint64_t reserved_;
+};
+
+static_assert(sizeof(RingHeader) <= HeaderBytes);
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Block states must be lock-free to be shared.");
+
+struct SharedMemoryRing::Impl
+{
+    std::string name_;
+    bool owner_ = false;
+    bool linked_ = true;
+    void* mapping_ = nullptr;
+    size_t capacity_ = 0;
+
+    [[nodiscard]] char* data() const { return static_cast<char*>(mapping_) + HeaderBytes; }
+    [[nodiscard]] BlockHeader* block(uint64_t offset) const { return reinterpret_cast<BlockHeader*>(data() + offset); }
+};
+
+SharedMemoryRing::SharedMemoryRing(std::unique_ptr<Impl> impl) : impl_(std::move(impl)) {}
+
+std::unique_ptr<SharedMemoryRing> SharedMemoryRing::create(size_t capacity)
+{
+#if defined(_WIN32)
+    return nullptr;
+#else
+    capacity = alignUp(std::max(capacity, 2 * BlockAlignment));
+    auto name = fmt::format("/mapget-{}-{:x}", getpid(), std::mt19937_64(std::random_device()())());
+    auto fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        log().warn("Could not create shared memory {}: {}", name, std::strerror(errno));
+        return nullptr;
+    }
+    auto size = HeaderBytes + capacity;
+    void* mapping = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(size)) == 0)
+        mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    auto error = errno;
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        log().warn("Could not map shared memory {}: {}", name, std::strerror(error));
+        return nullptr;
+    }
+    new (mapping) RingHeader{RingMagic, capacity};
+
+    auto impl = std::make_unique<Impl>();
+    impl->name_ = std::move(name);
+    impl->owner_ = true;
+    impl->mapping_ = mapping;
+    impl->capacity_ = capacity;
+    return std::unique_ptr<SharedMemoryRing>(new SharedMemoryRing(std::move(impl)));
+#endif
+}
+
+std::unique_ptr<SharedMemoryRing> SharedMemoryRing::open(std::string const& name)
+{
+#if defined(_WIN32)
+    raise("Shared memory is not supported on this platform.");
+#else
+    auto fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0)
+        raise(fmt::format("Could not open shared memory {}: {}", name, std::strerror(errno)));
+    struct stat status{};
+    void* mapping = MAP_FAILED;
+    if (fstat(fd, &status) == 0 && static_cast<size_t>(status.st_size) > HeaderBytes)
+        mapping = mmap(nullptr, status.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        raise(fmt::format("Could not map shared memory {}.", name));
+
+    auto header = static_cast<RingHeader const*>(mapping);
+    if (header->magic_ != RingMagic || header->capacity_ != static_cast<size_t>(status.st_size) - HeaderBytes) {
+        munmap(mapping, status.st_size);
+        raise(fmt::format("Shared memory {} is not a mapget ring.", name));
+    }
+
+    auto impl = std::make_unique<Impl>();
+    impl->name_ = name;
+    impl->mapping_ = mapping;
+    impl->capacity_ = header->capacity_;
+    return std::unique_ptr<SharedMemoryRing>(new SharedMemoryRing(std::move(impl)));
+#endif
+}
+
+SharedMemoryRing::~SharedMemoryRing()
+{
+#if !defined(_WIN32)
+    munmap(impl_->mapping_, HeaderBytes + impl_->capacity_);
+    if (impl_->owner_)
+        unlink();
+#endif
+}
+
+std::string const& SharedMemoryRing::name() const
+{
+    return impl_->name_;
+}
+
+size_t SharedMemoryRing::capacity() const
+{
+    return impl_->capacity_;
+}
+
+void SharedMemoryRing::unlink()
+{
+#if !defined(_WIN32)
+    // The other process may have removed the name already.
+    if (impl_->linked_)
+        shm_unlink(impl_->name_.c_str());
+    impl_->linked_ = false;
+#endif
+}
+
+void SharedMemoryRing::writeFrame(std::string_view const& bytes, std::string& body)
+{
+    Frame frame;
+    {
+        std::lock_guard lock(writerMutex_);
+        if (!allocate(bytes, frame))
+            frame = {InlineFrame, bytes.size(), 0};
+    }
+    body.append(reinterpret_cast<char const*>(&frame), sizeof(Frame));
+    if (frame.offset_ == InlineFrame)
+        body.append(bytes);
+}
+
+bool SharedMemoryRing::allocate(std::string_view const& bytes, Frame& frame)
+{
+    static_assert(sizeof(BlockHeader) == BlockAlignment);
+    reclaim();
+    auto const capacity = impl_->capacity_;
+    auto const blockSize = alignUp(sizeof(BlockHeader) + bytes.size());
+    if (blockSize > capacity)
+        return false;
+
+    // A region never wraps around, the space up to the end
+    // of the ring is skipped instead.
+    auto position = head_ % capacity;
+    if (position + blockSize > capacity) {
+        auto padding = capacity - position;
+        if (head_ + padding + blockSize - tail_ > capacity)
+            return false;
+        auto skipped = impl_->block(position);
+        skipped->size_ = padding - sizeof(BlockHeader);
+        skipped->writtenAtNs_ = 0;
+        skipped->state_.store(blockState(0, BlockReleased), std::memory_order_release);
+        head_ += padding;
+        position = 0;
+    }
+    if (head_ + blockSize - tail_ > capacity)
+        return false;
+
+    auto block = impl_->block(position);
+    auto sequence = nextSequence_++;
+    block->size_ = bytes.size();
+    block->writtenAtNs_ = nowNs();
+    std::memcpy(block + 1, bytes.data(), bytes.size());
+    block->state_.store(blockState(sequence, BlockInUse), std::memory_order_release);
+    head_ += blockSize;
+
+    frame = {position, bytes.size(), sequence};
+    return true;
+}
+
+void SharedMemoryRing::reclaim()
+{
+    auto const now = nowNs();
+    auto const timeoutNs = abandonedRegionTimeout_.count();
+    while (tail_ < head_) {
+        auto block = impl_->block(tail_ % impl_->capacity_);
+        auto state = block->state_.load(std::memory_order_acquire);
+        if ((state & BlockStateMask) != BlockReleased) {
+            if (now - block->writtenAtNs_ < timeoutNs)
+                break;
+            // The region is marked as released, so that a reader which
+            // still reads it fails, see FrameReader::read(). If the reader
+            // changed the state meanwhile, the block is looked at again.
+            if (!block->state_.compare_exchange_strong(
+                    state, (state & ~BlockStateMask) | BlockReleased, std::memory_order_acq_rel))
+                continue;
+            log().debug("Reusing an abandoned shared memory region of {} bytes.", block->size_);
+        }
+        tail_ += alignUp(sizeof(BlockHeader) + block->size_);
+    }
+}
+
+void SharedMemoryRing::setAbandonedRegionTimeout(std::chrono::nanoseconds timeout)
+{
+    std::lock_guard lock(writerMutex_);
+    abandonedRegionTimeout_ = timeout;
+}
+
+std::string_view SharedMemoryRing::region(Frame const& frame)
+{
+    if (frame.offset_ % BlockAlignment || frame.offset_ + sizeof(BlockHeader) + frame.size_ > impl_->capacity_)
+        raise("Shared memory frame is out of bounds.");
+    auto block = impl_->block(frame.offset_);
+    auto state = blockState(frame.sequence_, BlockInUse);
+    if (!block->state_.compare_exchange_strong(
+            state, blockState(frame.sequence_, BlockReading), std::memory_order_acq_rel))
+        raise("Shared memory region was reused before it was read.");
+    return {reinterpret_cast<char const*>(block + 1), frame.size_};
+}
+
+bool SharedMemoryRing::release(Frame const& frame)
+{
+    auto block = impl_->block(frame.offset_);
+    auto state = blockState(frame.sequence_, BlockReading);
+    return block->state_.compare_exchange_strong(
+        state, blockState(frame.sequence_, BlockReleased), std::memory_order_acq_rel);
+}
+
+SharedMemoryRing::FrameReader::FrameReader(std::shared_ptr<SharedMemoryRing> ring) : ring_(std::move(ring)) {}
+
+void SharedMemoryRing::FrameReader::read(
+    std::string_view const& bytes,
+    std::function<void(std::string_view)> const& onBytes)
+{
+    pending_.append(bytes);
+    size_t offset = 0;
+    while (pending_.size() - offset >= sizeof(Frame)) {
+        Frame frame;
+        std::memcpy(&frame, pending_.data() + offset, sizeof(Frame));
+        if (frame.offset_ == InlineFrame) {
+            if (pending_.size() - offset - sizeof(Frame) < frame.size_)
+                break;
+            onBytes(std::string_view(pending_).substr(offset + sizeof(Frame), frame.size_));
+            offset += sizeof(Frame) + frame.size_;
+            continue;
+        }
+        // The region is read in place. If the writer reused it meanwhile,
+        // as it was not released in time, the bytes may have changed, and
+        // the frame fails once the callback returned.
+        auto region = ring_->region(frame);
+        try {
+            onBytes(region);
+        }
+        catch (...) {
+            ring_->release(frame);
+            throw;
+        }
+        if (!ring_->release(frame))
+            raise("Shared memory region was reused while it was read.");
+        offset += sizeof(Frame);
+    }
+    pending_.erase(0, offset);
+}
+
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "mapget/detail/http-connection-pool.h"
+#include "mapget/service/cluster.h"
+#include "mapget/service/executor.h"
+
+#include <memory>
+
+namespace mapget
+{
+
+/**
+ * ClusterPeer which loads tiles through the /tiles endpoint of the
+ * HttpService of another cluster node. The requests carry the
+ * HttpService::ClusterForwardedHeader, so that the peer loads the tiles
+ * itself, using its cache and its data sources. A peer which does not
+ * answer is backed off, see HttpConnectionPool, and its tiles are loaded
+ * by this node meanwhile.
+ *
+ * The tiles keep the node ids of the data sources which loaded them. Each
+ * node may assign different ids to the strings of a node id, e.g. for
+ * in-process data sources. So the tiles are decoded with the string pools
+ * of the peer, which are mirrored per peer, and then re-encoded with the
+ * string pools of the local cache.
+ */
+class HttpClusterPeer : public ClusterPeer
+{
+public:
+    /** Construct from joint host:port string. */
+    static std::shared_ptr<HttpClusterPeer> fromHostPort(std::string const& hostPort);
+
+    HttpClusterPeer(std::string const& host, uint16_t port);
+    ~HttpClusterPeer() override;
+
+    std::vector<TileLayer::Ptr> get(
+        std::vector<MapTileKey> const& keys,
+        Cache::Ptr const& cache,
+        DataSourceInfo const& info,
+        std::vector<CancellationToken::Ptr> const& cancellations) override;
+
+    /** Runs get(...) on a request thread of the peer. */
+    void getAsync(
+        std::vector<MapTileKey> const& keys,
+        Cache::Ptr const& cache,
+        DataSourceInfo const& info,
+        std::function<void(std::vector<TileLayer::Ptr>)> onResult,
+        std::vector<CancellationToken::Ptr> const& cancellations) override;
+
+    /** Number of idle connections which are kept to the peer. */
+    static constexpr size_t MaxIdleConnections = 8;
+
+private:
+    std::unique_ptr<HttpConnectionPool> connections_;
+
+    // Mirror of the string pools of the peer, by node id.
+    std::shared_ptr<TileLayerStream::StringPoolCache> peerStrings_;
+
+    // Runs the blocking requests of getAsync(), one thread per idle connection.
+    // Declared last, so that running requests finish before the connections are destroyed.
+    std::unique_ptr<Executor> requestExecutor_;
+};
+
+}
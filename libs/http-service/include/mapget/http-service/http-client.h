@@ -16,8 +16,17 @@ public:
     /**
      * Connect to a running mapget HTTP service. Immediately calls the /sources
      * endpoint, and caches the result for the lifetime of this object.
+     * If numDecodingThreads is larger than one, the received tile layers
+     * are decoded on a thread pool of that size. They are still passed
+     * to the request in the order in which they were received.
+     * Up to numConnections requests are streamed in parallel, over
+     * keep-alive connections which are reused by later requests.
      */
-    explicit HttpClient(std::string const& host, uint16_t port);
+    explicit HttpClient(
+        std::string const& host,
+        uint16_t port,
+        size_t numDecodingThreads = 1,
+        size_t numConnections = 4);
     ~HttpClient();
 
     /**
@@ -27,6 +36,9 @@ public:
 
     /**
      * Post a Request for a number of tiles from a particular map layer.
+     * Returns immediately: The response is streamed in the background,
+     * and its tile layers are passed to the request as they arrive.
+     * Use LayerTilesRequest::wait() to wait for the request to be done.
      */
     LayerTilesRequest::Ptr request(LayerTilesRequest::Ptr const& request);
 
@@ -14,9 +14,40 @@ namespace mapget {
 class HttpService : public HttpServer, public Service
 {
 public:
+    /** Response header of a /session request, which carries the id for its /session/update requests. */
+    static constexpr auto SessionIdHeader = "X-Mapget-Session";
+
+    /**
+     * Request header of a /tiles request which another cluster node forwarded,
+     * see Service::setCluster(). Its tiles are loaded by this node.
+     */
+    static constexpr auto ClusterForwardedHeader = "X-Mapget-Cluster-Forwarded";
+
+    /** Maximum number of tiles which the bbox of a /query request may overlap. */
+    static constexpr size_t MaxQueryTiles = 65536;
+
     explicit HttpService(Cache::Ptr cache = std::make_shared<MemCache>(), bool watchConfig = false);
     ~HttpService() override;
 
+    /**
+     * Bound the number of tiles which /tiles and /query requests may queue, in total
+     * and per client. Clients are identified by their clientId, or by their
+     * address if they do not send one. Requests above a limit are rejected
+     * with status 429 and a Retry-After header, unless nothing is queued.
+     * A limit of zero, the default, means that there is no limit.
+     */
+    void setAdmissionLimits(size_t maxQueuedTiles, size_t maxQueuedTilesPerClient);
+
+    /**
+     * Bound the number of /tiles, /query and /session responses which are
+     * streamed at the same time. Each of them holds a server thread until it
+     * is done, so a limit below the thread pool size, see setThreadPoolSize(),
+     * keeps threads free for short requests like /sources and /locate.
+     * Requests above the limit are rejected with status 503 and a Retry-After
+     * header. A limit of zero, the default, means that there is no limit.
+     */
+    void setMaxStreams(size_t maxStreams);
+
 protected:
     void setup(httplib::Server& server) override;
 
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "mapget/model/tileid.h"
+
+#include <nlohmann/json.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace mapget
+{
+
+/**
+ * Load generator which replays a map viewer workload against the /tiles
+ * endpoint of a running HttpService. Each simulated client shows a viewport
+ * of tiles which it pans, and now and then zooms, after a random think time.
+ * Like a map viewer, a client requests the tiles of its new viewport under
+ * its clientId without waiting for the previous response, so the service
+ * aborts the previous request. The responses are counted, but not decoded.
+ */
+class LoadGenerator
+{
+public:
+    struct Options
+    {
+        std::string host_;
+        uint16_t port_ = 0;
+        std::string mapId_;
+        /** Layers which are requested for each viewport. Default is all layers of the map. */
+        std::vector<std::string> layerIds_;
+        /** WGS84 area of the viewports, as (min-lon, min-lat, max-lon, max-lat). */
+        std::array<double, 4> bbox_{};
+        std::vector<uint16_t> zoomLevels_ = {13};
+        size_t numClients_ = 16;
+        std::chrono::milliseconds duration_{30000};
+        /** Size of a viewport in tiles. */
+        uint32_t viewportWidth_ = 6;
+        uint32_t viewportHeight_ = 4;
+        /** Mean time between two viewport changes of a client. */
+        std::chrono::milliseconds thinkTime_{250};
+        /** Probability that a viewport change zooms instead of panning. */
+        double zoomProbability_ = 0.1;
+        /** Share of the requests for JSONL responses, the others are binary. */
+        double jsonlShare_ = 0.2;
+        /** Seed of the workload, so that runs can be compared. */
+        uint32_t seed_ = 1;
+    };
+
+    struct Report
+    {
+        size_t requests_ = 0;
+        size_t completedRequests_ = 0;  // Requests which received all tiles
+        size_t abortedRequests_ = 0;    // Responses which ended early, e.g. by a newer viewport
+        size_t rejectedRequests_ = 0;   // Requests which the admission control rejected
+        size_t failedRequests_ = 0;     // Requests which failed otherwise
+        size_t tiles_ = 0;
+        size_t bytes_ = 0;
+        double seconds_ = 0;
+
+        /** Milliseconds from sending a request until it received its first tile. */
+        std::vector<double> timesToFirstTile_;
+        /** Milliseconds from sending a request until it received each tile. */
+        std::vector<double> tileLatencies_;
+
+        /** Summary with tiles/s and p50/p99/p999 latencies. */
+        [[nodiscard]] nlohmann::json toJson() const;
+    };
+
+    explicit LoadGenerator(Options options);
+
+    /** Run the workload for the configured duration, and wait for the last responses. */
+    Report run();
+
+private:
+    struct Client;
+
+    // Get the tiles of a viewport around a center, at a zoom level.
+    [[nodiscard]] std::vector<TileId> viewportTiles(double lon, double lat, uint16_t zoomLevel) const;
+
+    Options options_;
+};
+
+}
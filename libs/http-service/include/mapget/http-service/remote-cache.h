@@ -0,0 +1,136 @@
+#pragma once
+
+#include "mapget/detail/http-server.h"
+#include "mapget/service/cache.h"
+#include "mapget/service/memcache.h"
+
+#include <memory>
+#include <string>
+
+namespace mapget
+{
+
+/**
+ * HTTP server which shares the blobs of a persistent cache, e.g. a
+ * RocksDBCache, with the RemoteCaches of several mapget instances. So
+ * a tile which is loaded by one instance is served by all of them.
+ *
+ * The store is only used through its blob methods. A string pool blob is
+ * only replaced by a longer one, and only if both agree on their common
+ * strings, otherwise the put is rejected with status 409. The responses
+ * to tile requests carry the highest string id of every string pool which
+ * was read or written since the server started, as a JSON object in the
+ * StringPoolsHeader, so that clients can catch up with their pools.
+ *
+ * Writes are only accepted if they are allowed, otherwise they are
+ * rejected with status 403. If a write token is given, writes must carry
+ * it as bearer token, otherwise they are rejected with status 401. Tile
+ * blobs are only stored if they are tile layer messages of a supported
+ * protocol version for their key, and string pools only if they parse.
+ * Malformed requests are rejected with status 400.
+ */
+class CacheServer : public HttpServer
+{
+public:
+    explicit CacheServer(Cache::Ptr store, bool allowWrites = false, std::string writeToken = {});
+    ~CacheServer() override;
+
+    /** Header of tile responses with the highest string id per node id. */
+    static constexpr auto StringPoolsHeader = "X-Mapget-String-Pools";
+
+protected:
+    void setup(httplib::Server& server) override;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+/**
+ * Cache which stores its blobs on a CacheServer, which is shared by several
+ * mapget instances. Recently used and put blobs are kept in a local MemCache,
+ * the hot tier. Concurrent reads of the same tile which is not in the hot
+ * tier are coalesced into a single request.
+ *
+ * The string pools of the instances are kept consistent through the server:
+ * a pool which is behind the highest string id reported by the server is
+ * updated before a tile of the server is returned. This works as long as
+ * the strings of a node id are assigned by a single data source process,
+ * e.g. a remote data source which all instances connect to. If the server
+ * rejects a string pool, or a pool of the server contradicts the local
+ * one, another process assigned different strings to the node id. Then
+ * the cache stops using the server, and only keeps the hot tier.
+ *
+ * Errors while contacting the server are logged. Failed reads are misses,
+ * and failed writes leave the blob in the hot tier only.
+ */
+class RemoteCache : public Cache
+{
+public:
+    /** Construct from joint host:port string. */
+    static std::shared_ptr<RemoteCache> fromHostPort(
+        std::string const& hostPort,
+        uint32_t maxHotTiles = 1024,
+        size_t maxHotBytes = 0,
+        std::string writeToken = {});
+
+    /**
+     * Construct a cache which uses the CacheServer at the given
+     * host and port, with the limits of the hot tier, see MemCache.
+     * The write token is sent to the server as bearer token.
+     */
+    RemoteCache(
+        std::string const& host,
+        uint16_t port,
+        uint32_t maxHotTiles = 1024,
+        size_t maxHotBytes = 0,
+        std::string writeToken = {});
+    ~RemoteCache() override;
+
+    /** Retrieve a TileLayer blob for a MapTileKey. */
+    std::optional<std::string> getTileLayerBlob(MapTileKey const& k) override;
+
+    /** Retrieve a TileLayer blob from the hot tier, or from the server. */
+    SharedBlob getSharedTileLayerBlob(MapTileKey const& k) override;
+
+    /** Upsert a TileLayer blob in the hot tier and on the server. */
+    void putTileLayerBlob(MapTileKey const& k, std::string const& v) override;
+
+    /** Remove a TileLayer blob from the hot tier and from the server. */
+    void eraseTileLayerBlob(MapTileKey const& k) override;
+
+    /** Retrieve a string-pool blob from the server. */
+    std::optional<std::string> getStringPoolBlob(std::string_view const& sourceNodeId) override;
+
+    /** Upsert a string-pool blob on the server. */
+    void putStringPoolBlob(std::string_view const& sourceNodeId, std::string const& v) override;
+
+    /** Compression dictionaries are shared through the server. */
+    std::optional<std::string> getCompressionDictionaryBlob(std::string const& key) override;
+    void putCompressionDictionaryBlob(std::string const& key, std::string const& v) override;
+
+    /**
+     * Enriches the statistics with the following values:
+     * `remote-hits`, `remote-misses`: Number of tiles which were (not) found on the server.
+     * `remote-errors`: Number of failed requests to the server.
+     * `coalesced-reads`: Number of tile reads which waited for the request of another read.
+     * `refreshed-string-pools`: Number of string pool updates from the server.
+     * `remote-disabled`: Whether the server is not used anymore, due to conflicting string pools.
+     * `hot-tier`: The statistics of the hot tier.
+     */
+    nlohmann::json getStatistics() const override;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+
+    // Fetch a tile blob from the server, and update the string pools
+    // which are behind the server, see CacheServer::StringPoolsHeader.
+    SharedBlob fetchTileLayerBlob(MapTileKey const& k);
+    // Read the strings of a node which were added on the server into its pool.
+    void refreshStringPool(std::string const& nodeId, simfil::StringId highestString);
+    // Stop using the server, as another process assigned different strings to a node id.
+    void disableRemote(std::string const& nodeId);
+};
+
+}
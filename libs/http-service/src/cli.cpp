@@ -1,13 +1,27 @@
 #include "cli.h"
+#include "cluster-peer.h"
 #include "http-client.h"
 #include "http-service.h"
+#include "load-generator.h"
+#include "remote-cache.h"
 #include "mapget/log.h"
 
 #include "mapget/http-datasource/datasource-client.h"
+#include "mapget/service/archive.h"
+#include "mapget/service/memory.h"
 #include "mapget/service/rocksdbcache.h"
+#include "mapget/service/tieredcache.h"
 #include "mapget/service/config.h"
 
 #include <CLI/CLI.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <set>
 #include <string>
 #include <vector>
 #include <yaml-cpp/yaml.h>
@@ -139,38 +153,187 @@ public:
     }
 };
 
+// Get the optional `timeout` of a data source config, in seconds.
+template <typename Duration>
+std::chrono::milliseconds configTimeout(YAML::Node const& config, Duration defaultTimeout)
+{
+    if (auto timeout = config["timeout"])
+        return std::chrono::milliseconds(static_cast<int64_t>(timeout.as<double>() * 1000));
+    return std::chrono::duration_cast<std::chrono::milliseconds>(defaultTimeout);
+}
+
 void registerDefaultDatasourceTypes() {
     auto& service = DataSourceConfigService::get();
     service.registerDataSourceType(
         "DataSourceHost",
         [](YAML::Node const& config) -> DataSource::Ptr {
             if (auto url = config["url"])
-                return RemoteDataSource::fromHostPort(url.as<std::string>());
+                return RemoteDataSource::fromHostPort(
+                    url.as<std::string>(),
+                    configTimeout(config, RemoteDataSource::DefaultInfoTimeout));
             else
                 throw std::runtime_error("Missing `url` field.");
         });
     service.registerDataSourceType(
         "DataSourceProcess",
         [](YAML::Node const& config) -> DataSource::Ptr {
-            if (auto cmd = config["cmd"])
-                return std::make_shared<RemoteDataSourceProcess>(cmd.as<std::string>());
+            if (auto cmd = config["cmd"]) {
+                auto processes = config["processes"] ? config["processes"].as<size_t>() : 1;
+                return std::make_shared<RemoteDataSourceProcess>(
+                    cmd.as<std::string>(),
+                    processes,
+                    configTimeout(config, RemoteDataSourceProcess::DefaultStartTimeout));
+            }
             else
                 throw std::runtime_error("Missing `cmd` field.");
         });
+    service.registerDataSourceType(
+        "TileArchive",
+        [](YAML::Node const& config) -> DataSource::Ptr {
+            if (auto path = config["path"])
+                return std::make_shared<ArchiveDataSource>(
+                    path.as<std::string>(),
+                    config["map"] ? config["map"].as<std::string>() : "");
+            else
+                throw std::runtime_error("Missing `path` field.");
+        });
 }
 
 bool isPostConfigEndpointEnabled_ = false;
 }
 
-struct ServeCommand
+/** Options which configure the cache of a service, see makeCache(). */
+struct CacheOptions
 {
-    int port_ = 0;
-    std::vector<std::string> datasourceHosts_;
-    std::vector<std::string> datasourceExecutables_;
     std::string cacheType_;
     std::string cachePath_;
+    std::string cacheServer_;
+    std::string cacheServerToken_;
     int64_t cacheMaxTiles_ = 1024;
+    int64_t cacheDiskMaxTiles_ = 16384;
+    int64_t cacheMaxMb_ = 0;
+    int64_t cacheMaxLiveMb_ = Cache::DefaultMaxLiveTileBytes / (1024 * 1024);
+    int64_t cacheWriteBehind_ = 0;
+    int cacheCompression_ = 0;
+    bool cacheLocateIndex_ = false;
     bool clearCache_ = false;
+
+    void addOptions(CLI::App* cmd)
+    {
+        cmd->add_option(
+            "-c,--cache-type",
+            cacheType_,
+            "From [memory|rocksdb|tiered|remote], default memory, rocksdb (Technology Preview), "
+            "tiered for a memory cache in front of a rocksdb cache, remote for a memory cache "
+            "in front of a cache server which is shared with other instances.")
+            ->default_val("memory");
+        cmd->add_option(
+            "--cache-dir", cachePath_, "Path to store RocksDB cache.")
+            ->default_val("mapget-cache");
+        cmd->add_option(
+            "--cache-server",
+            cacheServer_,
+            "Cache server for the remote cache in format <host:port>, see the cache-server command.");
+        cmd->add_option(
+            "--cache-server-token",
+            cacheServerToken_,
+            "Write token of the cache server, see the --write-token of the cache-server command.");
+        cmd->add_option(
+            "--cache-max-tiles", cacheMaxTiles_, "0 for unlimited, default 1024.")
+            ->default_val(1024);
+        cmd->add_option(
+            "--cache-disk-max-tiles",
+            cacheDiskMaxTiles_,
+            "Max number of tiles in the rocksdb tier of the tiered cache, 0 for unlimited, default 16384.")
+            ->default_val(16384);
+        cmd->add_option(
+            "--cache-max-mb", cacheMaxMb_, "Max total size of cached tiles in MB for the memory cache, 0 for unlimited, default 0.")
+            ->default_val(0);
+        cmd->add_option(
+            "--cache-max-live-mb",
+            cacheMaxLiveMb_,
+            "Memory budget in MB for recently used tiles, which are kept as parsed objects. 0 to disable, default 128.")
+            ->default_val(cacheMaxLiveMb_);
+        cmd->add_option(
+            "--cache-write-behind",
+            cacheWriteBehind_,
+            "Deliver loaded tiles before they are cached, and queue up to this many tiles for a "
+            "background writer, which drops the oldest ones when it falls behind. 0 to disable, default 0.")
+            ->default_val(0);
+        cmd->add_option(
+            "--cache-compression",
+            cacheCompression_,
+            "zstd level at which cached tiles are compressed, with a dictionary per map layer. 0 to disable, default 0.")
+            ->default_val(0);
+        cmd->add_option(
+            "--cache-locate-index",
+            cacheLocateIndex_,
+            "Index the feature ids of cached tiles, so that locate requests for them are answered "
+            "without the data sources. Stored by the rocksdb and tiered caches.")
+            ->default_val(false);
+        cmd->add_option(
+            "--clear-cache", clearCache_, "Clear existing cache at startup.")
+            ->default_val(false);
+    }
+
+    std::shared_ptr<Cache> makeCache() const
+    {
+        std::shared_ptr<Cache> cache;
+        if (cacheType_ == "rocksdb") {
+            cache = std::make_shared<RocksDBCache>(cacheMaxTiles_, cachePath_, clearCache_);
+        }
+        else if (cacheType_ == "tiered") {
+            log().info("Initializing in-memory cache in front of rocksdb cache.");
+            cache = std::make_shared<TieredCache>(
+                std::make_shared<MemCache>(
+                    cacheMaxTiles_,
+                    static_cast<size_t>(std::max<int64_t>(cacheMaxMb_, 0)) * 1024 * 1024),
+                std::make_shared<RocksDBCache>(cacheDiskMaxTiles_, cachePath_, clearCache_));
+        }
+        else if (cacheType_ == "remote") {
+            if (cacheServer_.empty())
+                raise("The remote cache requires a --cache-server.");
+            cache = RemoteCache::fromHostPort(
+                cacheServer_,
+                cacheMaxTiles_,
+                static_cast<size_t>(std::max<int64_t>(cacheMaxMb_, 0)) * 1024 * 1024,
+                cacheServerToken_);
+        }
+        else if (cacheType_ == "memory") {
+            log().info("Initializing in-memory cache.");
+            cache = std::make_shared<MemCache>(
+                cacheMaxTiles_,
+                static_cast<size_t>(std::max<int64_t>(cacheMaxMb_, 0)) * 1024 * 1024);
+        }
+        else {
+            raise(fmt::format("Cache type {} not supported!", cacheType_));
+        }
+        cache->setMaxLiveTileBytes(static_cast<size_t>(std::max<int64_t>(cacheMaxLiveMb_, 0)) * 1024 * 1024);
+        cache->setMaxQueuedTileLayers(static_cast<size_t>(std::max<int64_t>(cacheWriteBehind_, 0)));
+        cache->setCompressionLevel(cacheCompression_);
+        cache->setLocateIndexEnabled(cacheLocateIndex_);
+        return cache;
+    }
+};
+
+struct ServeCommand
+{
+    int port_ = 0;
+    std::vector<std::string> datasourceHosts_;
+    std::vector<std::string> datasourceExecutables_;
+    CacheOptions cacheOptions_;
+    bool prefetch_ = false;
+    bool memoryAccounting_ = false;
+    int64_t maxQueuedTiles_ = 0;
+    int64_t maxQueuedTilesPerClient_ = 0;
+    int64_t httpThreads_ = 0;
+    int64_t maxStreams_ = 0;
+    int64_t traceBufferSize_ = 0;
+    int64_t memoryLimitMb_ = 0;
+    int64_t maxMemoizedQueries_ = TileFeatureLayer::DefaultMaxMemoizedQueries;
+    std::vector<std::string> clientClassWeights_;
+    std::string clusterName_;
+    std::vector<std::string> clusterPeers_;
     std::string webapp_;
     CLI::App& app_;
 
@@ -195,18 +358,70 @@ struct ServeCommand
             "Data source executable paths, including arguments. "
             "Can be specified multiple times."),
             "--config <yaml-file>");
+        cacheOptions_.addOptions(serveCmd);
+        serveCmd->add_flag(
+            "--prefetch",
+            prefetch_,
+            "Prefetch the neighbor, parent and child tiles of requested tiles while data sources are idle.");
+        serveCmd->add_flag(
+            "--memory-accounting",
+            memoryAccounting_,
+            "Record the memory usage of loaded tiles by column, in their info and in the /status statistics.");
         serveCmd->add_option(
-            "-c,--cache-type", cacheType_, "From [memory|rocksdb], default memory, rocksdb (Technology Preview).")
-            ->default_val("memory");
+            "--max-queued-tiles",
+            maxQueuedTiles_,
+            "Maximum number of tiles queued by all /tiles requests, 0 for unlimited, default 0.")
+            ->default_val(0);
         serveCmd->add_option(
-            "--cache-dir", cachePath_, "Path to store RocksDB cache.")
-            ->default_val("mapget-cache");
+            "--max-queued-tiles-per-client",
+            maxQueuedTilesPerClient_,
+            "Maximum number of tiles queued by the /tiles requests of one client, 0 for unlimited, default 0.")
+            ->default_val(0);
         serveCmd->add_option(
-            "--cache-max-tiles", cacheMaxTiles_, "0 for unlimited, default 1024.")
-            ->default_val(1024);
+            "--http-threads",
+            httpThreads_,
+            "Number of threads which handle HTTP connections, 0 for the httplib default, default 0.")
+            ->default_val(0);
         serveCmd->add_option(
-            "--clear-cache", clearCache_, "Clear existing cache at startup.")
-            ->default_val(false);
+            "--max-streams",
+            maxStreams_,
+            "Maximum number of streamed /tiles, /query and /session responses, 0 for unlimited, default 0.")
+            ->default_val(0);
+        serveCmd->add_option(
+            "--memory-limit-mb",
+            memoryLimitMb_,
+            "Memory budget in MB for the caches, string pools, loading tiles and response buffers. "
+            "Above 80% of it, caches are shrunk and fewer tiles are loaded in parallel, at the limit, "
+            "new /tiles requests are rejected. Default is the MAPGET_MEMORY_LIMIT_MB environment "
+            "variable, or 0 (unlimited).");
+        serveCmd->add_option(
+            "--max-memoized-queries",
+            maxMemoizedQueries_,
+            "Number of /query expressions whose matching features each cached tile remembers, "
+            "0 to evaluate every query anew, default 64.")
+            ->default_val(TileFeatureLayer::DefaultMaxMemoizedQueries);
+        serveCmd->add_option(
+            "--trace-buffer-size",
+            traceBufferSize_,
+            "Record tracing spans, and keep up to this many for export via GET /traces. "
+            "Default is the MAPGET_TRACE_BUFFER_SIZE environment variable, or 0 (disabled).");
+        serveCmd->add_option(
+            "--client-class-weight",
+            clientClassWeights_,
+            "Scheduling weight of a client class in format <class>=<weight>, e.g. interactive=4. "
+            "Clients name their class in the clientClass of their requests. Classes without "
+            "a weight have weight 1. Can be specified multiple times.");
+        serveCmd->add_option(
+            "--cluster-name",
+            clusterName_,
+            "Name of this node in a cluster, by which its peers know it, in format <host:port>. "
+            "Required by --cluster-peer.");
+        serveCmd->add_option(
+            "--cluster-peer",
+            clusterPeers_,
+            "Other mapget node of a cluster in format <host:port>. Each tile is loaded by one node "
+            "of the cluster, which the others forward its requests to. All nodes must name the same "
+            "nodes. Can be specified multiple times.");
         serveCmd->add_option(
             "-w,--webapp",
             webapp_,
@@ -222,17 +437,7 @@ struct ServeCommand
     {
         log().info("Starting server on port {}.", port_);
 
-        std::shared_ptr<Cache> cache;
-        if (cacheType_ == "rocksdb") {
-            cache = std::make_shared<RocksDBCache>(cacheMaxTiles_, cachePath_, clearCache_);
-        }
-        else if (cacheType_ == "memory") {
-            log().info("Initializing in-memory cache.");
-            cache = std::make_shared<MemCache>(cacheMaxTiles_);
-        }
-        else {
-            raise(fmt::format("Cache type {} not supported!", cacheType_));
-        }
+        auto cache = cacheOptions_.makeCache();
 
         bool watchConfig = false;
         if (auto config = app_.get_config_ptr()) {
@@ -242,6 +447,30 @@ struct ServeCommand
         }
 
         HttpService srv(cache, watchConfig);
+        srv.setPrefetching(prefetch_);
+        srv.setMemoryAccounting(memoryAccounting_);
+        srv.setAdmissionLimits(maxQueuedTiles_, maxQueuedTilesPerClient_);
+        srv.setMaxStreams(maxStreams_);
+        srv.setThreadPoolSize(httpThreads_);
+        for (auto const& classWeight : clientClassWeights_) {
+            auto delimiterPos = classWeight.find('=');
+            if (delimiterPos == std::string::npos)
+                raiseFmt("Client class weight {} is not in the format <class>=<weight>.", classWeight);
+            srv.setClientClassWeight(classWeight.substr(0, delimiterPos), std::stod(classWeight.substr(delimiterPos + 1)));
+        }
+        if (!clusterPeers_.empty()) {
+            if (clusterName_.empty())
+                raise("A cluster requires a --cluster-name.");
+            std::map<std::string, ClusterPeer::Ptr> peers;
+            for (auto const& peer : clusterPeers_)
+                peers[peer] = HttpClusterPeer::fromHostPort(peer);
+            srv.setCluster(clusterName_, std::move(peers));
+        }
+        if (traceBufferSize_ > 0)
+            Tracer::instance().enable(traceBufferSize_);
+        if (memoryLimitMb_ > 0)
+            MemoryBudget::instance().setLimit(static_cast<size_t>(memoryLimitMb_) * 1024 * 1024);
+        TileFeatureLayer::setMaxMemoizedQueries(static_cast<size_t>(std::max<int64_t>(maxMemoizedQueries_, 0)));
 
         if (!datasourceHosts_.empty()) {
             for (auto& ds : datasourceHosts_) {
@@ -338,6 +567,7 @@ struct FetchCommand
         };
         request->onFeatureLayer(fn);
         request->onSourceDataLayer(fn);
+        request->onBinaryLayer(fn);
         cli.request(request)->wait();
 
         if (request->getStatus() == RequestStatus::NoDataSource)
@@ -347,6 +577,478 @@ struct FetchCommand
     }
 };
 
+struct BenchCommand
+{
+    std::string server_, reportFile_;
+    LoadGenerator::Options options_;
+    std::vector<double> bbox_;
+    int64_t durationMs_ = 30000;
+    int64_t thinkTimeMs_ = 250;
+
+    explicit BenchCommand(CLI::App& app)
+    {
+        auto benchCmd = app.add_subcommand(
+            "bench",
+            "Replays a map viewer workload of many clients against a server, and reports its throughput and latency.");
+        benchCmd->add_option("-s,--server", server_, "Server to connect to in format <host:port>.")
+            ->required();
+        benchCmd->add_option("-m,--map", options_.mapId_, "Map to retrieve.")->required();
+        benchCmd->add_option(
+            "-l,--layer",
+            options_.layerIds_,
+            "Layer of the map to retrieve. Can be specified multiple times. Default is all layers of the map.");
+        benchCmd->add_option(
+            "-b,--bbox",
+            bbox_,
+            "WGS84 bounding box of the viewports, in the format <min-lon> <min-lat> <max-lon> <max-lat>.")
+            ->expected(4)
+            ->required();
+        benchCmd->add_option(
+            "-z,--zoom",
+            options_.zoomLevels_,
+            "Zoom level of the viewports. Can be specified multiple times, clients then zoom between them. Default is 13.");
+        benchCmd->add_option("-c,--clients", options_.numClients_, "Number of concurrent clients, default 16.")
+            ->default_val(16);
+        benchCmd->add_option("--duration", durationMs_, "Duration of the workload in ms, default 30000.")
+            ->default_val(30000);
+        benchCmd->add_option(
+            "--viewport-width", options_.viewportWidth_, "Width of a viewport in tiles, default 6.")
+            ->default_val(6);
+        benchCmd->add_option(
+            "--viewport-height", options_.viewportHeight_, "Height of a viewport in tiles, default 4.")
+            ->default_val(4);
+        benchCmd->add_option(
+            "--think-time",
+            thinkTimeMs_,
+            "Mean time in ms after which a client pans or zooms its viewport, default 250.")
+            ->default_val(250);
+        benchCmd->add_option(
+            "--jsonl-share",
+            options_.jsonlShare_,
+            "Share of the requests which ask for JSONL instead of binary responses, default 0.2.")
+            ->default_val(0.2);
+        benchCmd->add_option("--seed", options_.seed_, "Seed of the workload, default 1.")
+            ->default_val(1);
+        benchCmd->add_option("--report", reportFile_, "File to write the JSON report to, in addition to stdout.");
+        benchCmd->callback([this]() { bench(); });
+    }
+
+    void bench()
+    {
+        auto delimiterPos = server_.find(':');
+        options_.host_ = server_.substr(0, delimiterPos);
+        options_.port_ = static_cast<uint16_t>(std::stoi(server_.substr(delimiterPos + 1)));
+        options_.bbox_ = {bbox_[0], bbox_[1], bbox_[2], bbox_[3]};
+        options_.duration_ = std::chrono::milliseconds(durationMs_);
+        options_.thinkTime_ = std::chrono::milliseconds(thinkTimeMs_);
+
+        auto report = LoadGenerator(options_).run().toJson();
+        std::cout << report.dump(4) << std::endl;
+        if (!reportFile_.empty())
+            std::ofstream(reportFile_) << report.dump(4) << std::endl;
+        log().info(
+            "{:.1f} tiles/s, time to first tile p50 {:.1f} ms, p99 {:.1f} ms, tile latency p99 {:.1f} ms.",
+            report["tilesPerSecond"].get<double>(),
+            report["timeToFirstTileMs"]["p50"].get<double>(),
+            report["timeToFirstTileMs"]["p99"].get<double>(),
+            report["tileLatencyMs"]["p99"].get<double>());
+    }
+};
+
+struct CacheServerCommand
+{
+    int port_ = 0;
+    std::string cachePath_;
+    int64_t cacheMaxTiles_ = 0;
+    bool clearCache_ = false;
+    bool allowWrites_ = false;
+    std::string writeToken_;
+
+    explicit CacheServerCommand(CLI::App& app)
+    {
+        auto cacheServerCmd = app.add_subcommand(
+            "cache-server",
+            "Starts a server which stores the tiles of several instances with a remote cache in a rocksdb cache.");
+        cacheServerCmd->add_option(
+            "-p,--port",
+            port_,
+            "Port to start the server on. Default is 0.")
+            ->default_val("0");
+        cacheServerCmd->add_option(
+            "--cache-dir", cachePath_, "Path to store RocksDB cache.")
+            ->default_val("mapget-cache");
+        cacheServerCmd->add_option(
+            "--cache-max-tiles", cacheMaxTiles_, "0 for unlimited, default 0.")
+            ->default_val(0);
+        cacheServerCmd->add_option(
+            "--clear-cache", clearCache_, "Clear existing cache at startup.")
+            ->default_val(false);
+        cacheServerCmd->add_flag(
+            "--allow-writes",
+            allowWrites_,
+            "Accept the tiles, string pools and dictionaries of remote caches. Without it, the server is read-only.");
+        cacheServerCmd->add_option(
+            "--write-token",
+            writeToken_,
+            "Token which remote caches must send as bearer token to write, see --cache-server-token.");
+        cacheServerCmd->callback([this]() { serve(); });
+    }
+
+    void serve()
+    {
+        log().info("Starting cache server on port {}.", port_);
+        CacheServer srv(std::make_shared<RocksDBCache>(cacheMaxTiles_, cachePath_, clearCache_), allowWrites_, writeToken_);
+        srv.go("0.0.0.0", port_);
+        srv.waitForSignal();
+    }
+};
+
+/**
+ * Get the (layer, tile) pairs of the given zoom levels within a WGS84 bbox,
+ * or within the coverage of each layer, grouped by layer.
+ */
+std::vector<std::pair<std::string, TileId>> enumerateTiles(
+    Service& service,
+    std::string const& mapId,
+    std::vector<std::string> const& layerIds,
+    std::vector<uint16_t> const& zoomLevels,
+    std::vector<double> const& bbox)
+{
+    // Layers are sorted by id, so that the order is the same in each run.
+    std::map<std::string, std::shared_ptr<LayerInfo>> selectedLayers;
+    for (auto const& info : service.info()) {
+        if (info.mapId_ != mapId)
+            continue;
+        for (auto const& [layerId, layerInfo] : info.layers_) {
+            if (layerIds.empty() || std::find(layerIds.begin(), layerIds.end(), layerId) != layerIds.end())
+                selectedLayers.emplace(layerId, layerInfo);
+        }
+    }
+
+    std::vector<std::pair<std::string, TileId>> result;
+    for (auto const& [layerId, layerInfo] : selectedLayers) {
+        // Bounding boxes as (min-lon, min-lat, max-lon, max-lat).
+        std::vector<std::array<double, 4>> boxes;
+        if (!bbox.empty()) {
+            boxes.push_back({bbox[0], bbox[1], bbox[2], bbox[3]});
+        }
+        else {
+            for (auto const& coverage : layerInfo->coverage_) {
+                auto sw = coverage.min_.sw();
+                auto ne = coverage.max_.ne();
+                auto otherSw = coverage.max_.sw();
+                auto otherNe = coverage.min_.ne();
+                boxes.push_back({
+                    std::min(sw.x, otherSw.x),
+                    std::min(sw.y, otherSw.y),
+                    std::max(ne.x, otherNe.x),
+                    std::max(ne.y, otherNe.y)});
+            }
+        }
+        if (boxes.empty())
+            log().warn("Layer {} has no coverage, specify a --bbox to load it.", layerId);
+
+        // Tiles are loaded along the Hilbert curve, so that
+        // neighbouring tiles are filled close to each other.
+        std::set<uint64_t> seenTiles;
+        std::vector<TileId> layerTiles;
+        for (auto const& box : boxes) {
+            for (auto zoomLevel : zoomLevels) {
+                for (auto const& tileId : TileId::tilesInBBox({box[0], box[1]}, {box[2], box[3]}, zoomLevel)) {
+                    if (layerInfo->covers(tileId) && seenTiles.insert(tileId.value_).second)
+                        layerTiles.push_back(tileId);
+                }
+            }
+        }
+        TileId::sort(layerTiles, TileId::Order::Hilbert);
+        for (auto const& tileId : layerTiles)
+            result.emplace_back(layerId, tileId);
+    }
+    if (result.empty())
+        raise(fmt::format("Found no tiles to load for map {}.", mapId));
+    return result;
+}
+
+struct WarmCommand
+{
+    std::string map_;
+    std::vector<std::string> layers_;
+    std::vector<uint16_t> zoomLevels_;
+    std::vector<double> bbox_;
+    std::vector<std::string> datasourceHosts_;
+    std::vector<std::string> datasourceExecutables_;
+    CacheOptions cacheOptions_;
+    int64_t batchSize_ = 256;
+    int64_t parallelBatches_ = 4;
+    std::string progressFile_;
+    CLI::App& app_;
+
+    explicit WarmCommand(CLI::App& app) : app_(app)
+    {
+        auto warmCmd = app.add_subcommand(
+            "warm",
+            "Fills the cache with the tiles of map layers, so that a server which uses the cache starts warm.");
+        warmCmd->add_option("-m,--map", map_, "Map to warm up.")->required();
+        warmCmd->add_option(
+            "-l,--layer",
+            layers_,
+            "Layer of the map to warm up. Can be specified multiple times. Default is all layers of the map.");
+        warmCmd->add_option(
+            "-z,--zoom",
+            zoomLevels_,
+            "Zoom level of the tiles to warm up. Can be specified multiple times.")
+            ->required();
+        warmCmd->add_option(
+            "-b,--bbox",
+            bbox_,
+            "WGS84 bounding box of the tiles, in the format <min-lon> <min-lat> <max-lon> <max-lat>. "
+            "Default is the coverage of each layer.")
+            ->expected(4);
+        warmCmd->add_option(
+            "-d,--datasource-host",
+            datasourceHosts_,
+            "Data sources in format <host:port>. Can be specified multiple times.");
+        warmCmd->add_option(
+            "-e,--datasource-exe",
+            datasourceExecutables_,
+            "Data source executable paths, including arguments. Can be specified multiple times.");
+        cacheOptions_.addOptions(warmCmd);
+        warmCmd->add_option(
+            "--batch-size",
+            batchSize_,
+            "Number of tiles which are requested at once, default 256.")
+            ->default_val(256);
+        warmCmd->add_option(
+            "--parallel-batches",
+            parallelBatches_,
+            "Number of batches which are requested at the same time, default 4.")
+            ->default_val(4);
+        warmCmd->add_option(
+            "--progress-file",
+            progressFile_,
+            "File which records the number of completed tiles, so that an interrupted warm-up resumes there.");
+        warmCmd->callback([this]() { warm(); });
+    }
+
+    void warm()
+    {
+        if (cacheOptions_.cacheType_ == "memory")
+            log().warn("Warming up a memory cache, which is lost once the warm-up is done.");
+        auto cache = cacheOptions_.makeCache();
+
+        bool useConfig = false;
+        if (auto config = app_.get_config_ptr(); config && !config->empty()) {
+            useConfig = true;
+            registerDefaultDatasourceTypes();
+            DataSourceConfigService::get().setConfigFilePath(config->as<std::string>());
+        }
+
+        Service service(cache, useConfig);
+        for (auto& ds : datasourceHosts_)
+            service.add(RemoteDataSource::fromHostPort(ds));
+        for (auto& ds : datasourceExecutables_)
+            service.add(std::make_shared<RemoteDataSourceProcess>(ds));
+        // The sources of the config are made in the background.
+        if (useConfig && !service.waitForConfig())
+            log().warn("Timeout while waiting for the data sources of the config.");
+
+        // The tiles are enumerated in a fixed order, so that a warm-up
+        // can be resumed with the number of completed tiles.
+        auto tiles = enumerateTiles(service);
+        size_t done = 0;
+        auto progressKey = fmt::format("{}/{}", map_, tiles.size());
+        if (!progressFile_.empty()) {
+            std::ifstream progress(progressFile_);
+            std::string key;
+            if (progress >> key >> done && key == progressKey) {
+                log().info("Resuming warm-up after {} tiles.", done);
+            }
+            else {
+                done = 0;
+            }
+        }
+
+        log().info("Warming up {} tiles of map {}.", tiles.size() - std::min(done, tiles.size()), map_);
+        auto batchSize = static_cast<size_t>(std::max<int64_t>(batchSize_, 1));
+        auto parallelBatches = static_cast<size_t>(std::max<int64_t>(parallelBatches_, 1));
+        auto start = std::chrono::steady_clock::now();
+        size_t warmed = 0;
+        std::atomic_size_t failed = 0;
+        auto onLayer = [&failed](auto&& layer) {
+            if (layer->error())
+                ++failed;
+        };
+
+        // Batches are requested while earlier ones are still running, so the
+        // data sources work on several of them. They are completed in order,
+        // so that the progress only covers tiles of completed batches.
+        std::deque<LayerTilesRequest::Ptr> batches;
+        size_t next = done;
+        while (done < tiles.size()) {
+            while (next < tiles.size() && batches.size() < parallelBatches) {
+                // A batch contains the tiles of one layer.
+                auto const& layerId = tiles[next].first;
+                std::vector<TileId> batch;
+                for (; next < tiles.size() && batch.size() < batchSize && tiles[next].first == layerId; ++next)
+                    batch.push_back(tiles[next].second);
+
+                auto request = std::make_shared<LayerTilesRequest>(map_, layerId, batch);
+                request->onFeatureLayer(onLayer);
+                request->onSourceDataLayer(onLayer);
+                request->onBinaryLayer(onLayer);
+                if (!service.request({request}))
+                    raise(fmt::format("No data source provides layer {} of map {}.", layerId, map_));
+                batches.push_back(std::move(request));
+            }
+
+            auto request = std::move(batches.front());
+            batches.pop_front();
+            request->wait();
+            if (request->getStatus() != RequestStatus::Success)
+                raise(fmt::format("Warm-up request for layer {} failed.", request->layerId_));
+
+            done += request->tiles_.size();
+            warmed += request->tiles_.size();
+            if (!progressFile_.empty())
+                std::ofstream(progressFile_) << progressKey << " " << done << std::endl;
+
+            auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            log().info(
+                "Warmed {}/{} tiles ({:.1f} tiles/s, {} failed).",
+                done,
+                tiles.size(),
+                seconds > 0 ? static_cast<double>(warmed) / seconds : 0.,
+                failed.load());
+        }
+
+        // Queued tiles are written when the service is destroyed.
+        log().info("Warm-up done, cache statistics: {}", cache->getStatistics().dump());
+    }
+
+    /** Get the (layer, tile) pairs to warm up, grouped by layer. */
+    std::vector<std::pair<std::string, TileId>> enumerateTiles(Service& service)
+    {
+        return mapget::enumerateTiles(service, map_, layers_, zoomLevels_, bbox_);
+    }
+};
+
+struct ExportCommand
+{
+    std::string map_;
+    std::vector<std::string> layers_;
+    std::vector<uint16_t> zoomLevels_;
+    std::vector<double> bbox_;
+    std::vector<std::string> datasourceHosts_;
+    std::vector<std::string> datasourceExecutables_;
+    std::string outputFile_;
+    int64_t batchSize_ = 256;
+    CLI::App& app_;
+
+    explicit ExportCommand(CLI::App& app) : app_(app)
+    {
+        auto exportCmd = app.add_subcommand(
+            "export",
+            "Writes the tiles of map layers into a single tile archive file, which a TileArchive data source serves.");
+        exportCmd->add_option("-m,--map", map_, "Map to export.")->required();
+        exportCmd->add_option(
+            "-l,--layer",
+            layers_,
+            "Layer of the map to export. Can be specified multiple times. Default is all layers of the map.");
+        exportCmd->add_option(
+            "-z,--zoom",
+            zoomLevels_,
+            "Zoom level of the tiles to export. Can be specified multiple times.")
+            ->required();
+        exportCmd->add_option(
+            "-b,--bbox",
+            bbox_,
+            "WGS84 bounding box of the tiles, in the format <min-lon> <min-lat> <max-lon> <max-lat>. "
+            "Default is the coverage of each layer.")
+            ->expected(4);
+        exportCmd->add_option(
+            "-d,--datasource-host",
+            datasourceHosts_,
+            "Data sources in format <host:port>. Can be specified multiple times.");
+        exportCmd->add_option(
+            "-e,--datasource-exe",
+            datasourceExecutables_,
+            "Data source executable paths, including arguments. Can be specified multiple times.");
+        exportCmd->add_option("-o,--output", outputFile_, "Tile archive file to write.")->required();
+        exportCmd->add_option(
+            "--batch-size",
+            batchSize_,
+            "Number of tiles which are requested at once, default 256.")
+            ->default_val(256);
+        exportCmd->callback([this]() { exportTiles(); });
+    }
+
+    void exportTiles()
+    {
+        auto archive = std::make_shared<TileArchiveWriter>(outputFile_);
+
+        bool useConfig = false;
+        if (auto config = app_.get_config_ptr(); config && !config->empty()) {
+            useConfig = true;
+            registerDefaultDatasourceTypes();
+            DataSourceConfigService::get().setConfigFilePath(config->as<std::string>());
+        }
+
+        std::vector<DataSourceInfo> archivedDataSources;
+        {
+            // The service puts each loaded tile into the archive, with its add-on data.
+            Service service(archive, useConfig);
+            for (auto& ds : datasourceHosts_)
+                service.add(RemoteDataSource::fromHostPort(ds));
+            for (auto& ds : datasourceExecutables_)
+                service.add(std::make_shared<RemoteDataSourceProcess>(ds));
+            // The sources of the config are made in the background.
+            if (useConfig && !service.waitForConfig())
+                log().warn("Timeout while waiting for the data sources of the config.");
+
+            auto tiles = enumerateTiles(service, map_, layers_, zoomLevels_, bbox_);
+            log().info("Exporting {} tiles of map {} to {}.", tiles.size(), map_, outputFile_);
+            auto batchSize = static_cast<size_t>(std::max<int64_t>(batchSize_, 1));
+            size_t done = 0;
+            size_t failed = 0;
+            std::set<std::string> exportedLayers;
+            while (done < tiles.size()) {
+                // A batch contains the tiles of one layer.
+                auto const& layerId = tiles[done].first;
+                exportedLayers.insert(layerId);
+                std::vector<TileId> batch;
+                for (auto i = done; i < tiles.size() && batch.size() < batchSize && tiles[i].first == layerId; ++i)
+                    batch.push_back(tiles[i].second);
+
+                auto request = std::make_shared<LayerTilesRequest>(map_, layerId, batch);
+                auto onLayer = [&failed](auto&& layer) {
+                    if (layer->error())
+                        ++failed;
+                };
+                request->onFeatureLayer(onLayer);
+                request->onSourceDataLayer(onLayer);
+                request->onBinaryLayer(onLayer);
+                if (!service.request({request}))
+                    raise(fmt::format("No data source provides layer {} of map {}.", layerId, map_));
+                request->wait();
+                if (request->getStatus() != RequestStatus::Success)
+                    raise(fmt::format("Export request for layer {} failed.", layerId));
+                done += batch.size();
+                log().info("Exported {}/{} tiles ({} failed).", done, tiles.size(), failed);
+            }
+
+            // The archive describes the exported layers of the map, without add-ons.
+            for (auto info : service.info()) {
+                if (info.mapId_ != map_ || info.isAddOn_)
+                    continue;
+                std::erase_if(info.layers_, [&](auto const& layer) { return !exportedLayers.contains(layer.first); });
+                if (!info.layers_.empty())
+                    archivedDataSources.push_back(std::move(info));
+            }
+        }
+        archive->finish(archivedDataSources);
+    }
+};
+
 std::string pathToSchema;
 int runFromCommandLine(std::vector<std::string> args, bool requireSubcommand)
 {
@@ -378,6 +1080,10 @@ int runFromCommandLine(std::vector<std::string> args, bool requireSubcommand)
 
     ServeCommand serveCommand(app);
     FetchCommand fetchCommand(app);
+    BenchCommand benchCommand(app);
+    WarmCommand warmCommand(app);
+    ExportCommand exportCommand(app);
+    CacheServerCommand cacheServerCommand(app);
 
     try {
         std::reverse(args.begin(), args.end());
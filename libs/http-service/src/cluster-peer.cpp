@@ -0,0 +1,175 @@
+#include "cluster-peer.h"
+#include "http-service.h"
+#include "mapget/detail/http-compression.h"
+#include "mapget/log.h"
+#include "mapget/model/sourcedatalayer.h"
+
+#include "httplib.h"
+#include "nlohmann/json.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace mapget
+{
+
+std::shared_ptr<HttpClusterPeer> HttpClusterPeer::fromHostPort(std::string const& hostPort)
+{
+    auto delimiterPos = hostPort.find(':');
+    if (delimiterPos == std::string::npos)
+        raiseFmt("Cluster node address {} is not in the format <host:port>.", hostPort);
+    std::string host = hostPort.substr(0, delimiterPos);
+    int port = std::stoi(hostPort.substr(delimiterPos + 1, hostPort.size()));
+    return std::make_shared<HttpClusterPeer>(host, port);
+}
+
+HttpClusterPeer::HttpClusterPeer(std::string const& host, uint16_t port)
+    : connections_(std::make_unique<HttpConnectionPool>(
+          std::vector<HttpConnectionPool::Endpoint>{{host, port}},
+          MaxIdleConnections,
+          [](size_t, httplib::Client& client)
+          {
+              auto sources = client.Get("/sources");
+              return sources && sources->status == 200;
+          })),
+      peerStrings_(std::make_shared<TileLayerStream::StringPoolCache>()),
+      requestExecutor_(std::make_unique<Executor>(MaxIdleConnections))
+{
+}
+
+HttpClusterPeer::~HttpClusterPeer() = default;
+
+std::vector<TileLayer::Ptr> HttpClusterPeer::get(
+    std::vector<MapTileKey> const& keys,
+    Cache::Ptr const& cache,
+    DataSourceInfo const& info,
+    std::vector<CancellationToken::Ptr> const& cancellations)
+{
+    using namespace nlohmann;
+
+    std::vector<TileLayer::Ptr> result(keys.size());
+    if (keys.empty())
+        return result;
+
+    auto connection = connections_->acquire();
+    if (!connection) {
+        auto endpoint = connections_->endpoints().front();
+        raiseFmt("Cluster node {}:{} is backed off.", endpoint.host_, endpoint.port_);
+    }
+
+    // The download is stopped once all tiles are cancelled.
+    auto allCancelled = [&cancellations, &keys]()
+    {
+        return cancellations.size() == keys.size() && std::all_of(
+            cancellations.begin(), cancellations.end(), [](auto const& c) { return c && c->isCancelled(); });
+    };
+
+    auto tileIds = json::array();
+    for (auto const& key : keys)
+        tileIds.push_back(key.tileId_.value_);
+
+    httplib::Request tilesRequest;
+    tilesRequest.method = "POST";
+    tilesRequest.path = "/tiles";
+    tilesRequest.set_header("Accept-Encoding", ZstdContentEncoding);
+    tilesRequest.set_header("Content-Type", "application/json");
+    tilesRequest.set_header(HttpService::ClusterForwardedHeader, "1");
+    if (auto trace = TraceContext::current(); trace.isValid())
+        tilesRequest.set_header(TraceParentHeader, trace.toTraceParent());
+    tilesRequest.body = json::object({
+        {"requests", json::array({{
+            {"mapId", keys.front().mapId_},
+            {"layerId", keys.front().layerId_},
+            {"tileIds", tileIds}}})},
+        {"stringPoolOffsets", peerStrings_->stringPoolOffsets()},
+        {"protocolVersion", TileLayerStream::CurrentProtocolVersion.toJson()}
+    }).dump();
+
+    // The tiles are read while they arrive, so that the string pool updates
+    // of the stream are applied to the mirrored pools of the peer in order.
+    // Then their strings are moved to the pools of the local cache.
+    std::unordered_map<uint64_t, TileLayer::Ptr> receivedTiles;
+    TileLayerStream::Reader reader(
+        [&](auto&& mapId, auto&& layerId) { return info.getLayer(std::string(layerId)); },
+        [&](auto&& tile)
+        {
+            if (auto featureTile = std::dynamic_pointer_cast<TileFeatureLayer>(tile))
+                featureTile->setStrings(cache->getStringPool(tile->nodeId()));
+            else if (auto sourceDataTile = std::dynamic_pointer_cast<TileSourceDataLayer>(tile))
+                sourceDataTile->setStrings(cache->getStringPool(tile->nodeId()));
+            receivedTiles[tile->tileId().value_] = tile;
+        },
+        peerStrings_);
+
+    int status = 0;
+    std::unique_ptr<ZstdStreamDecompressor> decompressor;
+    std::string decompressed;
+    tilesRequest.response_handler = [&](httplib::Response const& response)
+    {
+        status = response.status;
+        if (response.get_header_value("Content-Encoding") == ZstdContentEncoding)
+            decompressor = std::make_unique<ZstdStreamDecompressor>();
+        return true;
+    };
+    tilesRequest.content_receiver = [&](const char* data, size_t size, uint64_t, uint64_t)
+    {
+        if (status != 200)
+            return true;
+        std::string_view bytes(data, size);
+        if (decompressor) {
+            decompressed.clear();
+            decompressor->decompress(bytes, decompressed);
+            bytes = decompressed;
+        }
+        reader.read(bytes);
+        return !allCancelled();
+    };
+
+    httplib::Response response;
+    auto error = httplib::Error::Success;
+    if (!connection->client().send(tilesRequest, response, error) && !allCancelled()) {
+        connection->setFailed();
+        raiseFmt("Tiles request failed: {}", httplib::to_string(error));
+    }
+    // A peer which rejects the request, e.g. as it is overloaded, stays usable.
+    if (status != 200 && !allCancelled())
+        raiseFmt("Tiles request failed with status {}.", status);
+
+    for (auto i = 0u; i < keys.size(); ++i) {
+        auto it = receivedTiles.find(keys[i].tileId_.value_);
+        if (it != receivedTiles.end())
+            result[i] = it->second;
+    }
+    return result;
+}
+
+void HttpClusterPeer::getAsync(
+    std::vector<MapTileKey> const& keys,
+    Cache::Ptr const& cache,
+    DataSourceInfo const& info,
+    std::function<void(std::vector<TileLayer::Ptr>)> onResult,
+    std::vector<CancellationToken::Ptr> const& cancellations)
+{
+    requestExecutor_->post(
+        [this,
+         keys,
+         cache,
+         info,
+         onResult = std::move(onResult),
+         cancellations,
+         trace = TraceContext::current()]()
+        {
+            TraceScope traceScope(trace);
+            std::vector<TileLayer::Ptr> result(keys.size());
+            try {
+                result = get(keys, cache, info, cancellations);
+            }
+            catch (std::exception& e) {
+                auto endpoint = connections_->endpoints().front();
+                log().warn("Could not load tiles from cluster node {}:{}: {}", endpoint.host_, endpoint.port_, e.what());
+            }
+            onResult(std::move(result));
+        });
+}
+
+}
@@ -1,27 +1,47 @@
 #include "http-client.h"
+#include "mapget/detail/http-compression.h"
 #include "httplib.h"
 #include "mapget/log.h"
+#include "mapget/service/executor.h"
+
+#include <mutex>
 
 namespace mapget
 {
 
 struct HttpClient::Impl {
-    httplib::Client client_;
+    std::string host_;
+    uint16_t port_;
     std::unordered_map<std::string, DataSourceInfo> sources_;
     std::shared_ptr<TileLayerStream::StringPoolCache> stringPoolProvider_;
+    // Decodes the received tile layers, if more than one decoding thread is used.
+    std::unique_ptr<Executor> decodingExecutor_;
+
+    // Keep-alive connections which are not used by a request right now.
+    std::mutex connectionsMutex_;
+    std::vector<std::unique_ptr<httplib::Client>> idleConnections_;
 
-    Impl(std::string const& host, uint16_t port) : client_(host, port)
+    // Streams the responses of the requests, one per connection. Declared
+    // last, so that running requests finish before the connections are gone.
+    std::unique_ptr<Executor> requestExecutor_;
+
+    Impl(std::string const& host, uint16_t port, size_t numDecodingThreads, size_t numConnections)
+        : host_(host), port_(port)
     {
+        if (numDecodingThreads > 1)
+            decodingExecutor_ = std::make_unique<Executor>(numDecodingThreads);
         stringPoolProvider_ = std::make_shared<TileLayerStream::StringPoolCache>();
-        client_.set_keep_alive(false);
-        auto sourcesJson = client_.Get("/sources");
+        auto connection = acquireConnection();
+        auto sourcesJson = connection->Get("/sources");
         if (!sourcesJson || sourcesJson->status != 200)
             raise(
-                fmt::format("Failed to fetch sources: [{}]", sourcesJson->status));
+                fmt::format("Failed to fetch sources: [{}]", sourcesJson ? sourcesJson->status : -1));
         for (auto const& info : nlohmann::json::parse(sourcesJson->body)) {
             auto parsedInfo = DataSourceInfo::fromJson(info);
             sources_.emplace(parsedInfo.mapId_, parsedInfo);
         }
+        releaseConnection(std::move(connection));
+        requestExecutor_ = std::make_unique<Executor>(std::max<size_t>(numConnections, 1));
     }
 
     [[nodiscard]] std::shared_ptr<LayerInfo>
@@ -32,9 +52,112 @@ struct HttpClient::Impl {
             raise("Could not find map data source info");
         return mapIt->second.getLayer(std::string(layer));
     }
+
+    /** Take an idle connection, or open a new one. */
+    std::unique_ptr<httplib::Client> acquireConnection()
+    {
+        {
+            std::lock_guard lock(connectionsMutex_);
+            if (!idleConnections_.empty()) {
+                auto connection = std::move(idleConnections_.back());
+                idleConnections_.pop_back();
+                return connection;
+            }
+        }
+        auto connection = std::make_unique<httplib::Client>(host_, port_);
+        connection->set_keep_alive(true);
+        return connection;
+    }
+
+    /** Return a connection for reuse by a later request. */
+    void releaseConnection(std::unique_ptr<httplib::Client> connection)
+    {
+        std::lock_guard lock(connectionsMutex_);
+        idleConnections_.push_back(std::move(connection));
+    }
+
+    /** Post the /tiles request, and feed its response into the reader while it arrives. */
+    void streamTiles(LayerTilesRequest::Ptr const& request, TileLayerStream::Reader& reader)
+    {
+        using namespace nlohmann;
+
+        httplib::Request tilesRequest;
+        tilesRequest.method = "POST";
+        tilesRequest.path = "/tiles";
+        tilesRequest.set_header("Accept-Encoding", ZstdContentEncoding);
+        tilesRequest.set_header("Content-Type", "application/json");
+        tilesRequest.body = json::object({
+            {"requests", json::array({request->toJson()})},
+            {"stringPoolOffsets", reader.stringPoolCache()->stringPoolOffsets()},
+            {"protocolVersion", TileLayerStream::CurrentProtocolVersion.toJson()}
+        }).dump();
+
+        int status = 0;
+        std::unique_ptr<ZstdStreamDecompressor> decompressor;
+        std::string decompressed;
+        tilesRequest.response_handler = [&](httplib::Response const& response)
+        {
+            status = response.status;
+            if (response.get_header_value("Content-Encoding") == ZstdContentEncoding)
+                decompressor = std::make_unique<ZstdStreamDecompressor>();
+            return true;
+        };
+        tilesRequest.content_receiver = [&](const char* data, size_t size, uint64_t, uint64_t)
+        {
+            if (status != 200)
+                return true;
+            std::string_view bytes(data, size);
+            if (decompressor) {
+                decompressed.clear();
+                decompressor->decompress(bytes, decompressed);
+                bytes = decompressed;
+            }
+            reader.read(bytes);
+            return true;
+        };
+
+        auto connection = acquireConnection();
+        httplib::Response response;
+        httplib::Error error = httplib::Error::Success;
+        auto sent = connection->send(tilesRequest, response, error);
+        // A connection which failed may be closed, so it is not reused.
+        if (sent)
+            releaseConnection(std::move(connection));
+        reader.wait();
+
+        if (!sent) {
+            log().warn("Tiles request failed: {}", httplib::to_string(error));
+            request->setStatus(RequestStatus::Aborted);
+        }
+        else if (status == 400) {
+            request->setStatus(RequestStatus::NoDataSource);
+        }
+        else if (status == 429) {
+            // The server's admission control rejected the request.
+            log().warn("Tiles request was rejected, the server has too many queued tiles.");
+            request->setStatus(RequestStatus::Aborted);
+        }
+        else if (!request->isDone()) {
+            // The response ended before all tiles were received, which
+            // is expected if the server dropped tiles at their deadline.
+            auto now = std::chrono::steady_clock::now();
+            auto isLate = std::any_of(
+                request->tiles_.begin(),
+                request->tiles_.end(),
+                [&](auto const& tileId)
+                {
+                    auto deadline = request->deadline(tileId);
+                    return deadline && *deadline <= now;
+                });
+            request->setStatus(isLate ? RequestStatus::Expired : RequestStatus::Aborted);
+        }
+    }
 };
 
-HttpClient::HttpClient(const std::string& host, uint16_t port) : impl_(std::make_unique<Impl>(host, port)) {}
+HttpClient::HttpClient(const std::string& host, uint16_t port, size_t numDecodingThreads, size_t numConnections)
+    : impl_(std::make_unique<Impl>(host, port, numDecodingThreads, numConnections))
+{
+}
 
 HttpClient::~HttpClient() = default;
 
@@ -54,35 +177,26 @@ LayerTilesRequest::Ptr HttpClient::request(const LayerTilesRequest::Ptr& request
         return request;
     }
 
-    auto reader = std::make_unique<TileLayerStream::Reader>(
-        [this](auto&& mapId, auto&& layerId){return impl_->resolve(mapId, layerId);},
-        [request](auto&& result) { request->notifyResult(result); },
-        impl_->stringPoolProvider_);
-
-    using namespace nlohmann;
-
-    // TODO: Currently, cpp-httplib client-POST does not support async responses.
-    //  Those are only supported by GET. So, currently, this HttpClient
-    //  does not profit from the streaming response. However, erdblick is
-    //  is fully able to process async responses as it uses the browser fetch()-API.
-    auto tileResponse = impl_->client_.Post(
-        "/tiles",
-        json::object({
-            {"requests", json::array({request->toJson()})},
-            {"stringPoolOffsets", reader->stringPoolCache()->stringPoolOffsets()}
-        }).dump(),
-        "application/json");
-
-    if (tileResponse) {
-        if (tileResponse->status == 200) {
-            reader->read(tileResponse->body);
-        }
-        else if (tileResponse->status == 400) {
-            request->setStatus(mapget::RequestStatus::NoDataSource);
-        }
-        // TODO if multiple LayerTileRequests are ever sent by this client,
-        //  additionally handle RequestStatus::Aborted.
-    }
+    impl_->requestExecutor_->post(
+        [this, request]
+        {
+            auto reader = std::make_unique<TileLayerStream::Reader>(
+                [this](auto&& mapId, auto&& layerId){return impl_->resolve(mapId, layerId);},
+                [request](auto&& result) { request->notifyResult(result); },
+                impl_->stringPoolProvider_);
+            if (impl_->decodingExecutor_) {
+                reader->setParallelDecoding(
+                    [this](auto&& task) { impl_->decodingExecutor_->post(std::move(task)); });
+            }
+            try {
+                impl_->streamTiles(request, *reader);
+            }
+            catch (std::exception const& e) {
+                log().error("Tiles request failed: {}", e.what());
+                if (!request->isDone())
+                    request->setStatus(RequestStatus::Aborted);
+            }
+        });
 
     return request;
 }
@@ -1,12 +1,26 @@
 #include "http-service.h"
+#include "mapget/detail/http-compression.h"
 #include "mapget/log.h"
+#include "mapget/model/jsonwriter.h"
+#include "mapget/service/allocations.h"
 #include "mapget/service/config.h"
+#include "mapget/service/memory.h"
 
+#include <algorithm>
+#include <chrono>
 #include <condition_variable>
+#include <deque>
 #include <filesystem>
 #include <fstream>
+#include <iterator>
+#include <map>
 #include <mutex>
+#include <optional>
+#include <random>
+#include <shared_mutex>
 #include <sstream>
+#include <unordered_map>
+#include <variant>
 #include <vector>
 #include "cli.h"
 #include "httplib.h"
@@ -21,6 +35,45 @@ namespace mapget
 namespace
 {
 
+/**
+ * Get the ids of the tiles at the given zoom level, which overlap the
+ * WGS84 bounding box [minLon, minLat, maxLon, maxLat]. Raises if the
+ * zoom level is invalid, or if the box overlaps more than maxTiles tiles,
+ * before the tile ids are enumerated.
+ */
+std::vector<TileId> tileIdsInBBox(std::vector<double> const& bbox, int64_t zoomLevel, size_t maxTiles)
+{
+    if (bbox.size() != 4)
+        raise("The bbox of a query request must be an array [minLon, minLat, maxLon, maxLat].");
+    if (zoomLevel < 0 || zoomLevel > TileId::MaxZoomLevel)
+        raiseFmt("The zoomLevel of a query request must be between 0 and {}.", TileId::MaxZoomLevel);
+    Point corner(bbox[0], bbox[1]);
+    Point otherCorner(bbox[2], bbox[3]);
+    auto numTiles = TileId::numTilesInBBox(corner, otherCorner, static_cast<uint16_t>(zoomLevel));
+    if (numTiles > maxTiles)
+        raiseFmt("The bbox of the query request overlaps {} tiles, at most {} are allowed.", numTiles, maxTiles);
+    return TileId::tilesInBBox(corner, otherCorner, static_cast<uint16_t>(zoomLevel));
+}
+
+/**
+ * Convert the result of a simfil query to JSON. Objects and arrays,
+ * e.g. features or attributes, are converted through their toJson().
+ */
+nlohmann::json queryValueToJson(simfil::Value const& value)
+{
+    if (value.node && (value.isa(simfil::ValueType::Object) || value.isa(simfil::ValueType::Array)))
+        return value.node->toJson();
+    return std::visit(
+        [](auto&& scalar) -> nlohmann::json
+        {
+            if constexpr (std::is_constructible_v<nlohmann::json, decltype(scalar)>)
+                return scalar;
+            else
+                return nullptr;
+        },
+        value.getScalar());
+}
+
 /**
  * Hash a string using the SHA256 implementation.
  */
@@ -144,36 +197,346 @@ YAML::Node jsonToYaml(const nlohmann::json& json, std::unordered_map<std::string
 
     return node;
 }
+
+/** Get a new random id for a /session, which other clients cannot guess. */
+std::string newSessionId()
+{
+    static std::mutex mutex;
+    static std::mt19937_64 random{std::random_device{}()};
+    std::lock_guard lock(mutex);
+    return fmt::format("{:016x}{:016x}", random(), random());
+}
+
+/**
+ * Bounds the number of tiles which are queued by /tiles requests,
+ * both in total and per client. Tiles are reserved when a request
+ * is admitted, and released once they were delivered or their
+ * request is done. Also bounds the number of streamed responses,
+ * each of which holds a server thread until it is done.
+ * A limit of zero means that there is no limit.
+ */
+class AdmissionControl
+{
+public:
+    /**
+     * Reserve the given number of tiles for a client. Tiles which are
+     * still reserved by a request that the new request supersedes are
+     * not counted against the client limit. A request is always admitted
+     * if nothing is queued, so requests above a limit do not starve.
+     * Returns false if the request must be rejected.
+     */
+    bool tryAdmit(std::string const& clientKey, size_t numTiles, size_t supersededTiles)
+    {
+        std::unique_lock lock(mutex_);
+        auto& clientTiles = queuedTilesPerClient_[clientKey];
+        auto otherClientTiles = clientTiles - std::min(clientTiles, supersededTiles);
+        auto otherTiles = queuedTiles_ - std::min(queuedTiles_, supersededTiles);
+        auto exceeds = [numTiles](size_t queued, size_t limit)
+        { return limit > 0 && queued > 0 && queued + numTiles > limit; };
+
+        if (exceeds(otherClientTiles, maxQueuedTilesPerClient_) || exceeds(otherTiles, maxQueuedTiles_)) {
+            if (clientTiles == 0)
+                queuedTilesPerClient_.erase(clientKey);
+            ++rejectedRequests_;
+            return false;
+        }
+        clientTiles += numTiles;
+        queuedTiles_ += numTiles;
+        return true;
+    }
+
+    /** Release tiles which were reserved by tryAdmit(). */
+    void release(std::string const& clientKey, size_t numTiles)
+    {
+        std::unique_lock lock(mutex_);
+        auto clientIt = queuedTilesPerClient_.find(clientKey);
+        if (clientIt == queuedTilesPerClient_.end())
+            return;
+        numTiles = std::min(numTiles, clientIt->second);
+        clientIt->second -= numTiles;
+        queuedTiles_ -= numTiles;
+        if (clientIt->second == 0)
+            queuedTilesPerClient_.erase(clientIt);
+    }
+
+    /**
+     * Check whether the MemoryBudget admits a request, after letting it
+     * reclaim memory. Returns false if the request must be rejected,
+     * as the budget is exhausted.
+     */
+    bool tryAdmitMemory()
+    {
+        auto& memoryBudget = MemoryBudget::instance();
+        memoryBudget.reclaim();
+        if (!memoryBudget.isExhausted())
+            return true;
+        std::unique_lock lock(mutex_);
+        ++memoryRejectedRequests_;
+        return false;
+    }
+
+    void setLimits(size_t maxQueuedTiles, size_t maxQueuedTilesPerClient)
+    {
+        std::unique_lock lock(mutex_);
+        maxQueuedTiles_ = maxQueuedTiles;
+        maxQueuedTilesPerClient_ = maxQueuedTilesPerClient;
+    }
+
+    /**
+     * Reserve a server thread for a streamed response.
+     * Returns false if the request must be rejected.
+     */
+    bool tryOpenStream()
+    {
+        std::unique_lock lock(mutex_);
+        if (maxStreams_ > 0 && streams_ >= maxStreams_) {
+            ++rejectedStreams_;
+            return false;
+        }
+        ++streams_;
+        return true;
+    }
+
+    /** Release a stream which was reserved by tryOpenStream(). */
+    void closeStream()
+    {
+        std::unique_lock lock(mutex_);
+        streams_ -= std::min<size_t>(streams_, 1);
+    }
+
+    void setMaxStreams(size_t maxStreams)
+    {
+        std::unique_lock lock(mutex_);
+        maxStreams_ = maxStreams;
+    }
+
+    [[nodiscard]] nlohmann::json getStatistics() const
+    {
+        std::unique_lock lock(mutex_);
+        size_t maxClientTiles = 0;
+        for (auto const& [clientKey, numTiles] : queuedTilesPerClient_)
+            maxClientTiles = std::max(maxClientTiles, numTiles);
+        return {
+            {"max-queued-tiles", maxQueuedTiles_},
+            {"max-queued-tiles-per-client", maxQueuedTilesPerClient_},
+            {"queued-tiles", queuedTiles_},
+            {"queued-clients", queuedTilesPerClient_.size()},
+            {"max-client-queued-tiles", maxClientTiles},
+            {"rejected-requests", rejectedRequests_},
+            {"memory-rejected-requests", memoryRejectedRequests_},
+            {"max-streams", maxStreams_},
+            {"streams", streams_},
+            {"rejected-streams", rejectedStreams_}};
+    }
+
+private:
+    mutable std::mutex mutex_;
+    size_t maxQueuedTiles_ = 0;
+    size_t maxQueuedTilesPerClient_ = 0;
+    size_t queuedTiles_ = 0;
+    std::unordered_map<std::string, size_t> queuedTilesPerClient_;
+    int64_t rejectedRequests_ = 0;
+    int64_t memoryRejectedRequests_ = 0;
+    size_t maxStreams_ = 0;
+    size_t streams_ = 0;
+    int64_t rejectedStreams_ = 0;
+};
+
+/**
+ * Metrics of the /tiles responses. Serialization times are
+ * tracked per map and response type.
+ */
+class ResponseMetrics
+{
+public:
+    /** Get the serialization time histogram for a map and response type. */
+    Histogram& serializationTime(std::string const& mapId, std::string const& responseType)
+    {
+        auto key = std::make_pair(mapId, responseType);
+        {
+            std::shared_lock lock(mutex_);
+            auto it = serializationTime_.find(key);
+            if (it != serializationTime_.end())
+                return *it->second;
+        }
+        std::unique_lock lock(mutex_);
+        auto& histogram = serializationTime_[key];
+        if (!histogram)
+            histogram = std::make_unique<Histogram>();
+        return *histogram;
+    }
+
+    /** Count bytes which were streamed for a response type. */
+    void addStreamedBytes(std::string const& responseType, size_t numBytes)
+    {
+        {
+            std::shared_lock lock(mutex_);
+            auto it = streamedBytes_.find(responseType);
+            if (it != streamedBytes_.end()) {
+                *it->second += numBytes;
+                return;
+            }
+        }
+        std::unique_lock lock(mutex_);
+        auto& counter = streamedBytes_[responseType];
+        if (!counter)
+            counter = std::make_unique<std::atomic<uint64_t>>(0);
+        *counter += numBytes;
+    }
+
+    void write(MetricsWriter& writer) const
+    {
+        std::shared_lock lock(mutex_);
+        writer.family(
+            "mapget_serialization_duration_seconds",
+            "histogram",
+            "Duration of tile serialization for /tiles responses.");
+        for (auto const& [key, histogram] : serializationTime_)
+            writer.histogram(
+                "mapget_serialization_duration_seconds",
+                {{"map", key.first}, {"response_type", key.second}},
+                *histogram);
+
+        writer.family("mapget_streamed_bytes_total", "counter", "Bytes streamed in /tiles responses.");
+        for (auto const& [responseType, numBytes] : streamedBytes_)
+            writer.sample(
+                "mapget_streamed_bytes_total",
+                {{"response_type", responseType}},
+                static_cast<double>(numBytes->load()));
+    }
+
+private:
+    mutable std::shared_mutex mutex_;
+    std::map<std::pair<std::string, std::string>, std::unique_ptr<Histogram>> serializationTime_;
+    std::map<std::string, std::unique_ptr<std::atomic<uint64_t>>> streamedBytes_;
+};
+
 }  // namespace
 
 struct HttpService::Impl
 {
     HttpService& self_;
 
-    explicit Impl(HttpService& self) : self_(self) {}
+    explicit Impl(HttpService& self) : self_(self)
+    {
+        servedLayersReclaimerId_ = MemoryBudget::instance().addReclaimer(
+            [this](size_t bytes) { return reclaimServedLayers(bytes); });
+    }
+
+    ~Impl()
+    {
+        MemoryBudget::instance().removeReclaimer(servedLayersReclaimerId_);
+        MemoryBudget::instance().release(MemoryPool::DeltaBases, servedLayerBytes_);
+    }
+
+    std::shared_ptr<AdmissionControl> admissionControl_ = std::make_shared<AdmissionControl>();
+    std::shared_ptr<ResponseMetrics> responseMetrics_ = std::make_shared<ResponseMetrics>();
 
-    // Use a shared buffer for the responses and a mutex for thread safety.
+    // Recently served layers of requests which accept deltas,
+    // by tile key and timestamp, oldest first in servedLayerOrder_.
+    // Their bytes are reserved from the MemoryBudget, which may drop
+    // them early. Their eTags are remembered for much longer, in servedETags_.
+    static constexpr size_t MaxServedLayerBytes = 64 * 1024 * 1024;
+    static constexpr size_t MaxServedETags = 65536;
+    struct ServedLayer
+    {
+        TileFeatureLayer::Ptr layer_;
+        size_t bytes_ = 0;  // Estimated by TileLayer::memoryUsage()
+    };
+    mutable std::mutex servedLayersMutex_;
+    mutable std::unordered_map<std::string, ServedLayer> servedLayers_;
+    mutable std::deque<std::string> servedLayerOrder_;
+    mutable size_t servedLayerBytes_ = 0;
+    uint64_t servedLayersReclaimerId_ = 0;
+    mutable std::unordered_map<std::string, std::string> servedETags_;
+    mutable std::deque<std::string> servedETagOrder_;
+
+    // Use a queue of response chunks and a mutex for thread safety.
     struct HttpTilesRequestState
     {
         static constexpr auto binaryMimeType = "application/binary";
         static constexpr auto jsonlMimeType = "application/jsonl";
         static constexpr auto anyMimeType = "*/*";
 
+        // Serialized results are immutable, so they are shared between
+        // the producing threads and the content provider without copies.
+        using Chunk = std::shared_ptr<const std::string>;
+
         std::mutex mutex_;
         std::condition_variable resultEvent_;
 
         uint64_t requestId_;
-        std::stringstream buffer_;
+        // Results which were not streamed yet. The content provider takes
+        // them all at once and sends them without holding mutex_. They are
+        // reserved from the MemoryBudget until they were sent.
+        std::vector<Chunk> chunks_;
+        MemoryBudget::Reservation bufferedBytes_{MemoryPool::Buffers};
         std::string responseType_;
+        // Set if the client accepts zstd compressed responses.
+        std::unique_ptr<ZstdStreamCompressor> compressor_;
+        std::string compressedBuffer_;
+        // The writer tracks the strings which the client knows, so its
+        // messages are written in order. Its mutex is taken before mutex_,
+        // which is not held while serializing.
+        std::mutex writerMutex_;
         std::unique_ptr<TileLayerStream::Writer> writer_;
+        std::vector<Chunk> writtenChunks_;
         std::vector<LayerTilesRequest::Ptr> requests_;
+        // Projection of the feature layers of each request, see TileFeatureLayer::projected().
+        std::vector<TileFeatureLayer::Projection> projections_;
+        // Addresses of the source data which is served for each request, see TileSourceDataLayer::extract().
+        std::vector<std::vector<SourceDataAddress>> sourceDataAddresses_;
+        // Tiles which the client holds, of requests which accept deltas, see deltaResult().
+        struct BaseTile
+        {
+            Version mapVersion_;
+            int64_t timestamp_ = 0;
+        };
+        using BaseTiles = std::unordered_map<uint64_t, BaseTile>;
+        std::vector<std::optional<BaseTiles>> baseTiles_;
         TileLayerStream::StringPoolOffsetMap stringOffsets_;
 
+        std::shared_ptr<ResponseMetrics> responseMetrics_;
+
+        // Simfil query of a /query request, see addQueryResults().
+        std::string query_;
+        bool queryReturnsValues_ = false;
+        JsonLayout queryFeatureLayout_ = JsonLayout::Model;
+        std::optional<std::pair<Point, Point>> queryBBox_;
+        std::optional<TileFeatureLayer::AttributeFilter> queryAttributeFilter_;
+
+        // Span of the whole HTTP request, which the tile spans belong to.
+        Span span_;
+
+        // Set for the state of a /session, whose stream stays open for the
+        // requests of later updates, until the session is closed.
+        std::string sessionId_;
+        bool closed_ = false;
+        // Serializes the updates of a session, which add to requests_.
+        std::mutex updateMutex_;
+
+        // Tiles which this request holds in the admission control.
+        std::shared_ptr<AdmissionControl> admissionControl_;
+        std::string clientKey_;
+        // Scheduling class of the client, see LayerTilesRequest::clientClass_.
+        std::string clientClass_ = LayerTilesRequest::DefaultClientClass;
+        // Set if another cluster node forwarded the request, see LayerTilesRequest::clusterForwarded_.
+        bool clusterForwarded_ = false;
+        size_t reservedTiles_ = 0;
+        // Set if this request holds a stream of the admission control.
+        bool holdsStream_ = false;
+
         HttpTilesRequestState()
         {
             static std::atomic_uint64_t nextRequestId;
             writer_ = std::make_unique<TileLayerStream::Writer>(
-                [&, this](auto&& msg, auto&& msgType) { buffer_ << msg; },
+                [this](std::string_view header, std::string_view body, TileLayerStream::MessageType)
+                {
+                    std::string message;
+                    message.reserve(header.size() + body.size());
+                    message.append(header).append(body);
+                    writtenChunks_.push_back(std::make_shared<const std::string>(std::move(message)));
+                },
                 stringOffsets_);
             requestId_ = nextRequestId++;
         }
@@ -186,8 +549,57 @@ struct HttpService::Impl
             tileIds.reserve(requestJson["tileIds"].size());
             for (auto const& tid : requestJson["tileIds"].get<std::vector<uint64_t>>())
                 tileIds.emplace_back(tid);
-            requests_
-                .push_back(std::make_shared<LayerTilesRequest>(mapId, layerId, std::move(tileIds)));
+            auto request = std::make_shared<LayerTilesRequest>(mapId, layerId, std::move(tileIds));
+            request->traceContext_ = span_.context();
+            if (requestJson.contains("focus")) {
+                auto focus = requestJson["focus"].get<std::vector<double>>();
+                if (focus.size() != 2)
+                    raise("The focus of a tiles request must be an array [lon, lat].");
+                request->setFocus({focus[0], focus[1]});
+            }
+            if (requestJson.contains("simplify")) {
+                auto const& simplify = requestJson["simplify"];
+                if (simplify.is_boolean()) {
+                    if (simplify.get<bool>())
+                        request->setSimplification();
+                }
+                else {
+                    request->setSimplification(simplify.get<uint32_t>());
+                }
+            }
+            // Tiles which are sent as deltas to base tiles are never chunked.
+            if (requestJson.value("chunks", false) && !requestJson.contains("baseTiles"))
+                request->setChunks();
+            // Deadlines are given in milliseconds from the arrival of the request.
+            auto const now = std::chrono::steady_clock::now();
+            if (requestJson.contains("deadlineMs"))
+                request->setDeadline(now + std::chrono::milliseconds(requestJson["deadlineMs"].get<int64_t>()));
+            if (requestJson.contains("tileDeadlinesMs")) {
+                for (auto const& tileDeadline : requestJson["tileDeadlinesMs"]) {
+                    request->setDeadline(
+                        TileId(tileDeadline.at("tileId").get<uint64_t>()),
+                        now + std::chrono::milliseconds(tileDeadline.at("deadlineMs").get<int64_t>()));
+                }
+            }
+            requests_.push_back(std::move(request));
+            projections_.push_back(
+                requestJson.contains("projection") ?
+                    TileFeatureLayer::Projection::fromJson(requestJson["projection"]) :
+                    TileFeatureLayer::Projection{});
+            auto& sourceDataAddresses = sourceDataAddresses_.emplace_back();
+            if (requestJson.contains("sourceDataAddresses")) {
+                for (auto const& address : requestJson["sourceDataAddresses"].get<std::vector<uint64_t>>())
+                    sourceDataAddresses.emplace_back(address);
+            }
+            auto& baseTiles = baseTiles_.emplace_back();
+            if (requestJson.contains("baseTiles")) {
+                baseTiles.emplace();
+                for (auto const& baseTile : requestJson["baseTiles"]) {
+                    (*baseTiles)[baseTile.at("tileId").get<uint64_t>()] = {
+                        baseTile.contains("mapVersion") ? Version::fromJson(baseTile["mapVersion"]) : Version{},
+                        baseTile.at("timestamp").get<int64_t>()};
+                }
+            }
         }
 
         void setResponseType(std::string const& s)
@@ -204,22 +616,291 @@ struct HttpService::Impl
             raise(fmt::format("Unknown Accept-Header value {}", responseType_));
         }
 
-        void addResult(TileLayer::Ptr const& result)
+        [[nodiscard]] size_t numTiles() const
+        {
+            size_t result = 0;
+            for (auto const& request : requests_)
+                result += request->tiles_.size();
+            return result;
+        }
+
+        /**
+         * Reserve a stream of the admission control for the response, or
+         * reject the request with status 503 if too many are streamed.
+         */
+        bool tryOpenStream(std::shared_ptr<AdmissionControl> const& admissionControl, httplib::Response& res)
+        {
+            if (!admissionControl->tryOpenStream()) {
+                log().warn("Rejecting request {}: Too many streamed responses.", requestId_);
+                span_.setError("Too many streamed responses");
+                res.status = 503;  // Service Unavailable.
+                res.set_header("Retry-After", "1");
+                res.set_content(
+                    nlohmann::json::object({{"error", "Too many streamed responses, retry later."}}).dump(),
+                    "application/json");
+                return false;
+            }
+            admissionControl_ = admissionControl;
+            holdsStream_ = true;
+            return true;
+        }
+
+        /** Release the stream which was reserved by tryOpenStream(). */
+        void closeStream()
+        {
+            if (std::exchange(holdsStream_, false))
+                admissionControl_->closeStream();
+        }
+
+        /** Release the given number of reserved tiles, or all if nullopt. */
+        void releaseTiles(std::optional<size_t> numTiles = {})
+        {
+            auto released = std::min(numTiles.value_or(reservedTiles_), reservedTiles_);
+            if (released == 0 || !admissionControl_)
+                return;
+            reservedTiles_ -= released;
+            admissionControl_->release(clientKey_, released);
+        }
+
+        /** Queue chunks for the content provider, and release the tile they belong to. */
+        void addChunks(std::vector<Chunk>&& chunks)
         {
             std::unique_lock lock(mutex_);
-            log().debug("Response ready: {}", MapTileKey(*result).toString());
+            releaseTiles(1);
+            auto numBytes = bufferedBytes_.bytes();
+            for (auto const& chunk : chunks)
+                numBytes += chunk->size();
+            bufferedBytes_.resize(numBytes);
+            if (chunks_.empty())
+                chunks_ = std::move(chunks);
+            else
+                chunks_.insert(chunks_.end(), chunks.begin(), chunks.end());
+            chunks.clear();
+            resultEvent_.notify_one();
+        }
+
+        void addResult(TileLayer::Ptr const& result)
+        {
+            MAPGET_LOG_DEBUG("Response ready: {}", MapTileKey(*result).toString());
+            auto start = std::chrono::steady_clock::now();
+            Span serializeSpan("mapget.serialize", span_.context());
+            serializeSpan.setAttribute("mapget.tile", MapTileKey(*result).toString());
+            AllocationScope allocations(AllocationStage::Serialize);
             if (responseType_ == binaryMimeType) {
                 // Binary response
+                std::unique_lock writerLock(writerMutex_);
                 writer_->write(result);
+                addChunks(std::move(writtenChunks_));
             }
             else {
                 // JSON response
-                buffer_ << nlohmann::to_string(result->toJson()) + "\n";
+                std::string json;
+                result->writeJson(json);
+                json.push_back('\n');
+                addChunks({std::make_shared<const std::string>(std::move(json))});
             }
-            resultEvent_.notify_one();
+            responseMetrics_->serializationTime(result->mapId(), responseType_).observe(
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+
+        /**
+         * Evaluate the query on the features of a tile layer, and add a JSON line
+         * for each selected feature: the feature itself, or the query results.
+         * The query is evaluated without holding the lock, on the thread which
+         * provided the tile, so tiles are evaluated in parallel.
+         */
+        void addQueryResults(TileFeatureLayer::Ptr const& layer)
+        {
+            auto start = std::chrono::steady_clock::now();
+            Span evaluateSpan("mapget.query", span_.context());
+            evaluateSpan.setAttribute("mapget.tile", MapTileKey(*layer).toString());
+
+            std::string lines;
+            auto addMatch = [&](model_ptr<Feature> const& feature, std::vector<simfil::Value> const& values)
+            {
+                if (queryReturnsValues_) {
+                    auto valuesJson = nlohmann::json::array();
+                    for (auto const& value : values)
+                        valuesJson.emplace_back(queryValueToJson(value));
+                    lines.append(nlohmann::json::object({
+                        {"featureId", feature->id()->toString()},
+                        {"values", valuesJson}}).dump());
+                }
+                else
+                    writeJson(*feature, *layer->strings(), lines, queryFeatureLayout_);
+                lines.push_back('\n');
+            };
+
+            // A cached tile memoizes the features which match the query, so
+            // a repeated query only evaluates the values which it returns.
+            if (layer->isReadOnly() && TileFeatureLayer::maxMemoizedQueries() > 0) {
+                auto matches = layer->matchingFeatures(query_);
+                std::vector<model_ptr<Feature>> matchingFeatures;
+                if (queryBBox_) {
+                    // Both are in feature order.
+                    auto candidates = layer->findIntersecting(queryBBox_->first, queryBBox_->second);
+                    auto match = matches->begin();
+                    for (auto const& feature : candidates) {
+                        match = std::lower_bound(match, matches->end(), feature->addr().index());
+                        if (match != matches->end() && *match == feature->addr().index())
+                            matchingFeatures.emplace_back(feature);
+                    }
+                }
+                else
+                    for (auto featureIndex : *matches)
+                        matchingFeatures.emplace_back(layer->at(featureIndex));
+                for (auto const& feature : matchingFeatures)
+                    addMatch(feature, queryReturnsValues_ ? feature->evaluateAll(query_) : std::vector<simfil::Value>{});
+            }
+            else {
+                // Within a bbox, only candidates of the spatial index are evaluated.
+                // A numeric attribute comparison only evaluates the candidates of
+                // a scan over the attribute columns.
+                std::optional<std::vector<model_ptr<Feature>>> attributeCandidates;
+                if (queryAttributeFilter_)
+                    attributeCandidates = layer->findByAttribute(*queryAttributeFilter_);
+                std::vector<model_ptr<Feature>> candidates;
+                if (queryBBox_) {
+                    candidates = layer->findIntersecting(queryBBox_->first, queryBBox_->second);
+                    if (attributeCandidates) {
+                        // Both are in feature order.
+                        std::vector<model_ptr<Feature>> intersection;
+                        std::set_intersection(
+                            candidates.begin(),
+                            candidates.end(),
+                            attributeCandidates->begin(),
+                            attributeCandidates->end(),
+                            std::back_inserter(intersection),
+                            [](auto const& l, auto const& r) { return l->addr().index() < r->addr().index(); });
+                        candidates = std::move(intersection);
+                    }
+                }
+                else if (attributeCandidates)
+                    candidates = std::move(*attributeCandidates);
+                else
+                    for (auto const& feature : *layer)
+                        candidates.emplace_back(feature);
+
+                for (auto const& feature : candidates) {
+                    auto values = feature->evaluateAll(query_);
+                    if (TileFeatureLayer::queryMatches(values))
+                        addMatch(feature, values);
+                }
+            }
+
+            std::vector<Chunk> chunks;
+            if (!lines.empty())
+                chunks.push_back(std::make_shared<const std::string>(std::move(lines)));
+            addChunks(std::move(chunks));
+            responseMetrics_->serializationTime(layer->mapId(), responseType_).observe(
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+
+        /** Forward a cached tile layer message, which saves parsing and serializing the tile. */
+        void addResultMessage(
+            std::string const& mapId,
+            Cache::SharedBlob const& message,
+            std::shared_ptr<StringPool> const& strings)
+        {
+            auto start = std::chrono::steady_clock::now();
+            Span serializeSpan("mapget.serialize", span_.context());
+            serializeSpan.setAttribute("mapget.forwarded", static_cast<int64_t>(1));
+            AllocationScope allocations(AllocationStage::Serialize);
+            {
+                std::unique_lock writerLock(writerMutex_);
+                if (writer_->sendsUnchanged(*message)) {
+                    // The cached message is sent as its own chunk, without copying it.
+                    writer_->writeStringPool(strings->nodeId_, *strings);
+                    writtenChunks_.push_back(message);
+                }
+                else
+                    writer_->write(*message, *strings);
+                addChunks(std::move(writtenChunks_));
+            }
+            responseMetrics_->serializationTime(mapId, responseType_).observe(
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
         }
     };
 
+    /**
+     * Get the result for a layer of a request which accepts deltas: The
+     * delta against the tile which the client holds, if the layer which
+     * was served with its timestamp and map version is still remembered,
+     * otherwise the layer itself. The layer is remembered for later deltas.
+     * If the held layer had the same eTag(), e.g. because the tile was only
+     * filled again, a delta without changes is returned right away.
+     */
+    TileFeatureLayer::Ptr deltaResult(TileFeatureLayer::Ptr const& layer, HttpTilesRequestState::BaseTiles const& baseTiles) const
+    {
+        auto servedLayerKey = [](MapTileKey const& key, int64_t timestamp)
+        { return fmt::format("{}|{}", key.toString(), timestamp); };
+        auto tileKey = MapTileKey(*layer);
+        auto timestamp = std::chrono::duration_cast<std::chrono::microseconds>(layer->timestamp().time_since_epoch()).count();
+        auto eTag = layer->eTag();
+        auto bytes = layer->memoryUsage()["total"].get<size_t>();
+
+        TileFeatureLayer::Ptr base;
+        std::optional<int64_t> unchangedBaseTimestamp;
+        {
+            std::unique_lock lock(servedLayersMutex_);
+            auto baseTile = baseTiles.find(layer->tileId().value_);
+            if (baseTile != baseTiles.end()) {
+                auto baseKey = servedLayerKey(tileKey, baseTile->second.timestamp_);
+                auto baseETag = servedETags_.find(baseKey);
+                auto baseIt = servedLayers_.find(baseKey);
+                if (baseETag != servedETags_.end() && baseETag->second == eTag &&
+                    baseTile->second.mapVersion_ == layer->mapVersion())
+                    unchangedBaseTimestamp = baseTile->second.timestamp_;
+                else if (baseIt != servedLayers_.end() && baseIt->second.layer_->mapVersion() == baseTile->second.mapVersion_)
+                    base = baseIt->second.layer_;
+            }
+            auto [eTagIt, eTagInserted] = servedETags_.emplace(servedLayerKey(tileKey, timestamp), eTag);
+            if (eTagInserted) {
+                servedETagOrder_.push_back(eTagIt->first);
+                if (servedETagOrder_.size() > MaxServedETags) {
+                    servedETags_.erase(servedETagOrder_.front());
+                    servedETagOrder_.pop_front();
+                }
+            }
+            if (bytes <= MaxServedLayerBytes) {
+                auto [it, inserted] = servedLayers_.emplace(servedLayerKey(tileKey, timestamp), ServedLayer{layer, bytes});
+                if (inserted) {
+                    servedLayerOrder_.push_back(it->first);
+                    servedLayerBytes_ += bytes;
+                    MemoryBudget::instance().reserve(MemoryPool::DeltaBases, bytes);
+                    while (servedLayerBytes_ > MaxServedLayerBytes)
+                        eraseOldestServedLayer();
+                }
+            }
+        }
+        if (unchangedBaseTimestamp) {
+            return layer->unchangedDelta(std::chrono::time_point<std::chrono::system_clock>(
+                std::chrono::microseconds(*unchangedBaseTimestamp)));
+        }
+        if (!base)
+            return layer;
+        return layer->delta(base);
+    }
+
+    // Drop the oldest served layer. Requires servedLayersMutex_.
+    void eraseOldestServedLayer() const
+    {
+        auto it = servedLayers_.find(servedLayerOrder_.front());
+        servedLayerBytes_ -= it->second.bytes_;
+        MemoryBudget::instance().release(MemoryPool::DeltaBases, it->second.bytes_);
+        servedLayers_.erase(it);
+        servedLayerOrder_.pop_front();
+    }
+
+    size_t reclaimServedLayers(size_t bytes) const
+    {
+        std::unique_lock lock(servedLayersMutex_);
+        auto freed = servedLayerBytes_;
+        while (!servedLayerOrder_.empty() && freed - servedLayerBytes_ < bytes)
+            eraseOldestServedLayer();
+        return freed - servedLayerBytes_;
+    }
+
     mutable std::mutex clientRequestMapMutex_;
     mutable std::unordered_map<std::string, std::shared_ptr<HttpTilesRequestState>> requestStatePerClientId_;
 
@@ -246,6 +927,70 @@ struct HttpService::Impl
         }
     }
 
+    /**
+     * Number of tiles which are still reserved by the running
+     * request of the given client, which a new request would abort.
+     */
+    size_t supersededTiles(std::optional<std::string> const& clientId) const
+    {
+        if (!clientId)
+            return 0;
+        std::shared_ptr<HttpTilesRequestState> previousState;
+        {
+            std::unique_lock clientRequestMapAccess(clientRequestMapMutex_);
+            auto clientRequestIt = requestStatePerClientId_.find(*clientId);
+            if (clientRequestIt == requestStatePerClientId_.end())
+                return 0;
+            previousState = clientRequestIt->second;
+        }
+        std::unique_lock lock(previousState->mutex_);
+        return previousState->reservedTiles_;
+    }
+
+    /** Set up the callbacks of the i-th request of a state, which add its results to the state. */
+    void setupRequest(std::shared_ptr<HttpTilesRequestState> const& state, size_t i) const
+    {
+        auto& request = state->requests_[i];
+        request->clientId_ = state->clientKey_;
+        request->clientClass_ = state->clientClass_;
+        request->clusterForwarded_ = state->clusterForwarded_;
+        auto const& projection = state->projections_[i];
+        auto const& baseTiles = state->baseTiles_[i];
+        if (projection.keepsAll() && !baseTiles)
+            request->onFeatureLayer([state](auto&& layer) { state->addResult(layer); });
+        else if (!baseTiles)
+            request->onFeatureLayer([state, projection](auto&& layer) { state->addResult(layer->projected(projection)); });
+        else {
+            request->onFeatureLayer(
+                [this, state, projection, baseTiles = *baseTiles](auto&& layer)
+                { state->addResult(deltaResult(layer->projected(projection), baseTiles)); });
+        }
+        auto const& sourceDataAddresses = state->sourceDataAddresses_[i];
+        if (sourceDataAddresses.empty())
+            request->onSourceDataLayer([state](auto&& layer) { state->addResult(layer); });
+        else
+            request->onSourceDataLayer([state, sourceDataAddresses](auto&& layer) { state->addResult(layer->extract(sourceDataAddresses)); });
+        request->onBinaryLayer([state](auto&& layer) { state->addResult(layer); });
+        // Forwarded cached messages cannot be projected, extracted from or diffed.
+        if (state->responseType_ == HttpTilesRequestState::binaryMimeType && projection.keepsAll() &&
+            sourceDataAddresses.empty() && !baseTiles) {
+            request->onTileLayerMessage(
+                [state, mapId = request->mapId_](auto&& message, auto&& strings)
+                { state->addResultMessage(mapId, message, strings); });
+        }
+        request->onDone_ = [state](RequestStatus r)
+        {
+            std::unique_lock lock(state->mutex_);
+            auto allDone = std::all_of(
+                state->requests_.begin(),
+                state->requests_.end(),
+                [](const auto& r) { return r->isDone(); });
+            if (allDone)
+                state->releaseTiles();
+            state->resultEvent_.notify_one();
+        };
+    }
+
     /**
      * Wraps around the generic mapget service's request() function
      * to include httplib request decoding and response encoding.
@@ -256,15 +1001,60 @@ struct HttpService::Impl
         nlohmann::json j = nlohmann::json::parse(req.body);
         auto requestsJson = j["requests"];
 
-        // TODO: Limit number of requests to avoid DoS to other users.
         // Within one HTTP request, all requested tiles from the same map+layer
         // combination should be in a single LayerTilesRequest.
         auto state = std::make_shared<HttpTilesRequestState>();
         log().info("Processing tiles request {}", state->requestId_);
+        state->span_ = Span(
+            "mapget.http.tiles",
+            TraceContext::fromTraceParent(req.get_header_value(TraceParentHeader)).value_or(TraceContext{}),
+            SpanKind::Server);
+        state->span_.setAttribute("mapget.request_id", static_cast<int64_t>(state->requestId_));
         for (auto& requestJson : requestsJson) {
             state->parseRequestFromJson(requestJson);
         }
 
+        // Clients which do not announce their protocol version get
+        // messages of the oldest supported one, without compact geometry.
+        state->writer_->setProtocolVersion(
+            j.contains("protocolVersion") ? Version::fromJson(j["protocolVersion"]) :
+                                            TileLayerStream::MinimumProtocolVersion);
+
+        // Bound the number of queued tiles. Tiles of a previous request
+        // with the same clientId are not counted, as that request is aborted.
+        std::optional<std::string> clientId;
+        if (j.contains("clientId"))
+            clientId = j["clientId"].get<std::string>();
+        state->clientKey_ = clientId ? "client:" + *clientId : "addr:" + req.remote_addr;
+        state->clientClass_ = j.value("clientClass", state->clientClass_);
+        state->clusterForwarded_ = req.has_header(HttpService::ClusterForwardedHeader);
+        auto numTiles = state->numTiles();
+        if (!admissionControl_->tryAdmitMemory()) {
+            log().warn("Rejecting tiles request {}: The memory budget is exhausted.", state->requestId_);
+            state->span_.setError("Memory budget exhausted");
+            res.status = 503;  // Service Unavailable.
+            res.set_header("Retry-After", "1");
+            res.set_content(
+                nlohmann::json::object({{"error", "The memory budget is exhausted, retry later."}}).dump(),
+                "application/json");
+            return;
+        }
+        if (!admissionControl_->tryAdmit(state->clientKey_, numTiles, supersededTiles(clientId))) {
+            log().warn("Rejecting tiles request {} with {} tiles: Too many queued tiles.",
+                state->requestId_,
+                numTiles);
+            state->span_.setError("Too many queued tiles");
+            res.status = 429;  // Too Many Requests.
+            res.set_header("Retry-After", "1");
+            res.set_content(
+                nlohmann::json::object({{"error", "Too many queued tiles, retry later."}}).dump(),
+                "application/json");
+            return;
+        }
+        state->admissionControl_ = admissionControl_;
+        state->reservedTiles_ = numTiles;
+        state->responseMetrics_ = responseMetrics_;
+
         // Parse stringPoolOffsets.
         if (j.contains("stringPoolOffsets")) {
             for (auto& item : j["stringPoolOffsets"].items()) {
@@ -275,18 +1065,25 @@ struct HttpService::Impl
         // Determine response type.
         state->setResponseType(req.get_header_value("Accept"));
 
-        // Process requests.
-        for (auto& request : state->requests_) {
-            request->onFeatureLayer([state](auto&& layer) { state->addResult(layer); });
-            request->onSourceDataLayer([state](auto&& layer) { state->addResult(layer); });
-            request->onDone_ = [state](RequestStatus r)
-            {
-                state->resultEvent_.notify_one();
-            };
+        // The response holds a server thread until it is done.
+        if (!state->tryOpenStream(admissionControl_, res)) {
+            std::unique_lock lock(state->mutex_);
+            state->releaseTiles();
+            return;
         }
+
+        // Process requests.
+        for (size_t i = 0; i < state->requests_.size(); ++i)
+            setupRequest(state, i);
         auto canProcess = self_.request(state->requests_);
 
         if (!canProcess) {
+            {
+                std::unique_lock lock(state->mutex_);
+                state->releaseTiles();
+                state->closeStream();
+            }
+
             // Send a status report detailing for each request
             // whether its data source is unavailable or it was aborted.
             res.status = 400;
@@ -300,15 +1097,31 @@ struct HttpService::Impl
             return;
         }
 
-        // Parse/Process clientId.
-        if (j.contains("clientId")) {
-            auto clientId = j["clientId"].get<std::string>();
-            abortRequestsForClientId(clientId, state);
+        // Process clientId.
+        if (clientId)
+            abortRequestsForClientId(*clientId, state);
+
+        streamResponse(state, req, res);
+    }
+
+    /**
+     * Stream the results of the requests of a state to the client,
+     * until all of its requests are done.
+     */
+    void streamResponse(
+        std::shared_ptr<HttpTilesRequestState> const& state,
+        const httplib::Request& req,
+        httplib::Response& res) const
+    {
+        res.set_header("Vary", "Accept-Encoding");
+        if (acceptsEncoding(req.get_header_value("Accept-Encoding"), ZstdContentEncoding)) {
+            state->compressor_ = std::make_unique<ZstdStreamCompressor>();
+            res.set_header("Content-Encoding", ZstdContentEncoding);
         }
 
         // For efficiency, set up httplib to stream tile layer responses to client:
         // (1) Lambda continuously supplies response data to httplib's DataSink,
-        //     picking up data from state->buffer_ until all tile requests are done.
+        //     picking up the chunks of state->chunks_ until all tile requests are done.
         //     Then, signal sink->done() to close the stream with a 200 status.
         //     See httplib::write_content_without_length(...) too.
         // (2) Lambda acts as a cleanup routine, triggered by httplib upon request wrap-up.
@@ -321,27 +1134,67 @@ struct HttpService::Impl
                 std::unique_lock lock(state->mutex_);
 
                 // Wait until there is data to be read.
-                std::string strBuf;
                 bool allDone = false;
                 state->resultEvent_.wait(
                     lock,
                     [&]
                     {
-                        allDone = std::all_of(
-                            state->requests_.begin(),
-                            state->requests_.end(),
-                            [](const auto& r) { return r->isDone(); });
-                        if (allDone)
-                            state->writer_->sendEndOfStream();
-                        strBuf = state->buffer_.str();
-                        return !strBuf.empty() || allDone;
+                        allDone = (state->sessionId_.empty() || state->closed_) &&
+                            std::all_of(
+                                state->requests_.begin(),
+                                state->requests_.end(),
+                                [](const auto& r) { return r->isDone(); });
+                        return !state->chunks_.empty() || allDone;
                     });
 
-                if (!strBuf.empty()) {
-                    log().debug("Streaming {} bytes...", strBuf.size());
-                    sink.write(strBuf.data(), strBuf.size());
+                // The results are sent without holding the lock, so that
+                // new results can be added meanwhile.
+                auto chunks = std::move(state->chunks_);
+                state->chunks_.clear();
+                size_t bufferedBytes = 0;
+                for (auto const& chunk : chunks)
+                    bufferedBytes += chunk->size();
+                lock.unlock();
+
+                // Once all requests are done, no more results are written.
+                if (allDone && state->responseType_ == HttpTilesRequestState::binaryMimeType) {
+                    std::unique_lock writerLock(state->writerMutex_);
+                    state->writer_->sendEndOfStream();
+                    chunks.insert(chunks.end(), state->writtenChunks_.begin(), state->writtenChunks_.end());
+                    state->writtenChunks_.clear();
+                }
+
+                size_t numBytes = 0;
+                if (state->compressor_ && (!chunks.empty() || allDone)) {
+                    // The chunks are compressed as one, and flushed at the end,
+                    // so that the client can decode the tiles sent so far.
+                    state->compressedBuffer_.clear();
+                    for (size_t i = 0; i + 1 < chunks.size(); ++i)
+                        state->compressor_->compressBuffered(*chunks[i], state->compressedBuffer_);
+                    state->compressor_->compress(
+                        chunks.empty() ? std::string_view() : std::string_view(*chunks.back()),
+                        state->compressedBuffer_,
+                        allDone);
+                    numBytes = state->compressedBuffer_.size();
+                    if (numBytes)
+                        sink.write(state->compressedBuffer_.data(), numBytes);
+                }
+                else {
+                    for (auto const& chunk : chunks) {
+                        sink.write(chunk->data(), chunk->size());
+                        numBytes += chunk->size();
+                    }
+                }
+
+                if (numBytes) {
+                    MAPGET_LOG_DEBUG("Streaming {} bytes...", numBytes);
+                    state->responseMetrics_->addStreamedBytes(state->responseType_, numBytes);
                     sink.os.flush();
-                    state->buffer_.str("");  // Clear buffer after reading.
+                }
+                if (bufferedBytes) {
+                    lock.lock();
+                    state->bufferedBytes_.resize(state->bufferedBytes_.bytes() - bufferedBytes);
+                    lock.unlock();
                 }
 
                 // Call sink.done() when all requests are done.
@@ -356,17 +1209,294 @@ struct HttpService::Impl
             [state, this](bool success)
             {
                 if (!success) {
-                    log().warn("Aborting tiles request {}", state->requestId_);
+                    log().warn("Aborting request {}", state->requestId_);
                     for (auto& request : state->requests_) {
                         self_.abort(request);
                     }
                 }
                 else {
-                    log().info("Tiles request {} was successful.", state->requestId_);
+                    log().info("Request {} was successful.", state->requestId_);
+                }
+                if (!state->sessionId_.empty()) {
+                    std::unique_lock sessionsLock(sessionsMutex_);
+                    sessions_.erase(state->sessionId_);
                 }
+                std::unique_lock lock(state->mutex_);
+                state->closeStream();
+                if (!success)
+                    state->span_.setError("Aborted");
+                state->span_.end();
             });
     }
 
+    // Open sessions by their id, see handleOpenSessionRequest().
+    mutable std::mutex sessionsMutex_;
+    mutable std::unordered_map<std::string, std::shared_ptr<HttpTilesRequestState>> sessions_;
+
+    /**
+     * Open a session: Its response streams the results of the tile requests
+     * which are added by later /session/update requests, over one connection.
+     * The string pool offsets which the client knows are kept for the whole
+     * session, so they are sent only once.
+     */
+    void handleOpenSessionRequest(const httplib::Request& req, httplib::Response& res) const
+    {
+        nlohmann::json j = req.body.empty() ? nlohmann::json::object() : nlohmann::json::parse(req.body);
+
+        auto state = std::make_shared<HttpTilesRequestState>();
+        state->sessionId_ = newSessionId();
+        log().info("Opening tiles session {}", state->requestId_);
+        state->span_ = Span(
+            "mapget.http.session",
+            TraceContext::fromTraceParent(req.get_header_value(TraceParentHeader)).value_or(TraceContext{}),
+            SpanKind::Server);
+        state->span_.setAttribute("mapget.request_id", static_cast<int64_t>(state->requestId_));
+        state->writer_->setProtocolVersion(
+            j.contains("protocolVersion") ? Version::fromJson(j["protocolVersion"]) :
+                                            TileLayerStream::MinimumProtocolVersion);
+        if (j.contains("stringPoolOffsets")) {
+            for (auto& item : j["stringPoolOffsets"].items()) {
+                state->stringOffsets_[item.key()] = item.value().get<simfil::StringId>();
+            }
+        }
+        state->setResponseType(req.get_header_value("Accept"));
+        state->clientKey_ = "session:" + state->sessionId_;
+        state->clientClass_ = j.value("clientClass", state->clientClass_);
+        state->admissionControl_ = admissionControl_;
+        state->responseMetrics_ = responseMetrics_;
+        if (!state->tryOpenStream(admissionControl_, res))
+            return;
+
+        {
+            std::unique_lock sessionsLock(sessionsMutex_);
+            sessions_.emplace(state->sessionId_, state);
+        }
+        res.set_header(HttpService::SessionIdHeader, state->sessionId_);
+        streamResponse(state, req, res);
+    }
+
+    /**
+     * Update a session: Add tile requests to it, cancel some of its requests,
+     * move the focus of its running requests, or close it. The response lists
+     * the ids of the added requests, which later updates cancel them by.
+     */
+    void handleUpdateSessionRequest(const httplib::Request& req, httplib::Response& res) const
+    {
+        nlohmann::json j = nlohmann::json::parse(req.body);
+        std::shared_ptr<HttpTilesRequestState> state;
+        {
+            std::unique_lock sessionsLock(sessionsMutex_);
+            auto sessionIt = sessions_.find(j.at("sessionId").get<std::string>());
+            if (sessionIt != sessions_.end())
+                state = sessionIt->second;
+        }
+        if (!state) {
+            res.status = 404;
+            res.set_content(
+                nlohmann::json::object({{"error", "Unknown session."}}).dump(),
+                "application/json");
+            return;
+        }
+
+        std::unique_lock updateLock(state->updateMutex_);
+        auto result = nlohmann::json::object();
+
+        if (j.contains("cancel")) {
+            for (auto const& requestId : j["cancel"].get<std::vector<size_t>>()) {
+                if (requestId >= state->requests_.size())
+                    raiseFmt("Unknown request {} of session.", requestId);
+                if (!state->requests_[requestId]->isDone())
+                    self_.abort(state->requests_[requestId]);
+            }
+        }
+
+        if (j.contains("focus")) {
+            auto focus = j["focus"].get<std::vector<double>>();
+            if (focus.size() != 2)
+                raise("The focus of a session must be an array [lon, lat].");
+            for (auto const& request : state->requests_) {
+                if (!request->isDone())
+                    self_.setFocus(request, {focus[0], focus[1]});
+            }
+        }
+
+        if (j.contains("add")) {
+            auto const& requestsJson = j["add"];
+            size_t numTiles = 0;
+            for (auto const& requestJson : requestsJson)
+                numTiles += requestJson["tileIds"].size();
+            if (!admissionControl_->tryAdmit(state->clientKey_, numTiles, 0)) {
+                log().warn("Rejecting {} tiles of session {}: Too many queued tiles.",
+                    numTiles,
+                    state->requestId_);
+                res.status = 429;  // Too Many Requests.
+                res.set_header("Retry-After", "1");
+                res.set_content(
+                    nlohmann::json::object({{"error", "Too many queued tiles, retry later."}}).dump(),
+                    "application/json");
+                return;
+            }
+
+            size_t first = 0;
+            {
+                std::unique_lock lock(state->mutex_);
+                if (state->closed_) {
+                    admissionControl_->release(state->clientKey_, numTiles);
+                    raise("Cannot add requests to a closed session.");
+                }
+                first = state->requests_.size();
+                for (auto const& requestJson : requestsJson)
+                    state->parseRequestFromJson(requestJson);
+                state->reservedTiles_ += numTiles;
+            }
+            std::vector<LayerTilesRequest::Ptr> requests;
+            auto requestIds = nlohmann::json::array();
+            for (size_t i = first; i < state->requests_.size(); ++i) {
+                setupRequest(state, i);
+                requests.push_back(state->requests_[i]);
+                requestIds.push_back(i);
+            }
+            if (!self_.request(requests)) {
+                std::unique_lock lock(state->mutex_);
+                if (std::all_of(state->requests_.begin(), state->requests_.end(), [](auto const& r) { return r->isDone(); }))
+                    state->releaseTiles();
+                state->resultEvent_.notify_one();
+            }
+            std::vector<std::underlying_type_t<RequestStatus>> requestStatuses;
+            for (auto const& request : requests)
+                requestStatuses.push_back(static_cast<std::underlying_type_t<RequestStatus>>(request->getStatus()));
+            result["requestIds"] = requestIds;
+            result["requestStatuses"] = requestStatuses;
+        }
+
+        if (j.value("close", false)) {
+            log().info("Closing tiles session {}", state->requestId_);
+            {
+                std::unique_lock sessionsLock(sessionsMutex_);
+                sessions_.erase(state->sessionId_);
+            }
+            for (auto const& request : state->requests_) {
+                if (!request->isDone())
+                    self_.abort(request);
+            }
+            std::unique_lock lock(state->mutex_);
+            state->closed_ = true;
+            state->resultEvent_.notify_one();
+        }
+
+        res.set_content(result.dump(), "application/json");
+    }
+
+    /**
+     * Evaluate a simfil query on the features of the requested tiles, and
+     * stream the selected features, or the query results, as JSON lines.
+     * The tiles are taken from the cache or filled by the data sources
+     * like those of a /tiles request, but only the results are sent.
+     */
+    void handleQueryRequest(const httplib::Request& req, httplib::Response& res) const
+    {
+        auto state = std::make_shared<HttpTilesRequestState>();
+        log().info("Processing query request {}", state->requestId_);
+        state->span_ = Span(
+            "mapget.http.query",
+            TraceContext::fromTraceParent(req.get_header_value(TraceParentHeader)).value_or(TraceContext{}),
+            SpanKind::Server);
+        state->span_.setAttribute("mapget.request_id", static_cast<int64_t>(state->requestId_));
+        state->responseType_ = HttpTilesRequestState::jsonlMimeType;
+
+        // Invalid requests, e.g. with a bbox which overlaps too many tiles,
+        // are rejected before anything is allocated for their tiles.
+        nlohmann::json j;
+        LayerTilesRequest::Ptr request;
+        try {
+            j = nlohmann::json::parse(req.body);
+            state->query_ = j["query"].get<std::string>();
+            state->queryAttributeFilter_ = TileFeatureLayer::AttributeFilter::fromQuery(state->query_);
+            if (j.contains("result")) {
+                auto result = j["result"].get<std::string>();
+                if (result != "features" && result != "geojson" && result != "values")
+                    raise("The result of a query request must be \"features\", \"geojson\" or \"values\".");
+                state->queryReturnsValues_ = result == "values";
+                if (result == "geojson")
+                    state->queryFeatureLayout_ = JsonLayout::GeoJson;
+            }
+
+            std::vector<TileId> tileIds;
+            if (j.contains("bbox")) {
+                auto bbox = j["bbox"].get<std::vector<double>>();
+                tileIds = tileIdsInBBox(bbox, j["zoomLevel"].get<int64_t>(), MaxQueryTiles);
+                state->queryBBox_ = {Point(bbox[0], bbox[1]), Point(bbox[2], bbox[3])};
+            }
+            else {
+                for (auto const& tid : j["tileIds"].get<std::vector<uint64_t>>())
+                    tileIds.emplace_back(tid);
+            }
+            request = std::make_shared<LayerTilesRequest>(
+                j["mapId"].get<std::string>(),
+                j["layerId"].get<std::string>(),
+                std::move(tileIds));
+        }
+        catch (std::exception const& e) {
+            state->span_.setError(e.what());
+            res.status = 400;  // Bad Request.
+            res.set_content(nlohmann::json::object({{"error", e.what()}}).dump(), "application/json");
+            return;
+        }
+        request->traceContext_ = state->span_.context();
+        state->requests_.push_back(request);
+
+        state->clientKey_ = "addr:" + req.remote_addr;
+        state->clientClass_ = j.value("clientClass", state->clientClass_);
+        request->clientId_ = state->clientKey_;
+        request->clientClass_ = state->clientClass_;
+        auto numTiles = state->numTiles();
+        if (!admissionControl_->tryAdmit(state->clientKey_, numTiles, 0)) {
+            log().warn("Rejecting query request {} with {} tiles: Too many queued tiles.",
+                state->requestId_,
+                numTiles);
+            state->span_.setError("Too many queued tiles");
+            res.status = 429;  // Too Many Requests.
+            res.set_header("Retry-After", "1");
+            res.set_content(
+                nlohmann::json::object({{"error", "Too many queued tiles, retry later."}}).dump(),
+                "application/json");
+            return;
+        }
+        state->admissionControl_ = admissionControl_;
+        state->reservedTiles_ = numTiles;
+        state->responseMetrics_ = responseMetrics_;
+
+        if (!state->tryOpenStream(admissionControl_, res)) {
+            std::unique_lock lock(state->mutex_);
+            state->releaseTiles();
+            return;
+        }
+
+        request->onFeatureLayer([state](auto&& layer) { state->addQueryResults(layer); });
+        request->onDone_ = [state](RequestStatus)
+        {
+            std::unique_lock lock(state->mutex_);
+            state->releaseTiles();
+            state->resultEvent_.notify_one();
+        };
+        if (!self_.request(state->requests_)) {
+            {
+                std::unique_lock lock(state->mutex_);
+                state->releaseTiles();
+                state->closeStream();
+            }
+            res.status = 400;
+            std::vector<std::underlying_type_t<RequestStatus>> requestStatuses{
+                static_cast<std::underlying_type_t<RequestStatus>>(request->getStatus())};
+            res.set_content(
+                nlohmann::json::object({{"requestStatuses", requestStatuses}}).dump(),
+                "application/json");
+            return;
+        }
+
+        streamResponse(state, req, res);
+    }
+
     void handleAbortRequest(const httplib::Request& req, httplib::Response& res) const
     {
         // Parse the JSON request.
@@ -407,10 +1537,40 @@ struct HttpService::Impl
         oss << "<h2>Cache Statistics</h2>";
         oss << "<pre>" << cacheStats.dump(4) << "</pre>";  // Indentation of 4 for pretty printing
 
+        // Output admission control gauges
+        oss << "<h2>Admission Control</h2>";
+        oss << "<pre>" << admissionControl_->getStatistics().dump(4) << "</pre>";
+
         oss << "</body></html>";
         res.set_content(oss.str(), "text/html");
     }
 
+    void handleMetricsRequest(const httplib::Request&, httplib::Response& res) const
+    {
+        std::ostringstream oss;
+        MetricsWriter writer(oss);
+        self_.writeMetrics(writer);
+        responseMetrics_->write(writer);
+
+        auto admissionStats = admissionControl_->getStatistics();
+        writer.family("mapget_admission_queued_tiles", "gauge", "Tiles queued by admitted /tiles requests.");
+        writer.sample("mapget_admission_queued_tiles", {}, admissionStats["queued-tiles"].get<double>());
+        writer.family("mapget_admission_rejected_requests_total", "counter", "Rejected /tiles requests.");
+        writer.sample(
+            "mapget_admission_rejected_requests_total",
+            {},
+            admissionStats["rejected-requests"].get<double>());
+        writer.family("mapget_admission_streams", "gauge", "Responses which are streamed right now.");
+        writer.sample("mapget_admission_streams", {}, admissionStats["streams"].get<double>());
+        writer.family("mapget_admission_rejected_streams_total", "counter", "Requests rejected for too many streams.");
+        writer.sample(
+            "mapget_admission_rejected_streams_total",
+            {},
+            admissionStats["rejected-streams"].get<double>());
+
+        res.set_content(oss.str(), "text/plain; version=0.0.4");
+    }
+
     void handleLocateRequest(const httplib::Request& req, httplib::Response& res) const
     {
         // Parse the JSON request.
@@ -418,10 +1578,13 @@ struct HttpService::Impl
         auto requestsJson = j["requests"];
         auto allResponsesJson = nlohmann::json::array();
 
-        for (auto const& locateReqJson : requestsJson) {
-            LocateRequest locateReq{locateReqJson};
+        // All requests are located in one batch per data source.
+        std::vector<LocateRequest> locateRequests;
+        for (auto const& locateReqJson : requestsJson)
+            locateRequests.emplace_back(locateReqJson);
+        for (auto const& responses : self_.locate(locateRequests)) {
             auto responsesJson = nlohmann::json::array();
-            for (auto const& resp : self_.locate(locateReq))
+            for (auto const& resp : responses)
                 responsesJson.emplace_back(resp.serialize());
             allResponsesJson.emplace_back(responsesJson);
         }
@@ -431,6 +1594,39 @@ struct HttpService::Impl
             "application/json");
     }
 
+    void handleRelationsRequest(const httplib::Request& req, httplib::Response& res) const
+    {
+        // Parse the JSON request.
+        nlohmann::json j = nlohmann::json::parse(req.body);
+        auto mapId = j["mapId"].get<std::string>();
+        auto layerId = j["layerId"].get<std::string>();
+        auto tileId = TileId(j["tileId"].get<uint64_t>());
+        auto loadTargets = j.value("loadTargets", true);
+
+        // Get the source tile, from the cache or its data source.
+        TileFeatureLayer::Ptr tile;
+        auto tileRequest = std::make_shared<LayerTilesRequest>(mapId, layerId, std::vector<TileId>{tileId});
+        tileRequest->onFeatureLayer([&tile](auto&& result) { tile = result; });
+        if (!self_.request({tileRequest})) {
+            res.status = 400;  // Bad Request.
+            res.set_content(fmt::format("No data source provides {}::{}.", mapId, layerId), "text/plain");
+            return;
+        }
+        tileRequest->wait();
+        if (!tile) {
+            res.status = 404;  // Not found.
+            res.set_content("The tile could not be loaded.", "text/plain");
+            return;
+        }
+
+        auto relationsJson = nlohmann::json::array();
+        for (auto const& relation : self_.resolveRelations(tile, loadTargets))
+            relationsJson.emplace_back(relation.serialize(loadTargets));
+        res.set_content(
+            nlohmann::json::object({{"relations", relationsJson}}).dump(),
+            "application/json");
+    }
+
     static bool openConfigAndSchemaFile(std::ifstream& configFile, std::ifstream& schemaFile, httplib::Response& res)
     {
         auto configFilePath = DataSourceConfigService::get().getConfigFilePath();
@@ -523,7 +1719,7 @@ struct HttpService::Impl
         }
     }
 
-    static void handlePostConfigRequest(const httplib::Request& req, httplib::Response& res)
+    void handlePostConfigRequest(const httplib::Request& req, httplib::Response& res)
     {
         if (!isPostConfigEndpointEnabled()) {
             res.status = 403;  // Forbidden.
@@ -603,7 +1799,7 @@ struct HttpService::Impl
         // Write the YAML to configFilePath.
         update_done = false;
         configFile.close();
-        log().trace("Writing new config.");
+        MAPGET_LOG_TRACE("Writing new config.");
         std::ofstream newConfigFile(*DataSourceConfigService::get().getConfigFilePath());
         newConfigFile << yamlConfig;
         newConfigFile.close();
@@ -613,6 +1809,18 @@ struct HttpService::Impl
         if (!cv.wait_for(lk, std::chrono::seconds(60), [&] { return update_done; })) {
             res.status = 500;  // Internal Server Error.
             res.set_content("Timeout while waiting for config to update.", "text/plain");
+            return;
+        }
+        if (res.status != 200)
+            return;
+        lk.unlock();
+
+        // Unsubscribing waits until all subscribers got the new config, including
+        // this service. Its data sources are then made in the background.
+        subscription.reset();
+        if (!self_.waitForConfig()) {
+            res.status = 500;  // Internal Server Error.
+            res.set_content("Timeout while waiting for the data sources of the config.", "text/plain");
         }
     }
 };
@@ -624,6 +1832,16 @@ HttpService::HttpService(Cache::Ptr cache, bool watchConfig)
 
 HttpService::~HttpService() = default;
 
+void HttpService::setAdmissionLimits(size_t maxQueuedTiles, size_t maxQueuedTilesPerClient)
+{
+    impl_->admissionControl_->setLimits(maxQueuedTiles, maxQueuedTilesPerClient);
+}
+
+void HttpService::setMaxStreams(size_t maxStreams)
+{
+    impl_->admissionControl_->setMaxStreams(maxStreams);
+}
+
 void HttpService::setup(httplib::Server& server)
 {
     server.Post(
@@ -631,6 +1849,21 @@ void HttpService::setup(httplib::Server& server)
         [&](const httplib::Request& req, httplib::Response& res)
         { impl_->handleTilesRequest(req, res); });
 
+    server.Post(
+        "/query",
+        [&](const httplib::Request& req, httplib::Response& res)
+        { impl_->handleQueryRequest(req, res); });
+
+    server.Post(
+        "/session",
+        [&](const httplib::Request& req, httplib::Response& res)
+        { impl_->handleOpenSessionRequest(req, res); });
+
+    server.Post(
+        "/session/update",
+        [&](const httplib::Request& req, httplib::Response& res)
+        { impl_->handleUpdateSessionRequest(req, res); });
+
     server.Post(
         "/abort",
         [&](const httplib::Request& req, httplib::Response& res)
@@ -646,11 +1879,21 @@ void HttpService::setup(httplib::Server& server)
         [this](const httplib::Request& req, httplib::Response& res)
         { impl_->handleStatusRequest(req, res); });
 
+    server.Get(
+        "/metrics",
+        [this](const httplib::Request& req, httplib::Response& res)
+        { impl_->handleMetricsRequest(req, res); });
+
     server.Post(
         "/locate",
         [this](const httplib::Request& req, httplib::Response& res)
         { impl_->handleLocateRequest(req, res); });
 
+    server.Post(
+        "/relations",
+        [this](const httplib::Request& req, httplib::Response& res)
+        { impl_->handleRelationsRequest(req, res); });
+
     server.Get(
         "/config",
         [this](const httplib::Request& req, httplib::Response& res)
@@ -0,0 +1,352 @@
+#include "load-generator.h"
+#include "httplib.h"
+#include "mapget/log.h"
+#include "mapget/model/stream.h"
+
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <mutex>
+#include <numbers>
+#include <random>
+#include <sstream>
+#include <thread>
+
+namespace mapget
+{
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+double millisecondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+/** Percentile of sorted values, or zero without values. */
+double percentile(std::vector<double> const& sortedValues, double p)
+{
+    if (sortedValues.empty())
+        return 0.;
+    auto index = static_cast<size_t>(p * static_cast<double>(sortedValues.size()));
+    return sortedValues[std::min(index, sortedValues.size() - 1)];
+}
+
+nlohmann::json latencySummary(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    return nlohmann::json::object({
+        {"p50", percentile(values, .5)},
+        {"p99", percentile(values, .99)},
+        {"p999", percentile(values, .999)},
+        {"max", values.empty() ? 0. : values.back()}});
+}
+
+/**
+ * Counts the tiles of a /tiles response while it arrives, which are
+ * lines of a JSONL response, or tile layer messages of a binary one.
+ */
+class TileCounter
+{
+public:
+    explicit TileCounter(bool jsonl) : jsonl_(jsonl) {}
+
+    /** Add response bytes, and return the number of tiles which they completed. */
+    size_t read(std::string_view bytes)
+    {
+        if (jsonl_)
+            return static_cast<size_t>(std::count(bytes.begin(), bytes.end(), '\n'));
+
+        size_t result = 0;
+        while (!bytes.empty()) {
+            if (remainingBodyBytes_ > 0) {
+                auto skipped = std::min(remainingBodyBytes_, bytes.size());
+                remainingBodyBytes_ -= skipped;
+                bytes.remove_prefix(skipped);
+                continue;
+            }
+            auto headerBytes = std::min(MessageHeaderSize - header_.size(), bytes.size());
+            header_.append(bytes.substr(0, headerBytes));
+            bytes.remove_prefix(headerBytes);
+            if (header_.size() < MessageHeaderSize)
+                continue;
+            std::stringstream headerStream;
+            headerStream << header_;
+            header_.clear();
+            TileLayerStream::MessageType type;
+            uint32_t size = 0;
+            TileLayerStream::Reader::readMessageHeader(headerStream, type, size);
+            remainingBodyBytes_ = size;
+            if (type == TileLayerStream::MessageType::TileFeatureLayer ||
+                type == TileLayerStream::MessageType::TileSourceDataLayer ||
+                type == TileLayerStream::MessageType::TileBinaryLayer)
+                ++result;
+        }
+        return result;
+    }
+
+private:
+    // Protocol version, message type and size, see TileLayerStream.
+    static constexpr size_t MessageHeaderSize = 6 + 1 + 4;
+
+    bool jsonl_;
+    std::string header_;  // Bytes of an incomplete message header
+    size_t remainingBodyBytes_ = 0;
+};
+
+/** Outcome of one /tiles request. */
+struct RequestResult
+{
+    enum class Status { Completed, Aborted, Rejected, Failed } status_ = Status::Failed;
+    size_t tiles_ = 0;
+    size_t bytes_ = 0;
+    std::vector<double> tileLatencies_;
+};
+
+}  // namespace
+
+nlohmann::json LoadGenerator::Report::toJson() const
+{
+    return nlohmann::json::object({
+        {"seconds", seconds_},
+        {"requests", requests_},
+        {"completedRequests", completedRequests_},
+        {"abortedRequests", abortedRequests_},
+        {"rejectedRequests", rejectedRequests_},
+        {"failedRequests", failedRequests_},
+        {"tiles", tiles_},
+        {"bytes", bytes_},
+        {"tilesPerSecond", seconds_ > 0 ? static_cast<double>(tiles_) / seconds_ : 0.},
+        {"timeToFirstTileMs", latencySummary(timesToFirstTile_)},
+        {"tileLatencyMs", latencySummary(tileLatencies_)}});
+}
+
+/**
+ * Simulated map viewer, which sends the requests of its viewports
+ * with its own keep-alive connections.
+ */
+struct LoadGenerator::Client
+{
+    LoadGenerator const& generator_;
+    std::string clientId_;
+    std::mt19937 random_;
+
+    std::mutex connectionsMutex_;
+    std::vector<std::unique_ptr<httplib::Client>> idleConnections_;
+
+    std::unique_ptr<httplib::Client> acquireConnection()
+    {
+        {
+            std::lock_guard lock(connectionsMutex_);
+            if (!idleConnections_.empty()) {
+                auto connection = std::move(idleConnections_.back());
+                idleConnections_.pop_back();
+                return connection;
+            }
+        }
+        auto const& options = generator_.options_;
+        auto connection = std::make_unique<httplib::Client>(options.host_, options.port_);
+        connection->set_keep_alive(true);
+        return connection;
+    }
+
+    void releaseConnection(std::unique_ptr<httplib::Client> connection)
+    {
+        std::lock_guard lock(connectionsMutex_);
+        idleConnections_.push_back(std::move(connection));
+    }
+
+    [[nodiscard]] std::string requestBody(std::vector<TileId> const& tiles) const
+    {
+        std::vector<uint64_t> tileIds;
+        for (auto const& tile : tiles)
+            tileIds.push_back(tile.value_);
+        auto requests = nlohmann::json::array();
+        for (auto const& layerId : generator_.options_.layerIds_) {
+            requests.push_back({
+                {"mapId", generator_.options_.mapId_},
+                {"layerId", layerId},
+                {"tileIds", tileIds}});
+        }
+        return nlohmann::json::object({
+            {"requests", requests},
+            {"clientId", clientId_},
+            {"protocolVersion", TileLayerStream::CurrentProtocolVersion.toJson()}}).dump();
+    }
+
+    RequestResult fetch(std::vector<TileId> const& tiles, bool jsonl)
+    {
+        RequestResult result;
+        httplib::Request request;
+        request.method = "POST";
+        request.path = "/tiles";
+        request.set_header("Accept", jsonl ? "application/jsonl" : "application/binary");
+        request.set_header("Content-Type", "application/json");
+        request.body = requestBody(tiles);
+
+        TileCounter counter(jsonl);
+        int status = 0;
+        auto start = Clock::now();
+        request.response_handler = [&status](httplib::Response const& response)
+        {
+            status = response.status;
+            return true;
+        };
+        request.content_receiver = [&](const char* data, size_t size, uint64_t, uint64_t)
+        {
+            result.bytes_ += size;
+            if (status != 200)
+                return true;
+            auto numTiles = counter.read({data, size});
+            if (numTiles > 0) {
+                auto latency = millisecondsSince(start);
+                result.tileLatencies_.insert(result.tileLatencies_.end(), numTiles, latency);
+                result.tiles_ += numTiles;
+            }
+            return true;
+        };
+
+        auto connection = acquireConnection();
+        httplib::Response response;
+        httplib::Error error = httplib::Error::Success;
+        if (!connection->send(request, response, error)) {
+            log().debug("Load generator request of {} failed: {}", clientId_, httplib::to_string(error));
+            return result;
+        }
+        releaseConnection(std::move(connection));
+
+        auto expectedTiles = tiles.size() * generator_.options_.layerIds_.size();
+        if (status == 429 || status == 503)
+            result.status_ = RequestResult::Status::Rejected;
+        else if (status != 200)
+            result.status_ = RequestResult::Status::Failed;
+        else if (result.tiles_ < expectedTiles)
+            result.status_ = RequestResult::Status::Aborted;
+        else
+            result.status_ = RequestResult::Status::Completed;
+        return result;
+    }
+};
+
+LoadGenerator::LoadGenerator(Options options) : options_(std::move(options))
+{
+    if (options_.zoomLevels_.empty())
+        raise("The load generator needs at least one zoom level.");
+    if (options_.bbox_[0] >= options_.bbox_[2] || options_.bbox_[1] >= options_.bbox_[3])
+        raise("The bounding box of the load generator is empty.");
+}
+
+std::vector<TileId> LoadGenerator::viewportTiles(double lon, double lat, uint16_t zoomLevel) const
+{
+    auto tileSize = TileId::fromWgs84(lon, lat, zoomLevel).size();
+    auto halfWidth = tileSize.x * (std::max(options_.viewportWidth_, 1u) - 1) * .5;
+    auto halfHeight = tileSize.y * (std::max(options_.viewportHeight_, 1u) - 1) * .5;
+    return TileId::tilesInBBox(
+        {lon - halfWidth, lat - halfHeight},
+        {lon + halfWidth, lat + halfHeight},
+        zoomLevel);
+}
+
+LoadGenerator::Report LoadGenerator::run()
+{
+    if (options_.layerIds_.empty()) {
+        httplib::Client sourcesClient(options_.host_, options_.port_);
+        auto sources = sourcesClient.Get("/sources");
+        if (!sources || sources->status != 200)
+            raise(fmt::format("Failed to fetch sources: [{}]", sources ? sources->status : -1));
+        for (auto const& info : nlohmann::json::parse(sources->body)) {
+            if (info.value("mapId", "") != options_.mapId_)
+                continue;
+            for (auto const& [layerId, _] : info.at("layers").items())
+                options_.layerIds_.push_back(layerId);
+        }
+        if (options_.layerIds_.empty())
+            raise(fmt::format("The server has no layers of map {}.", options_.mapId_));
+    }
+
+    Report report;
+    std::mutex reportMutex;
+    auto addResult = [&](RequestResult&& result)
+    {
+        std::lock_guard lock(reportMutex);
+        ++report.requests_;
+        switch (result.status_) {
+        case RequestResult::Status::Completed: ++report.completedRequests_; break;
+        case RequestResult::Status::Aborted: ++report.abortedRequests_; break;
+        case RequestResult::Status::Rejected: ++report.rejectedRequests_; break;
+        case RequestResult::Status::Failed: ++report.failedRequests_; break;
+        }
+        report.tiles_ += result.tiles_;
+        report.bytes_ += result.bytes_;
+        if (!result.tileLatencies_.empty())
+            report.timesToFirstTile_.push_back(result.tileLatencies_.front());
+        report.tileLatencies_.insert(
+            report.tileLatencies_.end(), result.tileLatencies_.begin(), result.tileLatencies_.end());
+    };
+
+    log().info(
+        "Replaying viewports of {} clients on {} layers of map {} for {} ms.",
+        options_.numClients_,
+        options_.layerIds_.size(),
+        options_.mapId_,
+        options_.duration_.count());
+    auto const start = Clock::now();
+    auto const end = start + options_.duration_;
+    std::vector<std::thread> clientThreads;
+    for (size_t i = 0; i < options_.numClients_; ++i) {
+        clientThreads.emplace_back([this, i, end, &addResult]
+        {
+            Client client{*this, fmt::format("mapget-bench-{}-{}", options_.seed_, i)};
+            client.random_.seed(options_.seed_ + static_cast<uint32_t>(i));
+            std::uniform_real_distribution<double> unit(0., 1.);
+            std::exponential_distribution<double> thinkTime(1. / std::max<double>(1., options_.thinkTime_.count()));
+
+            auto const& bbox = options_.bbox_;
+            auto lon = bbox[0] + unit(client.random_) * (bbox[2] - bbox[0]);
+            auto lat = bbox[1] + unit(client.random_) * (bbox[3] - bbox[1]);
+            auto zoomIndex = client.random_() % options_.zoomLevels_.size();
+
+            // Responses of earlier viewports are still received while the
+            // next viewport is requested, which lets the service abort them.
+            std::vector<std::future<void>> pending;
+            while (Clock::now() < end) {
+                auto tiles = viewportTiles(lon, lat, options_.zoomLevels_[zoomIndex]);
+                auto jsonl = unit(client.random_) < options_.jsonlShare_;
+                pending.emplace_back(std::async(std::launch::async, [&client, &addResult, tiles, jsonl]
+                    { addResult(client.fetch(tiles, jsonl)); }));
+                std::erase_if(pending, [](auto& request) {
+                    return request.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+                });
+
+                std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(thinkTime(client.random_)));
+
+                // Zoom in or out by one level, or pan by one tile.
+                auto tileSize = TileId::fromWgs84(lon, lat, options_.zoomLevels_[zoomIndex]).size();
+                if (options_.zoomLevels_.size() > 1 && unit(client.random_) < options_.zoomProbability_) {
+                    if (zoomIndex == 0 || (zoomIndex + 1 < options_.zoomLevels_.size() && client.random_() % 2))
+                        ++zoomIndex;
+                    else
+                        --zoomIndex;
+                }
+                else {
+                    auto direction = client.random_() % 8;
+                    lon += tileSize.x * std::round(std::cos(direction * std::numbers::pi / 4.));
+                    lat += tileSize.y * std::round(std::sin(direction * std::numbers::pi / 4.));
+                    lon = std::clamp(lon, bbox[0], bbox[2]);
+                    lat = std::clamp(lat, bbox[1], bbox[3]);
+                }
+            }
+            for (auto& request : pending)
+                request.wait();
+        });
+    }
+    for (auto& thread : clientThreads)
+        thread.join();
+
+    report.seconds_ = millisecondsSince(start) / 1000.;
+    return report;
+}
+
+}
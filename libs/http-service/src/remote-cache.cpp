@@ -0,0 +1,642 @@
+#include "remote-cache.h"
+#include "mapget/log.h"
+
+#include "httplib.h"
+#include "nlohmann/json.hpp"
+
+#include <algorithm>
+#include <future>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+
+namespace mapget
+{
+
+namespace
+{
+
+/** Parse a string pool blob, as it is stored by Cache::putStringPoolBlob(). */
+std::shared_ptr<StringPool> parseStringPool(std::string const& nodeId, std::string const& blob)
+{
+    std::stringstream stream;
+    stream << blob;
+
+    TileLayerStream::MessageType messageType;
+    uint32_t messageSize;
+    if (!TileLayerStream::Reader::readMessageHeader(stream, messageType, messageSize) ||
+        messageType != TileLayerStream::MessageType::StringPool ||
+        StringPool::readDataSourceNodeId(stream) != nodeId) {
+        raiseFmt("Stream header error while parsing string pool of node {}.", nodeId);
+    }
+
+    auto result = std::make_shared<StringPool>(nodeId);
+    result->read(stream);
+    return result;
+}
+
+/** Whether both string pools have the same strings, up to the highest string of the shorter one. */
+bool agreeOnCommonStrings(StringPool& a, StringPool& b)
+{
+    auto highestCommonString = std::min(a.highest(), b.highest());
+    for (uint32_t id = 0; id <= highestCommonString; ++id) {
+        if (a.resolve(static_cast<simfil::StringId>(id)) != b.resolve(static_cast<simfil::StringId>(id)))
+            return false;
+    }
+    return true;
+}
+
+std::string queryParam(std::string const& name, std::string const& value)
+{
+    return fmt::format("?{}={}", name, httplib::detail::encode_query_param(value));
+}
+
+/** Get a query parameter, or set status 400 and return null. */
+std::optional<std::string> requireParam(httplib::Request const& req, httplib::Response& res, std::string const& name)
+{
+    if (req.has_param(name))
+        return req.get_param_value(name);
+    res.status = 400;
+    res.set_content(fmt::format("Missing parameter: {}", name), "text/plain");
+    return {};
+}
+
+/** Get the tile key of the key parameter, or set status 400 and return null. */
+std::optional<MapTileKey> requireTileKey(httplib::Request const& req, httplib::Response& res)
+{
+    auto key = requireParam(req, res, "key");
+    if (!key)
+        return {};
+    try {
+        return MapTileKey(*key);
+    }
+    catch (std::exception& e) {
+        res.status = 400;
+        res.set_content(fmt::format("Invalid tile key: {}", e.what()), "text/plain");
+        return {};
+    }
+}
+
+}
+
+struct CacheServer::Impl
+{
+    Cache::Ptr store_;
+    bool allowWrites_ = false;
+    std::string writeToken_;
+
+    // Decompresses put tile blobs for their validation, with the
+    // dictionaries which the RemoteCaches put before.
+    TileBlobCompression decompression_;
+
+    // Held while string pools are put, and for highestStrings_.
+    std::mutex stringPoolMutex_;
+    std::map<std::string, simfil::StringId> highestStrings_;
+
+    // Held while compression dictionaries are put.
+    std::mutex dictionaryMutex_;
+
+    Impl(Cache::Ptr store, bool allowWrites, std::string writeToken)
+        : store_(std::move(store)),
+          allowWrites_(allowWrites),
+          writeToken_(std::move(writeToken)),
+          decompression_(
+              0,
+              [this](auto&& key) { return store_->getCompressionDictionaryBlob(key); },
+              [](auto&&, auto&&) {})
+    {
+        if (!store_)
+            raise("A CacheServer requires a store.");
+    }
+
+    /** Whether the request may write, otherwise sets status 403 or 401. */
+    bool authorizeWrite(httplib::Request const& req, httplib::Response& res) const
+    {
+        if (!allowWrites_) {
+            res.status = 403;
+            res.set_content("The cache server does not accept writes.", "text/plain");
+            return false;
+        }
+        if (!writeToken_.empty() && req.get_header_value("Authorization") != "Bearer " + writeToken_) {
+            res.status = 401;
+            res.set_content("Writes require the write token of the cache server.", "text/plain");
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Check that a tile blob, which may be compressed, is a tile layer
+     * message of a supported protocol version for the given key. Throws otherwise.
+     */
+    void validateTileBlob(MapTileKey const& key, std::string const& blob)
+    {
+        std::shared_ptr<const std::string> decompressed;
+        if (TileBlobCompression::isCompressed(blob))
+            decompressed = decompression_.decompress(key, std::make_shared<const std::string>(blob));
+        auto header = TileLayerStream::Reader::readTileLayerHeader(decompressed ? *decompressed : blob);
+        if (header.mapId_ != key.mapId_ || header.layerId_ != key.layerId_ || header.tileId_.value_ != key.tileId_.value_) {
+            raiseFmt(
+                "The blob has the tile {}:{}:{}, but the key {}.",
+                header.mapId_,
+                header.layerId_,
+                header.tileId_.value_,
+                key.toString());
+        }
+    }
+
+    std::string stringPoolsHeader()
+    {
+        auto result = nlohmann::json::object();
+        std::unique_lock stringPoolLock(stringPoolMutex_);
+        for (auto const& [nodeId, highestString] : highestStrings_)
+            result[nodeId] = highestString;
+        return result.dump();
+    }
+
+    void handleGetTile(httplib::Request const& req, httplib::Response& res)
+    {
+        auto key = requireTileKey(req, res);
+        if (!key)
+            return;
+        auto blob = store_->getSharedTileLayerBlob(*key);
+        if (!blob) {
+            res.status = 404;
+            return;
+        }
+        // The string pool of the tile was put before the tile,
+        // so its highest string is already known.
+        res.set_header(StringPoolsHeader, stringPoolsHeader());
+        res.set_content(*blob, "application/binary");
+    }
+
+    void handlePutTile(httplib::Request const& req, httplib::Response& res)
+    {
+        if (!authorizeWrite(req, res))
+            return;
+        auto key = requireTileKey(req, res);
+        if (!key)
+            return;
+        try {
+            validateTileBlob(*key, req.body);
+        }
+        catch (std::exception& e) {
+            res.status = 400;
+            res.set_content(fmt::format("Invalid tile blob: {}", e.what()), "text/plain");
+            return;
+        }
+        store_->putTileLayerBlob(*key, req.body);
+    }
+
+    void handleDeleteTile(httplib::Request const& req, httplib::Response& res)
+    {
+        if (!authorizeWrite(req, res))
+            return;
+        if (auto key = requireTileKey(req, res))
+            store_->eraseTileLayerBlob(*key);
+    }
+
+    void handleGetStringPool(httplib::Request const& req, httplib::Response& res)
+    {
+        auto nodeId = requireParam(req, res, "node");
+        if (!nodeId)
+            return;
+        std::unique_lock stringPoolLock(stringPoolMutex_);
+        auto blob = store_->getStringPoolBlob(*nodeId);
+        if (!blob) {
+            res.status = 404;
+            return;
+        }
+        if (!highestStrings_.count(*nodeId))
+            highestStrings_[*nodeId] = parseStringPool(*nodeId, *blob)->highest();
+        res.set_content(*blob, "application/binary");
+    }
+
+    void handlePutStringPool(httplib::Request const& req, httplib::Response& res)
+    {
+        if (!authorizeWrite(req, res))
+            return;
+        auto nodeId = requireParam(req, res, "node");
+        if (!nodeId)
+            return;
+        std::shared_ptr<StringPool> strings;
+        try {
+            strings = parseStringPool(*nodeId, req.body);
+        }
+        catch (std::exception& e) {
+            res.status = 400;
+            res.set_content(fmt::format("Invalid string pool: {}", e.what()), "text/plain");
+            return;
+        }
+
+        std::unique_lock stringPoolLock(stringPoolMutex_);
+        if (auto storedBlob = store_->getStringPoolBlob(*nodeId)) {
+            auto storedStrings = parseStringPool(*nodeId, *storedBlob);
+            if (!agreeOnCommonStrings(*strings, *storedStrings)) {
+                log().warn("Rejecting string pool of node {}, which contradicts the stored one.", *nodeId);
+                res.status = 409;
+                res.set_content("The string pool contradicts the stored one.", "text/plain");
+                return;
+            }
+            // The stored pool already has all of the strings.
+            if (strings->highest() <= storedStrings->highest()) {
+                highestStrings_[*nodeId] = storedStrings->highest();
+                return;
+            }
+        }
+        store_->putStringPoolBlob(*nodeId, req.body);
+        highestStrings_[*nodeId] = strings->highest();
+    }
+
+    void handleGetDictionary(httplib::Request const& req, httplib::Response& res)
+    {
+        auto key = requireParam(req, res, "key");
+        if (!key)
+            return;
+        auto dictionary = store_->getCompressionDictionaryBlob(*key);
+        if (!dictionary) {
+            res.status = 404;
+            return;
+        }
+        res.set_content(*dictionary, "application/binary");
+    }
+
+    void handlePutDictionary(httplib::Request const& req, httplib::Response& res)
+    {
+        if (!authorizeWrite(req, res))
+            return;
+        auto key = requireParam(req, res, "key");
+        if (!key)
+            return;
+
+        // A dictionary is never replaced, as tiles may have been compressed with it.
+        std::unique_lock dictionaryLock(dictionaryMutex_);
+        auto storedDictionary = store_->getCompressionDictionaryBlob(*key);
+        if (!storedDictionary)
+            store_->putCompressionDictionaryBlob(*key, req.body);
+        else if (*storedDictionary != req.body) {
+            res.status = 409;
+            res.set_content("Another dictionary is stored for the map layer.", "text/plain");
+        }
+    }
+};
+
+CacheServer::CacheServer(Cache::Ptr store, bool allowWrites, std::string writeToken)
+    : impl_(std::make_unique<Impl>(std::move(store), allowWrites, std::move(writeToken)))
+{
+}
+
+CacheServer::~CacheServer() = default;
+
+void CacheServer::setup(httplib::Server& server)
+{
+    server.Get(
+        "/cache/tile",
+        [this](const httplib::Request& req, httplib::Response& res) { impl_->handleGetTile(req, res); });
+
+    server.Put(
+        "/cache/tile",
+        [this](const httplib::Request& req, httplib::Response& res) { impl_->handlePutTile(req, res); });
+
+    server.Delete(
+        "/cache/tile",
+        [this](const httplib::Request& req, httplib::Response& res) { impl_->handleDeleteTile(req, res); });
+
+    server.Get(
+        "/cache/string-pool",
+        [this](const httplib::Request& req, httplib::Response& res) { impl_->handleGetStringPool(req, res); });
+
+    server.Put(
+        "/cache/string-pool",
+        [this](const httplib::Request& req, httplib::Response& res) { impl_->handlePutStringPool(req, res); });
+
+    server.Get(
+        "/cache/dictionary",
+        [this](const httplib::Request& req, httplib::Response& res) { impl_->handleGetDictionary(req, res); });
+
+    server.Put(
+        "/cache/dictionary",
+        [this](const httplib::Request& req, httplib::Response& res) { impl_->handlePutDictionary(req, res); });
+}
+
+struct RemoteCache::Impl
+{
+    std::string host_;
+    uint16_t port_ = 0;
+    std::string writeToken_;
+    std::shared_ptr<MemCache> hot_;
+
+    // Clients which are not used by a request. Clients are created
+    // on demand, so there are as many as concurrent requests.
+    std::mutex clientsMutex_;
+    std::vector<std::unique_ptr<httplib::Client>> idleClients_;
+
+    // Requests for tiles which are not in the hot tier, which
+    // concurrent reads of the same tile wait for.
+    std::mutex runningReadsMutex_;
+    std::unordered_map<MapTileKey, std::shared_future<SharedBlob>, MapTileKey::Hash> runningReads_;
+
+    // Held while blobs are put into the hot tier, so that a read
+    // never overwrites a newer blob which was put meanwhile.
+    std::mutex hotWriteMutex_;
+
+    // Held while a string pool is updated from the server.
+    std::mutex refreshMutex_;
+
+    std::atomic<bool> disabled_ = false;
+    std::atomic<int64_t> remoteHits_ = 0;
+    std::atomic<int64_t> remoteMisses_ = 0;
+    std::atomic<int64_t> remoteErrors_ = 0;
+    std::atomic<int64_t> coalescedReads_ = 0;
+    std::atomic<int64_t> refreshedStringPools_ = 0;
+
+    Impl(std::string host, uint16_t port, std::string writeToken, uint32_t maxHotTiles, size_t maxHotBytes)
+        : host_(std::move(host)),
+          port_(port),
+          writeToken_(std::move(writeToken)),
+          hot_(std::make_shared<MemCache>(maxHotTiles, maxHotBytes))
+    {
+    }
+
+    template <typename SendFun>
+    httplib::Result send(SendFun const& sendRequest)
+    {
+        std::unique_ptr<httplib::Client> client;
+        {
+            std::unique_lock clientsLock(clientsMutex_);
+            if (!idleClients_.empty()) {
+                client = std::move(idleClients_.back());
+                idleClients_.pop_back();
+            }
+        }
+        if (!client) {
+            client = std::make_unique<httplib::Client>(host_, port_);
+            client->set_keep_alive(true);
+            if (!writeToken_.empty())
+                client->set_bearer_token_auth(writeToken_);
+        }
+
+        auto result = sendRequest(*client);
+        std::unique_lock clientsLock(clientsMutex_);
+        idleClients_.emplace_back(std::move(client));
+        return result;
+    }
+
+    /** Returns true if the request succeeded with one of the expected statuses, logs the error otherwise. */
+    bool check(httplib::Result const& result, std::string_view const& what, std::initializer_list<int> statuses = {200})
+    {
+        if (result && std::find(statuses.begin(), statuses.end(), result->status) != statuses.end())
+            return true;
+        ++remoteErrors_;
+        if (result)
+            log().warn("Could not {} on the cache server: status {}, {}", what, result->status, result->body);
+        else
+            log().warn("Could not {} on the cache server: {}", what, httplib::to_string(result.error()));
+        return false;
+    }
+};
+
+std::shared_ptr<RemoteCache> RemoteCache::fromHostPort(
+    std::string const& hostPort,
+    uint32_t maxHotTiles,
+    size_t maxHotBytes,
+    std::string writeToken)
+{
+    auto delimiterPos = hostPort.find(':');
+    if (delimiterPos == std::string::npos)
+        raiseFmt("Cache server address {} is not in the format <host:port>.", hostPort);
+    std::string host = hostPort.substr(0, delimiterPos);
+    int port = std::stoi(hostPort.substr(delimiterPos + 1, hostPort.size()));
+    log().info("Using cache server at {}:{}.", host, port);
+    return std::make_shared<RemoteCache>(host, port, maxHotTiles, maxHotBytes, std::move(writeToken));
+}
+
+RemoteCache::RemoteCache(
+    std::string const& host,
+    uint16_t port,
+    uint32_t maxHotTiles,
+    size_t maxHotBytes,
+    std::string writeToken)
+    : impl_(std::make_unique<Impl>(host, port, std::move(writeToken), maxHotTiles, maxHotBytes))
+{
+}
+
+RemoteCache::~RemoteCache() = default;
+
+std::optional<std::string> RemoteCache::getTileLayerBlob(MapTileKey const& k)
+{
+    if (auto blob = getSharedTileLayerBlob(k))
+        return *blob;
+    return {};
+}
+
+Cache::SharedBlob RemoteCache::getSharedTileLayerBlob(MapTileKey const& k)
+{
+    if (auto blob = impl_->hot_->getSharedTileLayerBlob(k))
+        return blob;
+    if (impl_->disabled_)
+        return nullptr;
+
+    // Reads of a tile which is being fetched wait for its request.
+    std::promise<SharedBlob> promise;
+    {
+        std::unique_lock runningReadsLock(impl_->runningReadsMutex_);
+        if (auto it = impl_->runningReads_.find(k); it != impl_->runningReads_.end()) {
+            auto runningRead = it->second;
+            runningReadsLock.unlock();
+            ++impl_->coalescedReads_;
+            return runningRead.get();
+        }
+        impl_->runningReads_.emplace(k, promise.get_future().share());
+    }
+
+    SharedBlob blob;
+    try {
+        blob = fetchTileLayerBlob(k);
+    }
+    catch (...) {
+        {
+            std::unique_lock runningReadsLock(impl_->runningReadsMutex_);
+            impl_->runningReads_.erase(k);
+        }
+        promise.set_exception(std::current_exception());
+        throw;
+    }
+
+    if (blob) {
+        std::unique_lock hotWriteLock(impl_->hotWriteMutex_);
+        if (!impl_->hot_->getSharedTileLayerBlob(k))
+            impl_->hot_->putTileLayerBlob(k, *blob);
+    }
+    {
+        std::unique_lock runningReadsLock(impl_->runningReadsMutex_);
+        impl_->runningReads_.erase(k);
+    }
+    promise.set_value(blob);
+    return blob;
+}
+
+Cache::SharedBlob RemoteCache::fetchTileLayerBlob(MapTileKey const& k)
+{
+    auto result = impl_->send([&k](httplib::Client& client)
+        { return client.Get("/cache/tile" + queryParam("key", k.toString())); });
+    if (!impl_->check(result, "get tile", {200, 404}))
+        return nullptr;
+    if (result->status == 404) {
+        ++impl_->remoteMisses_;
+        return nullptr;
+    }
+
+    // The tile may use strings which were added by another instance.
+    auto stringPools = result->get_header_value(CacheServer::StringPoolsHeader);
+    if (!stringPools.empty()) {
+        for (auto const& [nodeId, highestString] : nlohmann::json::parse(stringPools).items())
+            refreshStringPool(nodeId, highestString.get<simfil::StringId>());
+    }
+    if (impl_->disabled_)
+        return nullptr;
+
+    ++impl_->remoteHits_;
+    return std::make_shared<const std::string>(std::move(result->body));
+}
+
+void RemoteCache::refreshStringPool(std::string const& nodeId, simfil::StringId highestString)
+{
+    // Pools which are not loaded yet are read completely once they are used.
+    std::shared_ptr<StringPool> strings;
+    {
+        std::shared_lock stringPoolReadLock(stringPoolCacheMutex_);
+        auto it = stringPoolPerNodeId_.find(nodeId);
+        if (it == stringPoolPerNodeId_.end())
+            return;
+        strings = it->second;
+    }
+
+    std::unique_lock refreshLock(impl_->refreshMutex_);
+    if (strings->highest() >= highestString)
+        return;
+    auto blob = getStringPoolBlob(nodeId);
+    if (!blob)
+        return;
+    auto serverStrings = parseStringPool(nodeId, *blob);
+    if (!agreeOnCommonStrings(*strings, *serverStrings)) {
+        disableRemote(nodeId);
+        return;
+    }
+
+    // Add the strings which the local pool does not have yet.
+    std::stringstream newStrings;
+    serverStrings->write(newStrings, static_cast<simfil::StringId>(strings->highest() + 1));
+    StringPool::readDataSourceNodeId(newStrings);
+    strings->read(newStrings);
+    ++impl_->refreshedStringPools_;
+    log().debug("Updated string pool of node {} from the cache server, up to string {}.", nodeId, strings->highest());
+
+    // The new strings do not have to be written back.
+    std::unique_lock stringPoolOffsetLock(stringPoolOffsetMutex_);
+    auto& cachedOffset = stringPoolOffsets_[nodeId];
+    cachedOffset = std::max(cachedOffset, strings->highest());
+}
+
+void RemoteCache::disableRemote(std::string const& nodeId)
+{
+    if (impl_->disabled_.exchange(true))
+        return;
+    log().error(
+        "The cache server has a different string pool for node {}. The cache server is not used "
+        "anymore. Node ids must only be shared by instances which use the same data source process.",
+        nodeId);
+}
+
+void RemoteCache::putTileLayerBlob(MapTileKey const& k, std::string const& v)
+{
+    {
+        std::unique_lock hotWriteLock(impl_->hotWriteMutex_);
+        impl_->hot_->putTileLayerBlob(k, v);
+    }
+    if (impl_->disabled_)
+        return;
+    auto result = impl_->send([&k, &v](httplib::Client& client)
+        { return client.Put("/cache/tile" + queryParam("key", k.toString()), v, "application/binary"); });
+    impl_->check(result, "put tile");
+}
+
+void RemoteCache::eraseTileLayerBlob(MapTileKey const& k)
+{
+    {
+        std::unique_lock hotWriteLock(impl_->hotWriteMutex_);
+        impl_->hot_->eraseTileLayerBlob(k);
+    }
+    if (impl_->disabled_)
+        return;
+    auto result = impl_->send([&k](httplib::Client& client)
+        { return client.Delete("/cache/tile" + queryParam("key", k.toString())); });
+    impl_->check(result, "erase tile");
+}
+
+std::optional<std::string> RemoteCache::getStringPoolBlob(std::string_view const& sourceNodeId)
+{
+    if (impl_->disabled_)
+        return {};
+    auto result = impl_->send([nodeId = std::string(sourceNodeId)](httplib::Client& client)
+        { return client.Get("/cache/string-pool" + queryParam("node", nodeId)); });
+    if (!impl_->check(result, "get string pool", {200, 404}) || result->status == 404)
+        return {};
+    return std::move(result->body);
+}
+
+void RemoteCache::putStringPoolBlob(std::string_view const& sourceNodeId, std::string const& v)
+{
+    if (impl_->disabled_)
+        return;
+    auto nodeId = std::string(sourceNodeId);
+    auto result = impl_->send([&nodeId, &v](httplib::Client& client)
+        { return client.Put("/cache/string-pool" + queryParam("node", nodeId), v, "application/binary"); });
+    if (result && result->status == 409) {
+        disableRemote(nodeId);
+        return;
+    }
+    impl_->check(result, "put string pool");
+}
+
+std::optional<std::string> RemoteCache::getCompressionDictionaryBlob(std::string const& key)
+{
+    if (impl_->disabled_)
+        return {};
+    auto result = impl_->send([&key](httplib::Client& client)
+        { return client.Get("/cache/dictionary" + queryParam("key", key)); });
+    if (!impl_->check(result, "get compression dictionary", {200, 404}) || result->status == 404)
+        return {};
+    return std::move(result->body);
+}
+
+void RemoteCache::putCompressionDictionaryBlob(std::string const& key, std::string const& v)
+{
+    if (impl_->disabled_)
+        return;
+    auto result = impl_->send([&key, &v](httplib::Client& client)
+        { return client.Put("/cache/dictionary" + queryParam("key", key), v, "application/binary"); });
+
+    // Another instance trained a dictionary first. The layer is then
+    // compressed without dictionary, until the other one is loaded.
+    if (result && result->status == 409)
+        raiseFmt("Another instance stored a compression dictionary for {} first.", key);
+    if (!impl_->check(result, "put compression dictionary"))
+        raiseFmt("Could not store the compression dictionary for {}.", key);
+}
+
+nlohmann::json RemoteCache::getStatistics() const
+{
+    auto result = Cache::getStatistics();
+    result["remote-hits"] = impl_->remoteHits_.load();
+    result["remote-misses"] = impl_->remoteMisses_.load();
+    result["remote-errors"] = impl_->remoteErrors_.load();
+    result["coalesced-reads"] = impl_->coalescedReads_.load();
+    result["refreshed-string-pools"] = impl_->refreshedStringPools_.load();
+    result["remote-disabled"] = impl_->disabled_.load();
+    result["hot-tier"] = impl_->hot_->getStatistics();
+    return result;
+}
+
+}
@@ -1,9 +1,16 @@
 #pragma once
 
 #include "spdlog/spdlog.h"
+#include "spdlog/sinks/sink.h"
 #include "fmt/core.h"
 #include "simfil/exception-handler.h"
 
+#include <memory>
+
+#ifndef MAPGET_LOG_ACTIVE_LEVEL
+#define MAPGET_LOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#endif
+
 namespace mapget
 {
 
@@ -13,9 +20,36 @@ namespace mapget
  *  - MAPGET_LOG_LEVEL
  *  - MAPGET_LOG_FILE
  *  - MAPGET_LOG_FILE_MAXSIZE
+ *  - MAPGET_LOG_FILE_QUEUE_SIZE
+ * A file logger writes from a background thread, see AsyncSink.
  */
 spdlog::logger& log();
 
+/**
+ * Sink which hands the messages of the calling threads to a background
+ * thread, which writes them to a target sink. The queue is bounded: If it
+ * is full, the oldest message is dropped, so that logging never blocks.
+ * flush() waits until the queued messages are written.
+ */
+class AsyncSink : public spdlog::sinks::sink
+{
+public:
+    AsyncSink(std::shared_ptr<spdlog::sinks::sink> target, size_t queueSize);
+    ~AsyncSink() override;
+
+    void log(spdlog::details::log_msg const& msg) override;
+    void flush() override;
+    void set_pattern(std::string const& pattern) override;
+    void set_formatter(std::unique_ptr<spdlog::formatter> formatter) override;
+
+    /** Number of messages which were dropped, because the queue was full. */
+    [[nodiscard]] uint64_t droppedMessages() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
 /**
  * Set the level of the log instance to corresponding string.
  * If the string is empty, set to info.
@@ -24,6 +58,24 @@ spdlog::logger& log();
  */
 void setLogLevel(std::string logLevel, spdlog::logger& logInstance);
 
+/**
+ * Log through the global logger, without evaluating the arguments if the
+ * level is disabled. Levels below MAPGET_LOG_ACTIVE_LEVEL (an SPDLOG_LEVEL_*
+ * value, set by the build) are removed at compile time. Use these in hot
+ * paths instead of log().debug(...), whose arguments are always built.
+ */
+#define MAPGET_LOG(logLevel, ...)                                                                \
+    do {                                                                                         \
+        if constexpr ((logLevel) >= MAPGET_LOG_ACTIVE_LEVEL) {                                   \
+            auto& mapgetLogger = ::mapget::log();                                                \
+            if (mapgetLogger.should_log(static_cast<spdlog::level::level_enum>(logLevel)))       \
+                mapgetLogger.log(static_cast<spdlog::level::level_enum>(logLevel), __VA_ARGS__); \
+        }                                                                                        \
+    } while (false)
+
+#define MAPGET_LOG_TRACE(...) MAPGET_LOG(SPDLOG_LEVEL_TRACE, __VA_ARGS__)
+#define MAPGET_LOG_DEBUG(...) MAPGET_LOG(SPDLOG_LEVEL_DEBUG, __VA_ARGS__)
+
 /**
  * Log an exception and throw it via simfil::raise().
  */
@@ -1,72 +1,175 @@
-#include <shared_mutex>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
+#include <mutex>
+#include <thread>
 
 #include "spdlog/sinks/rotating_file_sink.h"
 #include "spdlog/sinks/stdout_color_sinks.h"
+#include "spdlog/details/log_msg_buffer.h"
 
 #include "mapget/log.h"
 
-spdlog::logger& mapget::log()
+namespace
 {
-    static std::shared_ptr<spdlog::logger> logInstance;
-    static std::shared_mutex loggerAccess;
 
+std::shared_ptr<spdlog::logger> createLogger()
+{
     static auto ENVVAR_LOG_LEVEL = "MAPGET_LOG_LEVEL";
     static auto ENVVAR_LOG_FILE = "MAPGET_LOG_FILE";
     static auto ENVVAR_LOG_FILE_MAXSIZE = "MAPGET_LOG_FILE_MAXSIZE";
+    static auto ENVVAR_LOG_FILE_QUEUE_SIZE = "MAPGET_LOG_FILE_QUEUE_SIZE";
     static auto LOG_MARKER = "mapget";
 
-    {
-        // Check if the logger is already initialized - read-only lock.
-        std::shared_lock<std::shared_mutex> readLock(loggerAccess);
-        if (logInstance)
-            return *logInstance;
+    auto getEnvSafe = [](char const* env){
+        auto value = std::getenv(env);
+        if (value)
+            return std::string(value);
+        return std::string();
+    };
+    auto parseEnvSafe = [&](char const* env, uint64_t defaultValue){
+        auto value = getEnvSafe(env);
+        if (value.empty())
+            return defaultValue;
+        try {
+            return static_cast<uint64_t>(std::stoull(value));
+        }
+        catch (std::exception&) {
+            std::cerr << "Could not parse value of " << env << " ." << std::endl;
+        }
+        return defaultValue;
+    };
+    std::string logLevel = getEnvSafe(ENVVAR_LOG_LEVEL);
+    std::string logFile = getEnvSafe(ENVVAR_LOG_FILE);
+    uint64_t logFileMaxSizeInt = parseEnvSafe(ENVVAR_LOG_FILE_MAXSIZE, 1024ull*1024*1024); // 1GB
+    uint64_t logFileQueueSize = parseEnvSafe(ENVVAR_LOG_FILE_QUEUE_SIZE, 8192);
+
+    // File logger on demand, otherwise console logger.
+    std::shared_ptr<spdlog::logger> logInstance;
+    if (!logFile.empty()) {
+        std::cout << "Logging mapget events to: " << logFile << std::endl;
+        std::cout << "Maximum logfile size: " << logFileMaxSizeInt << " bytes" << std::endl;
+        std::shared_ptr<spdlog::sinks::sink> sink =
+            std::make_shared<spdlog::sinks::rotating_file_sink_mt>(logFile, logFileMaxSizeInt, 2);
+        // Write from a background thread, unless the queue is disabled.
+        if (logFileQueueSize > 0)
+            sink = std::make_shared<mapget::AsyncSink>(std::move(sink), logFileQueueSize);
+        logInstance = std::make_shared<spdlog::logger>(LOG_MARKER, std::move(sink));
+        spdlog::register_logger(logInstance);
     }
+    else
+        logInstance = spdlog::stderr_color_mt(LOG_MARKER);
+
+    mapget::setLogLevel(logLevel, *logInstance);
+    return logInstance;
+}
+
+}  // namespace
+
+spdlog::logger& mapget::log()
+{
+    // Thread-safe initialization on first use, without locking afterwards.
+    static std::shared_ptr<spdlog::logger> logInstance = createLogger();
+    return *logInstance;
+}
+
+struct mapget::AsyncSink::Impl
+{
+    std::shared_ptr<spdlog::sinks::sink> target_;
+    size_t queueSize_;
+
+    std::mutex mutex_;
+    std::condition_variable queueChanged_;
+    std::condition_variable written_;
+    std::deque<spdlog::details::log_msg_buffer> queue_;
+    uint64_t enqueued_ = 0;
+    uint64_t done_ = 0;  // Messages which were written or dropped
+    uint64_t dropped_ = 0;
+    bool stop_ = false;
+    std::thread writer_;
 
+    void write()
     {
-        // Get write lock.
-        std::lock_guard<std::shared_mutex> readLock(loggerAccess);
-
-        // Check again, another thread might have initialized now.
-        if (logInstance)
-            return *logInstance;
-
-        // Initialize the logger.
-        auto getEnvSafe = [](char const* env){
-            auto value = std::getenv(env);
-            if (value)
-                return std::string(value);
-            return std::string();
-        };
-        std::string logLevel = getEnvSafe(ENVVAR_LOG_LEVEL);
-        std::string logFile = getEnvSafe(ENVVAR_LOG_FILE);
-        std::string logFileMaxSize = getEnvSafe(ENVVAR_LOG_FILE_MAXSIZE);
-        uint64_t logFileMaxSizeInt = 1024ull*1024*1024; // 1GB
-
-        // File logger on demand, otherwise console logger.
-        if (!logFile.empty()) {
-            std::cout << "Logging mapget events to: " << logFile << std::endl;
-            if (!logFileMaxSize.empty()) {
-                try {
-                    logFileMaxSizeInt = std::stoull(logFileMaxSize);
-                }
-                catch (std::exception&) {
-                    std::cerr << "Could not parse value of "
-                              << ENVVAR_LOG_FILE_MAXSIZE << " ." << std::endl;
-                }
+        std::unique_lock lock(mutex_);
+        while (true) {
+            queueChanged_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+            if (queue_.empty())
+                return;
+            auto msg = std::move(queue_.front());
+            queue_.pop_front();
+            lock.unlock();
+            try {
+                target_->log(msg);
             }
-            std::cout << "Maximum logfile size: " << logFileMaxSizeInt << " bytes" << std::endl;
-            logInstance = spdlog::rotating_logger_mt(LOG_MARKER, logFile, logFileMaxSizeInt, 2);
+            catch (std::exception& e) {
+                std::cerr << "Could not write log message: " << e.what() << std::endl;
+            }
+            lock.lock();
+            ++done_;
+            written_.notify_all();
         }
-        else
-            logInstance = spdlog::stderr_color_mt(LOG_MARKER);
+    }
+};
+
+mapget::AsyncSink::AsyncSink(std::shared_ptr<spdlog::sinks::sink> target, size_t queueSize)
+    : impl_(std::make_unique<Impl>())
+{
+    impl_->target_ = std::move(target);
+    impl_->queueSize_ = std::max<size_t>(queueSize, 1);
+    impl_->writer_ = std::thread([this] { impl_->write(); });
+}
 
-        mapget::setLogLevel(logLevel, *logInstance);
+mapget::AsyncSink::~AsyncSink()
+{
+    {
+        std::lock_guard lock(impl_->mutex_);
+        impl_->stop_ = true;
     }
+    impl_->queueChanged_.notify_all();
+    impl_->writer_.join();
+    impl_->target_->flush();
+}
 
-    return *logInstance;
+void mapget::AsyncSink::log(spdlog::details::log_msg const& msg)
+{
+    {
+        std::lock_guard lock(impl_->mutex_);
+        if (impl_->queue_.size() >= impl_->queueSize_) {
+            impl_->queue_.pop_front();
+            ++impl_->dropped_;
+            ++impl_->done_;
+        }
+        impl_->queue_.emplace_back(msg);
+        ++impl_->enqueued_;
+    }
+    impl_->queueChanged_.notify_one();
 }
 
+void mapget::AsyncSink::flush()
+{
+    {
+        std::unique_lock lock(impl_->mutex_);
+        auto const enqueued = impl_->enqueued_;
+        impl_->written_.wait(lock, [&] { return impl_->done_ >= enqueued; });
+    }
+    impl_->target_->flush();
+}
+
+void mapget::AsyncSink::set_pattern(std::string const& pattern)
+{
+    impl_->target_->set_pattern(pattern);
+}
+
+void mapget::AsyncSink::set_formatter(std::unique_ptr<spdlog::formatter> formatter)
+{
+    impl_->target_->set_formatter(std::move(formatter));
+}
+
+uint64_t mapget::AsyncSink::droppedMessages() const
+{
+    std::lock_guard lock(impl_->mutex_);
+    return impl_->dropped_;
+}
 
 void mapget::setLogLevel(std::string logLevel, spdlog::logger& logInstance) {
     for (auto& ch : logLevel)
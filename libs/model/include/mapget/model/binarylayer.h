@@ -0,0 +1,89 @@
+#pragma once
+
+#include "layer.h"
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace mapget
+{
+
+/**
+ * Tile layer which carries an opaque binary payload, e.g. the raster of a
+ * Heightmap or OrthoImage layer, or the buffer of a GLTF layer, together with
+ * its MIME content type and a small JSON metadata object, e.g. the extent
+ * or the value range of a raster. The payload is never interpreted by mapget.
+ *
+ * The payload may be a slice of a shared buffer, e.g. of a cached tile
+ * blob from which the layer was parsed, so that it is not copied.
+ */
+class TileBinaryLayer : public TileLayer
+{
+public:
+    using Ptr = std::shared_ptr<TileBinaryLayer>;
+    using SharedBytes = std::shared_ptr<const std::string>;
+
+    TileBinaryLayer(
+        TileId tileId,
+        std::string const& nodeId,
+        std::string const& mapId,
+        std::shared_ptr<LayerInfo> const& layerInfo);
+
+    /** Parse a layer from a stream, and copy its payload. */
+    TileBinaryLayer(std::istream& inputStream, LayerInfoResolveFun const& layerInfoResolveFun);
+
+    /**
+     * Parse a layer from a stream which reads the given message body, a
+     * slice of the shared buffer. The payload, which ends the message, is
+     * not read from the stream, but referenced in the buffer.
+     */
+    TileBinaryLayer(
+        std::istream& inputStream,
+        LayerInfoResolveFun const& layerInfoResolveFun,
+        SharedBytes buffer,
+        std::string_view const& message);
+
+    /**
+     * Getter and setter for the MIME type of the payload,
+     * e.g. `image/png` or `model/gltf-binary`.
+     */
+    [[nodiscard]] std::string const& contentType() const;
+    void setContentType(std::string const& contentType);
+
+    /** Getter and setter for the JSON metadata of the payload. */
+    [[nodiscard]] nlohmann::json const& metadata() const;
+    void setMetadata(nlohmann::json const& metadata);
+
+    /** Get the payload bytes. They are valid as long as the layer lives. */
+    [[nodiscard]] std::string_view payload() const;
+
+    /** Set the payload bytes. */
+    void setPayload(std::string bytes);
+
+    /**
+     * Set the payload to a slice of a shared buffer, which the layer keeps
+     * alive. Throws if the slice does not lie within the buffer.
+     */
+    void setPayload(SharedBytes buffer, std::string_view const& slice);
+
+    /** Serialization */
+    void write(std::ostream& outputStream) override;
+
+    /** The payload is written as base64, next to the contentType and metadata. */
+    nlohmann::json toJson() const override;
+
+private:
+    // Read the fields which follow the TileLayer header, and return the payload size.
+    uint64_t readFields(std::istream& inputStream);
+
+    void addMemoryUsage(nlohmann::json& usage) override;
+    void writeContent(std::ostream& outputStream) override;
+
+    std::string contentType_;
+    nlohmann::json metadata_ = nlohmann::json::object();
+    SharedBytes payloadBuffer_;
+    std::string_view payload_;
+};
+
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "nlohmann/json.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+namespace mapget
+{
+
+/**
+ * Per-thread pools of the pages of tile columns, see ColumnAllocator.
+ * Each worker thread keeps the pages of the tiles which it built once they
+ * die, and hands them out again for the next tiles it builds. A page which
+ * dies on another thread goes back to the pool of the thread which allocated
+ * it, so threads do not free each other's memory on the global heap. Each
+ * pool keeps up to maxPooledBytes() bytes, the pages above are freed.
+ */
+class ColumnPagePool
+{
+public:
+    /** Allocations below this size, e.g. the segment tables of columns, are not pooled. */
+    static constexpr size_t MinPageBytes = 1024;
+
+    /** Default of maxPooledBytes(). */
+    static constexpr size_t DefaultMaxPooledBytes = 32 * 1024 * 1024;
+
+    /** Allocate a page of the calling thread's pool, or from the heap if it is small. */
+    static void* allocate(size_t bytes, size_t alignment);
+
+    /** Return a page to the pool it was allocated from. */
+    static void deallocate(void* page, size_t bytes, size_t alignment) noexcept;
+
+    /** Bytes which each pool keeps at most. Zero disables the pools. */
+    static size_t maxPooledBytes();
+    static void setMaxPooledBytes(size_t bytes);
+
+    /**
+     * While a batch release lives on a thread, the pages which the thread
+     * returns are collected, and then returned at once, with a single lock
+     * per pool. Used when a tile dies, to release all of its columns.
+     * Batches may be nested, then the outermost one returns the pages.
+     */
+    class BatchRelease
+    {
+    public:
+        BatchRelease();
+        ~BatchRelease();
+
+        BatchRelease(BatchRelease const&) = delete;
+        BatchRelease& operator=(BatchRelease const&) = delete;
+
+    private:
+        bool isOutermost_ = false;
+    };
+
+    /**
+     * Get the totals of all pools: the number of `pooled-pages` and their
+     * `pooled-bytes`, the number of `new-pages` which were allocated from
+     * the heap, of `reused-pages` which were taken from a pool, of
+     * `remote-pages` which were returned by another thread, and of
+     * `freed-pages` which did not fit into their pool.
+     */
+    static nlohmann::json getStatistics();
+};
+
+/**
+ * Stateless allocator of the columns of tile layers, which takes their
+ * pages from the ColumnPagePool of the allocating thread.
+ */
+template <typename T>
+struct ColumnAllocator
+{
+    using value_type = T;
+
+    ColumnAllocator() noexcept = default;
+
+    template <typename U>
+    ColumnAllocator(ColumnAllocator<U> const&) noexcept {}
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(ColumnPagePool::allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* page, size_t n) noexcept
+    {
+        ColumnPagePool::deallocate(page, n * sizeof(T), alignof(T));
+    }
+
+    template <typename U>
+    bool operator==(ColumnAllocator<U> const&) const noexcept { return true; }
+
+    template <typename U>
+    bool operator!=(ColumnAllocator<U> const&) const noexcept { return false; }
+};
+
+}  // namespace mapget
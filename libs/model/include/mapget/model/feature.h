@@ -72,6 +72,13 @@ public:
     [[nodiscard]] model_ptr<GeometryCollection> geomOrNull() const;
     [[nodiscard]] SelfContainedGeometry firstGeometry() const;
 
+    /**
+     * Get the bounding box of all geometries of this feature, or nothing if
+     * it has no points. It is combined from the boxes of the geometries,
+     * see Geometry::bbox().
+     */
+    [[nodiscard]] std::optional<BBox> bbox() const;
+
     /**
      * Get this feature's Attribute layers. The non-const version adds a
      * AttributeLayerList if the feature does not have one yet.
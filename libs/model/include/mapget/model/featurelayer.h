@@ -1,6 +1,8 @@
 #pragma once
 
+#include <optional>
 #include <span>
+#include <variant>
 
 #include "simfil/model/nodes.h"
 #include "simfil/simfil.h"
@@ -68,6 +70,8 @@ public:
 
     /**
      * Constructor which parses a TileFeatureLayer from a binary stream.
+     * The feature, attribute, geometry and source data columns are only
+     * copied from the stream, and decoded when they are first accessed.
      * @param inputStream The binary stream to parse.
      * @param layerInfoResolveFun Function which will be called to retrieve
      *  a layerInfo object for the layer name stored for the tile.
@@ -87,9 +91,78 @@ public:
     void setIdPrefix(KeyValueViewPairs const& prefix);
     model_ptr<Object> getIdPrefix();
 
+    /**
+     * Expected numbers of nodes of a layer, which are used to pre-size
+     * its columns, see reserve(). The numbers of a filled layer are
+     * returned by sizeHint(), so they can be applied to similar layers.
+     */
+    struct SizeHint
+    {
+        uint32_t features_ = 0;
+        uint32_t attributes_ = 0;
+        uint32_t attributeLayers_ = 0;
+        uint32_t geometries_ = 0;
+        uint32_t validities_ = 0;
+        uint32_t relations_ = 0;
+        uint32_t sourceDataReferences_ = 0;
+    };
+
+    /**
+     * Reserve the columns of this layer for the given numbers of nodes,
+     * so that they do not grow page by page while the layer is filled.
+     * The columns still grow beyond the hint if needed.
+     */
+    void reserve(SizeHint const& hint);
+
+    /** Get the numbers of nodes which were added to this layer. */
+    [[nodiscard]] SizeHint sizeHint() const;
+
     /** Destructor for the TileFeatureLayer class. */
     ~TileFeatureLayer() override;
 
+    /**
+     * Columns of a batch of features, see newFeatures(). Row i of
+     * each column belongs to the i-th feature of the batch.
+     */
+    struct FeatureBatch
+    {
+        /** Values of a column. Id parts must be integers or strings. */
+        using Column = std::variant<std::vector<int64_t>, std::vector<double>, std::vector<std::string>>;
+
+        /** The type id of all features, or one type id per feature. */
+        std::vector<std::string> typeIds_;
+
+        /** Feature id parts by name, without the id prefix of the layer. */
+        std::vector<std::pair<std::string, Column>> idParts_;
+
+        /**
+         * Type of the geometry of each feature, see Feature::addLine() etc.
+         * The points of feature i are the (x, y, z) coordinate triples from
+         * geometryOffsets_[i] up to geometryOffsets_[i + 1]. A feature whose
+         * offsets are equal has no geometry. Without offsets, no feature has.
+         */
+        GeomType geomType_ = GeomType::Line;
+        std::vector<double> coordinates_;
+        std::vector<uint32_t> geometryOffsets_;
+
+        /** Attributes by name, which are added to Feature::attributes(). */
+        std::vector<std::pair<std::string, Column>> attributes_;
+
+        /** Number of features, which is the length of the longest column. */
+        [[nodiscard]] size_t size() const;
+    };
+
+    /**
+     * Create the features of a batch, as if each one was created by
+     * newFeature(), and given its geometry and attributes. The columns of
+     * the layer are reserved for the batch at once, and no node is
+     * returned, so the batch is added in one pass. Raises if a column
+     * does not have a row per feature, before any feature is added, or
+     * if a feature id is invalid, after the features before it were added.
+     * Returns the number of created features.
+     */
+    size_t newFeatures(FeatureBatch const& batch);
+
     /**
      * Creates a new feature and insert it into this tile layer.
      * The featureIdParts (which do not include the getIdPrefix of the layer)
@@ -199,9 +272,28 @@ public:
     /** (De-)Serialization */
     void write(std::ostream& outputStream) override;
 
+    /** Encodings of the vertex offsets of the geometries, see write(). */
+    enum class GeometryEncoding : uint8_t {
+        /** The float vertex offsets as they are stored. */
+        Raw,
+        /**
+         * Vertex offsets which are quantized to 1e-7 units horizontally
+         * (about 1 cm for WGS84 degrees) and 1e-3 units vertically, and
+         * stored as zigzag varint deltas. This is lossy, and can only be
+         * read since TileLayerStream::CompactGeometryProtocolVersion.
+         */
+        QuantizedDelta
+    };
+
+    /** Serialize with the given encoding of the vertex offsets. */
+    void write(std::ostream& outputStream, GeometryEncoding geometryEncoding);
+
     /** Convert to (Geo-) JSON. */
     nlohmann::json toJson() const override;
 
+    /** Append the JSON of toJson() as a FeatureCollection, without building it first. */
+    void writeJson(std::string& out, JsonLayout layout = JsonLayout::Model) const override;
+
     /** Access number of stored features */
     size_t size() const;
 
@@ -213,9 +305,94 @@ public:
     model_ptr<Feature> find(std::string_view const& type, KeyValueViewPairs const& queryIdParts) const;
     model_ptr<Feature> find(std::string_view const& type, KeyValuePairs const& queryIdParts) const;
 
+    /**
+     * Get the features whose geometry bounding box intersects the given
+     * WGS84 bounding box, in feature order. These are candidates, exact
+     * tests, e.g. `geo() within bbox(...)`, can be evaluated on them.
+     * A read-only layer keeps a packed R-tree over the feature bounding
+     * boxes, which is built on the first call. Writable layers are scanned.
+     */
+    std::vector<model_ptr<Feature>> findIntersecting(Point const& minPoint, Point const& maxPoint) const;
+
+    /**
+     * Comparison of a non-layered attribute with a number, e.g. the query
+     * `properties.speedLimit > 80`, which findByAttribute() evaluates.
+     */
+    struct AttributeFilter
+    {
+        enum class Op { Less, LessEqual, Greater, GreaterEqual, Equal };
+
+        std::string name_;
+        Op op_ = Op::Equal;
+        double value_ = 0.;
+
+        /**
+         * Parse a query which is exactly such a comparison, i.e.
+         * `properties.<name> <op> <number>` with one of the operators
+         * `<`, `<=`, `>`, `>=` or `==`. Other queries give nullopt.
+         */
+        static std::optional<AttributeFilter> fromQuery(std::string_view const& query);
+    };
+
+    /**
+     * Numeric values of a non-layered attribute of the features of one
+     * type, as one contiguous typed array. The values are integers, or
+     * doubles if any of them is a float.
+     */
+    struct AttributeColumn
+    {
+        std::string typeId_;
+        std::vector<uint32_t> features_;  // Ascending indices of the features which have the attribute
+        std::variant<std::vector<int64_t>, std::vector<double>> values_;  // One value per feature
+    };
+
+    /**
+     * Get the columns of a non-layered attribute, one per feature type
+     * which has it. Null if some feature has a value which is not a
+     * number, or null. A read-only layer caches the columns per attribute
+     * name, which are built on the first call. Other layers build them anew.
+     */
+    std::shared_ptr<const std::vector<AttributeColumn>> attributeColumns(std::string_view const& name) const;
+
+    /**
+     * Get the features whose attribute value passes the filter, in feature
+     * order, by scanning the attribute columns. These are candidates, the
+     * query can be evaluated on them: strict comparisons are scanned as
+     * non-strict ones, so that no match is lost to double rounding.
+     * Returns nullopt if there are no columns for the attribute.
+     */
+    std::optional<std::vector<model_ptr<Feature>>> findByAttribute(AttributeFilter const& filter) const;
+
+    /**
+     * Get the ascending indices of the features on which the query matches,
+     * see queryMatches(). A read-only layer, e.g. a cached tile, memoizes the
+     * indices per query, so a query which viewers repeat, e.g. of a style
+     * sheet, is evaluated once per tile. The results live with the layer, so
+     * a new version of the tile evaluates them anew. Each layer memoizes up
+     * to maxMemoizedQueries() queries, and clears them when it is full.
+     */
+    std::shared_ptr<const std::vector<uint32_t>> matchingFeatures(std::string_view const& query);
+
+    /** Whether the results of a query match, i.e. one of them is neither null nor false. */
+    static bool queryMatches(std::vector<simfil::Value> const& values);
+
+    /** Number of queries whose results each read-only layer memoizes, zero disables it. */
+    static constexpr size_t DefaultMaxMemoizedQueries = 64;
+    static size_t maxMemoizedQueries();
+    static void setMaxMemoizedQueries(size_t count);
+
     /** Shared pointer type */
     using Ptr = std::shared_ptr<TileFeatureLayer>;
 
+    /**
+     * Get a copy of this layer whose line and polygon geometries are simplified
+     * with the Douglas-Peucker algorithm, e.g. for overview tiles. No dropped
+     * vertex is farther than the tolerance, in degrees, from its simplified
+     * geometry. Geometries which are referenced by views are kept as they are.
+     * The copy shares the string pool of this layer.
+     */
+    Ptr simplified(double tolerance);
+
     /**
      * Evaluate a (potentially cached) simfil query on this pool
      */
@@ -229,6 +406,141 @@ public:
      */
     void setStrings(std::shared_ptr<simfil::StringPool> const& newPool) override;
 
+    /**
+     * Addresses of the nodes of another layer which were cloned into this
+     * layer, so that nodes which are referenced several times are cloned
+     * once. The addresses are kept in one flat vector per column, which
+     * is indexed by the node index in the other layer.
+     */
+    class ClonedNodes
+    {
+    public:
+        /**
+         * The source data references of the cloned nodes are only cloned
+         * if requested, as they refer to the source data of the other layer.
+         */
+        explicit ClonedNodes(bool withSourceDataReferences = false);
+
+        [[nodiscard]] std::optional<simfil::ModelNodeAddress> find(simfil::ModelNodeAddress const& other) const;
+        void insert(simfil::ModelNodeAddress const& other, simfil::ModelNodeAddress const& cloned);
+        [[nodiscard]] bool withSourceDataReferences() const;
+
+    private:
+        std::vector<std::vector<simfil::ModelNodeAddress>> columns_;
+        bool withSourceDataReferences_ = false;
+    };
+
+    /**
+     * Parts of a layer which are kept by projected(). A feature type or
+     * attribute layer is kept if it is in the include list, or if that
+     * list is empty, and if it is not in the exclude list.
+     */
+    struct Projection
+    {
+        std::vector<std::string> includeFeatureTypes_;
+        std::vector<std::string> excludeFeatureTypes_;
+        std::vector<std::string> includeAttributeLayers_;
+        std::vector<std::string> excludeAttributeLayers_;
+        bool geometry_ = true;
+        bool sourceDataReferences_ = true;
+
+        /**
+         * Parse a projection from JSON, e.g.
+         * `{"featureTypes": {"include": ["Road"]}, "attributeLayers": {"exclude": ["lanes"]},
+         *   "geometry": false, "sourceDataReferences": false}`.
+         * All keys are optional.
+         */
+        static Projection fromJson(nlohmann::json const& j);
+
+        /** Whether the projection keeps the whole layer. */
+        [[nodiscard]] bool keepsAll() const;
+        [[nodiscard]] bool keepsFeatureType(std::string_view const& typeId) const;
+        [[nodiscard]] bool keepsAttributeLayer(std::string_view const& name) const;
+    };
+
+    /**
+     * Get a copy of this layer with the features, attribute layers and
+     * geometries which the projection keeps. This layer itself is returned
+     * if the projection keeps all of it. The copy shares the string pool
+     * of this layer.
+     */
+    Ptr projected(Projection const& projection);
+
+    /**
+     * Get the changes of this layer against an older version of its tile,
+     * e.g. the version which a client holds: A copy of this layer which only
+     * has the features that are new or whose content changed, and which
+     * lists the type and id parts of the features that were removed from
+     * the base. Features are matched through the feature id hash index,
+     * and compared by their JSON bytes. The delta is applied
+     * to the base with applyDelta(). It shares the string pool of this layer.
+     */
+    Ptr delta(Ptr const& base);
+
+    /**
+     * Get a delta without changes against the layer with the given timestamp,
+     * e.g. for a client which holds a layer with the same eTag() as this one.
+     * Applying it to that layer gives this layer's content and timestamp.
+     */
+    Ptr unchangedDelta(std::chrono::time_point<std::chrono::system_clock> baseTimestamp);
+
+    /**
+     * Whether this layer was returned by delta(), and the timestamp
+     * of the layer which it must be applied to.
+     */
+    [[nodiscard]] bool isDelta() const;
+    [[nodiscard]] std::optional<std::chrono::time_point<std::chrono::system_clock>> deltaBaseTimestamp() const;
+
+    /**
+     * Apply a delta of this layer, see delta(). Returns a copy of the newer
+     * layer, with the unchanged features of this layer followed by the
+     * new and changed features of the delta. Throws if the delta was not
+     * computed against this layer.
+     */
+    Ptr applyDelta(Ptr const& delta);
+
+    /**
+     * Create empty layers for the tile of this layer, which may be filled
+     * in parallel, one thread per shard, e.g. to build a huge tile on
+     * several cores. The shards are then merged into this layer with
+     * merge(). Each shard has its own string pool, so that the threads do
+     * not contend for interning strings, and the id prefix of this layer.
+     */
+    std::vector<Ptr> newShards(size_t numShards);
+
+    /**
+     * Add the features of filled shards to this layer, in shard order,
+     * after the features which it already has. The columns of this layer
+     * are reserved for all shards first. A feature whose id is already
+     * in this layer, e.g. from another shard, gets the attributes,
+     * relations and geometries of the shard's feature, as with clone().
+     */
+    void merge(std::vector<Ptr> const& shards);
+
+    /**
+     * Send the features which were added since the previous chunk as a
+     * chunk: a layer of the same tile with only these features, whose info
+     * has the chunk index. Data sources which fill huge tiles may call this
+     * after each batch of features, so that requesters which accept chunks
+     * get the first features early, and merge() the chunks of a tile. Does
+     * nothing if the cancellation token of this layer has no chunk sink,
+     * or if no feature was added since the previous chunk.
+     */
+    void sendChunk();
+
+    /**
+     * Send the final chunk of this filled layer, with the features which
+     * were not sent in a chunk yet. It completes the chunks of the tile.
+     * Does nothing if no chunk was sent. Called by DataSource::get().
+     */
+    void sendFinalChunk();
+
+    /** Index of this layer among the chunks of its tile, if it is a chunk. */
+    [[nodiscard]] std::optional<uint32_t> chunkIndex() const;
+
+    /** Whether this layer is the final chunk of its tile. */
+    [[nodiscard]] bool isFinalChunk() const;
+
     /**
      * Create a copy of otherFeature in this layer with the given type
      * and id-parts. If a feature with that ID already exists in this layer,
@@ -236,19 +548,31 @@ public:
      * be appended to the existing feature.
      */
     void clone(
-        std::unordered_map<uint32_t, simfil::ModelNode::Ptr>& clonedModelNodes,
+        ClonedNodes& clonedModelNodes,
         TileFeatureLayer::Ptr const& otherLayer,
         Feature const& otherFeature,
         std::string_view const& type,
         KeyValueViewPairs idParts);
 
+    /**
+     * Variant of clone() for a feature, which only copies the attribute
+     * layers and the geometries which the projection keeps.
+     */
+    void clone(
+        ClonedNodes& clonedModelNodes,
+        TileFeatureLayer::Ptr const& otherLayer,
+        Feature const& otherFeature,
+        std::string_view const& type,
+        KeyValueViewPairs idParts,
+        Projection const& projection);
+
     /**
      * Create a copy of otherNode (which lives in otherLayer) in this layer.
      * The clonedModelNodes dict may be provided to avoid repeated copies
      * of nodes which are referenced multiple times.
      */
     simfil::ModelNode::Ptr clone(
-        std::unordered_map<uint32_t, simfil::ModelNode::Ptr>& clonedModelNodes,
+        ClonedNodes& clonedModelNodes,
         TileFeatureLayer::Ptr const& otherLayer,
         simfil::ModelNode::Ptr const& otherNode);
 
@@ -321,6 +645,31 @@ protected:
 
     Geometry::Storage& vertexBufferStorage();
 
+    /**
+     * Compute the bounds of the geometries of a parsed layer, once. The
+     * bounds are not serialized, and new layers keep them up to date.
+     */
+    void computeGeometryBoxes() const;
+
+    /**
+     * Get the cumulative lengths of a geometry, see Geometry::cumulativeLengths().
+     * A read-only layer caches them per geometry, other layers compute them anew.
+     */
+    std::shared_ptr<const std::vector<double>> lineLengths(Geometry const& geom) const;
+
+    /**
+     * Create an empty layer with the tile, map version, timestamp,
+     * info and feature id prefix of this layer. It uses the given
+     * string pool, or the string pool of this layer.
+     */
+    Ptr emptyCopy(std::shared_ptr<simfil::StringPool> const& strings = {});
+
+    // Create the chunk with the features which were not sent in a chunk yet.
+    Ptr nextChunk(bool isFinal);
+
+    void addMemoryUsage(nlohmann::json& usage) override;
+    void writeContent(std::ostream& outputStream) override;
+
     struct Impl;
     std::unique_ptr<Impl> impl_;
 };
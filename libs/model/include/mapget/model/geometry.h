@@ -3,12 +3,15 @@
 #include "simfil/model/nodes.h"
 
 #include "point.h"
+#include "simfil-geometry.h"
 #include "featureid.h"
 #include "sourcedatareference.h"
 #include "sourceinfo.h"
 
 #include <cstdint>
+#include <memory>
 #include <optional>
+#include <vector>
 
 using simfil::ValueType;
 using simfil::ModelNode;
@@ -69,6 +72,13 @@ public:
     /** Get a point at an index. */
     [[nodiscard]] Point pointAt(size_t index) const;
 
+    /**
+     * Get the bounding box of the points, or nothing if the geometry has
+     * no points. The box of a geometry is kept up to date while points are
+     * added, so this does not visit the points, except for geometry views.
+     */
+    [[nodiscard]] std::optional<BBox> bbox() const;
+
     /**
      * Get and set geometry name.
      */
@@ -95,6 +105,13 @@ public:
      */
     [[nodiscard]] double length() const;
 
+    /**
+     * Get the lengths of the Polyline in metres from its first point up to
+     * each of its points. So the first entry is zero, and the last one is
+     * the length(). A read-only layer computes the table once per geometry.
+     */
+    [[nodiscard]] std::shared_ptr<const std::vector<double>> cumulativeLengths() const;
+
     /**
      * Return geometric points on the Polyline (if the geometry is a Polyline)
      * within the defined position range boundaries.
@@ -113,6 +130,15 @@ public:
      */
     [[nodiscard]] std::vector<Point> pointsFromLengthBound(double start, std::optional<double> end) const;
 
+    /**
+     * Variant of pointsFromLengthBound() which looks the range up in the
+     * given cumulativeLengths() of this geometry, instead of walking it.
+     */
+    [[nodiscard]] std::vector<Point> pointsFromLengthBound(
+        double start,
+        std::optional<double> end,
+        std::vector<double> const& cumulativeLengths) const;
+
     /**
      * Turn the points and type from this geometry into a self-contained
      * struct which can be passed around.
@@ -127,6 +153,9 @@ protected:
     [[nodiscard]] StringId keyAt(int64_t) const override;
     bool iterate(IterCallback const& cb) const override;  // NOLINT (allow discard)
 
+    // Compute the table of cumulativeLengths().
+    [[nodiscard]] std::vector<double> computeCumulativeLengths() const;
+
     struct Data
     {
         Data() = default;
@@ -162,6 +191,12 @@ protected:
                 // Offset is set when vertexArray is allocated,
                 // which happens when the first point is added.
                 Point offset_;
+
+                // Bounds of the vertices relative to the offset. They
+                // are not serialized, but computed by a parsed layer,
+                // see TileFeatureLayer::computeGeometryBoxes().
+                glm::fvec3 boundsMin_{0.f};
+                glm::fvec3 boundsMax_{0.f};
             } geom_;
 
             struct GeomViewDetails {
@@ -228,6 +228,13 @@ struct Coverage
 
     /** Serialize Coverage to JSON. */
     [[nodiscard]] nlohmann::json toJson() const;
+
+    /**
+     * Check whether the layer is filled anywhere within the given tile.
+     * Tiles of other zoom levels are compared through their overlapping
+     * tiles at the zoom level of the coverage.
+     */
+    [[nodiscard]] bool covers(TileId const& tileId) const;
 };
 
 /**
@@ -279,6 +286,12 @@ struct LayerInfo
         bool validateForNewFeature,
         uint32_t compositionMatchStartIndex = 0);
 
+    /**
+     * Check whether the layer has data within the given tile, according to
+     * its coverage_. Layers without coverage are assumed to cover all tiles.
+     */
+    [[nodiscard]] bool covers(TileId const& tileId) const;
+
     /** Create LayerInfo from JSON. */
     static std::shared_ptr<LayerInfo> fromJson(const nlohmann::json& j, std::string const& layerId="");
 
@@ -312,6 +325,12 @@ struct DataSourceInfo
     /** Used mapget protocol version */
     Version protocolVersion_;
 
+    /**
+     * Maximum number of feature tiles of one layer which are passed
+     * to a single DataSource::fill() call.
+     */
+    int maxBatchSize_ = 1;
+
     /** Get the layer, or a runtime error, if no such layer exists. */
     [[nodiscard]] std::shared_ptr<LayerInfo> getLayer(std::string const& layerId, bool throwIfMissing=true) const;
 
@@ -339,6 +358,7 @@ struct DataSourceInfo
      *     ...
      *   },
      *   "maxParallelJobs": <int>,            // Optional: The maximum number of parallel jobs allowed. Defaults to 8.
+     *   "maxBatchSize": <int>,               // Optional: The maximum number of feature tiles filled in one call. Defaults to 1.
      *   "extraJsonAttachment": <JSON object>,// Optional: Any extra JSON data attached. Defaults to an empty object.
      *   "protocolVersion": {                 // Optional: The version of the protocol. Defaults to the current protocol version.
      *     "major": <int>,                    // Mandatory: The major version number.
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "layer.h"
+
+#include "simfil/model/nodes.h"
+#include "simfil/model/string-pool.h"
+
+#include <string>
+
+namespace mapget
+{
+
+/**
+ * Append the JSON of a model node to a buffer. The node tree is walked
+ * directly, without building a nlohmann::json DOM first, which saves
+ * an allocation per value. The output matches the node's toJson().
+ * Field names are resolved through the given string pool.
+ *
+ * With JsonLayout::GeoJson, the node must be a feature, see JsonLayout.
+ */
+void writeJson(
+    simfil::ModelNode const& node,
+    simfil::StringPool const& strings,
+    std::string& out,
+    JsonLayout layout = JsonLayout::Model);
+
+/** Append a JSON string literal, with the characters escaped as needed. */
+void writeJsonString(std::string_view const& str, std::string& out);
+
+}
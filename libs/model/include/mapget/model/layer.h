@@ -5,16 +5,35 @@
 
 #include "nlohmann/json.hpp"
 
+#include <atomic>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <chrono>
+#include <functional>
 #include <optional>
 #include <memory>
+#include <mutex>
 
 namespace simfil { struct StringPool; }
 
 namespace mapget
 {
 
+/**
+ * Layout of the JSON which is written by TileLayer::writeJson().
+ */
+enum class JsonLayout : uint8_t {
+    /** The layout of toJson(). */
+    Model,
+    /**
+     * RFC 7946 GeoJSON: Features only have the type, id, geometry and
+     * properties members. Their other members, e.g. typeId or the id
+     * parts, are moved into the properties.
+     */
+    GeoJson
+};
+
 /**
  * Callback type for a function which returns a string pool instance
  * for a given node identifier.
@@ -62,6 +81,33 @@ struct MapTileKey
      */
     [[nodiscard]] std::string toString() const;
 
+    /**
+     * Convert the key to a compact binary form, which is used as the
+     * storage key by caches. It consists of the map id and the layer id,
+     * each followed by a zero byte, the layer type as one byte, and the
+     * tile id as eight big-endian bytes. So keys of the same map layer
+     * share a prefix (see binaryLayerPrefix), and sort by tile id.
+     */
+    [[nodiscard]] std::string toBinary() const;
+
+    /** Parse a key as returned by toBinary. Raises if it is malformed. */
+    static MapTileKey fromBinary(std::string_view const& bytes);
+
+    /** Common prefix of the binary keys of all tiles in a map layer. */
+    static std::string binaryLayerPrefix(
+        std::string_view const& mapId,
+        std::string_view const& layerId,
+        LayerType layer = LayerType::Features);
+
+    /** Hash of all components, which does not allocate. */
+    [[nodiscard]] size_t hash() const;
+
+    /** Hash functor, allows this struct to be used as an std::unordered_map key. */
+    struct Hash
+    {
+        size_t operator()(MapTileKey const& k) const { return k.hash(); }
+    };
+
     /** Operator <, allows this struct to be used as an std::map key. */
     bool operator<(MapTileKey const& other) const;
 
@@ -72,6 +118,63 @@ struct MapTileKey
     bool operator!=(MapTileKey const& other) const;
 };
 
+/**
+ * Token which signals that nobody waits for a tile layer anymore, so that
+ * a data source may stop filling it early. A token is cancelled explicitly
+ * via cancel(), when its optional check function returns true, e.g.
+ * because the connection of the requesting client was closed, or once
+ * its optional deadline has passed. The token also carries the chunk
+ * sink of requesters which accept partial tiles.
+ */
+class CancellationToken
+{
+public:
+    using Ptr = std::shared_ptr<CancellationToken>;
+
+    CancellationToken() = default;
+    explicit CancellationToken(std::function<bool()> check);
+
+    /** Mark the token as cancelled. */
+    void cancel();
+
+    /** Check whether the token was cancelled. */
+    [[nodiscard]] bool isCancelled() const;
+
+    /**
+     * Let the token count as cancelled from the given time on, e.g. the
+     * deadline of the requests which wait for a tile. Nullopt removes
+     * the deadline. May be called while the token is in use.
+     */
+    void setDeadline(std::optional<std::chrono::steady_clock::time_point> deadline);
+
+    /** Get the deadline of the token, if it has one. */
+    [[nodiscard]] std::optional<std::chrono::steady_clock::time_point> deadline() const;
+
+    /**
+     * Callback which receives the chunks of a feature layer which is filled
+     * with this token, see TileFeatureLayer::sendChunk().
+     */
+    using ChunkSink = std::function<void(std::shared_ptr<TileLayer> const&)>;
+
+    /**
+     * Set the chunk sink, e.g. once a requester which accepts chunks waits
+     * for the tile. May be called while the token is in use.
+     */
+    void setChunkSink(ChunkSink sink);
+
+    /** Get the chunk sink, or null if no requester accepts chunks. */
+    [[nodiscard]] ChunkSink chunkSink() const;
+
+private:
+    static constexpr auto NoDeadline = std::chrono::steady_clock::duration::max().count();
+
+    std::atomic_bool cancelled_ = false;
+    std::atomic<std::chrono::steady_clock::rep> deadline_ = NoDeadline;  // Ticks since the clock's epoch
+    std::function<bool()> check_;
+    mutable std::mutex chunkSinkMutex_;  // Mutex for chunkSink_
+    ChunkSink chunkSink_;
+};
+
 /**
  * Tile Layer base class. Used by TileFeatureLayer class and other
  * tile-specific data containers.
@@ -154,6 +257,12 @@ public:
     [[nodiscard]] std::optional<std::chrono::milliseconds> ttl() const;
     void setTtl(const std::optional<std::chrono::milliseconds>& timeToLive);
 
+    /**
+     * When the ttl of this layer runs out, counted from its timestamp.
+     * Returns nullopt if the layer has no ttl.
+     */
+    [[nodiscard]] std::optional<std::chrono::time_point<std::chrono::system_clock>> expiresAt() const;
+
     /**
      * Getter and setter for 'mapVersion_' member variable.
      * It represents the map layer version that was used to serialize this layer.
@@ -169,10 +278,52 @@ public:
     [[nodiscard]] nlohmann::json info() const;
     void setInfo(std::string const& k, nlohmann::json const& v);
 
+    /**
+     * Get the bytes which this layer holds in memory, by column, and their
+     * `total`. The simfil nodes (`simfil-pool`) and the `string-pool` are
+     * counted with their serialized size. The string pool is shared with
+     * other layers, so it is not part of the total.
+     */
+    [[nodiscard]] nlohmann::json memoryUsage();
+
+    /** Store memoryUsage() in the info of this layer, as `memory-usage`. */
+    void recordMemoryUsage();
+
+    /**
+     * Get an HTTP entity tag of the layer: A quoted hash of its key, map
+     * version, error and content. The timestamp, ttl and info are left
+     * out, so a layer which is filled again with the same content keeps
+     * its tag.
+     */
+    [[nodiscard]] std::string eTag();
+
+    /**
+     * Getter and setter for 'cancellation_' member variable.
+     * Data sources may check isCancelled() while filling the layer,
+     * and stop early if it returns true. The token is not serialized.
+     */
+    [[nodiscard]] bool isCancelled() const;
+    [[nodiscard]] CancellationToken::Ptr cancellation() const;
+    void setCancellation(CancellationToken::Ptr token);
+
+    /**
+     * Mark the layer as read-only, e.g. because it is shared by a cache.
+     * Afterwards, all setters and other modifying calls throw. A layer
+     * cannot become writable again.
+     */
+    void setReadOnly();
+    [[nodiscard]] bool isReadOnly() const;
+
     /** Serialization */
     virtual void write(std::ostream& outputStream);
     virtual nlohmann::json toJson() const;
 
+    /**
+     * Append the JSON of the layer to a buffer. Layers which can write
+     * their JSON directly override this, by default toJson() is printed.
+     */
+    virtual void writeJson(std::string& out, JsonLayout layout = JsonLayout::Model) const;
+
 protected:
     Version mapVersion_{0, 0, 0};
     TileId tileId_;
@@ -183,6 +334,20 @@ protected:
     std::chrono::time_point<std::chrono::system_clock> timestamp_;
     std::optional<std::chrono::milliseconds> ttl_;
     nlohmann::json info_;
+    CancellationToken::Ptr cancellation_;
+    bool readOnly_ = false;
+
+    /** Throws if the layer was marked as read-only. */
+    void checkWritable() const;
+
+    /** Add the bytes of the columns of a derived layer to memoryUsage(). */
+    virtual void addMemoryUsage(nlohmann::json& usage);
+
+    /** Count the bytes which the given function writes to a stream. */
+    static uint64_t serializedSize(std::function<void(std::ostream&)> const& write);
+
+    /** Write the content of a derived layer, which eTag() hashes. */
+    virtual void writeContent(std::ostream& outputStream);
 };
 
 }
@@ -4,6 +4,10 @@
 #include "simfil/typed-meta-type.h"
 #include "point.h"
 
+#include <cstdint>
+#include <span>
+#include <vector>
+
 using simfil::Result;
 using simfil::FnInfo;
 using simfil::Context;
@@ -71,6 +75,13 @@ struct Polygon
     auto contains(const Point&) const -> bool;
     auto contains(const LineString&) const -> bool;
 
+    /**
+     * Test many points against the polygon in one call. The points are
+     * tested as coordinate arrays, edge by edge, in a vectorized loop.
+     * Returns a flag per point, which is 1 if the polygon contains it.
+     */
+    auto contains(std::span<const Point> points) const -> std::vector<uint8_t>;
+
     auto intersects(const BBox&) const -> bool;
     auto intersects(const LineString&) const -> bool;
     auto intersects(const Polygon&) const -> bool;
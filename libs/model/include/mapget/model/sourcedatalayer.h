@@ -1,12 +1,14 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include "simfil/model/model.h"
 #include "simfil/environment.h"
 #include "simfil/model/nodes.h"
 
 #include "layer.h"
+#include "sourceinfo.h"
 
 namespace mapget
 {
@@ -77,12 +79,37 @@ public:
     void setSourceDataAddressFormat(SourceDataAddressFormat f);
     SourceDataAddressFormat sourceDataAddressFormat() const;
 
+    /**
+     * Get the compounds which make up the source data of an address, e.g.
+     * of a SourceDataReferenceItem: The outermost compounds whose bit range
+     * lies within the address range, or the smallest compound which contains
+     * the address range, if there are none. With the Unknown address format,
+     * the compounds with exactly the given address are returned. A read-only
+     * layer keeps an index over the compound addresses, which is built
+     * on the first call. For writable layers, it is built for each call.
+     */
+    std::vector<model_ptr<SourceDataCompoundNode>> compoundsForAddress(SourceDataAddress address) const;
+
+    /**
+     * Get a copy of this layer which only holds the compounds for the given
+     * addresses as its roots, see compoundsForAddress(), e.g. for a client
+     * which inspects the source data of single features. The copy shares
+     * the string pool of this layer.
+     */
+    Ptr extract(std::vector<SourceDataAddress> const& addresses) const;
+
 private:
     /**
      * Generic node resolution overload.
      */
     void resolve(const simfil::ModelNode &n, const ResolveFn &cb) const override;
 
+    void addMemoryUsage(nlohmann::json& usage) override;
+    void writeContent(std::ostream& outputStream) override;
+
+    // Copy a node of another layer into this layer, with its children.
+    simfil::ModelNode::Ptr cloneNode(TileSourceDataLayer const& otherLayer, simfil::ModelNode::Ptr const& otherNode);
+
     struct Impl;
     std::unique_ptr<Impl> impl_;
 };
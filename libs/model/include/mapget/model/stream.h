@@ -3,13 +3,19 @@
 #include "layer.h"
 #include "stringpool.h"
 
+#include <condition_variable>
+#include <exception>
+#include <functional>
 #include <map>
+#include <mutex>
 #include <sstream>
 #include <shared_mutex>
 
 namespace mapget
 {
 
+class TileFeatureLayer;
+
 /**
  * Protocol for binary streaming of TileLayer and associated
  * StringPool dictionary objects. The general stream encoding is a simple
@@ -29,17 +35,44 @@ public:
         StringPool = 1,
         TileFeatureLayer = 2,
         TileSourceDataLayer = 3,
+        TileBinaryLayer = 4,
         EndOfStream = 128
     };
 
     struct StringPoolCache;
 
     /** Protocol Version which parsed blobs must be compatible with. */
-    static constexpr Version CurrentProtocolVersion{0, 1, 1};
+    static constexpr Version CurrentProtocolVersion{0, 3, 0};
+
+    /**
+     * Oldest protocol version which is still read, and written for
+     * clients which announce it, see Writer::setProtocolVersion().
+     */
+    static constexpr Version MinimumProtocolVersion{0, 2, 0};
+
+    /** Protocol version which introduced the compact geometry encoding. */
+    static constexpr Version CompactGeometryProtocolVersion{0, 3, 0};
+
+    /** Whether messages of the given protocol version can be read. */
+    static bool isSupportedProtocolVersion(Version const& version);
 
     /** Map to keep track of the highest sent string id per datasource node. */
     using StringPoolOffsetMap = std::unordered_map<std::string, simfil::StringId>;
 
+    /** Fields at the start of a serialized TileLayer, see Reader::readTileLayerHeader. */
+    struct TileLayerHeader
+    {
+        std::string mapId_;
+        std::string layerId_;
+        TileId tileId_;
+        std::string nodeId_;
+        std::chrono::time_point<std::chrono::system_clock> timestamp_;
+        std::optional<std::chrono::milliseconds> ttl_;
+
+        /** When the ttl of the layer runs out, see TileLayer::expiresAt(). */
+        [[nodiscard]] std::optional<std::chrono::time_point<std::chrono::system_clock>> expiresAt() const;
+    };
+
     /** The Reader turns bytes into TileLayer objects. */
     struct Reader
     {
@@ -60,9 +93,62 @@ public:
          */
         void read(std::string_view const& bytes);
 
-        /** end-of-stream: Returns true if the internal buffer is exhausted. */
+        /**
+         * Add some bytes to parse, which are shared, e.g. a cached tile blob.
+         * Binary layers which are parsed from them refer to their payload
+         * in the shared bytes instead of copying it, see TileBinaryLayer.
+         */
+        void read(std::shared_ptr<const std::string> const& bytes);
+
+        /** Waits for the layers which are decoded in parallel, see setParallelDecoding(). */
+        ~Reader();
+
+        /** Callback which runs a task, e.g. on a thread pool. */
+        using ScheduleFun = std::function<void(std::function<void()>)>;
+
+        /**
+         * Decode tile layer messages in tasks which are passed to the given
+         * scheduler, instead of on the thread which calls read(). String pool
+         * messages are still applied by read(), in the order of the stream,
+         * so a layer only refers to strings which were received before it.
+         * If orderedResults is true, onParsedLayer is called in the order of
+         * the messages, otherwise as soon as a layer is decoded. Either way,
+         * onParsedLayer is never called concurrently. The scheduler must run
+         * every task, as wait() and the destructor wait for all of them.
+         * Must be called before the first read().
+         */
+        void setParallelDecoding(ScheduleFun schedule, bool orderedResults = true);
+
+        /** Get the layer of a tile which the client holds, or null. */
+        using DeltaBaseFun = std::function<std::shared_ptr<TileFeatureLayer>(MapTileKey const&)>;
+
+        /**
+         * Apply received deltas, see TileFeatureLayer::delta(), to the layers
+         * which are returned by the given function, so that onParsedLayer
+         * gets the updated layers. Deltas whose base is not returned are
+         * passed on as they are. The function is called concurrently if
+         * the layers are decoded in parallel.
+         */
+        void setDeltaBases(DeltaBaseFun deltaBases);
+
+        /**
+         * Wait until all scheduled layers are decoded and passed to
+         * onParsedLayer. Rethrows the first error of a decoding task.
+         */
+        void wait();
+
+        /**
+         * end-of-stream: Returns true if the internal buffer is exhausted,
+         * and no message was started, i.e. its header was not read yet.
+         */
         [[nodiscard]] bool eos();
 
+        /** Capacity above which the buffer is freed once all of its bytes are parsed. */
+        static constexpr size_t MaxRetainedBufferBytes = 4 * 1024 * 1024;
+
+        /** Capacity of the buffer of incomplete messages, see MaxRetainedBufferBytes. */
+        [[nodiscard]] size_t bufferCapacity() const;
+
         /** Obtain the string pool cache used by this Reader. */
         std::shared_ptr<StringPoolCache> stringPoolCache();
 
@@ -73,23 +159,72 @@ public:
          */
         static bool readMessageHeader(std::stringstream& stream, MessageType& outType, uint32_t& outSize);
 
+        /**
+         * Read the header fields of a serialized TileLayer message,
+         * without parsing the layer. Throws if the message is malformed,
+         * or if its protocol version is not supported.
+         */
+        static TileLayerHeader readTileLayerHeader(std::string const& message);
+
     private:
         enum class Phase { ReadHeader, ReadValue };
 
+        // Read a message header, of which the stream must have all bytes.
+        static void parseMessageHeader(std::istream& stream, MessageType& outType, uint32_t& outSize);
+
         Phase currentPhase_ = Phase::ReadHeader;
         MessageType nextValueType_ = MessageType::None;
         uint32_t nextValueSize_ = 0;
 
         /**
-         * Reads messages from the current available data.
+         * Reads the next message from the given bytes, starting at the offset,
+         * and advances the offset past the consumed bytes.
          * @return True if it can continue and should be called again, false otherwise.
          */
-        bool continueReading();
+        bool continueReading(std::string_view const& bytes, size_t& offset);
+
+        // Parse a tile layer message body of the given type, which lies within the shared bytes, if any.
+        TileLayer::Ptr parseLayer(
+            MessageType type,
+            std::string_view const& message,
+            std::shared_ptr<const std::string> const& sharedBytes = nullptr);
+        // Decode a tile layer message of shared bytes in a scheduled task.
+        void decodeInParallel(
+            MessageType type,
+            std::shared_ptr<const std::string> sharedBytes,
+            std::string_view const& message,
+            uint64_t sequenceNumber);
+        // Pass a decoded layer (or null after an error) to onParsedLayer, in order if requested.
+        void deliverDecodedLayer(uint64_t sequenceNumber, TileLayer::Ptr layer);
+
+        /**
+         * Received bytes of an incomplete message, of which the ones from
+         * readOffset_ on are not parsed yet. Messages are parsed in place.
+         * The parsed bytes are released before new bytes are appended.
+         */
+        std::string buffer_;
+        size_t readOffset_ = 0;
+
+        // Shared bytes whose messages are being parsed in place, see read().
+        std::shared_ptr<const std::string> sharedBytes_;
 
-        std::stringstream buffer_;
         LayerInfoResolveFun layerInfoProvider_;
         std::shared_ptr<StringPoolCache> stringPoolProvider_;
         std::function<void(TileLayer::Ptr)> onParsedLayer_;
+        DeltaBaseFun deltaBases_;
+
+        // State of the parallel decoding, see setParallelDecoding().
+        ScheduleFun scheduleDecoding_;
+        bool orderedResults_ = true;
+        std::mutex decodingMutex_;
+        std::condition_variable decodingDone_;
+        size_t numPendingDecodings_ = 0;
+        uint64_t nextSequenceNumber_ = 0;
+        uint64_t nextDeliveredSequenceNumber_ = 0;
+        // Decoded layers which wait for their predecessors, if orderedResults_ is set.
+        std::map<uint64_t, TileLayer::Ptr> decodedLayers_;
+        bool deliveringLayers_ = false;
+        std::exception_ptr decodingError_;
     };
 
     /**
@@ -114,16 +249,78 @@ public:
             StringPoolOffsetMap& stringPoolOffsets,
             bool differentialStringUpdates = true);
 
+        /**
+         * Callback for a serialized message, as its header and its body.
+         * The slices are only valid during the call, as the Writer reuses
+         * its buffer for the next message.
+         */
+        using MessageSlicesFun = std::function<void(std::string_view header, std::string_view body, MessageType)>;
+
+        /**
+         * Construct a Writer which passes each message as slices, see
+         * MessageSlicesFun, so that the caller can copy them straight into
+         * its own buffer. The other Writer constructor joins the slices into
+         * a new string per message.
+         */
+        Writer(
+            MessageSlicesFun onMessageSlices,
+            StringPoolOffsetMap& stringPoolOffsets,
+            bool differentialStringUpdates = true);
+
         /** Serialize a tile layer and the required part of a StringPool. */
         void write(TileLayer::Ptr const& tileLayer);
 
+        /**
+         * Serialize only the part of a StringPool which was not sent yet.
+         * Together with writeLayer(), this allows to send string pools
+         * and tile layers separately, e.g. under different locks.
+         */
+        void writeStringPool(std::string const& nodeId, simfil::StringPool const& strings);
+
+        /**
+         * Serialize a tile layer without its StringPool. The offsets
+         * map of the Writer is not used.
+         */
+        void writeLayer(TileLayer::Ptr const& tileLayer);
+
+        /**
+         * Send a serialized TileLayer message as is, e.g. one from a cache,
+         * after the part of its StringPool which was not sent yet. Only the
+         * protocol version in its header is replaced, so the message must
+         * have the raw geometry encoding, as a Writer writes by default.
+         */
+        void write(std::string const& tileLayerMessage, StringPool const& strings);
+
+        /**
+         * Whether write(tileLayerMessage, strings) sends the message with its
+         * own bytes, as it has the protocol version of this Writer. Then, a
+         * caller may send the message itself, after writeStringPool(), so
+         * that a large message, e.g. a binary layer, is not copied.
+         */
+        [[nodiscard]] bool sendsUnchanged(std::string const& tileLayerMessage) const;
+
         /** Send an EndOfStream message. */
         void sendEndOfStream();
 
+        /**
+         * Write the messages for a reader of the given protocol version,
+         * e.g. one which a client announced. Readers which support the
+         * CompactGeometryProtocolVersion get feature layers with the
+         * QuantizedDelta geometry encoding, older ones get raw geometry,
+         * and messages which are stamped with the MinimumProtocolVersion.
+         * Throws if the version is not supported.
+         */
+        void setProtocolVersion(Version const& version);
+
     private:
-        void sendMessage(std::string&& bytes, MessageType msgType);
+        void sendStringPoolUpdate(std::string const& nodeId, simfil::StringPool const& strings);
+        void sendMessage(std::string_view const& bytes, MessageType msgType);
 
-        std::function<void(std::string, MessageType)> onMessage_;
+        MessageSlicesFun onMessageSlices_;
+        Version protocolVersion_ = CurrentProtocolVersion;
+        bool compactGeometry_ = false;
+        // Body of the message which is being sent, reused for all messages.
+        std::string serializationBuffer_;
         StringPoolOffsetMap& stringPoolOffsets_;
         bool differentialStringUpdates_ = true;
     };
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <vector>
 
 #include "point.h"
 
@@ -23,6 +24,25 @@ namespace mapget
  */
 struct TileId
 {
+    /**
+     * Order of the tiles which are enumerated by tilesInBBox() and
+     * tilesInPolygon(). Tiles which are close to each other in Hilbert or
+     * Morton order are also close on the map, so that batches of tiles
+     * are filled and read with good locality.
+     */
+    enum class Order : uint8_t
+    {
+        /** Ascending columns, and ascending rows within a column. */
+        ColumnMajor,
+        /** Z-order curve, see mortonIndex(). */
+        Morton,
+        /** Hilbert curve, see hilbertIndex(). */
+        Hilbert,
+    };
+
+    /** Highest zoom level whose columns fit into the 16 bits of x. */
+    static constexpr uint16_t MaxZoomLevel = 15;
+
     /**
      * Constructor to initialize TileId with x, y, z
      */
@@ -48,6 +68,44 @@ struct TileId
      */
     [[nodiscard]] TileId neighbor(int32_t offsetX, int32_t offsetY) const;
 
+    /**
+     * Get the ids of all tiles at the given zoom level which overlap the WGS84
+     * bounding box between the given corners, in the given order. The order
+     * of the corners does not matter. Boxes do not wrap at the antimeridian.
+     * Raises if the zoom level is above MaxZoomLevel.
+     */
+    static std::vector<TileId> tilesInBBox(Point const& corner, Point const& otherCorner, uint16_t zoomLevel, Order order = Order::Hilbert);
+
+    /**
+     * Get the number of tiles which tilesInBBox() returns, without enumerating
+     * them. Raises if the zoom level is above MaxZoomLevel.
+     */
+    static uint64_t numTilesInBBox(Point const& corner, Point const& otherCorner, uint16_t zoomLevel);
+
+    /**
+     * Get the ids of all tiles at the given zoom level which overlap the WGS84
+     * polygon with the given outer ring, in the given order. The ring may be
+     * open or closed.
+     */
+    static std::vector<TileId> tilesInPolygon(std::vector<Point> const& ring, uint16_t zoomLevel, Order order = Order::Hilbert);
+
+    /**
+     * Sort tile ids in the given order. Tiles are grouped by zoom level first.
+     */
+    static void sort(std::vector<TileId>& tileIds, Order order);
+
+    /**
+     * Get the position of this tile on the Z-order curve through
+     * all tiles of its zoom level, which interleaves the bits of x and y.
+     */
+    [[nodiscard]] uint64_t mortonIndex() const;
+
+    /**
+     * Get the position of this tile on the Hilbert curve through
+     * all tiles of its zoom level.
+     */
+    [[nodiscard]] uint64_t hilbertIndex() const;
+
     /**
      * Get the center of the tile in Wgs84.
      */
@@ -3,6 +3,8 @@
 #include "geometry.h"
 #include "sourcedatareference.h"
 
+#include <unordered_map>
+
 namespace mapget
 {
 
@@ -17,6 +19,7 @@ class Validity : public simfil::ProceduralObject<6, Validity, TileFeatureLayer>
     template <typename>
     friend struct simfil::model_ptr;
     friend class PointNode;
+    friend struct MultiValidity;
 
 public:
     /**
@@ -112,6 +115,15 @@ public:
      SelfContainedGeometry computeGeometry(model_ptr<GeometryCollection> geometryCollection, std::string* error=nullptr) const;
 
 protected:
+    /** Cumulative lengths of the geometries which a batch of validities refers to, by geometry index. */
+    using LineLengths = std::unordered_map<uint32_t, std::shared_ptr<const std::vector<double>>>;
+
+    /** computeGeometry() which shares the length tables among a batch of validities. */
+    SelfContainedGeometry computeGeometry(
+        model_ptr<GeometryCollection> geometryCollection,
+        std::string* error,
+        LineLengths& lineLengths) const;
+
     /** Actual per-validity data that is stored in the model's attributes-column. */
     struct Data
     {
@@ -276,6 +288,16 @@ struct MultiValidity : public simfil::BaseArray<TileFeatureLayer, Validity>
      */
     model_ptr<Validity> newDirection(Validity::Direction direction = Validity::Empty);
 
+    /**
+     * Compute the geometries of all validities, see Validity::computeGeometry().
+     * The cumulative lengths of each referenced geometry are only computed once
+     * for all length offset validities which refer to it. If an error string is
+     * passed, it is set to the last error.
+     */
+    std::vector<SelfContainedGeometry> computeGeometries(
+        model_ptr<GeometryCollection> const& geometryCollection,
+        std::string* error = nullptr) const;
+
 private:
     using simfil::BaseArray<TileFeatureLayer, Validity>::BaseArray;
 };
@@ -0,0 +1,177 @@
+#include "binarylayer.h"
+#include "mapget/log.h"
+
+#include <bitsery/bitsery.h>
+#include <bitsery/adapter/stream.h>
+#include <bitsery/traits/string.h>
+
+#include <istream>
+#include <limits>
+#include <ostream>
+
+namespace mapget
+{
+
+namespace
+{
+
+/** Encode bytes as base64, with padding. */
+std::string toBase64(std::string_view const& bytes)
+{
+    static constexpr char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string result;
+    result.reserve((bytes.size() + 2) / 3 * 4);
+    size_t i = 0;
+    for (; i + 2 < bytes.size(); i += 3) {
+        auto triple = (static_cast<uint32_t>(static_cast<uint8_t>(bytes[i])) << 16) |
+            (static_cast<uint32_t>(static_cast<uint8_t>(bytes[i + 1])) << 8) |
+            static_cast<uint32_t>(static_cast<uint8_t>(bytes[i + 2]));
+        result.push_back(alphabet[(triple >> 18) & 0x3f]);
+        result.push_back(alphabet[(triple >> 12) & 0x3f]);
+        result.push_back(alphabet[(triple >> 6) & 0x3f]);
+        result.push_back(alphabet[triple & 0x3f]);
+    }
+    if (auto rest = bytes.size() - i; rest > 0) {
+        auto triple = static_cast<uint32_t>(static_cast<uint8_t>(bytes[i])) << 16;
+        if (rest > 1)
+            triple |= static_cast<uint32_t>(static_cast<uint8_t>(bytes[i + 1])) << 8;
+        result.push_back(alphabet[(triple >> 18) & 0x3f]);
+        result.push_back(alphabet[(triple >> 12) & 0x3f]);
+        result.push_back(rest > 1 ? alphabet[(triple >> 6) & 0x3f] : '=');
+        result.push_back('=');
+    }
+    return result;
+}
+
+}  // namespace
+
+TileBinaryLayer::TileBinaryLayer(
+    TileId tileId,
+    std::string const& nodeId,
+    std::string const& mapId,
+    std::shared_ptr<LayerInfo> const& layerInfo)
+    : TileLayer(tileId, nodeId, mapId, layerInfo)
+{
+}
+
+TileBinaryLayer::TileBinaryLayer(std::istream& inputStream, LayerInfoResolveFun const& layerInfoResolveFun)
+    : TileLayer(inputStream, layerInfoResolveFun)
+{
+    auto payloadSize = readFields(inputStream);
+    std::string payload(payloadSize, '\0');
+    inputStream.read(payload.data(), static_cast<std::streamsize>(payloadSize));
+    if (static_cast<uint64_t>(inputStream.gcount()) != payloadSize)
+        raiseFmt("Binary tile layer {} has a truncated payload.", id().toString());
+    setPayload(std::move(payload));
+}
+
+TileBinaryLayer::TileBinaryLayer(
+    std::istream& inputStream,
+    LayerInfoResolveFun const& layerInfoResolveFun,
+    SharedBytes buffer,
+    std::string_view const& message)
+    : TileLayer(inputStream, layerInfoResolveFun)
+{
+    auto payloadSize = readFields(inputStream);
+    if (payloadSize > message.size())
+        raiseFmt("Binary tile layer {} has a truncated payload.", id().toString());
+    setPayload(std::move(buffer), message.substr(message.size() - payloadSize));
+}
+
+uint64_t TileBinaryLayer::readFields(std::istream& inputStream)
+{
+    bitsery::Deserializer<bitsery::InputStreamAdapter> s(inputStream);
+    s.text1b(contentType_, std::numeric_limits<uint32_t>::max());
+    std::string metadataJsonString;
+    s.text1b(metadataJsonString, std::numeric_limits<uint32_t>::max());
+    metadata_ = nlohmann::json::parse(metadataJsonString);
+    uint64_t payloadSize = 0;
+    s.value8b(payloadSize);
+    if (s.adapter().error() != bitsery::ReaderError::NoError)
+        raiseFmt("Failed to read the fields of binary tile layer {}.", id().toString());
+    return payloadSize;
+}
+
+std::string const& TileBinaryLayer::contentType() const
+{
+    return contentType_;
+}
+
+void TileBinaryLayer::setContentType(std::string const& contentType)
+{
+    checkWritable();
+    contentType_ = contentType;
+}
+
+nlohmann::json const& TileBinaryLayer::metadata() const
+{
+    return metadata_;
+}
+
+void TileBinaryLayer::setMetadata(nlohmann::json const& metadata)
+{
+    checkWritable();
+    metadata_ = metadata;
+}
+
+std::string_view TileBinaryLayer::payload() const
+{
+    return payload_;
+}
+
+void TileBinaryLayer::setPayload(std::string bytes)
+{
+    auto buffer = std::make_shared<const std::string>(std::move(bytes));
+    setPayload(buffer, *buffer);
+}
+
+void TileBinaryLayer::setPayload(SharedBytes buffer, std::string_view const& slice)
+{
+    checkWritable();
+    if (!slice.empty() &&
+        (!buffer || slice.data() < buffer->data() || slice.data() + slice.size() > buffer->data() + buffer->size()))
+        raiseFmt("The payload of binary tile layer {} is not a slice of its buffer.", id().toString());
+    payloadBuffer_ = std::move(buffer);
+    payload_ = slice;
+}
+
+void TileBinaryLayer::write(std::ostream& outputStream)
+{
+    TileLayer::write(outputStream);
+    {
+        bitsery::Serializer<bitsery::OutputStreamAdapter> s(outputStream);
+        s.text1b(contentType_, std::numeric_limits<uint32_t>::max());
+        s.text1b(metadata_.dump(), std::numeric_limits<uint32_t>::max());
+        s.value8b(static_cast<uint64_t>(payload_.size()));
+    }
+    // The payload ends the message, so that a reader can refer to it in place.
+    outputStream.write(payload_.data(), static_cast<std::streamsize>(payload_.size()));
+}
+
+nlohmann::json TileBinaryLayer::toJson() const
+{
+    return nlohmann::json::object({
+        {"type", "BinaryLayer"},
+        {"contentType", contentType_},
+        {"metadata", metadata_},
+        {"payload", toBase64(payload_)},
+    });
+}
+
+void TileBinaryLayer::addMemoryUsage(nlohmann::json& usage)
+{
+    usage["metadata"] = metadata_.dump().size() + contentType_.size();
+    usage["payload"] = payload_.size();
+}
+
+void TileBinaryLayer::writeContent(std::ostream& outputStream)
+{
+    {
+        bitsery::Serializer<bitsery::OutputStreamAdapter> s(outputStream);
+        s.text1b(contentType_, std::numeric_limits<uint32_t>::max());
+        s.text1b(metadata_.dump(), std::numeric_limits<uint32_t>::max());
+    }
+    outputStream.write(payload_.data(), static_cast<std::streamsize>(payload_.size()));
+}
+
+}  // namespace mapget
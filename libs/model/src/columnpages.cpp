@@ -0,0 +1,225 @@
+#include "columnpages.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+namespace mapget
+{
+
+namespace
+{
+
+// Pages start with a header, which must keep the alignment of the page.
+constexpr size_t PageHeaderSize = alignof(std::max_align_t);
+
+std::atomic<size_t> maxPooledBytes_ = ColumnPagePool::DefaultMaxPooledBytes;
+std::atomic<int64_t> pooledPages_ = 0;
+std::atomic<int64_t> pooledBytes_ = 0;
+std::atomic<int64_t> newPages_ = 0;
+std::atomic<int64_t> reusedPages_ = 0;
+std::atomic<int64_t> remotePages_ = 0;
+std::atomic<int64_t> freedPages_ = 0;
+
+bool isPooled(size_t bytes, size_t alignment)
+{
+    return bytes >= ColumnPagePool::MinPageBytes && alignment <= PageHeaderSize;
+}
+
+/**
+ * Pool of a thread. It lives as long as its thread, or as long as pages
+ * which were allocated from it are in use, whichever is longer.
+ */
+struct Pool
+{
+    std::mutex mutex_;  // Mutex for the members below
+    std::unordered_map<size_t, std::vector<void*>> freePages_;  // By page size
+    size_t bytes_ = 0;
+    bool isOrphaned_ = false;  // Whether the thread of the pool exited
+
+    // One reference for the thread, and one for each page in use.
+    std::atomic<size_t> references_ = 1;
+
+    void unreference(size_t count)
+    {
+        if (references_.fetch_sub(count, std::memory_order_acq_rel) == count)
+            delete this;
+    }
+
+    // Take back pages, with their sizes. The pages which do not fit are freed.
+    void giveBack(std::vector<std::pair<void*, size_t>> const& pages, bool isRemote)
+    {
+        std::vector<void*> pagesToFree;
+        {
+            std::unique_lock lock(mutex_);
+            auto maxBytes = maxPooledBytes_.load();
+            for (auto const& [page, bytes] : pages) {
+                if (isOrphaned_ || bytes_ + bytes > maxBytes) {
+                    pagesToFree.emplace_back(page);
+                    continue;
+                }
+                freePages_[bytes].emplace_back(page);
+                bytes_ += bytes;
+                ++pooledPages_;
+                pooledBytes_ += static_cast<int64_t>(bytes);
+            }
+        }
+        for (auto page : pagesToFree)
+            ::operator delete(page);
+        freedPages_ += static_cast<int64_t>(pagesToFree.size());
+        if (isRemote)
+            remotePages_ += static_cast<int64_t>(pages.size());
+        unreference(pages.size());
+    }
+};
+
+struct PageHeader
+{
+    Pool* pool_ = nullptr;
+};
+
+/** Owner of the pool of the calling thread, which orphans the pool when the thread exits. */
+struct ThreadPool
+{
+    Pool* pool_ = nullptr;
+
+    ~ThreadPool();
+};
+
+thread_local ThreadPool threadPool;
+
+// Pages which are returned by the current BatchRelease of the thread, by pool.
+thread_local std::vector<std::pair<Pool*, std::pair<void*, size_t>>>* batchedPages = nullptr;
+
+}  // namespace
+
+void* ColumnPagePool::allocate(size_t bytes, size_t alignment)
+{
+    if (!isPooled(bytes, alignment))
+        return ::operator new(bytes);
+    if (!threadPool.pool_)
+        threadPool.pool_ = new Pool;
+    auto* pool = threadPool.pool_;
+
+    void* page = nullptr;
+    {
+        std::unique_lock lock(pool->mutex_);
+        if (auto it = pool->freePages_.find(bytes); it != pool->freePages_.end() && !it->second.empty()) {
+            page = it->second.back();
+            it->second.pop_back();
+            pool->bytes_ -= bytes;
+        }
+    }
+    if (page) {
+        ++reusedPages_;
+        --pooledPages_;
+        pooledBytes_ -= static_cast<int64_t>(bytes);
+    }
+    else {
+        page = ::operator new(bytes + PageHeaderSize);
+        ++newPages_;
+    }
+
+    pool->references_.fetch_add(1, std::memory_order_relaxed);
+    new (page) PageHeader{pool};
+    return static_cast<char*>(page) + PageHeaderSize;
+}
+
+void ColumnPagePool::deallocate(void* page, size_t bytes, size_t alignment) noexcept
+{
+    if (!page)
+        return;
+    if (!isPooled(bytes, alignment)) {
+        ::operator delete(page);
+        return;
+    }
+    auto* start = static_cast<char*>(page) - PageHeaderSize;
+    auto* pool = reinterpret_cast<PageHeader*>(start)->pool_;
+    try {
+        if (batchedPages) {
+            batchedPages->emplace_back(pool, std::pair<void*, size_t>{start, bytes});
+            return;
+        }
+        pool->giveBack({{start, bytes}}, pool != threadPool.pool_);
+    }
+    catch (...) {
+        // Without memory for the bookkeeping, the page goes back to the heap.
+        ::operator delete(start);
+        ++freedPages_;
+        pool->unreference(1);
+    }
+}
+
+size_t ColumnPagePool::maxPooledBytes()
+{
+    return maxPooledBytes_;
+}
+
+void ColumnPagePool::setMaxPooledBytes(size_t bytes)
+{
+    maxPooledBytes_ = bytes;
+}
+
+ColumnPagePool::BatchRelease::BatchRelease()
+{
+    if (batchedPages)
+        return;
+    batchedPages = new std::remove_pointer_t<decltype(batchedPages)>;
+    isOutermost_ = true;
+}
+
+ColumnPagePool::BatchRelease::~BatchRelease()
+{
+    if (!isOutermost_)
+        return;
+    std::unique_ptr<std::remove_pointer_t<decltype(batchedPages)>> pages(batchedPages);
+    batchedPages = nullptr;
+
+    // The pages of each pool are returned with one call.
+    std::stable_sort(pages->begin(), pages->end(), [](auto const& l, auto const& r) { return l.first < r.first; });
+    std::vector<std::pair<void*, size_t>> poolPages;
+    for (auto it = pages->begin(); it != pages->end();) {
+        auto* pool = it->first;
+        poolPages.clear();
+        for (; it != pages->end() && it->first == pool; ++it)
+            poolPages.emplace_back(it->second);
+        pool->giveBack(poolPages, pool != threadPool.pool_);
+    }
+}
+
+nlohmann::json ColumnPagePool::getStatistics()
+{
+    return {
+        {"pooled-pages", pooledPages_.load()},
+        {"pooled-bytes", pooledBytes_.load()},
+        {"new-pages", newPages_.load()},
+        {"reused-pages", reusedPages_.load()},
+        {"remote-pages", remotePages_.load()},
+        {"freed-pages", freedPages_.load()}};
+}
+
+ThreadPool::~ThreadPool()
+{
+    if (!pool_)
+        return;
+    std::vector<void*> pagesToFree;
+    {
+        std::unique_lock lock(pool_->mutex_);
+        for (auto& [bytes, pages] : pool_->freePages_) {
+            pagesToFree.insert(pagesToFree.end(), pages.begin(), pages.end());
+            pooledPages_ -= static_cast<int64_t>(pages.size());
+            pooledBytes_ -= static_cast<int64_t>(bytes * pages.size());
+        }
+        pool_->freePages_.clear();
+        pool_->bytes_ = 0;
+        pool_->isOrphaned_ = true;
+    }
+    for (auto page : pagesToFree)
+        ::operator delete(page);
+    pool_->unreference(1);
+}
+
+}  // namespace mapget
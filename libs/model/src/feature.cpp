@@ -312,6 +312,28 @@ SelfContainedGeometry Feature::firstGeometry() const
     return {};
 }
 
+std::optional<BBox> Feature::bbox() const
+{
+    std::optional<BBox> result;
+    if (auto geometryCollection = geomOrNull()) {
+        geometryCollection->forEachGeometry(
+            [&result](auto&& geometry)
+            {
+                auto box = geometry->bbox();
+                if (!box)
+                    return true;
+                if (!result) {
+                    result = box;
+                    return true;
+                }
+                result->p1 = glm::min(result->p1, box->p1);
+                result->p2 = glm::max(result->p2, box->p2);
+                return true;
+            });
+    }
+    return result;
+}
+
 std::optional<std::vector<model_ptr<Relation>>>
 Feature::filterRelations(const std::string_view& name) const
 {
@@ -1,16 +1,34 @@
 #include "featurelayer.h"
+#include "columnpages.h"
+#include "jsonwriter.h"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
 #include <cstdint>
+#include <cstdlib>
 #include <initializer_list>
 #include <iterator>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <regex>
 #include <sstream>
 #include <stdexcept>
 #include <string_view>
 #include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <variant>
+#include <vector>
 
 #include <bitsery/bitsery.h>
+#include <bitsery/adapter/buffer.h>
 #include <bitsery/adapter/stream.h>
+#include <bitsery/ext/compact_value.h>
+#include <bitsery/traits/core/std_defaults.h>
 #include <bitsery/traits/string.h>
 #include "sfl/segmented_vector.hpp"
 
@@ -40,6 +58,17 @@ void serialize(S& s, mapget::Point& v) {
     s.value8b(v.z);
 }
 
+namespace traits
+{
+
+template <typename T, std::size_t N>
+struct ContainerTraits<sfl::segmented_vector<T, N, mapget::ColumnAllocator<T>>>
+    : public StdContainer<sfl::segmented_vector<T, N, mapget::ColumnAllocator<T>>, true, false>
+{
+};
+
+}
+
 }
 
 namespace
@@ -74,24 +103,28 @@ namespace
 namespace mapget
 {
 
+/** Column of a tile, with pages from the ColumnPagePool of the building worker thread. */
+template <typename T, std::size_t N>
+using PooledColumn = sfl::segmented_vector<T, N, ColumnAllocator<T>>;
+
 struct TileFeatureLayer::Impl {
     simfil::ModelNodeAddress featureIdPrefix_;
 
-    sfl::segmented_vector<Feature::Data, simfil::detail::ColumnPageSize/4> features_;
-    sfl::segmented_vector<Attribute::Data, simfil::detail::ColumnPageSize> attributes_;
-    sfl::segmented_vector<Validity::Data, simfil::detail::ColumnPageSize> validities_;
-    sfl::segmented_vector<FeatureId::Data, simfil::detail::ColumnPageSize/2> featureIds_;
-    sfl::segmented_vector<simfil::ArrayIndex, simfil::detail::ColumnPageSize/2> attrLayers_;
-    sfl::segmented_vector<simfil::ArrayIndex, simfil::detail::ColumnPageSize/2> attrLayerLists_;
-    sfl::segmented_vector<Relation::Data, simfil::detail::ColumnPageSize/2> relations_;
-    sfl::segmented_vector<Geometry::Data, simfil::detail::ColumnPageSize/2> geom_;
-    sfl::segmented_vector<QualifiedSourceDataReference, simfil::detail::ColumnPageSize/2> sourceDataReferences_;
+    PooledColumn<Feature::Data, simfil::detail::ColumnPageSize/4> features_;
+    PooledColumn<Attribute::Data, simfil::detail::ColumnPageSize> attributes_;
+    PooledColumn<Validity::Data, simfil::detail::ColumnPageSize> validities_;
+    PooledColumn<FeatureId::Data, simfil::detail::ColumnPageSize/2> featureIds_;
+    PooledColumn<simfil::ArrayIndex, simfil::detail::ColumnPageSize/2> attrLayers_;
+    PooledColumn<simfil::ArrayIndex, simfil::detail::ColumnPageSize/2> attrLayerLists_;
+    PooledColumn<Relation::Data, simfil::detail::ColumnPageSize/2> relations_;
+    PooledColumn<Geometry::Data, simfil::detail::ColumnPageSize/2> geom_;
+    PooledColumn<QualifiedSourceDataReference, simfil::detail::ColumnPageSize/2> sourceDataReferences_;
     Geometry::Storage pointBuffers_;
 
     /**
      * Indexing of features by their id hash. The hash-feature pairs are kept
-     * in a vector, which is kept in a sorted state. This allows finding a
-     * feature by it's id in O(log(n)) time.
+     * in a vector, which is sorted for serialization. Lookups go through an
+     * open-addressing table over the pairs, see FeatureHashTable.
      */
     struct FeatureAddrWithIdHash
     {
@@ -108,7 +141,11 @@ struct TileFeatureLayer::Impl {
             return std::tie(idHash_, featureAddr_) < std::tie(other.idHash_, other.featureAddr_);
         }
     };
-    sfl::segmented_vector<FeatureAddrWithIdHash, simfil::detail::ColumnPageSize/4> featureHashIndex_;
+    // Number of the chunks which were sent, and of the features in them, see sendChunk().
+    uint32_t numChunks_ = 0;
+    size_t numChunkedFeatures_ = 0;
+
+    PooledColumn<FeatureAddrWithIdHash, simfil::detail::ColumnPageSize/4> featureHashIndex_;
     bool featureHashIndexNeedsSorting_ = false;
 
     void sortFeatureHashIndex() {
@@ -118,30 +155,543 @@ struct TileFeatureLayer::Impl {
         std::sort(featureHashIndex_.begin(), featureHashIndex_.end());
     }
 
+    /**
+     * Open-addressing hash table over the feature hash index, laid out like
+     * a Swiss table: a probe scans one control byte per slot, which holds
+     * seven bits of the id hash of an occupied slot, and only reads the
+     * slot for matching control bytes. The slots are probed linearly from
+     * the slot which is selected by the upper bits of the mixed id hash.
+     * The load factor is kept at or below one half.
+     *
+     * The table is built on the first lookup of a sealed or parsed layer,
+     * which is guarded for concurrent readers. New features are inserted
+     * into an existing table, the table is rebuilt when it gets too full.
+     */
+    struct FeatureHashTable
+    {
+        static constexpr uint8_t EmptySlot = 0;
+
+        std::vector<uint8_t> control_;
+        std::vector<FeatureAddrWithIdHash> slots_;
+        size_t size_ = 0;
+        uint32_t shift_ = 64;
+
+        static uint8_t controlByte(uint64_t hash) {
+            return static_cast<uint8_t>(0x80u | (hash & 0x7fu));
+        }
+
+        [[nodiscard]] size_t firstSlot(uint64_t hash) const {
+            // Fibonacci hashing, so that the slots do not depend on the low bits only.
+            return static_cast<size_t>((hash * 0x9e3779b97f4a7c15ull) >> shift_);
+        }
+
+        [[nodiscard]] bool hasCapacityFor(size_t numEntries) const {
+            return numEntries * 2 <= slots_.size();
+        }
+
+        void reset(size_t numEntries) {
+            size_t capacity = 16;
+            shift_ = 60;
+            while (capacity < numEntries * 2) {
+                capacity <<= 1;
+                --shift_;
+            }
+            control_.assign(capacity, EmptySlot);
+            slots_.assign(capacity, {});
+            size_ = 0;
+        }
+
+        void insert(FeatureAddrWithIdHash const& entry) {
+            auto mask = slots_.size() - 1;
+            auto slot = firstSlot(entry.idHash_);
+            while (control_[slot] != EmptySlot)
+                slot = (slot + 1) & mask;
+            control_[slot] = controlByte(entry.idHash_);
+            slots_[slot] = entry;
+            ++size_;
+        }
+
+        // Call fn with the feature address of each entry with the given hash,
+        // until it returns true.
+        template<typename Fn>
+        void forEachMatch(uint64_t hash, Fn&& fn) const {
+            if (slots_.empty())
+                return;
+            auto mask = slots_.size() - 1;
+            auto control = controlByte(hash);
+            for (auto slot = firstSlot(hash); control_[slot] != EmptySlot; slot = (slot + 1) & mask) {
+                if (control_[slot] == control && slots_[slot].idHash_ == hash && fn(slots_[slot].featureAddr_))
+                    return;
+            }
+        }
+    };
+    FeatureHashTable featureHashTable_;
+    std::atomic<bool> featureHashTableIsValid_ = false;
+    std::mutex featureHashTableMutex_;
+
+    FeatureHashTable const& featureHashTable() {
+        if (!featureHashTableIsValid_.load(std::memory_order_acquire)) {
+            std::lock_guard lock(featureHashTableMutex_);
+            if (!featureHashTableIsValid_.load(std::memory_order_relaxed)) {
+                auto const& index = featureHashIndex();
+                featureHashTable_.reset(index.size());
+                for (auto const& entry : index)
+                    featureHashTable_.insert(entry);
+                featureHashTableIsValid_.store(true, std::memory_order_release);
+            }
+        }
+        return featureHashTable_;
+    }
+
+    void addToFeatureHashIndex(FeatureAddrWithIdHash const& entry) {
+        featureHashIndex().emplace_back(entry);
+        featureHashIndexNeedsSorting_ = true;
+        // Layers are not modified concurrently with lookups, see checkWritable().
+        if (!featureHashTableIsValid_.load(std::memory_order_relaxed))
+            return;
+        if (featureHashTable_.hasCapacityFor(featureHashTable_.size_ + 1))
+            featureHashTable_.insert(entry);
+        else
+            featureHashTableIsValid_.store(false, std::memory_order_relaxed);
+    }
+
+    /**
+     * Packed Hilbert R-tree over the bounding boxes of the feature
+     * geometries. The leaf boxes are sorted by the Hilbert index of their
+     * centers, and grouped into nodes of NodeSize boxes, level by level.
+     * All boxes are stored in one vector, the leaves first. For a leaf,
+     * the index is the feature index, for a node, it is the position of
+     * its first child box.
+     */
+    struct SpatialIndex
+    {
+        static constexpr size_t NodeSize = 16;
+
+        struct Box
+        {
+            double minX_ = std::numeric_limits<double>::max();
+            double minY_ = std::numeric_limits<double>::max();
+            double maxX_ = std::numeric_limits<double>::lowest();
+            double maxY_ = std::numeric_limits<double>::lowest();
+
+            void extend(Box const& other) {
+                minX_ = std::min(minX_, other.minX_);
+                minY_ = std::min(minY_, other.minY_);
+                maxX_ = std::max(maxX_, other.maxX_);
+                maxY_ = std::max(maxY_, other.maxY_);
+            }
+
+            [[nodiscard]] bool empty() const { return minX_ > maxX_; }
+
+            [[nodiscard]] bool intersects(Box const& other) const {
+                return minX_ <= other.maxX_ && other.minX_ <= maxX_ && minY_ <= other.maxY_ && other.minY_ <= maxY_;
+            }
+        };
+
+        std::vector<Box> boxes_;
+        std::vector<uint32_t> indices_;
+        std::vector<size_t> levelEnds_;  // End of each level in boxes_, the root level last
+
+        // Hilbert index of a point on a 2^16 x 2^16 grid.
+        static uint32_t hilbertIndex(uint32_t x, uint32_t y) {
+            uint32_t result = 0;
+            for (uint32_t s = 1u << 15; s > 0; s >>= 1) {
+                uint32_t rx = (x & s) > 0;
+                uint32_t ry = (y & s) > 0;
+                result += s * s * ((3 * rx) ^ ry);
+                if (ry == 0) {
+                    if (rx == 1) {
+                        x = 0xffff - x;
+                        y = 0xffff - y;
+                    }
+                    std::swap(x, y);
+                }
+            }
+            return result;
+        }
+
+        void build(std::vector<Box> const& featureBoxes) {
+            Box bounds;
+            std::vector<std::pair<uint32_t, uint32_t>> order;  // Hilbert index, feature index
+            for (auto const& box : featureBoxes)
+                if (!box.empty())
+                    bounds.extend(box);
+            auto const width = std::max(bounds.maxX_ - bounds.minX_, 1e-12);
+            auto const height = std::max(bounds.maxY_ - bounds.minY_, 1e-12);
+            for (uint32_t i = 0; i < featureBoxes.size(); ++i) {
+                auto const& box = featureBoxes[i];
+                if (box.empty())
+                    continue;
+                auto x = static_cast<uint32_t>(65535. * ((box.minX_ + box.maxX_) / 2. - bounds.minX_) / width);
+                auto y = static_cast<uint32_t>(65535. * ((box.minY_ + box.maxY_) / 2. - bounds.minY_) / height);
+                order.emplace_back(hilbertIndex(x, y), i);
+            }
+            std::sort(order.begin(), order.end());
+
+            boxes_.clear();
+            indices_.clear();
+            levelEnds_.clear();
+            for (auto const& [_, featureIndex] : order) {
+                boxes_.push_back(featureBoxes[featureIndex]);
+                indices_.push_back(featureIndex);
+            }
+            levelEnds_.push_back(boxes_.size());
+
+            // Group the boxes of each level into nodes, until a single root is left.
+            size_t levelBegin = 0;
+            while (levelEnds_.back() - levelBegin > 1) {
+                auto levelEnd = levelEnds_.back();
+                for (auto child = levelBegin; child < levelEnd; child += NodeSize) {
+                    Box node;
+                    for (auto i = child; i < std::min(child + NodeSize, levelEnd); ++i)
+                        node.extend(boxes_[i]);
+                    boxes_.push_back(node);
+                    indices_.push_back(static_cast<uint32_t>(child));
+                }
+                levelBegin = levelEnd;
+                levelEnds_.push_back(boxes_.size());
+            }
+        }
+
+        // Get the indices of the features whose box intersects the query box, in ascending order.
+        std::vector<uint32_t> search(Box const& query) const {
+            std::vector<uint32_t> result;
+            if (boxes_.empty())
+                return result;
+            std::vector<std::pair<size_t, size_t>> stack{{boxes_.size() - 1, levelEnds_.size() - 1}};  // Box, level
+            while (!stack.empty()) {
+                auto [box, level] = stack.back();
+                stack.pop_back();
+                if (!boxes_[box].intersects(query))
+                    continue;
+                if (level == 0) {
+                    result.push_back(indices_[box]);
+                    continue;
+                }
+                auto childBegin = indices_[box];
+                auto childEnd = std::min<size_t>(childBegin + NodeSize, levelEnds_[level - 1]);
+                for (auto child = childBegin; child < childEnd; ++child)
+                    stack.emplace_back(child, level - 1);
+            }
+            std::sort(result.begin(), result.end());
+            return result;
+        }
+    };
+    SpatialIndex spatialIndex_;
+    std::atomic<bool> spatialIndexIsValid_ = false;
+    std::mutex spatialIndexMutex_;
+
+    // The geometry bounds are not serialized, so a parsed
+    // layer computes them once, see computeGeometryBoxes().
+    std::once_flag geometryBoxesOnce_;
+    std::atomic<bool> geometryBoxesAreValid_ = true;
+
+    // Cumulative line lengths per geometry index, see lineLengths().
+    std::mutex lineLengthsMutex_;
+    std::unordered_map<uint32_t, std::shared_ptr<const std::vector<double>>> lineLengths_;
+
+    // Numeric attribute columns per attribute name, see attributeColumns().
+    // Null entries mark attributes which have values which are not numbers.
+    std::mutex attributeColumnsMutex_;
+    std::unordered_map<std::string, std::shared_ptr<const std::vector<AttributeColumn>>> attributeColumns_;
+
+    // Indices of the matching features per query, see matchingFeatures().
+    std::mutex matchingFeaturesMutex_;
+    std::unordered_map<std::string, std::shared_ptr<const std::vector<uint32_t>>> matchingFeatures_;
+
     // Simfil compiled expression cache and environment
-    SimfilExpressionCache expressionCache_;
+    std::shared_ptr<SimfilExpressionCache> expressionCache_;
+
+    /**
+     * The columns are serialized one by one, after a table with their sizes.
+     * A parsed layer keeps the serialized columns, and only decodes a column
+     * on its first access. So a client which e.g. only looks up a feature by
+     * its id does not pay for the geometry and source data columns. Columns
+     * which were not decoded are written out as they were read.
+     */
+    enum class EncodedColumn : uint8_t {
+        Features,
+        Attributes,
+        Validities,
+        FeatureIds,
+        AttributeLayers,
+        AttributeLayerLists,
+        Relations,
+        FeatureHashIndex,
+        Geometries,
+        PointBuffers,
+        SourceDataReferences,
+        Count
+    };
+    static constexpr size_t NumEncodedColumns = static_cast<size_t>(EncodedColumn::Count);
 
-    // (De-)Serialization
+    struct EncodedColumnState
+    {
+        size_t offset_ = 0;  // Offset of the column in encodedColumns_
+        size_t size_ = 0;
+        std::once_flag decodeOnce_;
+        std::atomic<bool> decoded_ = true;  // Columns of a new layer need no decoding
+    };
+    std::string encodedColumns_;
+    std::array<EncodedColumnState, NumEncodedColumns> encodedColumnStates_;
+
+    // Encoding of the point buffers in encodedColumns_. It is flagged
+    // in the size of the column, as the columns are limited to 2 GiB.
+    GeometryEncoding encodedGeometryEncoding_ = GeometryEncoding::Raw;
+    static constexpr uint32_t QuantizedDeltaColumnFlag = 1u << 31;
+
+    // Column accessors, which decode a column of a parsed layer on first use.
+    auto& features() { return decoded(EncodedColumn::Features, features_); }
+    auto& attributes() { return decoded(EncodedColumn::Attributes, attributes_); }
+    auto& validities() { return decoded(EncodedColumn::Validities, validities_); }
+    auto& featureIds() { return decoded(EncodedColumn::FeatureIds, featureIds_); }
+    auto& attrLayers() { return decoded(EncodedColumn::AttributeLayers, attrLayers_); }
+    auto& attrLayerLists() { return decoded(EncodedColumn::AttributeLayerLists, attrLayerLists_); }
+    auto& relations() { return decoded(EncodedColumn::Relations, relations_); }
+    auto& featureHashIndex() { return decoded(EncodedColumn::FeatureHashIndex, featureHashIndex_); }
+    auto& geom() { return decoded(EncodedColumn::Geometries, geom_); }
+    auto& pointBuffers() { return decoded(EncodedColumn::PointBuffers, pointBuffers_); }
+    auto& sourceDataReferences() { return decoded(EncodedColumn::SourceDataReferences, sourceDataReferences_); }
+
+    template<typename Column>
+    Column& decoded(EncodedColumn column, Column& storage) {
+        auto& state = encodedColumnStates_[static_cast<size_t>(column)];
+        if (!state.decoded_.load(std::memory_order_acquire)) {
+            std::call_once(state.decodeOnce_, [&, this] {
+                decodeColumn(column);
+                state.decoded_.store(true, std::memory_order_release);
+            });
+        }
+        return storage;
+    }
+
+    // Fill the point buffers of a parsed layer instead of decoding them,
+    // see TileFeatureLayer::simplified(). Raises if they were decoded.
+    template<typename Fun>
+    void fillPointBuffers(Fun&& fill) {
+        auto& state = encodedColumnStates_[static_cast<size_t>(EncodedColumn::PointBuffers)];
+        bool filled = false;
+        if (!state.decoded_.load(std::memory_order_acquire)) {
+            std::call_once(state.decodeOnce_, [&, this] {
+                fill(pointBuffers_);
+                state.decoded_.store(true, std::memory_order_release);
+                filled = true;
+            });
+        }
+        if (!filled)
+            raise("The point buffers of the layer are already decoded.");
+    }
+
+    // (De-)Serialization of a single column.
     template<typename S>
-    void readWrite(S& s) {
+    void readWriteColumn(S& s, EncodedColumn column) {
         constexpr size_t maxColumnSize = std::numeric_limits<uint32_t>::max();
-        s.container(features_, maxColumnSize);
-        s.container(attributes_, maxColumnSize);
-        s.container(validities_, maxColumnSize);
-        s.container(featureIds_, maxColumnSize);
-        s.container(attrLayers_, maxColumnSize);
-        s.container(attrLayerLists_, maxColumnSize);
+        switch (column) {
+        case EncodedColumn::Features: s.container(features_, maxColumnSize); break;
+        case EncodedColumn::Attributes: s.container(attributes_, maxColumnSize); break;
+        case EncodedColumn::Validities: s.container(validities_, maxColumnSize); break;
+        case EncodedColumn::FeatureIds: s.container(featureIds_, maxColumnSize); break;
+        case EncodedColumn::AttributeLayers: s.container(attrLayers_, maxColumnSize); break;
+        case EncodedColumn::AttributeLayerLists: s.container(attrLayerLists_, maxColumnSize); break;
+        case EncodedColumn::Relations: s.container(relations_, maxColumnSize); break;
+        case EncodedColumn::FeatureHashIndex: s.container(featureHashIndex_, maxColumnSize); break;
+        case EncodedColumn::Geometries: s.container(geom_, maxColumnSize); break;
+        case EncodedColumn::PointBuffers: s.ext(pointBuffers_, bitsery::ext::ArrayArenaExt{}); break;
+        case EncodedColumn::SourceDataReferences: s.container(sourceDataReferences_, maxColumnSize); break;
+        case EncodedColumn::Count: break;
+        }
+    }
+
+    /**
+     * QuantizedDelta encoding of the point buffers: The vertex offsets are
+     * quantized to VertexResolution. Per point buffer, the differences of
+     * consecutive quantized offsets are stored as zigzag varints, component
+     * by component, after the sizes of all buffers. So the decoder runs one
+     * tight loop per component, followed by a prefix sum.
+     */
+    static constexpr std::array<float, 3> VertexResolution{1e-7f, 1e-7f, 1e-3f};
+
+    // Point buffer indices in order, or nothing if they are not 0..n-1.
+    std::optional<std::vector<simfil::ArrayIndex>> pointBufferIndices() {
+        std::vector<simfil::ArrayIndex> result;
+        for (auto const& geom : geom_) {
+            if (!geom.isView_ && geom.detail_.geom_.vertexArray_ >= 0)
+                result.push_back(geom.detail_.geom_.vertexArray_);
+        }
+        std::sort(result.begin(), result.end());
+        for (size_t i = 0; i < result.size(); ++i) {
+            if (result[i] != static_cast<simfil::ArrayIndex>(i))
+                return {};
+        }
+        return result;
+    }
+
+    template<typename S>
+    void writeQuantizedPointBuffers(S& s, std::vector<simfil::ArrayIndex> const& arrays) {
+        for (auto resolution : VertexResolution)
+            s.value4b(resolution);
+        s.ext8b(static_cast<uint64_t>(arrays.size()), bitsery::ext::CompactValue{});
+        for (auto array : arrays)
+            s.ext8b(static_cast<uint64_t>(pointBuffers_.size(array)), bitsery::ext::CompactValue{});
+        for (size_t component = 0; component < 3; ++component) {
+            for (auto array : arrays) {
+                int64_t previous = 0;
+                auto size = pointBuffers_.size(array);
+                for (size_t i = 0; i < size; ++i) {
+                    auto quantized = static_cast<int64_t>(
+                        std::llround(pointBuffers_.at(array, i)[static_cast<glm::length_t>(component)] / VertexResolution[component]));
+                    s.ext8b(quantized - previous, bitsery::ext::CompactValue{});
+                    previous = quantized;
+                }
+            }
+        }
+    }
+
+    template<typename S>
+    void readQuantizedPointBuffers(S& s) {
+        std::array<float, 3> resolution{};
+        for (auto& r : resolution)
+            s.value4b(r);
+        uint64_t numArrays = 0;
+        s.ext8b(numArrays, bitsery::ext::CompactValue{});
+        if (numArrays > encodedColumns_.size())
+            raise("Failed to read TileFeatureLayer: Invalid point buffer count.");
+        std::vector<uint64_t> sizes(numArrays);
+        uint64_t numVertices = 0;
+        for (auto& size : sizes) {
+            s.ext8b(size, bitsery::ext::CompactValue{});
+            numVertices += size;
+        }
+        if (numVertices > encodedColumns_.size())
+            raise("Failed to read TileFeatureLayer: Invalid point buffer size.");
+
+        std::vector<glm::fvec3> vertices(numVertices);
+        for (size_t component = 0; component < 3; ++component) {
+            size_t vertex = 0;
+            for (auto size : sizes) {
+                int64_t quantized = 0;
+                for (uint64_t i = 0; i < size; ++i, ++vertex) {
+                    int64_t delta = 0;
+                    s.ext8b(delta, bitsery::ext::CompactValue{});
+                    quantized += delta;
+                    vertices[vertex][static_cast<glm::length_t>(component)] = static_cast<float>(quantized) * resolution[component];
+                }
+            }
+        }
+
+        size_t vertex = 0;
+        for (size_t array = 0; array < sizes.size(); ++array) {
+            auto index = pointBuffers_.new_array(sizes[array]);
+            if (index != static_cast<simfil::ArrayIndex>(array))
+                raise("Failed to read TileFeatureLayer: Unexpected point buffer index.");
+            for (uint64_t i = 0; i < sizes[array]; ++i)
+                pointBuffers_.emplace_back(index, vertices[vertex++]);
+        }
+    }
+
+    void decodeColumn(EncodedColumn column) {
+        auto const& state = encodedColumnStates_[static_cast<size_t>(column)];
+        auto begin = encodedColumns_.cbegin() + static_cast<std::ptrdiff_t>(state.offset_);
+        bitsery::Deserializer<bitsery::InputBufferAdapter<std::string>> s(begin, begin + static_cast<std::ptrdiff_t>(state.size_));
+        if (column == EncodedColumn::PointBuffers && encodedGeometryEncoding_ == GeometryEncoding::QuantizedDelta)
+            readQuantizedPointBuffers(s);
+        else
+            readWriteColumn(s, column);
+        if (s.adapter().error() != bitsery::ReaderError::NoError) {
+            raiseFmt(
+                "Failed to read TileFeatureLayer column {}: Error {}",
+                static_cast<size_t>(column),
+                static_cast<std::underlying_type_t<bitsery::ReaderError>>(s.adapter().error()));
+        }
+    }
+
+    void read(std::istream& inputStream) {
+        bitsery::Deserializer<bitsery::InputStreamAdapter> s(inputStream);
         s.object(featureIdPrefix_);
-        s.container(relations_, maxColumnSize);
+        size_t offset = 0;
+        for (size_t i = 0; i < NumEncodedColumns; ++i) {
+            auto& state = encodedColumnStates_[i];
+            uint32_t size = 0;
+            s.value4b(size);
+            if (static_cast<EncodedColumn>(i) == EncodedColumn::PointBuffers && (size & QuantizedDeltaColumnFlag)) {
+                encodedGeometryEncoding_ = GeometryEncoding::QuantizedDelta;
+                size &= ~QuantizedDeltaColumnFlag;
+            }
+            state.offset_ = offset;
+            state.size_ = size;
+            state.decoded_ = false;
+            offset += size;
+        }
+        if (s.adapter().error() != bitsery::ReaderError::NoError) {
+            raiseFmt(
+                "Failed to read TileFeatureLayer: Error {}",
+                static_cast<std::underlying_type_t<bitsery::ReaderError>>(s.adapter().error()));
+        }
+
+        geometryBoxesAreValid_ = false;
+
+        encodedColumns_.resize(offset);
+        inputStream.read(encodedColumns_.data(), static_cast<std::streamsize>(offset));
+        if (static_cast<size_t>(inputStream.gcount()) != offset)
+            raise("Failed to read TileFeatureLayer: Columns are truncated.");
+    }
+
+    void write(std::ostream& outputStream, GeometryEncoding geometryEncoding) {
         sortFeatureHashIndex();
-        s.container(featureHashIndex_, maxColumnSize);
-        s.container(geom_, maxColumnSize);
-        s.ext(pointBuffers_, bitsery::ext::ArrayArenaExt{});
-        s.container(sourceDataReferences_, maxColumnSize);
+
+        // The quantized encoding needs the geometries to find the point
+        // buffers. If their indices are unexpected, the raw encoding is used.
+        auto const& pointBuffersState = encodedColumnStates_[static_cast<size_t>(EncodedColumn::PointBuffers)];
+        bool keepEncodedPointBuffers =
+            !pointBuffersState.decoded_.load(std::memory_order_acquire) && encodedGeometryEncoding_ == geometryEncoding;
+        std::optional<std::vector<simfil::ArrayIndex>> quantizedPointBuffers;
+        if (geometryEncoding == GeometryEncoding::QuantizedDelta && !keepEncodedPointBuffers) {
+            geom();
+            pointBuffers();
+            quantizedPointBuffers = pointBufferIndices();
+            if (!quantizedPointBuffers)
+                geometryEncoding = GeometryEncoding::Raw;
+        }
+
+        std::array<std::string, NumEncodedColumns> encoded;
+        std::array<std::string_view, NumEncodedColumns> columns;
+        for (size_t i = 0; i < NumEncodedColumns; ++i) {
+            auto column = static_cast<EncodedColumn>(i);
+            auto const& state = encodedColumnStates_[i];
+            bool isPointBuffers = column == EncodedColumn::PointBuffers;
+            if (isPointBuffers && encodedGeometryEncoding_ != geometryEncoding)
+                pointBuffers();
+            if (!state.decoded_.load(std::memory_order_acquire)) {
+                columns[i] = std::string_view(encodedColumns_).substr(state.offset_, state.size_);
+                continue;
+            }
+            bitsery::Serializer<bitsery::OutputBufferAdapter<std::string>> s(encoded[i]);
+            if (isPointBuffers && quantizedPointBuffers)
+                writeQuantizedPointBuffers(s, *quantizedPointBuffers);
+            else
+                readWriteColumn(s, column);
+            s.adapter().flush();
+            encoded[i].resize(s.adapter().writtenBytesCount());
+            columns[i] = encoded[i];
+        }
+
+        bitsery::Serializer<bitsery::OutputStreamAdapter> s(outputStream);
+        s.object(featureIdPrefix_);
+        for (size_t i = 0; i < NumEncodedColumns; ++i) {
+            auto size = columns[i].size();
+            if (size >= QuantizedDeltaColumnFlag)
+                raise("TileFeatureLayer column exceeds 2 GiB.");
+            if (static_cast<EncodedColumn>(i) == EncodedColumn::PointBuffers &&
+                geometryEncoding == GeometryEncoding::QuantizedDelta)
+                size |= QuantizedDeltaColumnFlag;
+            s.value4b(static_cast<uint32_t>(size));
+        }
+        for (auto const& column : columns)
+            outputStream.write(column.data(), static_cast<std::streamsize>(column.size()));
     }
 
     explicit Impl(std::shared_ptr<simfil::StringPool> stringPool)
-        : expressionCache_(makeEnvironment(std::move(stringPool)))
+        : expressionCache_(sharedExpressionCache(stringPool))
     {
     }
 
@@ -168,17 +718,16 @@ TileFeatureLayer::TileFeatureLayer(
     ModelPool(stringPoolGetter(nodeId_)),
     impl_(std::make_unique<Impl>(stringPoolGetter(nodeId_)))
 {
-    bitsery::Deserializer<bitsery::InputStreamAdapter> s(inputStream);
-    impl_->readWrite(s);
-    if (s.adapter().error() != bitsery::ReaderError::NoError) {
-        raise(fmt::format(
-            "Failed to read TileFeatureLayer: Error {}",
-            static_cast<std::underlying_type_t<bitsery::ReaderError>>(s.adapter().error())));
-    }
+    impl_->read(inputStream);
     ModelPool::read(inputStream);
 }
 
-TileFeatureLayer::~TileFeatureLayer() = default;
+TileFeatureLayer::~TileFeatureLayer()
+{
+    // Return the pages of all columns to their pools at once.
+    ColumnPagePool::BatchRelease batchRelease;
+    impl_.reset();
+}
 
 namespace
 {
@@ -202,49 +751,66 @@ std::string idPartsToString(KeyValueViewPairs const& idParts) {
 }
 
 /**
- * Remove id parts from a keysAndValues list which are optional under
- * the given composition. Note: The ordering of keys in the keysAndValues
- * list must match the ordering in the composition. E.g., if `areaId` comes
- * before `featureId`, it will only be recognized if this order is also
- * maintained in the keysAndValues list.
+ * Cursor over the id parts of a keysAndValues list which are required,
+ * i.e. not optional, under the given composition. The parts are visited
+ * in place, so that no stripped copy of the list is made. Note: The
+ * ordering of keys in the keysAndValues list must match the ordering in
+ * the composition. E.g., if `areaId` comes before `featureId`, it will
+ * only be recognized if this order is also maintained in the keysAndValues list.
  */
-KeyValueViewPairs
-stripOptionalIdParts(KeyValueViewPairs const& keysAndValues, std::vector<IdPart> const& composition)
-{
-    KeyValueViewPairs result;
-    result.reserve(keysAndValues.size());
-    auto idPartIt = composition.begin();
-
-    for (auto const& [key, value] : keysAndValues) {
-        bool isOptional = true;
-        while (idPartIt != composition.end()) {
-            if (key == idPartIt->idPartLabel_) {
-                isOptional = idPartIt->isOptional_;
-                ++idPartIt;
-                break;
+class RequiredIdParts
+{
+public:
+    using Part = KeyValueViewPairs::value_type;
+
+    RequiredIdParts(KeyValueViewPairs const& keysAndValues, std::vector<IdPart> const& composition)
+        : part_(keysAndValues.begin()),
+          partsEnd_(keysAndValues.end()),
+          idPart_(composition.begin()),
+          idPartsEnd_(composition.end())
+    {
+    }
+
+    /** Get the next required id part, or null if there are no more. */
+    Part const* next()
+    {
+        while (part_ != partsEnd_) {
+            auto const& part = *part_++;
+            bool isOptional = true;
+            while (idPart_ != idPartsEnd_) {
+                auto const& idPart = *idPart_++;
+                if (part.first == idPart.idPartLabel_) {
+                    isOptional = idPart.isOptional_;
+                    break;
+                }
             }
-            ++idPartIt;
+            if (!isOptional)
+                return &part;
         }
-        if (!isOptional)
-            result.emplace_back(key, value);
+        return nullptr;
     }
 
-    return result;
-}
+private:
+    KeyValueViewPairs::const_iterator part_;
+    KeyValueViewPairs::const_iterator partsEnd_;
+    std::vector<IdPart>::const_iterator idPart_;
+    std::vector<IdPart>::const_iterator idPartsEnd_;
+};
 
 /**
- * Create a hash of the given feature-type-name + idParts combination.
+ * Create a hash of the given feature-type-name + required idParts combination.
  * We do not use std::hash, as it has different implementations on different
- * compilers. This hash must be stable across Emscripten/GCC/MSVC/etc.
+ * compilers. This hash must be stable across Emscripten/GCC/MSVC/etc.,
+ * and across versions, as it is stored in the feature hash index of
+ * serialized tiles. It is FNV-1a, computed without temporaries.
  */
-uint64_t hashFeatureId(const std::string_view& type, const KeyValueViewPairs& idParts)
+uint64_t hashFeatureId(std::string_view const& type, RequiredIdParts idParts)
 {
     // Constants for the FNV-1a hash algorithm
     constexpr uint64_t FNV_prime = 1099511628211ULL;
     constexpr uint64_t offset_basis = 14695981039346656037ULL;
 
-    // Lambda function for FNV-1a hash of a string view
-    auto fnv1a_hash = [](std::string_view str) -> uint64_t {
+    auto fnv1a_hash = [](std::string_view const& str) -> uint64_t {
         uint64_t hash = offset_basis;
         for (char c : str) {
             hash ^= static_cast<uint64_t>(c);
@@ -253,46 +819,115 @@ uint64_t hashFeatureId(const std::string_view& type, const KeyValueViewPairs& id
         return hash;
     };
 
-    // Lambda function to hash int64_t values
+    // The bytes of the value are hashed from the lowest to the highest.
     auto hash_int64 = [](int64_t value) -> uint64_t {
+        auto bits = static_cast<uint64_t>(value);
         uint64_t hash = offset_basis;
         for (size_t i = 0; i < sizeof(int64_t); ++i) {
-            hash ^= (value & 0xff);
+            hash ^= (bits >> (i * 8)) & 0xff;
             hash *= FNV_prime;
-            value >>= 8;
         }
         return hash;
     };
 
-    // Begin hashFeatureId implementation
     uint64_t hash = fnv1a_hash(type);
-
-    for (const auto& [key, value] : idParts) {
+    while (auto idPart = idParts.next()) {
         // Combine the hash of the key
-        hash ^= fnv1a_hash(key);
+        hash ^= fnv1a_hash(idPart->first);
         hash *= FNV_prime;
 
         // Combine the hash of the value
-        hash ^= std::visit([&](const auto& val) -> uint64_t {
-            using T = std::decay_t<decltype(val)>;
-            if constexpr (std::is_same_v<T, int64_t>) {
-                return hash_int64(val);
-            } else {
-                return fnv1a_hash(val);
-            }
-        }, value);
+        if (auto intValue = std::get_if<int64_t>(&idPart->second))
+            hash ^= hash_int64(*intValue);
+        else
+            hash ^= fnv1a_hash(std::get<std::string_view>(idPart->second));
         hash *= FNV_prime;
     }
 
     return hash;
 }
 
+/**
+ * Check whether the required parts of two id part lists are equal,
+ * in place, under the given composition.
+ */
+bool requiredIdPartsEqual(
+    KeyValueViewPairs const& left,
+    KeyValueViewPairs const& right,
+    std::vector<IdPart> const& composition)
+{
+    RequiredIdParts leftParts(left, composition);
+    RequiredIdParts rightParts(right, composition);
+    while (true) {
+        auto leftPart = leftParts.next();
+        auto rightPart = rightParts.next();
+        if (!leftPart || !rightPart)
+            return !leftPart && !rightPart;
+        if (*leftPart != *rightPart)
+            return false;
+    }
+}
+
+/**
+ * Douglas-Peucker simplification of a line of vertices in the x/y plane.
+ * Returns the indices of the vertices which are kept, so that no dropped
+ * vertex is farther than the tolerance from the simplified line. The first
+ * and the last vertex are always kept.
+ */
+std::vector<size_t> simplifiedVertexIndices(std::vector<glm::fvec3> const& vertices, double tolerance)
+{
+    std::vector<size_t> result;
+    if (vertices.size() <= 2) {
+        for (size_t i = 0; i < vertices.size(); ++i)
+            result.push_back(i);
+        return result;
+    }
+
+    std::vector<bool> keep(vertices.size(), false);
+    keep.front() = keep.back() = true;
+    std::vector<std::pair<size_t, size_t>> stack{{0, vertices.size() - 1}};
+    auto const toleranceSquared = tolerance * tolerance;
+    while (!stack.empty()) {
+        auto [first, last] = stack.back();
+        stack.pop_back();
+        glm::dvec2 a{vertices[first].x, vertices[first].y};
+        glm::dvec2 ab = glm::dvec2{vertices[last].x, vertices[last].y} - a;
+        auto lengthSquared = glm::dot(ab, ab);
+
+        auto farthest = first;
+        auto farthestDistanceSquared = 0.;
+        for (auto i = first + 1; i < last; ++i) {
+            glm::dvec2 ap = glm::dvec2{vertices[i].x, vertices[i].y} - a;
+            auto t = lengthSquared > 0. ? std::clamp(glm::dot(ap, ab) / lengthSquared, 0., 1.) : 0.;
+            auto d = ap - ab * t;
+            auto distanceSquared = glm::dot(d, d);
+            if (distanceSquared > farthestDistanceSquared) {
+                farthest = i;
+                farthestDistanceSquared = distanceSquared;
+            }
+        }
+
+        if (farthestDistanceSquared > toleranceSquared) {
+            keep[farthest] = true;
+            stack.emplace_back(first, farthest);
+            stack.emplace_back(farthest, last);
+        }
+    }
+
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        if (keep[i])
+            result.push_back(i);
+    }
+    return result;
+}
+
 }  // namespace
 
 simfil::model_ptr<Feature> TileFeatureLayer::newFeature(
     const std::string_view& typeId,
     const KeyValueViewPairs& featureIdParts)
 {
+    checkWritable();
     if (featureIdParts.empty()) {
         raise("Tried to create an empty feature ID.");
     }
@@ -308,9 +943,9 @@ simfil::model_ptr<Feature> TileFeatureLayer::newFeature(
             idPartsToString(featureIdParts)));
     }
 
-    auto featureIdIndex = impl_->featureIds_.size();
+    auto featureIdIndex = impl_->featureIds().size();
     auto featureIdObject = newObject(featureIdParts.size());
-    impl_->featureIds_.emplace_back(FeatureId::Data{
+    impl_->featureIds().emplace_back(FeatureId::Data{
         true,
         strings()->emplace(typeId),
         featureIdObject->addr()
@@ -322,8 +957,8 @@ simfil::model_ptr<Feature> TileFeatureLayer::newFeature(
         }, v);
     }
 
-    auto featureIndex = impl_->features_.size();
-    impl_->features_.emplace_back(Feature::Data{
+    auto featureIndex = impl_->features().size();
+    impl_->features().emplace_back(Feature::Data{
         simfil::ModelNodeAddress{ColumnId::FeatureIds, (uint32_t)featureIdIndex},
         simfil::ModelNodeAddress{Null, 0},
         simfil::ModelNodeAddress{Null, 0},
@@ -331,16 +966,20 @@ simfil::model_ptr<Feature> TileFeatureLayer::newFeature(
         simfil::ModelNodeAddress{Null, 0},
     });
     auto result = Feature(
-        impl_->features_.back(),
+        impl_->features().back(),
         shared_from_this(),
         simfil::ModelNodeAddress{ColumnId::Features, (uint32_t)featureIndex});
 
     // Add feature hash index entry.
+    // Without a prefix, the given parts are those of the new id,
+    // so they need not be read back.
     auto const& primaryIdComposition = getPrimaryIdComposition(typeId);
-    auto fullStrippedFeatureId = stripOptionalIdParts(result.id()->keyValuePairs(), primaryIdComposition);
-    auto hash = hashFeatureId(typeId, fullStrippedFeatureId);
-    impl_->featureHashIndex_.emplace_back(TileFeatureLayer::Impl::FeatureAddrWithIdHash{result.addr(), hash});
-    impl_->featureHashIndexNeedsSorting_ = true;
+    uint64_t hash = 0;
+    if (idPrefixLength == 0)
+        hash = hashFeatureId(typeId, {featureIdParts, primaryIdComposition});
+    else
+        hash = hashFeatureId(typeId, {result.id()->keyValuePairs(), primaryIdComposition});
+    impl_->addToFeatureHashIndex(TileFeatureLayer::Impl::FeatureAddrWithIdHash{result.addr(), hash});
 
     // Note: Here we rely on the assertion that the root_ collection
     // contains only references to feature nodes, in the order
@@ -355,6 +994,7 @@ TileFeatureLayer::newFeatureId(
     const std::string_view& typeId,
     const KeyValueViewPairs& featureIdParts)
 {
+    checkWritable();
     if (!layerInfo_->validFeatureId(typeId, featureIdParts, false)) {
         raise(fmt::format(
             "Could not find a matching ID composition of type {} with parts {}.",
@@ -363,8 +1003,8 @@ TileFeatureLayer::newFeatureId(
     }
 
     auto featureIdObject = newObject(featureIdParts.size());
-    auto featureIdIndex = impl_->featureIds_.size();
-    impl_->featureIds_.emplace_back(FeatureId::Data{
+    auto featureIdIndex = impl_->featureIds().size();
+    impl_->featureIds().emplace_back(FeatureId::Data{
         false,
         strings()->emplace(typeId),
         featureIdObject->addr()
@@ -375,18 +1015,19 @@ TileFeatureLayer::newFeatureId(
             featureIdObject->addField(kk, x);
         }, v);
     }
-    return FeatureId(impl_->featureIds_.back(), shared_from_this(), {ColumnId::FeatureIds, (uint32_t)featureIdIndex});
+    return FeatureId(impl_->featureIds().back(), shared_from_this(), {ColumnId::FeatureIds, (uint32_t)featureIdIndex});
 }
 
 model_ptr<Relation>
 TileFeatureLayer::newRelation(const std::string_view& name, const model_ptr<FeatureId>& target)
 {
-    auto relationIndex = impl_->relations_.size();
-    impl_->relations_.emplace_back(Relation::Data{
+    checkWritable();
+    auto relationIndex = impl_->relations().size();
+    impl_->relations().emplace_back(Relation::Data{
         strings()->emplace(name),
         target->addr()
     });
-    return Relation(&impl_->relations_.back(), shared_from_this(), {ColumnId::Relations, (uint32_t)relationIndex});
+    return Relation(&impl_->relations().back(), shared_from_this(), {ColumnId::Relations, (uint32_t)relationIndex});
 }
 
 model_ptr<Object> TileFeatureLayer::getIdPrefix()
@@ -399,40 +1040,44 @@ model_ptr<Object> TileFeatureLayer::getIdPrefix()
 model_ptr<Attribute>
 TileFeatureLayer::newAttribute(const std::string_view& name, size_t initialCapacity)
 {
-    auto attrIndex = impl_->attributes_.size();
-    impl_->attributes_.emplace_back(Attribute::Data{
+    checkWritable();
+    auto attrIndex = impl_->attributes().size();
+    impl_->attributes().emplace_back(Attribute::Data{
         {Null, 0},
         objectMemberStorage().new_array(initialCapacity),
         strings()->emplace(name)
     });
     return Attribute(
-        &impl_->attributes_.back(),
+        &impl_->attributes().back(),
         shared_from_this(),
         {ColumnId::Attributes, (uint32_t)attrIndex});
 }
 
 model_ptr<AttributeLayer> TileFeatureLayer::newAttributeLayer(size_t initialCapacity)
 {
-    auto layerIndex = impl_->attrLayers_.size();
-    impl_->attrLayers_.emplace_back(objectMemberStorage().new_array(initialCapacity));
+    checkWritable();
+    auto layerIndex = impl_->attrLayers().size();
+    impl_->attrLayers().emplace_back(objectMemberStorage().new_array(initialCapacity));
     return AttributeLayer(
-        impl_->attrLayers_.back(),
+        impl_->attrLayers().back(),
         shared_from_this(),
         {ColumnId::AttributeLayers, (uint32_t)layerIndex});
 }
 
 model_ptr<AttributeLayerList> TileFeatureLayer::newAttributeLayers(size_t initialCapacity)
 {
-    auto listIndex = impl_->attrLayerLists_.size();
-    impl_->attrLayerLists_.emplace_back(objectMemberStorage().new_array(initialCapacity));
+    checkWritable();
+    auto listIndex = impl_->attrLayerLists().size();
+    impl_->attrLayerLists().emplace_back(objectMemberStorage().new_array(initialCapacity));
     return AttributeLayerList(
-        impl_->attrLayerLists_.back(),
+        impl_->attrLayerLists().back(),
         shared_from_this(),
         {ColumnId::AttributeLayerLists, (uint32_t)listIndex});
 }
 
 model_ptr<GeometryCollection> TileFeatureLayer::newGeometryCollection(size_t initialCapacity)
 {
+    checkWritable();
     auto listIndex = arrayMemberStorage().new_array(initialCapacity);
     return GeometryCollection(
         shared_from_this(),
@@ -441,12 +1086,13 @@ model_ptr<GeometryCollection> TileFeatureLayer::newGeometryCollection(size_t ini
 
 model_ptr<Geometry> TileFeatureLayer::newGeometry(GeomType geomType, size_t initialCapacity)
 {
+    checkWritable();
     initialCapacity = std::max((size_t)1, initialCapacity);
-    impl_->geom_.emplace_back(geomType, initialCapacity);
+    impl_->geom().emplace_back(geomType, initialCapacity);
     return Geometry(
-        &impl_->geom_.back(),
+        &impl_->geom().back(),
         shared_from_this(),
-        {ColumnId::Geometries, (uint32_t)impl_->geom_.size() - 1});
+        {ColumnId::Geometries, (uint32_t)impl_->geom().size() - 1});
 }
 
 model_ptr<Geometry> TileFeatureLayer::newGeometryView(
@@ -455,16 +1101,18 @@ model_ptr<Geometry> TileFeatureLayer::newGeometryView(
     uint32_t size,
     const model_ptr<Geometry>& base)
 {
-    impl_->geom_.emplace_back(geomType, offset, size, base->addr());
+    checkWritable();
+    impl_->geom().emplace_back(geomType, offset, size, base->addr());
     return Geometry(
-        &impl_->geom_.back(),
+        &impl_->geom().back(),
         shared_from_this(),
-        {ColumnId::Geometries, (uint32_t)impl_->geom_.size() - 1});
+        {ColumnId::Geometries, (uint32_t)impl_->geom().size() - 1});
 }
 
 model_ptr<SourceDataReferenceCollection> TileFeatureLayer::newSourceDataReferenceCollection(std::span<QualifiedSourceDataReference> list)
 {
-    auto& arena = impl_->sourceDataReferences_;
+    checkWritable();
+    auto& arena = impl_->sourceDataReferences();
     const auto index = arena.size();
     const auto size = list.size();
 
@@ -477,15 +1125,17 @@ model_ptr<SourceDataReferenceCollection> TileFeatureLayer::newSourceDataReferenc
 
 model_ptr<Validity> TileFeatureLayer::newValidity()
 {
-    impl_->validities_.emplace_back();
+    checkWritable();
+    impl_->validities().emplace_back();
     return Validity(
-        &impl_->validities_.back(),
+        &impl_->validities().back(),
         shared_from_this(),
-        {ColumnId::Validities, (uint32_t)impl_->validities_.size() - 1});
+        {ColumnId::Validities, (uint32_t)impl_->validities().size() - 1});
 }
 
 model_ptr<MultiValidity> TileFeatureLayer::newValidityCollection(size_t initialCapacity)
 {
+    checkWritable();
     auto validityArrId = arrayMemberStorage().new_array(initialCapacity);
     return MultiValidity(
         shared_from_this(),
@@ -497,7 +1147,7 @@ model_ptr<AttributeLayer> TileFeatureLayer::resolveAttributeLayer(simfil::ModelN
     if (n.addr().column() != ColumnId::AttributeLayers)
         raise("Cannot cast this node to an AttributeLayer.");
     return AttributeLayer(
-        impl_->attrLayers_[n.addr().index()],
+        impl_->attrLayers()[n.addr().index()],
         shared_from_this(),
         n.addr());
 }
@@ -507,7 +1157,7 @@ model_ptr<AttributeLayerList> TileFeatureLayer::resolveAttributeLayerList(simfil
     if (n.addr().column() != ColumnId::AttributeLayerLists)
         raise("Cannot cast this node to an AttributeLayerList.");
     return AttributeLayerList(
-        impl_->attrLayerLists_[n.addr().index()],
+        impl_->attrLayerLists()[n.addr().index()],
         shared_from_this(),
         n.addr());
 }
@@ -517,7 +1167,7 @@ model_ptr<Attribute> TileFeatureLayer::resolveAttribute(simfil::ModelNode const&
     if (n.addr().column() != ColumnId::Attributes)
         raise("Cannot cast this node to an Attribute.");
     return Attribute(
-        &impl_->attributes_[n.addr().index()],
+        &impl_->attributes()[n.addr().index()],
         shared_from_this(),
         n.addr());
 }
@@ -527,7 +1177,7 @@ model_ptr<Feature> TileFeatureLayer::resolveFeature(simfil::ModelNode const& n)
     if (n.addr().column() != ColumnId::Features)
         raise("Cannot cast this node to a Feature.");
     return Feature(
-        impl_->features_[n.addr().index()],
+        impl_->features()[n.addr().index()],
         shared_from_this(),
         n.addr());
 }
@@ -537,7 +1187,7 @@ model_ptr<FeatureId> TileFeatureLayer::resolveFeatureId(simfil::ModelNode const&
     if (n.addr().column() != ColumnId::FeatureIds)
         raise("Cannot cast this node to a FeatureId.");
     return FeatureId(
-        impl_->featureIds_[n.addr().index()],
+        impl_->featureIds()[n.addr().index()],
         shared_from_this(),
         n.addr());
 }
@@ -547,7 +1197,7 @@ model_ptr<Relation> TileFeatureLayer::resolveRelation(const simfil::ModelNode& n
     if (n.addr().column() != ColumnId::Relations)
         raise("Cannot cast this node to a Relation.");
     return Relation(
-        &impl_->relations_[n.addr().index()],
+        &impl_->relations()[n.addr().index()],
         shared_from_this(),
         n.addr());
 }
@@ -557,7 +1207,7 @@ model_ptr<PointNode> TileFeatureLayer::resolvePoint(const simfil::ModelNode& n)
     if (n.addr().column() != ColumnId::Points)
         raise("Cannot cast this node to a Point.");
     return PointNode(
-        n, &impl_->geom_.at(n.addr().index()));
+        n, &impl_->geom().at(n.addr().index()));
 }
 
 model_ptr<PointNode> TileFeatureLayer::resolveValidityPoint(const simfil::ModelNode& n) const
@@ -565,7 +1215,7 @@ model_ptr<PointNode> TileFeatureLayer::resolveValidityPoint(const simfil::ModelN
     if (n.addr().column() != ColumnId::ValidityPoints)
         raise("Cannot cast this node to a ValidityPoint.");
     return PointNode(
-        n, &impl_->validities_.at(n.addr().index()));
+        n, &impl_->validities().at(n.addr().index()));
 }
 
 model_ptr<Validity> TileFeatureLayer::resolveValidity(simfil::ModelNode const& n) const
@@ -573,7 +1223,7 @@ model_ptr<Validity> TileFeatureLayer::resolveValidity(simfil::ModelNode const& n
     if (n.addr().column() != ColumnId::Validities)
         raise("Cannot cast this node to a Validity.");
     return Validity(
-        &impl_->validities_[n.addr().index()],
+        &impl_->validities()[n.addr().index()],
         shared_from_this(),
         n.addr());
 }
@@ -590,7 +1240,7 @@ model_ptr<MultiValidity> TileFeatureLayer::resolveValidityCollection(const simfi
 model_ptr<PointBufferNode> TileFeatureLayer::resolvePointBuffer(const simfil::ModelNode& n) const
 {
     return PointBufferNode(
-        &impl_->geom_.at(n.addr().index()),
+        &impl_->geom().at(n.addr().index()),
         shared_from_this(),
         n.addr());
 }
@@ -605,7 +1255,7 @@ model_ptr<PolygonNode> TileFeatureLayer::resolvePolygon(const simfil::ModelNode&
 model_ptr<MeshNode> TileFeatureLayer::resolveMesh(const simfil::ModelNode& n) const
 {
     return MeshNode(
-        &impl_->geom_.at(n.addr().index()),
+        &impl_->geom().at(n.addr().index()),
         shared_from_this(),
         n.addr());
 }
@@ -618,7 +1268,7 @@ model_ptr<LinearRingNode> TileFeatureLayer::resolveLinearRing(const simfil::Mode
 model_ptr<Geometry> TileFeatureLayer::resolveGeometry(const simfil::ModelNode& n) const
 {
     return Geometry(
-        &const_cast<Geometry::Data&>(impl_->geom_.at(n.addr().index())), // FIXME: const_cast?!
+        &const_cast<Geometry::Data&>(impl_->geom().at(n.addr().index())), // FIXME: const_cast?!
         shared_from_this(),
         n.addr());
 }
@@ -647,7 +1297,7 @@ TileFeatureLayer::resolveSourceDataReferenceCollection(const simfil::ModelNode&
         raise("Cannot cast this node to an SourceDataReferenceCollection.");
 
     auto [index, size] = modelAddressToSourceDataAddressList(n.addr().index());
-    const auto& data = impl_->sourceDataReferences_;
+    const auto& data = impl_->sourceDataReferences();
     return SourceDataReferenceCollection(index, size, shared_from_this(), n.addr());
 }
 
@@ -657,7 +1307,7 @@ TileFeatureLayer::resolveSourceDataReferenceItem(const simfil::ModelNode& n) con
     if (n.addr().column() != ColumnId::SourceDataReferences)
         raise("Cannot cast this node to an SourceDataReferenceItem.");
 
-    const auto* data = &impl_->sourceDataReferences_.at(n.addr().index());
+    const auto* data = &impl_->sourceDataReferences().at(n.addr().index());
     return SourceDataReferenceItem(data, shared_from_this(), n.addr());
 }
 
@@ -669,7 +1319,7 @@ void TileFeatureLayer::resolve(const simfil::ModelNode& n, const simfil::Model::
         return cb(*resolveFeature(n));
     case ColumnId::FeatureProperties:
         return cb(Feature::FeaturePropertyView(
-            impl_->features_[n.addr().index()],
+            impl_->features()[n.addr().index()],
             shared_from_this(),
             n.addr()
         ));
@@ -718,18 +1368,19 @@ void TileFeatureLayer::resolve(const simfil::ModelNode& n, const simfil::Model::
 
 std::vector<simfil::Value> TileFeatureLayer::evaluate(std::string_view query)
 {
-    return impl_->expressionCache_.eval(query, *root(0));
+    return impl_->expressionCache_->eval(query, *root(0));
 }
 
 std::vector<simfil::Value> TileFeatureLayer::evaluate(std::string_view query, ModelNode const& node)
 {
-    return impl_->expressionCache_.eval(query, node);
+    return impl_->expressionCache_->eval(query, node);
 }
 
 void TileFeatureLayer::setIdPrefix(const KeyValueViewPairs& prefix)
 {
+    checkWritable();
     // The prefix must be set, before any feature is added.
-    if (!impl_->features_.empty())
+    if (!impl_->features().empty())
         throw std::runtime_error("Cannot set feature id prefix after a feature was added.");
 
     // Check that the prefix is compatible with all primary id composites.
@@ -755,6 +1406,126 @@ void TileFeatureLayer::setIdPrefix(const KeyValueViewPairs& prefix)
     impl_->featureIdPrefix_ = idPrefix->addr();
 }
 
+void TileFeatureLayer::reserve(SizeHint const& hint)
+{
+    checkWritable();
+    // Each feature has an id and an attribute layer list, and
+    // each relation has the id of its target feature.
+    impl_->features().reserve(hint.features_);
+    impl_->featureIds().reserve(hint.features_ + hint.relations_);
+    impl_->featureHashIndex().reserve(hint.features_);
+    impl_->attrLayerLists().reserve(hint.features_);
+    impl_->attributes().reserve(hint.attributes_);
+    impl_->attrLayers().reserve(hint.attributeLayers_);
+    impl_->geom().reserve(hint.geometries_);
+    impl_->validities().reserve(hint.validities_);
+    impl_->relations().reserve(hint.relations_);
+    impl_->sourceDataReferences().reserve(hint.sourceDataReferences_);
+}
+
+size_t TileFeatureLayer::FeatureBatch::size() const
+{
+    size_t result = typeIds_.size() > 1 ? typeIds_.size() : 0;
+    if (!geometryOffsets_.empty())
+        result = std::max(result, geometryOffsets_.size() - 1);
+    for (auto const* columns : {&idParts_, &attributes_}) {
+        for (auto const& [name, column] : *columns)
+            result = std::max(result, std::visit([](auto&& values) { return values.size(); }, column));
+    }
+    return result;
+}
+
+size_t TileFeatureLayer::newFeatures(FeatureBatch const& batch)
+{
+    checkWritable();
+    auto const numFeatures = batch.size();
+    if (numFeatures == 0)
+        return 0;
+
+    // Check all columns first, so that a malformed batch adds nothing.
+    auto columnSize = [](FeatureBatch::Column const& column)
+    { return std::visit([](auto&& values) { return values.size(); }, column); };
+    if (batch.typeIds_.size() != 1 && batch.typeIds_.size() != numFeatures)
+        raiseFmt("A feature batch needs one type id, or one per feature, not {}.", batch.typeIds_.size());
+    for (auto const& [name, column] : batch.idParts_) {
+        if (columnSize(column) != numFeatures)
+            raiseFmt("Feature id part column {} has {} rows instead of {}.", name, columnSize(column), numFeatures);
+        if (std::holds_alternative<std::vector<double>>(column))
+            raiseFmt("Feature id part column {} must have integer or string values.", name);
+    }
+    for (auto const& [name, column] : batch.attributes_) {
+        if (columnSize(column) != numFeatures)
+            raiseFmt("Attribute column {} has {} rows instead of {}.", name, columnSize(column), numFeatures);
+    }
+    auto const& offsets = batch.geometryOffsets_;
+    if (!offsets.empty()) {
+        if (offsets.size() != numFeatures + 1)
+            raiseFmt("A feature batch needs {} geometry offsets, not {}.", numFeatures + 1, offsets.size());
+        if (batch.coordinates_.size() % 3 != 0 || offsets.back() > batch.coordinates_.size() / 3)
+            raise("The geometry offsets of a feature batch exceed its coordinates.");
+        if (!std::is_sorted(offsets.begin(), offsets.end()))
+            raise("The geometry offsets of a feature batch must not decrease.");
+    }
+
+    auto hint = sizeHint();
+    hint.features_ += static_cast<uint32_t>(numFeatures);
+    if (!offsets.empty())
+        hint.geometries_ += static_cast<uint32_t>(numFeatures);
+    reserve(hint);
+
+    KeyValueViewPairs idParts;
+    std::vector<Point> points;
+    for (size_t i = 0; i < numFeatures; ++i) {
+        idParts.clear();
+        for (auto const& [name, column] : batch.idParts_) {
+            if (auto const* ints = std::get_if<std::vector<int64_t>>(&column))
+                idParts.emplace_back(name, (*ints)[i]);
+            else
+                idParts.emplace_back(name, std::string_view(std::get<std::vector<std::string>>(column)[i]));
+        }
+        auto feature = newFeature(batch.typeIds_[batch.typeIds_.size() == 1 ? 0 : i], idParts);
+
+        if (!offsets.empty() && offsets[i] < offsets[i + 1]) {
+            points.clear();
+            for (auto p = offsets[i]; p < offsets[i + 1]; ++p)
+                points.emplace_back(batch.coordinates_[3 * p], batch.coordinates_[3 * p + 1], batch.coordinates_[3 * p + 2]);
+            switch (batch.geomType_) {
+            case GeomType::Points: feature->addPoints(points); break;
+            case GeomType::Line: feature->addLine(points); break;
+            case GeomType::Polygon: feature->addPoly(points); break;
+            case GeomType::Mesh: feature->addMesh(points); break;
+            }
+        }
+
+        if (batch.attributes_.empty())
+            continue;
+        auto attributes = feature->attributes();
+        for (auto const& [name, column] : batch.attributes_) {
+            std::visit([&](auto&& values)
+            {
+                if constexpr (std::is_same_v<std::decay_t<decltype(values)>, std::vector<std::string>>)
+                    attributes->addField(name, std::string_view(values[i]));
+                else
+                    attributes->addField(name, values[i]);
+            }, column);
+        }
+    }
+    return numFeatures;
+}
+
+TileFeatureLayer::SizeHint TileFeatureLayer::sizeHint() const
+{
+    return {
+        static_cast<uint32_t>(impl_->features().size()),
+        static_cast<uint32_t>(impl_->attributes().size()),
+        static_cast<uint32_t>(impl_->attrLayers().size()),
+        static_cast<uint32_t>(impl_->geom().size()),
+        static_cast<uint32_t>(impl_->validities().size()),
+        static_cast<uint32_t>(impl_->relations().size()),
+        static_cast<uint32_t>(impl_->sourceDataReferences().size())
+    };
+}
+
 TileFeatureLayer::Iterator TileFeatureLayer::begin() const
 {
     return TileFeatureLayer::Iterator{*this, 0};
@@ -766,10 +1537,14 @@ TileFeatureLayer::Iterator TileFeatureLayer::end() const
 }
 
 void TileFeatureLayer::write(std::ostream& outputStream)
+{
+    write(outputStream, GeometryEncoding::Raw);
+}
+
+void TileFeatureLayer::write(std::ostream& outputStream, GeometryEncoding geometryEncoding)
 {
     TileLayer::write(outputStream);
-    bitsery::Serializer<bitsery::OutputStreamAdapter> s(outputStream);
-    impl_->readWrite(s);
+    impl_->write(outputStream, geometryEncoding);
     ModelPool::write(outputStream);
 }
 
@@ -784,6 +1559,17 @@ nlohmann::json TileFeatureLayer::toJson() const
     });
 }
 
+void TileFeatureLayer::writeJson(std::string& out, JsonLayout layout) const
+{
+    out.append(R"({"type":"FeatureCollection","features":[)");
+    for (size_t i = 0; i < size(); ++i) {
+        if (i > 0)
+            out.push_back(',');
+        mapget::writeJson(*at(i), *strings(), out, layout);
+    }
+    out.append("]}");
+}
+
 size_t TileFeatureLayer::size() const
 {
     return numRoots();
@@ -798,48 +1584,309 @@ model_ptr<Feature>
 TileFeatureLayer::find(const std::string_view& type, const KeyValueViewPairs& queryIdParts) const
 {
     auto const& primaryIdComposition = getPrimaryIdComposition(type);
-    auto queryIdPartsStripped = stripOptionalIdParts(queryIdParts, primaryIdComposition);
-    auto hash = hashFeatureId(type, queryIdPartsStripped);
-
-    impl_->sortFeatureHashIndex();
-    auto it = std::lower_bound(
-        impl_->featureHashIndex_.begin(),
-        impl_->featureHashIndex_.end(),
-        Impl::FeatureAddrWithIdHash{0, hash},
-        [](auto&& l, auto&& r) { return l.idHash_ < r.idHash_; });
-
-    // Iterate through potential matches to handle hash collisions.
-    while (it != impl_->featureHashIndex_.end() && it->idHash_ == hash)
+    auto hash = hashFeatureId(type, {queryIdParts, primaryIdComposition});
+
+    model_ptr<Feature> result;
+    impl_->featureHashTable().forEachMatch(hash, [&](simfil::ModelNodeAddress const& featureAddr)
+    {
+        // Hash collisions are ruled out by comparing the type and ID parts.
+        auto feature = resolveFeature(*simfil::ModelNode::Ptr::make(shared_from_this(), featureAddr));
+        auto featureId = feature->id();
+        if (featureId->typeId() != type)
+            return false;
+        if (!requiredIdPartsEqual(featureId->keyValuePairs(), queryIdParts, primaryIdComposition))
+            return false;
+        result = feature;
+        return true;
+    });
+    return result;
+}
+
+model_ptr<Feature>
+TileFeatureLayer::find(const std::string_view& type, const KeyValuePairs& queryIdParts) const
+{
+    return find(type, castToKeyValueView(queryIdParts));
+}
+
+std::vector<model_ptr<Feature>> TileFeatureLayer::findIntersecting(Point const& minPoint, Point const& maxPoint) const
+{
+    using Box = Impl::SpatialIndex::Box;
+    auto featureBox = [this](size_t featureIndex)
     {
-        auto feature = resolveFeature(*simfil::ModelNode::Ptr::make(shared_from_this(), it->featureAddr_));
-        if (feature->id()->typeId() == type) {
-            auto featureIdParts = stripOptionalIdParts(feature->id()->keyValuePairs(), primaryIdComposition);
-            // Ensure that ID parts match exactly, not just the hash.
-            if (featureIdParts.size() != queryIdPartsStripped.size()) {
-                ++it;
+        Box result;
+        if (auto bbox = at(featureIndex)->bbox())
+            result = {bbox->p1.x, bbox->p1.y, bbox->p2.x, bbox->p2.y};
+        return result;
+    };
+
+    Box query{
+        std::min(minPoint.x, maxPoint.x),
+        std::min(minPoint.y, maxPoint.y),
+        std::max(minPoint.x, maxPoint.x),
+        std::max(minPoint.y, maxPoint.y)};
+    std::vector<model_ptr<Feature>> result;
+
+    // The geometry of a writable layer may still change, so it is not indexed.
+    if (!isReadOnly()) {
+        for (size_t i = 0; i < size(); ++i) {
+            if (featureBox(i).intersects(query))
+                result.emplace_back(at(i));
+        }
+        return result;
+    }
+
+    if (!impl_->spatialIndexIsValid_.load(std::memory_order_acquire)) {
+        std::lock_guard lock(impl_->spatialIndexMutex_);
+        if (!impl_->spatialIndexIsValid_.load(std::memory_order_relaxed)) {
+            std::vector<Box> featureBoxes;
+            featureBoxes.reserve(size());
+            for (size_t i = 0; i < size(); ++i)
+                featureBoxes.emplace_back(featureBox(i));
+            impl_->spatialIndex_.build(featureBoxes);
+            impl_->spatialIndexIsValid_.store(true, std::memory_order_release);
+        }
+    }
+    for (auto featureIndex : impl_->spatialIndex_.search(query))
+        result.emplace_back(at(featureIndex));
+    return result;
+}
+
+std::optional<TileFeatureLayer::AttributeFilter> TileFeatureLayer::AttributeFilter::fromQuery(std::string_view const& query)
+{
+    static std::regex const comparison(
+        R"(^\s*properties\.([A-Za-z_][A-Za-z0-9_]*)\s*(<=|>=|==|<|>)\s*([-+]?(?:[0-9]+\.?[0-9]*|\.[0-9]+)(?:[eE][-+]?[0-9]+)?)\s*$)");
+    std::cmatch match;
+    if (!std::regex_match(query.data(), query.data() + query.size(), match, comparison))
+        return {};
+
+    AttributeFilter result;
+    result.name_ = match[1].str();
+    // The attribute layers are not an attribute.
+    if (result.name_ == "layer")
+        return {};
+    auto op = match[2].str();
+    if (op == "<")
+        result.op_ = Op::Less;
+    else if (op == "<=")
+        result.op_ = Op::LessEqual;
+    else if (op == ">")
+        result.op_ = Op::Greater;
+    else if (op == ">=")
+        result.op_ = Op::GreaterEqual;
+    else
+        result.op_ = Op::Equal;
+    result.value_ = std::strtod(match[3].str().c_str(), nullptr);
+    if (!std::isfinite(result.value_))
+        return {};
+    return result;
+}
+
+std::shared_ptr<const std::vector<TileFeatureLayer::AttributeColumn>>
+TileFeatureLayer::attributeColumns(std::string_view const& name) const
+{
+    auto build = [this, &name]() -> std::shared_ptr<const std::vector<AttributeColumn>>
+    {
+        struct Values
+        {
+            std::vector<uint32_t> features_;
+            std::vector<int64_t> ints_;
+            std::vector<double> doubles_;
+            bool hasFloats_ = false;
+        };
+        std::vector<std::pair<std::string_view, Values>> valuesPerType;
+        std::optional<simfil::StringId> nameId;
+
+        for (size_t i = 0; i < size(); ++i) {
+            auto feature = at(i);
+            auto properties = feature->get(StringPool::PropertiesStr);
+            if (!properties)
                 continue;
-            }
-            bool exactMatch = true;
-            for (auto i = 0; i < featureIdParts.size(); ++i) {
-                if (featureIdParts[i] != queryIdPartsStripped[i]) {
-                    exactMatch = false;
+
+            // Resolve the keys until the name is found, then compare ids.
+            simfil::ModelNode::Ptr value;
+            for (int64_t j = 0; j < properties->size(); ++j) {
+                auto key = properties->keyAt(j);
+                if (nameId ? key == *nameId : strings()->resolve(key) == name) {
+                    nameId = key;
+                    value = properties->at(j);
                     break;
                 }
             }
-            if (exactMatch)
-                return feature;
+            if (!value || value->type() == simfil::ValueType::Null)
+                continue;
+
+            auto scalar = value->value();
+            auto const* intValue = std::get_if<int64_t>(&scalar);
+            auto const* doubleValue = std::get_if<double>(&scalar);
+            if (!intValue && !doubleValue)
+                return nullptr;
+
+            auto typeId = feature->typeId();
+            auto typeValues = std::find_if(
+                valuesPerType.begin(),
+                valuesPerType.end(),
+                [&typeId](auto const& entry) { return entry.first == typeId; });
+            if (typeValues == valuesPerType.end())
+                typeValues = valuesPerType.emplace(valuesPerType.end(), typeId, Values{});
+
+            auto& values = typeValues->second;
+            values.features_.push_back(static_cast<uint32_t>(i));
+            values.ints_.push_back(intValue ? *intValue : 0);
+            values.doubles_.push_back(intValue ? static_cast<double>(*intValue) : *doubleValue);
+            values.hasFloats_ |= doubleValue != nullptr;
+        }
+
+        auto result = std::make_shared<std::vector<AttributeColumn>>();
+        result->reserve(valuesPerType.size());
+        for (auto& [typeId, values] : valuesPerType) {
+            auto& column = result->emplace_back();
+            column.typeId_ = std::string(typeId);
+            column.features_ = std::move(values.features_);
+            if (values.hasFloats_)
+                column.values_ = std::move(values.doubles_);
+            else
+                column.values_ = std::move(values.ints_);
+        }
+        return result;
+    };
+
+    if (!isReadOnly())
+        return build();
+
+    std::string key(name);
+    {
+        std::lock_guard lock(impl_->attributeColumnsMutex_);
+        if (auto it = impl_->attributeColumns_.find(key); it != impl_->attributeColumns_.end())
+            return it->second;
+    }
+    auto result = build();
+    std::lock_guard lock(impl_->attributeColumnsMutex_);
+    return impl_->attributeColumns_.try_emplace(std::move(key), std::move(result)).first->second;
+}
+
+std::optional<std::vector<model_ptr<Feature>>> TileFeatureLayer::findByAttribute(AttributeFilter const& filter) const
+{
+    auto columns = attributeColumns(filter.name_);
+    if (!columns)
+        return {};
+
+    // The values are compared as doubles in branch-free loops over the
+    // contiguous columns, which compilers vectorize. Strict comparisons
+    // are widened, since large integers are rounded when converted.
+    using Op = AttributeFilter::Op;
+    auto bound = filter.value_;
+    std::vector<uint8_t> passes;
+    auto scan = [&](auto const& values)
+    {
+        passes.resize(values.size());
+        auto const* in = values.data();
+        auto* out = passes.data();
+        auto const count = values.size();
+        switch (filter.op_) {
+        case Op::Less:
+        case Op::LessEqual:
+            for (size_t i = 0; i < count; ++i)
+                out[i] = static_cast<double>(in[i]) <= bound;
+            break;
+        case Op::Greater:
+        case Op::GreaterEqual:
+            for (size_t i = 0; i < count; ++i)
+                out[i] = static_cast<double>(in[i]) >= bound;
+            break;
+        case Op::Equal:
+            for (size_t i = 0; i < count; ++i)
+                out[i] = static_cast<double>(in[i]) == bound;
+            break;
+        }
+    };
+
+    std::vector<uint32_t> featureIndices;
+    for (auto const& column : *columns) {
+        std::visit(scan, column.values_);
+        for (size_t i = 0; i < passes.size(); ++i) {
+            if (passes[i])
+                featureIndices.push_back(column.features_[i]);
+        }
+    }
+    if (columns->size() > 1)
+        std::sort(featureIndices.begin(), featureIndices.end());
+
+    std::vector<model_ptr<Feature>> result;
+    result.reserve(featureIndices.size());
+    for (auto featureIndex : featureIndices)
+        result.emplace_back(at(featureIndex));
+    return result;
+}
+
+namespace
+{
+std::atomic<size_t> maxMemoizedQueries_ = TileFeatureLayer::DefaultMaxMemoizedQueries;
+}
+
+std::shared_ptr<const std::vector<uint32_t>> TileFeatureLayer::matchingFeatures(std::string_view const& query)
+{
+    auto build = [this, &query]()
+    {
+        // A numeric attribute comparison only evaluates the candidates of
+        // a scan over the attribute columns.
+        auto result = std::make_shared<std::vector<uint32_t>>();
+        if (auto filter = AttributeFilter::fromQuery(query)) {
+            if (auto candidates = findByAttribute(*filter)) {
+                for (auto const& feature : *candidates)
+                    if (queryMatches(feature->evaluateAll(query)))
+                        result->push_back(feature->addr().index());
+                result->shrink_to_fit();
+                return result;
+            }
         }
-        // Move to the next potential match.
-        ++it;
+        for (size_t i = 0; i < size(); ++i)
+            if (queryMatches(at(i)->evaluateAll(query)))
+                result->push_back(static_cast<uint32_t>(i));
+        result->shrink_to_fit();
+        return result;
+    };
+
+    auto maxQueries = maxMemoizedQueries_.load();
+    if (!isReadOnly() || maxQueries == 0)
+        return build();
+
+    std::string key(query);
+    {
+        std::lock_guard lock(impl_->matchingFeaturesMutex_);
+        if (auto it = impl_->matchingFeatures_.find(key); it != impl_->matchingFeatures_.end())
+            return it->second;
     }
+    // The query is evaluated without the lock, so that other queries are not blocked.
+    std::shared_ptr<const std::vector<uint32_t>> result = build();
+    std::lock_guard lock(impl_->matchingFeaturesMutex_);
+    if (impl_->matchingFeatures_.size() >= maxQueries)
+        impl_->matchingFeatures_.clear();
+    return impl_->matchingFeatures_.try_emplace(std::move(key), std::move(result)).first->second;
+}
 
-    return {};
+bool TileFeatureLayer::queryMatches(std::vector<simfil::Value> const& values)
+{
+    return std::any_of(
+        values.begin(),
+        values.end(),
+        [](simfil::Value const& value)
+        {
+            if (value.isa(simfil::ValueType::Null) || value.isa(simfil::ValueType::Undef))
+                return false;
+            if (value.isa(simfil::ValueType::Bool))
+                return value.as<simfil::ValueType::Bool>();
+            return true;
+        });
 }
 
-model_ptr<Feature>
-TileFeatureLayer::find(const std::string_view& type, const KeyValuePairs& queryIdParts) const
+size_t TileFeatureLayer::maxMemoizedQueries()
 {
-    return find(type, castToKeyValueView(queryIdParts));
+    return maxMemoizedQueries_;
+}
+
+void TileFeatureLayer::setMaxMemoizedQueries(size_t count)
+{
+    maxMemoizedQueries_ = count;
 }
 
 std::vector<IdPart> const& TileFeatureLayer::getPrimaryIdComposition(const std::string_view& typeId) const
@@ -861,53 +1908,90 @@ std::vector<IdPart> const& TileFeatureLayer::getPrimaryIdComposition(const std::
 
 void TileFeatureLayer::setStrings(std::shared_ptr<simfil::StringPool> const& newDict)
 {
+    checkWritable();
     auto oldDict = strings();
-    // Reset simfil environment and clear expression cache
-    impl_->expressionCache_.reset(makeEnvironment(newDict));
+    // Use the simfil environment and compiled expressions of the new string pool
+    impl_->expressionCache_ = sharedExpressionCache(newDict);
     ModelPool::setStrings(newDict);
     if (!oldDict || *newDict == *oldDict)
         return;
 
     // Re-map old string IDs to new string IDs
-    for (auto& attr : impl_->attributes_) {
+    for (auto& attr : impl_->attributes()) {
         if (auto resolvedName = oldDict->resolve(attr.name_)) {
             attr.name_ = newDict->emplace(*resolvedName);
         }
     }
-    for (auto& validity : impl_->validities_) {
-        if (auto resolvedName = strings()->resolve(validity.referencedGeomName_)) {
+    for (auto& validity : impl_->validities()) {
+        if (auto resolvedName = oldDict->resolve(validity.referencedGeomName_)) {
             validity.referencedGeomName_ = newDict->emplace(*resolvedName);
         }
     }
-    for (auto& fid : impl_->featureIds_) {
+    for (auto& fid : impl_->featureIds()) {
         if (auto resolvedName = oldDict->resolve(fid.typeId_)) {
             fid.typeId_ = newDict->emplace(*resolvedName);
         }
     }
-    for (auto& rel : impl_->relations_) {
+    for (auto& rel : impl_->relations()) {
         if (auto resolvedName = oldDict->resolve(rel.name_)) {
             rel.name_ = newDict->emplace(*resolvedName);
         }
     }
 }
 
+TileFeatureLayer::ClonedNodes::ClonedNodes(bool withSourceDataReferences)
+    : withSourceDataReferences_(withSourceDataReferences)
+{
+}
+
+std::optional<simfil::ModelNodeAddress>
+TileFeatureLayer::ClonedNodes::find(simfil::ModelNodeAddress const& other) const
+{
+    if (other.column() >= columns_.size())
+        return {};
+    auto const& column = columns_[other.column()];
+    if (other.index() >= column.size() || !column[other.index()])
+        return {};
+    return column[other.index()];
+}
+
+void TileFeatureLayer::ClonedNodes::insert(simfil::ModelNodeAddress const& other, simfil::ModelNodeAddress const& cloned)
+{
+    if (other.column() >= columns_.size())
+        columns_.resize(other.column() + 1);
+    auto& column = columns_[other.column()];
+    if (other.index() >= column.size())
+        column.resize(other.index() + 1);
+    column[other.index()] = cloned;
+}
+
+bool TileFeatureLayer::ClonedNodes::withSourceDataReferences() const
+{
+    return withSourceDataReferences_;
+}
+
 simfil::ModelNode::Ptr TileFeatureLayer::clone(
-    std::unordered_map<uint32_t, simfil::ModelNode::Ptr>& cache,
+    ClonedNodes& cache,
     const TileFeatureLayer::Ptr& otherLayer,
     const simfil::ModelNode::Ptr& otherNode)
 {
-    auto it = cache.find(otherNode->addr().value_);
-    if (it != cache.end()) {
-        return it->second;
-    }
+    checkWritable();
+    if (auto cloned = cache.find(otherNode->addr()))
+        return ModelNode::Ptr::make(shared_from_this(), *cloned);
 
+    // The node is remembered before its children are cloned,
+    // so that a child which refers back to it finds the clone.
     using namespace simfil;
-    ModelNode::Ptr& newCacheNode = cache[otherNode->addr().value_];
+    ModelNode::Ptr newCacheNode;
+    auto remember = [&](auto const& newNode) {
+        newCacheNode = newNode;
+        cache.insert(otherNode->addr(), newCacheNode->addr());
+    };
     switch (otherNode->addr().column()) {
     case Objects: {
         auto resolved = otherLayer->resolveObject(otherNode);
         auto newNode = newObject(resolved->size());
-        newCacheNode = newNode;
+        remember(newNode);
         for (auto [key, value] : resolved->fields()) {
             if (auto keyStr = otherLayer->strings()->resolve(key)) {
                 newNode->addField(*keyStr, clone(cache, otherLayer, value));
@@ -918,31 +2002,52 @@ simfil::ModelNode::Ptr TileFeatureLayer::clone(
     case Arrays: {
         auto resolved = otherLayer->resolveArray(otherNode);
         auto newNode = newArray(resolved->size());
-        newCacheNode = newNode;
+        remember(newNode);
         for (auto value : *resolved) {
             newNode->append(clone(cache, otherLayer, value));
         }
         break;
     }
     case ColumnId::Geometries: {
-        // TODO: This implementation is not great, because it does not respect
-        //  Geometry views - it just converts every Geometry to a self-contained one.
-        // TODO: Clone geometry name.
+        // TODO: This implementation does not respect Geometry views -
+        //  it converts every view to a self-contained Geometry.
         auto resolved = otherLayer->resolveGeometry(*otherNode);
         auto newNode = newGeometry(resolved->geomType(), resolved->numPoints());
-        newCacheNode = newNode;
-        resolved->forEachPoint(
-            [&newNode](auto&& pt)
-            {
-                newNode->append(pt);
-                return true;
-            });
+        remember(newNode);
+        auto const& otherData = *resolved->geomData_;
+        if (!otherData.isView_ && otherData.detail_.geom_.vertexArray_ >= 0) {
+            // Copy the vertex offsets as they are, with their bounds.
+            otherLayer->computeGeometryBoxes();
+            auto const& otherGeom = otherData.detail_.geom_;
+            auto& otherPoints = otherLayer->impl_->pointBuffers();
+            auto& points = impl_->pointBuffers();
+            auto& newGeom = newNode->geomData_->detail_.geom_;
+            auto numVertices = otherPoints.size(otherGeom.vertexArray_);
+            newGeom.vertexArray_ = points.new_array(numVertices);
+            newGeom.offset_ = otherGeom.offset_;
+            newGeom.boundsMin_ = otherGeom.boundsMin_;
+            newGeom.boundsMax_ = otherGeom.boundsMax_;
+            for (size_t i = 0; i < numVertices; ++i)
+                points.emplace_back(newGeom.vertexArray_, otherPoints.at(otherGeom.vertexArray_, i));
+        }
+        else {
+            resolved->forEachPoint(
+                [&newNode](auto&& pt)
+                {
+                    newNode->append(pt);
+                    return true;
+                });
+        }
+        if (auto name = resolved->name())
+            newNode->setName(*name);
+        if (auto refs = resolved->sourceDataReferences(); refs && cache.withSourceDataReferences())
+            newNode->setSourceDataReferences(clone(cache, otherLayer, refs));
         break;
     }
     case ColumnId::GeometryCollections: {
         auto resolved = otherLayer->resolveGeometryCollection(*otherNode);
         auto newNode = newGeometryCollection(resolved->numGeometries());
-        newCacheNode = newNode;
+        remember(newNode);
         resolved->forEachGeometry(
             [this, &newNode, &cache, &otherLayer](auto&& geom)
             {
@@ -952,26 +2057,26 @@ simfil::ModelNode::Ptr TileFeatureLayer::clone(
         break;
     }
     case Int64: {
-        otherLayer->resolve(*otherNode, Lambda([this, &newCacheNode](auto&& resolved){
+        otherLayer->resolve(*otherNode, Lambda([this, &remember](auto&& resolved){
             auto value = std::get<int64_t>(resolved.value());
             auto newNode = newValue(value);
-            newCacheNode = newNode;
+            remember(newNode);
         }));
         break;
     }
     case Double: {
-        otherLayer->resolve(*otherNode, Lambda([this, &newCacheNode](auto&& resolved){
+        otherLayer->resolve(*otherNode, Lambda([this, &remember](auto&& resolved){
             auto value = std::get<double>(resolved.value());
             auto newNode = newValue(value);
-            newCacheNode = newNode;
+            remember(newNode);
         }));
         break;
     }
     case String: {
-        otherLayer->resolve(*otherNode, Lambda([this, &newCacheNode](auto&& resolved){
+        otherLayer->resolve(*otherNode, Lambda([this, &remember](auto&& resolved){
             auto value = std::get<std::string_view>(resolved.value());
             auto newNode = newValue(value);
-            newCacheNode = newNode;
+            remember(newNode);
         }));
         break;
     }
@@ -982,13 +2087,13 @@ simfil::ModelNode::Ptr TileFeatureLayer::clone(
     case ColumnId::FeatureIds: {
         auto resolved = otherLayer->resolveFeatureId(*otherNode);
         auto newNode = newFeatureId(resolved->typeId(), resolved->keyValuePairs());
-        newCacheNode = newNode;
+        remember(newNode);
         break;
     }
     case ColumnId::Attributes: {
         auto resolved = otherLayer->resolveAttribute(*otherNode);
         auto newNode = newAttribute(resolved->name());
-        newCacheNode = newNode;
+        remember(newNode);
         if (resolved->validityOrNull()) {
             newNode->setValidity(
                 resolveValidityCollection(*clone(cache, otherLayer, resolved->validityOrNull())));
@@ -999,12 +2104,14 @@ simfil::ModelNode::Ptr TileFeatureLayer::clone(
                 newNode->addField(key, clone(cache, otherLayer, value));
                 return true;
             });
+        if (auto refs = resolved->sourceDataReferences(); refs && cache.withSourceDataReferences())
+            newNode->setSourceDataReferences(clone(cache, otherLayer, refs));
         break;
     }
     case ColumnId::Validities: {
         auto resolved = otherLayer->resolveValidity(*otherNode);
         auto newNode = newValidity();
-        newCacheNode = newNode;
+        remember(newNode);
         newNode->setDirection(resolved->direction());
         switch (resolved->geometryDescriptionType()) {
         case Validity::NoGeometry:
@@ -1034,7 +2141,7 @@ simfil::ModelNode::Ptr TileFeatureLayer::clone(
     case ColumnId::ValidityCollections: {
         auto resolved = otherLayer->resolveValidityCollection(*otherNode);
         auto newNode = newValidityCollection(resolved->size());
-        newCacheNode = newNode;
+        remember(newNode);
         for (auto value : *resolved) {
             newNode->append(resolveValidity(*clone(cache, otherLayer, value)));
         }
@@ -1043,7 +2150,7 @@ simfil::ModelNode::Ptr TileFeatureLayer::clone(
     case ColumnId::AttributeLayers: {
         auto resolved = otherLayer->resolveAttributeLayer(*otherNode);
         auto newNode = newAttributeLayer(resolved->size());
-        newCacheNode = newNode;
+        remember(newNode);
         for (auto [key, value] : resolved->fields()) {
             if (auto keyStr = otherLayer->strings()->resolve(key)) {
                 newNode->addField(*keyStr, clone(cache, otherLayer, value));
@@ -1054,7 +2161,7 @@ simfil::ModelNode::Ptr TileFeatureLayer::clone(
     case ColumnId::AttributeLayerLists: {
         auto resolved = otherLayer->resolveAttributeLayerList(*otherNode);
         auto newNode = newAttributeLayers(resolved->size());
-        newCacheNode = newNode;
+        remember(newNode);
         for (auto [key, value] : resolved->fields()) {
             if (auto keyStr = otherLayer->strings()->resolve(key)) {
                 newNode->addField(*keyStr, clone(cache, otherLayer, value));
@@ -1075,16 +2182,18 @@ simfil::ModelNode::Ptr TileFeatureLayer::clone(
             newNode->setTargetValidity(resolveValidityCollection(
                 *clone(cache, otherLayer, resolved->targetValidityOrNull())));
         }
-        newCacheNode = newNode;
+        if (auto refs = resolved->sourceDataReferences(); refs && cache.withSourceDataReferences())
+            newNode->setSourceDataReferences(clone(cache, otherLayer, refs));
+        remember(newNode);
         break;
     }
     case ColumnId::SourceDataReferenceCollections: {
         auto resolved = otherLayer->resolveSourceDataReferenceCollection(*otherNode);
         auto items = std::vector<QualifiedSourceDataReference>(
-            otherLayer->impl_->sourceDataReferences_.begin() + resolved->offset_,
-            otherLayer->impl_->sourceDataReferences_.begin() + resolved->offset_ + resolved->size_);
-        newCacheNode = newSourceDataReferenceCollection({items.begin(), items.end()});
-        break;
+            otherLayer->impl_->sourceDataReferences().begin() + resolved->offset_,
+            otherLayer->impl_->sourceDataReferences().begin() + resolved->offset_ + resolved->size_);
+        // Not remembered, as the address of a collection packs its offset and size.
+        return newSourceDataReferenceCollection({items.begin(), items.end()});
     }
     case ColumnId::Points:
     case ColumnId::Mesh:
@@ -1097,20 +2206,32 @@ simfil::ModelNode::Ptr TileFeatureLayer::clone(
     case ColumnId::ValidityPoints:
         raiseFmt("Encountered unexpected column type {} in clone().", otherNode->addr().column());
     default: {
-        newCacheNode = ModelNode::Ptr::make(shared_from_this(), otherNode->addr());
+        // Inline values are encoded in the address itself.
+        return ModelNode::Ptr::make(shared_from_this(), otherNode->addr());
     }
     }
-    cache.insert({otherNode->addr().value_, newCacheNode});
     return newCacheNode;
 }
 
 void TileFeatureLayer::clone(
-    std::unordered_map<uint32_t, simfil::ModelNode::Ptr>& clonedModelNodes,
+    ClonedNodes& clonedModelNodes,
     const TileFeatureLayer::Ptr& otherLayer,
     const Feature& otherFeature,
     const std::string_view& type,
     KeyValueViewPairs idParts)
 {
+    clone(clonedModelNodes, otherLayer, otherFeature, type, std::move(idParts), Projection{});
+}
+
+void TileFeatureLayer::clone(
+    ClonedNodes& clonedModelNodes,
+    const TileFeatureLayer::Ptr& otherLayer,
+    const Feature& otherFeature,
+    const std::string_view& type,
+    KeyValueViewPairs idParts,
+    Projection const& projection)
+{
+    checkWritable();
     auto cloneTarget = find(type, idParts);
     if (!cloneTarget) {
         // Remove tile ID prefix from idParts to create a new feature.
@@ -1139,16 +2260,19 @@ void TileFeatureLayer::clone(
 
     // Adopt attribute layers
     if (auto attrLayers = otherFeature.attributeLayersOrNull()) {
-        auto baseAttrLayers = cloneTarget->attributeLayers();
+        model_ptr<AttributeLayerList> baseAttrLayers;
         for (auto const& [key, value] : attrLayers->fields()) {
-            if (auto keyStr = otherLayer->strings()->resolve(key)) {
-                baseAttrLayers->addField(*keyStr, lookupOrClone(value));
-            }
+            auto keyStr = otherLayer->strings()->resolve(key);
+            if (!keyStr || !projection.keepsAttributeLayer(*keyStr))
+                continue;
+            if (!baseAttrLayers)
+                baseAttrLayers = cloneTarget->attributeLayers();
+            baseAttrLayers->addField(*keyStr, lookupOrClone(value));
         }
     }
 
     // Adopt geometries
-    if (auto geom = otherFeature.geomOrNull()) {
+    if (auto geom = otherFeature.geomOrNull(); geom && projection.geometry_) {
         auto baseGeom = cloneTarget->geom();
         geom->forEachGeometry(
             [this, &baseGeom, &lookupOrClone](auto&& geomElement)
@@ -1169,11 +2293,474 @@ void TileFeatureLayer::clone(
                 return true;
             });
     }
+
+    // Adopt source data references
+    if (auto refs = otherFeature.sourceDataReferences(); refs && clonedModelNodes.withSourceDataReferences())
+        cloneTarget->setSourceDataReferences(lookupOrClone(refs));
+}
+
+TileFeatureLayer::Projection TileFeatureLayer::Projection::fromJson(nlohmann::json const& j)
+{
+    Projection result;
+    if (!j.is_object())
+        raise("A projection must be a JSON object.");
+    auto readFilter = [&j](char const* key, std::vector<std::string>& include, std::vector<std::string>& exclude) {
+        if (!j.contains(key))
+            return;
+        auto const& filter = j[key];
+        if (!filter.is_object())
+            raiseFmt("The {} of a projection must be an object with include and exclude lists.", key);
+        if (filter.contains("include"))
+            include = filter["include"].get<std::vector<std::string>>();
+        if (filter.contains("exclude"))
+            exclude = filter["exclude"].get<std::vector<std::string>>();
+    };
+    readFilter("featureTypes", result.includeFeatureTypes_, result.excludeFeatureTypes_);
+    readFilter("attributeLayers", result.includeAttributeLayers_, result.excludeAttributeLayers_);
+    result.geometry_ = j.value("geometry", true);
+    result.sourceDataReferences_ = j.value("sourceDataReferences", true);
+    return result;
+}
+
+bool TileFeatureLayer::Projection::keepsAll() const
+{
+    return includeFeatureTypes_.empty() && excludeFeatureTypes_.empty() &&
+        includeAttributeLayers_.empty() && excludeAttributeLayers_.empty() &&
+        geometry_ && sourceDataReferences_;
+}
+
+namespace
+{
+bool filterKeeps(
+    std::vector<std::string> const& include,
+    std::vector<std::string> const& exclude,
+    std::string_view const& name)
+{
+    if (!include.empty() && std::find(include.begin(), include.end(), name) == include.end())
+        return false;
+    return std::find(exclude.begin(), exclude.end(), name) == exclude.end();
+}
+}  // namespace
+
+bool TileFeatureLayer::Projection::keepsFeatureType(std::string_view const& typeId) const
+{
+    return filterKeeps(includeFeatureTypes_, excludeFeatureTypes_, typeId);
+}
+
+bool TileFeatureLayer::Projection::keepsAttributeLayer(std::string_view const& name) const
+{
+    return filterKeeps(includeAttributeLayers_, excludeAttributeLayers_, name);
+}
+
+TileFeatureLayer::Ptr TileFeatureLayer::projected(Projection const& projection)
+{
+    auto self = std::static_pointer_cast<TileFeatureLayer>(shared_from_this());
+    if (projection.keepsAll())
+        return self;
+
+    auto result = emptyCopy();
+    ClonedNodes clonedNodes(projection.sourceDataReferences_);
+    for (auto const& feature : *this) {
+        auto id = feature->id();
+        if (!projection.keepsFeatureType(id->typeId()))
+            continue;
+        result->clone(clonedNodes, self, *feature, id->typeId(), id->keyValuePairs(), projection);
+    }
+    return result;
+}
+
+TileFeatureLayer::Ptr TileFeatureLayer::delta(Ptr const& base)
+{
+    auto self = std::static_pointer_cast<TileFeatureLayer>(shared_from_this());
+    auto result = emptyCopy();
+
+    // Features are compared by their JSON bytes, which are written without a DOM.
+    ClonedNodes clonedNodes(true);
+    std::string featureJson;
+    std::string baseFeatureJson;
+    for (auto const& feature : *this) {
+        auto id = feature->id();
+        if (auto baseFeature = base->find(id->typeId(), id->keyValuePairs())) {
+            featureJson.clear();
+            baseFeatureJson.clear();
+            mapget::writeJson(*feature, *strings(), featureJson);
+            mapget::writeJson(*baseFeature, *base->strings(), baseFeatureJson);
+            if (featureJson == baseFeatureJson)
+                continue;
+        }
+        result->clone(clonedNodes, self, *feature, id->typeId(), id->keyValuePairs());
+    }
+
+    // Removed features are listed with their type and id parts, so that
+    // applyDelta() matches them with find(), like the changed features.
+    auto removedFeatures = nlohmann::json::array();
+    for (auto const& baseFeature : *base) {
+        auto id = baseFeature->id();
+        if (find(id->typeId(), id->keyValuePairs()))
+            continue;
+        auto idParts = nlohmann::json::array();
+        for (auto const& [key, value] : id->keyValuePairs()) {
+            if (auto intValue = std::get_if<int64_t>(&value))
+                idParts.push_back(nlohmann::json::array({std::string(key), *intValue}));
+            else
+                idParts.push_back(nlohmann::json::array({std::string(key), std::string(std::get<std::string_view>(value))}));
+        }
+        removedFeatures.push_back({{"typeId", std::string(id->typeId())}, {"idParts", idParts}});
+    }
+
+    result->setInfo("delta", {
+        {"baseTimestamp", std::chrono::duration_cast<std::chrono::microseconds>(base->timestamp().time_since_epoch()).count()},
+        {"removedFeatures", removedFeatures}});
+    return result;
+}
+
+TileFeatureLayer::Ptr TileFeatureLayer::unchangedDelta(std::chrono::time_point<std::chrono::system_clock> baseTimestamp)
+{
+    auto result = emptyCopy();
+    result->setInfo("delta", {
+        {"baseTimestamp", std::chrono::duration_cast<std::chrono::microseconds>(baseTimestamp.time_since_epoch()).count()},
+        {"removedFeatures", nlohmann::json::array()}});
+    return result;
+}
+
+bool TileFeatureLayer::isDelta() const
+{
+    return info_.contains("delta");
+}
+
+std::optional<std::chrono::time_point<std::chrono::system_clock>> TileFeatureLayer::deltaBaseTimestamp() const
+{
+    if (!isDelta())
+        return {};
+    return std::chrono::time_point<std::chrono::system_clock>(
+        std::chrono::microseconds(info_.at("delta").at("baseTimestamp").get<int64_t>()));
+}
+
+TileFeatureLayer::Ptr TileFeatureLayer::applyDelta(Ptr const& delta)
+{
+    if (!delta->isDelta() || *delta->deltaBaseTimestamp() != timestamp() || MapTileKey(*delta) != MapTileKey(*this))
+        raise("The delta was not computed against this layer.");
+
+    auto self = std::static_pointer_cast<TileFeatureLayer>(shared_from_this());
+    auto result = delta->emptyCopy();
+    result->info_.erase("delta");
+
+    // The removed features are looked up by their id parts, by their index in this layer.
+    std::unordered_set<size_t> removedFeatures;
+    for (auto const& removed : delta->info_["delta"]["removedFeatures"]) {
+        KeyValuePairs idParts;
+        for (auto const& part : removed.at("idParts")) {
+            auto const& value = part.at(1);
+            if (value.is_number_integer())
+                idParts.emplace_back(part.at(0).get<std::string>(), value.get<int64_t>());
+            else
+                idParts.emplace_back(part.at(0).get<std::string>(), value.get<std::string>());
+        }
+        if (auto feature = find(removed.at("typeId").get<std::string>(), idParts))
+            removedFeatures.insert(feature->addr().index());
+    }
+
+    ClonedNodes unchangedNodes(true);
+    for (auto const& feature : *this) {
+        auto id = feature->id();
+        if (removedFeatures.contains(feature->addr().index()) || delta->find(id->typeId(), id->keyValuePairs()))
+            continue;
+        result->clone(unchangedNodes, self, *feature, id->typeId(), id->keyValuePairs());
+    }
+
+    ClonedNodes changedNodes(true);
+    for (auto const& feature : *delta) {
+        auto id = feature->id();
+        result->clone(changedNodes, delta, *feature, id->typeId(), id->keyValuePairs());
+    }
+    return result;
+}
+
+std::vector<TileFeatureLayer::Ptr> TileFeatureLayer::newShards(size_t numShards)
+{
+    std::vector<Ptr> result;
+    result.reserve(numShards);
+    for (size_t i = 0; i < numShards; ++i)
+        result.emplace_back(emptyCopy(std::make_shared<StringPool>(nodeId())));
+    return result;
+}
+
+void TileFeatureLayer::merge(std::vector<Ptr> const& shards)
+{
+    checkWritable();
+    auto hint = sizeHint();
+    for (auto const& shard : shards) {
+        auto shardHint = shard->sizeHint();
+        hint.features_ += shardHint.features_;
+        hint.attributes_ += shardHint.attributes_;
+        hint.attributeLayers_ += shardHint.attributeLayers_;
+        hint.geometries_ += shardHint.geometries_;
+        hint.validities_ += shardHint.validities_;
+        hint.relations_ += shardHint.relations_;
+        hint.sourceDataReferences_ += shardHint.sourceDataReferences_;
+    }
+    reserve(hint);
+
+    // The shards describe the same tile, so their source data references are kept.
+    for (auto const& shard : shards) {
+        ClonedNodes shardNodes(true);
+        for (auto const& feature : *shard) {
+            auto id = feature->id();
+            clone(shardNodes, shard, *feature, id->typeId(), id->keyValuePairs());
+        }
+    }
+}
+
+void TileFeatureLayer::sendChunk()
+{
+    if (!cancellation_ || impl_->numChunkedFeatures_ == size())
+        return;
+    auto sink = cancellation_->chunkSink();
+    if (!sink)
+        return;
+    sink(nextChunk(false));
+}
+
+void TileFeatureLayer::sendFinalChunk()
+{
+    if (!cancellation_ || impl_->numChunks_ == 0)
+        return;
+    if (auto sink = cancellation_->chunkSink())
+        sink(nextChunk(true));
+}
+
+TileFeatureLayer::Ptr TileFeatureLayer::nextChunk(bool isFinal)
+{
+    auto self = std::static_pointer_cast<TileFeatureLayer>(shared_from_this());
+    auto result = emptyCopy();
+    result->setInfo("chunk", {{"index", impl_->numChunks_}, {"final", isFinal}});
+    ClonedNodes chunkNodes(true);
+    for (auto i = impl_->numChunkedFeatures_; i < size(); ++i) {
+        auto feature = at(i);
+        auto id = feature->id();
+        result->clone(chunkNodes, self, *feature, id->typeId(), id->keyValuePairs());
+    }
+    impl_->numChunkedFeatures_ = size();
+    ++impl_->numChunks_;
+    return result;
+}
+
+std::optional<uint32_t> TileFeatureLayer::chunkIndex() const
+{
+    if (!info_.contains("chunk"))
+        return {};
+    return info_.at("chunk").at("index").get<uint32_t>();
+}
+
+bool TileFeatureLayer::isFinalChunk() const
+{
+    return info_.contains("chunk") && info_.at("chunk").value("final", false);
+}
+
+TileFeatureLayer::Ptr TileFeatureLayer::emptyCopy(std::shared_ptr<simfil::StringPool> const& strings)
+{
+    auto result = std::make_shared<TileFeatureLayer>(
+        tileId(), nodeId(), mapId(), layerInfo(), strings ? strings : this->strings());
+    result->setMapVersion(mapVersion());
+    result->setTimestamp(timestamp());
+    result->setTtl(ttl());
+    result->setError(error());
+    auto infoJson = info();
+    for (auto const& item : infoJson.items())
+        result->setInfo(item.key(), item.value());
+    if (auto idPrefix = getIdPrefix()) {
+        KeyValueViewPairs prefix;
+        for (auto const& [key, value] : idPrefix->fields()) {
+            auto keyStr = strings()->resolve(key);
+            std::visit(
+                [&prefix, &keyStr](auto&& v)
+                {
+                    if constexpr (!std::is_same_v<std::decay_t<decltype(v)>, std::monostate> && !std::is_same_v<std::decay_t<decltype(v)>, double>) {
+                        prefix.emplace_back(*keyStr, v);
+                    }
+                },
+                value->value());
+        }
+        result->setIdPrefix(prefix);
+    }
+    return result;
+}
+
+void TileFeatureLayer::writeContent(std::ostream& outputStream)
+{
+    impl_->write(outputStream, GeometryEncoding::Raw);
+    ModelPool::write(outputStream);
+}
+
+void TileFeatureLayer::addMemoryUsage(nlohmann::json& usage)
+{
+    // Columns which were not decoded yet are counted in encoded-columns.
+    auto isDecoded = [this](Impl::EncodedColumn column)
+    { return impl_->encodedColumnStates_[static_cast<size_t>(column)].decoded_.load(std::memory_order_acquire); };
+    auto columnBytes = [&isDecoded](Impl::EncodedColumn column, auto const& values) -> uint64_t
+    {
+        if (!isDecoded(column))
+            return 0;
+        return values.capacity() * sizeof(typename std::decay_t<decltype(values)>::value_type);
+    };
+    using Column = Impl::EncodedColumn;
+    usage["features"] = columnBytes(Column::Features, impl_->features_);
+    usage["attributes"] = columnBytes(Column::Attributes, impl_->attributes_);
+    usage["validities"] = columnBytes(Column::Validities, impl_->validities_);
+    usage["feature-ids"] = columnBytes(Column::FeatureIds, impl_->featureIds_);
+    usage["attribute-layers"] = columnBytes(Column::AttributeLayers, impl_->attrLayers_);
+    usage["attribute-layer-lists"] = columnBytes(Column::AttributeLayerLists, impl_->attrLayerLists_);
+    usage["relations"] = columnBytes(Column::Relations, impl_->relations_);
+    usage["geometries"] = columnBytes(Column::Geometries, impl_->geom_);
+    usage["source-data-references"] = columnBytes(Column::SourceDataReferences, impl_->sourceDataReferences_);
+    usage["feature-hash-index"] = columnBytes(Column::FeatureHashIndex, impl_->featureHashIndex_);
+    usage["encoded-columns"] = impl_->encodedColumns_.capacity();
+
+    // The vertices of the geometries which are not views.
+    uint64_t pointBufferBytes = 0;
+    if (isDecoded(Column::Geometries) && isDecoded(Column::PointBuffers)) {
+        for (auto const& geom : impl_->geom_) {
+            if (!geom.isView_ && geom.detail_.geom_.vertexArray_ >= 0)
+                pointBufferBytes += impl_->pointBuffers_.size(geom.detail_.geom_.vertexArray_) * sizeof(glm::fvec3);
+        }
+    }
+    usage["point-buffers"] = pointBufferBytes;
+
+    // Lookup indexes, which are built on demand.
+    uint64_t indexBytes = 0;
+    if (impl_->featureHashTableIsValid_.load(std::memory_order_acquire)) {
+        auto const& table = impl_->featureHashTable_;
+        indexBytes += table.control_.capacity() + table.slots_.capacity() * sizeof(Impl::FeatureAddrWithIdHash);
+    }
+    if (impl_->spatialIndexIsValid_.load(std::memory_order_acquire)) {
+        auto const& index = impl_->spatialIndex_;
+        indexBytes += index.boxes_.capacity() * sizeof(Impl::SpatialIndex::Box) +
+            index.indices_.capacity() * sizeof(uint32_t) + index.levelEnds_.capacity() * sizeof(size_t);
+    }
+    {
+        std::lock_guard lock(impl_->lineLengthsMutex_);
+        for (auto const& [geometry, lengths] : impl_->lineLengths_)
+            indexBytes += lengths->capacity() * sizeof(double);
+    }
+    {
+        std::lock_guard lock(impl_->attributeColumnsMutex_);
+        for (auto const& [name, columns] : impl_->attributeColumns_) {
+            if (!columns)
+                continue;
+            for (auto const& column : *columns) {
+                indexBytes += column.features_.capacity() * sizeof(uint32_t);
+                std::visit([&indexBytes](auto const& values)
+                    { indexBytes += values.capacity() * sizeof(values[0]); }, column.values_);
+            }
+        }
+    }
+    {
+        std::lock_guard lock(impl_->matchingFeaturesMutex_);
+        for (auto const& [query, features] : impl_->matchingFeatures_)
+            indexBytes += query.capacity() + features->capacity() * sizeof(uint32_t);
+    }
+    usage["indexes"] = indexBytes;
+
+    usage["simfil-pool"] = serializedSize([this](std::ostream& stream) { ModelPool::write(stream); });
+    usage["string-pool"] = serializedSize([this](std::ostream& stream) { strings()->write(stream, 0); });
 }
 
 Geometry::Storage& TileFeatureLayer::vertexBufferStorage()
 {
-    return impl_->pointBuffers_;
+    return impl_->pointBuffers();
+}
+
+void TileFeatureLayer::computeGeometryBoxes() const
+{
+    if (impl_->geometryBoxesAreValid_.load(std::memory_order_acquire))
+        return;
+    std::call_once(impl_->geometryBoxesOnce_, [this] {
+        auto& pointBuffers = impl_->pointBuffers();
+        for (auto& geom : impl_->geom()) {
+            if (geom.isView_ || geom.detail_.geom_.vertexArray_ < 0)
+                continue;
+            auto& geomData = geom.detail_.geom_;
+            auto numVertices = pointBuffers.size(geomData.vertexArray_);
+            for (size_t i = 0; i < numVertices; ++i) {
+                auto const& vertex = pointBuffers.at(geomData.vertexArray_, i);
+                geomData.boundsMin_ = glm::min(geomData.boundsMin_, vertex);
+                geomData.boundsMax_ = glm::max(geomData.boundsMax_, vertex);
+            }
+        }
+        impl_->geometryBoxesAreValid_.store(true, std::memory_order_release);
+    });
+}
+
+std::shared_ptr<const std::vector<double>> TileFeatureLayer::lineLengths(Geometry const& geom) const
+{
+    if (!isReadOnly())
+        return std::make_shared<const std::vector<double>>(geom.computeCumulativeLengths());
+
+    auto index = geom.addr().index();
+    {
+        std::lock_guard lock(impl_->lineLengthsMutex_);
+        if (auto it = impl_->lineLengths_.find(index); it != impl_->lineLengths_.end())
+            return it->second;
+    }
+    auto result = std::make_shared<const std::vector<double>>(geom.computeCumulativeLengths());
+    std::lock_guard lock(impl_->lineLengthsMutex_);
+    return impl_->lineLengths_.try_emplace(index, std::move(result)).first->second;
+}
+
+TileFeatureLayer::Ptr TileFeatureLayer::simplified(double tolerance)
+{
+    std::stringstream stream;
+    write(stream);
+    auto result = std::make_shared<TileFeatureLayer>(
+        stream,
+        [this](auto&&, auto&&) { return layerInfo(); },
+        [this](auto&&) { return strings(); });
+
+    // Views refer to vertex ranges of their base geometries, so the
+    // base geometries of views are kept as they are.
+    auto& geometries = result->impl_->geom();
+    std::vector<bool> isViewBase(geometries.size(), false);
+    for (auto const& geom : geometries) {
+        auto const* base = &geom;
+        for (size_t depth = 0; base->isView_ && depth < geometries.size(); ++depth) {
+            auto baseIndex = base->detail_.view_.baseGeometry_.index();
+            if (baseIndex >= geometries.size())
+                break;
+            isViewBase[baseIndex] = true;
+            base = &geometries[baseIndex];
+        }
+    }
+
+    // The simplified vertex offsets are written to new point buffers in
+    // geometry order. The first point of a geometry is its offset, which
+    // is the origin of its vertex offsets.
+    auto& otherPoints = impl_->pointBuffers();
+    result->impl_->fillPointBuffers([&](Geometry::Storage& points) {
+        std::vector<glm::fvec3> vertices;
+        for (size_t i = 0; i < geometries.size(); ++i) {
+            auto& geom = geometries[i];
+            if (geom.isView_ || geom.detail_.geom_.vertexArray_ < 0)
+                continue;
+            auto& geomData = geom.detail_.geom_;
+            auto numVertices = otherPoints.size(geomData.vertexArray_);
+            vertices.assign(1, glm::fvec3{0.f});
+            for (size_t v = 0; v < numVertices; ++v)
+                vertices.push_back(otherPoints.at(geomData.vertexArray_, v));
+
+            std::vector<size_t> kept;
+            if (!isViewBase[i] && (geom.type_ == GeomType::Line || geom.type_ == GeomType::Polygon))
+                kept = simplifiedVertexIndices(vertices, tolerance);
+            if (kept.size() < (geom.type_ == GeomType::Polygon ? 3 : 2)) {
+                kept.resize(vertices.size());
+                std::iota(kept.begin(), kept.end(), 0);
+            }
+
+            geomData.vertexArray_ = points.new_array(kept.size() - 1);
+            for (auto k = kept.begin() + 1; k != kept.end(); ++k)
+                points.emplace_back(geomData.vertexArray_, vertices[*k]);
+        }
+    });
+    return result;
 }
 
 model_ptr<Feature> TileFeatureLayer::find(const std::string_view& featureId) const
@@ -8,6 +8,7 @@
 #include "validity.h"
 #include "pointnode.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <stdexcept>
@@ -256,12 +257,37 @@ void Geometry::append(Point const& p)
         geomData.offset_ = p;
         return;
     }
-    storage_->emplace_back(
-        geomData.vertexArray_,
-        glm::fvec3{
-            static_cast<float>(p.x - geomData.offset_.x),
-            static_cast<float>(p.y - geomData.offset_.y),
-            static_cast<float>(p.z - geomData.offset_.z)});
+    auto vertex = glm::fvec3{
+        static_cast<float>(p.x - geomData.offset_.x),
+        static_cast<float>(p.y - geomData.offset_.y),
+        static_cast<float>(p.z - geomData.offset_.z)};
+    storage_->emplace_back(geomData.vertexArray_, vertex);
+    geomData.boundsMin_ = glm::min(geomData.boundsMin_, vertex);
+    geomData.boundsMax_ = glm::max(geomData.boundsMax_, vertex);
+}
+
+std::optional<BBox> Geometry::bbox() const
+{
+    // A view covers a part of its base geometry, so its points are visited.
+    if (geomData_->isView_) {
+        std::optional<BBox> result;
+        forEachPoint([&result](auto&& point) {
+            if (!result)
+                result = BBox{point, point};
+            result->p1 = glm::min(result->p1, point);
+            result->p2 = glm::max(result->p2, point);
+            return true;
+        });
+        return result;
+    }
+
+    auto const& geomData = geomData_->detail_.geom_;
+    if (geomData.vertexArray_ < 0)
+        return {};
+    model().computeGeometryBoxes();
+    return BBox{
+        geomData.offset_ + glm::dvec3(geomData.boundsMin_),
+        geomData.offset_ + glm::dvec3(geomData.boundsMax_)};
 }
 
 GeomType Geometry::geomType() const {
@@ -304,15 +330,29 @@ void Geometry::setName(const std::string_view& newName)
 
 double Geometry::length() const
 {
+    auto lengths = cumulativeLengths();
+    return lengths->empty() ? 0. : lengths->back();
+}
+
+std::shared_ptr<const std::vector<double>> Geometry::cumulativeLengths() const
+{
+    return model().lineLengths(*this);
+}
+
+std::vector<double> Geometry::computeCumulativeLengths() const
+{
+    std::vector<double> result;
+    result.reserve(numPoints());
     auto length = 0.0;
-    if (numPoints() < 2) return length;
-    for (auto i = 0; i < numPoints()-1; ++i)
-    {
-        auto pos = pointAt(i);
-        auto posNext = pointAt(i+1);
-        length += pos.geographicDistanceTo(posNext);
-    }
-    return length;
+    std::optional<Point> previous;
+    forEachPoint([&](auto&& point) {
+        if (previous)
+            length += previous->geographicDistanceTo(point);
+        result.push_back(length);
+        previous = point;
+        return true;
+    });
+    return result;
 }
 
 std::vector<Point> Geometry::pointsFromPositionBound(const Point& start, const std::optional<Point>& end) const
@@ -380,39 +420,47 @@ std::vector<Point> Geometry::pointsFromPositionBound(const Point& start, const s
 }
 
 std::vector<Point> Geometry::pointsFromLengthBound(double start, std::optional<double> end) const
+{
+    return pointsFromLengthBound(start, end, *cumulativeLengths());
+}
+
+std::vector<Point> Geometry::pointsFromLengthBound(
+    double start,
+    std::optional<double> end,
+    std::vector<double> const& cumulativeLengths) const
 {
     // Make sure that end comes after start.
     if (end && *end < start) {
         std::swap(start, *end);
     }
-    int32_t innerIndexStart = 0, innerIndexEnd = 0;
-    auto startPos = pointAt(innerIndexStart), endPos = pointAt(innerIndexEnd);
-    double coveredLength = 0;
-    bool startReached = false;
-    for (auto i = 0; i < numPoints()-1; ++i)
+
+    // Find the first segment [i, i+1] which ends at or after the offset, and
+    // interpolate on it. Offsets beyond the end of the line yield point 0.
+    auto findOffset = [&](double offset, size_t firstSegment) -> std::optional<std::pair<size_t, Point>>
     {
+        if (cumulativeLengths.size() < 2 || firstSegment + 1 >= cumulativeLengths.size())
+            return {};
+        auto it = std::lower_bound(cumulativeLengths.begin() + static_cast<std::ptrdiff_t>(firstSegment) + 1, cumulativeLengths.end(), offset);
+        if (it == cumulativeLengths.end())
+            return {};
+        auto i = static_cast<size_t>(it - cumulativeLengths.begin()) - 1;
         auto pos = pointAt(i);
         auto posNext = pointAt(i+1);
         auto dist = pos.geographicDistanceTo(posNext);
-        coveredLength += dist;
-
-        if (!startReached && start <= coveredLength)
-        {
-            innerIndexStart = i;
-            // Note: We use a fast linear calculation here instead of proper geodesic trigonometry.
-            // I calculated, that the approximate error for this is roughly 0.001% at the equator, so
-            // the error on a 1km long line would be about 1 centimeter.
-            auto lerp = static_cast<double>(dist - (coveredLength - start)) / static_cast<double>(dist);
-            startPos = pos + (posNext - pos) * lerp;
-            startReached = true;
-            if (!end)
-                break;
-        }
-        if (startReached && end && *end <= coveredLength) {
-            innerIndexEnd = i;
-            auto lerp = static_cast<double>(dist - (coveredLength - *end)) / static_cast<double>(dist);
-            endPos = pos + (posNext - pos) * lerp;
-            break;
+        // Note: We use a fast linear calculation here instead of proper geodesic trigonometry.
+        // I calculated, that the approximate error for this is roughly 0.001% at the equator, so
+        // the error on a 1km long line would be about 1 centimeter.
+        auto lerp = static_cast<double>(dist - (cumulativeLengths[i+1] - offset)) / static_cast<double>(dist);
+        return std::pair{i, Point(pos + (posNext - pos) * lerp)};
+    };
+
+    size_t innerIndexStart = 0, innerIndexEnd = 0;
+    auto startPos = pointAt(innerIndexStart), endPos = pointAt(innerIndexEnd);
+    if (auto startOffset = findOffset(start, 0)) {
+        std::tie(innerIndexStart, startPos) = *startOffset;
+        if (end) {
+            if (auto endOffset = findOffset(*end, innerIndexStart))
+                std::tie(innerIndexEnd, endPos) = *endOffset;
         }
     }
 
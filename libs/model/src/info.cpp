@@ -2,6 +2,7 @@
 #include "stream.h"
 #include "mapget/log.h"
 
+#include <algorithm>
 #include <tuple>
 #include <random>
 #include <sstream>
@@ -151,7 +152,7 @@ bool IdPart::idPartsMatchComposition(
     }
 
     if (requireCompositionEnd) {
-        while (compositionIter != candidateComposition.end()) {
+        for (; compositionIter != candidateComposition.end(); ++compositionIter) {
             if (!compositionIter->isOptional_)
                 return false;
         }
@@ -310,6 +311,49 @@ nlohmann::json Coverage::toJson() const
     return nlohmann::json{{"min", min_.value_}, {"max", max_.value_}, {"filled", filled_}};
 }
 
+bool Coverage::covers(TileId const& tileId) const
+{
+    // Get the range of coverage tiles which overlap the tile along one axis.
+    auto zoomLevel = min_.z();
+    auto overlap = [&tileId, zoomLevel](uint32_t coord) -> std::pair<uint32_t, uint32_t>
+    {
+        if (tileId.z() >= zoomLevel)
+            return {coord >> (tileId.z() - zoomLevel), coord >> (tileId.z() - zoomLevel)};
+        auto shift = zoomLevel - tileId.z();
+        return {coord << shift, ((coord + 1) << shift) - 1};
+    };
+    auto [minX, maxX] = overlap(tileId.x());
+    auto [minY, maxY] = overlap(tileId.y());
+    minX = std::max<uint32_t>(minX, min_.x());
+    maxX = std::min<uint32_t>(maxX, max_.x());
+    minY = std::max<uint32_t>(minY, min_.y());
+    maxY = std::min<uint32_t>(maxY, max_.y());
+    if (minX > maxX || minY > maxY)
+        return false;
+    if (filled_.empty())
+        return true;
+
+    auto width = max_.x() - min_.x() + 1;
+    for (auto y = minY; y <= maxY; ++y) {
+        for (auto x = minX; x <= maxX; ++x) {
+            auto bit = (y - min_.y()) * width + (x - min_.x());
+            if (bit < filled_.size() && filled_[bit])
+                return true;
+        }
+    }
+    return false;
+}
+
+bool LayerInfo::covers(TileId const& tileId) const
+{
+    if (coverage_.empty())
+        return true;
+    return std::any_of(
+        coverage_.begin(),
+        coverage_.end(),
+        [&tileId](auto const& coverage) { return coverage.covers(tileId); });
+}
+
 std::shared_ptr<LayerInfo> LayerInfo::fromJson(const nlohmann::json& j, std::string const& layerId)
 {
     try {
@@ -445,7 +489,8 @@ DataSourceInfo DataSourceInfo::fromJson(const nlohmann::json& j)
             j.value("addOn", false),
             j.value("extraJsonAttachment", nlohmann::json::object()),
             Version::fromJson(
-                j.value("protocolVersion", TileLayerStream::CurrentProtocolVersion.toJson()))
+                j.value("protocolVersion", TileLayerStream::CurrentProtocolVersion.toJson())),
+            j.value("maxBatchSize", 1)
         };
     }
     catch (nlohmann::json::out_of_range const& e) {
@@ -467,12 +512,14 @@ nlohmann::json DataSourceInfo::toJson() const
         {"maxParallelJobs", maxParallelJobs_},
         {"addOn", isAddOn_},
         {"extraJsonAttachment", extraJsonAttachment_},
-        {"protocolVersion", protocolVersion_.toJson()}};
+        {"protocolVersion", protocolVersion_.toJson()},
+        {"maxBatchSize", maxBatchSize_}};
 }
 
 KeyValueViewPairs castToKeyValueView(const KeyValuePairs& kvp)
 {
     KeyValueViewPairs kvpView;
+    kvpView.reserve(kvp.size());
     for (auto const& [k, v] : kvp) {
         std::visit([&kvpView, &k](auto&& vv){
             if constexpr (std::is_same_v<std::decay_t<decltype(vv)>, std::string>)
@@ -487,6 +534,7 @@ KeyValueViewPairs castToKeyValueView(const KeyValuePairs& kvp)
 KeyValuePairs castToKeyValue(const KeyValueViewPairs& kvpView)
 {
     KeyValuePairs kvp;
+    kvp.reserve(kvpView.size());
     for (auto const& [k, v] : kvpView) {
         std::visit([&kvp, &k](auto&& vv){
             if constexpr (std::is_same_v<std::decay_t<decltype(vv)>, std::string_view>)
@@ -501,6 +549,7 @@ KeyValuePairs castToKeyValue(const KeyValueViewPairs& kvpView)
 KeyValueViewPairs castToKeyValueView(const KeyValuePairVec& kvp)
 {
     KeyValueViewPairs kvpView;
+    kvpView.reserve(kvp.size());
     for (auto const& [k, v] : kvp) {
         std::visit([&kvpView, &k](auto&& vv){
             if constexpr (std::is_same_v<std::decay_t<decltype(vv)>, std::string>)
@@ -0,0 +1,180 @@
+#include "jsonwriter.h"
+#include "stringpool.h"
+
+#include "fmt/format.h"
+
+#include <cmath>
+#include <iterator>
+#include <string_view>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+namespace mapget
+{
+
+namespace
+{
+
+void writeScalar(simfil::ScalarValueType const& value, std::string& out)
+{
+    std::visit(
+        [&out](auto&& v)
+        {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, bool>) {
+                out.append(v ? "true" : "false");
+            }
+            else if constexpr (std::is_integral_v<T>) {
+                fmt::format_to(std::back_inserter(out), "{}", v);
+            }
+            else if constexpr (std::is_floating_point_v<T>) {
+                // Like nlohmann::json: Non-finite numbers are null, and
+                // integral numbers keep a fraction, so they stay floats.
+                if (!std::isfinite(v)) {
+                    out.append("null");
+                    return;
+                }
+                auto begin = out.size();
+                fmt::format_to(std::back_inserter(out), "{}", v);
+                if (out.find_first_of(".e", begin) == std::string::npos)
+                    out.append(".0");
+            }
+            else if constexpr (std::is_convertible_v<T const&, std::string_view>) {
+                writeJsonString(v, out);
+            }
+            else {
+                out.append("null");
+            }
+        },
+        value);
+}
+
+void writeNode(simfil::ModelNode const& node, simfil::StringPool const& strings, std::string& out);
+
+void writeField(
+    simfil::StringId key,
+    simfil::ModelNode::Ptr const& value,
+    simfil::StringPool const& strings,
+    std::string& out,
+    bool& first)
+{
+    auto keyStr = strings.resolve(key);
+    if (!keyStr)
+        return;
+    if (!first)
+        out.push_back(',');
+    first = false;
+    writeJsonString(*keyStr, out);
+    out.push_back(':');
+    if (value)
+        writeNode(*value, strings, out);
+    else
+        out.append("null");
+}
+
+void writeNode(simfil::ModelNode const& node, simfil::StringPool const& strings, std::string& out)
+{
+    switch (node.type()) {
+    case simfil::ValueType::Object: {
+        out.push_back('{');
+        bool first = true;
+        for (int64_t i = 0; i < node.size(); ++i)
+            writeField(node.keyAt(i), node.at(i), strings, out, first);
+        out.push_back('}');
+        break;
+    }
+    case simfil::ValueType::Array: {
+        out.push_back('[');
+        for (int64_t i = 0; i < node.size(); ++i) {
+            if (i > 0)
+                out.push_back(',');
+            if (auto child = node.at(i))
+                writeNode(*child, strings, out);
+            else
+                out.append("null");
+        }
+        out.push_back(']');
+        break;
+    }
+    default:
+        writeScalar(node.value(), out);
+    }
+}
+
+// Write a feature as an RFC 7946 feature, see JsonLayout::GeoJson.
+void writeGeoJsonFeature(simfil::ModelNode const& feature, simfil::StringPool const& strings, std::string& out)
+{
+    simfil::ModelNode::Ptr id;
+    simfil::ModelNode::Ptr geometry;
+    simfil::ModelNode::Ptr properties;
+    std::vector<std::pair<simfil::StringId, simfil::ModelNode::Ptr>> otherMembers;
+    for (int64_t i = 0; i < feature.size(); ++i) {
+        auto key = feature.keyAt(i);
+        switch (key) {
+        case StringPool::TypeStr: break;
+        case StringPool::IdStr: id = feature.at(i); break;
+        case StringPool::GeometryStr: geometry = feature.at(i); break;
+        case StringPool::PropertiesStr: properties = feature.at(i); break;
+        default: otherMembers.emplace_back(key, feature.at(i));
+        }
+    }
+
+    out.append(R"({"type":"Feature","id":)");
+    if (id)
+        writeNode(*id, strings, out);
+    else
+        out.append("null");
+    out.append(R"(,"geometry":)");
+    if (geometry)
+        writeNode(*geometry, strings, out);
+    else
+        out.append("null");
+    out.append(R"(,"properties":{)");
+    bool first = true;
+    for (auto const& [key, value] : otherMembers)
+        writeField(key, value, strings, out, first);
+    if (properties && properties->type() == simfil::ValueType::Object) {
+        for (int64_t i = 0; i < properties->size(); ++i)
+            writeField(properties->keyAt(i), properties->at(i), strings, out, first);
+    }
+    out.append("}}");
+}
+
+}  // namespace
+
+void writeJsonString(std::string_view const& str, std::string& out)
+{
+    out.push_back('"');
+    for (auto c : str) {
+        switch (c) {
+        case '"': out.append("\\\""); break;
+        case '\\': out.append("\\\\"); break;
+        case '\b': out.append("\\b"); break;
+        case '\f': out.append("\\f"); break;
+        case '\n': out.append("\\n"); break;
+        case '\r': out.append("\\r"); break;
+        case '\t': out.append("\\t"); break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20)
+                fmt::format_to(std::back_inserter(out), "\\u{:04x}", static_cast<unsigned>(c));
+            else
+                out.push_back(c);
+        }
+    }
+    out.push_back('"');
+}
+
+void writeJson(
+    simfil::ModelNode const& node,
+    simfil::StringPool const& strings,
+    std::string& out,
+    JsonLayout layout)
+{
+    if (layout == JsonLayout::GeoJson)
+        writeGeoJsonFeature(node, strings, out);
+    else
+        writeNode(node, strings, out);
+}
+
+}
@@ -8,6 +8,8 @@
 #include "simfil/model/bitsery-traits.h"
 
 #include <istream>
+#include <ostream>
+#include <streambuf>
 #include <ranges>
 #include <string_view>
 #include <charconv>
@@ -28,7 +30,7 @@ MapTileKey::MapTileKey(const std::string& str)
 
     if (partsVec.size() < 4)
         raise(fmt::format("Invalid cache tile id: {}", str));
-    layer_ = nlohmann::json(std::string_view(&*partsVec[1].begin(), distance(partsVec[1]))).get<LayerType>();
+    layer_ = nlohmann::json(std::string_view(&*partsVec[0].begin(), distance(partsVec[0]))).get<LayerType>();
     mapId_ = std::string_view(&*partsVec[1].begin(), distance(partsVec[1]));
     layerId_ = std::string_view(&*partsVec[2].begin(), distance(partsVec[2]));
     std::from_chars(&*partsVec[3].begin(), &*partsVec[3].begin() + distance(partsVec[3]), tileId_.value_, 16);
@@ -52,6 +54,55 @@ std::string MapTileKey::toString() const
         tileId_.value_);
 }
 
+std::string MapTileKey::toBinary() const
+{
+    auto result = binaryLayerPrefix(mapId_, layerId_, layer_);
+    for (auto shift = 56; shift >= 0; shift -= 8)
+        result.push_back(static_cast<char>((tileId_.value_ >> shift) & 0xff));
+    return result;
+}
+
+MapTileKey MapTileKey::fromBinary(std::string_view const& bytes)
+{
+    // The tile id and layer type take the last nine bytes.
+    auto mapIdEnd = bytes.find('\0');
+    auto layerIdEnd = mapIdEnd == std::string_view::npos ? mapIdEnd : bytes.find('\0', mapIdEnd + 1);
+    if (layerIdEnd == std::string_view::npos || bytes.size() != layerIdEnd + 10)
+        raise(fmt::format("Invalid binary cache tile id of {} bytes.", bytes.size()));
+
+    MapTileKey result;
+    result.mapId_ = bytes.substr(0, mapIdEnd);
+    result.layerId_ = bytes.substr(mapIdEnd + 1, layerIdEnd - mapIdEnd - 1);
+    result.layer_ = static_cast<LayerType>(static_cast<uint8_t>(bytes[layerIdEnd + 1]));
+    for (auto i = layerIdEnd + 2; i < bytes.size(); ++i)
+        result.tileId_.value_ = (result.tileId_.value_ << 8) | static_cast<uint8_t>(bytes[i]);
+    return result;
+}
+
+std::string MapTileKey::binaryLayerPrefix(
+    std::string_view const& mapId,
+    std::string_view const& layerId,
+    LayerType layer)
+{
+    std::string result;
+    result.reserve(mapId.size() + layerId.size() + 11);
+    result.append(mapId).push_back('\0');
+    result.append(layerId).push_back('\0');
+    result.push_back(static_cast<char>(layer));
+    return result;
+}
+
+size_t MapTileKey::hash() const
+{
+    // Combine the component hashes as boost::hash_combine does.
+    auto result = std::hash<std::string_view>{}(mapId_);
+    auto combine = [&result](size_t h) { result ^= h + 0x9e3779b97f4a7c15ull + (result << 6) + (result >> 2); };
+    combine(std::hash<std::string_view>{}(layerId_));
+    combine(std::hash<uint64_t>{}(tileId_.value_));
+    combine(static_cast<size_t>(layer_));
+    return result;
+}
+
 bool MapTileKey::operator<(const MapTileKey& other) const
 {
     return std::tie(layer_, mapId_, layerId_, tileId_) <
@@ -69,6 +120,47 @@ bool MapTileKey::operator!=(const MapTileKey& other) const
     return !(*this == other);
 }
 
+CancellationToken::CancellationToken(std::function<bool()> check) : check_(std::move(check)) {}
+
+void CancellationToken::cancel()
+{
+    cancelled_ = true;
+}
+
+bool CancellationToken::isCancelled() const
+{
+    if (cancelled_ || (check_ && check_()))
+        return true;
+    auto deadline = deadline_.load(std::memory_order_relaxed);
+    return deadline != NoDeadline &&
+        std::chrono::steady_clock::now().time_since_epoch().count() >= deadline;
+}
+
+void CancellationToken::setDeadline(std::optional<std::chrono::steady_clock::time_point> deadline)
+{
+    deadline_ = deadline ? deadline->time_since_epoch().count() : NoDeadline;
+}
+
+std::optional<std::chrono::steady_clock::time_point> CancellationToken::deadline() const
+{
+    auto deadline = deadline_.load(std::memory_order_relaxed);
+    if (deadline == NoDeadline)
+        return {};
+    return std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(deadline));
+}
+
+void CancellationToken::setChunkSink(ChunkSink sink)
+{
+    std::lock_guard lock(chunkSinkMutex_);
+    chunkSink_ = std::move(sink);
+}
+
+CancellationToken::ChunkSink CancellationToken::chunkSink() const
+{
+    std::lock_guard lock(chunkSinkMutex_);
+    return chunkSink_;
+}
+
 TileLayer::TileLayer(
     const TileId& id,
     std::string nodeId,
@@ -163,6 +255,12 @@ std::optional<std::chrono::milliseconds> TileLayer::ttl() const {
     return ttl_;
 }
 
+std::optional<std::chrono::time_point<std::chrono::system_clock>> TileLayer::expiresAt() const {
+    if (!ttl_)
+        return {};
+    return timestamp_ + *ttl_;
+}
+
 Version TileLayer::mapVersion() const {
     return mapVersion_;
 }
@@ -172,41 +270,171 @@ nlohmann::json TileLayer::info() const {
 }
 
 void TileLayer::setTileId(const TileId& id) {
+    checkWritable();
     tileId_ = id;
 }
 
 void TileLayer::setNodeId(const std::string& id) {
+    checkWritable();
     nodeId_ = id;
 }
 
 void TileLayer::setMapId(const std::string& id) {
+    checkWritable();
     mapId_ = id;
 }
 
 void TileLayer::setLayerInfo(const std::shared_ptr<LayerInfo>& info) {
+    checkWritable();
     layerInfo_ = info;
 }
 
 void TileLayer::setError(const std::optional<std::string>& err) {
+    checkWritable();
     error_ = err;
 }
 
 void TileLayer::setTimestamp(const std::chrono::time_point<std::chrono::system_clock>& ts) {
+    checkWritable();
     timestamp_ = ts;
 }
 
 void TileLayer::setTtl(const std::optional<std::chrono::milliseconds>& timeToLive) {
+    checkWritable();
     ttl_ = timeToLive;
 }
 
 void TileLayer::setMapVersion(Version v) {
+    checkWritable();
     mapVersion_ = v;
 }
 
 void TileLayer::setInfo(std::string const& k, nlohmann::json const& v) {
+    checkWritable();
     info_[k] = v;
 }
 
+nlohmann::json TileLayer::memoryUsage()
+{
+    auto usage = nlohmann::json::object();
+    usage["info"] = info_.dump().size();
+    addMemoryUsage(usage);
+
+    uint64_t total = 0;
+    for (auto const& [column, bytes] : usage.items()) {
+        if (column != "string-pool")
+            total += bytes.get<uint64_t>();
+    }
+    usage["total"] = total;
+    return usage;
+}
+
+void TileLayer::recordMemoryUsage()
+{
+    setInfo("memory-usage", memoryUsage());
+}
+
+void TileLayer::addMemoryUsage(nlohmann::json&)
+{
+}
+
+uint64_t TileLayer::serializedSize(std::function<void(std::ostream&)> const& write)
+{
+    // Stream buffer which only counts the bytes that are written to it.
+    struct CountingStreamBuffer : public std::streambuf
+    {
+        uint64_t size_ = 0;
+
+        std::streamsize xsputn(const char*, std::streamsize n) override
+        {
+            size_ += n;
+            return n;
+        }
+
+        int_type overflow(int_type c) override
+        {
+            if (!traits_type::eq_int_type(c, traits_type::eof()))
+                ++size_;
+            return traits_type::not_eof(c);
+        }
+    };
+    CountingStreamBuffer buffer;
+    std::ostream stream(&buffer);
+    write(stream);
+    return buffer.size_;
+}
+
+std::string TileLayer::eTag()
+{
+    // Stream buffer which computes the FNV-1a hash of the bytes that are written to it.
+    struct HashingStreamBuffer : public std::streambuf
+    {
+        uint64_t hash_ = 14695981039346656037ULL;
+
+        std::streamsize xsputn(const char* s, std::streamsize n) override
+        {
+            for (std::streamsize i = 0; i < n; ++i) {
+                hash_ ^= static_cast<unsigned char>(s[i]);
+                hash_ *= 1099511628211ULL;
+            }
+            return n;
+        }
+
+        int_type overflow(int_type c) override
+        {
+            if (!traits_type::eq_int_type(c, traits_type::eof())) {
+                auto ch = traits_type::to_char_type(c);
+                xsputn(&ch, 1);
+            }
+            return traits_type::not_eof(c);
+        }
+    };
+    HashingStreamBuffer buffer;
+    std::ostream stream(&buffer);
+    {
+        bitsery::Serializer<bitsery::OutputStreamAdapter> s(stream);
+        s.text1b(mapId_, std::numeric_limits<uint32_t>::max());
+        s.text1b(layerInfo_->layerId_, std::numeric_limits<uint32_t>::max());
+        s.object(mapVersion_);
+        s.value8b(tileId_.value_);
+        s.text1b(nodeId_, std::numeric_limits<uint32_t>::max());
+        s.text1b(error_.value_or(""), std::numeric_limits<uint32_t>::max());
+    }
+    writeContent(stream);
+    stream.flush();
+    return fmt::format("\"{:016x}\"", buffer.hash_);
+}
+
+void TileLayer::writeContent(std::ostream&)
+{
+}
+
+bool TileLayer::isCancelled() const {
+    return cancellation_ && cancellation_->isCancelled();
+}
+
+CancellationToken::Ptr TileLayer::cancellation() const {
+    return cancellation_;
+}
+
+void TileLayer::setCancellation(CancellationToken::Ptr token) {
+    checkWritable();
+    cancellation_ = std::move(token);
+}
+
+void TileLayer::setReadOnly() {
+    readOnly_ = true;
+}
+
+bool TileLayer::isReadOnly() const {
+    return readOnly_;
+}
+
+void TileLayer::checkWritable() const {
+    if (readOnly_)
+        raiseFmt("Tile layer {} is read-only.", id().toString());
+}
+
 void TileLayer::write(std::ostream& outputStream)
 {
     using namespace std::chrono;
@@ -238,4 +466,9 @@ nlohmann::json TileLayer::toJson() const
     return {};
 }
 
+void TileLayer::writeJson(std::string& out, JsonLayout) const
+{
+    out.append(nlohmann::to_string(toJson()));
+}
+
 } // namespace mapget
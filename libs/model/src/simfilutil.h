@@ -1,7 +1,9 @@
 #pragma once
 
+#include <map>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <string_view>
 
 #include "simfil/environment.h"
@@ -33,28 +35,24 @@ std::unique_ptr<simfil::Environment> makeEnvironment(Args&& ...args)
 }
 
 /**
- * Simfil compiled expression cache.
+ * Simfil compiled expression cache. The compiled expressions are shared,
+ * so an expression is evaluated without holding the lock, and may outlive
+ * its cache entry. When the cache is full, it is cleared.
  */
 struct SimfilExpressionCache
 {
+    using SharedExpr = std::shared_ptr<const simfil::ExprPtr>;
+
+    /** Number of compiled expressions, at which the cache is cleared. */
+    static constexpr size_t MaxCachedExpressions = 1024;
+
     explicit SimfilExpressionCache(std::unique_ptr<simfil::Environment> env)
         : env_(std::move(env))
     {}
 
     auto eval(std::string_view query, std::function<std::vector<simfil::Value>(const simfil::Expr&)> evalFun)
     {
-        std::shared_lock s(mtx_);
-        auto iter = cache_.find(query);
-        if (iter != cache_.end())
-            return evalFun(*iter->second);
-        s.unlock();
-
-        std::unique_lock u(mtx_);
-        auto [newIter, _] = cache_.emplace(
-            std::string(query),
-            simfil::compile(*env_, query, false)
-        );
-        return evalFun(*newIter->second);
+        return evalFun(**compile(query));
     }
 
     std::vector<simfil::Value> eval(std::string_view query, simfil::ModelNode const& node)
@@ -66,7 +64,7 @@ struct SimfilExpressionCache
         return eval(query, evalFun);
     }
 
-    const simfil::ExprPtr& compile(std::string_view query)
+    SharedExpr compile(std::string_view query)
     {
         std::shared_lock s(mtx_);
         auto iter = cache_.find(query);
@@ -75,28 +73,57 @@ struct SimfilExpressionCache
         s.unlock();
 
         std::unique_lock u(mtx_);
+        iter = cache_.find(query);
+        if (iter != cache_.end())
+            return iter->second;
+        if (cache_.size() >= MaxCachedExpressions)
+            cache_.clear();
         auto [newIter, _] = cache_.emplace(
             std::string(query),
-            simfil::compile(*env_, query, false)
+            std::make_shared<const simfil::ExprPtr>(simfil::compile(*env_, query, false))
         );
         return newIter->second;
     }
 
-    void reset(std::unique_ptr<simfil::Environment> env)
-    {
-        std::unique_lock l(mtx_);
-        cache_.clear();
-        env_ = std::move(env);
-    }
-
     simfil::Environment& environment()
     {
         return *env_;
     }
 
     mutable std::shared_mutex mtx_;
-    std::map<std::string, simfil::ExprPtr, std::less<>> cache_;
+    std::map<std::string, SharedExpr, std::less<>> cache_;
     std::unique_ptr<simfil::Environment> env_;
 };
 
+/**
+ * Get the process-wide expression cache for a string pool. Compiled
+ * expressions refer to the strings of the pool of their environment,
+ * and the environment is otherwise the same for all layers. So all
+ * layers with the same string pool, i.e. the layers of one data source
+ * node, share their environment and their compiled expressions, and an
+ * expression is only compiled once for all of their tiles. A cache is
+ * released with the last layer which uses it.
+ */
+inline std::shared_ptr<SimfilExpressionCache> sharedExpressionCache(std::shared_ptr<simfil::StringPool> const& strings)
+{
+    static std::mutex mutex;
+    static std::map<simfil::StringPool const*, std::weak_ptr<SimfilExpressionCache>> caches;
+
+    std::lock_guard lock(mutex);
+    auto& cache = caches[strings.get()];
+    if (auto result = cache.lock())
+        return result;
+
+    // Drop the entries of released caches, whose pool address may be reused.
+    for (auto it = caches.begin(); it != caches.end();) {
+        if (it->second.expired() && it->first != strings.get())
+            it = caches.erase(it);
+        else
+            ++it;
+    }
+    auto result = std::make_shared<SimfilExpressionCache>(makeEnvironment(strings));
+    cache = result;
+    return result;
+}
+
 }
@@ -1,7 +1,13 @@
 #include "sourcedatalayer.h"
 
+#include <algorithm>
+#include <atomic>
 #include <limits>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_set>
+#include <utility>
 
 #include "bitsery/bitsery.h"
 #include "bitsery/adapter/stream.h"
@@ -22,6 +28,7 @@
 #include "simfil/environment.h"
 #include "simfil/model/nodes.h"
 
+using simfil::ModelNode;
 using simfil::ModelNodeAddress;
 
 namespace mapget
@@ -33,10 +40,64 @@ struct TileSourceDataLayer::Impl
     sfl::segmented_vector<SourceDataCompoundNode::Data, simfil::detail::ColumnPageSize / 4> compounds_;
 
     // Simfil compiled expression and environment
-    SimfilExpressionCache expressionCache_;
+    std::shared_ptr<SimfilExpressionCache> expressionCache_;
+
+    // Compounds sorted by the start of their address range, outer
+    // compounds first, with the running maximum of the range ends.
+    struct AddressIndex
+    {
+        std::vector<uint32_t> compounds_;
+        std::vector<uint64_t> starts_;
+        std::vector<uint64_t> ends_;
+        std::vector<uint64_t> maxEnds_;
+    };
+
+    // Index of a read-only layer, built on first use.
+    std::once_flag addressIndexOnce_;
+    std::atomic<bool> addressIndexIsValid_ = false;
+    AddressIndex addressIndex_;
+
+    // Address range [start, end) of a compound or requested address.
+    std::pair<uint64_t, uint64_t> addressRange(SourceDataAddress const& address) const
+    {
+        if (format_ == SourceDataAddressFormat::BitRange)
+            return {address.bitOffset(), static_cast<uint64_t>(address.bitOffset()) + address.bitSize()};
+        return {address.u64(), address.u64() + 1};
+    }
+
+    AddressIndex buildAddressIndex() const
+    {
+        AddressIndex index;
+        index.compounds_.resize(compounds_.size());
+        std::vector<std::pair<uint64_t, uint64_t>> ranges;
+        ranges.reserve(compounds_.size());
+        for (auto const& compound : compounds_)
+            ranges.emplace_back(addressRange(compound.sourceAddress_));
+        for (uint32_t i = 0; i < index.compounds_.size(); ++i)
+            index.compounds_[i] = i;
+        std::sort(
+            index.compounds_.begin(),
+            index.compounds_.end(),
+            [&ranges](uint32_t l, uint32_t r)
+            {
+                if (ranges[l].first != ranges[r].first)
+                    return ranges[l].first < ranges[r].first;
+                if (ranges[l].second != ranges[r].second)
+                    return ranges[l].second > ranges[r].second;
+                return l < r;
+            });
+        uint64_t maxEnd = 0;
+        for (auto compound : index.compounds_) {
+            maxEnd = std::max(maxEnd, ranges[compound].second);
+            index.starts_.push_back(ranges[compound].first);
+            index.ends_.push_back(ranges[compound].second);
+            index.maxEnds_.push_back(maxEnd);
+        }
+        return index;
+    }
 
     Impl(std::shared_ptr<simfil::StringPool> stringPool)
-        : expressionCache_(makeEnvironment(std::move(stringPool)))
+        : expressionCache_(sharedExpressionCache(stringPool))
         , format_(SourceDataAddressFormat::BitRange)
     {}
 
@@ -83,11 +144,12 @@ TileSourceDataLayer::~TileSourceDataLayer() = default;
 
 simfil::Environment& TileSourceDataLayer::evaluationEnvironment()
 {
-    return impl_->expressionCache_.environment();
+    return impl_->expressionCache_->environment();
 }
 
 model_ptr<SourceDataCompoundNode> TileSourceDataLayer::newCompound(size_t initialSize)
 {
+    checkWritable();
     auto index = impl_->compounds_.size();
     auto& data = impl_->compounds_.emplace_back(SourceDataCompoundNode::Data{});
 
@@ -127,20 +189,43 @@ nlohmann::json TileSourceDataLayer::toJson() const
     return ModelPool::toJson();
 }
 
+void TileSourceDataLayer::writeContent(std::ostream& outputStream)
+{
+    bitsery::Serializer<bitsery::OutputStreamAdapter> s(outputStream);
+    impl_->readWrite(s);
+    ModelPool::write(outputStream);
+}
+
+void TileSourceDataLayer::addMemoryUsage(nlohmann::json& usage)
+{
+    usage["compounds"] = impl_->compounds_.capacity() * sizeof(SourceDataCompoundNode::Data);
+    uint64_t indexBytes = 0;
+    if (impl_->addressIndexIsValid_.load(std::memory_order_acquire)) {
+        auto const& index = impl_->addressIndex_;
+        indexBytes = index.compounds_.capacity() * sizeof(uint32_t) +
+            (index.starts_.capacity() + index.ends_.capacity() + index.maxEnds_.capacity()) * sizeof(uint64_t);
+    }
+    usage["indexes"] = indexBytes;
+    usage["simfil-pool"] = serializedSize([this](std::ostream& stream) { ModelPool::write(stream); });
+    usage["string-pool"] = serializedSize([this](std::ostream& stream) { strings()->write(stream, 0); });
+}
+
 void TileSourceDataLayer::setStrings(std::shared_ptr<simfil::StringPool> const& newDict)
 {
+    checkWritable();
     for (auto& compound : impl_->compounds_) {
         if (auto str = strings()->resolve(compound.schemaName_))
             compound.schemaName_ = newDict->emplace(*str);
     }
 
-    impl_->expressionCache_.reset(makeEnvironment(newDict));
+    impl_->expressionCache_ = sharedExpressionCache(newDict);
 
     ModelPool::setStrings(newDict);
 }
 
 void TileSourceDataLayer::setSourceDataAddressFormat(SourceDataAddressFormat f)
 {
+    checkWritable();
     impl_->format_ = f;
 }
 
@@ -149,4 +234,138 @@ TileSourceDataLayer::SourceDataAddressFormat TileSourceDataLayer::sourceDataAddr
     return impl_->format_;
 }
 
+std::vector<model_ptr<SourceDataCompoundNode>> TileSourceDataLayer::compoundsForAddress(SourceDataAddress address) const
+{
+    Impl::AddressIndex scannedIndex;
+    Impl::AddressIndex const* index = &scannedIndex;
+    if (isReadOnly()) {
+        std::call_once(
+            impl_->addressIndexOnce_,
+            [this]()
+            {
+                impl_->addressIndex_ = impl_->buildAddressIndex();
+                impl_->addressIndexIsValid_.store(true, std::memory_order_release);
+            });
+        index = &impl_->addressIndex_;
+    }
+    else {
+        scannedIndex = impl_->buildAddressIndex();
+    }
+
+    auto [start, end] = impl_->addressRange(address);
+    std::vector<uint32_t> found;
+
+    // The outermost compounds which lie within the range. Outer
+    // compounds come first, so nested ones end before the last kept one.
+    auto first = std::lower_bound(index->starts_.begin(), index->starts_.end(), start) - index->starts_.begin();
+    uint64_t keptEnd = 0;
+    for (auto i = static_cast<size_t>(first); i < index->starts_.size() && index->starts_[i] <= end; ++i) {
+        if (index->ends_[i] > end || (!found.empty() && index->ends_[i] <= keptEnd))
+            continue;
+        found.push_back(index->compounds_[i]);
+        keptEnd = index->ends_[i];
+    }
+
+    // Otherwise the smallest compound which contains the range.
+    if (found.empty()) {
+        std::optional<size_t> smallest;
+        auto last = std::upper_bound(index->starts_.begin(), index->starts_.end(), start) - index->starts_.begin();
+        for (auto i = static_cast<size_t>(last); i > 0 && index->maxEnds_[i - 1] >= end; --i) {
+            if (index->ends_[i - 1] < end)
+                continue;
+            if (!smallest || index->ends_[i - 1] - index->starts_[i - 1] < index->ends_[*smallest] - index->starts_[*smallest])
+                smallest = i - 1;
+        }
+        if (smallest)
+            found.push_back(index->compounds_[*smallest]);
+    }
+
+    std::vector<model_ptr<SourceDataCompoundNode>> result;
+    result.reserve(found.size());
+    for (auto compound : found)
+        result.push_back(resolveCompound(*ModelNode::Ptr::make(shared_from_this(), ModelNodeAddress(Compound, compound))));
+    return result;
+}
+
+TileSourceDataLayer::Ptr TileSourceDataLayer::extract(std::vector<SourceDataAddress> const& addresses) const
+{
+    auto result = std::make_shared<TileSourceDataLayer>(tileId(), nodeId(), mapId(), layerInfo(), strings());
+    result->setMapVersion(mapVersion());
+    result->setTimestamp(timestamp());
+    result->setTtl(ttl());
+    result->setError(error());
+    result->setSourceDataAddressFormat(sourceDataAddressFormat());
+
+    std::unordered_set<uint32_t> extracted;
+    for (auto const& address : addresses) {
+        for (auto const& compound : compoundsForAddress(address)) {
+            if (extracted.insert(compound->addr().index()).second)
+                result->addRoot(result->cloneNode(*this, compound));
+        }
+    }
+    return result;
+}
+
+simfil::ModelNode::Ptr TileSourceDataLayer::cloneNode(TileSourceDataLayer const& otherLayer, simfil::ModelNode::Ptr const& otherNode)
+{
+    using namespace simfil;
+    switch (otherNode->addr().column()) {
+    case Compound: {
+        auto resolved = otherLayer.resolveCompound(*otherNode);
+        auto newNode = newCompound(resolved->size());
+        newNode->setSourceDataAddress(resolved->sourceDataAddress());
+        newNode->setSchemaName(resolved->schemaName());
+        if (auto object = std::as_const(*resolved).object()) {
+            auto newObject = newNode->object();
+            for (auto [key, value] : object->fields()) {
+                if (auto keyStr = otherLayer.strings()->resolve(key))
+                    newObject->addField(*keyStr, cloneNode(otherLayer, value));
+            }
+        }
+        return newNode;
+    }
+    case Objects: {
+        auto resolved = otherLayer.resolveObject(otherNode);
+        auto newNode = newObject(resolved->size());
+        for (auto [key, value] : resolved->fields()) {
+            if (auto keyStr = otherLayer.strings()->resolve(key))
+                newNode->addField(*keyStr, cloneNode(otherLayer, value));
+        }
+        return newNode;
+    }
+    case Arrays: {
+        auto resolved = otherLayer.resolveArray(otherNode);
+        auto newNode = newArray(resolved->size());
+        for (auto value : *resolved)
+            newNode->append(cloneNode(otherLayer, value));
+        return newNode;
+    }
+    case Int64: {
+        ModelNode::Ptr newNode;
+        otherLayer.resolve(*otherNode, Lambda([this, &newNode](auto&& resolved){
+            newNode = newValue(std::get<int64_t>(resolved.value()));
+        }));
+        return newNode;
+    }
+    case Double: {
+        ModelNode::Ptr newNode;
+        otherLayer.resolve(*otherNode, Lambda([this, &newNode](auto&& resolved){
+            newNode = newValue(std::get<double>(resolved.value()));
+        }));
+        return newNode;
+    }
+    case String: {
+        ModelNode::Ptr newNode;
+        otherLayer.resolve(*otherNode, Lambda([this, &newNode](auto&& resolved){
+            newNode = newValue(std::get<std::string_view>(resolved.value()));
+        }));
+        return newNode;
+    }
+    default: {
+        // Inline values are encoded in the address itself.
+        return ModelNode::Ptr::make(shared_from_this(), otherNode->addr());
+    }
+    }
+}
+
 }
@@ -5,16 +5,73 @@
 #include "simfil/model/nodes.h"
 
 #include <bitsery/bitsery.h>
+#include <bitsery/adapter/buffer.h>
 #include <bitsery/adapter/stream.h>
 #include <bitsery/traits/string.h>
 #include <memory>
 
+#include "binarylayer.h"
 #include "featurelayer.h"
 #include "sourcedatalayer.h"
 
 namespace mapget
 {
 
+namespace
+{
+
+/**
+ * Stream buffer over a span of bytes, so that a message can be
+ * parsed from the Reader's buffer without copying it.
+ */
+struct ByteSpanStreamBuffer : public std::streambuf
+{
+    ByteSpanStreamBuffer(char const* bytes, size_t size)
+    {
+        auto begin = const_cast<char*>(bytes);
+        setg(begin, begin, begin + size);
+    }
+};
+
+/** Version: 6B, Type: 1B, Size: 4B */
+constexpr size_t MessageHeaderSize = 6 + 1 + 4;
+
+/** Whether messages of the given type carry a serialized TileLayer. */
+bool isTileLayerMessage(TileLayerStream::MessageType type)
+{
+    return type == TileLayerStream::MessageType::TileFeatureLayer ||
+        type == TileLayerStream::MessageType::TileSourceDataLayer ||
+        type == TileLayerStream::MessageType::TileBinaryLayer;
+}
+
+/**
+ * Stream buffer which appends to a string, so that a Writer can
+ * serialize into a buffer which it reuses for all of its messages.
+ */
+struct StringAppendStreamBuffer : public std::streambuf
+{
+    explicit StringAppendStreamBuffer(std::string& target) : target_(target) {}
+
+protected:
+    std::streamsize xsputn(char const* bytes, std::streamsize count) override
+    {
+        target_.append(bytes, static_cast<size_t>(count));
+        return count;
+    }
+
+    int_type overflow(int_type c) override
+    {
+        if (!traits_type::eq_int_type(c, traits_type::eof()))
+            target_.push_back(traits_type::to_char_type(c));
+        return traits_type::not_eof(c);
+    }
+
+private:
+    std::string& target_;
+};
+
+}
+
 TileLayerStream::Reader::Reader(
     LayerInfoResolveFun layerInfoProvider,
     std::function<void(TileLayer::Ptr)> onParsedLayer,
@@ -29,62 +86,236 @@ TileLayerStream::Reader::Reader(
 
 void TileLayerStream::Reader::read(const std::string_view& bytes)
 {
-    buffer_ << bytes;
-    while (continueReading());
+    if (eos()) {
+        // Nothing is pending, so the messages are parsed from the given
+        // bytes. Only an incomplete message at their end is buffered.
+        if (buffer_.capacity() > MaxRetainedBufferBytes)
+            std::string().swap(buffer_);
+        size_t offset = 0;
+        while (continueReading(bytes, offset));
+        buffer_.assign(bytes.substr(offset));
+        readOffset_ = 0;
+        return;
+    }
+
+    // Release the parsed bytes, so that a long-lived stream does not
+    // grow the buffer. Only the unparsed rest of a message is moved.
+    if (readOffset_ > 0) {
+        buffer_.erase(0, readOffset_);
+        readOffset_ = 0;
+    }
+    buffer_.append(bytes);
+    while (continueReading(buffer_, readOffset_));
+}
+
+void TileLayerStream::Reader::read(std::shared_ptr<const std::string> const& bytes)
+{
+    if (!bytes)
+        return;
+    if (!eos()) {
+        read(std::string_view(*bytes));
+        return;
+    }
+
+    // The messages are parsed from the shared bytes, which
+    // binary layers keep alive instead of copying their payload.
+    sharedBytes_ = bytes;
+    try {
+        read(std::string_view(*bytes));
+    }
+    catch (...) {
+        sharedBytes_ = nullptr;
+        throw;
+    }
+    sharedBytes_ = nullptr;
 }
 
 bool TileLayerStream::Reader::eos()
 {
-    return (buffer_.tellp() - buffer_.tellg()) == 0;
+    return currentPhase_ == Phase::ReadHeader && readOffset_ == buffer_.size();
 }
 
-bool TileLayerStream::Reader::continueReading()
+size_t TileLayerStream::Reader::bufferCapacity() const
 {
+    return buffer_.capacity();
+}
+
+bool TileLayerStream::Reader::continueReading(std::string_view const& bytes, size_t& offset)
+{
+    auto numUnreadBytes = bytes.size() - offset;
     if (currentPhase_ == Phase::ReadHeader)
     {
-        if (readMessageHeader(buffer_, nextValueType_, nextValueSize_)) {
-            currentPhase_ = Phase::ReadValue;
-        }
-        else {
+        if (numUnreadBytes < MessageHeaderSize)
             return false;
-        }
+        ByteSpanStreamBuffer headerBytes(bytes.data() + offset, MessageHeaderSize);
+        std::istream headerStream(&headerBytes);
+        parseMessageHeader(headerStream, nextValueType_, nextValueSize_);
+        offset += MessageHeaderSize;
+        numUnreadBytes -= MessageHeaderSize;
+        currentPhase_ = Phase::ReadValue;
     }
 
-    bitsery::Deserializer<bitsery::InputStreamAdapter> s(buffer_);
-    auto numUnreadBytes = buffer_.tellp() - buffer_.tellg();
     if (numUnreadBytes < nextValueSize_)
         return false;
 
-    if (nextValueType_ == MessageType::TileFeatureLayer)
-    {
-        auto start = std::chrono::system_clock::now();
-        auto layer = std::make_shared<TileFeatureLayer>(buffer_, layerInfoProvider_, [this](auto&& nodeId) {
-            return stringPoolProvider_->getStringPool(nodeId);
-        });
+    // The message is parsed where it is in memory. Its bytes are
+    // consumed even if the parser does not read all of them.
+    auto message = bytes.substr(offset, nextValueSize_);
+    offset += nextValueSize_;
+    currentPhase_ = Phase::ReadHeader;
 
-        // Calculate duration.
-        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - start);
-        log().trace("Reading {} kB took {} ms.", nextValueSize_/1000, elapsed.count());
-        onParsedLayer_(layer);
-    }
-    else if (nextValueType_ == MessageType::TileSourceDataLayer)
+    // Only the given bytes may be shared, not the buffer of incomplete messages.
+    auto sharedBytes = sharedBytes_ && bytes.data() == sharedBytes_->data() ? sharedBytes_ : nullptr;
+    if (isTileLayerMessage(nextValueType_))
     {
-        auto layer = std::make_shared<TileSourceDataLayer>(buffer_, layerInfoProvider_, [this](auto&& nodeId) {
-            return stringPoolProvider_->getStringPool(nodeId);
-        });
-        onParsedLayer_(layer);
+        if (scheduleDecoding_) {
+            // Unshared bytes are copied, as the buffer is reused for the next messages.
+            if (!sharedBytes) {
+                sharedBytes = std::make_shared<const std::string>(message);
+                message = *sharedBytes;
+            }
+            decodeInParallel(nextValueType_, std::move(sharedBytes), message, nextSequenceNumber_++);
+        }
+        else
+            onParsedLayer_(parseLayer(nextValueType_, message, sharedBytes));
     }
     else if (nextValueType_ == MessageType::StringPool)
     {
+        ByteSpanStreamBuffer valueBytes(message.data(), message.size());
+        std::istream valueStream(&valueBytes);
         // Read the node id which identifies the string pool.
-        std::string stringPoolNodeId = StringPool::readDataSourceNodeId(buffer_);
-        stringPoolProvider_->getStringPool(stringPoolNodeId)->read(buffer_);
+        std::string stringPoolNodeId = StringPool::readDataSourceNodeId(valueStream);
+        stringPoolProvider_->getStringPool(stringPoolNodeId)->read(valueStream);
     }
-
-    currentPhase_ = Phase::ReadHeader;
     return true;
 }
 
+TileLayer::Ptr TileLayerStream::Reader::parseLayer(
+    MessageType type,
+    std::string_view const& message,
+    std::shared_ptr<const std::string> const& sharedBytes)
+{
+    ByteSpanStreamBuffer messageBytes(message.data(), message.size());
+    std::istream messageStream(&messageBytes);
+    auto getStringPool = [this](auto&& nodeId) { return stringPoolProvider_->getStringPool(nodeId); };
+    if (type == MessageType::TileSourceDataLayer)
+        return std::make_shared<TileSourceDataLayer>(messageStream, layerInfoProvider_, getStringPool);
+    if (type == MessageType::TileBinaryLayer) {
+        if (sharedBytes)
+            return std::make_shared<TileBinaryLayer>(messageStream, layerInfoProvider_, sharedBytes, message);
+        return std::make_shared<TileBinaryLayer>(messageStream, layerInfoProvider_);
+    }
+
+    auto start = std::chrono::system_clock::now();
+    auto layer = std::make_shared<TileFeatureLayer>(messageStream, layerInfoProvider_, getStringPool);
+
+    // Calculate duration.
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - start);
+    log().trace("Reading {} kB took {} ms.", message.size()/1000, elapsed.count());
+
+    if (deltaBases_ && layer->isDelta()) {
+        auto base = deltaBases_(MapTileKey(*layer));
+        if (base && base->timestamp() == *layer->deltaBaseTimestamp())
+            return base->applyDelta(layer);
+    }
+    return layer;
+}
+
+void TileLayerStream::Reader::setDeltaBases(DeltaBaseFun deltaBases)
+{
+    deltaBases_ = std::move(deltaBases);
+}
+
+TileLayerStream::Reader::~Reader()
+{
+    try {
+        wait();
+    }
+    catch (std::exception& e) {
+        log().error("Failed to decode a tile layer: {}", e.what());
+    }
+}
+
+void TileLayerStream::Reader::setParallelDecoding(ScheduleFun schedule, bool orderedResults)
+{
+    scheduleDecoding_ = std::move(schedule);
+    orderedResults_ = orderedResults;
+}
+
+void TileLayerStream::Reader::wait()
+{
+    std::unique_lock lock(decodingMutex_);
+    decodingDone_.wait(lock, [this] { return numPendingDecodings_ == 0; });
+    if (decodingError_)
+        std::rethrow_exception(std::exchange(decodingError_, nullptr));
+}
+
+void TileLayerStream::Reader::decodeInParallel(
+    MessageType type,
+    std::shared_ptr<const std::string> sharedBytes,
+    std::string_view const& message,
+    uint64_t sequenceNumber)
+{
+    {
+        std::unique_lock lock(decodingMutex_);
+        ++numPendingDecodings_;
+    }
+    scheduleDecoding_([this, type, sharedBytes = std::move(sharedBytes), message, sequenceNumber]
+    {
+        TileLayer::Ptr layer;
+        try {
+            layer = parseLayer(type, message, sharedBytes);
+        }
+        catch (...) {
+            std::unique_lock lock(decodingMutex_);
+            if (!decodingError_)
+                decodingError_ = std::current_exception();
+        }
+        deliverDecodedLayer(sequenceNumber, std::move(layer));
+    });
+}
+
+void TileLayerStream::Reader::deliverDecodedLayer(uint64_t sequenceNumber, TileLayer::Ptr layer)
+{
+    std::unique_lock lock(decodingMutex_);
+    auto deliver = [&, this](TileLayer::Ptr const& next)
+    {
+        if (!next)
+            return;
+        lock.unlock();
+        try {
+            onParsedLayer_(next);
+        }
+        catch (...) {
+            lock.lock();
+            if (!decodingError_)
+                decodingError_ = std::current_exception();
+            return;
+        }
+        lock.lock();
+    };
+
+    // Only one task calls onParsedLayer at a time. It also delivers
+    // the layers which other tasks decoded meanwhile.
+    decodedLayers_.emplace(sequenceNumber, std::move(layer));
+    if (!deliveringLayers_) {
+        deliveringLayers_ = true;
+        while (!decodedLayers_.empty()) {
+            auto it = decodedLayers_.begin();
+            if (orderedResults_ && it->first != nextDeliveredSequenceNumber_)
+                break;
+            auto next = std::move(it->second);
+            decodedLayers_.erase(it);
+            ++nextDeliveredSequenceNumber_;
+            deliver(next);
+        }
+        deliveringLayers_ = false;
+    }
+
+    --numPendingDecodings_;
+    decodingDone_.notify_all();
+}
+
 std::shared_ptr<TileLayerStream::StringPoolCache> TileLayerStream::Reader::stringPoolCache()
 {
     return stringPoolProvider_;
@@ -92,17 +323,19 @@ std::shared_ptr<TileLayerStream::StringPoolCache> TileLayerStream::Reader::strin
 
 bool TileLayerStream::Reader::readMessageHeader(std::stringstream & stream, MessageType& outType, uint32_t& outSize)
 {
-    bitsery::Deserializer<bitsery::InputStreamAdapter> s(stream);
     auto numUnreadBytes = stream.tellp() - stream.tellg();
-
-    // Version: 6B, Type: 1B, Size: 4B
-    constexpr auto headerSize = 6 + 1 + 4;
-    if (numUnreadBytes < headerSize)
+    if (numUnreadBytes < static_cast<std::streamoff>(MessageHeaderSize))
         return false;
+    parseMessageHeader(stream, outType, outSize);
+    return true;
+}
 
+void TileLayerStream::Reader::parseMessageHeader(std::istream& stream, MessageType& outType, uint32_t& outSize)
+{
+    bitsery::Deserializer<bitsery::InputStreamAdapter> s(stream);
     Version protocolVersion;
     s.object(protocolVersion);
-    if (!protocolVersion.isCompatible(CurrentProtocolVersion)) {
+    if (!isSupportedProtocolVersion(protocolVersion)) {
         raise(fmt::format(
             "Unable to read message with version {} using version {}.",
             protocolVersion.toString(),
@@ -110,15 +343,85 @@ bool TileLayerStream::Reader::readMessageHeader(std::stringstream & stream, Mess
     }
     s.value1b(outType);
     s.value4b(outSize);
+}
 
-    return true;
+bool TileLayerStream::isSupportedProtocolVersion(Version const& version)
+{
+    return version.major_ == CurrentProtocolVersion.major_ &&
+        version.minor_ >= MinimumProtocolVersion.minor_ &&
+        version.minor_ <= CurrentProtocolVersion.minor_;
+}
+
+TileLayerStream::TileLayerHeader TileLayerStream::Reader::readTileLayerHeader(std::string const& message)
+{
+    // The fields follow the message header, see TileLayer::write.
+    bitsery::Deserializer<bitsery::InputBufferAdapter<std::string>> s(message.begin(), message.size());
+    Version protocolVersion;
+    MessageType messageType = MessageType::None;
+    uint32_t messageSize = 0;
+    Version mapVersion;
+    int64_t timestamp = 0;
+    bool hasTtl = false;
+    TileLayerHeader result;
+    s.object(protocolVersion);
+    s.value1b(messageType);
+    s.value4b(messageSize);
+    s.text1b(result.mapId_, std::numeric_limits<uint32_t>::max());
+    s.text1b(result.layerId_, std::numeric_limits<uint32_t>::max());
+    s.object(mapVersion);
+    s.value8b(result.tileId_.value_);
+    s.text1b(result.nodeId_, std::numeric_limits<uint32_t>::max());
+    s.value8b(timestamp);
+    s.value1b(hasTtl);
+    if (hasTtl) {
+        int64_t ttl = 0;
+        s.value8b(ttl);
+        result.ttl_ = std::chrono::milliseconds(ttl);
+    }
+
+    if (s.adapter().error() != bitsery::ReaderError::NoError || !isTileLayerMessage(messageType) ||
+        messageSize != message.size() - MessageHeaderSize) {
+        raise("Could not read the header of a tile layer message.");
+    }
+    if (!isSupportedProtocolVersion(protocolVersion)) {
+        raiseFmt(
+            "Unable to read message with version {} using version {}.",
+            protocolVersion.toString(),
+            CurrentProtocolVersion.toString());
+    }
+    result.timestamp_ = std::chrono::time_point<std::chrono::system_clock>(std::chrono::microseconds(timestamp));
+    return result;
+}
+
+std::optional<std::chrono::time_point<std::chrono::system_clock>> TileLayerStream::TileLayerHeader::expiresAt() const
+{
+    if (!ttl_)
+        return {};
+    return timestamp_ + *ttl_;
 }
 
 TileLayerStream::Writer::Writer(
     std::function<void(std::string, MessageType)> onMessage,
     StringPoolOffsetMap& stringPoolOffsets,
     bool differentialStringUpdates)
-    : onMessage_(std::move(onMessage)),
+    : Writer(
+          [onMessage = std::move(onMessage)](std::string_view header, std::string_view body, MessageType msgType)
+          {
+              std::string message;
+              message.reserve(header.size() + body.size());
+              message.append(header).append(body);
+              onMessage(std::move(message), msgType);
+          },
+          stringPoolOffsets,
+          differentialStringUpdates)
+{
+}
+
+TileLayerStream::Writer::Writer(
+    MessageSlicesFun onMessageSlices,
+    StringPoolOffsetMap& stringPoolOffsets,
+    bool differentialStringUpdates)
+    : onMessageSlices_(std::move(onMessageSlices)),
       stringPoolOffsets_(stringPoolOffsets),
       differentialStringUpdates_(differentialStringUpdates)
 {
@@ -127,31 +430,33 @@ TileLayerStream::Writer::Writer(
 void TileLayerStream::Writer::write(TileLayer::Ptr const& tileLayer)
 {
     if (auto modelPool = std::dynamic_pointer_cast<simfil::ModelPool>(tileLayer)) {
-        if (auto strings = modelPool->strings()) {
-            auto& highestStringKnownToClient = stringPoolOffsets_[tileLayer->nodeId()];
-            auto highestString = strings->highest();
-
-            if (highestStringKnownToClient < highestString)
-            {
-                // Need to send the client an update for the string pool.
-                std::stringstream serializedStrings;
-                auto stringUpdateOffset = 0;
-                if (differentialStringUpdates_)
-                    stringUpdateOffset = highestStringKnownToClient + 1;
-                strings->write(serializedStrings, stringUpdateOffset);
-                sendMessage(serializedStrings.str(), MessageType::StringPool);
-                highestStringKnownToClient = highestString;
-            }
-        }
+        if (auto strings = modelPool->strings())
+            sendStringPoolUpdate(tileLayer->nodeId(), *strings);
     }
+    writeLayer(tileLayer);
+}
 
+void TileLayerStream::Writer::writeStringPool(std::string const& nodeId, simfil::StringPool const& strings)
+{
+    sendStringPoolUpdate(nodeId, strings);
+}
+
+void TileLayerStream::Writer::writeLayer(TileLayer::Ptr const& tileLayer)
+{
     // Send the actual layer
-    std::stringstream serializedLayer;
     auto start = std::chrono::system_clock::now();
-    tileLayer->write(serializedLayer);
-    auto bytes = serializedLayer.str();
+    serializationBuffer_.clear();
+    {
+        StringAppendStreamBuffer serializedLayer(serializationBuffer_);
+        std::ostream serializedLayerStream(&serializedLayer);
+        auto featureLayer = compactGeometry_ ? std::dynamic_pointer_cast<TileFeatureLayer>(tileLayer) : nullptr;
+        if (featureLayer)
+            featureLayer->write(serializedLayerStream, TileFeatureLayer::GeometryEncoding::QuantizedDelta);
+        else
+            tileLayer->write(serializedLayerStream);
+    }
     auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - start);
-    log().trace("Writing {} kB took {} ms.", bytes.size()/1000, elapsed.count());
+    log().trace("Writing {} kB took {} ms.", serializationBuffer_.size()/1000, elapsed.count());
 
     const auto layerType = tileLayer->layerInfo()->type_;
     const auto messageType = [&layerType]() {
@@ -160,37 +465,101 @@ void TileLayerStream::Writer::write(TileLayer::Ptr const& tileLayer)
             return MessageType::TileFeatureLayer;
         case mapget::LayerType::SourceData:
             return MessageType::TileSourceDataLayer;
+        case mapget::LayerType::Heightmap:
+        case mapget::LayerType::OrthoImage:
+        case mapget::LayerType::GLTF:
+            return MessageType::TileBinaryLayer;
         default:
             raiseFmt("Unsupported layer type: {}", static_cast<int>(layerType));
         }
         return MessageType::None;
     }();
 
-    sendMessage(std::move(bytes), messageType);
+    sendMessage(serializationBuffer_, messageType);
+}
+
+void TileLayerStream::Writer::write(std::string const& tileLayerMessage, StringPool const& strings)
+{
+    // The message type follows the 6B protocol version.
+    if (tileLayerMessage.size() < MessageHeaderSize)
+        raise("Cannot forward a truncated tile layer message.");
+    sendStringPoolUpdate(strings.nodeId_, strings);
+
+    // The header is written anew, so that it carries the protocol
+    // version of the reader, see setProtocolVersion().
+    sendMessage(
+        std::string_view(tileLayerMessage).substr(MessageHeaderSize),
+        static_cast<MessageType>(tileLayerMessage[6]));
+}
+
+bool TileLayerStream::Writer::sendsUnchanged(std::string const& tileLayerMessage) const
+{
+    if (tileLayerMessage.size() < MessageHeaderSize)
+        return false;
+    bitsery::Deserializer<bitsery::InputBufferAdapter<std::string>> s(tileLayerMessage.begin(), MessageHeaderSize);
+    Version messageVersion;
+    s.object(messageVersion);
+    return s.adapter().error() == bitsery::ReaderError::NoError && messageVersion == protocolVersion_;
+}
+
+void TileLayerStream::Writer::setProtocolVersion(Version const& version)
+{
+    if (!isSupportedProtocolVersion(version)) {
+        raiseFmt(
+            "Unable to write messages with version {} using version {}.",
+            version.toString(),
+            CurrentProtocolVersion.toString());
+    }
+    compactGeometry_ = version.minor_ >= CompactGeometryProtocolVersion.minor_;
+    protocolVersion_ = compactGeometry_ ? CurrentProtocolVersion : MinimumProtocolVersion;
+}
+
+void TileLayerStream::Writer::sendStringPoolUpdate(std::string const& nodeId, simfil::StringPool const& strings)
+{
+    auto& highestStringKnownToClient = stringPoolOffsets_[nodeId];
+    auto highestString = strings.highest();
+
+    if (highestStringKnownToClient < highestString)
+    {
+        // Need to send the client an update for the string pool.
+        auto stringUpdateOffset = 0;
+        if (differentialStringUpdates_)
+            stringUpdateOffset = highestStringKnownToClient + 1;
+        serializationBuffer_.clear();
+        {
+            StringAppendStreamBuffer serializedStrings(serializationBuffer_);
+            std::ostream serializedStringsStream(&serializedStrings);
+            strings.write(serializedStringsStream, stringUpdateOffset);
+        }
+        sendMessage(serializationBuffer_, MessageType::StringPool);
+        highestStringKnownToClient = highestString;
+    }
 }
 
-void TileLayerStream::Writer::sendMessage(std::string&& bytes, TileLayerStream::MessageType msgType)
+void TileLayerStream::Writer::sendMessage(std::string_view const& bytes, TileLayerStream::MessageType msgType)
 {
     // TODO refactor the preparation of tile layer & field dicts storage format
     //  such that the encoding logic is not split over multiple functions.
 
-    std::stringstream message;
-    bitsery::Serializer<bitsery::OutputStreamAdapter> s(message);
-
-    // Write protocol version
-    s.object(CurrentProtocolVersion);
+    std::string header;
+    header.reserve(MessageHeaderSize);
+    {
+        StringAppendStreamBuffer headerBuffer(header);
+        std::ostream headerStream(&headerBuffer);
+        bitsery::Serializer<bitsery::OutputStreamAdapter> s(headerStream);
 
-    // Write message type
-    s.value1b(msgType);
+        // Write protocol version
+        s.object(protocolVersion_);
 
-    // Write content length
-    s.value4b((uint32_t)bytes.size());
+        // Write message type
+        s.value1b(msgType);
 
-    // Write content
-    message << bytes;
+        // Write content length
+        s.value4b((uint32_t)bytes.size());
+    }
 
-    // Notify result
-    onMessage_(message.str(), msgType);
+    // Notify result, the content is passed as it was serialized.
+    onMessageSlices_(header, bytes, msgType);
 }
 
 void TileLayerStream::Writer::sendEndOfStream()
@@ -208,7 +577,7 @@ std::shared_ptr<StringPool> TileLayerStream::StringPoolCache::getStringPool(cons
         }
     }
     {
-        std::unique_lock stringPoolWriteLock(stringPoolCacheMutex_, std::defer_lock);
+        std::unique_lock stringPoolWriteLock(stringPoolCacheMutex_);
         // Was it inserted already now?
         auto it = stringPoolPerNodeId_.find(std::string(nodeId));
         if (it != stringPoolPerNodeId_.end())
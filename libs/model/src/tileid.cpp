@@ -1,6 +1,7 @@
 #include "tileid.h"
 #include <algorithm>
 #include <cmath>
+#include <utility>
 #include "mapget/log.h"
 
 namespace mapget
@@ -14,6 +15,101 @@ constexpr auto MAX_LAT = 90.0;
 constexpr auto LON_EXTENT = MAX_LON - MIN_LON;
 constexpr auto LAT_EXTENT = MAX_LAT - MIN_LAT;
 
+namespace
+{
+
+// Get the column of a longitude, clamped to the columns of the zoom level.
+int64_t columnOf(double longitude, uint16_t zoomLevel)
+{
+    auto numCols = static_cast<int64_t>(1ull << (zoomLevel + 1));
+    auto x = static_cast<int64_t>(std::floor((longitude - MIN_LON) / LON_EXTENT * static_cast<double>(numCols)));
+    return std::clamp(x, int64_t(0), numCols - 1);
+}
+
+// Get the row of a latitude, clamped to the rows of the zoom level.
+int64_t rowOf(double latitude, uint16_t zoomLevel)
+{
+    auto numRows = static_cast<int64_t>(1ull << zoomLevel);
+    auto y = static_cast<int64_t>(std::floor((MAX_LAT - latitude) / LAT_EXTENT * static_cast<double>(numRows)));
+    return std::clamp(y, int64_t(0), numRows - 1);
+}
+
+// Columns and rows of the tiles which overlap a bounding box.
+struct TileRange
+{
+    int64_t minX = 0, maxX = 0, minY = 0, maxY = 0;
+};
+
+TileRange tileRangeOf(Point const& corner, Point const& otherCorner, uint16_t zoomLevel)
+{
+    if (zoomLevel > TileId::MaxZoomLevel)
+        raiseFmt("Zoom level {} is above the maximum zoom level {}.", zoomLevel, TileId::MaxZoomLevel);
+    // Row 0 is at the north pole.
+    return {
+        columnOf(std::min(corner.x, otherCorner.x), zoomLevel),
+        columnOf(std::max(corner.x, otherCorner.x), zoomLevel),
+        rowOf(std::max(corner.y, otherCorner.y), zoomLevel),
+        rowOf(std::min(corner.y, otherCorner.y), zoomLevel)};
+}
+
+// Check whether a point lies within a ring, by counting the ring edges
+// which a ray from the point towards positive x crosses.
+bool ringContains(std::vector<Point> const& ring, Point const& p)
+{
+    bool inside = false;
+    for (size_t i = 0, j = ring.size() - 1; i < ring.size(); j = i++) {
+        auto const& a = ring[i];
+        auto const& b = ring[j];
+        if ((a.y > p.y) != (b.y > p.y) && p.x < (b.x - a.x) * (p.y - a.y) / (b.y - a.y) + a.x)
+            inside = !inside;
+    }
+    return inside;
+}
+
+// Check whether the segment from a to b overlaps the box between
+// min and max, by clipping it to the box (Liang-Barsky).
+bool segmentOverlapsBox(Point const& a, Point const& b, Point const& min, Point const& max)
+{
+    double t0 = 0.;
+    double t1 = 1.;
+    auto clip = [&t0, &t1](double p, double q)
+    {
+        if (p == 0.)
+            return q >= 0.;
+        auto t = q / p;
+        if (p < 0.)
+            t0 = std::max(t0, t);
+        else
+            t1 = std::min(t1, t);
+        return t0 <= t1;
+    };
+    auto dx = b.x - a.x;
+    auto dy = b.y - a.y;
+    return clip(-dx, a.x - min.x) && clip(dx, max.x - a.x) && clip(-dy, a.y - min.y) && clip(dy, max.y - a.y);
+}
+
+// Get the position of a cell on the Hilbert curve through a square grid with the given side.
+uint64_t hilbertIndexInSquare(uint64_t x, uint64_t y, uint64_t side)
+{
+    uint64_t result = 0;
+    for (auto s = side / 2; s > 0; s /= 2) {
+        uint64_t rx = (x & s) > 0;
+        uint64_t ry = (y & s) > 0;
+        result += s * s * ((3 * rx) ^ ry);
+        // Rotate the quadrant, so that the curve through it starts and ends at the right corners.
+        if (ry == 0) {
+            if (rx == 1) {
+                x = side - 1 - x;
+                y = side - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return result;
+}
+
+}
+
 TileId::TileId(uint16_t x, uint16_t y, uint16_t z) {
     value_ = ((uint64_t)x << 32) | ((uint64_t)y << 16) | z;
 }
@@ -93,6 +189,99 @@ TileId TileId::neighbor(int32_t offsetX, int32_t offsetY) const
     return TileId(resultX, resultY, z()).value_;
 }
 
+uint64_t TileId::numTilesInBBox(Point const& corner, Point const& otherCorner, uint16_t zoomLevel)
+{
+    auto [minX, maxX, minY, maxY] = tileRangeOf(corner, otherCorner, zoomLevel);
+    return static_cast<uint64_t>(maxX - minX + 1) * static_cast<uint64_t>(maxY - minY + 1);
+}
+
+std::vector<TileId> TileId::tilesInBBox(Point const& corner, Point const& otherCorner, uint16_t zoomLevel, Order order)
+{
+    auto [minX, maxX, minY, maxY] = tileRangeOf(corner, otherCorner, zoomLevel);
+
+    std::vector<TileId> result;
+    result.reserve((maxX - minX + 1) * (maxY - minY + 1));
+    for (auto x = minX; x <= maxX; ++x)
+        for (auto y = minY; y <= maxY; ++y)
+            result.emplace_back(static_cast<uint16_t>(x), static_cast<uint16_t>(y), zoomLevel);
+    sort(result, order);
+    return result;
+}
+
+std::vector<TileId> TileId::tilesInPolygon(std::vector<Point> const& ring, uint16_t zoomLevel, Order order)
+{
+    if (ring.empty())
+        return {};
+
+    Point min = ring.front();
+    Point max = ring.front();
+    for (auto const& p : ring) {
+        min = {std::min(min.x, p.x), std::min(min.y, p.y)};
+        max = {std::max(max.x, p.x), std::max(max.y, p.y)};
+    }
+
+    // A tile overlaps the polygon if a ring vertex lies within the tile, if a
+    // ring edge crosses the tile, or if the tile lies within the polygon.
+    auto result = tilesInBBox(min, max, zoomLevel, Order::ColumnMajor);
+    std::erase_if(
+        result,
+        [&ring](TileId const& tile)
+        {
+            auto tileMin = tile.sw();
+            auto tileMax = tile.ne();
+            for (size_t i = 0, j = ring.size() - 1; i < ring.size(); j = i++) {
+                if (segmentOverlapsBox(ring[j], ring[i], tileMin, tileMax))
+                    return false;
+            }
+            return !ringContains(ring, tile.center());
+        });
+    sort(result, order);
+    return result;
+}
+
+void TileId::sort(std::vector<TileId>& tileIds, Order order)
+{
+    auto key = [order](TileId const& tile) -> uint64_t
+    {
+        switch (order) {
+        case Order::Morton:
+            return tile.mortonIndex();
+        case Order::Hilbert:
+            return tile.hilbertIndex();
+        default:
+            return tile.value_;
+        }
+    };
+    std::sort(
+        tileIds.begin(),
+        tileIds.end(),
+        [&key](TileId const& l, TileId const& r)
+        {
+            if (l.z() != r.z())
+                return l.z() < r.z();
+            return key(l) < key(r);
+        });
+}
+
+uint64_t TileId::mortonIndex() const
+{
+    uint64_t result = 0;
+    for (auto bit = 0; bit < 16; ++bit) {
+        result |= static_cast<uint64_t>((x() >> bit) & 1u) << (2 * bit);
+        result |= static_cast<uint64_t>((y() >> bit) & 1u) << (2 * bit + 1);
+    }
+    return result;
+}
+
+uint64_t TileId::hilbertIndex() const
+{
+    // The columns of a zoom level form two squares of 2^z by
+    // 2^z tiles, the western one is traversed before the eastern one.
+    uint64_t side = 1ull << z();
+    uint64_t square = x() / side;
+    return square * side * side + hilbertIndexInSquare(x() % side, y(), side);
+}
+
 Point TileId::center() const {
     auto extent = size();
     auto lon = MIN_LON + (static_cast<double>(x()) + 0.5) * extent.x;
@@ -239,6 +239,15 @@ model_ptr<Geometry> Validity::simpleGeometry() const
 SelfContainedGeometry Validity::computeGeometry(
     model_ptr<GeometryCollection> geometryCollection,
     std::string* error) const
+{
+    LineLengths lineLengths;
+    return computeGeometry(std::move(geometryCollection), error, lineLengths);
+}
+
+SelfContainedGeometry Validity::computeGeometry(
+    model_ptr<GeometryCollection> geometryCollection,
+    std::string* error,
+    LineLengths& lineLengths) const
 {
     if (data_->geomDescrType_ == SimpleGeometry) {
         // Return the self-contained geometry points.
@@ -343,10 +352,19 @@ SelfContainedGeometry Validity::computeGeometry(
         return {points, points.size() > 1 ? GeomType::Line : GeomType::Points};
     }
 
+    // Both length offset types look up the cumulative lengths of the geometry.
+    std::shared_ptr<const std::vector<double>> cumulativeLengths;
+    if (offsetType == MetricLengthOffset || offsetType == RelativeLengthOffset) {
+        auto& lengths = lineLengths[geometry->addr().index()];
+        if (!lengths)
+            lengths = geometry->cumulativeLengths();
+        cumulativeLengths = lengths;
+    }
+
     // Handle RelativeLengthOffset (a percentage range of the geometry).
     //  - we convert the percentages to length values, and then fall through to MetricLengthOffset.
     if (offsetType == RelativeLengthOffset) {
-        auto lineLength = geometry->length();
+        auto lineLength = cumulativeLengths->empty() ? 0. : cumulativeLengths->back();
         startPoint.x *= lineLength;
         if (endPoint) {
             endPoint->x *= lineLength;
@@ -355,7 +373,10 @@ SelfContainedGeometry Validity::computeGeometry(
 
     // Handle MetricLengthOffset (a length range of the geometry in meters).
     if (offsetType == MetricLengthOffset || offsetType == RelativeLengthOffset) {
-        auto points = geometry->pointsFromLengthBound(startPoint.x, endPoint ? std::optional<double>(endPoint->x) : std::optional<double>());
+        auto points = geometry->pointsFromLengthBound(
+            startPoint.x,
+            endPoint ? std::optional<double>(endPoint->x) : std::optional<double>(),
+            *cumulativeLengths);
         return {points, points.size() > 1 ? GeomType::Line : GeomType::Points};
     }
 
@@ -461,4 +482,18 @@ model_ptr<Validity> MultiValidity::newDirection(Validity::Direction direction)
     return result;
 }
 
+std::vector<SelfContainedGeometry> MultiValidity::computeGeometries(
+    model_ptr<GeometryCollection> const& geometryCollection,
+    std::string* error) const
+{
+    std::vector<SelfContainedGeometry> result;
+    result.reserve(size());
+    Validity::LineLengths lineLengths;
+    forEach([&](auto&& validity) {
+        result.emplace_back(validity.computeGeometry(geometryCollection, error, lineLengths));
+        return true;
+    });
+    return result;
+}
+
 }
@@ -163,12 +163,14 @@ void bindHttpClient(py::module_& m)
         )pbdoc", py::call_guard<py::gil_scoped_release>());
 
     py::class_<HttpClient, std::shared_ptr<HttpClient>>(m, "Client")
-        .def(py::init<const std::string&, uint16_t>(),
+        .def(py::init<const std::string&, uint16_t, size_t, size_t>(),
              R"pbdoc(
                 Connect to a running mapget HTTP service. Immediately calls the /sources
                 endpoint, and caches the result for the lifetime of this object.
+                With more than one decoding thread, received tiles are decoded in parallel.
+                Up to the given number of connections stream requests in parallel.
             )pbdoc",
-             py::arg("host"), py::arg("port"))
+             py::arg("host"), py::arg("port"), py::arg("decoding_threads") = 1, py::arg("connections") = 4)
         .def("sources", [](HttpClient& self){
                 auto jsonArray = nlohmann::json::array();
                 for (auto const& dsInfo : self.sources())
@@ -186,7 +188,8 @@ void bindHttpClient(py::module_& m)
             },
             R"pbdoc(
                 Post a Request for a number of tiles from a particular map layer.
-                Returns the request object which was put in.
+                Returns the request object which was put in, while its response
+                is streamed in the background.
             )pbdoc",
             py::arg("request"));
 }
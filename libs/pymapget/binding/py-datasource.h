@@ -49,6 +49,18 @@ void bindDataSourceServer(py::module_& m)
             error occurs while filling the tile, the callback can use
             TileFeatureLayer::setError(...) to signal the error downstream.
         )pbdoc")
+        .def(
+            "on_tile_feature_batch_request",
+            &DataSourceServer::onTileFeatureBatchRequest,
+            py::arg("callback"),
+            py::call_guard<py::gil_scoped_acquire>(),
+            R"pbdoc(
+            Set the Callback which fills a batch of feature tiles of the same
+            layer at once, for the tiles of a `/tiles`-request. The callback
+            argument is a list of up to `maxBatchSize` fresh TileFeatureLayers.
+            Without it, the tiles are filled one by one using the callback of
+            on_tile_feature_request.
+        )pbdoc")
         .def(
             "on_tile_sourcedata_request",
             &DataSourceServer::onTileSourceDataRequest,
@@ -62,6 +74,25 @@ void bindDataSourceServer(py::module_& m)
             error occurs while filling the tile, the callback can use
             TileFeatureLayer::setError(...) to signal the error downstream.
         )pbdoc")
+        .def(
+            "on_tile_binary_request",
+            &DataSourceServer::onTileBinaryRequest,
+            py::arg("callback"),
+            py::call_guard<py::gil_scoped_acquire>(),
+            R"pbdoc(
+            Set the Callback which will be invoked when a `/tile`-request for a
+            Heightmap, OrthoImage or GLTF layer is received. The callback argument
+            is a fresh TileBinaryLayer, which the callback must fill with its payload.
+        )pbdoc")
+        .def(
+            "set_fill_thread_pool_size",
+            &DataSourceServer::setFillThreadPoolSize,
+            py::arg("num_threads"),
+            R"pbdoc(
+            Set the number of threads which run the fill callbacks, which bounds the
+            number of concurrent fills. Must be called before go(). Zero fills the
+            tiles on the HTTP threads, which is the default.
+        )pbdoc")
         .def(
             "go",
             &DataSourceServer::go,
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "mapget/model/binarylayer.h"
 #include "mapget/model/featurelayer.h"
 
 #include <pybind11/functional.h>
@@ -11,6 +12,41 @@
 namespace py = pybind11;
 using namespace py::literals;
 
+/**
+ * Convert a column of a feature batch, which is either a one-dimensional
+ * buffer of int64 or float64 values, or a list of int, float or str values.
+ */
+mapget::TileFeatureLayer::FeatureBatch::Column batchColumn(std::string const& name, py::handle const& values)
+{
+    using Column = mapget::TileFeatureLayer::FeatureBatch::Column;
+    if (py::isinstance<py::buffer>(values) && !py::isinstance<py::str>(values) && !py::isinstance<py::bytes>(values)) {
+        auto info = py::reinterpret_borrow<py::buffer>(values).request();
+        if (info.ndim != 1)
+            throw py::value_error("Column " + name + " must be one-dimensional.");
+        auto copy = [&info](auto result)
+        {
+            using T = typename decltype(result)::value_type;
+            result.resize(static_cast<size_t>(info.shape[0]));
+            auto const* data = static_cast<char const*>(info.ptr);
+            for (py::ssize_t i = 0; i < info.shape[0]; ++i)
+                std::memcpy(&result[i], data + i * info.strides[0], sizeof(T));
+            return Column(std::move(result));
+        };
+        if (info.item_type_is_equivalent_to<int64_t>())
+            return copy(std::vector<int64_t>());
+        if (info.item_type_is_equivalent_to<double>())
+            return copy(std::vector<double>());
+        throw py::type_error("Column " + name + " must be a buffer of int64 or float64 values.");
+    }
+
+    auto list = py::cast<py::sequence>(values);
+    if (list.size() > 0 && py::isinstance<py::str>(list[0]))
+        return list.cast<std::vector<std::string>>();
+    if (list.size() > 0 && py::isinstance<py::float_>(list[0]))
+        return list.cast<std::vector<double>>();
+    return list.cast<std::vector<int64_t>>();
+}
+
 void bindTileLayer(py::module_& m)
 {
     using namespace mapget;
@@ -51,6 +87,13 @@ void bindTileLayer(py::module_& m)
             R"pbdoc(
             Set the error occurred while the tile was filled.
             )pbdoc")
+        .def(
+            "is_cancelled",
+            [](TileFeatureLayer const& self) { return self.isCancelled(); },
+            R"pbdoc(
+            Check whether nobody waits for this tile anymore. Expensive fills
+            may check this now and then, and return early if it is True.
+            )pbdoc")
         .def(
             "timestamp",
             [](TileFeatureLayer const& self) {return self.timestamp(); },
@@ -139,6 +182,55 @@ void bindTileLayer(py::module_& m)
             information, prepended with the getIdPrefix, must conform to an existing
             UniqueIdComposition for the feature typeId within the associated layer.
         )pbdoc")
+        .def(
+            "new_features",
+            [](TileFeatureLayer& self,
+               py::object const& typeIds,
+               py::dict const& idParts,
+               GeomType geomType,
+               std::optional<py::buffer> const& coordinates,
+               std::optional<std::vector<uint32_t>> const& geometryOffsets,
+               std::optional<py::dict> const& attributes)
+            {
+                TileFeatureLayer::FeatureBatch batch;
+                if (py::isinstance<py::str>(typeIds))
+                    batch.typeIds_.push_back(typeIds.cast<std::string>());
+                else
+                    batch.typeIds_ = typeIds.cast<std::vector<std::string>>();
+                for (auto const& [name, values] : idParts) {
+                    auto key = name.cast<std::string>();
+                    batch.idParts_.emplace_back(key, batchColumn(key, values));
+                }
+                batch.geomType_ = geomType;
+                if (coordinates) {
+                    for (auto const& p : pointsFromBuffer(*coordinates))
+                        batch.coordinates_.insert(batch.coordinates_.end(), {p.x, p.y, p.z});
+                }
+                if (geometryOffsets)
+                    batch.geometryOffsets_ = *geometryOffsets;
+                if (attributes) {
+                    for (auto const& [name, values] : *attributes) {
+                        auto key = name.cast<std::string>();
+                        batch.attributes_.emplace_back(key, batchColumn(key, values));
+                    }
+                }
+                py::gil_scoped_release releaseGil;
+                return self.newFeatures(batch);
+            },
+            py::arg("type_ids"),
+            py::arg("feature_id_parts"),
+            py::arg("geom_type") = GeomType::Line,
+            py::arg("coordinates") = std::nullopt,
+            py::arg("geometry_offsets") = std::nullopt,
+            py::arg("attributes") = std::nullopt,
+            R"pbdoc(
+            Create many features at once. Each column has one row per feature:
+            feature_id_parts and attributes map names to lists or numpy arrays
+            of int64, float64 or str values. type_ids is one type id for all
+            features, or a list of them. The points of feature i are the rows
+            geometry_offsets[i] to geometry_offsets[i + 1] of the (N, 2) or
+            (N, 3) float64 coordinates array. Returns the number of features.
+        )pbdoc")
         .def(
             "new_feature_id",
             [](TileFeatureLayer& self, std::string const& typeId, KeyValuePairVec const& idParts)
@@ -194,11 +286,86 @@ void bindTileLayer(py::module_& m)
             R"pbdoc(
             Create a new geometry of the given type.
         )pbdoc")
+        .def(
+            "matching_features",
+            [](TileFeatureLayer& self, std::string const& query)
+            { return *self.matchingFeatures(query); },
+            py::arg("query"),
+            py::call_guard<py::gil_scoped_release>(),
+            R"pbdoc(
+            Get the indices of the features on which the simfil query yields a value
+            other than null or false. Read-only tiles remember the indices per query.
+        )pbdoc")
         .def(
             "geojson",
             [](TileFeatureLayer& self)
             { return self.toJson().dump(); },
+            py::call_guard<py::gil_scoped_release>(),
             R"pbdoc(
             Convert this tile to a GeoJSON feature collection.
         )pbdoc");
+
+    py::class_<TileBinaryLayer, TileBinaryLayer::Ptr>(
+        m,
+        "TileBinaryLayer")
+        .def(
+            "tile_id",
+            [](TileBinaryLayer const& self){return self.tileId();},
+            R"pbdoc(
+            Get the layer's tileId. This controls the rough geographic extent
+            of the contained tile data.
+            )pbdoc")
+        .def(
+            "map_id",
+            [](TileBinaryLayer const& self){return self.mapId();},
+            R"pbdoc(
+            Get the identifier of the map which this tile layer belongs to.
+            )pbdoc")
+        .def(
+            "layer_id",
+            [](TileBinaryLayer const& self) { return self.layerInfo()->layerId_; },
+            R"pbdoc(
+            Get the layer name for this TileLayer.
+            )pbdoc")
+        .def(
+            "set_error",
+            [](TileBinaryLayer& self, std::string const& e) { self.setError(e); },
+            py::arg("err"),
+            R"pbdoc(
+            Set the error occurred while the tile was filled.
+            )pbdoc")
+        .def(
+            "is_cancelled",
+            [](TileBinaryLayer const& self) { return self.isCancelled(); },
+            R"pbdoc(
+            Check whether nobody waits for this tile anymore. Expensive fills
+            may check this now and then, and return early if it is True.
+            )pbdoc")
+        .def(
+            "set_content_type",
+            [](TileBinaryLayer& self, std::string const& contentType) { self.setContentType(contentType); },
+            py::arg("content_type"),
+            R"pbdoc(
+            Set the MIME type of the payload, e.g. `image/png`.
+            )pbdoc")
+        .def(
+            "set_metadata",
+            [](TileBinaryLayer& self, std::string const& metadata) { self.setMetadata(nlohmann::json::parse(metadata)); },
+            py::arg("metadata_json"),
+            R"pbdoc(
+            Set the metadata of the payload, as a JSON string.
+            )pbdoc")
+        .def(
+            "set_payload",
+            [](TileBinaryLayer& self, py::bytes const& payload) { self.setPayload(std::string(payload)); },
+            py::arg("payload"),
+            R"pbdoc(
+            Set the payload bytes, e.g. an encoded raster or a glTF buffer.
+            )pbdoc")
+        .def(
+            "payload",
+            [](TileBinaryLayer const& self) { return py::bytes(self.payload().data(), self.payload().size()); },
+            R"pbdoc(
+            Get the payload bytes.
+            )pbdoc");
 }
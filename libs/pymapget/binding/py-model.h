@@ -9,6 +9,8 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 
+#include <cstring>
+
 namespace py = pybind11;
 using namespace py::literals;
 using namespace simfil;
@@ -126,6 +128,60 @@ ModelVariant pyValueToModel(py::object const& pyValue, TileFeatureLayer& model)
     }
 }
 
+/**
+ * Read the points of an (N, 2) or (N, 3) buffer of float64 coordinates,
+ * e.g. a numpy array, in one pass. Without z, the points have elevation 0.
+ * The buffer is read without holding the GIL.
+ */
+std::vector<Point> pointsFromBuffer(py::buffer const& buffer)
+{
+    auto info = buffer.request();
+    if (!info.item_type_is_equivalent_to<double>())
+        throw py::type_error("Expected a buffer of float64 coordinates.");
+    if (info.ndim != 2 || (info.shape[1] != 2 && info.shape[1] != 3))
+        throw py::value_error("Expected a buffer of shape (N, 2) or (N, 3).");
+
+    std::vector<Point> result(static_cast<size_t>(info.shape[0]));
+    py::gil_scoped_release releaseGil;
+    auto const* data = static_cast<char const*>(info.ptr);
+    auto coordinate = [&](py::ssize_t i, py::ssize_t j)
+    {
+        // Strided buffers are not necessarily aligned.
+        double value;
+        std::memcpy(&value, data + i * info.strides[0] + j * info.strides[1], sizeof(double));
+        return value;
+    };
+    for (py::ssize_t i = 0; i < info.shape[0]; ++i)
+        result[i] = {coordinate(i, 0), coordinate(i, 1), info.shape[1] == 3 ? coordinate(i, 2) : 0.};
+    return result;
+}
+
+/**
+ * Points of a geometry as a contiguous (N, 3) buffer of float64 coordinates,
+ * which numpy.asarray() or memoryview() wrap without copying.
+ */
+struct PointArray
+{
+    static void bind(py::module_& m)
+    {
+        py::class_<PointArray>(m, "PointArray", py::buffer_protocol())
+            .def_buffer(
+                [](PointArray& self)
+                {
+                    return py::buffer_info(
+                        self.coordinates_.data(),
+                        sizeof(double),
+                        py::format_descriptor<double>::format(),
+                        2,
+                        {static_cast<py::ssize_t>(self.coordinates_.size() / 3), py::ssize_t(3)},
+                        {static_cast<py::ssize_t>(3 * sizeof(double)), static_cast<py::ssize_t>(sizeof(double))});
+                })
+            .def("__len__", [](PointArray const& self) { return self.coordinates_.size() / 3; });
+    }
+
+    std::vector<double> coordinates_;  // x, y, z per point
+};
+
 template <typename NodeType = Object>
 struct BoundObject : public BoundModelNode
 {
@@ -185,7 +241,45 @@ struct BoundArray : public BoundModelNode
                     std::visit([&self](auto&& value) { self.modelNodePtr_->append(value); }, vv);
                 },
                 py::arg("value"),
-                "Append a value to the array.");
+                "Append a value to the array.")
+            .def(
+                "extend",
+                [](BoundArray& self, py::buffer const& buffer) {
+                    auto info = buffer.request();
+                    if (info.ndim != 1)
+                        throw py::value_error("Expected a one-dimensional buffer.");
+                    auto appendAll = [&](auto valueType)
+                    {
+                        using ValueType = decltype(valueType);
+                        py::gil_scoped_release releaseGil;
+                        auto const* data = static_cast<char const*>(info.ptr);
+                        for (py::ssize_t i = 0; i < info.shape[0]; ++i) {
+                            ValueType value;
+                            std::memcpy(&value, data + i * info.strides[0], sizeof(ValueType));
+                            // Small integers are stored compactly, as by append().
+                            if constexpr (std::is_same_v<ValueType, int64_t>) {
+                                if (value >= INT16_MIN && value <= INT16_MAX) {
+                                    self.modelNodePtr_->append(static_cast<int16_t>(value));
+                                    continue;
+                                }
+                            }
+                            self.modelNodePtr_->append(value);
+                        }
+                    };
+                    if (info.item_type_is_equivalent_to<double>())
+                        appendAll(double{});
+                    else if (info.item_type_is_equivalent_to<int64_t>())
+                        appendAll(int64_t{});
+                    else if (info.item_type_is_equivalent_to<bool>())
+                        appendAll(bool{});
+                    else
+                        throw py::type_error("Expected a buffer of float64, int64 or bool values.");
+                },
+                py::arg("values"),
+                R"pbdoc(
+                Append all values of a one-dimensional buffer of float64, int64
+                or bool values, e.g. a numpy array, to the array.
+            )pbdoc");
     }
 
     ModelNode::Ptr node() override { return modelNodePtr_; }
@@ -225,6 +319,48 @@ struct BoundGeometry : public BoundModelNode
                 py::arg("point"),
                 R"pbdoc(
                 Append a point to the geometry.
+            )pbdoc")
+            .def(
+                "append_points",
+                [](BoundGeometry& node, py::buffer const& points) {
+                    auto parsedPoints = pointsFromBuffer(points);
+                    py::gil_scoped_release releaseGil;
+                    for (auto const& p : parsedPoints)
+                        node.modelNodePtr_->append(p);
+                },
+                py::arg("points"),
+                R"pbdoc(
+                Append the points of an (N, 2) or (N, 3) buffer of float64
+                coordinates, e.g. a numpy array, to the geometry.
+            )pbdoc")
+            .def(
+                "points",
+                [](BoundGeometry& node) {
+                    PointArray result;
+                    py::gil_scoped_release releaseGil;
+                    result.coordinates_.reserve(node.modelNodePtr_->numPoints() * 3);
+                    node.modelNodePtr_->forEachPoint(
+                        [&result](auto&& p)
+                        {
+                            result.coordinates_.insert(result.coordinates_.end(), {p.x, p.y, p.z});
+                            return true;
+                        });
+                    return result;
+                },
+                R"pbdoc(
+                Get the points of the geometry as a PointArray, an (N, 3) buffer
+                of float64 coordinates, which numpy.asarray() wraps without copying.
+            )pbdoc")
+            .def(
+                "bbox",
+                [](BoundGeometry& node) -> std::optional<std::pair<Point, Point>> {
+                    if (auto bbox = node.modelNodePtr_->bbox())
+                        return std::pair{bbox->p1, bbox->p2};
+                    return {};
+                },
+                R"pbdoc(
+                Get the (min, max) points of the bounding box of the geometry,
+                or None if it has no points.
             )pbdoc");
     }
 
@@ -366,6 +502,14 @@ struct BoundFeature : public BoundModelNode
                 [](BoundFeature& self)
                 { return BoundGeometryCollection(self.modelNodePtr_->geom()); },
                 "Access this feature's geometry collection.")
+            .def(
+                "bbox",
+                [](BoundFeature& self) -> std::optional<std::pair<Point, Point>> {
+                    if (auto bbox = self.modelNodePtr_->bbox())
+                        return std::pair{bbox->p1, bbox->p2};
+                    return {};
+                },
+                "Get the (min, max) points of the bounding box of all geometries, or None.")
             .def(
                 "attributes",
                 [](BoundFeature& self) { return BoundObject(self.modelNodePtr_->attributes()); },
@@ -386,6 +530,15 @@ struct BoundFeature : public BoundModelNode
                 },
                 py::arg("p"),
                 "Add a point to the feature.")
+            .def(
+                "add_points",
+                [](BoundFeature& self, py::buffer const& points) {
+                    auto parsedPoints = pointsFromBuffer(points);
+                    py::gil_scoped_release releaseGil;
+                    self.modelNodePtr_->addPoints(parsedPoints);
+                },
+                py::arg("points"),
+                "Add multiple points to the feature, from an (N, 2) or (N, 3) buffer of float64 coordinates.")
             .def(
                 "add_points",
                 [](BoundFeature& self, std::vector<Point> const& points) {
@@ -393,6 +546,15 @@ struct BoundFeature : public BoundModelNode
                 },
                 py::arg("points"),
                 "Add multiple points to the feature.")
+            .def(
+                "add_line",
+                [](BoundFeature& self, py::buffer const& points) {
+                    auto parsedPoints = pointsFromBuffer(points);
+                    py::gil_scoped_release releaseGil;
+                    self.modelNodePtr_->addLine(parsedPoints);
+                },
+                py::arg("points"),
+                "Add a line to the feature, from an (N, 2) or (N, 3) buffer of float64 coordinates.")
             .def(
                 "add_line",
                 [](BoundFeature& self, std::vector<Point> const& points) {
@@ -400,6 +562,15 @@ struct BoundFeature : public BoundModelNode
                 },
                 py::arg("points"),
                 "Add a line to the feature.")
+            .def(
+                "add_mesh",
+                [](BoundFeature& self, py::buffer const& points) {
+                    auto parsedPoints = pointsFromBuffer(points);
+                    py::gil_scoped_release releaseGil;
+                    self.modelNodePtr_->addMesh(parsedPoints);
+                },
+                py::arg("points"),
+                "Add a mesh to the feature from an (N, 2) or (N, 3) buffer of float64 coordinates, N must be a multiple of three.")
             .def(
                 "add_mesh",
                 [](BoundFeature& self, std::vector<Point> const& points) {
@@ -407,6 +578,15 @@ struct BoundFeature : public BoundModelNode
                 },
                 py::arg("points"),
                 "Add a mesh to the feature, len(points) must be multiple of three.")
+            .def(
+                "add_poly",
+                [](BoundFeature& self, py::buffer const& points) {
+                    auto parsedPoints = pointsFromBuffer(points);
+                    py::gil_scoped_release releaseGil;
+                    self.modelNodePtr_->addPoly(parsedPoints);
+                },
+                py::arg("points"),
+                "Add a polygon to the feature, from an (N, 2) or (N, 3) buffer of float64 coordinates.")
             .def(
                 "add_poly",
                 [](BoundFeature& self, std::vector<Point> const& points) {
@@ -452,6 +632,7 @@ void bindModel(py::module& m)
     mapget::BoundModelNodeBase::bind(m);
     mapget::BoundObject<>::bind(m);
     mapget::BoundArray::bind(m);
+    mapget::PointArray::bind(m);
     mapget::BoundGeometry::bind(m);
     mapget::BoundGeometryCollection::bind(m);
     mapget::BoundAttribute::bind(m);
@@ -38,10 +38,17 @@ void bindTileId(py::module_& m)
             Convert the Point to a string representation.
             )pbdoc");
 
-    py::class_<TileId>(m, "TileId", R"pbdoc(
+    py::class_<TileId> tileId(m, "TileId", R"pbdoc(
             The TileId struct represents a tile identifier for a specific map tile.
             It includes an x (column), y (row), and z (zoom level) components.
-            )pbdoc")
+            )pbdoc");
+
+    py::enum_<TileId::Order>(tileId, "Order")
+        .value("COLUMN_MAJOR", TileId::Order::ColumnMajor)
+        .value("MORTON", TileId::Order::Morton)
+        .value("HILBERT", TileId::Order::Hilbert);
+
+    tileId
         .def(
             py::init<uint16_t, uint16_t, uint16_t>(),
             R"pbdoc(
@@ -65,6 +72,33 @@ void bindTileId(py::module_& m)
             py::arg("longitude"),
             py::arg("latitude"),
             py::arg("zoom_level"))
+        .def_static(
+            "tiles_in_bbox",
+            &TileId::tilesInBBox,
+            R"pbdoc(
+            Get the ids of all tiles at the given zoom level which overlap
+            the WGS84 bounding box between the given corners, in the given order.
+            )pbdoc",
+            py::arg("corner"),
+            py::arg("other_corner"),
+            py::arg("zoom_level"),
+            py::arg("order") = TileId::Order::Hilbert)
+        .def_static(
+            "tiles_in_polygon",
+            &TileId::tilesInPolygon,
+            R"pbdoc(
+            Get the ids of all tiles at the given zoom level which overlap
+            the WGS84 polygon with the given outer ring, in the given order.
+            )pbdoc",
+            py::arg("ring"),
+            py::arg("zoom_level"),
+            py::arg("order") = TileId::Order::Hilbert)
+        .def("morton_index", &TileId::mortonIndex, R"pbdoc(
+            Get the position of the tile on the Z-order curve through all tiles of its zoom level.
+            )pbdoc")
+        .def("hilbert_index", &TileId::hilbertIndex, R"pbdoc(
+            Get the position of the tile on the Hilbert curve through all tiles of its zoom level.
+            )pbdoc")
         .def("center", &TileId::center, R"pbdoc(
             Get the center of the tile in WGS84 coordinates.
             )pbdoc")
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "nlohmann/json.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace mapget
+{
+
+/** Processing stages to which allocations are attributed, see AllocationScope. */
+enum class AllocationStage : uint8_t {
+    Fill,
+    CacheGet,
+    CachePut,
+    Serialize,
+    AddOnMerge
+};
+
+/** Number of allocations and their requested bytes. */
+struct AllocationCounts
+{
+    uint64_t allocations_ = 0;
+    uint64_t bytes_ = 0;
+};
+
+/**
+ * Attributes the allocations of the calling thread to a stage while it
+ * lives. Nested scopes count their allocations only for themselves, so the
+ * totals of the stages add up. Allocations are only counted if mapget was
+ * built with MAPGET_WITH_ALLOCATION_TRACKING, which replaces the global
+ * operator new. Otherwise, scopes count nothing, and cost almost nothing.
+ * Allocations of tasks which a stage runs on other threads are not counted.
+ */
+class AllocationScope
+{
+public:
+    explicit AllocationScope(AllocationStage stage);
+    ~AllocationScope();
+
+    AllocationScope(AllocationScope const&) = delete;
+    AllocationScope& operator=(AllocationScope const&) = delete;
+
+    /** Allocations of this scope so far, without those of nested scopes. */
+    [[nodiscard]] AllocationCounts const& counts() const { return counts_; }
+
+    /**
+     * Set the counts of this scope as `<stage>-allocations` and
+     * `<stage>-allocated-bytes` info fields of a tile layer, if
+     * allocations are counted.
+     */
+    template <typename LayerType>
+    void setInfo(LayerType& layer) const
+    {
+        if (!isEnabled())
+            return;
+        layer.setInfo(std::string(stageName(stage_)) + "-allocations", static_cast<int64_t>(counts_.allocations_));
+        layer.setInfo(std::string(stageName(stage_)) + "-allocated-bytes", static_cast<int64_t>(counts_.bytes_));
+    }
+
+    /** Whether allocations are counted, i.e. the build enabled the tracking. */
+    static bool isEnabled();
+
+    /** Count an allocation for the current scope of the calling thread. */
+    static void record(size_t bytes) noexcept;
+
+    /** Name of a stage in statistics and info fields, e.g. `cache-get`. */
+    static char const* stageName(AllocationStage stage);
+
+    /**
+     * Get the totals of the finished scopes since the start of the process:
+     * `enabled`, and per stage the number of `scopes`, their `allocations`
+     * and `bytes`, and the `bytes-per-scope`.
+     */
+    static nlohmann::json getStatistics();
+
+private:
+    AllocationStage stage_;
+    AllocationScope* parent_;
+    AllocationCounts counts_;
+};
+
+}  // namespace mapget
@@ -0,0 +1,214 @@
+#pragma once
+
+#include "datasource.h"
+
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mapget
+{
+
+/**
+ * Layout of a tile archive file, which holds the tiles of one or more
+ * map layers, as written by a TileArchiveWriter. All integers are in
+ * the native byte order, i.e. little-endian on the supported platforms.
+ * The file consists of:
+ *  - The Header.
+ *  - The tile blobs and string pool blobs, as a Cache stores them.
+ *  - The metadata, as JSON: `dataSources` with the DataSourceInfo of each
+ *    archived map, and `stringPools` with the [offset, size] of the string
+ *    pool blob of each node id, followed by those of its updates.
+ *  - The binary MapTileKeys of the tiles, see MapTileKey::toBinary().
+ *  - The index, with one IndexEntry per tile, sorted by binary key.
+ */
+namespace archive
+{
+
+/** First bytes of a tile archive. */
+constexpr char Magic[8] = {'M', 'G', 'T', 'A', 'R', 'C', 'H', '\0'};
+
+/** Version of the archive layout. */
+constexpr uint32_t FormatVersion = 1;
+
+struct Header
+{
+    char magic_[8] = {};
+    uint32_t version_ = 0;
+    uint32_t reserved_ = 0;
+    uint64_t metadataOffset_ = 0;
+    uint64_t metadataSize_ = 0;
+    uint64_t indexOffset_ = 0;
+    uint64_t indexCount_ = 0;
+};
+
+struct IndexEntry
+{
+    uint64_t keyOffset_ = 0;
+    uint32_t keySize_ = 0;
+    uint32_t reserved_ = 0;
+    uint64_t blobOffset_ = 0;
+    uint64_t blobSize_ = 0;
+};
+
+static_assert(sizeof(Header) == 48 && sizeof(IndexEntry) == 32);
+
+}  // namespace archive
+
+/**
+ * Cache which writes the tiles which are put into it to a tile archive file,
+ * e.g. as the cache of a Service which loads all tiles of a map. The tiles
+ * are appended to the file as they are put. Tiles which are put again
+ * replace the earlier ones. The string pools are kept in memory, and the
+ * archive is only complete once finish() was called.
+ */
+class TileArchiveWriter : public Cache
+{
+public:
+    explicit TileArchiveWriter(std::string path);
+    ~TileArchiveWriter() override;
+
+    /**
+     * Write the string pools, the metadata and the index. The given data
+     * sources describe the archived map layers. No tiles can be put after.
+     */
+    void finish(std::vector<DataSourceInfo> const& dataSources);
+
+    /** The archive is written, not read, so no tiles are returned. */
+    std::optional<std::string> getTileLayerBlob(MapTileKey const& k) override { return {}; }
+
+    /** Append a TileLayer blob to the file. */
+    void putTileLayerBlob(MapTileKey const& k, std::string const& v) override;
+
+    /** Retrieve the latest string-pool blob of a node. */
+    std::optional<std::string> getStringPoolBlob(std::string_view const& sourceNodeId) override;
+
+    /** Replace the string-pool blob of a node, and drop its updates. */
+    void putStringPoolBlob(std::string_view const& sourceNodeId, std::string const& v) override;
+
+    /** New strings are appended as updates, so that the pools are not rewritten for each tile. */
+    [[nodiscard]] bool supportsStringPoolUpdates() const override { return true; }
+    void appendStringPoolUpdateBlob(
+        std::string_view const& sourceNodeId,
+        simfil::StringId offset,
+        std::string const& v) override;
+    std::vector<std::string> getStringPoolUpdateBlobs(std::string_view const& sourceNodeId) override;
+
+    /** Enriches the statistics with the number and size of the archived tiles. */
+    nlohmann::json getStatistics() const override;
+
+private:
+    // Append bytes to the file, and return their offset. Requires mutex_.
+    uint64_t append(std::string_view const& bytes);
+
+    std::string path_;
+    mutable std::mutex mutex_;  // Mutex for all of the members below
+    std::ofstream file_;
+    uint64_t fileSize_ = 0;
+    std::map<std::string, std::pair<uint64_t, uint64_t>> tiles_;  // Binary key -> (offset, size)
+    std::map<std::string, std::vector<std::string>, std::less<>> stringPools_;  // Node id -> pool, updates
+    bool finished_ = false;
+};
+
+/**
+ * Read-only tile archive file, which is memory-mapped, so that opening it
+ * does not read the tiles, and the archived tiles only take up what the OS
+ * page cache holds of them. Tiles are looked up by binary search on the index.
+ */
+class TileArchive
+{
+public:
+    using Ptr = std::shared_ptr<TileArchive>;
+
+    /** Map an archive file. Raises if it is not a complete archive. */
+    explicit TileArchive(std::string const& path);
+    ~TileArchive();
+
+    /** The data sources of the archived map layers. */
+    [[nodiscard]] std::vector<DataSourceInfo> const& dataSources() const { return dataSources_; }
+
+    /** Number of archived tiles. */
+    [[nodiscard]] size_t size() const;
+
+    /** Size of the archive file in bytes. */
+    [[nodiscard]] size_t fileSize() const;
+
+    /** Get the blob of an archived tile, as a Cache stores it, or null. */
+    [[nodiscard]] Cache::SharedBlob getTileLayerBlob(MapTileKey const& k) const;
+
+    /** Get the string pool blob of a node, followed by its updates. */
+    [[nodiscard]] std::vector<std::string_view> getStringPoolBlobs(std::string const& nodeId) const;
+
+private:
+    // Bytes of the mapped file at the given range. Raises if it is out of bounds.
+    [[nodiscard]] std::string_view bytes(uint64_t offset, uint64_t size) const;
+
+    struct MappedFile;
+    std::unique_ptr<MappedFile> file_;
+    archive::Header header_;
+    archive::IndexEntry const* index_ = nullptr;
+    std::vector<DataSourceInfo> dataSources_;
+    std::unordered_map<std::string, std::vector<std::pair<uint64_t, uint64_t>>> stringPools_;
+};
+
+/**
+ * Data source which serves the tiles of one map of a tile archive. Tiles
+ * are forwarded as the archived messages to requesters which accept them,
+ * so they are not parsed. Other requesters get the parsed tiles. Tiles
+ * which are not in the archive are empty. The archived strings are added
+ * to the string pools of the service cache, which the tiles refer to.
+ * The archived tiles include the add-on data of the export, so add-on
+ * sources for the map are not used when tiles are forwarded.
+ */
+class ArchiveDataSource : public DataSource
+{
+public:
+    /**
+     * Serve the map with the given id from an archive file. The map id
+     * may be empty if the archive holds a single map.
+     */
+    explicit ArchiveDataSource(std::string const& path, std::string const& mapId = "");
+
+    /** Serve a map of an opened archive. */
+    ArchiveDataSource(TileArchive::Ptr archive, std::string const& mapId);
+
+    DataSourceInfo info() override { return info_; }
+
+    /** Tiles which are not in the archive stay empty. */
+    void fill(TileFeatureLayer::Ptr const& featureTile) override {}
+    void fill(TileSourceDataLayer::Ptr const& sourceData) override {}
+    void fill(TileBinaryLayer::Ptr const& binaryTile) override {}
+
+    /** Parse the archived tile, or get an empty one. */
+    TileLayer::Ptr get(
+        MapTileKey const& k,
+        Cache::Ptr& cache,
+        DataSourceInfo const& info,
+        CancellationToken::Ptr const& cancellation = {}) override;
+
+    /** Parse the archived tiles one by one. */
+    std::vector<TileLayer::Ptr> get(
+        std::vector<MapTileKey> const& keys,
+        Cache::Ptr& cache,
+        DataSourceInfo const& info,
+        std::vector<CancellationToken::Ptr> const& cancellations = {}) override;
+
+    /** Get the archived message of a tile, without parsing it. */
+    std::optional<Cache::TileLayerMessage> getTileLayerMessage(MapTileKey const& k, Cache::Ptr const& cache) override;
+
+private:
+    // Get the string pool of the archive's node from the cache, with the archived strings.
+    std::shared_ptr<StringPool> archivedStrings(Cache::Ptr const& cache);
+
+    TileArchive::Ptr archive_;
+    DataSourceInfo info_;
+
+    std::mutex stringsMutex_;  // Mutex for stringsCache_
+    Cache* stringsCache_ = nullptr;  // Cache whose string pool has the archived strings
+};
+
+}  // namespace mapget
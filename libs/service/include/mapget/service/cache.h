@@ -1,15 +1,26 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <map>
 #include <string>
 #include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
 
 #include "mapget/model/info.h"
 #include "mapget/model/featurelayer.h"
 #include "mapget/model/stream.h"
+#include "compression.h"
 
 namespace mapget
 {
 
+class LocateRequest;
+
 /**
  * Abstract class which defines the behavior of a mapget cache,
  * which can store and recover the output of any mapget DataSource
@@ -22,18 +33,132 @@ class Cache : public TileLayerStream::StringPoolCache, public std::enable_shared
 
 public:
     using Ptr = std::shared_ptr<Cache>;
+    using SharedBlob = std::shared_ptr<const std::string>;
+
+    /**
+     * The live tiles and the string pools are reserved from the
+     * MemoryBudget, which may evict live tiles if it is under pressure.
+     */
+    Cache();
+    ~Cache() override;
+
     // The following methods are already implemented,
     // they forward to the virtual methods on-demand.
 
     /**
      * Used by DataSource to upsert a cached TileLayer.
      * Triggers putTileLayerBlob and putStringPoolBlob internally.
+     * Afterwards, the `serialize-time-ms`, `cache-write-time-ms` and
+     * `serialized-bytes` of the put are set in the info of the layer,
+     * unless it is read-only. They are not part of the cached blob.
      */
     void putTileLayer(TileLayer::Ptr const& l);
 
-    /** Used by DataSource to retrieve a cached TileLayer. */
+    /**
+     * Queue a TileLayer to be put by a background writer, if write-behind
+     * is enabled via setMaxQueuedTileLayers(). Otherwise, the layer is put
+     * right away. Queued layers are returned by getTileLayer() until they are
+     * written. If the queue is full, its oldest layer is dropped. Returns
+     * true if the caller must start a writer, which calls
+     * writeQueuedTileLayers() until it returns zero.
+     */
+    bool queueTileLayer(TileLayer::Ptr const& l);
+
+    /**
+     * Put up to maxTiles queued layers, oldest first, with a single call
+     * to putTileLayerBlobs(). Returns the number of written layers. Once it
+     * returns zero, the next queueTileLayer() call starts a writer again.
+     */
+    size_t writeQueuedTileLayers(size_t maxTiles = WriteBehindBatchSize);
+
+    /**
+     * Set the maximum number of layers which are queued by queueTileLayer().
+     * Zero disables write-behind, which is the default.
+     */
+    void setMaxQueuedTileLayers(size_t maxTiles);
+
+    /** Default number of layers which are written by one writeQueuedTileLayers() call. */
+    static constexpr size_t WriteBehindBatchSize = 64;
+
+    /**
+     * Used by DataSource to retrieve a cached TileLayer. Recently returned
+     * layers are kept as objects in the live tile tier, so that hot tiles
+     * do not have to be parsed again. The returned layer may be shared
+     * with other callers, so it is read-only.
+     */
     TileLayer::Ptr getTileLayer(MapTileKey const& tileKey, DataSourceInfo const& dataSource);
 
+    /** Serialized TileLayer message, with the string pool of its node. */
+    struct TileLayerMessage
+    {
+        SharedBlob message_;
+        std::shared_ptr<StringPool> strings_;
+    };
+
+    /**
+     * Retrieve a cached TileLayer as the serialized message which is
+     * stored in the cache, so that it can be forwarded without parsing
+     * it. Returns nullopt if the tile is not cached, or if it expired.
+     */
+    std::optional<TileLayerMessage> getTileLayerMessage(MapTileKey const& tileKey);
+
+    /**
+     * Remove up to maxTiles cached tiles whose ttl ran out, earliest
+     * expired first. Returns the number of removed tiles. Only tiles which
+     * were put since the cache was constructed are known. Expired tiles
+     * are never returned by getTileLayer(), even if they were not removed.
+     */
+    size_t sweepExpiredTiles(size_t maxTiles = ExpirySweepBatchSize);
+
+    /** Default number of tiles which are removed by one sweep. */
+    static constexpr size_t ExpirySweepBatchSize = 256;
+
+    /**
+     * Set the memory budget of the live tile tier. The size of a layer
+     * is estimated by the size of its blob. Zero disables the tier.
+     */
+    void setMaxLiveTileBytes(size_t maxBytes);
+
+    /** Default budget of the live tile tier. */
+    static constexpr size_t DefaultMaxLiveTileBytes = 128 * 1024 * 1024;
+
+    /**
+     * Compress the tile blobs which are put from now on with zstd at the
+     * given level, using a trained dictionary per map layer, see
+     * TileBlobCompression. Zero disables compression, which is the default.
+     * Blobs which were put without compression can still be read, and
+     * compressed blobs are read regardless of the level, e.g. after
+     * compression was disabled. Must be called before the cache is used.
+     */
+    void setCompressionLevel(int level);
+
+    /**
+     * Index the ids of the features of the tiles which are put from now on,
+     * so that their tiles can be located without asking the data sources,
+     * see lookupLocateIndex(). The index is stored as locate index blobs,
+     * so it only exists for caches which store them, and it persists with
+     * the tiles of persistent caches. Disabled by default. Must be called
+     * before the cache is used.
+     */
+    void setLocateIndexEnabled(bool enabled);
+
+    /** Whether the ids of put features are indexed, see setLocateIndexEnabled(). */
+    [[nodiscard]] bool isLocateIndexEnabled() const { return locateIndexEnabled_; }
+
+    /** Tile of an indexed feature, with the version of its layer when the tile was put. */
+    struct LocateIndexEntry
+    {
+        MapTileKey tileKey_;
+        std::string layerVersion_;
+    };
+
+    /**
+     * Look up the tile of a feature of a node in the locate index. Only
+     * the primary ids of the features are indexed. Returns nullopt if the
+     * index is disabled, or if the feature is not indexed.
+     */
+    std::optional<LocateIndexEntry> lookupLocateIndex(std::string const& nodeId, LocateRequest const& req);
+
     /** Override for CachedStringPoolCache::getStringPool() */
     std::shared_ptr<StringPool> getStringPool(std::string_view const&) override;
 
@@ -42,15 +167,81 @@ public:
     /** Abstract: Retrieve a TileLayer blob for a MapTileKey. */
     virtual std::optional<std::string> getTileLayerBlob(MapTileKey const& k) = 0;
 
+    /**
+     * Retrieve a TileLayer blob for a MapTileKey, or null. Caches which keep
+     * their blobs in memory override this to hand out the stored blob
+     * without copying it. The default implementation calls getTileLayerBlob().
+     */
+    virtual SharedBlob getSharedTileLayerBlob(MapTileKey const& k);
+
     /** Abstract: Upsert (update or insert) a TileLayer blob. */
     virtual void putTileLayerBlob(MapTileKey const& k, std::string const& v) = 0;
 
+    /**
+     * Upsert several TileLayer blobs with unique keys. Caches which can write
+     * them at once override this. The default implementation calls
+     * putTileLayerBlob() for each blob.
+     */
+    virtual void putTileLayerBlobs(std::vector<std::pair<MapTileKey, std::string>> const& blobs);
+
+    /**
+     * Remove a TileLayer blob, e.g. because it expired. The default
+     * implementation does nothing, then expired blobs stay until
+     * they are evicted or overwritten.
+     */
+    virtual void eraseTileLayerBlob(MapTileKey const& k) {}
+
     /** Abstract: Retrieve a string-pool blob for a sourceNodeId. */
     virtual std::optional<std::string> getStringPoolBlob(std::string_view const& sourceNodeId) = 0;
 
-    /** Abstract: Upsert (update or insert) a string-pool blob. */
+    /**
+     * Abstract: Upsert (update or insert) a string-pool blob. Caches which
+     * support string pool updates must drop the updates of the node.
+     */
     virtual void putStringPoolBlob(std::string_view const& sourceNodeId, std::string const& v) = 0;
 
+    /**
+     * Whether the cache stores the new strings of a pool as update blobs,
+     * instead of rewriting the whole pool. The default implementation
+     * returns false, then the other string pool update methods are not used.
+     */
+    [[nodiscard]] virtual bool supportsStringPoolUpdates() const { return false; }
+
+    /**
+     * Append a string pool update blob with the strings of a node
+     * from the given string id on. Updates are kept until the next
+     * putStringPoolBlob() call for the node.
+     */
+    virtual void appendStringPoolUpdateBlob(
+        std::string_view const& sourceNodeId,
+        simfil::StringId offset,
+        std::string const& v) {}
+
+    /**
+     * Retrieve the compression dictionary blob of a map layer, see
+     * TileBlobCompression::dictionaryKey(). The default implementation
+     * stores no dictionaries, then they are trained again after a restart.
+     */
+    virtual std::optional<std::string> getCompressionDictionaryBlob(std::string const& key) { return {}; }
+
+    /** Store the compression dictionary blob of a map layer. It is never replaced. */
+    virtual void putCompressionDictionaryBlob(std::string const& key, std::string const& v) {}
+
+    /**
+     * Retrieve the locate index blob of a feature, see lookupLocateIndex().
+     * The default implementation stores no locate index blobs.
+     */
+    virtual std::optional<std::string> getLocateIndexBlob(std::string const& key) { return {}; }
+
+    /** Upsert the locate index blobs of the features of put tiles. Later blobs replace earlier ones with the same key. */
+    virtual void putLocateIndexBlobs(std::vector<std::pair<std::string, std::string>> const& blobs) {}
+
+    /** Retrieve the string pool update blobs of a node, in ascending offset order. */
+    virtual std::vector<std::string> getStringPoolUpdateBlobs(std::string_view const& sourceNodeId) { return {}; }
+
+    /** Number of string pool updates of a node, after which its whole string pool is rewritten. */
+    static constexpr size_t MaxStringPoolUpdates = 256;
+
     // Override this method if your cache implementation has special stats.
 
     /**
@@ -58,6 +249,18 @@ public:
      * `cache-hits`: Number of fulfilled cache requests.
      * `cache-misses`: Number of cache misses (unfulfilled cache requests).
      * `loaded-string-pools`: Number of string pools currently held in memory.
+     * `live-tile-hits`: Number of cache hits which were served by the live tile tier.
+     * `live-tiles`: Number of tile layers in the live tile tier.
+     * `live-tile-bytes`: Estimated size of the tile layers in the live tile tier.
+     * `expired-tiles`: Number of cached tiles which were removed, as their ttl ran out.
+     * `queued-tiles`: Number of tile layers which wait for the background writer.
+     * `dropped-tiles`: Number of queued tile layers which were dropped, as the queue was full.
+     * If compression is enabled, the statistics of TileBlobCompression::getStatistics() are added.
+     * If the locate index is enabled, `locate-index-features` is the number of indexed features.
+     * `layers`: Per map id and layer id, the number of `hits` and `misses`, the `read-bytes` of
+     *   the stored blobs which were read, the number of `written-tiles` and their `written-bytes`,
+     *   the `average-blob-bytes` of the written tiles, and the number of `evicted-tiles` and
+     *   `expired-tiles`. Blob sizes are counted as stored, i.e. after compression.
      */
     virtual nlohmann::json getStatistics() const;
 
@@ -66,13 +269,142 @@ protected:
     // Used by DataSource::cachedStringPoolOffset()
     simfil::StringId cachedStringPoolOffset(std::string const& nodeId);
 
-    // Mutex for stringPoolOffsets_
+    /**
+     * Implementations must call this when they evict a tile layer blob.
+     * Removes the tile from the live tier, and counts the eviction.
+     */
+    void evictLiveTile(MapTileKey const& k);
+
+    // Mutex for stringPoolOffsets_, stringPoolWriteMutexes_, stringPoolUpdateCounts_ and stringPoolBytes_
     std::mutex stringPoolOffsetMutex_;
     TileLayerStream::StringPoolOffsetMap stringPoolOffsets_;
+    // Per node id, held while the string pool blob of the node is written.
+    std::unordered_map<std::string, std::mutex> stringPoolWriteMutexes_;
+    // Per node id, the number of string pool updates since its pool was written.
+    std::unordered_map<std::string, size_t> stringPoolUpdateCounts_;
+    // Per node id, the serialized size of its string pool, as reserved from the MemoryBudget.
+    std::unordered_map<std::string, size_t> stringPoolBytes_;
 
     // Statistics
-    int64_t cacheHits_ = 0;
-    int64_t cacheMisses_ = 0;
+    std::atomic<int64_t> cacheHits_ = 0;
+    std::atomic<int64_t> cacheMisses_ = 0;
+
+private:
+    /** Counters of one map layer, see getStatistics(). */
+    struct LayerStatistics
+    {
+        std::atomic<int64_t> hits_ = 0;
+        std::atomic<int64_t> misses_ = 0;
+        std::atomic<int64_t> readBytes_ = 0;
+        std::atomic<int64_t> writtenTiles_ = 0;
+        std::atomic<int64_t> writtenBytes_ = 0;
+        std::atomic<int64_t> evictedTiles_ = 0;
+        std::atomic<int64_t> expiredTiles_ = 0;
+    };
+
+    struct LiveTile
+    {
+        TileLayer::Ptr layer_;
+        size_t bytes_ = 0;
+        std::list<MapTileKey>::iterator lruPosition_;
+    };
+
+    /**
+     * Blob reads of tiles which are not in the live tier. A read is stale
+     * if its tile was put or evicted meanwhile, then its result must not
+     * enter the live tier.
+     */
+    struct LiveTileRead
+    {
+        int numReaders_ = 0;
+        bool stale_ = false;
+    };
+
+    struct QueuedTileLayer
+    {
+        TileLayer::Ptr layer_;
+        // Position in writeQueue_, or its end while the layer is written.
+        std::list<MapTileKey>::iterator queuePosition_;
+    };
+
+    /** Durations of putting a layer, and the size of its blob before compression. */
+    struct PutTimings
+    {
+        double serializeMs_ = 0;  // Serialization and compression of the layer
+        double writeMs_ = 0;      // Writing the blobs of all layers of the put
+        size_t serializedBytes_ = 0;
+    };
+
+    // Put layers, sweeping expired tiles first. Returns the timings per layer.
+    std::vector<PutTimings> putTileLayers(std::vector<TileLayer::Ptr> const& layers);
+    // Write the string pool of a layer, if it has strings which are not cached yet.
+    void putStringPoolUpdate(TileLayer::Ptr const& l);
+    // Add the locate index blobs of the features of a layer.
+    void addLocateIndexBlobs(TileLayer const& l, std::vector<std::pair<std::string, std::string>>& blobs);
+    // Key of a feature in the locate index.
+    static std::string locateIndexKey(std::string const& nodeId, LocateRequest const& req);
+    // Get a tile blob, decompressed if it was compressed. Counts the read bytes.
+    SharedBlob getDecompressedTileLayerBlob(MapTileKey const& k, LayerStatistics& stats);
+    // Get the counters of the map layer of a tile, creating them on first use.
+    LayerStatistics& layerStatistics(MapTileKey const& k);
+    // Count a cache hit or miss, globally and for the layer.
+    void countLookup(LayerStatistics& stats, bool hit);
+    // Get a queued layer which was not written yet, or null.
+    TileLayer::Ptr getQueuedTileLayer(MapTileKey const& k);
+    // Write a queued layer right away, so that its blob can be read.
+    void writeQueuedTileLayer(MapTileKey const& k);
+    // Get a tile from the live tier, or register a blob read for it.
+    TileLayer::Ptr getLiveTile(MapTileKey const& k, DataSourceInfo const& dataSource);
+    // Finish a blob read, and add its result to the live tier.
+    void finishLiveTileRead(MapTileKey const& k, TileLayer::Ptr const& layer, size_t bytes);
+    // Remember when a put tile expires, or forget it if it has no ttl. Requires expiryMutex_.
+    void trackExpiry(MapTileKey const& k, std::optional<std::chrono::system_clock::time_point> expiresAt);
+    // Remove expired tiles, see sweepExpiredTiles(). Requires expiryMutex_.
+    size_t sweepExpiredTilesLocked(size_t maxTiles);
+    // Remove a tile from the live tier, and mark running reads of it as stale.
+    void dropLiveTile(MapTileKey const& k);
+    // Remove a tile from the live tier. Requires liveTilesMutex_.
+    void eraseLiveTile(std::unordered_map<MapTileKey, LiveTile, MapTileKey::Hash>::iterator it);
+    // Remove the least recently used live tiles, until the given number of bytes is freed.
+    size_t reclaimLiveTiles(size_t bytes);
+    // Set the reserved size of the string pool of a node. Requires stringPoolOffsetMutex_.
+    void setStringPoolBytes(std::string const& nodeId, size_t bytes);
+
+    mutable std::mutex liveTilesMutex_;  // Mutex for all of the live tier members
+    std::unordered_map<MapTileKey, LiveTile, MapTileKey::Hash> liveTiles_;
+    std::list<MapTileKey> liveTilesLru_;  // Most recently used first
+    std::unordered_map<MapTileKey, LiveTileRead, MapTileKey::Hash> liveTileReads_;
+    size_t liveTileBytes_ = 0;
+    size_t maxLiveTileBytes_ = DefaultMaxLiveTileBytes;
+    std::atomic<int64_t> liveTileHits_ = 0;
+    uint64_t reclaimerId_ = 0;  // Id of the live tier's reclaimer at the MemoryBudget
+
+    // Mutex for the expiry members. Also held while expired tile blobs are erased.
+    std::mutex expiryMutex_;
+    std::multimap<std::chrono::system_clock::time_point, MapTileKey> expiryQueue_;  // Earliest first
+    std::unordered_map<MapTileKey, std::chrono::system_clock::time_point, MapTileKey::Hash> tileExpiry_;
+    std::atomic<int64_t> expiredTiles_ = 0;
+
+    std::unique_ptr<TileBlobCompression> compression_;  // Null if compression is disabled
+
+    // Decompresses the compressed blobs which are read while compression
+    // is disabled, created with the first of them.
+    std::once_flag decompressionOnce_;
+    std::unique_ptr<TileBlobCompression> decompression_;
+
+    bool locateIndexEnabled_ = false;
+    std::atomic<int64_t> locateIndexFeatures_ = 0;
+
+    // Reads of the counters only take the shared lock. Layers are added under the unique lock.
+    mutable std::shared_mutex layerStatisticsMutex_;
+    std::map<std::string, std::map<std::string, std::unique_ptr<LayerStatistics>, std::less<>>, std::less<>> layerStatistics_;
+
+    mutable std::mutex writeQueueMutex_;  // Mutex for all of the write-behind members
+    std::list<MapTileKey> writeQueue_;  // Oldest first
+    std::unordered_map<MapTileKey, QueuedTileLayer, MapTileKey::Hash> queuedTileLayers_;
+    size_t maxQueuedTileLayers_ = 0;
+    bool writerActive_ = false;
+    std::atomic<int64_t> droppedTileLayers_ = 0;
 };
 
 }
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "cache.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace mapget
+{
+
+/**
+ * Consistent hash ring, which assigns each tile to one node of a cluster.
+ * Each node is placed on the ring at VirtualNodes points, and a tile is
+ * owned by the node of the first point after the hash of its key. So all
+ * nodes which know the same node names agree on the owners, and adding or
+ * removing a node only moves the tiles which it gains or loses.
+ */
+class HashRing
+{
+public:
+    /** Number of points of each node on the ring. */
+    static constexpr size_t VirtualNodes = 64;
+
+    /** Construct a ring of the given nodes. The node names must be unique. */
+    explicit HashRing(std::vector<std::string> nodes);
+
+    /** Index of the node which owns the tile. */
+    [[nodiscard]] size_t owner(MapTileKey const& key) const;
+
+    [[nodiscard]] std::vector<std::string> const& nodes() const;
+
+private:
+    std::vector<std::string> nodes_;
+    std::vector<std::pair<uint64_t, size_t>> points_;  // (hash, node index), ascending
+};
+
+/**
+ * Other node of a cluster of services, see Service::setCluster(), which
+ * loads the tiles that it owns on behalf of this node.
+ */
+class ClusterPeer
+{
+public:
+    using Ptr = std::shared_ptr<ClusterPeer>;
+
+    virtual ~ClusterPeer() = default;
+
+    /**
+     * Load tiles of one map layer from the peer, which takes them from its
+     * cache or loads them from its data sources. The strings of the tiles are
+     * added to the string pools of the given cache. Returns one layer per key,
+     * which is null if the peer could not load it. The peer may stop once
+     * all tiles are cancelled. Throws if the peer cannot be reached.
+     */
+    virtual std::vector<TileLayer::Ptr> get(
+        std::vector<MapTileKey> const& keys,
+        Cache::Ptr const& cache,
+        DataSourceInfo const& info,
+        std::vector<CancellationToken::Ptr> const& cancellations) = 0;
+
+    /**
+     * Asynchronous variant of get(...), which is called by mapget::Service
+     * workers, so that they do not block a service thread while the peer
+     * loads the tiles. The onResult callback must be called exactly once,
+     * possibly from another thread, with one layer per key. All layers are
+     * null if the peer could not be reached. If getAsync throws, the callback
+     * must not be called. The default implementation calls get(...).
+     */
+    virtual void getAsync(
+        std::vector<MapTileKey> const& keys,
+        Cache::Ptr const& cache,
+        DataSourceInfo const& info,
+        std::function<void(std::vector<TileLayer::Ptr>)> onResult,
+        std::vector<CancellationToken::Ptr> const& cancellations);
+};
+
+}  // namespace mapget
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mapget/model/layer.h"
+#include "nlohmann/json.hpp"
+
+namespace mapget
+{
+
+/**
+ * zstd compression of cached tile blobs. The tiles of one map layer are
+ * very similar, so a dictionary is trained per (map, layer) from the first
+ * compressed tiles, and used for all later tiles of the layer. Tiles which
+ * were compressed with a dictionary can only be decompressed with it, so
+ * dictionaries are persisted through the given callbacks, and a persisted
+ * dictionary is never replaced.
+ */
+class TileBlobCompression
+{
+public:
+    /** Load the persisted dictionary of a map layer, see dictionaryKey(). */
+    using LoadDictionaryFun = std::function<std::optional<std::string>(std::string const& key)>;
+
+    /** Persist the dictionary of a map layer, see dictionaryKey(). */
+    using StoreDictionaryFun = std::function<void(std::string const& key, std::string const& dictionary)>;
+
+    TileBlobCompression(int level, LoadDictionaryFun loadDictionary, StoreDictionaryFun storeDictionary);
+    ~TileBlobCompression();
+
+    /** Compress a serialized tile layer message. */
+    std::string compress(MapTileKey const& k, std::string const& blob);
+
+    /**
+     * Decompress a blob which was returned by compress(). Blobs which are
+     * not compressed, e.g. ones which were cached before compression was
+     * enabled, are returned as they are. The dictionary of the layer is
+     * loaded on demand, so any instance can decompress any blob whose
+     * dictionary was persisted, regardless of its own level.
+     */
+    std::shared_ptr<const std::string> decompress(MapTileKey const& k, std::shared_ptr<const std::string> blob);
+
+    /** Check whether a blob starts with a zstd frame, i.e. was returned by compress(). */
+    static bool isCompressed(std::string const& blob);
+
+    /** Key of the dictionary of the map layer of a tile. */
+    static std::string dictionaryKey(MapTileKey const& k);
+
+    /**
+     * Get the compression statistics:
+     * `compression-dictionaries`: Number of map layers with a dictionary.
+     * `compressed-tiles`: Number of compressed tile blobs.
+     * `compression-input-bytes`, `compression-output-bytes`: Total size of the blobs before and after compression.
+     * `compression-ratio`: Input bytes divided by output bytes.
+     * `compression-ms`, `decompression-ms`: Total time spent compressing and decompressing blobs.
+     */
+    [[nodiscard]] nlohmann::json getStatistics() const;
+
+    /** Number of tiles of a map layer which are sampled to train its dictionary. */
+    static constexpr size_t DictionarySampleCount = 64;
+
+    /** Size of a tile which is sampled for dictionary training at most. Larger tiles are truncated. */
+    static constexpr size_t DictionarySampleBytes = 128 * 1024;
+
+    /** Maximum size of a trained dictionary. */
+    static constexpr size_t MaxDictionaryBytes = 64 * 1024;
+
+private:
+    // zstd dictionaries of a map layer, see compression.cpp.
+    struct LayerDictionary;
+
+    struct LayerState
+    {
+        bool loaded_ = false;  // Whether the persisted dictionary was looked up
+        bool training_ = false;  // Whether the samples are being trained
+        std::shared_ptr<LayerDictionary> dictionary_;
+        std::vector<std::string> samples_;
+    };
+
+    // Get the dictionary of a layer for compression, or null. Collects the
+    // blob as a training sample while the layer has no dictionary yet.
+    std::shared_ptr<LayerDictionary> compressionDictionary(MapTileKey const& k, std::string const& blob);
+    // Get the dictionary of a layer for decompression, or null. Looks
+    // the dictionary up again if the layer has none, for shared caches.
+    std::shared_ptr<LayerDictionary> decompressionDictionary(MapTileKey const& k);
+    // Train the dictionary of a layer from its samples, and persist it.
+    void trainDictionary(std::string const& key, std::vector<std::string> const& samples);
+    // Get the state of a layer, loading its persisted dictionary once. Requires mutex_.
+    LayerState& layerState(std::string const& key);
+    // Create the zstd dictionaries from a dictionary blob.
+    std::shared_ptr<LayerDictionary> makeDictionary(std::string const& dictionary) const;
+
+    int level_ = 0;
+    LoadDictionaryFun loadDictionary_;
+    StoreDictionaryFun storeDictionary_;
+
+    std::mutex mutex_;  // Mutex for layers_
+    std::unordered_map<std::string, LayerState> layers_;
+
+    std::atomic<int64_t> numDictionaries_ = 0;
+    std::atomic<int64_t> compressedTiles_ = 0;
+    std::atomic<int64_t> inputBytes_ = 0;
+    std::atomic<int64_t> outputBytes_ = 0;
+    std::atomic<int64_t> compressionMicros_ = 0;
+    std::atomic<int64_t> decompressionMicros_ = 0;
+};
+
+}
@@ -3,9 +3,14 @@
 #include "cache.h"
 #include "locate.h"
 
+#include "mapget/model/binarylayer.h"
 #include "mapget/model/featurelayer.h"
 #include "mapget/model/sourcedatalayer.h"
 
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
 namespace mapget
 {
 
@@ -34,11 +39,33 @@ public:
      *  should fill according the available data. If any error occurs
      *  while doing so, the data source may use TileLayer::setError.
      *  To store any extra information of interest such as timings or sizes,
-     *  TileLayer::setInfo() may be used.
+     *  TileLayer::setInfo() may be used. Expensive fills should check
+     *  TileLayer::isCancelled() now and then, and return early if nobody
+     *  waits for the tile anymore. Cancelled tiles are discarded.
+     *  The columns of the tile are reserved for the sizes of previously
+     *  filled tiles of the same layer. A data source which knows better
+     *  may call TileFeatureLayer::reserve() itself. Fills of huge tiles may
+     *  call TileFeatureLayer::sendChunk() now and then, so that requesters
+     *  which accept chunks get the first features early.
      */
     virtual void fill(TileFeatureLayer::Ptr const& featureTile) = 0;
     virtual void fill(TileSourceDataLayer::Ptr const& sourceData) = 0;
 
+    /**
+     * Fill the payload of a Heightmap, OrthoImage or GLTF layer tile, see
+     * TileBinaryLayer. Data sources which serve such layers must override
+     * this. The default implementation sets an error on the tile.
+     */
+    virtual void fill(TileBinaryLayer::Ptr const& binaryTile);
+
+    /**
+     * Fill a batch of up to DataSourceInfo::maxBatchSize_ feature tiles
+     * of the same layer. Data sources which can load adjacent tiles more
+     * cheaply in one go may override this. The default implementation
+     * calls fill() for each tile.
+     */
+    virtual void fill(std::vector<TileFeatureLayer::Ptr> const& featureTiles);
+
     /**
      * Obtain map tile keys where the feature with the specified ID may be found.
      * The implementation is completely datasource-specific. Note, that the returned
@@ -48,11 +75,92 @@ public:
      */
     virtual std::vector<LocateResponse> locate(LocateRequest const& req);
 
-    /** Called by mapget::Service worker. Dispatches to Cache or fill(...) on miss. */
-    virtual TileLayer::Ptr get(MapTileKey const& k, Cache::Ptr& cache, DataSourceInfo const& info);
+    /**
+     * Batched variant of locate(...), which returns one list of responses
+     * per request. Used by mapget::Service to resolve all indirect feature
+     * IDs of an add-on tile at once. The default implementation calls
+     * locate(...) for each request.
+     */
+    virtual std::vector<std::vector<LocateResponse>> locate(std::vector<LocateRequest> const& requests);
+
+    /**
+     * Called by mapget::Service worker. Dispatches to Cache or fill(...) on miss.
+     * The cancellation token, if any, is attached to the filled tile.
+     */
+    virtual TileLayer::Ptr get(
+        MapTileKey const& k,
+        Cache::Ptr& cache,
+        DataSourceInfo const& info,
+        CancellationToken::Ptr const& cancellation = {});
+
+    /**
+     * Called by mapget::Service worker for a batch of tile keys. Feature tiles
+     * of the same layer are passed to a single batched fill(...) call. Other
+     * batches are loaded tile by tile using get(...). Returns one layer per key.
+     * The cancellation tokens are either empty, or there is one per key.
+     */
+    virtual std::vector<TileLayer::Ptr> get(
+        std::vector<MapTileKey> const& keys,
+        Cache::Ptr& cache,
+        DataSourceInfo const& info,
+        std::vector<CancellationToken::Ptr> const& cancellations = {});
+
+    /**
+     * Asynchronous variant of get(...), which is called by mapget::Service
+     * workers for single tile jobs. Data sources which wait for I/O (e.g. a
+     * remote server) may override this, so that they do not block a service
+     * thread while the tile is loaded. The onResult callback must be called
+     * exactly once, possibly from another thread, with the loaded tile or
+     * null if loading failed. If getAsync throws, the callback must not be
+     * called. The default implementation calls get(...) and passes its result.
+     */
+    virtual void getAsync(
+        MapTileKey const& k,
+        Cache::Ptr const& cache,
+        DataSourceInfo const& info,
+        std::function<void(TileLayer::Ptr)> onResult,
+        CancellationToken::Ptr const& cancellation = {});
+
+    /**
+     * Asynchronous variant of get(...) for a batch of tile keys, which is
+     * called by mapget::Service workers for batched jobs. The onResult
+     * callback must be called exactly once, possibly from another thread,
+     * with one layer per key, which is null if loading the tile failed. If
+     * getBatchAsync throws, the callback must not be called. The default
+     * implementation calls get(...) and passes its result.
+     */
+    virtual void getBatchAsync(
+        std::vector<MapTileKey> const& keys,
+        Cache::Ptr const& cache,
+        DataSourceInfo const& info,
+        std::function<void(std::vector<TileLayer::Ptr>)> onResult,
+        std::vector<CancellationToken::Ptr> const& cancellations = {});
+
+    /**
+     * Get a tile as a serialized TileLayer message with raw geometry, as
+     * a Cache stores it, so that the service can forward it to requesters
+     * of messages without parsing it. Data sources which hold serialized
+     * tiles may override this. The string pool of the message must be the
+     * one which the tiles of get(...) use. The default implementation
+     * returns nullopt, then the tile is loaded via get(...).
+     */
+    virtual std::optional<Cache::TileLayerMessage> getTileLayerMessage(MapTileKey const& k, Cache::Ptr const& cache)
+    {
+        return {};
+    }
 
 protected:
     static simfil::StringId cachedStringPoolOffset(std::string const& nodeId, Cache::Ptr const& cache);
+
+private:
+    // Reserve the columns of a feature tile for the sizes of its layer.
+    void reserveColumns(TileFeatureLayer& featureTile);
+    // Update the sizes of the layer of a filled feature tile.
+    void recordColumnSizes(TileFeatureLayer const& featureTile);
+
+    // Moving average of the column sizes of the filled tiles per layer id.
+    std::mutex sizeHintsMutex_;
+    std::unordered_map<std::string, TileFeatureLayer::SizeHint> sizeHints_;
 };
 
 }
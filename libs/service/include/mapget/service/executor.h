@@ -0,0 +1,55 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+
+namespace mapget
+{
+
+/**
+ * Fixed-size work-stealing thread pool. Each thread owns a task queue.
+ * Tasks which are posted from within a pool thread are placed in that
+ * thread's own queue, other tasks are distributed round-robin. Idle
+ * threads steal tasks from the queues of busy threads. A posted task
+ * wakes at most one sleeping thread.
+ */
+class Executor
+{
+public:
+    using Task = std::function<void()>;
+
+    /**
+     * Construct an executor and launch its threads.
+     * @param numThreads Number of threads. If zero, the number of
+     *  hardware threads is used.
+     */
+    explicit Executor(size_t numThreads = 0);
+
+    /** Destructor. Calls stop(). */
+    ~Executor();
+
+    /**
+     * Schedule a task for execution. Exceptions thrown by the task
+     * are logged. Tasks which are posted after stop() was called
+     * are discarded.
+     */
+    void post(Task task);
+
+    /**
+     * Wait for the currently running tasks to finish, discard queued
+     * tasks and join all threads. Must not be called from a task.
+     */
+    void stop();
+
+    /** Number of threads in this executor. */
+    [[nodiscard]] size_t numThreads() const;
+
+    /** Number of tasks which are queued but not yet running. */
+    [[nodiscard]] size_t numQueuedTasks() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+}  // namespace mapget
@@ -46,4 +46,25 @@ public:
     [[nodiscard]] nlohmann::json serialize() const override;
 };
 
+/**
+ * A relation of a feature, with the tiles which contain its target feature,
+ * and the target features if they were loaded, see Service::resolveRelations().
+ * A target id may be located in several tiles, and the lists stay empty if
+ * it could not be located.
+ */
+struct ResolvedRelation
+{
+    model_ptr<Feature> source_;
+    model_ptr<Relation> relation_;
+    std::vector<MapTileKey> targetTiles_;
+    std::vector<model_ptr<Feature>> targets_;
+
+    /**
+     * Serialize the source and target feature ids, the relation
+     * name and the target tile keys. The target features are
+     * written as `targets` if withTargets is set.
+     */
+    [[nodiscard]] nlohmann::json serialize(bool withTargets = false) const;
+};
+
 }
@@ -2,15 +2,22 @@
 
 #include "cache.h"
 
+#include <list>
+#include <memory>
 #include <unordered_map>
-#include <deque>
-#include <shared_mutex>
+#include <vector>
 
 namespace mapget
 {
 
 /**
- * Simple in-memory mapget cache implementation.
+ * Simple in-memory mapget cache implementation. Tiles are evicted in
+ * least-recently-used order, once the number of cached tiles or their
+ * total blob size exceeds its limit. The tiles are distributed over
+ * shards with their own locks and LRU lists, each of which holds an
+ * equal part of the limits, so that concurrent lookups rarely contend.
+ * The blobs are reserved from the MemoryBudget, which may evict tiles
+ * before the limits are reached, if it is under pressure.
  */
 class MemCache : public Cache
 {
@@ -18,32 +25,46 @@ public:
     using Ptr = std::shared_ptr<Cache>;
 
     /**
-     * Construct a cache, and indicate the max number of cached tiles.
-     * If the limit is reached, tiles are evicted in FIFO order.
+     * Construct a cache, and indicate the max number of cached tiles,
+     * and the max total size of their blobs in bytes. Zero means no limit.
      */
-    MemCache(uint32_t maxCachedTiles=1024);
+    MemCache(uint32_t maxCachedTiles=1024, size_t maxCachedBytes=0);
+    ~MemCache() override;
 
     /** Retrieve a TileLayer blob for a MapTileKey. */
     std::optional<std::string> getTileLayerBlob(MapTileKey const& k) override;
 
+    /** Retrieve a TileLayer blob for a MapTileKey without copying it. */
+    SharedBlob getSharedTileLayerBlob(MapTileKey const& k) override;
+
     /** Upsert a TileLayer blob. */
     void putTileLayerBlob(MapTileKey const& k, std::string const& v) override;
 
+    /** Remove a TileLayer blob. */
+    void eraseTileLayerBlob(MapTileKey const& k) override;
+
     /** Retrieve a string-pool blob for a sourceNodeId -> No-Op */
     std::optional<std::string> getStringPoolBlob(std::string_view const& sourceNodeId) override {return {};}
 
     /** Upsert a string-pool blob. -> No-Op */
     void putStringPoolBlob(std::string_view const& sourceNodeId, std::string const& v) override {}
 
-    /** Enriches the statistics with info about the number of cached tiles. */
+    /** Enriches the statistics with info about the number and size of cached tiles. */
     nlohmann::json getStatistics() const override;
 
 private:
-    // Cached tile blobs.
-    std::shared_mutex cacheMutex_;
-    std::unordered_map<std::string, std::string> cachedTiles_;
-    std::deque<std::string> fifo_;
-    uint32_t maxCachedTiles_ = 0;
+    // Tiles up to which the cache is not sharded, per shard.
+    static constexpr uint32_t MinTilesPerShard = 64;
+    static constexpr uint32_t MaxShards = 16;
+
+    struct Shard;
+    Shard& shardFor(MapTileKey const& tileKey);
+
+    // Evict the least recently used tiles, until the given number of bytes is freed.
+    size_t reclaim(size_t bytes);
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    uint64_t reclaimerId_ = 0;  // Id of the reclaimer at the MemoryBudget
 };
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "nlohmann/json.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+
+namespace mapget
+{
+
+/** Components which reserve their memory from the MemoryBudget. */
+enum class MemoryPool : uint8_t {
+    CachedTiles,   // Tile blobs of memory caches
+    LiveTiles,     // Parsed tiles of the live tile tiers of caches
+    StringPools,   // String pools of caches, estimated by their serialized size
+    LoadingTiles,  // Tiles which data sources are filling, estimated by their blob size
+    Buffers,       // Serialized results which wait to be sent to a client
+    DeltaBases     // Served layers which are kept as the bases of deltas
+};
+
+/**
+ * Process-wide memory budget, from which the caches, the string pools, the
+ * tiles which are being loaded, and the response buffers reserve their
+ * memory. Reservations are never refused, so that the budget does not make
+ * anything fail. Instead, the budget applies backpressure before the limit
+ * is hit: Once the reserved memory exceeds the soft limit, the budget is
+ * under pressure. Then reclaim() asks the reclaimers, e.g. the caches, to
+ * free memory, and the service runs at most one job per data source. Once
+ * the limit is reached, the budget is exhausted, and new /tiles requests
+ * are rejected. Without a limit, the budget only counts. The limit is set
+ * by setLimit(), or the MAPGET_MEMORY_LIMIT_MB environment variable.
+ */
+class MemoryBudget
+{
+public:
+    static MemoryBudget& instance();
+
+    /** Default soft limit, as a fraction of the limit. */
+    static constexpr double DefaultSoftLimitRatio = 0.8;
+
+    /** Set the limit in bytes, zero for no limit, and the soft limit as a fraction of it. */
+    void setLimit(size_t bytes, double softLimitRatio = DefaultSoftLimitRatio);
+
+    [[nodiscard]] size_t limit() const;
+    [[nodiscard]] size_t softLimit() const;
+
+    /** Reserved bytes in total, and of a single pool. */
+    [[nodiscard]] size_t reserved() const;
+    [[nodiscard]] size_t reserved(MemoryPool pool) const;
+
+    /** Reserve and release bytes of a pool, from any thread. */
+    void reserve(MemoryPool pool, size_t bytes);
+    void release(MemoryPool pool, size_t bytes);
+
+    /** Whether the reserved bytes exceed the soft limit. */
+    [[nodiscard]] bool isUnderPressure() const;
+
+    /** Whether the reserved bytes reached the limit. */
+    [[nodiscard]] bool isExhausted() const;
+
+    /**
+     * Function which frees up to the given number of bytes, releases
+     * them from the budget, and returns how many it freed.
+     */
+    using Reclaimer = std::function<size_t(size_t)>;
+
+    /** Add a reclaimer, and return its id for removeReclaimer(). */
+    uint64_t addReclaimer(Reclaimer reclaimer);
+
+    /** Remove a reclaimer. It is not running anymore once this returns. */
+    void removeReclaimer(uint64_t id);
+
+    /**
+     * If the budget is under pressure, ask the reclaimers in the order of
+     * their addition to free memory, until the reserved bytes are a tenth
+     * below the soft limit, so that it is not reclaimed again right away.
+     * Only one thread reclaims at a time, others return right away. Must
+     * not be called while holding a lock which the reclaimers take.
+     * Returns the number of freed bytes.
+     */
+    size_t reclaim();
+
+    /**
+     * Get the `limit` and `soft-limit`, the `reserved` bytes with the bytes
+     * per pool, whether the budget is `under-pressure`, the number of
+     * `reclaims` which freed memory, and the `reclaimed-bytes`.
+     */
+    [[nodiscard]] nlohmann::json getStatistics() const;
+
+    /** Name of a pool in the statistics, e.g. `cached-tiles`. */
+    static char const* poolName(MemoryPool pool);
+
+    /**
+     * Bytes of a pool which are reserved while the reservation lives.
+     * A reservation must not be resized by several threads at once.
+     */
+    class Reservation
+    {
+    public:
+        explicit Reservation(MemoryPool pool, size_t bytes = 0);
+        ~Reservation();
+
+        Reservation(Reservation const&) = delete;
+        Reservation& operator=(Reservation const&) = delete;
+
+        /** Reserve more or release some of the bytes, so that the given number is reserved. */
+        void resize(size_t bytes);
+
+        [[nodiscard]] size_t bytes() const { return bytes_; }
+
+    private:
+        MemoryPool pool_;
+        size_t bytes_ = 0;
+    };
+
+private:
+    MemoryBudget();
+
+    static constexpr size_t NumPools = 6;
+
+    std::atomic<size_t> limit_ = 0;
+    std::atomic<size_t> softLimit_ = 0;
+    std::atomic<size_t> reserved_ = 0;
+    std::array<std::atomic<size_t>, NumPools> reservedPerPool_{};
+    std::atomic<int64_t> reclaims_ = 0;
+    std::atomic<int64_t> reclaimedBytes_ = 0;
+
+    // Held while the reclaimers run, so that removed ones are not running.
+    std::mutex reclaimMutex_;
+    std::mutex reclaimersMutex_;  // Mutex for the reclaimers
+    std::list<std::pair<uint64_t, Reclaimer>> reclaimers_;
+    uint64_t nextReclaimerId_ = 0;
+};
+
+}  // namespace mapget
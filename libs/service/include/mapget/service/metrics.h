@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace mapget
+{
+
+/** Label name/value pairs of a metric sample. */
+using MetricLabels = std::vector<std::pair<std::string, std::string>>;
+
+/**
+ * Histogram with fixed bucket bounds. Observations only use relaxed
+ * atomic increments, so a histogram can be updated concurrently and
+ * cheaply from any thread.
+ */
+class Histogram
+{
+public:
+    /** Bucket upper bounds for durations in seconds, from 0.5ms to 10s. */
+    static std::vector<double> const& defaultDurationBounds();
+
+    /** Construct a histogram with the given ascending bucket upper bounds. */
+    explicit Histogram(std::vector<double> upperBounds = defaultDurationBounds());
+
+    /** Add a value to the histogram. */
+    void observe(double value);
+
+    /** Bucket upper bounds, without the implicit +Inf bucket. */
+    [[nodiscard]] std::vector<double> const& upperBounds() const;
+
+    /** Number of observed values per bucket, including the +Inf bucket. Not cumulative. */
+    [[nodiscard]] std::vector<uint64_t> bucketCounts() const;
+
+    /** Total number and sum of the observed values. */
+    [[nodiscard]] uint64_t count() const;
+    [[nodiscard]] double sum() const;
+
+private:
+    std::vector<double> upperBounds_;
+    std::unique_ptr<std::atomic<uint64_t>[]> bucketCounts_;
+    std::atomic<uint64_t> count_ = 0;
+    std::atomic<double> sum_ = 0.;
+};
+
+/**
+ * Writes metrics in the Prometheus text exposition format. All samples
+ * of a metric must be written directly after its family() call.
+ */
+class MetricsWriter
+{
+public:
+    explicit MetricsWriter(std::ostream& out);
+
+    /** Write the HELP and TYPE lines of a metric, e.g. of type "counter". */
+    void family(std::string_view name, std::string_view type, std::string_view help);
+
+    /** Write a single counter or gauge sample. */
+    void sample(std::string_view name, MetricLabels const& labels, double value);
+
+    /** Write the bucket, sum and count samples of a histogram. */
+    void histogram(std::string_view name, MetricLabels const& labels, Histogram const& histogram);
+
+private:
+    void writeLabels(MetricLabels const& labels, std::string_view extraName = {}, std::string_view extraValue = {});
+
+    std::ostream& out_;
+};
+
+}  // namespace mapget
@@ -10,7 +10,8 @@ namespace mapget
 /**
  * A persistent cache implementation that stores layers and string pools
  * in RocksDB. Oldest tiles are removed automatically in FIFO order when cacheMaxTiles is
- * reached.
+ * exceeded. They are removed in chunks of 1/16 of cacheMaxTiles, so that
+ * not every insertion has to delete a tile.
  */
 class RocksDBCache : public Cache
 {
@@ -23,10 +24,56 @@ public:
 
     std::optional<std::string> getTileLayerBlob(MapTileKey const& k) override;
     void putTileLayerBlob(MapTileKey const& k, std::string const& v) override;
+
+    /** Upserts all blobs with a single write. */
+    void putTileLayerBlobs(std::vector<std::pair<MapTileKey, std::string>> const& blobs) override;
+    void eraseTileLayerBlob(MapTileKey const& k) override;
     std::optional<std::string> getStringPoolBlob(std::string_view const& sourceNodeId) override;
     void putStringPoolBlob(std::string_view const& sourceNodeId, std::string const& v) override;
 
+    /** String pool updates are stored by node id and offset, see COL_STRING_POOL_UPDATES. */
+    [[nodiscard]] bool supportsStringPoolUpdates() const override { return true; }
+    void appendStringPoolUpdateBlob(
+        std::string_view const& sourceNodeId,
+        simfil::StringId offset,
+        std::string const& v) override;
+    std::vector<std::string> getStringPoolUpdateBlobs(std::string_view const& sourceNodeId) override;
+    std::optional<std::string> getCompressionDictionaryBlob(std::string const& key) override;
+    void putCompressionDictionaryBlob(std::string const& key, std::string const& v) override;
+
+    /** The locate index is stored in COL_LOCATE_INDEX, and written with a single write. */
+    std::optional<std::string> getLocateIndexBlob(std::string const& key) override;
+    void putLocateIndexBlobs(std::vector<std::pair<std::string, std::string>> const& blobs) override;
+
+    /** Enriches the statistics with the number of cached tiles. */
+    nlohmann::json getStatistics() const override;
+
 private:
+    // The max tile count is divided by this to get the eviction chunk size.
+    static constexpr uint32_t EvictionChunkDivisor = 16;
+
+    // Delete the given number of oldest tiles.
+    void evictOldestTiles(uint32_t count);
+
+    // Convert the entries of a cache from an older version, and count them.
+    void upgradeLegacyCache();
+
+    // Add the entries of a tile to a batch. Returns whether the tile existed already.
+    bool batchTileLayerBlob(
+        rocksdb::WriteBatch& batch,
+        MapTileKey const& k,
+        std::string const& v,
+        std::string const& timestamp);
+
+    // Write a batch of tiles, and evict the oldest tiles if there are too many.
+    void writeTileLayerBatch(rocksdb::WriteBatch& batch, uint32_t numNewTiles);
+
+    // Key prefix of the string pool updates of a node.
+    static std::string stringPoolUpdatePrefix(std::string_view const& sourceNodeId);
+
+    // Add an update of the persisted tile count to a batch.
+    void putTileCount(rocksdb::WriteBatch& batch, uint32_t count);
+
     rocksdb::DB* db_{};
     rocksdb::Options options_;
     rocksdb::WriteOptions write_options_;
@@ -1,13 +1,21 @@
 #pragma once
 
 #include "cache.h"
+#include "cluster.h"
 #include "datasource.h"
 #include "mapget/model/sourcedatalayer.h"
 #include "mapget/model/layer.h"
 #include "memcache.h"
+#include "metrics.h"
+#include "tracing.h"
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <deque>
 #include <mutex>
+#include <optional>
+#include <unordered_map>
 #include <utility>
 
 namespace mapget
@@ -17,7 +25,8 @@ enum class RequestStatus {
     Open = 0x0,
     Success = 0x1, /** The request has been fully satisfied. */
     NoDataSource = 0x2, /** No data source could provide the requested map + layer. */
-    Aborted = 0x3 /** Canceled, e.g. because a bundled request cannot be fulfilled. */
+    Aborted = 0x3, /** Canceled, e.g. because a bundled request cannot be fulfilled. */
+    Expired = 0x4 /** Done, but some tiles were dropped as their deadline passed, see LayerTilesRequest::setDeadline(). */
 };
 
 /**
@@ -39,6 +48,9 @@ public:
         std::string layerId,
         std::vector<TileId> tiles);
 
+    /** Destructor. Frees the results which were queued but not delivered. */
+    virtual ~LayerTilesRequest();
+
     /** Get the current status of the request. */
     RequestStatus getStatus();
 
@@ -56,7 +68,8 @@ public:
 
     /**
      * The map tile ids for which this request is dedicated.
-     * Must not be empty. Result tiles will be processed in the given order.
+     * Must not be empty. Result tiles will be processed in the given order,
+     * unless a focus point is set.
      */
     std::vector<TileId> tiles_;
 
@@ -66,7 +79,11 @@ public:
     std::function<void(RequestStatus)> onDone_;
 
     /**
-     * The callback function which is called when all tiles have been processed.
+     * Set the callback function which is called when a result tile is available.
+     * Requests for the same tile may receive the same tile object, so the
+     * callback must not modify it. A Service calls the callbacks of a request
+     * one at a time, on its delivery threads, so that a slow callback does
+     * not hold up the threads which load the tiles.
      */
     template <class Fun>
     LayerTilesRequest& onFeatureLayer(Fun&& callback) { onFeatureLayer_ = std::forward<Fun>(callback); return *this; }
@@ -74,8 +91,118 @@ public:
     template <class Fun>
     LayerTilesRequest& onSourceDataLayer(Fun&& callback) { onSourceDataLayer_ = std::forward<Fun>(callback); return *this; }
 
+    /** Receives the tiles of Heightmap, OrthoImage and GLTF layers. */
+    template <class Fun>
+    LayerTilesRequest& onBinaryLayer(Fun&& callback) { onBinaryLayer_ = std::forward<Fun>(callback); return *this; }
+
+    /**
+     * Set a callback function which receives cached result tiles as the
+     * serialized TileLayerStream messages from the cache, instead of parsed
+     * layers. Each message comes with the string pool of its data source
+     * node. Tiles which are not cached are still passed to the layer callbacks.
+     */
+    template <class Fun>
+    LayerTilesRequest& onTileLayerMessage(Fun&& callback) { onTileLayerMessage_ = std::forward<Fun>(callback); return *this; }
+
+    /**
+     * Set a focus point, e.g. the camera position of a map viewer. Tiles are
+     * then processed by ascending zoom level, and by ascending distance of
+     * their center to the focus point. Must be called before the request is
+     * passed to a service. To move the focus of a running request,
+     * use Service::setFocus().
+     */
+    LayerTilesRequest& setFocus(Point const& focus) { focus_ = focus; ++focusVersion_; return *this; }
+
+    /**
+     * Simplify the line and polygon geometries of the result feature layers
+     * according to the zoom level of their tiles, see TileFeatureLayer::simplified().
+     * The tolerance is the width of a tile divided by the given resolution, e.g.
+     * half a pixel for tiles which are drawn 512 pixels wide. Zero disables the
+     * simplification, which is the default. The service keeps the simplified
+     * tiles, so that each tile is only simplified once. Cached tiles are then
+     * passed to the layer callbacks instead of onTileLayerMessage(). Must be
+     * called before the request is passed to a service.
+     */
+    LayerTilesRequest& setSimplification(uint32_t resolution = DefaultSimplificationResolution) { simplificationResolution_ = resolution; return *this; }
+
+    /** Default resolution for setSimplification(). */
+    static constexpr uint32_t DefaultSimplificationResolution = 1024;
+
+    /**
+     * Set a deadline for all tiles of the request, e.g. when a map viewer
+     * will not draw them anymore. Tiles which were not served by their
+     * deadline are dropped: They are not served from the cache, their jobs
+     * are not scheduled, and running jobs which no other request waits for
+     * are cancelled. The request is then done with RequestStatus::Expired
+     * instead of Success. Must be called before the request is passed
+     * to a service.
+     */
+    LayerTilesRequest& setDeadline(std::chrono::steady_clock::time_point deadline) { deadline_ = deadline; return *this; }
+
+    /**
+     * Set a deadline for a single tile of the request, see setDeadline().
+     * The earlier one of the tile's and the request's deadline applies.
+     * Must be called before the request is passed to a service.
+     */
+    LayerTilesRequest& setDeadline(TileId tile, std::chrono::steady_clock::time_point deadline) { tileDeadlines_[tile.value_] = deadline; return *this; }
+
+    /**
+     * Accept the feature layers of tiles in chunks, see TileFeatureLayer::sendChunk(),
+     * so that the first features of a huge tile arrive while its data source still
+     * fills it. The chunks of a tile are passed to onFeatureLayer(), and the
+     * final one completes the tile. Tiles whose data source sends no chunks,
+     * or which were loaded already, arrive whole. Requests which simplify their
+     * tiles always get them whole. Must be called before the request is passed
+     * to a service.
+     */
+    LayerTilesRequest& setChunks(bool acceptsChunks = true) { acceptsChunks_ = acceptsChunks; return *this; }
+
+    /** Get the deadline of a tile of this request, if it has one. */
+    [[nodiscard]] std::optional<std::chrono::steady_clock::time_point> deadline(TileId tile) const;
+
+    /** Get the number of tiles which were dropped, as their deadline passed. */
+    [[nodiscard]] size_t expiredTileCount() const { return expiredCount_; }
+
+    /**
+     * Trace context of the client operation which issued this request.
+     * The spans which are recorded while the request's tiles are loaded
+     * become its children. Must be set before the request is passed to
+     * a service.
+     */
+    TraceContext traceContext_;
+
+    /**
+     * Client which issued this request, e.g. the clientId of a /tiles
+     * request. Data source workers share their capacity for a map layer
+     * between the clients whose requests wait for tiles, so a client does
+     * not get a larger share for sending more requests. Requests without
+     * a client id count as one client. Must be set before the request is
+     * passed to a service.
+     */
+    std::string clientId_;
+
+    /**
+     * Scheduling class of the client, e.g. "interactive" or "batch". The
+     * share of a client is proportional to the weight of its class, see
+     * Service::setClientClassWeight(). Must be set before the request is
+     * passed to a service.
+     */
+    std::string clientClass_ = DefaultClientClass;
+
+    /** Class of clients which do not name one. */
+    static constexpr auto DefaultClientClass = "default";
+
+    /**
+     * Set if this request was forwarded by another node of a cluster, see
+     * Service::setCluster(). Its tiles are then loaded by this node, even
+     * if another node owns them. Must be set before the request is passed
+     * to a service.
+     */
+    bool clusterForwarded_ = false;
+
 protected:
     virtual void notifyResult(TileLayer::Ptr);
+    virtual void notifyResultMessage(Cache::SharedBlob const& message, std::shared_ptr<StringPool> const& strings);
     void setStatus(RequestStatus s);
     void notifyStatus();
     nlohmann::json toJson();
@@ -86,25 +213,99 @@ private:
      */
     std::function<void(TileFeatureLayer::Ptr)> onFeatureLayer_;
     std::function<void(TileSourceDataLayer::Ptr)> onSourceDataLayer_;
+    std::function<void(TileBinaryLayer::Ptr)> onBinaryLayer_;
+    std::function<void(Cache::SharedBlob const&, std::shared_ptr<StringPool> const&)> onTileLayerMessage_;
 
-    // So the service can track which tileId index from tiles_
-    // is next in line to be processed.
-    size_t nextTileIndex_ = 0;
+    void countResult();
+    void countExpired();
+
+    /**
+     * Result which a service queues for delivery, see queueResult(). Either
+     * a tile layer, a cached tile layer message, or an expired tile.
+     */
+    struct QueuedResult
+    {
+        TileLayer::Ptr layer_;
+        Cache::SharedBlob message_;
+        std::shared_ptr<StringPool> strings_;
+        bool expired_ = false;
+        std::atomic<QueuedResult*> next_ = nullptr;
+    };
+
+    /**
+     * Queue a result, without waiting, from any thread. Returns true if the
+     * queue was idle, so that the caller must schedule drainResults().
+     */
+    bool queueResult(std::unique_ptr<QueuedResult> result);
+
+    /**
+     * Deliver the queued results to the callbacks, until none are left.
+     * Only one drain runs at a time, so the callbacks are never called
+     * concurrently, and a slow callback only delays this request.
+     */
+    void drainResults();
+
+    // Pop the oldest queued result. Returns null if the queue is empty,
+    // or if its next result is still being linked in by a producer.
+    QueuedResult* popResult();
+
+    // Intrusive MPSC queue of the results, with a stub node which is never
+    // delivered: Producers link results in with one atomic exchange on the
+    // head, the drain pops them from the tail. The count of queued results
+    // decides which producer schedules the drain.
+    QueuedResult resultQueueStub_;
+    std::atomic<QueuedResult*> resultQueueHead_ = &resultQueueStub_;
+    QueuedResult* resultQueueTail_ = &resultQueueStub_;
+    std::atomic<size_t> queuedResults_ = 0;
+
+    // So the service can track which tiles were not found in the
+    // cache, and are next in line to be processed by a data source.
+    std::deque<TileId> missingTiles_;
+
+    // When the request entered its request queue, to measure the queue
+    // wait time of its tiles. Guarded by the service's job mutex.
+    std::chrono::steady_clock::time_point queuedSince_;
 
     // So the requester can track how many results have been received.
+    // Expired tiles count as results, so that the request finishes.
     size_t resultCount_ = 0;
+    std::atomic<size_t> expiredCount_ = 0;
+
+    // Serializes result delivery with aborting the request.
+    std::mutex resultMutex_;
+
+    // Optional focus point for tile prioritization. While the request
+    // is processed by a service, it is guarded by the service's job mutex.
+    // The version is incremented whenever the focus changes.
+    std::optional<Point> focus_;
+    std::atomic<uint32_t> focusVersion_ = 0;
+
+    // Resolution for the geometry simplification, zero if it is disabled.
+    uint32_t simplificationResolution_ = 0;
+
+    // Whether feature layers may arrive in chunks, and the tiles (by TileId
+    // value) which chunks were sent for, with whether the final one was sent.
+    // The tiles are guarded by the service's job mutex.
+    bool acceptsChunks_ = false;
+    std::unordered_map<uint64_t, bool> chunkedTiles_;
+
+    // Optional deadlines of the request, and of single tiles by TileId value.
+    std::optional<std::chrono::steady_clock::time_point> deadline_;
+    std::unordered_map<uint64_t, std::chrono::steady_clock::time_point> tileDeadlines_;
 
     // Mutex/condition variable for reading/setting request status.
     std::mutex statusMutex_;
     std::condition_variable statusConditionVariable_;
-    RequestStatus status_ = RequestStatus::Open;
+    std::atomic<RequestStatus> status_ = RequestStatus::Open;
+    std::atomic_bool doneNotified_ = false;  // So that onDone_ is called once
 };
 
 /**
  * Class which serves to unify multiple data sources for multiple maps,
  * and a cache which may store/restore the output of any of these sources.
- * The service maintains a number of worker threads for each source, depending
- * on the source's maxParallelJobs_.
+ * All cache lookups and data source jobs run on one service-wide thread pool,
+ * which is sized to the available hardware threads. For each source, at most
+ * maxParallelJobs_ jobs run at the same time.
  */
 class Service
 {
@@ -115,22 +316,24 @@ public:
      * MemCache.
      * @param cache Cache instance to use.
      * @param useDataSourceConfig Instruct this service instance to makeDataSource its datasource
-     *  backends based on a subscription to the YAML datasource config file.
+     *  backends based on a subscription to the YAML datasource config file. The data
+     *  sources of the config are made in parallel, in the background, and each one is
+     *  served once it is ready. Sources which fail are retried, with a growing delay.
      */
     explicit Service(
         Cache::Ptr cache = std::make_shared<MemCache>(),
         bool useDataSourceConfig = false);
 
-    /** Destructor. Stops all workers of the present data sources. */
+    /** Destructor. Waits for the running jobs of all data sources. */
     ~Service();
 
     /**
-     * Add a data source. Worker threads will be launched as needed,
-     * and incoming/present requests for the data source will start to be
+     * Add a data source. Incoming/present requests for the data source will start to be
      * processed. Note, that the map layer versions for all layers of the
      * given source must be compatible with present one's, if existing.
      *
-     * Thread safety: This method should not be called in parallel with itself or remove().
+     * Thread safety: Calls are serialized with remove(), and with the data
+     * sources of the config, which are added by background threads.
      */
     void add(DataSource::Ptr const& dataSource);
 
@@ -139,15 +342,29 @@ public:
      * can only be satisfied by the given source will not be processed anymore.
      * TODO: Any such ongoing requests should be forcefully marked as done.
      *
-     * Thread safety: This method should not be called in parallel with itself or add().
+     * Thread safety: Calls are serialized with add().
      */
     void remove(DataSource::Ptr const& dataSource);
 
+    /** Default timeout of waitForConfig(). */
+    static constexpr auto DefaultConfigTimeout = std::chrono::seconds(60);
+
+    /**
+     * Wait until the data sources of the last applied config change have been
+     * made, see the useDataSourceConfig constructor parameter. Each source has
+     * then either been added, or failed once, in which case it is still retried
+     * in the background. Returns immediately if the service does not use the
+     * config, and false if the timeout passed first.
+     */
+    bool waitForConfig(std::chrono::milliseconds timeout = DefaultConfigTimeout);
+
     /**
      * Request some map data tiles. If the requested map+layer
      * combination is available, will schedule a job to retrieve
      * the tiles. A request object should only ever be passed
      * to one service. Otherwise, there is undefined behavior.
+     * Tiles outside of the layer's coverage or zoom levels are answered
+     * with empty layers without a job, unless the map has add-on sources.
      * @return false if the requested map+layer is not available
      * from any connected DataSource, true otherwise.
      */
@@ -157,15 +374,90 @@ public:
      * Trigger queries to all connected data sources to check
      * for a feature matching the given typeId and idParts.
      * Returns the list of MapTileKeys received from data sources.
+     * The data sources are queried concurrently, on the service threads.
+     * Non-empty results are kept for five minutes in a bounded LRU cache,
+     * which is keyed on the data source node and its layer versions. The
+     * results of a removed data source are dropped. If the cache has a locate
+     * index, features of cached tiles are located without the data sources.
      */
     std::vector<LocateResponse> locate(LocateRequest const& req);
 
+    /**
+     * Locate several features at once. Each data source gets the requests
+     * for its map as one batch, see DataSource::locate(std::vector<LocateRequest> const&),
+     * and the data sources are queried concurrently. Returns the responses
+     * per request, in the order of the requests.
+     */
+    std::vector<std::vector<LocateResponse>> locate(std::vector<LocateRequest> const& requests);
+
+    /**
+     * Resolve the targets of the relations of all features of a tile, e.g.
+     * to follow a road network across tiles. Targets in the tile itself
+     * are found directly. The other target ids are located in one batch,
+     * see locate(std::vector<LocateRequest> const&). If loadTargets is set,
+     * the target tiles are then requested together, from the cache or
+     * the data sources, and the target features are looked up in them.
+     * Returns one ResolvedRelation per relation, in feature order. Blocks
+     * until the target tiles are loaded, so it must not be called by a
+     * data source job.
+     */
+    std::vector<ResolvedRelation> resolveRelations(TileFeatureLayer::Ptr const& tile, bool loadTargets = true);
+
     /**
      * Abort the given request. The request will be removed from
-     * the processing queue, and forcefully marked as done.
+     * the processing queue, and forcefully marked as done. Running
+     * jobs for its tiles which no other request waits for are cancelled,
+     * see TileLayer::isCancelled().
      */
     void abort(LayerTilesRequest::Ptr const& r);
 
+    /**
+     * Move the focus point of a running request, e.g. because the camera
+     * of a map viewer moved. Its remaining tiles are reordered according
+     * to LayerTilesRequest::setFocus(), without aborting the request.
+     */
+    void setFocus(LayerTilesRequest::Ptr const& r, Point const& focus);
+
+    /**
+     * Enable or disable prefetching. If enabled, the neighbors, the parent
+     * and the children of requested tiles are loaded into the cache while
+     * the data sources have no requested tiles to process. Queued prefetches
+     * for a map are dropped as soon as new tiles are requested for it.
+     * Disabled by default.
+     */
+    void setPrefetching(bool enabled);
+
+    /**
+     * Enable or disable memory accounting. If enabled, each tile which is
+     * loaded from a data source records its TileLayer::memoryUsage() in its
+     * info as `memory-usage`, and the usage is summed up in getStatistics().
+     * Disabled by default, as it serializes the simfil nodes of each tile.
+     */
+    void setMemoryAccounting(bool enabled);
+
+    /**
+     * Set the scheduling weight of a client class, see LayerTilesRequest::clientClass_.
+     * The clients which wait for tiles of a map layer get its data source jobs in
+     * proportion to the weights of their classes, e.g. a client of a class with
+     * weight 4 gets four tiles for each tile of a client with weight 1. Classes
+     * without a weight have weight 1. The weight must be positive.
+     */
+    void setClientClassWeight(std::string const& clientClass, double weight);
+
+    /**
+     * Join a cluster of services, which share the loading of tiles. Each tile
+     * is owned by one node of the cluster, as assigned by a HashRing of the
+     * names of this node and of its peers. All nodes must use the same names.
+     * Tiles which are owned by a peer, and which are not in the cache, are
+     * loaded from the peer, see ClusterPeer, and are not cached by this node.
+     * So each tile is only loaded and cached by its owner. If the peer fails,
+     * the tile is loaded from the data sources of this node. Prefetching only
+     * loads the tiles which this node owns. Tiles of requests which were forwarded
+     * by a peer, see LayerTilesRequest::clusterForwarded_, are always loaded
+     * by this node. Passing no peers leaves the cluster.
+     */
+    void setCluster(std::string const& selfName, std::map<std::string, ClusterPeer::Ptr> peers);
+
     /** DataSourceInfo for all data sources which have been added to this Service. */
     std::vector<DataSourceInfo> info();
 
@@ -175,12 +467,68 @@ public:
     /**
      * Get Statistics about the operation of this service.
      * Returns the following values:
-     * - `workers`: Number of active workers.
-     * - `datasources`: Number of active data sources.
-     * - `active-requests`: Number of in-flight requests.
+     * - `datasources`: For each data source, its map id (`name`),
+     *   allowed parallel jobs (`workers`), tiles per batched fill
+     *   (`max-batch-size`) and running jobs (`active-jobs`).
+     * - `active-requests`: Number of in-flight requests with tiles that
+     *   must be processed by a data source.
+     * - `pending-cache-lookups`: Number of requests with unfinished cache lookups.
+     * - `executor-threads`: Size of the service's thread pool.
+     * - `queued-tasks`: Number of tasks waiting for a thread pool thread.
+     * - `prefetch`: Whether prefetching is `enabled`, the number of
+     *   `queued-tiles` and `loaded-tiles`, and the prefetch `hits`
+     *   (requested tiles which were prefetched) and `misses` (requested
+     *   tiles which had to be loaded from a data source).
+     * - `cancelled-jobs`: Number of running jobs which were cancelled,
+     *   as all requests waiting for them were aborted.
+     * - `pruned-tiles`: Number of requested tiles which were answered with
+     *   empty layers, as they are outside of their layer's coverage or
+     *   zoom levels.
+     * - `late-tiles`: Number of requested tiles which were dropped, as
+     *   their deadline passed, see LayerTilesRequest::setDeadline().
+     * - `locate-cache`: Number of cached locate results (`size`),
+     *   the locate cache `hits` and `misses`, and the misses of
+     *   results which were too old (`expired`).
+     * - `locate-index`: Whether the cache has a locate index (`enabled`),
+     *   the number of locates which it answered (`hits`), and of those
+     *   which it could not answer (`misses`), see Cache::setLocateIndexEnabled().
+     * - `simplified-tile-cache`: The same for the simplified tiles,
+     *   see LayerTilesRequest::setSimplification().
+     * - `memory-usage`: Whether memory accounting is `enabled`, the number
+     *   of accounted `tiles`, and their summed up `bytes` by column, see
+     *   setMemoryAccounting().
+     * - `memory-budget`: The statistics of MemoryBudget::getStatistics(),
+     *   and the number of `throttles`, i.e. how often a data source got no
+     *   more parallel jobs, as the budget was under pressure.
+     * - `column-pages`: The statistics of ColumnPagePool::getStatistics(),
+     *   i.e. of the per-thread pools of the pages of tile columns.
+     * - `client-classes`: Per client class which requested tiles, its
+     *   `weight`, the number of `queued-clients` and `queued-requests`
+     *   which wait for tiles, the number of `scheduled-tiles`, and their
+     *   `mean-queue-wait-ms`.
+     * - `cluster`: Whether the service is in a cluster (`enabled`), its
+     *   `nodes`, the number of `forwarded-tiles` which were loaded from
+     *   their owners, and the number of `forward-failures`, whose tiles
+     *   were loaded by this node instead.
      */
     [[nodiscard]] nlohmann::json getStatistics() const;
 
+    /**
+     * Write metrics about the operation of this service in the Prometheus
+     * text format. Per non-add-on data source, labelled with `source` (node id)
+     * and `map`, these are histograms of the tile load duration per job
+     * (`mapget_fill_duration_seconds`), of the cache lookup duration per tile
+     * (`mapget_cache_lookup_duration_seconds`) and of the time tiles waited in
+     * the request queue (`mapget_queue_wait_seconds`), the number of tiles which
+     * were passed to requests from the cache or from jobs (`mapget_tiles_served_total`),
+     * and the number of running jobs (`mapget_active_jobs`). The queue wait time
+     * is also written per client class (`mapget_client_queue_wait_seconds`,
+     * labelled with `class`). Service-wide gauges
+     * report the tiles which are being loaded and the queued executor tasks.
+     * Collecting the metrics only takes atomic increments.
+     */
+    void writeMetrics(MetricsWriter& writer) const;
+
     /** Get the Cache which this service was constructed with. */
     [[nodiscard]] Cache::Ptr cache();
 
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "cache.h"
+
+#include <mutex>
+
+namespace mapget
+{
+
+/**
+ * Cache which combines a fast front cache, e.g. a MemCache, with a
+ * larger back cache, e.g. a RocksDBCache. Tiles are looked up in the
+ * front first. Tiles which are only found in the back are promoted to
+ * the front. Tiles are written through to both caches, string pools
+ * are kept in the back. The string pools and their offsets are owned by
+ * the TieredCache itself, so both tiers store blobs which refer to the
+ * same string pools. The inner caches must not be used on their own.
+ */
+class TieredCache : public Cache
+{
+public:
+    TieredCache(Cache::Ptr front, Cache::Ptr back);
+
+    /** Retrieve a TileLayer blob for a MapTileKey. */
+    std::optional<std::string> getTileLayerBlob(MapTileKey const& k) override;
+
+    /** Retrieve a TileLayer blob from the front, or promote it from the back. */
+    SharedBlob getSharedTileLayerBlob(MapTileKey const& k) override;
+
+    /** Upsert a TileLayer blob in both tiers. */
+    void putTileLayerBlob(MapTileKey const& k, std::string const& v) override;
+
+    /** Upsert several TileLayer blobs in both tiers. */
+    void putTileLayerBlobs(std::vector<std::pair<MapTileKey, std::string>> const& blobs) override;
+
+    /** Remove a TileLayer blob from both tiers. */
+    void eraseTileLayerBlob(MapTileKey const& k) override;
+
+    /** Retrieve a string-pool blob from the back. */
+    std::optional<std::string> getStringPoolBlob(std::string_view const& sourceNodeId) override;
+
+    /** Upsert a string-pool blob in both tiers. */
+    void putStringPoolBlob(std::string_view const& sourceNodeId, std::string const& v) override;
+
+    /** String pool updates are kept in the back, if it supports them. */
+    [[nodiscard]] bool supportsStringPoolUpdates() const override;
+    void appendStringPoolUpdateBlob(
+        std::string_view const& sourceNodeId,
+        simfil::StringId offset,
+        std::string const& v) override;
+    std::vector<std::string> getStringPoolUpdateBlobs(std::string_view const& sourceNodeId) override;
+
+    /** Compression dictionaries are kept in the back. */
+    std::optional<std::string> getCompressionDictionaryBlob(std::string const& key) override;
+    void putCompressionDictionaryBlob(std::string const& key, std::string const& v) override;
+
+    /** The locate index is kept in the back. */
+    std::optional<std::string> getLocateIndexBlob(std::string const& key) override;
+    void putLocateIndexBlobs(std::vector<std::pair<std::string, std::string>> const& blobs) override;
+
+    /**
+     * Enriches the statistics with the number of promoted tiles,
+     * and with the statistics of the tiers as `front-tier` and `back-tier`.
+     */
+    nlohmann::json getStatistics() const override;
+
+private:
+    Cache::Ptr front_;
+    Cache::Ptr back_;
+
+    // Held while tiles are written, so that a promotion
+    // never overwrites a newer blob in the front.
+    std::mutex writeMutex_;
+    std::atomic<int64_t> promotedTiles_ = 0;
+};
+
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include "nlohmann/json.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace mapget
+{
+
+/** HTTP header which carries a W3C trace context between processes. */
+static constexpr auto TraceParentHeader = "traceparent";
+
+/**
+ * Identifies a span within a trace, as defined by the W3C trace context
+ * specification. A default-constructed context is invalid, i.e. it
+ * belongs to no trace.
+ */
+struct TraceContext
+{
+    std::string traceId_;  // 32 lowercase hex digits
+    std::string spanId_;   // 16 lowercase hex digits
+    bool sampled_ = true;
+
+    [[nodiscard]] bool isValid() const;
+
+    /** Encode the context as a traceparent header value. */
+    [[nodiscard]] std::string toTraceParent() const;
+
+    /** Parse a traceparent header value. Returns nullopt if it is malformed. */
+    static std::optional<TraceContext> fromTraceParent(std::string_view value);
+
+    /** The context which the calling thread currently works in, see TraceScope. */
+    static TraceContext const& current();
+};
+
+/**
+ * Sets the current trace context of the calling thread for its lifetime.
+ * Spans which are started without an explicit parent become its children.
+ */
+class TraceScope
+{
+public:
+    explicit TraceScope(TraceContext context);
+    ~TraceScope();
+
+    TraceScope(TraceScope const&) = delete;
+    TraceScope& operator=(TraceScope const&) = delete;
+
+private:
+    TraceContext previous_;
+};
+
+/** Span kinds, with the values which OpenTelemetry uses. */
+enum class SpanKind : uint8_t {
+    Internal = 1,
+    Server = 2,
+    Client = 3
+};
+
+using SpanAttributes = std::vector<std::pair<std::string, std::variant<std::string, int64_t>>>;
+
+/** A finished span, as recorded by the Tracer. */
+struct SpanData
+{
+    TraceContext context_;
+    std::string parentSpanId_;  // Empty for root spans
+    std::string name_;
+    SpanKind kind_ = SpanKind::Internal;
+    uint64_t startTimeUnixNano_ = 0;
+    uint64_t endTimeUnixNano_ = 0;
+    SpanAttributes attributes_;
+    std::optional<std::string> error_;
+};
+
+/**
+ * Process-wide collector of finished spans. Tracing is disabled unless
+ * enable() is called, or the MAPGET_TRACE_BUFFER_SIZE environment
+ * variable is set to a positive number. Spans are then kept in a bounded
+ * buffer, from which they are taken for export. The oldest spans are
+ * dropped if the buffer is full.
+ */
+class Tracer
+{
+public:
+    static Tracer& instance();
+
+    /** Keep up to maxBufferedSpans spans. Zero disables tracing. */
+    void enable(size_t maxBufferedSpans);
+
+    [[nodiscard]] bool isEnabled() const;
+
+    /** Add a finished span to the buffer. */
+    void record(SpanData span);
+
+    /** Take all buffered spans out of the buffer. */
+    std::vector<SpanData> takeSpans();
+
+    /** Number of spans which were dropped, as the buffer was full. */
+    [[nodiscard]] size_t numDroppedSpans() const;
+
+    /**
+     * Convert spans to the OTLP/JSON format, i.e. to the body of an
+     * OpenTelemetry collector's /v1/traces request.
+     */
+    static nlohmann::json toOtlpJson(std::vector<SpanData> const& spans);
+
+private:
+    Tracer();
+
+    std::atomic<size_t> maxBufferedSpans_ = 0;
+    std::atomic<size_t> numDroppedSpans_ = 0;
+    std::mutex mutex_;
+    std::deque<SpanData> spans_;  // Guarded by mutex_
+};
+
+/**
+ * Records the duration of a processing stage. The span starts when it
+ * is constructed, and ends when end() is called or when it is destroyed.
+ * If tracing is disabled, or the parent trace is not sampled, the span
+ * does not record anything, and its context() is that of its parent.
+ */
+class Span
+{
+public:
+    /** Construct a span which records nothing. */
+    Span() = default;
+
+    /**
+     * Start a span. If the parent context is invalid,
+     * the span is the root of a new trace.
+     */
+    explicit Span(
+        std::string name,
+        TraceContext const& parent = TraceContext::current(),
+        SpanKind kind = SpanKind::Internal);
+
+    Span(Span&& other) noexcept;
+    Span& operator=(Span&& other) noexcept;
+    ~Span();
+
+    [[nodiscard]] bool isRecording() const;
+
+    /** Context for child spans and for propagation to other processes. */
+    [[nodiscard]] TraceContext const& context() const;
+
+    /** Move the start of the span to an earlier point in time. */
+    void setStartTime(std::chrono::steady_clock::time_point start);
+
+    void setAttribute(std::string key, std::string value);
+    void setAttribute(std::string key, int64_t value);
+
+    /** Mark the span as failed. */
+    void setError(std::string message);
+
+    /** End the span and pass it to the Tracer. Further calls do nothing. */
+    void end();
+
+private:
+    std::optional<SpanData> data_;  // Only set while the span is recording
+    TraceContext context_;
+};
+
+}  // namespace mapget
@@ -0,0 +1,116 @@
+#include "allocations.h"
+
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace mapget
+{
+
+namespace
+{
+
+constexpr size_t NumStages = static_cast<size_t>(AllocationStage::AddOnMerge) + 1;
+
+struct StageTotals
+{
+    std::atomic<uint64_t> scopes_ = 0;
+    std::atomic<uint64_t> allocations_ = 0;
+    std::atomic<uint64_t> bytes_ = 0;
+};
+
+// Both are constant-initialized, so allocations
+// before static initialization can use them.
+std::array<StageTotals, NumStages> stageTotals;
+thread_local AllocationScope* currentScope = nullptr;
+
+}  // namespace
+
+AllocationScope::AllocationScope(AllocationStage stage) : stage_(stage), parent_(currentScope)
+{
+    currentScope = this;
+}
+
+AllocationScope::~AllocationScope()
+{
+    currentScope = parent_;
+    auto& totals = stageTotals[static_cast<size_t>(stage_)];
+    totals.scopes_.fetch_add(1, std::memory_order_relaxed);
+    totals.allocations_.fetch_add(counts_.allocations_, std::memory_order_relaxed);
+    totals.bytes_.fetch_add(counts_.bytes_, std::memory_order_relaxed);
+}
+
+bool AllocationScope::isEnabled()
+{
+#ifdef MAPGET_WITH_ALLOCATION_TRACKING
+    return true;
+#else
+    return false;
+#endif
+}
+
+void AllocationScope::record(size_t bytes) noexcept
+{
+    if (auto scope = currentScope) {
+        ++scope->counts_.allocations_;
+        scope->counts_.bytes_ += bytes;
+    }
+}
+
+char const* AllocationScope::stageName(AllocationStage stage)
+{
+    switch (stage) {
+    case AllocationStage::Fill: return "fill";
+    case AllocationStage::CacheGet: return "cache-get";
+    case AllocationStage::CachePut: return "cache-put";
+    case AllocationStage::Serialize: return "serialize";
+    case AllocationStage::AddOnMerge: return "add-on-merge";
+    }
+    return "unknown";
+}
+
+nlohmann::json AllocationScope::getStatistics()
+{
+    auto result = nlohmann::json::object({{"enabled", isEnabled()}});
+    for (size_t i = 0; i < NumStages; ++i) {
+        auto const& totals = stageTotals[i];
+        auto scopes = totals.scopes_.load(std::memory_order_relaxed);
+        auto bytes = totals.bytes_.load(std::memory_order_relaxed);
+        result[stageName(static_cast<AllocationStage>(i))] = {
+            {"scopes", scopes},
+            {"allocations", totals.allocations_.load(std::memory_order_relaxed)},
+            {"bytes", bytes},
+            {"bytes-per-scope", scopes ? static_cast<double>(bytes) / static_cast<double>(scopes) : 0.}};
+    }
+    return result;
+}
+
+}  // namespace mapget
+
+#ifdef MAPGET_WITH_ALLOCATION_TRACKING
+
+// Replacements of the global allocation functions, which count each
+// allocation for the current AllocationScope. The array and nothrow
+// variants forward to these by default. Aligned allocations are
+// not counted.
+
+void* operator new(std::size_t size)
+{
+    mapget::AllocationScope::record(size);
+    if (auto result = std::malloc(size ? size : 1))
+        return result;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+#endif
@@ -0,0 +1,371 @@
+#include "archive.h"
+#include "mapget/log.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace mapget
+{
+
+TileArchiveWriter::TileArchiveWriter(std::string path) : path_(std::move(path))
+{
+    // The live tier would only hold tiles which are never read.
+    setMaxLiveTileBytes(0);
+    file_.open(path_, std::ios::binary | std::ios::trunc);
+    if (!file_)
+        raiseFmt("Could not create tile archive {}.", path_);
+
+    // The header is written by finish(), once the offsets are known.
+    archive::Header header;
+    append({reinterpret_cast<char const*>(&header), sizeof(header)});
+}
+
+TileArchiveWriter::~TileArchiveWriter()
+{
+    if (!finished_)
+        log().warn("Tile archive {} was not finished, it is incomplete.", path_);
+}
+
+uint64_t TileArchiveWriter::append(std::string_view const& bytes)
+{
+    auto offset = fileSize_;
+    file_.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    if (!file_)
+        raiseFmt("Could not write tile archive {}.", path_);
+    fileSize_ += bytes.size();
+    return offset;
+}
+
+void TileArchiveWriter::putTileLayerBlob(MapTileKey const& k, std::string const& v)
+{
+    std::unique_lock lock(mutex_);
+    if (finished_)
+        raiseFmt("Tile archive {} is finished, tile {} cannot be added.", path_, k.toString());
+    auto offset = append(v);
+    tiles_[k.toBinary()] = {offset, v.size()};
+}
+
+std::optional<std::string> TileArchiveWriter::getStringPoolBlob(std::string_view const& sourceNodeId)
+{
+    std::unique_lock lock(mutex_);
+    auto it = stringPools_.find(sourceNodeId);
+    if (it == stringPools_.end() || it->second.empty())
+        return {};
+    return it->second.front();
+}
+
+void TileArchiveWriter::putStringPoolBlob(std::string_view const& sourceNodeId, std::string const& v)
+{
+    std::unique_lock lock(mutex_);
+    auto it = stringPools_.find(sourceNodeId);
+    if (it == stringPools_.end())
+        it = stringPools_.emplace(std::string(sourceNodeId), std::vector<std::string>{}).first;
+    it->second = {v};
+}
+
+void TileArchiveWriter::appendStringPoolUpdateBlob(
+    std::string_view const& sourceNodeId,
+    simfil::StringId offset,
+    std::string const& v)
+{
+    std::unique_lock lock(mutex_);
+    auto it = stringPools_.find(sourceNodeId);
+    if (it == stringPools_.end())
+        it = stringPools_.emplace(std::string(sourceNodeId), std::vector<std::string>{}).first;
+    it->second.push_back(v);
+}
+
+std::vector<std::string> TileArchiveWriter::getStringPoolUpdateBlobs(std::string_view const& sourceNodeId)
+{
+    std::unique_lock lock(mutex_);
+    auto it = stringPools_.find(sourceNodeId);
+    if (it == stringPools_.end() || it->second.empty())
+        return {};
+    return {it->second.begin() + 1, it->second.end()};
+}
+
+void TileArchiveWriter::finish(std::vector<DataSourceInfo> const& dataSources)
+{
+    std::unique_lock lock(mutex_);
+    if (finished_)
+        return;
+
+    auto metadata = nlohmann::json::object({
+        {"dataSources", nlohmann::json::array()},
+        {"stringPools", nlohmann::json::object()}});
+    for (auto const& info : dataSources)
+        metadata["dataSources"].push_back(info.toJson());
+    for (auto const& [nodeId, blobs] : stringPools_) {
+        auto ranges = nlohmann::json::array();
+        for (auto const& blob : blobs)
+            ranges.push_back({append(blob), blob.size()});
+        metadata["stringPools"][nodeId] = ranges;
+    }
+
+    archive::Header header;
+    std::memcpy(header.magic_, archive::Magic, sizeof(header.magic_));
+    header.version_ = archive::FormatVersion;
+    auto metadataJson = metadata.dump();
+    header.metadataOffset_ = append(metadataJson);
+    header.metadataSize_ = metadataJson.size();
+
+    // The keys, then the index, which is aligned for access in place.
+    std::vector<archive::IndexEntry> index;
+    index.reserve(tiles_.size());
+    for (auto const& [key, blob] : tiles_) {
+        auto& entry = index.emplace_back();
+        entry.keyOffset_ = append(key);
+        entry.keySize_ = static_cast<uint32_t>(key.size());
+        entry.blobOffset_ = blob.first;
+        entry.blobSize_ = blob.second;
+    }
+    append(std::string((alignof(archive::IndexEntry) - fileSize_ % alignof(archive::IndexEntry)) % alignof(archive::IndexEntry), '\0'));
+    header.indexOffset_ = append({reinterpret_cast<char const*>(index.data()), index.size() * sizeof(archive::IndexEntry)});
+    header.indexCount_ = index.size();
+
+    file_.seekp(0);
+    file_.write(reinterpret_cast<char const*>(&header), sizeof(header));
+    file_.close();
+    if (!file_)
+        raiseFmt("Could not write tile archive {}.", path_);
+    finished_ = true;
+    log().info("Wrote {} tiles ({} bytes) to tile archive {}.", tiles_.size(), fileSize_, path_);
+}
+
+nlohmann::json TileArchiveWriter::getStatistics() const
+{
+    auto result = Cache::getStatistics();
+    std::unique_lock lock(mutex_);
+    result["archive-tiles"] = static_cast<int64_t>(tiles_.size());
+    result["archive-bytes"] = static_cast<int64_t>(fileSize_);
+    return result;
+}
+
+/** Read-only memory mapping of a whole file. */
+struct TileArchive::MappedFile
+{
+    char const* data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = nullptr;
+#endif
+
+    explicit MappedFile(std::string const& path)
+    {
+#ifdef _WIN32
+        file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE)
+            raiseFmt("Could not open tile archive {}.", path);
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file_, &size) || size.QuadPart == 0)
+            raiseFmt("Could not map empty tile archive {}.", path);
+        size_ = static_cast<size_t>(size.QuadPart);
+        mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping_)
+            data_ = static_cast<char const*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+        if (!data_)
+            raiseFmt("Could not map tile archive {}.", path);
+#else
+        auto fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            raiseFmt("Could not open tile archive {}.", path);
+        struct stat status{};
+        if (::fstat(fd, &status) != 0 || status.st_size == 0) {
+            ::close(fd);
+            raiseFmt("Could not map empty tile archive {}.", path);
+        }
+        size_ = static_cast<size_t>(status.st_size);
+        auto data = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        // The mapping stays valid without the file descriptor.
+        ::close(fd);
+        if (data == MAP_FAILED)
+            raiseFmt("Could not map tile archive {}.", path);
+        data_ = static_cast<char const*>(data);
+#endif
+    }
+
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        if (data_)
+            UnmapViewOfFile(data_);
+        if (mapping_)
+            CloseHandle(mapping_);
+        if (file_ != INVALID_HANDLE_VALUE)
+            CloseHandle(file_);
+#else
+        if (data_)
+            ::munmap(const_cast<char*>(data_), size_);
+#endif
+    }
+};
+
+TileArchive::TileArchive(std::string const& path) : file_(std::make_unique<MappedFile>(path))
+{
+    if (file_->size_ < sizeof(header_))
+        raiseFmt("{} is not a tile archive.", path);
+    std::memcpy(&header_, file_->data_, sizeof(header_));
+    if (std::memcmp(header_.magic_, archive::Magic, sizeof(header_.magic_)) != 0)
+        raiseFmt("{} is not a tile archive, or it was not finished.", path);
+    if (header_.version_ != archive::FormatVersion)
+        raiseFmt("Tile archive {} has version {}, expected {}.", path, header_.version_, archive::FormatVersion);
+
+    auto indexBytes = bytes(header_.indexOffset_, header_.indexCount_ * sizeof(archive::IndexEntry));
+    if (header_.indexOffset_ % alignof(archive::IndexEntry) != 0)
+        raiseFmt("Tile archive {} has a misaligned index.", path);
+    index_ = reinterpret_cast<archive::IndexEntry const*>(indexBytes.data());
+
+    auto metadata = nlohmann::json::parse(bytes(header_.metadataOffset_, header_.metadataSize_));
+    for (auto const& info : metadata["dataSources"])
+        dataSources_.push_back(DataSourceInfo::fromJson(info));
+    for (auto const& [nodeId, ranges] : metadata["stringPools"].items()) {
+        auto& blobs = stringPools_[nodeId];
+        for (auto const& range : ranges)
+            blobs.emplace_back(range[0].get<uint64_t>(), range[1].get<uint64_t>());
+    }
+    log().info("Opened tile archive {} with {} tiles.", path, header_.indexCount_);
+}
+
+TileArchive::~TileArchive() = default;
+
+size_t TileArchive::size() const
+{
+    return static_cast<size_t>(header_.indexCount_);
+}
+
+size_t TileArchive::fileSize() const
+{
+    return file_->size_;
+}
+
+std::string_view TileArchive::bytes(uint64_t offset, uint64_t size) const
+{
+    if (offset > file_->size_ || size > file_->size_ - offset)
+        raiseFmt("Range {}+{} is outside of the tile archive of {} bytes.", offset, size, file_->size_);
+    return {file_->data_ + offset, static_cast<size_t>(size)};
+}
+
+Cache::SharedBlob TileArchive::getTileLayerBlob(MapTileKey const& k) const
+{
+    auto key = k.toBinary();
+    auto end = index_ + header_.indexCount_;
+    auto it = std::lower_bound(
+        index_,
+        end,
+        key,
+        [this](archive::IndexEntry const& entry, std::string const& key)
+        { return bytes(entry.keyOffset_, entry.keySize_) < key; });
+    if (it == end || bytes(it->keyOffset_, it->keySize_) != key)
+        return nullptr;
+    return std::make_shared<const std::string>(bytes(it->blobOffset_, it->blobSize_));
+}
+
+std::vector<std::string_view> TileArchive::getStringPoolBlobs(std::string const& nodeId) const
+{
+    std::vector<std::string_view> result;
+    if (auto it = stringPools_.find(nodeId); it != stringPools_.end()) {
+        for (auto const& [offset, size] : it->second)
+            result.push_back(bytes(offset, size));
+    }
+    return result;
+}
+
+ArchiveDataSource::ArchiveDataSource(std::string const& path, std::string const& mapId)
+    : ArchiveDataSource(std::make_shared<TileArchive>(path), mapId)
+{
+}
+
+ArchiveDataSource::ArchiveDataSource(TileArchive::Ptr archive, std::string const& mapId)
+    : archive_(std::move(archive))
+{
+    auto const& dataSources = archive_->dataSources();
+    auto it = std::find_if(
+        dataSources.begin(),
+        dataSources.end(),
+        [&mapId](auto const& info) { return info.mapId_ == mapId; });
+    if (mapId.empty() && dataSources.size() == 1)
+        it = dataSources.begin();
+    if (it == dataSources.end())
+        raiseFmt("The tile archive has no map '{}'.", mapId);
+    info_ = *it;
+}
+
+std::shared_ptr<StringPool> ArchiveDataSource::archivedStrings(Cache::Ptr const& cache)
+{
+    auto strings = cache->getStringPool(info_.nodeId_);
+    std::unique_lock lock(stringsMutex_);
+    if (stringsCache_ == cache.get())
+        return strings;
+
+    for (auto const& blob : archive_->getStringPoolBlobs(info_.nodeId_)) {
+        std::stringstream stream;
+        stream << blob;
+        TileLayerStream::MessageType messageType;
+        uint32_t messageSize;
+        TileLayerStream::Reader::readMessageHeader(stream, messageType, messageSize);
+        if (messageType != TileLayerStream::MessageType::StringPool ||
+            StringPool::readDataSourceNodeId(stream) != info_.nodeId_) {
+            raise("Stream header error while parsing an archived string pool.");
+        }
+        strings->read(stream);
+    }
+    stringsCache_ = cache.get();
+    return strings;
+}
+
+TileLayer::Ptr ArchiveDataSource::get(
+    MapTileKey const& k,
+    Cache::Ptr& cache,
+    DataSourceInfo const& info,
+    CancellationToken::Ptr const& cancellation)
+{
+    auto blob = archive_->getTileLayerBlob(k);
+    if (!blob)
+        return DataSource::get(k, cache, info, cancellation);
+
+    // The tile refers to the string pool of the cache, which has the archived strings.
+    archivedStrings(cache);
+    TileLayer::Ptr result;
+    TileLayerStream::Reader reader(
+        [this](auto&& mapId, auto&& layerId) { return info_.getLayer(std::string(layerId)); },
+        [&result](auto&& layer) { result = layer; },
+        cache);
+    reader.read(blob);
+    if (result)
+        result->setCancellation(cancellation);
+    return result;
+}
+
+std::vector<TileLayer::Ptr> ArchiveDataSource::get(
+    std::vector<MapTileKey> const& keys,
+    Cache::Ptr& cache,
+    DataSourceInfo const& info,
+    std::vector<CancellationToken::Ptr> const& cancellations)
+{
+    std::vector<TileLayer::Ptr> result;
+    result.reserve(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i)
+        result.push_back(get(keys[i], cache, info, cancellations.empty() ? nullptr : cancellations[i]));
+    return result;
+}
+
+std::optional<Cache::TileLayerMessage> ArchiveDataSource::getTileLayerMessage(MapTileKey const& k, Cache::Ptr const& cache)
+{
+    auto blob = archive_->getTileLayerBlob(k);
+    if (!blob)
+        return {};
+    return Cache::TileLayerMessage{std::move(blob), archivedStrings(cache)};
+}
+
+}  // namespace mapget
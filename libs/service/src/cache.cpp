@@ -1,11 +1,40 @@
 #include "cache.h"
+#include "allocations.h"
+#include "locate.h"
+#include "memory.h"
 #include "mapget/log.h"
+#include "tracing.h"
 
 #include "fmt/format.h"
 
+#include <algorithm>
+
 namespace mapget
 {
 
+namespace
+{
+
+double millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+}  // namespace
+
+Cache::Cache()
+{
+    reclaimerId_ = MemoryBudget::instance().addReclaimer([this](size_t bytes) { return reclaimLiveTiles(bytes); });
+}
+
+Cache::~Cache()
+{
+    MemoryBudget::instance().removeReclaimer(reclaimerId_);
+    MemoryBudget::instance().release(MemoryPool::LiveTiles, liveTileBytes_);
+    for (auto const& [nodeId, bytes] : stringPoolBytes_)
+        MemoryBudget::instance().release(MemoryPool::StringPools, bytes);
+}
+
 std::shared_ptr<StringPool> Cache::getStringPool(const std::string_view& nodeId)
 {
     {
@@ -27,11 +56,10 @@ std::shared_ptr<StringPool> Cache::getStringPool(const std::string_view& nodeId)
 
         // Load/insert the string pool.
         std::shared_ptr<StringPool> stringPool = std::make_shared<StringPool>(nodeId);
-        auto cachedStringsBlob = getStringPoolBlob(nodeId);
-        if (cachedStringsBlob) {
+        auto readStringPoolBlob = [&stringPool, &nodeId](std::string const& blob) {
             // Read the string pool from the stream.
             std::stringstream stream;
-            stream << *cachedStringsBlob;
+            stream << blob;
 
             // First, read the header and the datasource node id.
             // These must match what we expect.
@@ -45,7 +73,22 @@ std::shared_ptr<StringPool> Cache::getStringPool(const std::string_view& nodeId)
 
             // Now, actually read the string pool message.
             stringPool->read(stream);
+        };
+
+        auto cachedStringsBlob = getStringPoolBlob(nodeId);
+        if (cachedStringsBlob) {
+            readStringPoolBlob(*cachedStringsBlob);
+            auto poolBytes = cachedStringsBlob->size();
+
+            // The updates which were appended since are replayed in order.
+            auto updateBlobs = getStringPoolUpdateBlobs(nodeId);
+            for (auto const& updateBlob : updateBlobs) {
+                readStringPoolBlob(updateBlob);
+                poolBytes += updateBlob.size();
+            }
+            setStringPoolBytes(std::string(nodeId), poolBytes);
             stringPoolOffsets_.emplace(nodeId, stringPool->highest());
+            stringPoolUpdateCounts_[std::string(nodeId)] = updateBlobs.size();
         }
         auto [itNew, _] = stringPoolPerNodeId_.emplace(nodeId, stringPool);
         return itNew->second;
@@ -53,57 +96,655 @@ std::shared_ptr<StringPool> Cache::getStringPool(const std::string_view& nodeId)
 }
 
 nlohmann::json Cache::getStatistics() const {
-    return {
-        {"cache-hits", cacheHits_},
-        {"cache-misses", cacheMisses_},
-        {"loaded-string-pools", (int64_t)stringPoolOffsets().size()}
+    int64_t numQueuedTiles = 0;
+    {
+        std::unique_lock writeQueueLock(writeQueueMutex_);
+        numQueuedTiles = (int64_t)queuedTileLayers_.size();
+    }
+    std::unique_lock liveTilesLock(liveTilesMutex_);
+    nlohmann::json result = {
+        {"cache-hits", cacheHits_.load()},
+        {"cache-misses", cacheMisses_.load()},
+        {"loaded-string-pools", (int64_t)stringPoolOffsets().size()},
+        {"live-tile-hits", liveTileHits_.load()},
+        {"live-tiles", (int64_t)liveTiles_.size()},
+        {"live-tile-bytes", (int64_t)liveTileBytes_},
+        {"expired-tiles", expiredTiles_.load()},
+        {"queued-tiles", numQueuedTiles},
+        {"dropped-tiles", droppedTileLayers_.load()}
     };
+    if (compression_)
+        result.update(compression_->getStatistics());
+    if (locateIndexEnabled_)
+        result["locate-index-features"] = locateIndexFeatures_.load();
+    liveTilesLock.unlock();
+
+    auto layers = nlohmann::json::object();
+    std::shared_lock layerStatisticsLock(layerStatisticsMutex_);
+    for (auto const& [mapId, mapLayers] : layerStatistics_) {
+        for (auto const& [layerId, stats] : mapLayers) {
+            auto writtenTiles = stats->writtenTiles_.load();
+            auto writtenBytes = stats->writtenBytes_.load();
+            layers[mapId][layerId] = {
+                {"hits", stats->hits_.load()},
+                {"misses", stats->misses_.load()},
+                {"read-bytes", stats->readBytes_.load()},
+                {"written-tiles", writtenTiles},
+                {"written-bytes", writtenBytes},
+                {"average-blob-bytes", writtenTiles ? writtenBytes / writtenTiles : 0},
+                {"evicted-tiles", stats->evictedTiles_.load()},
+                {"expired-tiles", stats->expiredTiles_.load()}
+            };
+        }
+    }
+    result["layers"] = layers;
+    return result;
 }
 
-TileLayer::Ptr Cache::getTileLayer(const MapTileKey& tileKey, DataSourceInfo const& dataSource)
+Cache::LayerStatistics& Cache::layerStatistics(MapTileKey const& k)
 {
-    auto tileBlob = getTileLayerBlob(tileKey);
-    if (!tileBlob) {
+    {
+        std::shared_lock layerStatisticsLock(layerStatisticsMutex_);
+        if (auto mapIt = layerStatistics_.find(k.mapId_); mapIt != layerStatistics_.end()) {
+            if (auto layerIt = mapIt->second.find(k.layerId_); layerIt != mapIt->second.end())
+                return *layerIt->second;
+        }
+    }
+
+    // The statistics of a layer are never removed, so the returned reference stays valid.
+    std::unique_lock layerStatisticsLock(layerStatisticsMutex_);
+    auto& stats = layerStatistics_[k.mapId_][k.layerId_];
+    if (!stats)
+        stats = std::make_unique<LayerStatistics>();
+    return *stats;
+}
+
+void Cache::countLookup(LayerStatistics& stats, bool hit)
+{
+    if (hit) {
+        ++cacheHits_;
+        ++stats.hits_;
+    }
+    else {
         ++cacheMisses_;
-        return nullptr;
+        ++stats.misses_;
+    }
+}
+
+TileLayer::Ptr Cache::getTileLayer(const MapTileKey& tileKey, DataSourceInfo const& dataSource)
+{
+    AllocationScope allocations(AllocationStage::CacheGet);
+    auto& stats = layerStatistics(tileKey);
+    auto isExpired = [now = std::chrono::system_clock::now()](TileLayer const& layer) {
+        auto expiresAt = layer.expiresAt();
+        return expiresAt && *expiresAt <= now;
+    };
+
+    // Layers which wait for the background writer are served as they are.
+    if (auto queuedTile = getQueuedTileLayer(tileKey)) {
+        if (queuedTile->layerInfo() == dataSource.getLayer(tileKey.layerId_, false) && !isExpired(*queuedTile)) {
+            countLookup(stats, true);
+            MAPGET_LOG_DEBUG("Returned queued tile from cache: {}", tileKey.tileId_.value_);
+            return queuedTile;
+        }
     }
+
+    if (auto liveTile = getLiveTile(tileKey, dataSource)) {
+        if (isExpired(*liveTile)) {
+            dropLiveTile(tileKey);
+            countLookup(stats, false);
+            return nullptr;
+        }
+        countLookup(stats, true);
+        ++liveTileHits_;
+        MAPGET_LOG_DEBUG("Returned live tile from cache: {}", tileKey.tileId_.value_);
+        return liveTile;
+    }
+
+    SharedBlob tileBlob;
     TileLayer::Ptr result;
-    TileLayerStream::Reader tileReader(
-        [&dataSource, &tileKey](auto&& mapId, auto&& layerId) {
-            if (dataSource.mapId_ != mapId) {
-                raiseFmt(
-                    "Encountered unexpected map id '{}' in cache for tile {:0x}, expected '{}'",
-                    mapId,
-                    tileKey.tileId_.value_,
-                    dataSource.mapId_);
-            }
-            return dataSource.getLayer(std::string(layerId));
-        },
-        [&](auto&& parsedLayer){result = parsedLayer;},
-        shared_from_this());
+    try {
+        tileBlob = getDecompressedTileLayerBlob(tileKey, stats);
+        if (tileBlob) {
+            TileLayerStream::Reader tileReader(
+                [&dataSource, &tileKey](auto&& mapId, auto&& layerId) {
+                    if (dataSource.mapId_ != mapId) {
+                        raiseFmt(
+                            "Encountered unexpected map id '{}' in cache for tile {:0x}, expected '{}'",
+                            mapId,
+                            tileKey.tileId_.value_,
+                            dataSource.mapId_);
+                    }
+                    return dataSource.getLayer(std::string(layerId));
+                },
+                [&](auto&& parsedLayer){result = parsedLayer;},
+                shared_from_this());
+            tileReader.read(tileBlob);
+        }
+    }
+    catch (...) {
+        finishLiveTileRead(tileKey, nullptr, 0);
+        throw;
+    }
+
+    // Expired tiles are misses. They are overwritten once they are loaded again.
+    if (result && isExpired(*result)) {
+        MAPGET_LOG_DEBUG("Cached tile expired: {}", tileKey.tileId_.value_);
+        result = nullptr;
+        tileBlob = nullptr;
+    }
 
-    tileReader.read(*tileBlob);
-    ++cacheHits_;
-    log().debug("Returned tile from cache: {}", tileKey.tileId_.value_);
+    finishLiveTileRead(tileKey, result, tileBlob ? tileBlob->size() : 0);
+    if (!tileBlob) {
+        countLookup(stats, false);
+        return nullptr;
+    }
+    countLookup(stats, true);
+    MAPGET_LOG_DEBUG("Returned tile from cache: {}", tileKey.tileId_.value_);
     return result;
 }
 
+std::optional<Cache::TileLayerMessage> Cache::getTileLayerMessage(MapTileKey const& tileKey)
+{
+    AllocationScope allocations(AllocationStage::CacheGet);
+    // The message of a queued layer only exists once it is written.
+    writeQueuedTileLayer(tileKey);
+    auto& stats = layerStatistics(tileKey);
+    auto tileBlob = getDecompressedTileLayerBlob(tileKey, stats);
+    if (!tileBlob) {
+        countLookup(stats, false);
+        return {};
+    }
+
+    auto header = TileLayerStream::Reader::readTileLayerHeader(*tileBlob);
+    if (auto expiresAt = header.expiresAt(); expiresAt && *expiresAt <= std::chrono::system_clock::now()) {
+        MAPGET_LOG_DEBUG("Cached tile expired: {}", tileKey.tileId_.value_);
+        countLookup(stats, false);
+        return {};
+    }
+
+    countLookup(stats, true);
+    MAPGET_LOG_DEBUG("Returned tile message from cache: {}", tileKey.tileId_.value_);
+    return TileLayerMessage{std::move(tileBlob), getStringPool(header.nodeId_)};
+}
+
+Cache::SharedBlob Cache::getSharedTileLayerBlob(MapTileKey const& k)
+{
+    if (auto blob = getTileLayerBlob(k))
+        return std::make_shared<const std::string>(std::move(*blob));
+    return nullptr;
+}
+
+Cache::SharedBlob Cache::getDecompressedTileLayerBlob(MapTileKey const& k, LayerStatistics& stats)
+{
+    auto blob = getSharedTileLayerBlob(k);
+    if (blob)
+        stats.readBytes_ += static_cast<int64_t>(blob->size());
+    if (!blob || !TileBlobCompression::isCompressed(*blob))
+        return blob;
+    if (compression_)
+        return compression_->decompress(k, std::move(blob));
+    std::call_once(decompressionOnce_, [this]() {
+        decompression_ = std::make_unique<TileBlobCompression>(
+            0,
+            [this](auto&& key) { return getCompressionDictionaryBlob(key); },
+            [](auto&&, auto&&) {});
+    });
+    return decompression_->decompress(k, std::move(blob));
+}
+
+void Cache::setCompressionLevel(int level)
+{
+    if (level == 0) {
+        compression_.reset();
+        return;
+    }
+    compression_ = std::make_unique<TileBlobCompression>(
+        level,
+        [this](auto&& key) { return getCompressionDictionaryBlob(key); },
+        [this](auto&& key, auto&& dictionary) { putCompressionDictionaryBlob(key, dictionary); });
+}
+
+void Cache::setLocateIndexEnabled(bool enabled)
+{
+    locateIndexEnabled_ = enabled;
+}
+
+std::optional<Cache::LocateIndexEntry> Cache::lookupLocateIndex(std::string const& nodeId, LocateRequest const& req)
+{
+    if (!locateIndexEnabled_)
+        return {};
+    auto blob = getLocateIndexBlob(locateIndexKey(nodeId, req));
+    if (!blob)
+        return {};
+
+    // The blob is the layer version, a zero byte, and the binary tile key.
+    auto separator = blob->find('\0');
+    if (separator == std::string::npos) {
+        log().warn("Malformed locate index entry for {}.", req.serialize().dump());
+        return {};
+    }
+    return LocateIndexEntry{
+        MapTileKey::fromBinary(std::string_view(*blob).substr(separator + 1)),
+        blob->substr(0, separator)};
+}
+
+void Cache::addLocateIndexBlobs(TileLayer const& l, std::vector<std::pair<std::string, std::string>>& blobs)
+{
+    auto featureLayer = dynamic_cast<TileFeatureLayer const*>(&l);
+    if (!featureLayer)
+        return;
+    auto value = l.layerInfo()->version_.toString();
+    value.push_back('\0');
+    value += MapTileKey(l).toBinary();
+    for (auto const& feature : *featureLayer) {
+        auto featureId = feature->id();
+        LocateRequest req(l.mapId(), std::string(featureId->typeId()), castToKeyValue(featureId->keyValuePairs()));
+        blobs.emplace_back(locateIndexKey(l.nodeId(), req), value);
+    }
+}
+
+std::string Cache::locateIndexKey(std::string const& nodeId, LocateRequest const& req)
+{
+    auto result = nodeId;
+    result.push_back('\0');
+    return result + req.serialize().dump();
+}
+
+void Cache::setMaxLiveTileBytes(size_t maxBytes)
+{
+    std::unique_lock liveTilesLock(liveTilesMutex_);
+    maxLiveTileBytes_ = maxBytes;
+    while (liveTileBytes_ > maxLiveTileBytes_)
+        eraseLiveTile(liveTiles_.find(liveTilesLru_.back()));
+}
+
+TileLayer::Ptr Cache::getLiveTile(MapTileKey const& k, DataSourceInfo const& dataSource)
+{
+    std::unique_lock liveTilesLock(liveTilesMutex_);
+    if (maxLiveTileBytes_ == 0)
+        return nullptr;
+
+    auto it = liveTiles_.find(k);
+    if (it != liveTiles_.end()) {
+        // Layers which were parsed with the info of a replaced
+        // data source are not used anymore.
+        if (it->second.layer_->layerInfo() == dataSource.getLayer(k.layerId_, false)) {
+            liveTilesLru_.splice(liveTilesLru_.begin(), liveTilesLru_, it->second.lruPosition_);
+            return it->second.layer_;
+        }
+        eraseLiveTile(it);
+    }
+    ++liveTileReads_[k].numReaders_;
+    return nullptr;
+}
+
+void Cache::finishLiveTileRead(MapTileKey const& k, TileLayer::Ptr const& layer, size_t bytes)
+{
+    std::unique_lock liveTilesLock(liveTilesMutex_);
+    auto readIt = liveTileReads_.find(k);
+    if (readIt == liveTileReads_.end())
+        return;
+    auto stale = readIt->second.stale_;
+    if (--readIt->second.numReaders_ == 0)
+        liveTileReads_.erase(readIt);
+    if (stale || !layer || bytes > maxLiveTileBytes_)
+        return;
+
+    // Another reader of the same tile may have been faster.
+    if (auto it = liveTiles_.find(k); it != liveTiles_.end())
+        eraseLiveTile(it);
+
+    layer->setReadOnly();
+    liveTilesLru_.push_front(k);
+    liveTiles_.emplace(k, LiveTile{layer, bytes, liveTilesLru_.begin()});
+    liveTileBytes_ += bytes;
+    MemoryBudget::instance().reserve(MemoryPool::LiveTiles, bytes);
+    while (liveTileBytes_ > maxLiveTileBytes_)
+        eraseLiveTile(liveTiles_.find(liveTilesLru_.back()));
+}
+
+void Cache::eraseLiveTile(std::unordered_map<MapTileKey, LiveTile, MapTileKey::Hash>::iterator it)
+{
+    liveTileBytes_ -= it->second.bytes_;
+    MemoryBudget::instance().release(MemoryPool::LiveTiles, it->second.bytes_);
+    liveTilesLru_.erase(it->second.lruPosition_);
+    liveTiles_.erase(it);
+}
+
+size_t Cache::reclaimLiveTiles(size_t bytes)
+{
+    std::unique_lock liveTilesLock(liveTilesMutex_);
+    auto freed = liveTileBytes_;
+    while (!liveTilesLru_.empty() && freed - liveTileBytes_ < bytes)
+        eraseLiveTile(liveTiles_.find(liveTilesLru_.back()));
+    return freed - liveTileBytes_;
+}
+
+void Cache::evictLiveTile(MapTileKey const& k)
+{
+    ++layerStatistics(k).evictedTiles_;
+    dropLiveTile(k);
+}
+
+void Cache::dropLiveTile(MapTileKey const& k)
+{
+    std::unique_lock liveTilesLock(liveTilesMutex_);
+    if (auto it = liveTiles_.find(k); it != liveTiles_.end())
+        eraseLiveTile(it);
+    if (auto readIt = liveTileReads_.find(k); readIt != liveTileReads_.end())
+        readIt->second.stale_ = true;
+}
+
 void Cache::putTileLayer(TileLayer::Ptr const& l)
 {
-    std::unique_lock stringPoolOffsetLock(stringPoolOffsetMutex_);
-    TileLayerStream::Writer tileWriter(
-        [&l, this](auto&& msg, auto&& msgType)
+    // A queued older version of the layer must not overwrite the new one.
+    {
+        std::unique_lock writeQueueLock(writeQueueMutex_);
+        auto it = queuedTileLayers_.find(MapTileKey(*l));
+        if (it != queuedTileLayers_.end() && it->second.queuePosition_ != writeQueue_.end()) {
+            writeQueue_.erase(it->second.queuePosition_);
+            queuedTileLayers_.erase(it);
+        }
+    }
+    auto timings = putTileLayers({l});
+
+    // The layer does not carry its own put timings in its cached blob.
+    if (!l->isReadOnly()) {
+        l->setInfo("serialize-time-ms", timings.front().serializeMs_);
+        l->setInfo("cache-write-time-ms", timings.front().writeMs_);
+        l->setInfo("serialized-bytes", static_cast<int64_t>(timings.front().serializedBytes_));
+    }
+}
+
+std::vector<Cache::PutTimings> Cache::putTileLayers(std::vector<TileLayer::Ptr> const& layers)
+{
+    AllocationScope allocations(AllocationStage::CachePut);
+    Span span("mapget.cache.put");
+    span.setAttribute("mapget.tile", MapTileKey(*layers.front()).toString());
+    span.setAttribute("mapget.tile_count", static_cast<int64_t>(layers.size()));
+
+    // The tile bodies are serialized and compressed concurrently. Only
+    // the string pool updates are synchronized, per node id.
+    std::vector<std::pair<MapTileKey, std::string>> blobs;
+    blobs.reserve(layers.size());
+    std::vector<PutTimings> timings(layers.size());
+    for (auto i = 0u; i < layers.size(); ++i) {
+        auto const& l = layers[i];
+        MapTileKey tileKey(*l);
+        auto serializeStart = std::chrono::steady_clock::now();
+        putStringPoolUpdate(l);
+        TileLayerStream::StringPoolOffsetMap unusedOffsets;
+        TileLayerStream::Writer tileWriter(
+            [&tileKey, &blobs](auto&& msg, auto&&) { blobs.emplace_back(tileKey, std::move(msg)); },
+            unusedOffsets,
+            /* differentialStringUpdates= */ false);
+        MAPGET_LOG_DEBUG("Writing tile layer to cache: {}", tileKey.toString());
+        tileWriter.writeLayer(l);
+        timings[i].serializedBytes_ = blobs.back().second.size();
+        if (compression_)
+            blobs.back().second = compression_->compress(tileKey, blobs.back().second);
+        timings[i].serializeMs_ = millisecondsSince(serializeStart);
+
+        auto& stats = layerStatistics(tileKey);
+        ++stats.writtenTiles_;
+        stats.writtenBytes_ += static_cast<int64_t>(blobs.back().second.size());
+    }
+
+    // Expired tiles are removed first, so that they are evicted before live ones.
+    // The blobs are written without the lock, so that puts run in parallel.
+    // A sweep only erases the put tiles once their new expiry has passed.
+    auto writeStart = std::chrono::steady_clock::now();
+    {
+        std::unique_lock expiryLock(expiryMutex_);
+        sweepExpiredTilesLocked(ExpirySweepBatchSize);
+        for (auto const& l : layers)
+            trackExpiry(MapTileKey(*l), l->expiresAt());
+    }
+    putTileLayerBlobs(blobs);
+    auto writeMs = millisecondsSince(writeStart);
+    for (auto& layerTimings : timings)
+        layerTimings.writeMs_ = writeMs;
+
+    // The live tiles are outdated by the new blobs. Reads of the old
+    // blobs which are still running are marked as stale.
+    for (auto const& l : layers)
+        dropLiveTile(MapTileKey(*l));
+
+    // Features which moved to another tile are overwritten by their new
+    // entries. Entries of features which disappeared are kept, they are
+    // ignored once the version of their layer changed.
+    if (locateIndexEnabled_) {
+        std::vector<std::pair<std::string, std::string>> locateIndexBlobs;
+        for (auto const& l : layers)
+            addLocateIndexBlobs(*l, locateIndexBlobs);
+        if (!locateIndexBlobs.empty()) {
+            locateIndexFeatures_ += static_cast<int64_t>(locateIndexBlobs.size());
+            putLocateIndexBlobs(locateIndexBlobs);
+        }
+    }
+    return timings;
+}
+
+void Cache::putStringPoolUpdate(TileLayer::Ptr const& l)
+{
+    auto modelPool = std::dynamic_pointer_cast<simfil::ModelPool>(l);
+    auto strings = modelPool ? modelPool->strings() : nullptr;
+    if (!strings)
+        return;
+
+    // The strings of a complete layer are all in its pool, so a pool
+    // blob which was written after the layer was built covers them.
+    auto const& nodeId = l->nodeId();
+    auto highestString = strings->highest();
+    std::mutex* stringPoolWriteMutex = nullptr;
+    {
+        std::unique_lock stringPoolOffsetLock(stringPoolOffsetMutex_);
+        if (auto it = stringPoolOffsets_.find(nodeId); it != stringPoolOffsets_.end() && it->second >= highestString)
+            return;
+        stringPoolWriteMutex = &stringPoolWriteMutexes_[nodeId];
+    }
+
+    std::unique_lock stringPoolWriteLock(*stringPoolWriteMutex);
+    TileLayerStream::StringPoolOffsetMap offsets;
+    auto appendUpdate = false;
+    {
+        // Another writer may have written the pool meanwhile.
+        std::unique_lock stringPoolOffsetLock(stringPoolOffsetMutex_);
+        if (auto it = stringPoolOffsets_.find(nodeId); it != stringPoolOffsets_.end()) {
+            if (it->second >= highestString)
+                return;
+            offsets.emplace(nodeId, it->second);
+
+            // Only the new strings are appended, until there are so many
+            // updates that the pool is compacted by rewriting it.
+            appendUpdate = supportsStringPoolUpdates() && stringPoolUpdateCounts_[nodeId] < MaxStringPoolUpdates;
+        }
+    }
+
+    auto updateOffset = static_cast<simfil::StringId>(offsets[nodeId] + 1);
+    size_t writtenBytes = 0;
+    TileLayerStream::Writer stringPoolWriter(
+        [&nodeId, &appendUpdate, &updateOffset, &writtenBytes, this](auto&& msg, auto&&)
         {
-            if (msgType == TileLayerStream::MessageType::TileFeatureLayer ||
-                msgType == TileLayerStream::MessageType::TileSourceDataLayer)
-                putTileLayerBlob(MapTileKey(*l), msg);
-            else if (msgType == TileLayerStream::MessageType::StringPool)
-                putStringPoolBlob(l->nodeId(), msg);
+            writtenBytes += msg.size();
+            if (appendUpdate)
+                appendStringPoolUpdateBlob(nodeId, updateOffset, msg);
+            else
+                putStringPoolBlob(nodeId, msg);
         },
-        stringPoolOffsets_,
-        /* differentialStringUpdates= */ false);
-    log().debug("Writing tile layer to cache: {}", MapTileKey(*l).toString());
-    tileWriter.write(l);
+        offsets,
+        /* differentialStringUpdates= */ appendUpdate);
+    stringPoolWriter.writeStringPool(nodeId, *strings);
+
+    std::unique_lock stringPoolOffsetLock(stringPoolOffsetMutex_);
+    auto& cachedOffset = stringPoolOffsets_[nodeId];
+    cachedOffset = std::max(cachedOffset, offsets[nodeId]);
+    auto& updateCount = stringPoolUpdateCounts_[nodeId];
+    updateCount = appendUpdate ? updateCount + 1 : 0;
+    setStringPoolBytes(nodeId, appendUpdate ? stringPoolBytes_[nodeId] + writtenBytes : writtenBytes);
+}
+
+void Cache::setStringPoolBytes(std::string const& nodeId, size_t bytes)
+{
+    auto& poolBytes = stringPoolBytes_[nodeId];
+    if (bytes > poolBytes)
+        MemoryBudget::instance().reserve(MemoryPool::StringPools, bytes - poolBytes);
+    else
+        MemoryBudget::instance().release(MemoryPool::StringPools, poolBytes - bytes);
+    poolBytes = bytes;
+}
+
+void Cache::putTileLayerBlobs(std::vector<std::pair<MapTileKey, std::string>> const& blobs)
+{
+    for (auto const& [tileKey, blob] : blobs)
+        putTileLayerBlob(tileKey, blob);
+}
+
+bool Cache::queueTileLayer(TileLayer::Ptr const& l)
+{
+    std::unique_lock writeQueueLock(writeQueueMutex_);
+    if (maxQueuedTileLayers_ == 0) {
+        writeQueueLock.unlock();
+        putTileLayer(l);
+        return false;
+    }
+
+    MapTileKey tileKey(*l);
+    auto [it, isNew] = queuedTileLayers_.try_emplace(tileKey, QueuedTileLayer{l, writeQueue_.end()});
+    it->second.layer_ = l;
+    if (it->second.queuePosition_ == writeQueue_.end()) {
+        // Layers which are already queued keep their position.
+        writeQueue_.push_back(tileKey);
+        it->second.queuePosition_ = std::prev(writeQueue_.end());
+    }
+
+    while (writeQueue_.size() > maxQueuedTileLayers_) {
+        MAPGET_LOG_DEBUG("Dropping queued tile layer: {}", writeQueue_.front().toString());
+        queuedTileLayers_.erase(writeQueue_.front());
+        writeQueue_.pop_front();
+        ++droppedTileLayers_;
+    }
+
+    auto startWriter = !writerActive_;
+    writerActive_ = true;
+    return startWriter;
+}
+
+size_t Cache::writeQueuedTileLayers(size_t maxTiles)
+{
+    std::vector<TileLayer::Ptr> layers;
+    {
+        std::unique_lock writeQueueLock(writeQueueMutex_);
+        while (layers.size() < maxTiles && !writeQueue_.empty()) {
+            auto& queuedLayer = queuedTileLayers_.at(writeQueue_.front());
+            queuedLayer.queuePosition_ = writeQueue_.end();
+            layers.emplace_back(queuedLayer.layer_);
+            writeQueue_.pop_front();
+        }
+        if (layers.empty()) {
+            writerActive_ = false;
+            return 0;
+        }
+    }
+
+    try {
+        putTileLayers(layers);
+    }
+    catch (std::exception& e) {
+        log().error("Could not write {} queued tile layers: {}", layers.size(), e.what());
+    }
+
+    // Layers which were queued again meanwhile stay.
+    std::unique_lock writeQueueLock(writeQueueMutex_);
+    for (auto const& layer : layers) {
+        auto it = queuedTileLayers_.find(MapTileKey(*layer));
+        if (it != queuedTileLayers_.end() && it->second.layer_ == layer)
+            queuedTileLayers_.erase(it);
+    }
+    return layers.size();
+}
+
+void Cache::setMaxQueuedTileLayers(size_t maxTiles)
+{
+    std::unique_lock writeQueueLock(writeQueueMutex_);
+    maxQueuedTileLayers_ = maxTiles;
+}
+
+TileLayer::Ptr Cache::getQueuedTileLayer(MapTileKey const& k)
+{
+    std::unique_lock writeQueueLock(writeQueueMutex_);
+    if (auto it = queuedTileLayers_.find(k); it != queuedTileLayers_.end())
+        return it->second.layer_;
+    return nullptr;
+}
+
+void Cache::writeQueuedTileLayer(MapTileKey const& k)
+{
+    TileLayer::Ptr layer;
+    {
+        std::unique_lock writeQueueLock(writeQueueMutex_);
+        auto it = queuedTileLayers_.find(k);
+        if (it == queuedTileLayers_.end() || it->second.queuePosition_ == writeQueue_.end())
+            return;
+        layer = it->second.layer_;
+        writeQueue_.erase(it->second.queuePosition_);
+        it->second.queuePosition_ = writeQueue_.end();
+    }
+    putTileLayers({layer});
+
+    std::unique_lock writeQueueLock(writeQueueMutex_);
+    if (auto it = queuedTileLayers_.find(k); it != queuedTileLayers_.end() && it->second.layer_ == layer)
+        queuedTileLayers_.erase(it);
+}
+
+size_t Cache::sweepExpiredTiles(size_t maxTiles)
+{
+    std::unique_lock expiryLock(expiryMutex_);
+    return sweepExpiredTilesLocked(maxTiles);
+}
+
+size_t Cache::sweepExpiredTilesLocked(size_t maxTiles)
+{
+    auto now = std::chrono::system_clock::now();
+    size_t numErased = 0;
+    while (numErased < maxTiles && !expiryQueue_.empty() && expiryQueue_.begin()->first <= now) {
+        auto tileKey = expiryQueue_.begin()->second;
+        expiryQueue_.erase(expiryQueue_.begin());
+        tileExpiry_.erase(tileKey);
+        try {
+            eraseTileLayerBlob(tileKey);
+        }
+        catch (std::exception& e) {
+            log().error("Could not erase expired tile {}: {}", tileKey.toString(), e.what());
+        }
+        dropLiveTile(tileKey);
+        ++layerStatistics(tileKey).expiredTiles_;
+        ++numErased;
+    }
+    if (numErased > 0) {
+        expiredTiles_ += static_cast<int64_t>(numErased);
+        MAPGET_LOG_DEBUG("Erased {} expired tiles from the cache.", numErased);
+    }
+    return numErased;
+}
+
+void Cache::trackExpiry(MapTileKey const& k, std::optional<std::chrono::system_clock::time_point> expiresAt)
+{
+    if (auto it = tileExpiry_.find(k); it != tileExpiry_.end()) {
+        auto [begin, end] = expiryQueue_.equal_range(it->second);
+        for (auto queueIt = begin; queueIt != end; ++queueIt) {
+            if (queueIt->second == k) {
+                expiryQueue_.erase(queueIt);
+                break;
+            }
+        }
+        tileExpiry_.erase(it);
+    }
+    if (expiresAt) {
+        tileExpiry_.emplace(k, *expiresAt);
+        expiryQueue_.emplace(*expiresAt, k);
+    }
 }
 
 simfil::StringId Cache::cachedStringPoolOffset(std::string const& nodeId)
@@ -114,7 +755,7 @@ simfil::StringId Cache::cachedStringPoolOffset(std::string const& nodeId)
     std::unique_lock stringPoolOffsetLock(stringPoolOffsetMutex_);
     auto it = stringPoolOffsets_.find(nodeId);
     if (it != stringPoolOffsets_.end()) {
-        log().trace("Cached string pool offset for {}: {}", nodeId, it->second);
+        MAPGET_LOG_TRACE("Cached string pool offset for {}: {}", nodeId, it->second);
         return it->second;
     }
     return 0;
@@ -0,0 +1,68 @@
+#include "cluster.h"
+#include "mapget/log.h"
+
+#include "fmt/format.h"
+
+#include <algorithm>
+
+namespace mapget
+{
+
+namespace
+{
+
+// FNV-1a, which is the same on all nodes, unlike std::hash.
+uint64_t stableHash(std::string_view const& bytes)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (auto c : bytes) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ULL;
+    }
+    // Mix the bits, so that similar keys spread over the ring.
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+}  // namespace
+
+HashRing::HashRing(std::vector<std::string> nodes) : nodes_(std::move(nodes))
+{
+    if (nodes_.empty())
+        raise("A hash ring needs at least one node.");
+    points_.reserve(nodes_.size() * VirtualNodes);
+    for (auto i = 0u; i < nodes_.size(); ++i) {
+        for (auto v = 0u; v < VirtualNodes; ++v)
+            points_.emplace_back(stableHash(fmt::format("{}#{}", nodes_[i], v)), i);
+    }
+    std::sort(points_.begin(), points_.end());
+}
+
+size_t HashRing::owner(MapTileKey const& key) const
+{
+    auto hash = stableHash(key.toString());
+    auto it = std::lower_bound(
+        points_.begin(), points_.end(), hash, [](auto const& point, uint64_t h) { return point.first < h; });
+    if (it == points_.end())
+        it = points_.begin();
+    return it->second;
+}
+
+std::vector<std::string> const& HashRing::nodes() const
+{
+    return nodes_;
+}
+
+void ClusterPeer::getAsync(
+    std::vector<MapTileKey> const& keys,
+    Cache::Ptr const& cache,
+    DataSourceInfo const& info,
+    std::function<void(std::vector<TileLayer::Ptr>)> onResult,
+    std::vector<CancellationToken::Ptr> const& cancellations)
+{
+    onResult(get(keys, cache, info, cancellations));
+}
+
+}  // namespace mapget
@@ -0,0 +1,243 @@
+#include "compression.h"
+#include "mapget/log.h"
+
+#include <chrono>
+#include <cstdint>
+
+#include <zdict.h>
+#include <zstd.h>
+
+namespace mapget
+{
+
+struct TileBlobCompression::LayerDictionary
+{
+    std::unique_ptr<ZSTD_CDict, decltype(&ZSTD_freeCDict)> compression_{nullptr, &ZSTD_freeCDict};
+    std::unique_ptr<ZSTD_DDict, decltype(&ZSTD_freeDDict)> decompression_{nullptr, &ZSTD_freeDDict};
+    unsigned id_ = 0;
+};
+
+namespace
+{
+
+// zstd contexts are reused per thread, as they are costly to create.
+ZSTD_CCtx* compressionContext()
+{
+    thread_local std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> context{ZSTD_createCCtx(), &ZSTD_freeCCtx};
+    return context.get();
+}
+
+ZSTD_DCtx* decompressionContext()
+{
+    thread_local std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> context{ZSTD_createDCtx(), &ZSTD_freeDCtx};
+    return context.get();
+}
+
+int64_t microsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
+TileBlobCompression::TileBlobCompression(
+    int level,
+    LoadDictionaryFun loadDictionary,
+    StoreDictionaryFun storeDictionary)
+    : level_(level), loadDictionary_(std::move(loadDictionary)), storeDictionary_(std::move(storeDictionary))
+{
+}
+
+TileBlobCompression::~TileBlobCompression() = default;
+
+std::string TileBlobCompression::dictionaryKey(MapTileKey const& k)
+{
+    return k.mapId_ + "/" + k.layerId_;
+}
+
+std::string TileBlobCompression::compress(MapTileKey const& k, std::string const& blob)
+{
+    auto dictionary = compressionDictionary(k, blob);
+
+    auto start = std::chrono::steady_clock::now();
+    std::string result(ZSTD_compressBound(blob.size()), '\0');
+    auto size = dictionary ?
+        ZSTD_compress_usingCDict(
+            compressionContext(), result.data(), result.size(), blob.data(), blob.size(), dictionary->compression_.get()) :
+        ZSTD_compressCCtx(compressionContext(), result.data(), result.size(), blob.data(), blob.size(), level_);
+    if (ZSTD_isError(size))
+        raiseFmt("Could not compress tile {}: {}", k.toString(), ZSTD_getErrorName(size));
+    result.resize(size);
+
+    compressionMicros_ += microsSince(start);
+    ++compressedTiles_;
+    inputBytes_ += static_cast<int64_t>(blob.size());
+    outputBytes_ += static_cast<int64_t>(result.size());
+    return result;
+}
+
+std::shared_ptr<const std::string> TileBlobCompression::decompress(
+    MapTileKey const& k,
+    std::shared_ptr<const std::string> blob)
+{
+    // Uncompressed blobs start with the protocol version, not with a zstd frame.
+    if (!blob || !isCompressed(*blob))
+        return blob;
+    auto contentSize = ZSTD_getFrameContentSize(blob->data(), blob->size());
+    if (contentSize == ZSTD_CONTENTSIZE_ERROR || contentSize == ZSTD_CONTENTSIZE_UNKNOWN)
+        return blob;
+
+    std::shared_ptr<LayerDictionary> dictionary;
+    if (auto dictionaryId = ZSTD_getDictID_fromFrame(blob->data(), blob->size())) {
+        dictionary = decompressionDictionary(k);
+        if (!dictionary || dictionary->id_ != dictionaryId)
+            raiseFmt("Missing compression dictionary {} for tile {}.", dictionaryId, k.toString());
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto result = std::make_shared<std::string>(contentSize, '\0');
+    auto size = dictionary ?
+        ZSTD_decompress_usingDDict(
+            decompressionContext(), result->data(), result->size(), blob->data(), blob->size(), dictionary->decompression_.get()) :
+        ZSTD_decompressDCtx(decompressionContext(), result->data(), result->size(), blob->data(), blob->size());
+    if (ZSTD_isError(size))
+        raiseFmt("Could not decompress tile {}: {}", k.toString(), ZSTD_getErrorName(size));
+
+    decompressionMicros_ += microsSince(start);
+    return result;
+}
+
+bool TileBlobCompression::isCompressed(std::string const& blob)
+{
+    if (blob.size() < sizeof(uint32_t))
+        return false;
+    uint32_t magic = 0;
+    for (auto i = 0u; i < sizeof(magic); ++i)
+        magic |= static_cast<uint32_t>(static_cast<uint8_t>(blob[i])) << (8 * i);
+    return magic == ZSTD_MAGICNUMBER;
+}
+
+std::shared_ptr<TileBlobCompression::LayerDictionary>
+TileBlobCompression::compressionDictionary(MapTileKey const& k, std::string const& blob)
+{
+    auto key = dictionaryKey(k);
+    std::vector<std::string> samples;
+    {
+        std::unique_lock lock(mutex_);
+        auto& layer = layerState(key);
+        if (layer.dictionary_ || layer.training_)
+            return layer.dictionary_;
+
+        layer.samples_.emplace_back(blob.substr(0, DictionarySampleBytes));
+        if (layer.samples_.size() < DictionarySampleCount)
+            return nullptr;
+        layer.training_ = true;
+        samples = std::move(layer.samples_);
+        layer.samples_.clear();
+    }
+
+    // Training takes a while, so it does not block the other layers.
+    trainDictionary(key, samples);
+    std::unique_lock lock(mutex_);
+    return layers_[key].dictionary_;
+}
+
+std::shared_ptr<TileBlobCompression::LayerDictionary> TileBlobCompression::decompressionDictionary(MapTileKey const& k)
+{
+    std::unique_lock lock(mutex_);
+    auto key = dictionaryKey(k);
+    auto& layer = layerState(key);
+
+    // With a shared cache, another process may have stored the dictionary since it was looked up.
+    if (!layer.dictionary_) {
+        if (auto dictionary = loadDictionary_(key)) {
+            layer.dictionary_ = makeDictionary(*dictionary);
+            ++numDictionaries_;
+        }
+    }
+    return layer.dictionary_;
+}
+
+void TileBlobCompression::trainDictionary(std::string const& key, std::vector<std::string> const& samples)
+{
+    std::string concatenatedSamples;
+    std::vector<size_t> sampleSizes;
+    for (auto const& sample : samples) {
+        concatenatedSamples += sample;
+        sampleSizes.push_back(sample.size());
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::string dictionary(MaxDictionaryBytes, '\0');
+    auto size = ZDICT_trainFromBuffer(
+        dictionary.data(),
+        dictionary.size(),
+        concatenatedSamples.data(),
+        sampleSizes.data(),
+        static_cast<unsigned>(sampleSizes.size()));
+
+    std::shared_ptr<LayerDictionary> result;
+    if (ZDICT_isError(size)) {
+        // Layers with too small or too few tiles are compressed without a dictionary.
+        log().debug("Not using a compression dictionary for {}: {}", key, ZDICT_getErrorName(size));
+    }
+    else {
+        dictionary.resize(size);
+        try {
+            storeDictionary_(key, dictionary);
+            result = makeDictionary(dictionary);
+            log().debug("Trained {} B compression dictionary for {} in {} ms.", size, key, microsSince(start) / 1000);
+        }
+        catch (std::exception& e) {
+            log().error("Could not store compression dictionary: {}", e.what());
+        }
+    }
+
+    // A failed training is not repeated, the layer stays without dictionary.
+    std::unique_lock lock(mutex_);
+    auto& layer = layers_[key];
+    layer.dictionary_ = result;
+    if (result)
+        ++numDictionaries_;
+}
+
+TileBlobCompression::LayerState& TileBlobCompression::layerState(std::string const& key)
+{
+    auto& layer = layers_[key];
+    if (layer.loaded_)
+        return layer;
+    layer.loaded_ = true;
+    if (auto dictionary = loadDictionary_(key)) {
+        layer.dictionary_ = makeDictionary(*dictionary);
+        ++numDictionaries_;
+    }
+    return layer;
+}
+
+std::shared_ptr<TileBlobCompression::LayerDictionary> TileBlobCompression::makeDictionary(std::string const& dictionary) const
+{
+    auto result = std::make_shared<LayerDictionary>();
+    result->compression_.reset(ZSTD_createCDict(dictionary.data(), dictionary.size(), level_));
+    result->decompression_.reset(ZSTD_createDDict(dictionary.data(), dictionary.size()));
+    result->id_ = ZSTD_getDictID_fromDict(dictionary.data(), dictionary.size());
+    if (!result->compression_ || !result->decompression_)
+        raise("Could not load a compression dictionary.");
+    return result;
+}
+
+nlohmann::json TileBlobCompression::getStatistics() const
+{
+    auto inputBytes = inputBytes_.load();
+    auto outputBytes = outputBytes_.load();
+    return {
+        {"compression-dictionaries", numDictionaries_.load()},
+        {"compressed-tiles", compressedTiles_.load()},
+        {"compression-input-bytes", inputBytes},
+        {"compression-output-bytes", outputBytes},
+        {"compression-ratio", outputBytes ? static_cast<double>(inputBytes) / static_cast<double>(outputBytes) : 0.},
+        {"compression-ms", compressionMicros_.load() / 1000},
+        {"decompression-ms", decompressionMicros_.load() / 1000}
+    };
+}
+
+}
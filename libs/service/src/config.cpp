@@ -95,12 +95,18 @@ void DataSourceConfigService::loadConfig()
 DataSource::Ptr DataSourceConfigService::makeDataSource(YAML::Node const& descriptor)
 {
     if (auto typeNode = descriptor["type"]) {
-        std::lock_guard memberAccessLock(memberAccessMutex_);
         auto type = typeNode.as<std::string>();
-        auto it = constructors_.find(type);
-        if (it != constructors_.end()) {
+        // The constructor runs without the lock, so that
+        // data sources can be made in parallel.
+        std::function<DataSource::Ptr(YAML::Node const&)> constructor;
+        {
+            std::lock_guard memberAccessLock(memberAccessMutex_);
+            if (auto it = constructors_.find(type); it != constructors_.end())
+                constructor = it->second;
+        }
+        if (constructor) {
             try {
-                if (auto result = it->second(descriptor)) {
+                if (auto result = constructor(descriptor)) {
                     return result;
                 }
                 log().error("Datasource constructor for type {} returned NULL.", type);
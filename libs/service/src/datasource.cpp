@@ -1,14 +1,21 @@
 #include "datasource.h"
+#include "allocations.h"
 #include <memory>
 #include <stdexcept>
 #include <chrono>
+#include <algorithm>
 #include "mapget/model/sourcedatalayer.h"
 #include "mapget/model/info.h"
+#include "mapget/log.h"
 
 namespace mapget
 {
 
-TileLayer::Ptr DataSource::get(const MapTileKey& k, Cache::Ptr& cache, DataSourceInfo const& info)
+TileLayer::Ptr DataSource::get(
+    const MapTileKey& k,
+    Cache::Ptr& cache,
+    DataSourceInfo const& info,
+    CancellationToken::Ptr const& cancellation)
 {
     auto layerInfo = info.getLayer(k.layerId_);
     if (!layerInfo)
@@ -16,6 +23,7 @@ TileLayer::Ptr DataSource::get(const MapTileKey& k, Cache::Ptr& cache, DataSourc
 
     auto result = TileLayer::Ptr{};
 
+    AllocationScope allocations(AllocationStage::Fill);
     auto start = std::chrono::steady_clock::now();
     switch (layerInfo->type_) {
     case mapget::LayerType::Features: {
@@ -25,7 +33,12 @@ TileLayer::Ptr DataSource::get(const MapTileKey& k, Cache::Ptr& cache, DataSourc
             info.mapId_,
             info.getLayer(k.layerId_),
             cache->getStringPool(info.nodeId_));
+        tileFeatureLayer->setCancellation(cancellation);
+        reserveColumns(*tileFeatureLayer);
         fill(tileFeatureLayer);
+        if (!tileFeatureLayer->isCancelled())
+            tileFeatureLayer->sendFinalChunk();
+        recordColumnSizes(*tileFeatureLayer);
         result = tileFeatureLayer;
         break;
     }
@@ -36,10 +49,24 @@ TileLayer::Ptr DataSource::get(const MapTileKey& k, Cache::Ptr& cache, DataSourc
             info.mapId_,
             info.getLayer(k.layerId_),
             cache->getStringPool(info.nodeId_));
+        tileSourceDataLayer->setCancellation(cancellation);
         fill(tileSourceDataLayer);
         result = tileSourceDataLayer;
         break;
     }
+    case mapget::LayerType::Heightmap:
+    case mapget::LayerType::OrthoImage:
+    case mapget::LayerType::GLTF: {
+        auto tileBinaryLayer = std::make_shared<TileBinaryLayer>(
+            k.tileId_,
+            info.nodeId_,
+            info.mapId_,
+            info.getLayer(k.layerId_));
+        tileBinaryLayer->setCancellation(cancellation);
+        fill(tileBinaryLayer);
+        result = tileBinaryLayer;
+        break;
+    }
     default:
         break;
     }
@@ -48,10 +75,145 @@ TileLayer::Ptr DataSource::get(const MapTileKey& k, Cache::Ptr& cache, DataSourc
     if (result) {
         auto duration = std::chrono::steady_clock::now() - start;
         result->setInfo("fill-time-ms", std::chrono::duration_cast<std::chrono::milliseconds>(duration).count());
+        allocations.setInfo(*result);
     }
     return result;
 }
 
+std::vector<TileLayer::Ptr> DataSource::get(
+    std::vector<MapTileKey> const& keys,
+    Cache::Ptr& cache,
+    DataSourceInfo const& info,
+    std::vector<CancellationToken::Ptr> const& cancellations)
+{
+    auto cancellationAt = [&cancellations](size_t i)
+    { return i < cancellations.size() ? cancellations[i] : CancellationToken::Ptr{}; };
+
+    std::vector<TileLayer::Ptr> result;
+    result.reserve(keys.size());
+
+    auto isFeatureBatch = keys.size() > 1 && std::all_of(
+        keys.begin(), keys.end(), [&keys](auto const& k) {
+            return k.layer_ == LayerType::Features && k.layerId_ == keys.front().layerId_;
+        });
+    if (!isFeatureBatch) {
+        for (auto i = 0u; i < keys.size(); ++i)
+            result.emplace_back(get(keys[i], cache, info, cancellationAt(i)));
+        return result;
+    }
+
+    auto layerInfo = info.getLayer(keys.front().layerId_);
+    if (!layerInfo)
+        throw std::runtime_error("Layer info is null");
+
+    std::vector<TileFeatureLayer::Ptr> featureTiles;
+    featureTiles.reserve(keys.size());
+    auto stringPool = cache->getStringPool(info.nodeId_);
+    for (auto i = 0u; i < keys.size(); ++i) {
+        auto& featureTile = featureTiles.emplace_back(std::make_shared<TileFeatureLayer>(
+            keys[i].tileId_,
+            info.nodeId_,
+            info.mapId_,
+            layerInfo,
+            stringPool));
+        featureTile->setCancellation(cancellationAt(i));
+        reserveColumns(*featureTile);
+    }
+
+    AllocationScope allocations(AllocationStage::Fill);
+    auto start = std::chrono::steady_clock::now();
+    fill(featureTiles);
+    auto duration = std::chrono::steady_clock::now() - start;
+
+    // Notify the tiles how long it took to fill the whole batch.
+    for (auto const& tileFeatureLayer : featureTiles) {
+        if (!tileFeatureLayer->isCancelled())
+            tileFeatureLayer->sendFinalChunk();
+        recordColumnSizes(*tileFeatureLayer);
+        tileFeatureLayer->setInfo("fill-time-ms", std::chrono::duration_cast<std::chrono::milliseconds>(duration).count());
+        tileFeatureLayer->setInfo("fill-batch-size", static_cast<int64_t>(featureTiles.size()));
+        allocations.setInfo(*tileFeatureLayer);
+        result.emplace_back(tileFeatureLayer);
+    }
+    return result;
+}
+
+void DataSource::getAsync(
+    MapTileKey const& k,
+    Cache::Ptr const& cache,
+    DataSourceInfo const& info,
+    std::function<void(TileLayer::Ptr)> onResult,
+    CancellationToken::Ptr const& cancellation)
+{
+    auto cachePtr = cache;
+    onResult(get(k, cachePtr, info, cancellation));
+}
+
+void DataSource::getBatchAsync(
+    std::vector<MapTileKey> const& keys,
+    Cache::Ptr const& cache,
+    DataSourceInfo const& info,
+    std::function<void(std::vector<TileLayer::Ptr>)> onResult,
+    std::vector<CancellationToken::Ptr> const& cancellations)
+{
+    auto cachePtr = cache;
+    onResult(get(keys, cachePtr, info, cancellations));
+}
+
+void DataSource::fill(std::vector<TileFeatureLayer::Ptr> const& featureTiles)
+{
+    for (auto const& featureTile : featureTiles) {
+        if (!featureTile->isCancelled())
+            fill(featureTile);
+    }
+}
+
+void DataSource::fill(TileBinaryLayer::Ptr const& binaryTile)
+{
+    binaryTile->setError(fmt::format(
+        "Data source does not fill {} layers.",
+        nlohmann::json(binaryTile->layerInfo()->type_).get<std::string>()));
+}
+
+void DataSource::reserveColumns(TileFeatureLayer& featureTile)
+{
+    TileFeatureLayer::SizeHint hint;
+    {
+        std::unique_lock lock(sizeHintsMutex_);
+        auto it = sizeHints_.find(featureTile.layerInfo()->layerId_);
+        if (it == sizeHints_.end())
+            return;
+        hint = it->second;
+    }
+    featureTile.reserve(hint);
+}
+
+void DataSource::recordColumnSizes(TileFeatureLayer const& featureTile)
+{
+    // Cancelled or failed tiles are usually incomplete.
+    if (featureTile.isCancelled() || featureTile.error())
+        return;
+    auto sizes = featureTile.sizeHint();
+
+    std::unique_lock lock(sizeHintsMutex_);
+    auto [it, inserted] = sizeHints_.try_emplace(featureTile.layerInfo()->layerId_, sizes);
+    if (inserted)
+        return;
+
+    // The average follows the recent tiles, so that one huge
+    // tile does not inflate the reservations for a long time.
+    auto average = [](uint32_t& value, uint32_t sample)
+    { value = static_cast<uint32_t>((uint64_t{value} * 3 + sample) / 4); };
+    auto& hint = it->second;
+    average(hint.features_, sizes.features_);
+    average(hint.attributes_, sizes.attributes_);
+    average(hint.attributeLayers_, sizes.attributeLayers_);
+    average(hint.geometries_, sizes.geometries_);
+    average(hint.validities_, sizes.validities_);
+    average(hint.relations_, sizes.relations_);
+    average(hint.sourceDataReferences_, sizes.sourceDataReferences_);
+}
+
 simfil::StringId DataSource::cachedStringPoolOffset(const std::string& nodeId, Cache::Ptr const& cache)
 {
     return cache->cachedStringPoolOffset(nodeId);
@@ -62,4 +224,13 @@ std::vector<LocateResponse> DataSource::locate(const LocateRequest& req)
     return {};
 }
 
+std::vector<std::vector<LocateResponse>> DataSource::locate(std::vector<LocateRequest> const& requests)
+{
+    std::vector<std::vector<LocateResponse>> result;
+    result.reserve(requests.size());
+    for (auto const& req : requests)
+        result.emplace_back(locate(req));
+    return result;
+}
+
 }
@@ -0,0 +1,179 @@
+#include "executor.h"
+#include "mapget/log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mapget
+{
+
+struct Executor::Impl
+{
+    struct TaskQueue
+    {
+        std::mutex mutex_;
+        std::deque<Task> tasks_;
+    };
+
+    std::vector<std::unique_ptr<TaskQueue>> queues_;
+    std::vector<std::thread> threads_;
+
+    std::atomic<size_t> numQueuedTasks_ = 0;
+    std::atomic<size_t> nextQueue_ = 0;
+    std::atomic_bool stopping_ = false;
+
+    // Sleeping threads wait for new tasks with this mutex/condition variable.
+    std::mutex sleepMutex_;
+    std::condition_variable tasksAvailable_;
+
+    // Allows post() to find the calling thread's own queue.
+    static thread_local Impl* currentExecutor_;
+    static thread_local size_t currentQueue_;
+
+    explicit Impl(size_t numThreads)
+    {
+        if (numThreads == 0)
+            numThreads = std::max(1u, std::thread::hardware_concurrency());
+        for (auto i = 0u; i < numThreads; ++i)
+            queues_.emplace_back(std::make_unique<TaskQueue>());
+        for (auto i = 0u; i < numThreads; ++i)
+            threads_.emplace_back([this, i] { run(i); });
+    }
+
+    void post(Task task)
+    {
+        if (stopping_)
+            return;
+
+        auto queueIndex = (currentExecutor_ == this) ?
+            currentQueue_ :
+            nextQueue_.fetch_add(1) % queues_.size();
+        {
+            // The count is raised under the queue lock, before the task
+            // can be popped, so that popping never makes it wrap around.
+            auto& queue = *queues_[queueIndex];
+            std::unique_lock lock(queue.mutex_);
+            ++numQueuedTasks_;
+            queue.tasks_.push_back(std::move(task));
+        }
+
+        {
+            // Taking the sleep mutex ensures that a thread which
+            // is about to sleep observes the new task count.
+            std::unique_lock lock(sleepMutex_);
+        }
+        tasksAvailable_.notify_one();
+    }
+
+    bool tryPop(size_t threadIndex, Task& task)
+    {
+        // Own queue is served in FIFO order.
+        auto& ownQueue = *queues_[threadIndex];
+        {
+            std::unique_lock lock(ownQueue.mutex_);
+            if (!ownQueue.tasks_.empty()) {
+                task = std::move(ownQueue.tasks_.front());
+                ownQueue.tasks_.pop_front();
+                --numQueuedTasks_;
+                return true;
+            }
+        }
+
+        // Steal from the back of other threads' queues.
+        for (auto offset = 1u; offset < queues_.size(); ++offset) {
+            auto& otherQueue = *queues_[(threadIndex + offset) % queues_.size()];
+            std::unique_lock lock(otherQueue.mutex_);
+            if (!otherQueue.tasks_.empty()) {
+                task = std::move(otherQueue.tasks_.back());
+                otherQueue.tasks_.pop_back();
+                --numQueuedTasks_;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(size_t threadIndex)
+    {
+        currentExecutor_ = this;
+        currentQueue_ = threadIndex;
+
+        while (!stopping_) {
+            Task task;
+            if (tryPop(threadIndex, task)) {
+                try {
+                    task();
+                }
+                catch (std::exception& e) {
+                    log().error("Uncaught exception in executor task: {}", e.what());
+                }
+                catch (...) {
+                    log().error("Uncaught non-standard exception in executor task.");
+                }
+                continue;
+            }
+
+            std::unique_lock lock(sleepMutex_);
+            tasksAvailable_.wait(
+                lock,
+                [this] { return stopping_ || numQueuedTasks_ > 0; });
+        }
+    }
+
+    void stop()
+    {
+        {
+            std::unique_lock lock(sleepMutex_);
+            stopping_ = true;
+        }
+        tasksAvailable_.notify_all();
+        for (auto& thread : threads_) {
+            if (thread.joinable())
+                thread.join();
+        }
+        threads_.clear();
+
+        for (auto& queue : queues_) {
+            std::unique_lock lock(queue->mutex_);
+            numQueuedTasks_ -= queue->tasks_.size();
+            queue->tasks_.clear();
+        }
+    }
+};
+
+thread_local Executor::Impl* Executor::Impl::currentExecutor_ = nullptr;
+thread_local size_t Executor::Impl::currentQueue_ = 0;
+
+Executor::Executor(size_t numThreads) : impl_(std::make_unique<Impl>(numThreads)) {}
+
+Executor::~Executor()
+{
+    stop();
+}
+
+void Executor::post(Task task)
+{
+    impl_->post(std::move(task));
+}
+
+void Executor::stop()
+{
+    impl_->stop();
+}
+
+size_t Executor::numThreads() const
+{
+    return impl_->queues_.size();
+}
+
+size_t Executor::numQueuedTasks() const
+{
+    return impl_->numQueuedTasks_;
+}
+
+}  // namespace mapget
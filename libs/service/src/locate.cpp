@@ -101,4 +101,24 @@ void LocateRequest::setFeatureId(const KeyValueViewPairs& kvp)
     }
 }
 
+nlohmann::json ResolvedRelation::serialize(bool withTargets) const
+{
+    auto targetTiles = nlohmann::json::array();
+    for (auto const& tileKey : targetTiles_)
+        targetTiles.emplace_back(tileKey.toString());
+    auto result = nlohmann::json::object({
+        {"sourceFeatureId", source_->id()->toString()},
+        {"name", relation_->name()},
+        {"targetFeatureId", relation_->target()->toString()},
+        {"targetTileIds", targetTiles},
+    });
+    if (withTargets) {
+        auto targets = nlohmann::json::array();
+        for (auto const& target : targets_)
+            targets.emplace_back(target->toJson());
+        result["targets"] = targets;
+    }
+    return result;
+}
+
 }  // namespace mapget
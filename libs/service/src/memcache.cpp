@@ -1,39 +1,158 @@
 #include "memcache.h"
+#include "memory.h"
 #include "mapget/log.h"
 
+#include <algorithm>
+#include <functional>
+#include <mutex>
+
 namespace mapget
 {
 
-MemCache::MemCache(uint32_t maxCachedTiles) : maxCachedTiles_(maxCachedTiles) {}
+struct MemCache::Shard
+{
+    struct Entry
+    {
+        SharedBlob blob_;
+        std::list<MapTileKey>::iterator lruPosition_;
+    };
+
+    std::mutex mutex_;
+    std::unordered_map<MapTileKey, Entry, MapTileKey::Hash> tiles_;
+    std::list<MapTileKey> lru_;  // Most recently used first
+    size_t bytes_ = 0;
+    size_t maxTiles_ = 0;  // Zero means no limit
+    size_t maxBytes_ = 0;  // Zero means no limit
+
+    void erase(decltype(tiles_)::iterator it)
+    {
+        bytes_ -= it->second.blob_->size();
+        MemoryBudget::instance().release(MemoryPool::CachedTiles, it->second.blob_->size());
+        lru_.erase(it->second.lruPosition_);
+        tiles_.erase(it);
+    }
+
+    [[nodiscard]] bool exceedsLimits() const
+    {
+        return (maxTiles_ && tiles_.size() > maxTiles_) || (maxBytes_ && bytes_ > maxBytes_);
+    }
+};
+
+MemCache::MemCache(uint32_t maxCachedTiles, size_t maxCachedBytes)
+{
+    // Small caches use a single shard, so that they evict in exact LRU order.
+    auto numShards = maxCachedTiles ? std::clamp(maxCachedTiles / MinTilesPerShard, 1u, MaxShards) : MaxShards;
+    for (auto i = 0u; i < numShards; ++i) {
+        auto& shard = *shards_.emplace_back(std::make_unique<Shard>());
+        shard.maxTiles_ = maxCachedTiles / numShards + (i < maxCachedTiles % numShards ? 1 : 0);
+        if (maxCachedBytes)
+            shard.maxBytes_ = std::max<size_t>(maxCachedBytes / numShards, 1);
+    }
+    reclaimerId_ = MemoryBudget::instance().addReclaimer([this](size_t bytes) { return reclaim(bytes); });
+}
+
+MemCache::~MemCache()
+{
+    MemoryBudget::instance().removeReclaimer(reclaimerId_);
+    for (auto const& shard : shards_)
+        MemoryBudget::instance().release(MemoryPool::CachedTiles, shard->bytes_);
+}
+
+MemCache::Shard& MemCache::shardFor(MapTileKey const& tileKey)
+{
+    return *shards_[tileKey.hash() % shards_.size()];
+}
 
 std::optional<std::string> MemCache::getTileLayerBlob(const MapTileKey& k)
 {
-    std::shared_lock cacheLock(cacheMutex_);
-    auto cacheIt = cachedTiles_.find(k.toString());
-    if (cacheIt != cachedTiles_.end())
-        return cacheIt->second;
+    if (auto blob = getSharedTileLayerBlob(k))
+        return *blob;
     return {};
 }
 
+Cache::SharedBlob MemCache::getSharedTileLayerBlob(const MapTileKey& k)
+{
+    auto& shard = shardFor(k);
+    std::unique_lock shardLock(shard.mutex_);
+    auto cacheIt = shard.tiles_.find(k);
+    if (cacheIt == shard.tiles_.end())
+        return nullptr;
+    shard.lru_.splice(shard.lru_.begin(), shard.lru_, cacheIt->second.lruPosition_);
+    return cacheIt->second.blob_;
+}
+
 void MemCache::putTileLayerBlob(const MapTileKey& k, const std::string& v)
 {
-    std::unique_lock cacheLock(cacheMutex_);
-    auto ks = k.toString();
-    fifo_.push_front(ks);
-    cachedTiles_.emplace(ks, v);
-    while (fifo_.size() > maxCachedTiles_) {
-        auto oldestTileKey = fifo_.back();
-        fifo_.pop_back();
-        log().debug("Evicting tile from cache: {}", oldestTileKey);
-        cachedTiles_.erase(oldestTileKey);
+    auto blob = std::make_shared<const std::string>(v);
+    auto& shard = shardFor(k);
+    std::unique_lock shardLock(shard.mutex_);
+
+    if (auto cacheIt = shard.tiles_.find(k); cacheIt != shard.tiles_.end())
+        shard.erase(cacheIt);
+    if (shard.maxBytes_ && blob->size() > shard.maxBytes_) {
+        MAPGET_LOG_DEBUG("Not caching tile {}, its {} bytes exceed the budget.", k.toString(), blob->size());
+        return;
+    }
+
+    shard.lru_.push_front(k);
+    shard.bytes_ += blob->size();
+    MemoryBudget::instance().reserve(MemoryPool::CachedTiles, blob->size());
+    shard.tiles_.emplace(k, Shard::Entry{std::move(blob), shard.lru_.begin()});
+    while (shard.exceedsLimits()) {
+        auto oldestTileKey = shard.lru_.back();
+        MAPGET_LOG_DEBUG("Evicting tile from cache: {}", oldestTileKey.toString());
+        shard.erase(shard.tiles_.find(oldestTileKey));
+        evictLiveTile(oldestTileKey);
+    }
+}
+
+void MemCache::eraseTileLayerBlob(const MapTileKey& k)
+{
+    auto& shard = shardFor(k);
+    std::unique_lock shardLock(shard.mutex_);
+    if (auto cacheIt = shard.tiles_.find(k); cacheIt != shard.tiles_.end())
+        shard.erase(cacheIt);
+}
+
+size_t MemCache::reclaim(size_t bytes)
+{
+    // The shards give up their least recently used tiles in turns,
+    // so that each of them keeps its part of the cache.
+    size_t freed = 0;
+    auto evictedAny = true;
+    while (freed < bytes && evictedAny) {
+        evictedAny = false;
+        for (auto const& shard : shards_) {
+            std::unique_lock shardLock(shard->mutex_);
+            if (shard->lru_.empty())
+                continue;
+            auto oldestTileKey = shard->lru_.back();
+            auto cacheIt = shard->tiles_.find(oldestTileKey);
+            freed += cacheIt->second.blob_->size();
+            MAPGET_LOG_DEBUG("Evicting tile from cache to reclaim memory: {}", oldestTileKey.toString());
+            shard->erase(cacheIt);
+            evictLiveTile(oldestTileKey);
+            evictedAny = true;
+            if (freed >= bytes)
+                break;
+        }
     }
+    return freed;
 }
 
 nlohmann::json MemCache::getStatistics() const {
     auto result = Cache::getStatistics();
-    result["memcache-map-size"] = (int64_t)cachedTiles_.size();
-    result["memcache-fifo-size"] = (int64_t)fifo_.size();
+    int64_t numTiles = 0;
+    int64_t numBytes = 0;
+    for (auto const& shard : shards_) {
+        std::unique_lock shardLock(shard->mutex_);
+        numTiles += (int64_t)shard->tiles_.size();
+        numBytes += (int64_t)shard->bytes_;
+    }
+    result["memcache-map-size"] = numTiles;
+    result["memcache-bytes"] = numBytes;
+    result["memcache-shards"] = (int64_t)shards_.size();
     return result;
 }
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,168 @@
+#include "memory.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+namespace mapget
+{
+
+MemoryBudget& MemoryBudget::instance()
+{
+    static MemoryBudget budget;
+    return budget;
+}
+
+MemoryBudget::MemoryBudget()
+{
+    if (auto limitMb = std::getenv("MAPGET_MEMORY_LIMIT_MB"))
+        setLimit(std::strtoull(limitMb, nullptr, 10) * 1024 * 1024);
+}
+
+void MemoryBudget::setLimit(size_t bytes, double softLimitRatio)
+{
+    softLimit_ = static_cast<size_t>(static_cast<double>(bytes) * std::clamp(softLimitRatio, 0., 1.));
+    limit_ = bytes;
+}
+
+size_t MemoryBudget::limit() const
+{
+    return limit_;
+}
+
+size_t MemoryBudget::softLimit() const
+{
+    return softLimit_;
+}
+
+size_t MemoryBudget::reserved() const
+{
+    return reserved_;
+}
+
+size_t MemoryBudget::reserved(MemoryPool pool) const
+{
+    return reservedPerPool_[static_cast<size_t>(pool)];
+}
+
+void MemoryBudget::reserve(MemoryPool pool, size_t bytes)
+{
+    reservedPerPool_[static_cast<size_t>(pool)] += bytes;
+    reserved_ += bytes;
+}
+
+void MemoryBudget::release(MemoryPool pool, size_t bytes)
+{
+    reservedPerPool_[static_cast<size_t>(pool)] -= bytes;
+    reserved_ -= bytes;
+}
+
+bool MemoryBudget::isUnderPressure() const
+{
+    return limit_ > 0 && reserved_ > softLimit_;
+}
+
+bool MemoryBudget::isExhausted() const
+{
+    return limit_ > 0 && reserved_ >= limit_;
+}
+
+uint64_t MemoryBudget::addReclaimer(Reclaimer reclaimer)
+{
+    std::unique_lock lock(reclaimersMutex_);
+    auto id = nextReclaimerId_++;
+    reclaimers_.emplace_back(id, std::move(reclaimer));
+    return id;
+}
+
+void MemoryBudget::removeReclaimer(uint64_t id)
+{
+    std::unique_lock reclaimLock(reclaimMutex_);
+    std::unique_lock lock(reclaimersMutex_);
+    reclaimers_.remove_if([id](auto const& reclaimer) { return reclaimer.first == id; });
+}
+
+size_t MemoryBudget::reclaim()
+{
+    if (!isUnderPressure())
+        return 0;
+    std::unique_lock reclaimLock(reclaimMutex_, std::try_to_lock);
+    if (!reclaimLock.owns_lock())
+        return 0;
+
+    // The reclaimers are called without reclaimersMutex_, as they reserve and release memory.
+    std::vector<Reclaimer> reclaimers;
+    {
+        std::unique_lock lock(reclaimersMutex_);
+        for (auto const& [id, reclaimer] : reclaimers_)
+            reclaimers.emplace_back(reclaimer);
+    }
+    auto target = softLimit_ - softLimit_ / 10;
+    size_t freed = 0;
+    for (auto const& reclaimer : reclaimers) {
+        auto reservedBytes = reserved_.load();
+        if (reservedBytes <= target)
+            break;
+        freed += reclaimer(reservedBytes - target);
+    }
+    if (freed > 0) {
+        ++reclaims_;
+        reclaimedBytes_ += static_cast<int64_t>(freed);
+    }
+    return freed;
+}
+
+nlohmann::json MemoryBudget::getStatistics() const
+{
+    auto reservedPerPool = nlohmann::json::object();
+    for (auto i = 0u; i < NumPools; ++i)
+        reservedPerPool[poolName(static_cast<MemoryPool>(i))] = reservedPerPool_[i].load();
+    return {
+        {"limit", limit_.load()},
+        {"soft-limit", softLimit_.load()},
+        {"reserved", reserved_.load()},
+        {"reserved-per-pool", reservedPerPool},
+        {"under-pressure", isUnderPressure()},
+        {"reclaims", reclaims_.load()},
+        {"reclaimed-bytes", reclaimedBytes_.load()}};
+}
+
+char const* MemoryBudget::poolName(MemoryPool pool)
+{
+    switch (pool) {
+    case MemoryPool::CachedTiles:
+        return "cached-tiles";
+    case MemoryPool::LiveTiles:
+        return "live-tiles";
+    case MemoryPool::StringPools:
+        return "string-pools";
+    case MemoryPool::LoadingTiles:
+        return "loading-tiles";
+    case MemoryPool::Buffers:
+        return "buffers";
+    case MemoryPool::DeltaBases:
+        return "delta-bases";
+    }
+    return "unknown";
+}
+
+MemoryBudget::Reservation::Reservation(MemoryPool pool, size_t bytes) : pool_(pool)
+{
+    resize(bytes);
+}
+
+MemoryBudget::Reservation::~Reservation()
+{
+    resize(0);
+}
+
+void MemoryBudget::Reservation::resize(size_t bytes)
+{
+    if (bytes > bytes_)
+        instance().reserve(pool_, bytes - bytes_);
+    else if (bytes < bytes_)
+        instance().release(pool_, bytes_ - bytes);
+    bytes_ = bytes;
+}
+
+}  // namespace mapget
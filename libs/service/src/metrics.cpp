@@ -0,0 +1,143 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+namespace mapget
+{
+
+namespace
+{
+
+void writeValue(std::ostream& out, double value)
+{
+    if (std::isinf(value))
+        out << (value > 0 ? "+Inf" : "-Inf");
+    else if (std::isnan(value))
+        out << "NaN";
+    else
+        out << value;
+}
+
+}  // namespace
+
+std::vector<double> const& Histogram::defaultDurationBounds()
+{
+    static std::vector<double> bounds{
+        0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1., 2.5, 5., 10.};
+    return bounds;
+}
+
+Histogram::Histogram(std::vector<double> upperBounds)
+    : upperBounds_(std::move(upperBounds)),
+      bucketCounts_(std::make_unique<std::atomic<uint64_t>[]>(upperBounds_.size() + 1))
+{
+}
+
+void Histogram::observe(double value)
+{
+    auto bucket = std::lower_bound(upperBounds_.begin(), upperBounds_.end(), value) - upperBounds_.begin();
+    bucketCounts_[bucket].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+}
+
+std::vector<double> const& Histogram::upperBounds() const
+{
+    return upperBounds_;
+}
+
+std::vector<uint64_t> Histogram::bucketCounts() const
+{
+    std::vector<uint64_t> result;
+    result.reserve(upperBounds_.size() + 1);
+    for (auto i = 0u; i <= upperBounds_.size(); ++i)
+        result.emplace_back(bucketCounts_[i].load(std::memory_order_relaxed));
+    return result;
+}
+
+uint64_t Histogram::count() const
+{
+    return count_.load(std::memory_order_relaxed);
+}
+
+double Histogram::sum() const
+{
+    return sum_.load(std::memory_order_relaxed);
+}
+
+MetricsWriter::MetricsWriter(std::ostream& out) : out_(out) {}
+
+void MetricsWriter::family(std::string_view name, std::string_view type, std::string_view help)
+{
+    out_ << "# HELP " << name << " " << help << "\n";
+    out_ << "# TYPE " << name << " " << type << "\n";
+}
+
+void MetricsWriter::sample(std::string_view name, MetricLabels const& labels, double value)
+{
+    out_ << name;
+    writeLabels(labels);
+    out_ << " ";
+    writeValue(out_, value);
+    out_ << "\n";
+}
+
+void MetricsWriter::histogram(std::string_view name, MetricLabels const& labels, Histogram const& histogram)
+{
+    // Buckets are reported cumulatively. The count is taken from the
+    // buckets, so that it matches the +Inf bucket even if observations
+    // happen while the histogram is written.
+    auto const& upperBounds = histogram.upperBounds();
+    auto bucketCounts = histogram.bucketCounts();
+    uint64_t cumulativeCount = 0;
+    for (auto i = 0u; i <= upperBounds.size(); ++i) {
+        cumulativeCount += bucketCounts[i];
+        std::ostringstream bound;
+        if (i < upperBounds.size())
+            writeValue(bound, upperBounds[i]);
+        else
+            bound << "+Inf";
+        out_ << name << "_bucket";
+        writeLabels(labels, "le", bound.str());
+        out_ << " " << cumulativeCount << "\n";
+    }
+    out_ << name << "_sum";
+    writeLabels(labels);
+    out_ << " ";
+    writeValue(out_, histogram.sum());
+    out_ << "\n";
+    out_ << name << "_count";
+    writeLabels(labels);
+    out_ << " " << cumulativeCount << "\n";
+}
+
+void MetricsWriter::writeLabels(MetricLabels const& labels, std::string_view extraName, std::string_view extraValue)
+{
+    if (labels.empty() && extraName.empty())
+        return;
+
+    auto first = true;
+    auto writeLabel = [&](std::string_view labelName, std::string_view labelValue)
+    {
+        out_ << (first ? "{" : ",") << labelName << "=\"";
+        first = false;
+        for (auto c : labelValue) {
+            switch (c) {
+            case '\\': out_ << "\\\\"; break;
+            case '"': out_ << "\\\""; break;
+            case '\n': out_ << "\\n"; break;
+            default: out_ << c;
+            }
+        }
+        out_ << "\"";
+    };
+    for (auto const& [labelName, labelValue] : labels)
+        writeLabel(labelName, labelValue);
+    if (!extraName.empty())
+        writeLabel(extraName, extraValue);
+    out_ << "}";
+}
+
+}  // namespace mapget
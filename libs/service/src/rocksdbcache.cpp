@@ -8,6 +8,7 @@
 namespace mapget
 {
 
+// Tile keys in all of the tile columns are binary MapTileKeys (see MapTileKey::toBinary).
 // Timestamp to the tileId stored at that time. Used to delete oldest entries.
 static uint8_t COL_TIMESTAMP = 0;
 // Reverse tile->timestamp lookup.
@@ -17,6 +18,24 @@ static uint8_t COL_TIMESTAMP_REVERSE = 1;
 static uint8_t COL_TILES = 2;
 // String Pools. No data gets deleted from there unless clearCache=true is set.
 static uint8_t COL_STRING_POOLS = 3;
+// Metadata about the cache contents, so that it need not be scanned at startup.
+static uint8_t COL_METADATA = 4;
+// Strings which were added to a string pool since it was written. Keys are the
+// node id, a zero byte, and the big-endian first string id of the update.
+static uint8_t COL_STRING_POOL_UPDATES = 5;
+// Compression dictionaries per map layer, which are needed to read compressed tiles.
+static uint8_t COL_COMPRESSION_DICTIONARIES = 6;
+// Locate index, from the keys of the features of the cached tiles to their tiles.
+static uint8_t COL_LOCATE_INDEX = 7;
+
+// Metadata key of the number of cached tiles.
+static constexpr auto META_TILE_COUNT = "tile-count";
+// Metadata key of the tile key format. Caches without it use textual keys.
+static constexpr auto META_KEY_FORMAT = "key-format";
+static constexpr auto KEY_FORMAT_BINARY = "binary";
+
+// Size up to which the converted entries of an older cache are written at once.
+static constexpr size_t UpgradeBatchBytes = 64 * 1024 * 1024;
 
 RocksDBCache::RocksDBCache(uint32_t cacheMaxTiles, std::string cachePath, bool clearCache)
     : max_key_count_(cacheMaxTiles)
@@ -41,6 +60,18 @@ RocksDBCache::RocksDBCache(uint32_t cacheMaxTiles, std::string cachePath, bool c
     columnFamilies.push_back(rocksdb::ColumnFamilyDescriptor(
         "StringPools",
         rocksdb::ColumnFamilyOptions()));
+    columnFamilies.push_back(rocksdb::ColumnFamilyDescriptor(
+        "Metadata",
+        rocksdb::ColumnFamilyOptions()));
+    columnFamilies.push_back(rocksdb::ColumnFamilyDescriptor(
+        "StringPoolUpdates",
+        rocksdb::ColumnFamilyOptions()));
+    columnFamilies.push_back(rocksdb::ColumnFamilyDescriptor(
+        "CompressionDictionaries",
+        rocksdb::ColumnFamilyOptions()));
+    columnFamilies.push_back(rocksdb::ColumnFamilyDescriptor(
+        "LocateIndex",
+        rocksdb::ColumnFamilyOptions()));
 
     namespace fs = std::filesystem;
 
@@ -48,7 +79,7 @@ RocksDBCache::RocksDBCache(uint32_t cacheMaxTiles, std::string cachePath, bool c
     if (fs::path(cachePath).is_relative()) {
         absoluteCachePath = fs::current_path() / cachePath;
     }
-    log().debug(fmt::format("Initializing RocksDB cache under: {}", absoluteCachePath.string()));
+    MAPGET_LOG_DEBUG(fmt::format("Initializing RocksDB cache under: {}", absoluteCachePath.string()));
 
     if (!fs::exists(absoluteCachePath.parent_path())) {
         raiseFmt("Error initializing rocksDB cache: parent directory {} does not exist!",
@@ -74,45 +105,36 @@ RocksDBCache::RocksDBCache(uint32_t cacheMaxTiles, std::string cachePath, bool c
             status.ToString()));
     }
 
-    for (rocksdb::ColumnFamilyHandle* handle : column_family_handles_) {
-        std::unique_ptr<rocksdb::Iterator> it(db_->NewIterator(rocksdb::ReadOptions(), handle));
-        for (it->SeekToFirst(); it->Valid(); it->Next()) {
-            if (handle->GetName() == ROCKSDB_NAMESPACE::kDefaultColumnFamilyName) {
-                // Count existing tiles, since we're not clearing the cache.
-                key_count_++;
-            }
-            else if (handle->GetName() == "StringPools") {
-                // Update stringPoolOffsets_ (superclass member)
-                // for each node ID by triggering cache lookup.
-                Cache::getStringPool(it->key().ToString());
-            }
-        }
+    // Update stringPoolOffsets_ (superclass member)
+    // for each node ID by triggering cache lookup.
+    {
+        std::unique_ptr<rocksdb::Iterator>
+            it(db_->NewIterator(read_options_, column_family_handles_[COL_STRING_POOLS]));
+        for (it->SeekToFirst(); it->Valid(); it->Next())
+            Cache::getStringPool(it->key().ToString());
+    }
+
+    // The tile count is kept in the metadata, so that the tiles need not be
+    // counted. Caches from older versions are upgraded once.
+    std::string keyFormat;
+    std::string tileCount;
+    if (db_->Get(read_options_, column_family_handles_[COL_METADATA], META_KEY_FORMAT, &keyFormat).ok() &&
+        keyFormat == KEY_FORMAT_BINARY &&
+        db_->Get(read_options_, column_family_handles_[COL_METADATA], META_TILE_COUNT, &tileCount).ok())
+    {
+        key_count_ = static_cast<uint32_t>(std::stoul(tileCount));
+    }
+    else {
+        upgradeLegacyCache();
     }
 
     // Handle special case: if the cache is initialized with lower maxTiles
     // than in the opened one, delete oldest tiles to fit limit.
     if (!clearCache && max_key_count_ > 0 && key_count_ > max_key_count_) {
-        auto deleteCount = key_count_ - max_key_count_;
-        rocksdb::WriteBatch batch;
-        std::unique_ptr<rocksdb::Iterator>
-            it(db_->NewIterator(read_options_, column_family_handles_[COL_TIMESTAMP]));
-        it->SeekToFirst();
-        auto timeStampsToDelete = std::vector<std::string>();
-        while (deleteCount != 0) {
-            batch.Delete(column_family_handles_[COL_TIMESTAMP], it->key());
-            batch.Delete(column_family_handles_[COL_TIMESTAMP_REVERSE], it->value());
-            batch.Delete(column_family_handles_[COL_TILES], it->value());
-            it->Next();
-            --deleteCount;
-        }
-        status = db_->Write(write_options_, &batch);
-        if (!status.ok()) {
-            raise("Could not trim cache!");
-        }
-        key_count_ = max_key_count_;
+        evictOldestTiles(key_count_ - max_key_count_);
     }
 
-    log().debug(fmt::format("Initialized RocksDB cache with {} existing tile entries.",key_count_));
+    MAPGET_LOG_DEBUG(fmt::format("Initialized RocksDB cache with {} existing tile entries.",key_count_));
 }
 
 RocksDBCache::~RocksDBCache()
@@ -127,11 +149,11 @@ std::optional<std::string> RocksDBCache::getTileLayerBlob(MapTileKey const& k)
 {
     std::string read_value;
     auto status =
-        db_->Get(read_options_, column_family_handles_[COL_TILES], k.toString(), &read_value);
+        db_->Get(read_options_, column_family_handles_[COL_TILES], k.toBinary(), &read_value);
 
     if (status.ok()) {
-        log().trace(fmt::format("Key: {} | Layer size: {}", k.toString(), read_value.size()));
-        log().debug("Cache hits: {}, cache misses: {}", cacheHits_, cacheMisses_);
+        MAPGET_LOG_TRACE("Key: {} | Layer size: {}", k.toString(), read_value.size());
+        MAPGET_LOG_DEBUG("Cache hits: {}, cache misses: {}", cacheHits_.load(), cacheMisses_.load());
         return read_value;
     }
     else if (status.IsNotFound()) {
@@ -143,61 +165,181 @@ std::optional<std::string> RocksDBCache::getTileLayerBlob(MapTileKey const& k)
 
 void RocksDBCache::putTileLayerBlob(MapTileKey const& k, std::string const& v)
 {
-    // If the tile exists already, delete the previous timestamp entry.
-    std::string previousTileTimestamp;
-    if (db_->Get(
-               read_options_,
-               column_family_handles_[COL_TIMESTAMP_REVERSE],
-               k.toString(),
-               &previousTileTimestamp)
-            .ok())
-    {
-        rocksdb::WriteBatch batch;
-        batch.Delete(column_family_handles_[COL_TIMESTAMP], previousTileTimestamp);
-        batch.Delete(column_family_handles_[COL_TIMESTAMP_REVERSE], k.toString());
-        rocksdb::Status status = db_->Write(write_options_, &batch);
-    }
+    rocksdb::WriteBatch batch;
+    auto timestamp = std::chrono::system_clock::now().time_since_epoch().count();
+    writeTileLayerBatch(batch, batchTileLayerBlob(batch, k, v, std::to_string(timestamp)) ? 0 : 1);
+}
+
+void RocksDBCache::putTileLayerBlobs(std::vector<std::pair<MapTileKey, std::string>> const& blobs)
+{
+    if (blobs.empty())
+        return;
 
+    // Each tile needs its own timestamp entry, so they are made unique.
+    rocksdb::WriteBatch batch;
     auto timestamp = std::chrono::system_clock::now().time_since_epoch().count();
+    uint32_t numNewTiles = 0;
+    for (auto const& [k, v] : blobs) {
+        if (!batchTileLayerBlob(batch, k, v, std::to_string(timestamp++)))
+            ++numNewTiles;
+    }
+    writeTileLayerBatch(batch, numNewTiles);
+}
+
+bool RocksDBCache::batchTileLayerBlob(
+    rocksdb::WriteBatch& batch,
+    MapTileKey const& k,
+    std::string const& v,
+    std::string const& timestamp)
+{
+    auto binaryKey = k.toBinary();
 
-    rocksdb::WriteBatch newTileBatch;
-    newTileBatch.Put(column_family_handles_[COL_TIMESTAMP], std::to_string(timestamp), k.toString());
-    newTileBatch.Put(
+    // If the tile exists already, its previous timestamp entry is replaced.
+    std::string previousTileTimestamp;
+    auto isUpdate = db_->Get(
+        read_options_,
         column_family_handles_[COL_TIMESTAMP_REVERSE],
-        k.toString(),
-        std::to_string(timestamp));
-    newTileBatch.Put(column_family_handles_[COL_TILES], k.toString(), v);
+        binaryKey,
+        &previousTileTimestamp).ok();
+    if (isUpdate)
+        batch.Delete(column_family_handles_[COL_TIMESTAMP], previousTileTimestamp);
+    batch.Put(column_family_handles_[COL_TIMESTAMP], timestamp, binaryKey);
+    batch.Put(column_family_handles_[COL_TIMESTAMP_REVERSE], binaryKey, timestamp);
+    batch.Put(column_family_handles_[COL_TILES], binaryKey, v);
+    return isUpdate;
+}
 
-    auto status = db_->Write(write_options_, &newTileBatch);
+void RocksDBCache::writeTileLayerBatch(rocksdb::WriteBatch& batch, uint32_t numNewTiles)
+{
+    putTileCount(batch, key_count_ + numNewTiles);
+
+    auto status = db_->Write(write_options_, &batch);
 
     if (!status.ok()) {
         raise(fmt::format("Error writing to database: {}", status.ToString()));
     }
 
-    ++key_count_;
-    log().debug("Cache hits: {}, cache misses: {}", cacheHits_, cacheMisses_);
+    key_count_ += numNewTiles;
+    MAPGET_LOG_DEBUG("Cache hits: {}, cache misses: {}", cacheHits_.load(), cacheMisses_.load());
 
-    // Delete the oldest entry if we are exceeding the cache limit.
-    // TODO improve performance by using RocksDB's DeleteRange function
-    //  and not invoking deletion at every insert.
+    // Delete the oldest entries if we are exceeding the cache limit. A chunk
+    // of entries is deleted at once, so that this does not happen on every put.
     if (max_key_count_ && key_count_ > max_key_count_) {
-        // Iterator of the timestamp column is in tile insertion order.
-        std::unique_ptr<rocksdb::Iterator>
-            it(db_->NewIterator(read_options_, column_family_handles_[COL_TIMESTAMP]));
-        it->SeekToFirst();
-
-        rocksdb::WriteBatch purgeBatch;
-        purgeBatch.Delete(column_family_handles_[COL_TIMESTAMP], it->key());
-        purgeBatch.Delete(column_family_handles_[COL_TIMESTAMP_REVERSE], it->value());
-        purgeBatch.Delete(column_family_handles_[COL_TILES], it->value());
-        rocksdb::Status purgeStatus = db_->Write(write_options_, &purgeBatch);
-
-        if (!purgeStatus.ok()) {
-            raise(
-                fmt::format("Could not delete oldest cache entry: {}", purgeStatus.ToString()));
+        evictOldestTiles(key_count_ - max_key_count_ + max_key_count_ / EvictionChunkDivisor);
+    }
+}
+
+void RocksDBCache::eraseTileLayerBlob(MapTileKey const& k)
+{
+    auto binaryKey = k.toBinary();
+    std::string tileTimestamp;
+    if (!db_->Get(read_options_, column_family_handles_[COL_TIMESTAMP_REVERSE], binaryKey, &tileTimestamp).ok())
+        return;
+
+    rocksdb::WriteBatch batch;
+    batch.Delete(column_family_handles_[COL_TIMESTAMP], tileTimestamp);
+    batch.Delete(column_family_handles_[COL_TIMESTAMP_REVERSE], binaryKey);
+    batch.Delete(column_family_handles_[COL_TILES], binaryKey);
+    putTileCount(batch, key_count_ - 1);
+
+    auto status = db_->Write(write_options_, &batch);
+    if (!status.ok()) {
+        raise(fmt::format("Error deleting from database: {}", status.ToString()));
+    }
+    --key_count_;
+}
+
+void RocksDBCache::upgradeLegacyCache()
+{
+    // Caches which were written by older versions use textual tile keys,
+    // which never contain a zero byte. Convert them to binary keys,
+    // and count the tiles.
+    rocksdb::WriteBatch batch;
+    std::unique_ptr<rocksdb::Iterator>
+        it(db_->NewIterator(read_options_, column_family_handles_[COL_TIMESTAMP]));
+    auto numConvertedKeys = 0;
+    key_count_ = 0;
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+        ++key_count_;
+        auto legacyKey = it->value().ToString();
+        if (legacyKey.find('\0') != std::string::npos)
+            continue;
+        auto binaryKey = MapTileKey(legacyKey).toBinary();
+        std::string tile;
+        if (db_->Get(read_options_, column_family_handles_[COL_TILES], legacyKey, &tile).ok()) {
+            batch.Delete(column_family_handles_[COL_TILES], legacyKey);
+            batch.Put(column_family_handles_[COL_TILES], binaryKey, tile);
+        }
+        batch.Delete(column_family_handles_[COL_TIMESTAMP_REVERSE], legacyKey);
+        batch.Put(column_family_handles_[COL_TIMESTAMP_REVERSE], binaryKey, it->key());
+        batch.Put(column_family_handles_[COL_TIMESTAMP], it->key(), binaryKey);
+        ++numConvertedKeys;
+
+        // The iterator reads from an implicit snapshot,
+        // so large batches may be written meanwhile.
+        if (batch.GetDataSize() > UpgradeBatchBytes) {
+            if (!db_->Write(write_options_, &batch).ok())
+                raise("Could not upgrade the cache, restart with '--clear-cache 1'!");
+            batch.Clear();
         }
-        --key_count_;
     }
+
+    batch.Put(column_family_handles_[COL_METADATA], META_KEY_FORMAT, KEY_FORMAT_BINARY);
+    putTileCount(batch, key_count_);
+    auto status = db_->Write(write_options_, &batch);
+    if (!status.ok()) {
+        raise("Could not upgrade the cache, restart with '--clear-cache 1'!");
+    }
+    if (numConvertedKeys > 0)
+        log().info("Converted {} RocksDB cache entries to binary tile keys.", numConvertedKeys);
+}
+
+void RocksDBCache::putTileCount(rocksdb::WriteBatch& batch, uint32_t count)
+{
+    batch.Put(column_family_handles_[COL_METADATA], META_TILE_COUNT, std::to_string(count));
+}
+
+void RocksDBCache::evictOldestTiles(uint32_t count)
+{
+    // Iterator of the timestamp column is in tile insertion order,
+    // so the evicted timestamps are deleted as one range.
+    std::unique_ptr<rocksdb::Iterator>
+        it(db_->NewIterator(read_options_, column_family_handles_[COL_TIMESTAMP]));
+    it->SeekToFirst();
+    if (!it->Valid())
+        return;
+
+    rocksdb::WriteBatch batch;
+    std::vector<MapTileKey> evictedTileKeys;
+    auto firstTimestamp = it->key().ToString();
+    std::string lastTimestamp;
+    for (; it->Valid() && evictedTileKeys.size() < count; it->Next()) {
+        batch.Delete(column_family_handles_[COL_TIMESTAMP_REVERSE], it->value());
+        batch.Delete(column_family_handles_[COL_TILES], it->value());
+        evictedTileKeys.emplace_back(MapTileKey::fromBinary(it->value().ToString()));
+        lastTimestamp = it->key().ToString();
+    }
+    if (!it->status().ok()) {
+        raise(fmt::format("Could not iterate the cache: {}", it->status().ToString()));
+    }
+
+    // The range end is exclusive. The smallest key after the last
+    // evicted timestamp is that timestamp with a zero byte appended.
+    batch.DeleteRange(
+        column_family_handles_[COL_TIMESTAMP],
+        firstTimestamp,
+        lastTimestamp + std::string(1, '\0'));
+    putTileCount(batch, key_count_ - static_cast<uint32_t>(evictedTileKeys.size()));
+
+    auto status = db_->Write(write_options_, &batch);
+    if (!status.ok()) {
+        raise(fmt::format("Could not delete oldest cache entries: {}", status.ToString()));
+    }
+
+    key_count_ -= static_cast<uint32_t>(evictedTileKeys.size());
+    MAPGET_LOG_DEBUG("Evicted {} tiles from the cache.", evictedTileKeys.size());
+    for (auto const& tileKey : evictedTileKeys)
+        evictLiveTile(tileKey);
 }
 
 std::optional<std::string> RocksDBCache::getStringPoolBlob(std::string_view const& sourceNodeId)
@@ -207,7 +349,7 @@ std::optional<std::string> RocksDBCache::getStringPoolBlob(std::string_view cons
         db_->Get(read_options_, column_family_handles_[COL_STRING_POOLS], sourceNodeId, &read_value);
 
     if (status.ok()) {
-        log().trace(fmt::format("Node: {} | String pool size: {}", sourceNodeId, read_value.size()));
+        MAPGET_LOG_TRACE(fmt::format("Node: {} | String pool size: {}", sourceNodeId, read_value.size()));
         return read_value;
     }
     else if (status.IsNotFound()) {
@@ -219,12 +361,106 @@ std::optional<std::string> RocksDBCache::getStringPoolBlob(std::string_view cons
 
 void RocksDBCache::putStringPoolBlob(std::string_view const& sourceNodeId, std::string const& v)
 {
-    auto status =
-        db_->Put(write_options_, column_family_handles_[COL_STRING_POOLS], sourceNodeId, v);
+    // The whole pool replaces the updates of the node.
+    auto prefix = stringPoolUpdatePrefix(sourceNodeId);
+    auto prefixEnd = prefix;
+    prefixEnd.back() = '\1';
+    rocksdb::WriteBatch batch;
+    batch.Put(column_family_handles_[COL_STRING_POOLS], sourceNodeId, v);
+    batch.DeleteRange(column_family_handles_[COL_STRING_POOL_UPDATES], prefix, prefixEnd);
+    auto status = db_->Write(write_options_, &batch);
+
+    if (!status.ok()) {
+        raise(fmt::format("Error writing to database: {}", status.ToString()));
+    }
+}
+
+void RocksDBCache::appendStringPoolUpdateBlob(
+    std::string_view const& sourceNodeId,
+    simfil::StringId offset,
+    std::string const& v)
+{
+    auto key = stringPoolUpdatePrefix(sourceNodeId);
+    auto bigEndianOffset = static_cast<uint32_t>(offset);
+    for (auto shift = 24; shift >= 0; shift -= 8)
+        key.push_back(static_cast<char>((bigEndianOffset >> shift) & 0xff));
+    auto status = db_->Put(write_options_, column_family_handles_[COL_STRING_POOL_UPDATES], key, v);
+
+    if (!status.ok()) {
+        raise(fmt::format("Error writing to database: {}", status.ToString()));
+    }
+}
+
+std::vector<std::string> RocksDBCache::getStringPoolUpdateBlobs(std::string_view const& sourceNodeId)
+{
+    std::vector<std::string> result;
+    auto prefix = stringPoolUpdatePrefix(sourceNodeId);
+    std::unique_ptr<rocksdb::Iterator>
+        it(db_->NewIterator(read_options_, column_family_handles_[COL_STRING_POOL_UPDATES]));
+    for (it->Seek(prefix); it->Valid() && it->key().starts_with(prefix); it->Next())
+        result.emplace_back(it->value().ToString());
+    if (!it->status().ok()) {
+        raise(fmt::format("Error reading from database: {}", it->status().ToString()));
+    }
+    MAPGET_LOG_TRACE("Node: {} | String pool updates: {}", sourceNodeId, result.size());
+    return result;
+}
+
+std::optional<std::string> RocksDBCache::getCompressionDictionaryBlob(std::string const& key)
+{
+    std::string result;
+    auto status = db_->Get(read_options_, column_family_handles_[COL_COMPRESSION_DICTIONARIES], key, &result);
+    if (status.ok())
+        return result;
+    else if (status.IsNotFound())
+        return {};
+    raise(fmt::format("Error reading from database: {}", status.ToString()));
+}
+
+void RocksDBCache::putCompressionDictionaryBlob(std::string const& key, std::string const& v)
+{
+    auto status = db_->Put(write_options_, column_family_handles_[COL_COMPRESSION_DICTIONARIES], key, v);
+
+    if (!status.ok()) {
+        raise(fmt::format("Error writing to database: {}", status.ToString()));
+    }
+}
+
+std::optional<std::string> RocksDBCache::getLocateIndexBlob(std::string const& key)
+{
+    std::string result;
+    auto status = db_->Get(read_options_, column_family_handles_[COL_LOCATE_INDEX], key, &result);
+    if (status.ok())
+        return result;
+    else if (status.IsNotFound())
+        return {};
+    raise(fmt::format("Error reading from database: {}", status.ToString()));
+}
+
+void RocksDBCache::putLocateIndexBlobs(std::vector<std::pair<std::string, std::string>> const& blobs)
+{
+    rocksdb::WriteBatch batch;
+    for (auto const& [key, value] : blobs)
+        batch.Put(column_family_handles_[COL_LOCATE_INDEX], key, value);
+    auto status = db_->Write(write_options_, &batch);
 
     if (!status.ok()) {
         raise(fmt::format("Error writing to database: {}", status.ToString()));
     }
 }
 
+std::string RocksDBCache::stringPoolUpdatePrefix(std::string_view const& sourceNodeId)
+{
+    std::string result(sourceNodeId);
+    result.push_back('\0');
+    return result;
+}
+
+nlohmann::json RocksDBCache::getStatistics() const
+{
+    auto result = Cache::getStatistics();
+    result["rocksdb-tiles"] = (int64_t)key_count_;
+    return result;
+}
+
 }  // namespace mapget
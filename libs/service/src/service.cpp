@@ -1,9 +1,14 @@
 #include "service.h"
+#include "allocations.h"
 
 #include "fmt/format.h"
 #include "locate.h"
 #include "config.h"
+#include "memory.h"
+#include "executor.h"
+#include "metrics.h"
 #include "mapget/log.h"
+#include "mapget/model/columnpages.h"
 #include "mapget/model/sourcedatalayer.h"
 #include "mapget/model/featurelayer.h"
 #include "mapget/model/info.h"
@@ -11,11 +16,16 @@
 
 #include <memory>
 #include <optional>
-#include <set>
 #include <atomic>
 #include <condition_variable>
 #include <thread>
+#include <algorithm>
+#include <deque>
 #include <list>
+#include <future>
+#include <map>
+#include <set>
+#include <unordered_map>
 
 namespace mapget
 {
@@ -35,6 +45,12 @@ LayerTilesRequest::LayerTilesRequest(
     }
 }
 
+LayerTilesRequest::~LayerTilesRequest()
+{
+    while (auto result = popResult())
+        delete result;
+}
+
 void LayerTilesRequest::notifyResult(TileLayer::Ptr r) {
     const auto type = r->layerInfo()->type_;
     switch (type) {
@@ -46,15 +62,115 @@ void LayerTilesRequest::notifyResult(TileLayer::Ptr r) {
         if (onSourceDataLayer_)
             onSourceDataLayer_(std::move(std::static_pointer_cast<mapget::TileSourceDataLayer>(r)));
         break;
+    case mapget::LayerType::Heightmap:
+    case mapget::LayerType::OrthoImage:
+    case mapget::LayerType::GLTF:
+        if (onBinaryLayer_)
+            onBinaryLayer_(std::move(std::static_pointer_cast<mapget::TileBinaryLayer>(r)));
+        break;
     default:
         mapget::log().error(fmt::format("Unhandled layer type {}, no matching callback!", static_cast<int>(type)));
         break;
     }
+    // Only the final chunk of a tile counts as its result.
+    if (type == LayerType::Features) {
+        auto const& featureLayer = static_cast<TileFeatureLayer const&>(*r);
+        if (featureLayer.chunkIndex() && !featureLayer.isFinalChunk())
+            return;
+    }
+    countResult();
+}
 
+void LayerTilesRequest::notifyResultMessage(
+    Cache::SharedBlob const& message,
+    std::shared_ptr<StringPool> const& strings)
+{
+    if (onTileLayerMessage_)
+        onTileLayerMessage_(message, strings);
+    countResult();
+}
+
+void LayerTilesRequest::countResult()
+{
     ++resultCount_;
     if (resultCount_ == tiles_.size()) {
-        setStatus(RequestStatus::Success);
+        setStatus(expiredCount_ > 0 ? RequestStatus::Expired : RequestStatus::Success);
+    }
+}
+
+void LayerTilesRequest::countExpired()
+{
+    ++expiredCount_;
+    countResult();
+}
+
+bool LayerTilesRequest::queueResult(std::unique_ptr<QueuedResult> result)
+{
+    auto* node = result.release();
+    node->next_.store(nullptr, std::memory_order_relaxed);
+    auto* previous = resultQueueHead_.exchange(node, std::memory_order_acq_rel);
+    previous->next_.store(node, std::memory_order_release);
+    return queuedResults_.fetch_add(1, std::memory_order_acq_rel) == 0;
+}
+
+LayerTilesRequest::QueuedResult* LayerTilesRequest::popResult()
+{
+    auto* tail = resultQueueTail_;
+    auto* next = tail->next_.load(std::memory_order_acquire);
+    if (tail == &resultQueueStub_) {
+        if (!next)
+            return nullptr;
+        resultQueueTail_ = tail = next;
+        next = next->next_.load(std::memory_order_acquire);
+    }
+    if (next) {
+        resultQueueTail_ = next;
+        return tail;
+    }
+    if (tail != resultQueueHead_.load(std::memory_order_acquire))
+        return nullptr;
+
+    // The tail is the last result, so the stub is linked in behind it.
+    resultQueueStub_.next_.store(nullptr, std::memory_order_relaxed);
+    auto* previous = resultQueueHead_.exchange(&resultQueueStub_, std::memory_order_acq_rel);
+    previous->next_.store(&resultQueueStub_, std::memory_order_release);
+    next = tail->next_.load(std::memory_order_acquire);
+    if (next) {
+        resultQueueTail_ = next;
+        return tail;
     }
+    return nullptr;
+}
+
+void LayerTilesRequest::drainResults()
+{
+    do {
+        QueuedResult* next = nullptr;
+        while (!(next = popResult())) {
+            // A producer has counted its result, but not linked it in yet.
+            std::this_thread::yield();
+        }
+        std::unique_ptr<QueuedResult> result(next);
+        std::unique_lock lock(resultMutex_);
+        if (isDone())
+            continue;
+        if (result->expired_)
+            countExpired();
+        else if (result->layer_)
+            notifyResult(std::move(result->layer_));
+        else
+            notifyResultMessage(result->message_, result->strings_);
+    } while (queuedResults_.fetch_sub(1, std::memory_order_acq_rel) > 1);
+}
+
+std::optional<std::chrono::steady_clock::time_point> LayerTilesRequest::deadline(TileId tile) const
+{
+    auto tileIt = tileDeadlines_.find(tile.value_);
+    if (tileIt == tileDeadlines_.end())
+        return deadline_;
+    if (!deadline_)
+        return tileIt->second;
+    return std::min(*deadline_, tileIt->second);
 }
 
 void LayerTilesRequest::setStatus(RequestStatus s)
@@ -68,7 +184,7 @@ void LayerTilesRequest::setStatus(RequestStatus s)
 
 void LayerTilesRequest::notifyStatus()
 {
-    if (isDone() && onDone_) {
+    if (isDone() && onDone_ && !doneNotified_.exchange(true)) {
         // Run the final callback function.
         onDone_(this->status_);
     }
@@ -90,11 +206,29 @@ nlohmann::json LayerTilesRequest::toJson()
     auto tileIds = nlohmann::json::array();
     for (auto const& tid : tiles_)
         tileIds.emplace_back(tid.value_);
-    return nlohmann::json::object({
+    auto result = nlohmann::json::object({
         {"mapId", mapId_},
         {"layerId", layerId_},
         {"tileIds", tileIds}
     });
+
+    // Deadlines are sent as the milliseconds which are left until them.
+    auto const now = std::chrono::steady_clock::now();
+    auto remainingMs = [&now](auto const& deadline) {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now);
+        return std::max(remaining, std::chrono::milliseconds::zero()).count();
+    };
+    if (deadline_)
+        result["deadlineMs"] = remainingMs(*deadline_);
+    if (!tileDeadlines_.empty()) {
+        auto tileDeadlines = nlohmann::json::array();
+        for (auto const& [tileId, deadline] : tileDeadlines_)
+            tileDeadlines.push_back({{"tileId", tileId}, {"deadlineMs", remainingMs(deadline)}});
+        result["tileDeadlinesMs"] = tileDeadlines;
+    }
+    if (acceptsChunks_)
+        result["chunks"] = true;
+    return result;
 }
 
 RequestStatus LayerTilesRequest::getStatus()
@@ -107,15 +241,355 @@ bool LayerTilesRequest::isDone()
     return status_ != RequestStatus::Open;
 }
 
+namespace
+{
+
+/**
+ * Tile order for requests with a focus point: Tiles with lower zoom levels
+ * come first, then tiles whose center is closer to the focus point.
+ */
+struct FocusOrder
+{
+    Point focus_;
+
+    bool operator()(TileId const& a, TileId const& b) const
+    {
+        if (a.z() != b.z())
+            return a.z() < b.z();
+        return a.center().distanceTo(focus_) < b.center().distanceTo(focus_);
+    }
+};
+
+/**
+ * Bounded LRU cache with string keys, e.g. for the locate results of data
+ * sources. Locate keys must identify the data source and its map version,
+ * see locateCacheScope(). With a TTL, entries which were put longer ago
+ * are misses.
+ */
+template<typename Value>
+class LruCache
+{
+public:
+    explicit LruCache(size_t capacity, std::optional<std::chrono::steady_clock::duration> ttl = {})
+        : capacity_(capacity), ttl_(ttl)
+    {
+    }
+
+    std::optional<Value> get(std::string const& key)
+    {
+        std::unique_lock lock(mutex_);
+        auto it = index_.find(key);
+        if (it == index_.end()) {
+            ++misses_;
+            return {};
+        }
+        if (ttl_ && std::chrono::steady_clock::now() - it->second->putTime_ >= *ttl_) {
+            entries_.erase(it->second);
+            index_.erase(it);
+            ++misses_;
+            ++expired_;
+            return {};
+        }
+        ++hits_;
+        entries_.splice(entries_.begin(), entries_, it->second);
+        return it->second->value_;
+    }
+
+    void put(std::string const& key, Value value)
+    {
+        std::unique_lock lock(mutex_);
+        auto now = std::chrono::steady_clock::now();
+        auto it = index_.find(key);
+        if (it != index_.end()) {
+            it->second->value_ = std::move(value);
+            it->second->putTime_ = now;
+            entries_.splice(entries_.begin(), entries_, it->second);
+            return;
+        }
+        entries_.push_front({key, std::move(value), now});
+        index_.emplace(key, entries_.begin());
+        if (entries_.size() > capacity_) {
+            index_.erase(entries_.back().key_);
+            entries_.pop_back();
+        }
+    }
+
+    /** Remove the entries whose key starts with the given prefix. */
+    void erasePrefix(std::string const& prefix)
+    {
+        std::unique_lock lock(mutex_);
+        for (auto it = entries_.begin(); it != entries_.end();) {
+            if (it->key_.compare(0, prefix.size(), prefix) != 0) {
+                ++it;
+                continue;
+            }
+            index_.erase(it->key_);
+            it = entries_.erase(it);
+        }
+    }
+
+    [[nodiscard]] nlohmann::json getStatistics() const
+    {
+        std::unique_lock lock(mutex_);
+        return {
+            {"size", entries_.size()},
+            {"hits", hits_},
+            {"misses", misses_},
+            {"expired", expired_}};
+    }
+
+private:
+    struct Entry
+    {
+        std::string key_;
+        Value value_;
+        std::chrono::steady_clock::time_point putTime_;
+    };
+
+    size_t capacity_;
+    std::optional<std::chrono::steady_clock::duration> ttl_;
+    std::list<Entry> entries_;  // Most recently used first
+    std::unordered_map<std::string, typename std::list<Entry>::iterator> index_;
+    int64_t hits_ = 0;
+    int64_t misses_ = 0;
+    int64_t expired_ = 0;  // Misses of entries whose TTL passed
+    mutable std::mutex mutex_;
+};
+
+using LocateCache = LruCache<std::vector<LocateResponse>>;
+
+/** Simplified feature layer, with the timestamp of the layer it was simplified from. */
+struct SimplifiedTile
+{
+    std::chrono::time_point<std::chrono::system_clock> sourceTimestamp_;
+    TileFeatureLayer::Ptr layer_;
+};
+
+/**
+ * Metrics of a non-add-on data source. They are updated without locks.
+ */
+struct SourceMetrics
+{
+    Histogram fillTime_;         // Duration of data source loads, one per job
+    Histogram cacheLookupTime_;  // Duration of cache lookups, one per tile
+    Histogram queueWaitTime_;    // Time from entering the request queue to the start of a job, per tile
+    std::atomic<uint64_t> tilesFromCache_ = 0;   // Tiles which were passed to requests from the cache
+    std::atomic<uint64_t> tilesFromSource_ = 0;  // Tiles which were passed to requests from jobs
+};
+
+/**
+ * Metrics of a client class, see LayerTilesRequest::clientClass_.
+ * They are updated without locks.
+ */
+struct ClientClassMetrics
+{
+    Histogram queueWaitTime_;  // Time from entering the request queue to the start of a job, per tile
+};
+
+/** Seconds since the given time point, for metrics. */
+double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * Locate cache key prefix for a data source. It contains the node id and
+ * the versions of all layers, so that results are not reused across map versions.
+ */
+std::string locateCacheScope(DataSourceInfo const& info)
+{
+    std::vector<std::string> layerVersions;
+    for (auto const& [layerId, layerInfo] : info.layers_)
+        layerVersions.emplace_back(layerId + "@" + layerInfo->version_.toString());
+    std::sort(layerVersions.begin(), layerVersions.end());
+
+    auto scope = info.nodeId_;
+    for (auto const& layerVersion : layerVersions)
+        scope += "|" + layerVersion;
+    return scope + "|";
+}
+
+}  // namespace
+
 struct Service::Controller
 {
-    using Job = std::pair<MapTileKey, LayerTilesRequest::Ptr>;
+    using TileJob = std::pair<MapTileKey, LayerTilesRequest::Ptr>;
+    using Job = std::vector<TileJob>;  // Batch of tiles of one map layer
+    using RequestQueueKey = std::pair<std::string, std::string>;  // (mapId, layerId)
+
+    /**
+     * Requests of one client with missing tiles of a map layer. The client's
+     * virtual time advances by the cost of each tile which is scheduled for it,
+     * which is the inverse weight of its class.
+     */
+    struct ClientQueue
+    {
+        std::list<LayerTilesRequest::Ptr> requests_;
+        double virtualTime_ = 0;
+    };
+
+    /**
+     * Requests with missing tiles of a map layer, per client id. The client
+     * with the least virtual time is served next, so the clients share the jobs
+     * in proportion to their weights, regardless of their numbers of requests.
+     */
+    struct RequestQueue
+    {
+        std::map<std::string, ClientQueue> clients_;
+        double virtualTime_ = 0;  // Virtual time of the client which was served last
 
-    std::set<MapTileKey> jobsInProgress_;    // Set of jobs currently in progress
+        [[nodiscard]] bool empty() const { return clients_.empty(); }
+
+        [[nodiscard]] size_t size() const
+        {
+            size_t result = 0;
+            for (auto const& [clientId, client] : clients_)
+                result += client.requests_.size();
+            return result;
+        }
+
+        // A client which starts waiting joins at the current virtual time,
+        // so it gets no credit for the time it did not wait.
+        void push_back(LayerTilesRequest::Ptr const& request)
+        {
+            auto [clientIt, inserted] = clients_.try_emplace(request->clientId_);
+            if (inserted)
+                clientIt->second.virtualTime_ = virtualTime_;
+            clientIt->second.requests_.push_back(request);
+        }
+
+        void remove(LayerTilesRequest::Ptr const& request)
+        {
+            auto clientIt = clients_.find(request->clientId_);
+            if (clientIt == clients_.end())
+                return;
+            clientIt->second.requests_.remove(request);
+            if (clientIt->second.requests_.empty())
+                clients_.erase(clientIt);
+        }
+    };
+
+    /** Range of request tiles which must be looked up in the cache. */
+    struct CacheLookup
+    {
+        LayerTilesRequest::Ptr request_;
+        std::vector<TileId> tiles_;
+        size_t nextTileIndex_ = 0;
+        uint32_t focusVersion_ = 0;  // Request focus version which tiles_ is sorted for
+    };
+
+    /** Tile which is being worked on by a data source worker. */
+    struct JobInProgress
+    {
+        LayerTilesRequest::Ptr request_;  // Request which the job was scheduled for, null for prefetches
+        std::vector<LayerTilesRequest::Ptr> waitingRequests_;  // Further requests which wait for the result
+        CancellationToken::Ptr cancellation_ = std::make_shared<CancellationToken>();
+        std::optional<std::chrono::steady_clock::time_point> queuedSince_;  // When request_ entered its queue
+    };
+
+    // Number of tiles which a cache lookup task looks up for one request,
+    // before it re-posts itself for the remaining tiles.
+    static constexpr size_t CacheLookupBatchSize = 32;
+
+    std::map<MapTileKey, JobInProgress> jobsInProgress_;  // Jobs in progress, with requests waiting for their results
     Cache::Ptr cache_;                       // The cache for the service
-    std::list<LayerTilesRequest::Ptr> requests_;       // List of requests currently being processed
-    std::condition_variable jobsAvailable_;  // Condition variable to signal job availability
-    std::mutex jobsMutex_;  // Mutex used with the jobsAvailable_ condition variable
+    std::map<RequestQueueKey, RequestQueue> requests_;  // Requests with missing tiles, queued per map layer
+    std::vector<std::shared_ptr<Worker>> workers_;  // Job schedulers of all non-add-on data sources
+    std::map<std::string, double, std::less<>> clientClassWeights_;  // See Service::setClientClassWeight()
+    std::map<std::string, std::shared_ptr<ClientClassMetrics>, std::less<>> clientClassMetrics_;
+    std::condition_variable jobsFinished_;   // Signalled when a terminating worker has no more jobs
+    std::mutex jobsMutex_;  // Mutex for all of the above members
+
+    std::atomic<size_t> pendingCacheLookups_ = 0;  // Requests with unfinished cache lookups
+    Executor executor_;  // Runs cache lookups and data source jobs for all data sources
+
+    // Lower bound for the delivery threads, so that a few slow
+    // consumers do not hold up the results of other requests.
+    static constexpr size_t MinDeliveryThreads = 4;
+    Executor deliveryExecutor_{std::max<size_t>(std::thread::hardware_concurrency(), MinDeliveryThreads)};  // Runs the result callbacks of requests
+
+    // Bounds for the prefetch queue, and for the set of prefetched
+    // tiles which are tracked to detect prefetch hits.
+    static constexpr size_t MaxQueuedPrefetches = 256;
+    static constexpr size_t MaxTrackedPrefetches = 4096;
+
+    std::atomic_bool prefetchEnabled_ = false;  // Whether tiles around requested tiles are prefetched
+    std::deque<MapTileKey> prefetchQueue_;    // Tiles to prefetch, newest last. Guarded by jobsMutex_.
+    std::set<MapTileKey> prefetchedTiles_;    // Prefetched tiles which were not requested yet
+    std::deque<MapTileKey> prefetchedTilesOrder_;  // Insertion order of prefetchedTiles_
+    std::mutex prefetchMutex_;  // Mutex for prefetchedTiles_ and prefetchedTilesOrder_
+    std::atomic<int64_t> prefetchLoads_ = 0;   // Tiles loaded by prefetch jobs
+    std::atomic<int64_t> prefetchHits_ = 0;    // Requested tiles which were prefetched
+    std::atomic<int64_t> prefetchMisses_ = 0;  // Requested tiles which had to be loaded
+    std::atomic<int64_t> cancelledJobs_ = 0;   // Jobs which were cancelled, as all their requests were aborted
+    std::atomic<int64_t> prunedTiles_ = 0;     // Empty tiles outside of their layer's coverage, see prunedTile()
+    std::atomic<int64_t> lateTiles_ = 0;       // Requested tiles which were dropped, as their deadline passed
+    std::atomic<int64_t> memoryThrottles_ = 0; // Times a data source got no more jobs, as the memory budget was under pressure
+
+    // Non-empty locate results of all data sources. Results of remote sources
+    // may change without a new layer version, so they are only reused for a while.
+    static constexpr size_t LocateCacheSize = 4096;
+    static constexpr auto LocateCacheTtl = std::chrono::minutes(5);
+    LocateCache locateCache_{LocateCacheSize, LocateCacheTtl};
+    std::atomic<int64_t> locateIndexHits_ = 0;    // Locate results from the locate index of the cache
+    std::atomic<int64_t> locateIndexMisses_ = 0;  // Locates which were not in the index, or had a stale entry
+
+    static constexpr size_t SimplifiedTileCacheSize = 1024;
+    LruCache<SimplifiedTile> simplifiedTiles_{SimplifiedTileCacheSize};  // See simplifiedResult()
+
+    std::atomic_bool memoryAccountingEnabled_ = false;  // Whether loaded tiles record their memory usage
+    std::mutex memoryUsageMutex_;  // Mutex for the memory usage totals
+    int64_t memoryAccountedTiles_ = 0;  // Loaded tiles which recorded their memory usage
+    std::map<std::string, uint64_t> memoryUsage_;  // Bytes of the loaded tiles by column
+
+    /** Record the memory usage of a loaded tile, and add it to the totals. */
+    void recordMemoryUsage(TileLayer& layer)
+    {
+        layer.recordMemoryUsage();
+        auto usage = layer.info()["memory-usage"];
+        std::unique_lock lock(memoryUsageMutex_);
+        ++memoryAccountedTiles_;
+        for (auto const& [column, bytes] : usage.items())
+            memoryUsage_[column] += bytes.get<uint64_t>();
+    }
+
+    nlohmann::json memoryUsageStatistics()
+    {
+        std::unique_lock lock(memoryUsageMutex_);
+        return {
+            {"enabled", memoryAccountingEnabled_.load()},
+            {"tiles", memoryAccountedTiles_},
+            {"bytes", memoryUsage_}};
+    }
+
+    /** Nodes of the cluster which the service joined, see Service::setCluster(). */
+    struct Cluster
+    {
+        HashRing ring_;
+        size_t self_ = 0;  // Index of this node on the ring
+        std::vector<ClusterPeer::Ptr> peers_;  // Peer per ring node, null for this node
+    };
+
+    std::shared_ptr<Cluster const> cluster_;  // Null if the service is not in a cluster
+    mutable std::mutex clusterMutex_;  // Mutex for cluster_
+    std::atomic<int64_t> clusterForwardedTiles_ = 0;  // Tiles which were loaded from their owners
+    std::atomic<int64_t> clusterForwardFailures_ = 0;  // Tiles whose owner failed, which were loaded locally
+
+    [[nodiscard]] std::shared_ptr<Cluster const> cluster() const
+    {
+        std::unique_lock lock(clusterMutex_);
+        return cluster_;
+    }
+
+    nlohmann::json clusterStatistics() const
+    {
+        auto cluster = this->cluster();
+        return {
+            {"enabled", cluster != nullptr},
+            {"nodes", cluster ? cluster->ring_.nodes() : std::vector<std::string>{}},
+            {"forwarded-tiles", clusterForwardedTiles_.load()},
+            {"forward-failures", clusterForwardFailures_.load()}};
+    }
 
     explicit Controller(Cache::Ptr cache) : cache_(std::move(cache))
     {
@@ -123,88 +597,822 @@ struct Service::Controller
             raise("Cache must not be null!");
     }
 
-    std::optional<Job> nextJob(DataSourceInfo const& i)
+    virtual ~Controller() = default;
+
+    /** Schedule a cache lookup for the given tiles of a request. */
+    void addCacheLookup(LayerTilesRequest::Ptr const& request, std::vector<TileId> tiles)
     {
-        // Workers call the nextJob function when they are free.
-        // Note: For thread safety, jobsMutex_ must be held
-        //  when calling this function.
+        ++pendingCacheLookups_;
+        postCacheLookup({request, std::move(tiles), 0, request->focusVersion_});
+    }
 
-        std::optional<Job> result;
+    void postCacheLookup(CacheLookup lookup)
+    {
+        executor_.post([this, lookup = std::move(lookup)]() mutable { serveCachedTiles(lookup); });
+    }
 
-        // Return next job, if available.
-        bool cachedTilesServed = false;
-        do {
-            cachedTilesServed = false;
-            for (auto reqIt = requests_.begin(); reqIt != requests_.end(); ++reqIt) {
-                auto& request = *reqIt;
-                auto layerIt = i.layers_.find(request->layerId_);
+    /** Write the tiles which were queued by Cache::queueTileLayer() in the background. */
+    void postCacheWriter()
+    {
+        executor_.post([this]() { while (cache_->writeQueuedTileLayers() > 0) {} });
+    }
 
-                // Are there tiles left to be processed in the request?
-                if (request->mapId_ == i.mapId_ && layerIt != i.layers_.end()) {
-                    if (request->nextTileIndex_ >= request->tiles_.size()) {
-                        continue;
-                    }
+    /**
+     * Cache lookup task: Serve the tiles of the lookup which are present
+     * in the cache, and schedule the others for the data source workers.
+     * Does not hold jobsMutex_ during the cache lookups or while the
+     * request's result callbacks run.
+     */
+    void serveCachedTiles(CacheLookup& lookup)
+    {
+        auto& request = lookup.request_;
+        auto dataSourceInfo = dataSourceInfoForLayer(request->mapId_, request->layerId_);
+        if (!dataSourceInfo) {
+            // The data source was removed after the request was accepted.
+            MAPGET_LOG_DEBUG("No data source for cache lookup of {}::{}", request->mapId_, request->layerId_);
+            {
+                std::unique_lock lock(jobsMutex_);
+                auto queueIt = requests_.find({request->mapId_, request->layerId_});
+                if (queueIt != requests_.end()) {
+                    queueIt->second.remove(request);
+                    if (queueIt->second.empty())
+                        requests_.erase(queueIt);
+                }
+                request->missingTiles_.clear();
+            }
+            {
+                std::unique_lock resultLock(request->resultMutex_);
+                if (!request->isDone())
+                    request->setStatus(RequestStatus::NoDataSource);
+            }
+            --pendingCacheLookups_;
+            return;
+        }
+        auto layerType = dataSourceInfo->getLayer(request->layerId_)->type_;
+        auto metrics = metricsForLayer(request->mapId_, request->layerId_);
 
-                    // Create result wrapper object.
-                    auto tileId = request->tiles_[request->nextTileIndex_++];
-                    result = {MapTileKey(), request};
-                    result->first.layer_ = layerIt->second->type_;
-                    result->first.mapId_ = request->mapId_;
-                    result->first.layerId_ = request->layerId_;
-                    result->first.tileId_ = tileId;
-
-                    // Cache lookup.
-                    auto cachedResult = cache_->getTileLayer(result->first, i);
-                    if (cachedResult) {
-                        // TODO: Consider TTL.
-                        log().debug("Serving cached tile: {}", result->first.toString());
-                        request->notifyResult(cachedResult);
-                        result.reset();
-                        cachedTilesServed = true;
-                        continue;
-                    }
+        // Re-sort the remaining tiles if the request's focus has moved.
+        if (auto focusVersion = request->focusVersion_.load(); focusVersion != lookup.focusVersion_) {
+            std::optional<Point> focus;
+            {
+                std::unique_lock lock(jobsMutex_);
+                focus = request->focus_;
+            }
+            lookup.focusVersion_ = focusVersion;
+            if (focus) {
+                std::stable_sort(
+                    lookup.tiles_.begin() + static_cast<std::ptrdiff_t>(lookup.nextTileIndex_),
+                    lookup.tiles_.end(),
+                    FocusOrder{*focus});
+            }
+        }
 
-                    if (jobsInProgress_.find(result->first) != jobsInProgress_.end()) {
-                        // Don't work on something that is already being worked on.
-                        // Wait for the work to finish, then send the (hopefully cached) result.
-                        log().debug("Delaying tile with job in progress: {}",
-                                    result->first.toString());
-                        --request->nextTileIndex_;
-                        result.reset();
+        std::vector<TileId> missingTiles;
+        std::optional<bool> canPrune;  // Whether the map has no add-on sources, see prunedTile()
+        auto batchEnd = std::min(lookup.nextTileIndex_ + CacheLookupBatchSize, lookup.tiles_.size());
+        for (; lookup.nextTileIndex_ < batchEnd && !request->isDone(); ++lookup.nextTileIndex_) {
+            auto tileId = lookup.tiles_[lookup.nextTileIndex_];
+            if (isPastDeadline(*request, tileId)) {
+                dropLateTile(request, tileId);
+                continue;
+            }
+            MapTileKey tileKey;
+            tileKey.layer_ = layerType;
+            tileKey.mapId_ = request->mapId_;
+            tileKey.layerId_ = request->layerId_;
+            tileKey.tileId_ = tileId;
+
+            // Requesters which forward the cached messages get them unparsed.
+            TileLayer::Ptr cachedResult;
+            std::optional<Cache::TileLayerMessage> cachedMessage;
+            auto lookupStart = std::chrono::steady_clock::now();
+            try {
+                if (request->onTileLayerMessage_ && !request->simplificationResolution_) {
+                    cachedMessage = cache_->getTileLayerMessage(tileKey);
+                    if (!cachedMessage)
+                        cachedMessage = dataSourceTileLayerMessage(tileKey);
+                }
+                else
+                    cachedResult = cache_->getTileLayer(tileKey, *dataSourceInfo);
+            }
+            catch (std::exception& e) {
+                log().error("Could not read cached tile {}: {}", tileKey.toString(), e.what());
+            }
+            if (metrics)
+                metrics->cacheLookupTime_.observe(secondsSince(lookupStart));
+
+            // Tiles which the layer cannot have are answered right away.
+            if (!cachedResult && !cachedMessage) {
+                if (!canPrune)
+                    canPrune = !hasAddOnDataSource(request->mapId_);
+                if (*canPrune) {
+                    if (auto emptyTile = prunedTile(tileKey, *dataSourceInfo)) {
+                        deliverResult(request, emptyTile);
                         continue;
                     }
+                }
+            }
 
-                    // Enter into the jobs-in-progress set.
-                    jobsInProgress_.insert(result->first);
+            // Expired tiles are not returned by the cache.
+            if (cachedResult || cachedMessage) {
+                MAPGET_LOG_DEBUG("Serving cached tile: {}", tileKey.toString());
+                if (prefetchEnabled_)
+                    countPrefetchHit(tileKey);
+                if (metrics)
+                    ++metrics->tilesFromCache_;
+                if (cachedMessage)
+                    deliverResultMessage(request, cachedMessage->message_, cachedMessage->strings_);
+                else
+                    deliverResult(request, cachedResult);
+                continue;
+            }
+            missingTiles.emplace_back(tileId);
+        }
 
-                    // Move this request to the end of the list, so others gain priority.
-                    requests_.splice(requests_.end(), requests_, reqIt);
+        if (!missingTiles.empty())
+            addMissingTiles(request, missingTiles);
 
-                    log().debug("Working on tile: {}", result->first.toString());
-                    break;
+        // Continue with the rest of this request's tiles later,
+        // so that other lookups are not stalled by large requests.
+        if (lookup.nextTileIndex_ < lookup.tiles_.size() && !request->isDone())
+            postCacheLookup(std::move(lookup));
+        else
+            --pendingCacheLookups_;
+    }
+
+    /**
+     * Get an empty layer for a tile which its layer cannot have, as it is
+     * outside of the layer's coverage, or its zoom level is not one of the
+     * layer's zoomLevels_. The layer is cached like a loaded one, so it
+     * is served from the cache from then on. Returns null if the layer may
+     * have the tile. Must not be used for maps with add-on sources, which
+     * may add data to any tile.
+     */
+    TileLayer::Ptr prunedTile(MapTileKey const& tileKey, DataSourceInfo const& info)
+    {
+        auto layerInfo = info.getLayer(tileKey.layerId_, false);
+        if (!layerInfo)
+            return nullptr;
+        auto const& zoomLevels = layerInfo->zoomLevels_;
+        auto supportsZoomLevel = zoomLevels.empty() ||
+            std::find(zoomLevels.begin(), zoomLevels.end(), tileKey.tileId_.z()) != zoomLevels.end();
+        if (supportsZoomLevel && layerInfo->covers(tileKey.tileId_))
+            return nullptr;
+
+        TileLayer::Ptr result;
+        auto strings = cache_->getStringPool(info.nodeId_);
+        if (layerInfo->type_ == LayerType::Features)
+            result = std::make_shared<TileFeatureLayer>(tileKey.tileId_, info.nodeId_, info.mapId_, layerInfo, strings);
+        else if (layerInfo->type_ == LayerType::SourceData)
+            result = std::make_shared<TileSourceDataLayer>(tileKey.tileId_, info.nodeId_, info.mapId_, layerInfo, strings);
+        else
+            result = std::make_shared<TileBinaryLayer>(tileKey.tileId_, info.nodeId_, info.mapId_, layerInfo);
+        result->setInfo("pruned", true);
+
+        MAPGET_LOG_DEBUG("Pruned tile outside of the layer coverage: {}", tileKey.toString());
+        ++prunedTiles_;
+        try {
+            if (cache_->queueTileLayer(result))
+                postCacheWriter();
+        }
+        catch (std::exception& e) {
+            log().error("Could not cache pruned tile {}: {}", tileKey.toString(), e.what());
+        }
+        return result;
+    }
+
+    /** Check whether the deadline of a requested tile has passed. */
+    static bool isPastDeadline(LayerTilesRequest const& request, TileId tileId)
+    {
+        if (!request.deadline_ && request.tileDeadlines_.empty())
+            return false;
+        auto deadline = request.deadline(tileId);
+        return deadline && std::chrono::steady_clock::now() >= *deadline;
+    }
+
+    /**
+     * Drop a requested tile, as its deadline has passed. It counts as a result
+     * of the request, which is then done with RequestStatus::Expired. Note:
+     * jobsMutex_ must not be held when calling this function.
+     */
+    void dropLateTile(LayerTilesRequest::Ptr const& request, TileId tileId)
+    {
+        if (request->isDone())
+            return;
+        MAPGET_LOG_DEBUG(
+            "Dropping tile {} of {}::{}, as its deadline passed.", tileId.value_, request->mapId_, request->layerId_);
+        ++lateTiles_;
+        auto result = std::make_unique<LayerTilesRequest::QueuedResult>();
+        result->expired_ = true;
+        queueResult(request, std::move(result));
+    }
+
+    /**
+     * Drop the queued tiles whose deadline has passed, so that their
+     * requests are done without waiting for a free worker.
+     */
+    void dropLateQueuedTiles()
+    {
+        std::vector<std::pair<LayerTilesRequest::Ptr, TileId>> lateTiles;
+        {
+            std::unique_lock lock(jobsMutex_);
+            for (auto queueIt = requests_.begin(); queueIt != requests_.end();) {
+                auto& queue = queueIt->second;
+                for (auto clientIt = queue.clients_.begin(); clientIt != queue.clients_.end();) {
+                    auto& clientRequests = clientIt->second.requests_;
+                    for (auto reqIt = clientRequests.begin(); reqIt != clientRequests.end();) {
+                        auto& request = *reqIt;
+                        if (!request->deadline_ && request->tileDeadlines_.empty()) {
+                            ++reqIt;
+                            continue;
+                        }
+                        std::erase_if(request->missingTiles_, [&](TileId tileId) {
+                            if (!isPastDeadline(*request, tileId))
+                                return false;
+                            lateTiles.emplace_back(request, tileId);
+                            return true;
+                        });
+                        reqIt = request->missingTiles_.empty() ? clientRequests.erase(reqIt) : std::next(reqIt);
+                    }
+                    clientIt = clientRequests.empty() ? queue.clients_.erase(clientIt) : std::next(clientIt);
                 }
+                queueIt = queue.empty() ? requests_.erase(queueIt) : std::next(queueIt);
+            }
+        }
+        for (auto const& [request, tileId] : lateTiles)
+            dropLateTile(request, tileId);
+    }
+
+    /**
+     * Enqueue tiles which were not found in the cache for the data
+     * source workers. A request is present in its map layer request
+     * queue exactly as long as it has missing tiles. Tiles whose
+     * deadline has passed are dropped instead.
+     */
+    void addMissingTiles(LayerTilesRequest::Ptr const& request, std::vector<TileId> const& tiles)
+    {
+        std::vector<TileId> liveTiles;
+        for (auto const& tileId : tiles) {
+            if (isPastDeadline(*request, tileId))
+                dropLateTile(request, tileId);
+            else
+                liveTiles.emplace_back(tileId);
+        }
+        if (liveTiles.empty())
+            return;
+
+        {
+            std::unique_lock lock(jobsMutex_);
+            if (request->isDone())
+                return;
+
+            // Real requests take precedence over queued prefetches for the map.
+            if (prefetchEnabled_) {
+                std::erase_if(prefetchQueue_, [&request](auto const& tileKey) {
+                    return tileKey.mapId_ == request->mapId_;
+                });
+            }
+
+            auto& missingTiles = request->missingTiles_;
+            if (missingTiles.empty()) {
+                requests_[{request->mapId_, request->layerId_}].push_back(request);
+                request->queuedSince_ = std::chrono::steady_clock::now();
             }
+            auto numPresentTiles = static_cast<std::ptrdiff_t>(missingTiles.size());
+            missingTiles.insert(missingTiles.end(), liveTiles.begin(), liveTiles.end());
+
+            // Keep the missing tiles in focus order. Cache lookups run
+            // in focus order, so usually the new tiles are just appended.
+            if (request->focus_) {
+                FocusOrder order{*request->focus_};
+                auto newTilesBegin = missingTiles.begin() + numPresentTiles;
+                std::stable_sort(newTilesBegin, missingTiles.end(), order);
+                if (numPresentTiles > 0 && order(*newTilesBegin, *(newTilesBegin - 1)))
+                    std::inplace_merge(missingTiles.begin(), newTilesBegin, missingTiles.end(), order);
+            }
+
+            scheduleJobs(request->mapId_);
         }
-        while (cachedTilesServed && !result);
+    }
 
-        // Clean up done requests.
-        requests_.remove_if([](auto&& r) {return r->nextTileIndex_ == r->tiles_.size(); });
+    /**
+     * Queue a result for a request, and schedule the delivery of its queued
+     * results on the delivery executor if none is running. So the cache
+     * workers and data source workers which produce results never wait for
+     * the callbacks of a request, or for each other.
+     */
+    void queueResult(LayerTilesRequest::Ptr const& request, std::unique_ptr<LayerTilesRequest::QueuedResult> result)
+    {
+        if (request->queueResult(std::move(result)))
+            deliveryExecutor_.post([request]() { request->drainResults(); });
+    }
 
+    /**
+     * Pass a result tile to a request. Results may be delivered concurrently
+     * by cache workers and data source workers. Note: jobsMutex_ must
+     * not be held when calling this function.
+     */
+    void deliverResult(LayerTilesRequest::Ptr const& request, TileLayer::Ptr const& result)
+    {
+        if (request->isDone())
+            return;
+        if (request->acceptsChunks_ && result->layerInfo()->type_ == LayerType::Features) {
+            // A tile whose final chunk was delivered is complete. If the
+            // chunks of a tile stopped early, the whole tile follows them.
+            std::unique_lock lock(jobsMutex_);
+            auto tileIt = request->chunkedTiles_.find(result->tileId().value_);
+            if (tileIt != request->chunkedTiles_.end()) {
+                auto isComplete = tileIt->second;
+                request->chunkedTiles_.erase(tileIt);
+                if (isComplete)
+                    return;
+            }
+        }
+        auto queued = std::make_unique<LayerTilesRequest::QueuedResult>();
+        queued->layer_ = simplifiedResult(*request, result);
+        queueResult(request, std::move(queued));
+    }
+
+    /**
+     * Get the simplified version of a feature layer for a request which asks
+     * for it, see LayerTilesRequest::setSimplification(). Simplified layers are
+     * kept under the key of their source tile and the resolution, until
+     * their source tile is replaced by one with another timestamp.
+     */
+    TileLayer::Ptr simplifiedResult(LayerTilesRequest const& request, TileLayer::Ptr const& result)
+    {
+        if (!request.simplificationResolution_ || result->layerInfo()->type_ != LayerType::Features)
+            return result;
+
+        auto key = fmt::format("{}|{}", MapTileKey(*result).toString(), request.simplificationResolution_);
+        if (auto cached = simplifiedTiles_.get(key); cached && cached->sourceTimestamp_ == result->timestamp())
+            return cached->layer_;
+
+        try {
+            auto tolerance = result->tileId().size().x / static_cast<double>(request.simplificationResolution_);
+            auto simplified = std::static_pointer_cast<TileFeatureLayer>(result)->simplified(tolerance);
+            simplified->setReadOnly();
+            simplifiedTiles_.put(key, {result->timestamp(), simplified});
+            return simplified;
+        }
+        catch (std::exception& e) {
+            log().error("Could not simplify tile {}: {}", MapTileKey(*result).toString(), e.what());
+        }
         return result;
     }
 
-    virtual void loadAddOnTiles(TileFeatureLayer::Ptr const& baseTile, DataSource& baseDataSource) = 0;
+    /**
+     * Let the job of a feature tile send chunks, if the request accepts them,
+     * see LayerTilesRequest::setChunks(). Note: jobsMutex_ must be held
+     * when calling this function.
+     */
+    void acceptChunks(MapTileKey const& tileKey, JobInProgress& job, LayerTilesRequest const& request)
+    {
+        if (!request.acceptsChunks_ || request.simplificationResolution_ || tileKey.layer_ != LayerType::Features)
+            return;
+        if (job.cancellation_->chunkSink())
+            return;
+        job.cancellation_->setChunkSink([this, tileKey](TileLayer::Ptr const& chunk) { deliverChunk(tileKey, chunk); });
+    }
+
+    /**
+     * Pass a chunk of a tile which is being filled to the requests which
+     * wait for the tile and accept chunks. The later chunks only go to the
+     * requests which got the first one, so that they get all chunks. Tiles
+     * of maps with add-on sources are not chunked, as the add-on data is
+     * only merged into the whole tile.
+     */
+    void deliverChunk(MapTileKey const& tileKey, TileLayer::Ptr const& chunk)
+    {
+        if (hasAddOnDataSource(tileKey.mapId_))
+            return;
+        auto const& featureChunk = static_cast<TileFeatureLayer const&>(*chunk);
+        auto isFirst = featureChunk.chunkIndex() == 0u;
+        auto isFinal = featureChunk.isFinalChunk();
+        std::vector<LayerTilesRequest::Ptr> recipients;
+        {
+            std::unique_lock lock(jobsMutex_);
+            auto jobIt = jobsInProgress_.find(tileKey);
+            if (jobIt == jobsInProgress_.end())
+                return;
+            auto addRecipient = [&](LayerTilesRequest::Ptr const& request)
+            {
+                if (!request || !request->acceptsChunks_ || request->simplificationResolution_ || request->isDone())
+                    return;
+                auto& chunkedTiles = request->chunkedTiles_;
+                auto tileIt = chunkedTiles.find(tileKey.tileId_.value_);
+                if (isFirst)
+                    tileIt = chunkedTiles.insert_or_assign(tileKey.tileId_.value_, false).first;
+                else if (tileIt == chunkedTiles.end())
+                    return;
+                tileIt->second = isFinal;
+                recipients.emplace_back(request);
+            };
+            addRecipient(jobIt->second.request_);
+            for (auto const& request : jobIt->second.waitingRequests_)
+                addRecipient(request);
+        }
+        for (auto const& request : recipients) {
+            auto queued = std::make_unique<LayerTilesRequest::QueuedResult>();
+            queued->layer_ = chunk;
+            queueResult(request, std::move(queued));
+        }
+    }
+
+    /** Pass a serialized result tile from the cache to a request, see deliverResult. */
+    void deliverResultMessage(
+        LayerTilesRequest::Ptr const& request,
+        Cache::SharedBlob const& message,
+        std::shared_ptr<StringPool> const& strings)
+    {
+        if (request->isDone())
+            return;
+        auto queued = std::make_unique<LayerTilesRequest::QueuedResult>();
+        queued->message_ = message;
+        queued->strings_ = strings;
+        queueResult(request, std::move(queued));
+    }
+
+    /**
+     * Mark the job for the given tile as finished. The result is handed to
+     * all requests which were waiting for this job. If there is no result,
+     * the waiting requests get the tile scheduled again.
+     * @return The number of requests which were waiting for the job.
+     */
+    size_t finishJob(MapTileKey const& tileKey, TileLayer::Ptr const& result)
+    {
+        std::vector<LayerTilesRequest::Ptr> waitingRequests;
+        {
+            std::unique_lock lock(jobsMutex_);
+            auto jobIt = jobsInProgress_.find(tileKey);
+            if (jobIt != jobsInProgress_.end()) {
+                waitingRequests = std::move(jobIt->second.waitingRequests_);
+                // The token stays with the loaded tile, which must not reach this service anymore.
+                jobIt->second.cancellation_->setChunkSink({});
+                jobsInProgress_.erase(jobIt);
+            }
+        }
+        for (auto const& request : waitingRequests) {
+            if (result)
+                deliverResult(request, result);
+            else
+                addMissingTiles(request, {tileKey.tileId_});
+        }
+        return waitingRequests.size();
+    }
+
+    /**
+     * Get the cancellation token of a running job. Null if the job is unknown.
+     */
+    CancellationToken::Ptr jobCancellation(MapTileKey const& tileKey)
+    {
+        std::unique_lock lock(jobsMutex_);
+        auto jobIt = jobsInProgress_.find(tileKey);
+        if (jobIt == jobsInProgress_.end())
+            return {};
+        return jobIt->second.cancellation_;
+    }
+
+    /**
+     * Get the milliseconds since the request of a running job entered its
+     * queue. Nullopt if the job is unknown, or if it is a prefetch.
+     */
+    std::optional<double> jobQueueWaitMs(MapTileKey const& tileKey)
+    {
+        std::unique_lock lock(jobsMutex_);
+        auto jobIt = jobsInProgress_.find(tileKey);
+        if (jobIt == jobsInProgress_.end() || !jobIt->second.queuedSince_)
+            return {};
+        return secondsSince(*jobIt->second.queuedSince_) * 1e3;
+    }
+
+    /**
+     * Cancel the running jobs for the map layer of an aborted request,
+     * for which no other request waits. Prefetch jobs are not cancelled.
+     * Note: jobsMutex_ must be held when calling this function.
+     */
+    void cancelAbandonedJobs(LayerTilesRequest::Ptr const& abortedRequest)
+    {
+        auto isAbandoned = [&abortedRequest](LayerTilesRequest::Ptr const& request)
+        { return request == abortedRequest || request->isDone(); };
+
+        for (auto& [tileKey, job] : jobsInProgress_) {
+            if (!job.request_ || job.cancellation_->isCancelled())
+                continue;
+            if (tileKey.mapId_ != abortedRequest->mapId_ || tileKey.layerId_ != abortedRequest->layerId_)
+                continue;
+            if (!isAbandoned(job.request_) ||
+                !std::all_of(job.waitingRequests_.begin(), job.waitingRequests_.end(), isAbandoned))
+                continue;
+            MAPGET_LOG_DEBUG("Cancelling job for tile: {}", tileKey.toString());
+            job.cancellation_->cancel();
+            ++cancelledJobs_;
+        }
+    }
+
+    /**
+     * Enqueue the neighbors, the parent and the children of a requested
+     * tile for prefetching. Only zoom levels which are supported by the
+     * tile's layer are considered. If the queue is full, the oldest
+     * queued prefetches are dropped.
+     */
+    void addPrefetchCandidates(MapTileKey const& tileKey, LayerInfo const& layerInfo)
+    {
+        // TileId::x() has 16 bits, which allows 2^16 columns on the highest level.
+        constexpr uint16_t MaxZoomLevel = 15;
+
+        auto const tileId = tileKey.tileId_;
+        std::vector<TileId> candidates;
+        for (auto offsetY = -1; offsetY <= 1; ++offsetY) {
+            for (auto offsetX = -1; offsetX <= 1; ++offsetX) {
+                if (offsetX != 0 || offsetY != 0)
+                    candidates.emplace_back(tileId.neighbor(offsetX, offsetY));
+            }
+        }
+        if (tileId.z() > 0)
+            candidates.emplace_back(tileId.x() / 2, tileId.y() / 2, tileId.z() - 1);
+        if (tileId.z() < MaxZoomLevel) {
+            for (uint16_t childY = 0; childY < 2; ++childY) {
+                for (uint16_t childX = 0; childX < 2; ++childX)
+                    candidates.emplace_back(tileId.x() * 2 + childX, tileId.y() * 2 + childY, tileId.z() + 1);
+            }
+        }
+
+        // In a cluster, each node only prefetches the tiles which it owns.
+        auto cluster = this->cluster();
+
+        std::vector<MapTileKey> candidateKeys;
+        {
+            std::unique_lock lock(prefetchMutex_);
+            for (auto const& candidate : candidates) {
+                if (candidate == tileId)
+                    continue;  // Clamped neighbor at the poles.
+                auto const& zoomLevels = layerInfo.zoomLevels_;
+                if (!zoomLevels.empty() &&
+                    std::find(zoomLevels.begin(), zoomLevels.end(), candidate.z()) == zoomLevels.end())
+                    continue;
+                if (!layerInfo.covers(candidate))
+                    continue;
+                auto candidateKey = tileKey;
+                candidateKey.tileId_ = candidate;
+                if (prefetchedTiles_.count(candidateKey))
+                    continue;
+                if (cluster && cluster->ring_.owner(candidateKey) != cluster->self_)
+                    continue;
+                candidateKeys.emplace_back(std::move(candidateKey));
+            }
+        }
+
+        std::unique_lock lock(jobsMutex_);
+        for (auto& candidateKey : candidateKeys) {
+            if (jobsInProgress_.count(candidateKey) ||
+                std::find(prefetchQueue_.begin(), prefetchQueue_.end(), candidateKey) != prefetchQueue_.end())
+                continue;
+            prefetchQueue_.emplace_back(std::move(candidateKey));
+        }
+        while (prefetchQueue_.size() > MaxQueuedPrefetches)
+            prefetchQueue_.pop_front();
+        scheduleJobs(tileKey.mapId_);
+    }
+
+    /** Remember a tile which was loaded by a prefetch job. */
+    void addPrefetchedTile(MapTileKey const& tileKey)
+    {
+        std::unique_lock lock(prefetchMutex_);
+        if (!prefetchedTiles_.insert(tileKey).second)
+            return;
+        prefetchedTilesOrder_.emplace_back(tileKey);
+        while (prefetchedTilesOrder_.size() > MaxTrackedPrefetches) {
+            prefetchedTiles_.erase(prefetchedTilesOrder_.front());
+            prefetchedTilesOrder_.pop_front();
+        }
+    }
+
+    /** Count a prefetch hit, if the given requested tile was prefetched. */
+    void countPrefetchHit(MapTileKey const& tileKey)
+    {
+        std::unique_lock lock(prefetchMutex_);
+        if (prefetchedTiles_.erase(tileKey))
+            ++prefetchHits_;
+    }
+
+    /**
+     * Get the next job for a worker of a data source with the given info.
+     * The job contains up to maxBatchSize_ tiles of a single map layer.
+     * Only the request queues for the source's map layers are visited.
+     * The layer cursor is owned by the calling worker, and remembers the
+     * layer which was last served, so that the worker cycles through
+     * its layers in round-robin fashion.
+     */
+    Job nextJob(DataSourceInfo const& i, std::string& layerCursor)
+    {
+        // Workers call the nextJob function when they are free.
+        // Note: For thread safety, jobsMutex_ must be held
+        //  when calling this function.
+
+        // Request queues for this map are stored contiguously. Visit
+        // the queues after the layer which was served last, then wrap around.
+        auto const lastLayerId = layerCursor;
+        auto const maxTiles = static_cast<size_t>(std::max(i.maxBatchSize_, 1));
+        auto visitQueues = [&, this](auto queueIt, auto&& inRange) -> Job
+        {
+            while (queueIt != requests_.end() && queueIt->first.first == i.mapId_ &&
+                   inRange(queueIt->first.second)) {
+                auto layerIt = i.layers_.find(queueIt->first.second);
+                if (layerIt == i.layers_.end()) {
+                    ++queueIt;
+                    continue;
+                }
+
+                auto result = nextJobFromQueue(queueIt->second, layerIt->second->type_, maxTiles);
+                if (!result.empty())
+                    layerCursor = queueIt->first.second;
+
+                // Clean up queues without open requests.
+                if (queueIt->second.empty())
+                    queueIt = requests_.erase(queueIt);
+                else
+                    ++queueIt;
+
+                if (!result.empty())
+                    return result;
+            }
+            return {};
+        };
+
+        if (auto result = visitQueues(
+                requests_.upper_bound({i.mapId_, lastLayerId}),
+                [](auto&&) { return true; });
+            !result.empty())
+            return result;
+        return visitQueues(
+            requests_.lower_bound({i.mapId_, {}}),
+            [&](std::string const& layerId) { return layerId <= lastLayerId; });
+    }
+
+    /**
+     * Pick the next job with up to maxTiles tiles from a single map layer
+     * request queue. Tiles are taken from the client with the least virtual
+     * time, and from its front request first, which keeps batches spatially
+     * coherent. Requests are rotated to the end of their client's queue once
+     * they have provided tiles, so that the other requests of the client gain
+     * priority. Requests for tiles which are already being worked on wait for
+     * that job. Requests which have no more missing tiles are removed from
+     * the queue. Tiles whose deadline has passed are dropped by a separate
+     * executor task, as jobsMutex_ is held.
+     */
+    Job nextJobFromQueue(RequestQueue& queue, LayerType layerType, size_t maxTiles)
+    {
+        Job result;
+        while (!queue.empty() && result.size() < maxTiles) {
+            auto clientIt = std::min_element(
+                queue.clients_.begin(),
+                queue.clients_.end(),
+                [](auto const& l, auto const& r) { return l.second.virtualTime_ < r.second.virtualTime_; });
+            auto& client = clientIt->second;
+            queue.virtualTime_ = client.virtualTime_;
+            auto reqIt = client.requests_.begin();
+            auto request = *reqIt;
+            auto const tileCost = 1. / clientClassWeight(request->clientClass_);
+
+            while (!request->missingTiles_.empty() && result.size() < maxTiles) {
+                MapTileKey tileKey;
+                tileKey.layer_ = layerType;
+                tileKey.mapId_ = request->mapId_;
+                tileKey.layerId_ = request->layerId_;
+                tileKey.tileId_ = request->missingTiles_.front();
+                request->missingTiles_.pop_front();
+
+                if (isPastDeadline(*request, tileKey.tileId_)) {
+                    executor_.post([this, request, tileId = tileKey.tileId_]() { dropLateTile(request, tileId); });
+                    continue;
+                }
+                auto deadline = request->deadline(tileKey.tileId_);
+
+                auto jobIt = jobsInProgress_.find(tileKey);
+                if (jobIt != jobsInProgress_.end()) {
+                    // Don't work on something that is already being worked on.
+                    // The result of the running job is passed on to this request.
+                    // If the job was cancelled, the request gets the tile
+                    // scheduled again once the job has finished. The job
+                    // only runs into its deadline once all its requests are late.
+                    MAPGET_LOG_DEBUG("Waiting for tile with job in progress: {}", tileKey.toString());
+                    auto& job = jobIt->second;
+                    job.waitingRequests_.emplace_back(request);
+                    acceptChunks(tileKey, job, *request);
+                    auto jobDeadline = job.cancellation_->deadline();
+                    if (jobDeadline && (!deadline || *deadline > *jobDeadline))
+                        job.cancellation_->setDeadline(deadline);
+                    continue;
+                }
+
+                // Enter into the jobs-in-progress map.
+                auto& job = jobsInProgress_.emplace(tileKey, JobInProgress{request}).first->second;
+                job.queuedSince_ = request->queuedSince_;
+                job.cancellation_->setDeadline(deadline);
+                acceptChunks(tileKey, job, *request);
+                if (prefetchEnabled_)
+                    ++prefetchMisses_;
+                MAPGET_LOG_DEBUG("Working on tile: {}", tileKey.toString());
+                result.emplace_back(std::move(tileKey), request);
+                client.virtualTime_ += tileCost;
+            }
+
+            // Move this request to the end of its client's queue, so others gain
+            // priority, or drop it from the queue if all its tiles have been scheduled.
+            if (request->missingTiles_.empty())
+                client.requests_.erase(reqIt);
+            else
+                client.requests_.splice(client.requests_.end(), client.requests_, reqIt);
+            if (client.requests_.empty())
+                queue.clients_.erase(clientIt);
+        }
+        return result;
+    }
+
+    /**
+     * Get the scheduling weight of a client class, see Service::setClientClassWeight().
+     * Note: jobsMutex_ must be held when calling this function.
+     */
+    double clientClassWeight(std::string_view const& clientClass) const
+    {
+        auto it = clientClassWeights_.find(clientClass);
+        return it != clientClassWeights_.end() ? it->second : 1.;
+    }
+
+    /**
+     * Get the metrics of a client class, creating them on first use.
+     * Note: jobsMutex_ must be held when calling this function.
+     */
+    ClientClassMetrics& clientClassMetrics(std::string const& clientClass)
+    {
+        auto& metrics = clientClassMetrics_[clientClass];
+        if (!metrics)
+            metrics = std::make_shared<ClientClassMetrics>();
+        return *metrics;
+    }
+
+    /**
+     * Post jobs to the executor for all workers of the given map, as long
+     * as they are below their data source's maxParallelJobs_ limit.
+     * Note: jobsMutex_ must be held when calling these functions.
+     */
+    void scheduleJobs(std::string const& mapId);
+    void scheduleJobs(std::shared_ptr<Worker> const& worker);
+
+    /**
+     * Get a prefetch job for an otherwise idle worker. Each worker runs
+     * at most one prefetch job at a time. The most recently queued tiles
+     * are prefetched first. The job's request pointer is null.
+     * Note: jobsMutex_ must be held when calling this function.
+     */
+    Job nextPrefetchJob(Worker& worker);
+
+    /** Get the metrics of the worker which serves the given map layer, or null. */
+    std::shared_ptr<SourceMetrics> metricsForLayer(std::string const& mapId, std::string const& layerId);
+
+    /** Get the info of a data source which serves the given map layer. */
+    virtual std::optional<DataSourceInfo> dataSourceInfoForLayer(std::string const& mapId, std::string const& layerId) = 0;
+
+    /**
+     * Get a tile as a message from the data source which serves its map layer,
+     * see DataSource::getTileLayerMessage(). Returns nullopt if the map has
+     * add-on data sources, as their data must be merged into the tile.
+     */
+    virtual std::optional<Cache::TileLayerMessage> dataSourceTileLayerMessage(MapTileKey const& tileKey) = 0;
+
+    /** Check whether any add-on data source serves the given map. */
+    virtual bool hasAddOnDataSource(std::string const& mapId) = 0;
+
+    virtual void loadAddOnTiles(
+        TileFeatureLayer::Ptr const& baseTile,
+        DataSource& baseDataSource,
+        DataSourceInfo const& baseInfo) = 0;
 };
 
-struct Service::Worker
+/**
+ * Runs the jobs for one data source on the executor. At most
+ * maxParallelJobs_ jobs of a data source run at the same time.
+ */
+struct Service::Worker : public std::enable_shared_from_this<Service::Worker>
 {
     using Ptr = std::shared_ptr<Worker>;
 
     DataSource::Ptr dataSource_;   // Data source the worker is responsible for
     DataSourceInfo info_;          // Information about the data source
-    std::atomic_bool shouldTerminate_ = false; // Flag indicating whether the worker thread should terminate
+    std::atomic_bool shouldTerminate_ = false; // Flag indicating whether the worker should stop taking jobs
     Controller& controller_;       // Reference to Service::Impl which owns this worker
-    std::thread thread_;           // The worker thread
+    std::string layerCursor_;      // Layer id of the request queue which was served last
+    int activeJobs_ = 0;           // Number of posted jobs which have not finished yet
+    bool prefetching_ = false;     // Whether a prefetch job of this worker is running
+    std::shared_ptr<SourceMetrics> metrics_ = std::make_shared<SourceMetrics>();
+
+    // The tiles of the posted jobs are reserved from the MemoryBudget
+    // while they load, estimated by the blob size of the loaded tiles.
+    static constexpr size_t DefaultTileBytesEstimate = 64 * 1024;
+    size_t loadingTiles_ = 0;  // Tiles of the posted jobs, guarded by jobsMutex_
+    MemoryBudget::Reservation loadingTileMemory_{MemoryPool::LoadingTiles};  // Guarded by jobsMutex_
+    std::atomic<size_t> tileBytesEstimate_ = DefaultTileBytesEstimate;
 
     Worker(
         DataSource::Ptr dataSource,
@@ -214,126 +1422,825 @@ struct Service::Worker
           info_(std::move(info)),
           controller_(controller)
     {
-        thread_ = std::thread([this]{while (work()) {}});
     }
 
-    bool work()
+    /** Executor task: Process a single job, then schedule the next ones. */
+    void work(Controller::Job const& job)
     {
-        std::optional<Controller::Job> nextJob;
+        MemoryBudget::instance().reclaim();
 
-        {
-            std::unique_lock<std::mutex> lock(controller_.jobsMutex_);
-            controller_.jobsAvailable_.wait(
-                lock,
-                [&, this]()
+        // Prefetch jobs have no request, so they are traced on their own.
+        Span prefetchSpan;
+        if (isPrefetchJob(job)) {
+            prefetchSpan = Span("mapget.prefetch", {});
+            prefetchSpan.setAttribute("mapget.tile", job.front().first.toString());
+        }
+        TraceScope traceScope(traceContext(job, prefetchSpan));
+
+        if (shouldTerminate_) {
+            // Hand back the job, so that it may be picked up by another worker.
+            for (auto const& [mapTileKey, request] : job) {
+                controller_.finishJob(mapTileKey, nullptr);
+                if (request)
+                    controller_.addMissingTiles(request, {mapTileKey.tileId_});
+            }
+            finishWork(job);
+            return;
+        }
+
+        // Prefetch jobs skip tiles which are cached already,
+        // without deserializing them.
+        if (isPrefetchJob(job) && isCached(job.front().first)) {
+            complete(job, {nullptr});
+            return;
+        }
+
+        // Tiles which are owned by a peer are loaded by the peer.
+        if (auto cluster = controller_.cluster(); cluster && !isPrefetchJob(job)) {
+            for (auto const& [mapTileKey, request] : job) {
+                if (!request->clusterForwarded_ && cluster->ring_.owner(mapTileKey) != cluster->self_) {
+                    processInCluster(cluster, job);
+                    return;
+                }
+            }
+        }
+
+        if (job.size() == 1)
+            processAsync(job);
+        else
+            processBatchAsync(
+                job,
+                [self = shared_from_this(), job](std::vector<TileLayer::Ptr> const& results)
+                { self->complete(job, results); });
+    }
+
+    /** Pass the results of a job to its requests, then schedule the next jobs. */
+    void complete(Controller::Job const& job, std::vector<TileLayer::Ptr> const& results)
+    {
+        for (auto i = 0u; i < job.size(); ++i) {
+            auto const& [mapTileKey, request] = job[i];
+            if (!request) {
+                // Requests which waited for a prefetch job count as prefetch hits.
+                auto numWaitingRequests = controller_.finishJob(mapTileKey, results[i]);
+                if (!results[i])
+                    continue;
+                ++controller_.prefetchLoads_;
+                metrics_->tilesFromSource_ += numWaitingRequests;
+                if (numWaitingRequests > 0)
+                    controller_.prefetchHits_ += static_cast<int64_t>(numWaitingRequests);
+                else
+                    controller_.addPrefetchedTile(mapTileKey);
+                continue;
+            }
+
+            if (results[i]) {
+                ++metrics_->tilesFromSource_;
+                controller_.deliverResult(request, results[i]);
+            }
+            else if (Controller::isPastDeadline(*request, mapTileKey.tileId_))
+                controller_.dropLateTile(request, mapTileKey.tileId_);
+            auto numWaitingRequests = controller_.finishJob(mapTileKey, results[i]);
+            if (results[i])
+                metrics_->tilesFromSource_ += numWaitingRequests;
+            if (results[i] && controller_.prefetchEnabled_)
+                controller_.addPrefetchCandidates(mapTileKey, *results[i]->layerInfo());
+        }
+        finishWork(job);
+    }
+
+    void finishWork(Controller::Job const& job)
+    {
+        std::unique_lock lock(controller_.jobsMutex_);
+        --activeJobs_;
+        loadingTiles_ -= job.size();
+        loadingTileMemory_.resize(loadingTiles_ * tileBytesEstimate_);
+        if (isPrefetchJob(job))
+            prefetching_ = false;
+        if (shouldTerminate_)
+            controller_.jobsFinished_.notify_all();
+        else
+            controller_.scheduleJobs(shared_from_this());
+    }
+
+    /**
+     * Load the tile of a single-tile job using DataSource::getAsync(). The
+     * executor thread is not blocked while the data source loads the tile.
+     * Once the tile arrives, the job is completed by another executor task.
+     */
+    void processAsync(Controller::Job const& job)
+    {
+        auto const& mapTileKey = job.front().first;
+        auto cancellation = controller_.jobCancellation(mapTileKey);
+        if (cancellation && cancellation->isCancelled()) {
+            complete(job, {nullptr});
+            return;
+        }
+        if (auto cachedLayer = getCachedTile(mapTileKey)) {
+            complete(job, {cachedLayer});
+            return;
+        }
+
+        // The span is ended by the result callback, which must be copyable.
+        auto jobTrace = TraceContext::current();
+        auto fillSpan = std::make_shared<Span>(startFillSpan(job));
+        try {
+            TraceScope fillScope(fillSpan->context());
+            dataSource_->getAsync(
+                mapTileKey,
+                controller_.cache_,
+                info_,
+                [self = shared_from_this(),
+                 job,
+                 fillSpan,
+                 jobTrace,
+                 start = std::chrono::steady_clock::now()](TileLayer::Ptr layer)
+                {
+                    self->metrics_->fillTime_.observe(secondsSince(start));
+                    fillSpan->end();
+                    self->controller_.executor_.post(
+                        [self, job, jobTrace, layer = std::move(layer)]()
+                        {
+                            TraceScope traceScope(jobTrace);
+                            self->complete(job, {self->storeLoadedTile(job.front().first, layer)});
+                        });
+                },
+                cancellation);
+        }
+        catch (std::exception& e) {
+            log().error("Could not load tile {}: {}", mapTileKey.toString(), e.what());
+            fillSpan->setError(e.what());
+            fillSpan->end();
+            complete(job, {nullptr});
+        }
+    }
+
+    /**
+     * Load the tiles of a job using DataSource::getBatchAsync(). Calls onLoaded
+     * with one layer per job tile, which is null if loading the tile failed.
+     * The executor thread is not blocked while the data source loads the tiles:
+     * once they arrive, onLoaded is called by another executor task.
+     */
+    void processBatchAsync(
+        Controller::Job const& job,
+        std::function<void(std::vector<TileLayer::Ptr> const&)> onLoaded)
+    {
+        std::vector<TileLayer::Ptr> results(job.size());
+        std::vector<MapTileKey> tilesToLoad;
+        std::vector<CancellationToken::Ptr> cancellations;
+        std::vector<size_t> tilesToLoadIndices;
+
+        for (auto i = 0u; i < job.size(); ++i) {
+            auto cancellation = controller_.jobCancellation(job[i].first);
+            if (cancellation && cancellation->isCancelled())
+                continue;
+            results[i] = getCachedTile(job[i].first);
+            if (!results[i]) {
+                tilesToLoad.emplace_back(job[i].first);
+                cancellations.emplace_back(std::move(cancellation));
+                tilesToLoadIndices.emplace_back(i);
+            }
+        }
+        if (tilesToLoad.empty()) {
+            onLoaded(results);
+            return;
+        }
+
+        std::vector<std::optional<double>> queueWaits;
+        queueWaits.reserve(tilesToLoad.size());
+        for (auto const& mapTileKey : tilesToLoad)
+            queueWaits.emplace_back(controller_.jobQueueWaitMs(mapTileKey));
+
+        // The span is ended by the result callback, which must be copyable.
+        auto jobTrace = TraceContext::current();
+        auto fillSpan = std::make_shared<Span>(startFillSpan(job));
+        fillSpan->setAttribute("mapget.batch_size", static_cast<int64_t>(tilesToLoad.size()));
+        try {
+            TraceScope fillScope(fillSpan->context());
+            dataSource_->getBatchAsync(
+                tilesToLoad,
+                controller_.cache_,
+                info_,
+                [self = shared_from_this(),
+                 results,
+                 tilesToLoad,
+                 tilesToLoadIndices,
+                 queueWaits,
+                 onLoaded,
+                 fillSpan,
+                 jobTrace,
+                 start = std::chrono::steady_clock::now()](std::vector<TileLayer::Ptr> layers) mutable
                 {
-                    log().trace("Worker checking conditions.");
-                    if (shouldTerminate_) {
-                        log().trace("Terminating.");
-                        // Set by the controller at shutdown or if a data source
-                        // is removed. All worker instances are expected to terminate.
-                        return true;
+                    self->metrics_->fillTime_.observe(secondsSince(start));
+                    if (layers.size() != tilesToLoad.size()) {
+                        for (auto const& mapTileKey : tilesToLoad)
+                            log().error("Could not load tile {}: {}", mapTileKey.toString(),
+                                "DataSource::getBatchAsync() returned an unexpected number of tiles.");
+                        fillSpan->setError("Unexpected number of tiles.");
+                        layers.assign(tilesToLoad.size(), nullptr);
                     }
-                    nextJob = controller_.nextJob(info_);
-                    return nextJob.has_value();
-                });
+                    fillSpan->end();
+                    self->controller_.executor_.post(
+                        [self,
+                         results = std::move(results),
+                         tilesToLoad = std::move(tilesToLoad),
+                         tilesToLoadIndices = std::move(tilesToLoadIndices),
+                         queueWaits = std::move(queueWaits),
+                         onLoaded = std::move(onLoaded),
+                         jobTrace,
+                         layers = std::move(layers)]() mutable
+                        {
+                            TraceScope traceScope(jobTrace);
+                            for (auto i = 0u; i < tilesToLoad.size(); ++i) {
+                                if (layers[i] && queueWaits[i] && !layers[i]->isReadOnly())
+                                    layers[i]->setInfo("queue-wait-ms", *queueWaits[i]);
+                                results[tilesToLoadIndices[i]] = self->storeLoadedTile(tilesToLoad[i], layers[i]);
+                            }
+                            onLoaded(results);
+                        });
+                },
+                cancellations);
         }
+        catch (std::exception& e) {
+            for (auto const& mapTileKey : tilesToLoad)
+                log().error("Could not load tile {}: {}", mapTileKey.toString(), e.what());
+            fillSpan->setError(e.what());
+            fillSpan->end();
+            onLoaded(results);
+        }
+    }
 
-        if (shouldTerminate_)
-            return false;
+    /** State of a job whose tiles are loaded by cluster peers, see processInCluster(). */
+    struct ClusterJob
+    {
+        std::mutex mutex;
+        std::vector<TileLayer::Ptr> results;  // Layer per job tile
+        Controller::Job localJob;  // Tiles which are loaded from the data source
+        std::vector<size_t> localJobIndices;  // Job tile index per local job tile
+        size_t numPendingSteps = 0;  // Forwards which did not finish yet, plus the dispatch
+
+        void loadLocally(Controller::Job const& job, size_t i)
+        {
+            localJob.emplace_back(job[i]);
+            localJobIndices.emplace_back(i);
+        }
+    };
+
+    /**
+     * Load the tiles of a job which are owned by peers from the peers, and
+     * the remaining ones from the data source. Tiles of a peer which fails
+     * are loaded from the data source as well. The peers' tiles are complete,
+     * so they do not get add-on data, and they are only cached by their owners.
+     * The executor thread is not blocked while the peers load the tiles: once
+     * all of them answered, the job is continued by another executor task.
+     */
+    void processInCluster(std::shared_ptr<Controller::Cluster const> const& cluster, Controller::Job const& job)
+    {
+        auto clusterJob = std::make_shared<ClusterJob>();
+        clusterJob->results.resize(job.size());
+        std::map<size_t, std::vector<size_t>> tilesPerPeer;  // Peer node index -> job tile indices
+
+        for (auto i = 0u; i < job.size(); ++i) {
+            auto const& [mapTileKey, request] = job[i];
+            auto owner = cluster->ring_.owner(mapTileKey);
+            if (request->clusterForwarded_ || owner == cluster->self_)
+                clusterJob->loadLocally(job, i);
+            else
+                tilesPerPeer[owner].emplace_back(i);
+        }
+
+        // The dispatch is a step of its own, so that the job is not
+        // continued before the tiles of all peers were requested.
+        clusterJob->numPendingSteps = tilesPerPeer.size() + 1;
+        for (auto const& [owner, indices] : tilesPerPeer) {
+            std::vector<MapTileKey> tilesToForward;
+            std::vector<CancellationToken::Ptr> cancellations;
+            std::vector<size_t> tilesToForwardIndices;
+            for (auto i : indices) {
+                auto cancellation = controller_.jobCancellation(job[i].first);
+                if (cancellation && cancellation->isCancelled())
+                    continue;
+                auto cachedLayer = getCachedTile(job[i].first);
+                if (cachedLayer) {
+                    std::lock_guard lock(clusterJob->mutex);
+                    clusterJob->results[i] = std::move(cachedLayer);
+                    continue;
+                }
+                tilesToForward.emplace_back(job[i].first);
+                cancellations.emplace_back(std::move(cancellation));
+                tilesToForwardIndices.emplace_back(i);
+            }
+            if (tilesToForward.empty()) {
+                finishClusterStep(job, clusterJob);
+                continue;
+            }
+
+            // The span is ended by the result callback, which must be copyable.
+            auto jobTrace = TraceContext::current();
+            auto forwardSpan = std::make_shared<Span>("mapget.cluster.forward", TraceContext::current(), SpanKind::Client);
+            forwardSpan->setAttribute("mapget.cluster.node", cluster->ring_.nodes()[owner]);
+            forwardSpan->setAttribute("mapget.tile", tilesToForward.front().toString());
+            forwardSpan->setAttribute("mapget.batch_size", static_cast<int64_t>(tilesToForward.size()));
+            auto onForwarded = [self = shared_from_this(),
+                                job,
+                                clusterJob,
+                                cluster,
+                                owner = owner,
+                                tilesToForward,
+                                cancellations,
+                                tilesToForwardIndices,
+                                forwardSpan,
+                                jobTrace](std::vector<TileLayer::Ptr> layers)
+            {
+                if (layers.size() != tilesToForward.size()) {
+                    log().warn("Could not load tiles from cluster node {}: {}",
+                        cluster->ring_.nodes()[owner],
+                        "ClusterPeer::getAsync() returned an unexpected number of tiles.");
+                    forwardSpan->setError("Unexpected number of tiles.");
+                    layers.assign(tilesToForward.size(), nullptr);
+                }
+                forwardSpan->end();
+                self->controller_.executor_.post(
+                    [self, job, clusterJob, tilesToForward, cancellations, tilesToForwardIndices, jobTrace,
+                     layers = std::move(layers)]()
+                    {
+                        TraceScope traceScope(jobTrace);
+                        self->receiveForwardedTiles(
+                            job, *clusterJob, tilesToForward, cancellations, tilesToForwardIndices, layers);
+                        self->finishClusterStep(job, clusterJob);
+                    });
+            };
+            try {
+                TraceScope forwardScope(forwardSpan->context());
+                cluster->peers_[owner]->getAsync(tilesToForward, controller_.cache_, info_, onForwarded, cancellations);
+            }
+            catch (std::exception& e) {
+                log().warn("Could not load tiles from cluster node {}: {}", cluster->ring_.nodes()[owner], e.what());
+                forwardSpan->setError(e.what());
+                onForwarded(std::vector<TileLayer::Ptr>(tilesToForward.size()));
+            }
+        }
+        finishClusterStep(job, clusterJob);
+    }
+
+    /** Take the tiles of a peer. Tiles which the peer did not load are loaded locally. */
+    void receiveForwardedTiles(
+        Controller::Job const& job,
+        ClusterJob& clusterJob,
+        std::vector<MapTileKey> const& tilesToForward,
+        std::vector<CancellationToken::Ptr> const& cancellations,
+        std::vector<size_t> const& tilesToForwardIndices,
+        std::vector<TileLayer::Ptr> const& layers)
+    {
+        for (auto i = 0u; i < tilesToForward.size(); ++i) {
+            auto jobIndex = tilesToForwardIndices[i];
+            if (cancellations[i] && cancellations[i]->isCancelled())
+                continue;
+            if (!layers[i]) {
+                ++controller_.clusterForwardFailures_;
+                MAPGET_LOG_DEBUG("Loading tile {} locally, as its cluster node failed.", tilesToForward[i].toString());
+                std::lock_guard lock(clusterJob.mutex);
+                clusterJob.loadLocally(job, jobIndex);
+                continue;
+            }
+            ++controller_.clusterForwardedTiles_;
+            if (controller_.memoryAccountingEnabled_)
+                controller_.recordMemoryUsage(*layers[i]);
+            std::lock_guard lock(clusterJob.mutex);
+            clusterJob.results[jobIndex] = layers[i];
+        }
+    }
+
+    /**
+     * Finish a step of a cluster job. After the last one, the
+     * local tiles are loaded, and then the job is completed.
+     */
+    void finishClusterStep(Controller::Job const& job, std::shared_ptr<ClusterJob> const& clusterJob)
+    {
+        {
+            std::lock_guard lock(clusterJob->mutex);
+            if (--clusterJob->numPendingSteps > 0)
+                return;
+        }
+        if (clusterJob->localJob.empty()) {
+            complete(job, clusterJob->results);
+            return;
+        }
+        processBatchAsync(
+            clusterJob->localJob,
+            [self = shared_from_this(), job, clusterJob](std::vector<TileLayer::Ptr> const& localResults)
+            {
+                for (auto i = 0u; i < clusterJob->localJob.size(); ++i)
+                    clusterJob->results[clusterJob->localJobIndices[i]] = localResults[i];
+                self->complete(job, clusterJob->results);
+            });
+    }
+
+    static bool isPrefetchJob(Controller::Job const& job)
+    {
+        return !job.front().second;
+    }
+
+    /**
+     * Trace context which the spans of a job belong to. Batched jobs
+     * may serve several requests, they are traced for the first one.
+     */
+    static TraceContext traceContext(Controller::Job const& job, Span const& prefetchSpan)
+    {
+        if (isPrefetchJob(job))
+            return prefetchSpan.context();
+        return job.front().second->traceContext_;
+    }
+
+    /** Start the span for loading the tiles of a job from the data source. */
+    Span startFillSpan(Controller::Job const& job)
+    {
+        Span result("mapget.datasource.get");
+        result.setAttribute("mapget.node_id", info_.nodeId_);
+        result.setAttribute("mapget.tile", job.front().first.toString());
+        return result;
+    }
+
+    /** Check whether a tile is cached, without deserializing it. */
+    bool isCached(MapTileKey const& mapTileKey)
+    {
+        try {
+            return controller_.cache_->getSharedTileLayerBlob(mapTileKey) != nullptr;
+        }
+        catch (std::exception& e) {
+            log().error("Could not read cached tile {}: {}", mapTileKey.toString(), e.what());
+        }
+        return false;
+    }
 
-        auto& [mapTileKey, request] = *nextJob;
+    /**
+     * Get a tile from the cache. The tile may have been loaded by a job
+     * which finished after the cache lookup for its request took place.
+     */
+    TileLayer::Ptr getCachedTile(MapTileKey const& mapTileKey)
+    {
+        try {
+            return controller_.cache_->getTileLayer(mapTileKey, info_);
+        }
+        catch (std::exception& e) {
+            log().error("Could not read cached tile {}: {}", mapTileKey.toString(), e.what());
+        }
+        return nullptr;
+    }
 
+    /**
+     * Add the add-on data to a tile which was loaded from the data source,
+     * and put it into the cache. Returns null if the tile is not usable,
+     * or if it was cancelled, as it might be incomplete then.
+     */
+    TileLayer::Ptr storeLoadedTile(MapTileKey const& mapTileKey, TileLayer::Ptr const& layer)
+    {
         try
         {
-            auto layer = dataSource_->get(mapTileKey, controller_.cache_, info_);
+            auto isCancelled = [&]() {
+                if (!layer || !layer->isCancelled())
+                    return false;
+                MAPGET_LOG_DEBUG("Discarding cancelled tile: {}", mapTileKey.toString());
+                return true;
+            };
+            if (isCancelled())
+                return nullptr;
             if (!layer)
                 raise("DataSource::get() returned null.");
 
             // Special FeatureLayer handling
             if (layer->layerInfo()->type_ == LayerType::Features) {
-                controller_.loadAddOnTiles(std::static_pointer_cast<TileFeatureLayer>(layer), *dataSource_);
-            }
-
-            controller_.cache_->putTileLayer(layer);
-
-            {
-                std::unique_lock<std::mutex> lock(controller_.jobsMutex_);
-                controller_.jobsInProgress_.erase(mapTileKey);
-                request->notifyResult(layer);
-                // As we entered a tile into the cache, notify other workers
-                // that this tile can be served.
-                controller_.jobsAvailable_.notify_all();
+                controller_.loadAddOnTiles(std::static_pointer_cast<TileFeatureLayer>(layer), *dataSource_, info_);
             }
+            if (isCancelled())
+                return nullptr;
+
+            // The token is not needed anymore, once the tile is complete.
+            layer->setCancellation({});
+            if (controller_.memoryAccountingEnabled_)
+                controller_.recordMemoryUsage(*layer);
+            if (controller_.cache_->queueTileLayer(layer))
+                controller_.postCacheWriter();
+
+            // Tiles which are written behind do not know their blob size yet.
+            auto serializedBytes = layer->info().value("serialized-bytes", int64_t(0));
+            if (serializedBytes > 0)
+                tileBytesEstimate_ = (tileBytesEstimate_ * 7 + static_cast<size_t>(serializedBytes)) / 8;
+            return layer;
         }
         catch (std::exception& e) {
             log().error("Could not load tile {}: {}",
                 mapTileKey.toString(),
                 e.what());
         }
+        return nullptr;
+    }
+};
+
+void Service::Controller::scheduleJobs(std::string const& mapId)
+{
+    for (auto const& worker : workers_) {
+        if (worker->info_.mapId_ == mapId)
+            scheduleJobs(worker);
+    }
+}
+
+void Service::Controller::scheduleJobs(Worker::Ptr const& worker)
+{
+    while (!worker->shouldTerminate_ && worker->activeJobs_ < worker->info_.maxParallelJobs_) {
+        // Under memory pressure, each data source runs one job at a time.
+        // The running job schedules the next one when it finishes.
+        if (worker->activeJobs_ > 0 && MemoryBudget::instance().isUnderPressure()) {
+            ++memoryThrottles_;
+            break;
+        }
+        auto job = nextJob(worker->info_, worker->layerCursor_);
+        for (auto const& [tileKey, request] : job) {
+            auto queueWait = secondsSince(request->queuedSince_);
+            worker->metrics_->queueWaitTime_.observe(queueWait);
+            clientClassMetrics(request->clientClass_).queueWaitTime_.observe(queueWait);
+            Span queueSpan("mapget.queue", request->traceContext_);
+            queueSpan.setStartTime(request->queuedSince_);
+            queueSpan.setAttribute("mapget.tile", tileKey.toString());
+        }
+        if (job.empty())
+            job = nextPrefetchJob(*worker);
+        if (job.empty())
+            break;
+        ++worker->activeJobs_;
+        worker->loadingTiles_ += job.size();
+        worker->loadingTileMemory_.resize(worker->loadingTiles_ * worker->tileBytesEstimate_);
+        executor_.post([worker, job = std::move(job)]() { worker->work(job); });
+    }
+}
+
+Service::Controller::Job Service::Controller::nextPrefetchJob(Worker& worker)
+{
+    if (!prefetchEnabled_ || worker.prefetching_)
+        return {};
 
-        return true;
+    for (auto it = prefetchQueue_.rbegin(); it != prefetchQueue_.rend(); ++it) {
+        if (it->mapId_ != worker.info_.mapId_ || !worker.info_.getLayer(it->layerId_, false))
+            continue;
+        if (jobsInProgress_.count(*it))
+            continue;
+
+        auto tileKey = *it;
+        prefetchQueue_.erase(std::next(it).base());
+        jobsInProgress_.emplace(tileKey, JobInProgress{});
+        worker.prefetching_ = true;
+        MAPGET_LOG_DEBUG("Prefetching tile: {}", tileKey.toString());
+        return {{tileKey, nullptr}};
     }
-};
+    return {};
+}
+
+std::shared_ptr<SourceMetrics> Service::Controller::metricsForLayer(std::string const& mapId, std::string const& layerId)
+{
+    std::unique_lock lock(jobsMutex_);
+    for (auto const& worker : workers_) {
+        if (worker->info_.mapId_ == mapId && worker->info_.getLayer(layerId, false))
+            return worker->metrics_;
+    }
+    return {};
+}
 
 struct Service::Impl : public Service::Controller
 {
     std::map<DataSource::Ptr, DataSourceInfo> dataSourceInfo_;
-    std::map<DataSource::Ptr, std::vector<Worker::Ptr>> dataSourceWorkers_;
     std::list<DataSource::Ptr> addOnDataSources_;
 
     std::unique_ptr<DataSourceConfigService::Subscription> configSubscription_;
-    std::vector<DataSource::Ptr> dataSourcesFromConfig_;
+    // Data sources which were made from the config, by their serialized descriptor.
+    std::vector<std::pair<std::string, DataSource::Ptr>> dataSourcesFromConfig_;
+
+    // Data sources of the config are made in parallel, each by its own
+    // thread, see makeDataSourceFromConfig(). A thread whose source could
+    // not be made retries with a growing delay, until the config changes.
+    static constexpr auto InitialConfigRetryDelay = std::chrono::seconds(1);
+    static constexpr auto MaxConfigRetryDelay = std::chrono::seconds(60);
+    struct DataSourceMaker
+    {
+        std::thread thread_;
+        std::shared_ptr<std::atomic_bool> isDone_;
+    };
+    std::list<DataSourceMaker> dataSourceMakers_;
+    uint64_t configGeneration_ = 0;  // Incremented by each config change
+    bool stopMakingDataSources_ = false;
+    std::condition_variable configChanged_;
+    // Makers whose first attempt is not done yet, see waitForConfig().
+    size_t pendingConfigMakers_ = 0;
+    std::condition_variable configApplied_;
+    // Mutex for the config members above, which also serializes
+    // adding and removing data sources.
+    std::mutex configMutex_;
+
+    // Interval in which expired tiles are removed from the cache,
+    // and in which queued tiles are checked for their deadlines.
+    static constexpr auto ExpirySweepInterval = std::chrono::seconds(1);
+
+    std::thread expirySweeper_;
+    std::mutex expirySweeperMutex_;
+    std::condition_variable expirySweeperStopped_;
+    std::atomic_bool stopExpirySweeper_ = false;
+
+    // Highest string id per base node id, up to which its add-on
+    // string pool agrees with its own, see syncAddOnStringPool().
+    std::mutex addOnStringPoolsMutex_;
+    std::unordered_map<std::string, simfil::StringId> addOnStringPoolAgreement_;
 
     explicit Impl(Cache::Ptr cache, bool useDataSourceConfig) : Controller(std::move(cache))
     {
+        expirySweeper_ = std::thread([this] { sweepExpiredTiles(); });
+
         if (!useDataSourceConfig)
             return;
         configSubscription_ = DataSourceConfigService::get().subscribe(
-            [this](auto&& dataSourceConfigNodes)
-            {
-                // Remove previous datasources.
-                log().info("Config changed. Removing previous datasources.");
-                for (auto const& datasource : dataSourcesFromConfig_) {
-                    removeDataSource(datasource);
+            [this](auto&& dataSourceConfigNodes) { updateDataSourcesFromConfig(dataSourceConfigNodes); });
+    }
+
+    /**
+     * Apply a changed config: Only the data sources whose descriptors changed
+     * are removed, and only the new descriptors are made into data sources.
+     * The workers and running jobs of the unchanged data sources are kept.
+     */
+    void updateDataSourcesFromConfig(std::vector<YAML::Node> const& dataSourceConfigNodes)
+    {
+        std::unique_lock lock(configMutex_);
+        ++configGeneration_;
+        configChanged_.notify_all();
+
+        // Join the threads which are done, the others stop at their
+        // next attempt, as their config generation is outdated.
+        for (auto makerIt = dataSourceMakers_.begin(); makerIt != dataSourceMakers_.end();) {
+            if (!makerIt->isDone_->load()) {
+                ++makerIt;
+                continue;
+            }
+            makerIt->thread_.join();
+            makerIt = dataSourceMakers_.erase(makerIt);
+        }
+
+        std::vector<std::string> descriptors;
+        descriptors.reserve(dataSourceConfigNodes.size());
+        for (auto const& configNode : dataSourceConfigNodes)
+            descriptors.emplace_back(YAML::Dump(configNode));
+
+        // Keep one data source per unchanged descriptor, which may occur more than once.
+        std::vector<bool> isKept(descriptors.size(), false);
+        std::vector<std::pair<std::string, DataSource::Ptr>> keptDataSources;
+        size_t numRemoved = 0;
+        for (auto& [descriptor, dataSource] : dataSourcesFromConfig_) {
+            auto kept = false;
+            for (auto i = 0u; i < descriptors.size() && !kept; ++i) {
+                if (!isKept[i] && descriptors[i] == descriptor)
+                    isKept[i] = kept = true;
+            }
+            if (kept) {
+                keptDataSources.emplace_back(std::move(descriptor), std::move(dataSource));
+                continue;
+            }
+            removeDataSource(dataSource);
+            ++numRemoved;
+        }
+        dataSourcesFromConfig_ = std::move(keptDataSources);
+        log().info(
+            "Config changed. Keeping {} datasources, removed {}.",
+            dataSourcesFromConfig_.size(),
+            numRemoved);
+
+        // Make datasources for the new descriptors in parallel. Each one
+        // is served as soon as it is ready, without waiting for the others.
+        for (auto i = 0u; i < dataSourceConfigNodes.size(); ++i) {
+            if (isKept[i])
+                continue;
+            auto isDone = std::make_shared<std::atomic_bool>(false);
+            ++pendingConfigMakers_;
+            dataSourceMakers_.push_back({
+                std::thread(
+                    [this, descriptor = std::move(descriptors[i]), index = i, generation = configGeneration_, isDone]
+                    {
+                        makeDataSourceFromConfig(descriptor, index, generation);
+                        *isDone = true;
+                    }),
+                isDone});
+        }
+    }
+
+    /**
+     * Thread function which makes the data source of a config descriptor,
+     * and adds it to the service, unless the config changed meanwhile.
+     * Data sources bound their own start-up time, e.g. a RemoteDataSource
+     * by its info timeout. If the data source could not be made, it is
+     * retried with a growing delay.
+     */
+    void makeDataSourceFromConfig(std::string const& descriptor, size_t index, uint64_t generation)
+    {
+        auto isOutdated = [this, generation] { return stopMakingDataSources_ || configGeneration_ != generation; };
+        std::chrono::seconds retryDelay = InitialConfigRetryDelay;
+        auto isFirstAttempt = true;
+        while (true) {
+            // Each thread parses its own node, as nodes are not thread-safe.
+            auto dataSource = DataSourceConfigService::get().makeDataSource(YAML::Load(descriptor));
+
+            std::unique_lock lock(configMutex_);
+            // The lock is held until the source is added, so
+            // waitForConfig() returns once it is served.
+            if (isFirstAttempt) {
+                isFirstAttempt = false;
+                --pendingConfigMakers_;
+                configApplied_.notify_all();
+            }
+            if (isOutdated())
+                return;
+            if (dataSource) {
+                try {
+                    addDataSource(dataSource);
+                    dataSourcesFromConfig_.emplace_back(descriptor, dataSource);
                 }
-                dataSourcesFromConfig_.clear();
-
-                // Add datasources present in the new configuration.
-                auto index = 0;
-                for (const auto& configNode : dataSourceConfigNodes) {
-                    if (auto dataSource = DataSourceConfigService::get().makeDataSource(configNode)) {
-                        addDataSource(dataSource);
-                        dataSourcesFromConfig_.push_back(dataSource);
-                    }
-                    else {
-                        log().error(
-                            "Failed to make datasource at index {}.", index);
-                    }
-                    ++index;
+                catch (std::exception const& e) {
+                    log().error("Failed to add datasource at index {}: {}", index, e.what());
                 }
-            });
+                return;
+            }
+
+            log().error("Failed to make datasource at index {}, retrying in {}s.", index, retryDelay.count());
+            if (configChanged_.wait_for(lock, retryDelay, isOutdated))
+                return;
+            retryDelay = std::min<std::chrono::seconds>(retryDelay * 2, MaxConfigRetryDelay);
+        }
+    }
+
+    bool waitForConfig(std::chrono::milliseconds timeout)
+    {
+        std::unique_lock lock(configMutex_);
+        return configApplied_.wait_for(lock, timeout, [this] { return pendingConfigMakers_ == 0; });
+    }
+
+    /** Stop making the data sources of the config, and join the threads. */
+    void stopMakingDataSources()
+    {
+        {
+            std::unique_lock lock(configMutex_);
+            stopMakingDataSources_ = true;
+        }
+        configChanged_.notify_all();
+        for (auto& maker : dataSourceMakers_)
+            maker.thread_.join();
+        dataSourceMakers_.clear();
     }
 
     ~Impl()
     {
+        {
+            std::unique_lock lock(expirySweeperMutex_);
+            stopExpirySweeper_ = true;
+        }
+        expirySweeperStopped_.notify_all();
+        expirySweeper_.join();
+
         // Ensure that no new datasources are added while we are cleaning up.
         configSubscription_.reset();
+        stopMakingDataSources();
 
-        for (auto& dataSourceAndWorkers : dataSourceWorkers_) {
-            for (auto& worker : dataSourceAndWorkers.second) {
+        {
+            // Wait for the jobs of all workers to finish.
+            std::unique_lock lock(jobsMutex_);
+            for (auto& worker : workers_)
                 worker->shouldTerminate_ = true;
-            }
+            jobsFinished_.wait(lock, [this]() {
+                return std::all_of(workers_.begin(), workers_.end(), [](auto&& worker) {
+                    return worker->activeJobs_ == 0;
+                });
+            });
+            workers_.clear();
         }
-        // Wake up all workers to check shouldTerminate_.
-        jobsAvailable_.notify_all();
 
-        for (auto& dataSourceAndWorkers : dataSourceWorkers_) {
-            for (auto& worker : dataSourceAndWorkers.second) {
-                if (worker->thread_.joinable()) {
-                    worker->thread_.join();
-                }
+        executor_.stop();
+        deliveryExecutor_.stop();
+
+        // Write the tiles which are still queued for the cache.
+        while (cache_->writeQueuedTileLayers() > 0) {}
+    }
+
+    /**
+     * Thread function of the expiry sweeper: Periodically remove expired
+     * tiles from the cache, in batches, and drop the queued tiles whose
+     * deadline has passed, until the service is destroyed.
+     */
+    void sweepExpiredTiles()
+    {
+        std::unique_lock lock(expirySweeperMutex_);
+        while (!expirySweeperStopped_.wait_for(lock, ExpirySweepInterval, [this] { return stopExpirySweeper_.load(); })) {
+            lock.unlock();
+            try {
+                // Sweep again right away if the batch was full.
+                while (cache_->sweepExpiredTiles() == Cache::ExpirySweepBatchSize && !stopExpirySweeper_) {}
+                dropLateQueuedTiles();
+            }
+            catch (std::exception& e) {
+                log().error("Could not sweep expired tiles: {}", e.what());
             }
+            lock.lock();
         }
     }
 
@@ -353,48 +2260,78 @@ struct Service::Impl : public Service::Controller
         }
 
         DataSourceInfo info = dataSource->info();
-        dataSourceInfo_[dataSource] = info;
+        {
+            std::unique_lock lock(jobsMutex_);
+            dataSourceInfo_[dataSource] = info;
+        }
 
         // If the datasource is an add-on source, then it
         // does not have separate workers.
         if (info.isAddOn_) {
+            std::unique_lock lock(jobsMutex_);
             addOnDataSources_.emplace_back(dataSource);
             return;
         }
 
-        auto& workers = dataSourceWorkers_[dataSource];
-
-        // Create workers for this DataSource
-        for (auto i = 0; i < info.maxParallelJobs_; ++i)
-            workers.emplace_back(std::make_shared<Worker>(
-                dataSource,
-                info,
-                *this));
+        // Create the worker for this DataSource, and let it
+        // pick up any requests which are already waiting.
+        std::unique_lock lock(jobsMutex_);
+        auto& worker = workers_.emplace_back(std::make_shared<Worker>(dataSource, info, *this));
+        scheduleJobs(worker);
     }
 
     void removeDataSource(DataSource::Ptr const& dataSource)
     {
-        dataSourceInfo_.erase(dataSource);
-        addOnDataSources_.remove(dataSource);
-
-        auto workers = dataSourceWorkers_.find(dataSource);
-        if (workers != dataSourceWorkers_.end())
         {
-            // Signal each worker thread to terminate.
-            for (auto& worker : workers->second) {
-                worker->shouldTerminate_ = true;
+            std::unique_lock lock(jobsMutex_);
+            if (auto infoIt = dataSourceInfo_.find(dataSource); infoIt != dataSourceInfo_.end()) {
+                locateCache_.erasePrefix(locateCacheScope(infoIt->second));
+                dataSourceInfo_.erase(infoIt);
             }
-            jobsAvailable_.notify_all();
+            addOnDataSources_.remove(dataSource);
+        }
+
+        std::unique_lock lock(jobsMutex_);
+        auto workerIt = std::find_if(workers_.begin(), workers_.end(), [&](auto&& worker) {
+            return worker->dataSource_ == dataSource;
+        });
+        if (workerIt != workers_.end())
+        {
+            // Signal the worker to stop taking jobs, and wait
+            // for its running jobs to finish.
+            auto worker = *workerIt;
+            workers_.erase(workerIt);
+            worker->shouldTerminate_ = true;
+            jobsFinished_.wait(lock, [&worker]() { return worker->activeJobs_ == 0; });
+        }
 
-            // Wait for each worker thread to terminate.
-            for (auto& worker : workers->second) {
-                if (worker->thread_.joinable()) {
-                    worker->thread_.join();
+        // Requests which wait for a map layer that no other data source
+        // serves are finished, as their tiles would never be scheduled.
+        std::vector<LayerTilesRequest::Ptr> orphanedRequests;
+        for (auto queueIt = requests_.begin(); queueIt != requests_.end();) {
+            auto const& [mapId, layerId] = queueIt->first;
+            auto isServed = std::any_of(dataSourceInfo_.begin(), dataSourceInfo_.end(), [&](auto const& entry) {
+                auto const& info = entry.second;
+                return info.mapId_ == mapId && !info.isAddOn_ && info.layers_.count(layerId) > 0;
+            });
+            if (isServed) {
+                ++queueIt;
+                continue;
+            }
+            for (auto const& [clientId, client] : queueIt->second.clients_) {
+                for (auto const& request : client.requests_) {
+                    request->missingTiles_.clear();
+                    orphanedRequests.emplace_back(request);
                 }
             }
+            queueIt = requests_.erase(queueIt);
+        }
+        lock.unlock();
 
-            // Remove workers.
-            dataSourceWorkers_.erase(workers);
+        for (auto const& request : orphanedRequests) {
+            std::unique_lock resultLock(request->resultMutex_);
+            if (!request->isDone())
+                request->setStatus(RequestStatus::NoDataSource);
         }
     }
 
@@ -409,123 +2346,481 @@ struct Service::Impl : public Service::Controller
             return;
         }
 
+        auto tiles = r->tiles_;
+        if (r->focus_)
+            std::stable_sort(tiles.begin(), tiles.end(), FocusOrder{*r->focus_});
+        addCacheLookup(r, std::move(tiles));
+    }
+
+    void abortRequest(LayerTilesRequest::Ptr const& r)
+    {
+        {
+            std::unique_lock lock(jobsMutex_);
+            // Remove the request from its map layer request queue.
+            auto queueIt = requests_.find({r->mapId_, r->layerId_});
+            if (queueIt != requests_.end()) {
+                queueIt->second.remove(r);
+                if (queueIt->second.empty())
+                    requests_.erase(queueIt);
+            }
+            r->missingTiles_.clear();
+            cancelAbandonedJobs(r);
+        }
+
+        // Mark it as done. Pending cache lookups for the
+        // request are skipped once it is done.
+        std::unique_lock resultLock(r->resultMutex_);
+        if (!r->isDone())
+            r->setStatus(RequestStatus::Aborted);
+    }
+
+    void setPrefetching(bool enabled)
+    {
+        prefetchEnabled_ = enabled;
+        if (enabled)
+            return;
         {
             std::unique_lock lock(jobsMutex_);
-            requests_.push_back(std::move(r));
+            prefetchQueue_.clear();
         }
-        jobsAvailable_.notify_all();
+        std::unique_lock lock(prefetchMutex_);
+        prefetchedTiles_.clear();
+        prefetchedTilesOrder_.clear();
     }
 
-    void abortRequest(LayerTilesRequest::Ptr const& r)
+    void setRequestFocus(LayerTilesRequest::Ptr const& r, Point const& focus)
     {
         std::unique_lock lock(jobsMutex_);
-        // Remove the request from the list of requests.
-        auto numRemoved = requests_.remove_if([r](auto&& request) { return r == request; });
-        // Clear its jobs to mark it as done.
-        if (numRemoved) {
-            r->setStatus(RequestStatus::Aborted);
+        r->focus_ = focus;
+        ++r->focusVersion_;
+        // Pending cache lookups pick up the new focus via focusVersion_.
+        std::stable_sort(r->missingTiles_.begin(), r->missingTiles_.end(), FocusOrder{focus});
+    }
+
+    std::optional<DataSourceInfo> dataSourceInfoForLayer(std::string const& mapId, std::string const& layerId) override
+    {
+        std::unique_lock lock(jobsMutex_);
+        for (auto const& [dataSource, info] : dataSourceInfo_) {
+            if (info.mapId_ == mapId && !info.isAddOn_ && info.layers_.find(layerId) != info.layers_.end())
+                return info;
+        }
+        return {};
+    }
+
+    std::optional<Cache::TileLayerMessage> dataSourceTileLayerMessage(MapTileKey const& tileKey) override
+    {
+        DataSource::Ptr dataSource;
+        {
+            std::unique_lock lock(jobsMutex_);
+            for (auto const& [candidate, info] : dataSourceInfo_) {
+                if (info.mapId_ != tileKey.mapId_)
+                    continue;
+                if (info.isAddOn_)
+                    return {};
+                if (info.layers_.find(tileKey.layerId_) != info.layers_.end())
+                    dataSource = candidate;
+            }
         }
+        if (!dataSource)
+            return {};
+        return dataSource->getTileLayerMessage(tileKey, cache_);
+    }
+
+    bool hasAddOnDataSource(std::string const& mapId) override
+    {
+        std::unique_lock lock(jobsMutex_);
+        return std::any_of(addOnDataSources_.begin(), addOnDataSources_.end(), [&](auto const& dataSource) {
+            auto infoIt = dataSourceInfo_.find(dataSource);
+            return infoIt != dataSourceInfo_.end() && infoIt->second.mapId_ == mapId;
+        });
     }
 
     std::vector<DataSourceInfo> getDataSourceInfos()
     {
+        std::unique_lock lock(jobsMutex_);
         std::vector<DataSourceInfo> infos;
         infos.reserve(dataSourceInfo_.size());
         for (const auto& [dataSource, info] : dataSourceInfo_) {
             infos.push_back(info);
         }
-        return std::move(infos);
+        return infos;
     }
 
-    void loadAddOnTiles(TileFeatureLayer::Ptr const& baseTile, DataSource& baseDataSource) override {
-        for (auto const& auxDataSource : addOnDataSources_) {
-            if (auxDataSource->info().mapId_ == baseTile->mapId()) {
-                auto auxTile = [&]() -> TileFeatureLayer::Ptr
-                {
-                    auto auxTile = auxDataSource->get(baseTile->id(), cache_, auxDataSource->info());
-                    if (!auxTile) {
-                        log().warn("auxDataSource returned null for {}", baseTile->id().toString());
-                        return {};
-                    }
-                    if (auxTile->error()) {
-                        log().warn("Error while fetching addon tile {}: {}", baseTile->id().toString(), *auxTile->error());
-                        return {};
-                    }
-                    if (auxTile->layerInfo()->type_ != LayerType::Features) {
-                        log().warn("Addon tile is not a feature layer");
-                        return {};
-                    }
+    /**
+     * Fetch the tiles of all add-on sources for the map of the base tile.
+     * The tiles are requested concurrently via DataSource::getAsync(), so
+     * that asynchronous add-on sources (e.g. remote ones) load in parallel.
+     */
+    std::vector<TileFeatureLayer::Ptr> loadAuxTiles(TileFeatureLayer::Ptr const& baseTile)
+    {
+        std::vector<std::pair<DataSource::Ptr, DataSourceInfo>> auxDataSources;
+        {
+            std::unique_lock lock(jobsMutex_);
+            for (auto const& auxDataSource : addOnDataSources_) {
+                auto infoIt = dataSourceInfo_.find(auxDataSource);
+                if (infoIt != dataSourceInfo_.end() && infoIt->second.mapId_ == baseTile->mapId())
+                    auxDataSources.emplace_back(auxDataSource, infoIt->second);
+            }
+        }
+        if (auxDataSources.empty())
+            return {};
+
+        struct PendingAuxTiles
+        {
+            std::mutex mutex_;
+            std::condition_variable done_;
+            std::vector<TileLayer::Ptr> tiles_;
+            size_t numPending_ = 0;
+        };
+        auto pending = std::make_shared<PendingAuxTiles>();
+        pending->tiles_.resize(auxDataSources.size());
+        pending->numPending_ = auxDataSources.size();
+
+        for (auto i = 0u; i < auxDataSources.size(); ++i) {
+            auto& [auxDataSource, auxInfo] = auxDataSources[i];
+            try {
+                auxDataSource->getAsync(
+                    baseTile->id(),
+                    cache_,
+                    auxInfo,
+                    [pending, i](TileLayer::Ptr auxTile)
+                    {
+                        std::unique_lock lock(pending->mutex_);
+                        pending->tiles_[i] = std::move(auxTile);
+                        if (--pending->numPending_ == 0)
+                            pending->done_.notify_all();
+                    },
+                    baseTile->cancellation());
+            }
+            catch (std::exception& e) {
+                log().warn("Error while fetching addon tile {}: {}", baseTile->id().toString(), e.what());
+                std::unique_lock lock(pending->mutex_);
+                --pending->numPending_;
+            }
+        }
+
+        std::unique_lock lock(pending->mutex_);
+        pending->done_.wait(lock, [&pending] { return pending->numPending_ == 0; });
 
-                    return std::static_pointer_cast<TileFeatureLayer>(auxTile);
-                }();
+        std::vector<TileFeatureLayer::Ptr> result;
+        for (auto const& auxTile : pending->tiles_) {
+            if (!auxTile) {
+                log().warn("auxDataSource returned null for {}", baseTile->id().toString());
+                continue;
+            }
+            if (auxTile->error()) {
+                log().warn("Error while fetching addon tile {}: {}", baseTile->id().toString(), *auxTile->error());
+                continue;
+            }
+            if (auxTile->layerInfo()->type_ != LayerType::Features) {
+                log().warn("Addon tile is not a feature layer");
+                continue;
+            }
+            result.emplace_back(std::static_pointer_cast<TileFeatureLayer>(auxTile));
+        }
+        return result;
+    }
+
+    /**
+     * Locate a feature of a data source using the locate index of the cache,
+     * see Cache::setLocateIndexEnabled(). Entries which were indexed for
+     * another version of the layer are not used.
+     */
+    std::optional<std::vector<LocateResponse>> locateIndexed(DataSourceInfo const& info, LocateRequest const& req)
+    {
+        if (!cache_->isLocateIndexEnabled())
+            return {};
+        auto entry = cache_->lookupLocateIndex(info.nodeId_, req);
+        if (entry) {
+            auto layerInfo = info.getLayer(entry->tileKey_.layerId_, false);
+            if (!layerInfo || layerInfo->version_.toString() != entry->layerVersion_)
+                entry.reset();
+        }
+        if (!entry) {
+            ++locateIndexMisses_;
+            return {};
+        }
+        ++locateIndexHits_;
+        LocateResponse response(req);
+        response.tileKey_ = entry->tileKey_;
+        return std::vector<LocateResponse>{std::move(response)};
+    }
+
+    /**
+     * Locate the given features using a data source, with one batched call
+     * for all requests whose results are neither in the locate cache nor
+     * in the locate index. Empty results are not cached, as they may stem
+     * from transient errors of remote sources.
+     */
+    std::vector<std::vector<LocateResponse>> locateCached(
+        DataSource& dataSource,
+        DataSourceInfo const& info,
+        std::vector<LocateRequest> const& requests)
+    {
+        auto const scope = locateCacheScope(info);
+        std::vector<std::vector<LocateResponse>> results(requests.size());
+        std::vector<std::string> uncachedKeys;
+        std::vector<LocateRequest> uncachedRequests;
+        std::vector<size_t> uncachedIndices;
+        for (auto i = 0u; i < requests.size(); ++i) {
+            auto key = scope + requests[i].serialize().dump();
+            if (auto cachedResult = locateCache_.get(key)) {
+                results[i] = std::move(*cachedResult);
+                continue;
+            }
+            if (auto indexedResult = locateIndexed(info, requests[i])) {
+                locateCache_.put(key, *indexedResult);
+                results[i] = std::move(*indexedResult);
+                continue;
+            }
+            uncachedKeys.emplace_back(std::move(key));
+            uncachedRequests.emplace_back(requests[i]);
+            uncachedIndices.emplace_back(i);
+        }
+        if (uncachedRequests.empty())
+            return results;
+
+        std::vector<std::vector<LocateResponse>> locatedResults;
+        if (uncachedRequests.size() == 1)
+            locatedResults.emplace_back(dataSource.locate(uncachedRequests.front()));
+        else
+            locatedResults = dataSource.locate(uncachedRequests);
+        if (locatedResults.size() != uncachedRequests.size()) {
+            log().warn("Batched locate returned {} results for {} requests.",
+                locatedResults.size(),
+                uncachedRequests.size());
+            locatedResults.resize(uncachedRequests.size());
+        }
+        for (auto i = 0u; i < uncachedRequests.size(); ++i) {
+            if (!locatedResults[i].empty())
+                locateCache_.put(uncachedKeys[i], locatedResults[i]);
+            results[uncachedIndices[i]] = std::move(locatedResults[i]);
+        }
+        return results;
+    }
+
+    /** Locate requests of one data source, see locate(). */
+    struct SourceLocate
+    {
+        DataSource::Ptr dataSource_;
+        DataSourceInfo info_;
+        std::vector<LocateRequest> requests_;
+        std::vector<size_t> indices_;
+
+        // Set by the thread which runs the locate, which is
+        // either the calling thread or an executor thread.
+        std::atomic_bool isClaimed_ = false;
+        std::promise<std::vector<std::vector<LocateResponse>>> result_;
+    };
+
+    /** Run a source locate, unless another thread claimed it. */
+    void runSourceLocate(SourceLocate& source)
+    {
+        if (source.isClaimed_.exchange(true))
+            return;
+        try {
+            source.result_.set_value(
+                locateCached(*source.dataSource_, source.info_, source.requests_));
+        }
+        catch (...) {
+            source.result_.set_exception(std::current_exception());
+        }
+    }
 
-                if (!auxTile) {
-                    // Error messages have been generated above.
+    /**
+     * Locate features using all non-add-on data sources for their maps.
+     * Each data source gets one batch with the requests for its map, and
+     * the data sources are queried concurrently, on the executor.
+     */
+    std::vector<std::vector<LocateResponse>> locate(std::vector<LocateRequest> const& requests)
+    {
+        // The sources are shared with the executor tasks, which may
+        // run after this call if the calling thread claimed their source.
+        auto sources = std::make_shared<std::list<SourceLocate>>();
+        {
+            std::unique_lock lock(jobsMutex_);
+            for (auto const& [ds, info] : dataSourceInfo_) {
+                if (info.isAddOn_)
                     continue;
+                auto& source = sources->emplace_back();
+                source.dataSource_ = ds;
+                source.info_ = info;
+                for (auto i = 0u; i < requests.size(); ++i) {
+                    if (info.mapId_ == requests[i].mapId_) {
+                        source.requests_.emplace_back(requests[i]);
+                        source.indices_.emplace_back(i);
+                    }
                 }
+                if (source.requests_.empty())
+                    sources->pop_back();
+            }
+        }
+
+        // All but the first source are posted to the executor. This thread
+        // then runs each source which no executor thread has picked up yet,
+        // so a busy executor does not stall the locate.
+        std::vector<std::future<std::vector<std::vector<LocateResponse>>>> pendingResults;
+        for (auto& source : *sources) {
+            pendingResults.emplace_back(source.result_.get_future());
+            if (&source != &sources->front())
+                executor_.post([this, sources, &source]() { runSourceLocate(source); });
+        }
+        for (auto& source : *sources)
+            runSourceLocate(source);
+
+        std::vector<std::vector<LocateResponse>> results(requests.size());
+        auto resultIt = pendingResults.begin();
+        for (auto const& source : *sources) {
+            auto locations = (resultIt++)->get();
+            for (auto i = 0u; i < locations.size(); ++i) {
+                for (auto& location : locations[i])
+                    results[source.indices_[i]].emplace_back(std::move(location));
+            }
+        }
+        return results;
+    }
+
+    /**
+     * Extend the add-on string pool of a base node with the strings which
+     * were added to the base pool since the last call, as long as both pools
+     * assign them the same ids. So the string ids of base tiles stay valid
+     * in the add-on pool, and the strings of aux tiles which are not in the
+     * base pool get ids above them. Once an aux string took an id which the
+     * base pool assigns differently, later base strings are only re-encoded.
+     */
+    void syncAddOnStringPool(std::string const& baseNodeId, simfil::StringPool& basePool, simfil::StringPool& addOnPool)
+    {
+        std::unique_lock lock(addOnStringPoolsMutex_);
+        auto& agreed = addOnStringPoolAgreement_.try_emplace(baseNodeId, StringPool::FeatureIdStr).first->second;
+        while (agreed < basePool.highest()) {
+            auto next = static_cast<simfil::StringId>(agreed + 1);
+            auto str = basePool.resolve(next);
+            if (!str)
+                break;
+            if (next <= addOnPool.highest()) {
+                if (addOnPool.resolve(next) != str)
+                    break;
+            }
+            else if (addOnPool.emplace(*str) != next)
+                break;
+            agreed = next;
+        }
+    }
+
+    void loadAddOnTiles(
+        TileFeatureLayer::Ptr const& baseTile,
+        DataSource& baseDataSource,
+        DataSourceInfo const& baseInfo) override
+    {
+        Span span("mapget.addons");
+        span.setAttribute("mapget.tile", MapTileKey(*baseTile).toString());
+        AllocationScope allocations(AllocationStage::AddOnMerge);
+
+        // The aux tiles may introduce new strings to the base tile. Since we
+        // cannot manipulate the original node's string pool, the merged tile
+        // uses one add-on string pool per base node, with an artificial node
+        // id. The add-on pool mirrors the ids of the base pool, so the base
+        // tile keeps its string ids, and it is shared by all aux sources.
+        auto baseNodeId = baseTile->nodeId();
+        auto addOnNodeId = baseNodeId + "|add-ons";
+        bool usesAddOnStringPool = false;
+
+        auto start = std::chrono::steady_clock::now();
+        auto auxTiles = loadAuxTiles(baseTile);
+        for (auto const& auxTile : auxTiles) {
+            // Stop merging if nobody waits for the base tile anymore.
+            if (baseTile->isCancelled())
+                return;
+
+            // Switch to the add-on string pool once, before the first merge.
+            if (!usesAddOnStringPool) {
+                auto addOnStringPool = cache_->getStringPool(addOnNodeId);
+                syncAddOnStringPool(baseNodeId, *baseTile->strings(), *addOnStringPool);
+                baseTile->setStrings(addOnStringPool);
+                baseTile->setNodeId(addOnNodeId);
+                usesAddOnStringPool = true;
+            }
 
-                // Re-encode the base tile in a common string namespace.
-                // This is necessary, because the aux tile may introduce new strings
-                // to the base tile. Since we cannot manipulate the original
-                // node's string pool, we have to create a new one based on a new
-                // artificial node id.
-                auto auxBaseNodeId = baseTile->nodeId() + "|" + auxTile->nodeId();
-                auto auxBaseStringPool = cache_->getStringPool(auxBaseNodeId);
-                baseTile->setStrings(auxBaseStringPool);
-                baseTile->setNodeId(auxBaseNodeId);
-
-                // Adopt new attributes, features and relations for the base feature
-                // from the auxiliary feature.
-                std::unordered_map<uint32_t, simfil::ModelNode::Ptr> clonedModelNodes;
-                for (auto const& auxFeature : *auxTile)
+            // If the ID of an aux feature does not validate as a primary feature id,
+            // we assume that it uses a secondary ID scheme for which a locate-call
+            // is required. All such IDs of the aux tile are resolved in one batch.
+            std::vector<bool> auxFeatureIdIsIndirect;
+            std::vector<LocateRequest> locateRequests;
+            for (auto const& auxFeature : *auxTile) {
+                auto idIsIndirect = !baseTile->layerInfo()->validFeatureId(
+                    auxFeature->id()->typeId(),
+                    auxFeature->id()->keyValuePairs(),
+                    true);
+                auxFeatureIdIsIndirect.push_back(idIsIndirect);
+                if (idIsIndirect) {
+                    locateRequests.emplace_back(
+                        auxTile->mapId(),
+                        std::string(auxFeature->id()->typeId()),
+                        castToKeyValue(auxFeature->id()->keyValuePairs()));
+                }
+            }
+
+            std::vector<std::vector<LocateResponse>> locateResults;
+            if (!locateRequests.empty())
+                locateResults = locateCached(baseDataSource, baseInfo, locateRequests);
+
+            // Reserve the base tile columns for the nodes of the aux tile.
+            auto baseSizes = baseTile->sizeHint();
+            auto auxSizes = auxTile->sizeHint();
+            baseTile->reserve({
+                baseSizes.features_ + auxSizes.features_,
+                baseSizes.attributes_ + auxSizes.attributes_,
+                baseSizes.attributeLayers_ + auxSizes.attributeLayers_,
+                baseSizes.geometries_ + auxSizes.geometries_,
+                baseSizes.validities_ + auxSizes.validities_,
+                baseSizes.relations_ + auxSizes.relations_,
+                baseSizes.sourceDataReferences_ + auxSizes.sourceDataReferences_});
+
+            // Adopt new attributes, features and relations for the base feature
+            // from the auxiliary feature.
+            TileFeatureLayer::ClonedNodes clonedModelNodes;
+            size_t auxFeatureIndex = 0;
+            size_t locateResultIndex = 0;
+            for (auto const& auxFeature : *auxTile)
+            {
+                // Note: A single secondary feature ID may resolve to multiple
+                // primary feature IDs. So we keep a vector of aux feature ID info.
+                std::vector<std::pair<std::string_view, KeyValueViewPairs>> auxFeatureIds = {
+                    {auxFeature->id()->typeId(), auxFeature->id()->keyValuePairs()}};
+
+                // Convert the feature reference to multiple direct ones on-demand.
+                if (auxFeatureIdIsIndirect[auxFeatureIndex++])
                 {
-                    // Note: A single secondary feature ID may resolve to multiple
-                    // primary feature IDs. So we keep a vector of aux feature ID info.
-                    std::vector<std::pair<std::string_view, KeyValueViewPairs>> auxFeatureIds = {
-                        {auxFeature->id()->typeId(), auxFeature->id()->keyValuePairs()}};
-
-                    // Convert the feature reference to multiple direct ones on-demand.
-                    // If the ID does not validate as a primary feature id, we assume
-                    // that it uses a secondary ID scheme for which a locate-call
-                    // is required.
-                    auto idIsIndirect = !baseTile->layerInfo()->validFeatureId(
-                        auxFeatureIds[0].first,
-                        auxFeatureIds[0].second,
-                        true);
-                    std::vector<LocateResponse> locateResponses;
-                    if (idIsIndirect)
-                    {
-                        locateResponses = baseDataSource.locate(LocateRequest(
-                            auxTile->mapId(),
-                            std::string(auxFeatureIds[0].first),
-                            castToKeyValue(auxFeatureIds[0].second)));
-                        if (locateResponses.empty()) {
-                            log().warn("Could not locate indirect aux feature id {}", auxFeature->id()->toString());
+                    auto const& locateResponses = locateResults[locateResultIndex++];
+                    if (locateResponses.empty()) {
+                        log().warn("Could not locate indirect aux feature id {}", auxFeature->id()->toString());
+                        continue;
+                    }
+                    auxFeatureIds.clear();
+                    for (auto const& resolution : locateResponses) {
+                        // Do not adopt resolutions which point to a different tile layer.
+                        if (resolution.tileKey_ != baseTile->id())
                             continue;
-                        }
-                        auxFeatureIds.clear();
-                        for (auto const& resolution : locateResponses) {
-                            // Do not adopt resolutions which point to a different tile layer.
-                            if (resolution.tileKey_ != baseTile->id())
-                                continue;
-                            auxFeatureIds.emplace_back(
-                                resolution.typeId_,
-                                castToKeyValueView(resolution.featureId_));
-                        }
+                        auxFeatureIds.emplace_back(
+                            resolution.typeId_,
+                            castToKeyValueView(resolution.featureId_));
                     }
+                }
 
-                    // Go over all feature IDs to which the auxiliary feature data should be appended.
-                    for (auto const& [auxFeatureType, auxFeatureKvp] : auxFeatureIds) {
-                        baseTile->clone(
-                            clonedModelNodes,
-                            auxTile,
-                            *auxFeature,
-                            auxFeatureType,
-                            auxFeatureKvp);
-                    }
+                // Go over all feature IDs to which the auxiliary feature data should be appended.
+                for (auto const& [auxFeatureType, auxFeatureKvp] : auxFeatureIds) {
+                    baseTile->clone(
+                        clonedModelNodes,
+                        auxTile,
+                        *auxFeature,
+                        auxFeatureType,
+                        auxFeatureKvp);
                 }
             }
         }
+        allocations.setInfo(*baseTile);
+        if (!auxTiles.empty())
+            baseTile->setInfo("add-on-merge-time-ms", secondsSince(start) * 1e3);
     }
 };
 
@@ -538,21 +2833,28 @@ Service::~Service() = default;
 
 void Service::add(DataSource::Ptr const& dataSource)
 {
+    std::unique_lock lock(impl_->configMutex_);
     impl_->addDataSource(dataSource);
 }
 
 void Service::remove(const DataSource::Ptr& dataSource)
 {
+    std::unique_lock lock(impl_->configMutex_);
     impl_->removeDataSource(dataSource);
 }
 
+bool Service::waitForConfig(std::chrono::milliseconds timeout)
+{
+    return impl_->waitForConfig(timeout);
+}
+
 bool Service::request(std::vector<LayerTilesRequest::Ptr> requests)
 {
     bool dataSourcesAvailable = true;
     for (const auto& r : requests) {
         if (!hasLayer(r->mapId_, r->layerId_)) {
             dataSourcesAvailable = false;
-            log().debug("No data source can provide requested map and layer: {}::{}",
+            MAPGET_LOG_DEBUG("No data source can provide requested map and layer: {}::{}",
                 r->mapId_,
                 r->layerId_);
             r->setStatus(RequestStatus::NoDataSource);
@@ -562,7 +2864,7 @@ bool Service::request(std::vector<LayerTilesRequest::Ptr> requests)
     for (const auto& r : requests) {
         if (!dataSourcesAvailable) {
             if (r->getStatus() != RequestStatus::NoDataSource) {
-                log().debug("Aborting unfulfillable request!");
+                MAPGET_LOG_DEBUG("Aborting unfulfillable request!");
                 r->setStatus(RequestStatus::Aborted);
             }
         }
@@ -575,13 +2877,97 @@ bool Service::request(std::vector<LayerTilesRequest::Ptr> requests)
 
 std::vector<LocateResponse> Service::locate(LocateRequest const& req)
 {
-    std::vector<LocateResponse> results;
-    for (auto const& [ds, info] : impl_->dataSourceInfo_)
-        if (info.mapId_ == req.mapId_ && !info.isAddOn_) {
-            for (auto const& location : ds->locate(req))
-                results.emplace_back(location);
+    return std::move(impl_->locate(std::vector<LocateRequest>{req}).front());
+}
+
+std::vector<std::vector<LocateResponse>> Service::locate(std::vector<LocateRequest> const& requests)
+{
+    return impl_->locate(requests);
+}
+
+std::vector<ResolvedRelation> Service::resolveRelations(TileFeatureLayer::Ptr const& tile, bool loadTargets)
+{
+    std::vector<ResolvedRelation> result;
+    auto tileKey = MapTileKey(*tile);
+
+    // Targets which are not in the tile are located once per target id.
+    std::vector<LocateRequest> locateRequests;
+    std::unordered_map<std::string, size_t> locateRequestIndices;
+    std::vector<std::optional<size_t>> relationLocateRequests;
+    for (auto const& feature : *tile) {
+        feature->forEachRelation([&](model_ptr<Relation> const& relation)
+        {
+            auto& resolved = result.emplace_back(ResolvedRelation{feature, relation, {}, {}});
+            auto target = relation->target();
+            if (auto targetFeature = tile->find(target->typeId(), target->keyValuePairs())) {
+                resolved.targetTiles_.emplace_back(tileKey);
+                resolved.targets_.emplace_back(std::move(targetFeature));
+                relationLocateRequests.emplace_back();
+                return true;
+            }
+            auto [it, isNew] = locateRequestIndices.try_emplace(target->toString(), locateRequests.size());
+            if (isNew) {
+                locateRequests.emplace_back(
+                    tile->mapId(),
+                    std::string(target->typeId()),
+                    castToKeyValue(target->keyValuePairs()));
+            }
+            relationLocateRequests.emplace_back(it->second);
+            return true;
+        });
+    }
+    if (locateRequests.empty())
+        return result;
+    auto locations = locate(locateRequests);
+
+    // Request all located target tiles, with one request per layer.
+    std::map<MapTileKey, TileFeatureLayer::Ptr> targetTiles;
+    if (loadTargets) {
+        std::map<std::string, std::set<TileId>> targetTileIdsPerLayer;
+        for (auto const& responses : locations) {
+            for (auto const& response : responses) {
+                if (response.tileKey_.layer_ == LayerType::Features && response.tileKey_.mapId_ == tile->mapId())
+                    targetTileIdsPerLayer[response.tileKey_.layerId_].insert(response.tileKey_.tileId_);
+            }
+        }
+
+        std::mutex targetTilesMutex;
+        std::vector<LayerTilesRequest::Ptr> layerRequests;
+        for (auto const& [layerId, tileIds] : targetTileIdsPerLayer) {
+            if (!hasLayer(tile->mapId(), layerId)) {
+                log().warn("Relation targets of tile {} are in unavailable layer {}.", tileKey.toString(), layerId);
+                continue;
+            }
+            auto layerRequest = std::make_shared<LayerTilesRequest>(
+                tile->mapId(),
+                layerId,
+                std::vector<TileId>(tileIds.begin(), tileIds.end()));
+            layerRequest->onFeatureLayer([&targetTiles, &targetTilesMutex](auto&& targetTile)
+            {
+                std::unique_lock lock(targetTilesMutex);
+                targetTiles.emplace(MapTileKey(*targetTile), targetTile);
+            });
+            layerRequests.emplace_back(std::move(layerRequest));
+        }
+        request(layerRequests);
+        for (auto const& layerRequest : layerRequests)
+            layerRequest->wait();
+    }
+
+    for (auto i = 0u; i < result.size(); ++i) {
+        if (!relationLocateRequests[i])
+            continue;
+        auto& resolved = result[i];
+        for (auto const& response : locations[*relationLocateRequests[i]]) {
+            resolved.targetTiles_.emplace_back(response.tileKey_);
+            auto targetTile = targetTiles.find(response.tileKey_);
+            if (targetTile == targetTiles.end())
+                continue;
+            if (auto targetFeature = targetTile->second->find(response.typeId_, castToKeyValueView(response.featureId_)))
+                resolved.targets_.emplace_back(std::move(targetFeature));
         }
-    return results;
+    }
+    return result;
 }
 
 void Service::abort(const LayerTilesRequest::Ptr& r)
@@ -589,6 +2975,52 @@ void Service::abort(const LayerTilesRequest::Ptr& r)
     impl_->abortRequest(r);
 }
 
+void Service::setPrefetching(bool enabled)
+{
+    impl_->setPrefetching(enabled);
+}
+
+void Service::setMemoryAccounting(bool enabled)
+{
+    impl_->memoryAccountingEnabled_ = enabled;
+}
+
+void Service::setClientClassWeight(std::string const& clientClass, double weight)
+{
+    if (!(weight > 0))
+        raiseFmt("The weight of client class {} must be positive.", clientClass);
+    std::unique_lock lock(impl_->jobsMutex_);
+    impl_->clientClassWeights_[clientClass] = weight;
+}
+
+void Service::setCluster(std::string const& selfName, std::map<std::string, ClusterPeer::Ptr> peers)
+{
+    std::shared_ptr<Controller::Cluster const> cluster;
+    if (!peers.empty()) {
+        if (peers.count(selfName))
+            raiseFmt("Cluster node {} must not be its own peer.", selfName);
+        std::vector<std::string> nodes{selfName};
+        for (auto const& [name, peer] : peers) {
+            if (!peer)
+                raiseFmt("Cluster peer {} must not be null.", name);
+            nodes.emplace_back(name);
+        }
+        std::vector<ClusterPeer::Ptr> nodePeers{nullptr};
+        for (auto& [name, peer] : peers)
+            nodePeers.emplace_back(std::move(peer));
+        cluster = std::make_shared<Controller::Cluster const>(
+            Controller::Cluster{HashRing(std::move(nodes)), 0, std::move(nodePeers)});
+        log().info("Joined a cluster of {} nodes as {}.", cluster->ring_.nodes().size(), selfName);
+    }
+    std::unique_lock lock(impl_->clusterMutex_);
+    impl_->cluster_ = std::move(cluster);
+}
+
+void Service::setFocus(LayerTilesRequest::Ptr const& r, Point const& focus)
+{
+    impl_->setRequestFocus(r, focus);
+}
+
 std::vector<DataSourceInfo> Service::info()
 {
     return impl_->getDataSourceInfos();
@@ -616,17 +3048,153 @@ bool Service::hasLayer(std::string const& mapId, std::string const& layerId)
 nlohmann::json Service::getStatistics() const
 {
     auto datasources = nlohmann::json::array();
-    for (auto const& [dataSource, info] : impl_->dataSourceInfo_) {
-        datasources.push_back({
-            {"name", info.mapId_},
-            {"workers", impl_->dataSourceWorkers_[dataSource].size()}
-        });
+    auto clientClasses = nlohmann::json::object();
+    size_t activeRequests = 0;
+    size_t queuedPrefetches = 0;
+    {
+        std::unique_lock lock(impl_->jobsMutex_);
+        for (auto const& worker : impl_->workers_) {
+            datasources.push_back({
+                {"name", worker->info_.mapId_},
+                {"workers", worker->info_.maxParallelJobs_},
+                {"max-batch-size", worker->info_.maxBatchSize_},
+                {"active-jobs", worker->activeJobs_}
+            });
+        }
+        for (auto const& [key, queue] : impl_->requests_)
+            activeRequests += queue.size();
+        queuedPrefetches = impl_->prefetchQueue_.size();
+
+        // Classes which were only queued so far have no metrics yet.
+        std::map<std::string, std::pair<size_t, size_t>> queuedPerClass;  // (clients, requests)
+        for (auto const& [key, queue] : impl_->requests_) {
+            for (auto const& [clientId, client] : queue.clients_) {
+                auto& [numClients, numRequests] = queuedPerClass[client.requests_.front()->clientClass_];
+                ++numClients;
+                numRequests += client.requests_.size();
+            }
+        }
+        for (auto const& [clientClass, metrics] : impl_->clientClassMetrics_)
+            queuedPerClass.try_emplace(clientClass);
+        for (auto const& [clientClass, queued] : queuedPerClass) {
+            uint64_t scheduledTiles = 0;
+            double queueWaitMs = 0.;
+            if (auto it = impl_->clientClassMetrics_.find(clientClass); it != impl_->clientClassMetrics_.end()) {
+                scheduledTiles = it->second->queueWaitTime_.count();
+                queueWaitMs = it->second->queueWaitTime_.sum() * 1000.;
+            }
+            clientClasses[clientClass] = {
+                {"weight", impl_->clientClassWeight(clientClass)},
+                {"queued-clients", queued.first},
+                {"queued-requests", queued.second},
+                {"scheduled-tiles", scheduledTiles},
+                {"mean-queue-wait-ms", scheduledTiles ? queueWaitMs / static_cast<double>(scheduledTiles) : 0.}};
+        }
     }
 
     return {
         {"datasources", datasources},
-        {"active-requests", impl_->requests_.size()}
+        {"active-requests", activeRequests},
+        {"pending-cache-lookups", impl_->pendingCacheLookups_.load()},
+        {"executor-threads", impl_->executor_.numThreads()},
+        {"queued-tasks", impl_->executor_.numQueuedTasks()},
+        {"prefetch", {
+            {"enabled", impl_->prefetchEnabled_.load()},
+            {"queued-tiles", queuedPrefetches},
+            {"loaded-tiles", impl_->prefetchLoads_.load()},
+            {"hits", impl_->prefetchHits_.load()},
+            {"misses", impl_->prefetchMisses_.load()}
+        }},
+        {"cancelled-jobs", impl_->cancelledJobs_.load()},
+        {"pruned-tiles", impl_->prunedTiles_.load()},
+        {"late-tiles", impl_->lateTiles_.load()},
+        {"locate-cache", impl_->locateCache_.getStatistics()},
+        {"locate-index", {
+            {"enabled", impl_->cache_->isLocateIndexEnabled()},
+            {"hits", impl_->locateIndexHits_.load()},
+            {"misses", impl_->locateIndexMisses_.load()}
+        }},
+        {"simplified-tile-cache", impl_->simplifiedTiles_.getStatistics()},
+        {"memory-usage", impl_->memoryUsageStatistics()},
+        {"memory-budget", [&]() {
+            auto budget = MemoryBudget::instance().getStatistics();
+            budget["throttles"] = impl_->memoryThrottles_.load();
+            return budget;
+        }()},
+        {"column-pages", ColumnPagePool::getStatistics()},
+        {"client-classes", clientClasses},
+        {"cluster", impl_->clusterStatistics()},
+        {"allocations", AllocationScope::getStatistics()}
+    };
+}
+
+void Service::writeMetrics(MetricsWriter& writer) const
+{
+    struct SourceSnapshot
+    {
+        MetricLabels labels_;
+        int activeJobs_ = 0;
+        std::shared_ptr<SourceMetrics> metrics_;
+    };
+    std::vector<SourceSnapshot> sources;
+    std::vector<std::pair<std::string, std::shared_ptr<ClientClassMetrics>>> clientClasses;
+    size_t jobsInProgress = 0;
+    {
+        std::unique_lock lock(impl_->jobsMutex_);
+        clientClasses.assign(impl_->clientClassMetrics_.begin(), impl_->clientClassMetrics_.end());
+        for (auto const& worker : impl_->workers_) {
+            sources.push_back({
+                {{"source", worker->info_.nodeId_}, {"map", worker->info_.mapId_}},
+                worker->activeJobs_,
+                worker->metrics_});
+        }
+        jobsInProgress = impl_->jobsInProgress_.size();
+    }
+
+    auto writeHistograms = [&](char const* name, char const* help, Histogram SourceMetrics::*histogram)
+    {
+        writer.family(name, "histogram", help);
+        for (auto const& source : sources)
+            writer.histogram(name, source.labels_, (*source.metrics_).*histogram);
     };
+    writeHistograms(
+        "mapget_fill_duration_seconds",
+        "Duration of tile loads from a data source, one per job.",
+        &SourceMetrics::fillTime_);
+    writeHistograms(
+        "mapget_cache_lookup_duration_seconds",
+        "Duration of cache lookups for requested tiles.",
+        &SourceMetrics::cacheLookupTime_);
+    writeHistograms(
+        "mapget_queue_wait_seconds",
+        "Time which requested tiles waited in the request queue before a job started.",
+        &SourceMetrics::queueWaitTime_);
+
+    writer.family(
+        "mapget_client_queue_wait_seconds",
+        "histogram",
+        "Time which requested tiles waited in the request queue before a job started, per client class.");
+    for (auto const& [clientClass, metrics] : clientClasses)
+        writer.histogram("mapget_client_queue_wait_seconds", {{"class", clientClass}}, metrics->queueWaitTime_);
+
+    writer.family("mapget_tiles_served_total", "counter", "Tiles which were passed to requests.");
+    for (auto const& source : sources) {
+        auto labels = source.labels_;
+        labels.emplace_back("origin", "cache");
+        writer.sample("mapget_tiles_served_total", labels, static_cast<double>(source.metrics_->tilesFromCache_.load()));
+        labels.back().second = "source";
+        writer.sample("mapget_tiles_served_total", labels, static_cast<double>(source.metrics_->tilesFromSource_.load()));
+    }
+
+    writer.family("mapget_active_jobs", "gauge", "Running jobs of a data source.");
+    for (auto const& source : sources)
+        writer.sample("mapget_active_jobs", source.labels_, source.activeJobs_);
+
+    writer.family("mapget_jobs_in_progress_tiles", "gauge", "Tiles which are being loaded by jobs.");
+    writer.sample("mapget_jobs_in_progress_tiles", {}, static_cast<double>(jobsInProgress));
+
+    writer.family("mapget_executor_queued_tasks", "gauge", "Tasks waiting for a service thread.");
+    writer.sample("mapget_executor_queued_tasks", {}, static_cast<double>(impl_->executor_.numQueuedTasks()));
 }
 
 }  // namespace mapget
@@ -0,0 +1,123 @@
+#include "tieredcache.h"
+#include "mapget/log.h"
+
+namespace mapget
+{
+
+TieredCache::TieredCache(Cache::Ptr front, Cache::Ptr back)
+    : front_(std::move(front)), back_(std::move(back))
+{
+    if (!front_ || !back_)
+        raise("A TieredCache requires a front and a back cache.");
+
+    // Update stringPoolOffsets_ (superclass member)
+    // with the string pools which the back has loaded.
+    for (auto const& [nodeId, _] : back_->stringPoolOffsets())
+        Cache::getStringPool(nodeId);
+}
+
+std::optional<std::string> TieredCache::getTileLayerBlob(const MapTileKey& k)
+{
+    if (auto blob = getSharedTileLayerBlob(k))
+        return *blob;
+    return {};
+}
+
+Cache::SharedBlob TieredCache::getSharedTileLayerBlob(const MapTileKey& k)
+{
+    if (auto blob = front_->getSharedTileLayerBlob(k))
+        return blob;
+    auto blob = back_->getSharedTileLayerBlob(k);
+    if (!blob)
+        return nullptr;
+
+    // A tile which was put since the back was read is in the front already.
+    std::unique_lock writeLock(writeMutex_);
+    if (!front_->getSharedTileLayerBlob(k)) {
+        MAPGET_LOG_DEBUG("Promoting tile to the front cache: {}", k.toString());
+        front_->putTileLayerBlob(k, *blob);
+        ++promotedTiles_;
+    }
+    return blob;
+}
+
+void TieredCache::putTileLayerBlob(const MapTileKey& k, const std::string& v)
+{
+    std::unique_lock writeLock(writeMutex_);
+    back_->putTileLayerBlob(k, v);
+    front_->putTileLayerBlob(k, v);
+}
+
+void TieredCache::putTileLayerBlobs(std::vector<std::pair<MapTileKey, std::string>> const& blobs)
+{
+    std::unique_lock writeLock(writeMutex_);
+    back_->putTileLayerBlobs(blobs);
+    front_->putTileLayerBlobs(blobs);
+}
+
+void TieredCache::eraseTileLayerBlob(const MapTileKey& k)
+{
+    std::unique_lock writeLock(writeMutex_);
+    front_->eraseTileLayerBlob(k);
+    back_->eraseTileLayerBlob(k);
+}
+
+std::optional<std::string> TieredCache::getStringPoolBlob(std::string_view const& sourceNodeId)
+{
+    return back_->getStringPoolBlob(sourceNodeId);
+}
+
+void TieredCache::putStringPoolBlob(std::string_view const& sourceNodeId, std::string const& v)
+{
+    back_->putStringPoolBlob(sourceNodeId, v);
+    front_->putStringPoolBlob(sourceNodeId, v);
+}
+
+bool TieredCache::supportsStringPoolUpdates() const
+{
+    return back_->supportsStringPoolUpdates();
+}
+
+void TieredCache::appendStringPoolUpdateBlob(
+    std::string_view const& sourceNodeId,
+    simfil::StringId offset,
+    std::string const& v)
+{
+    back_->appendStringPoolUpdateBlob(sourceNodeId, offset, v);
+}
+
+std::vector<std::string> TieredCache::getStringPoolUpdateBlobs(std::string_view const& sourceNodeId)
+{
+    return back_->getStringPoolUpdateBlobs(sourceNodeId);
+}
+
+std::optional<std::string> TieredCache::getCompressionDictionaryBlob(std::string const& key)
+{
+    return back_->getCompressionDictionaryBlob(key);
+}
+
+void TieredCache::putCompressionDictionaryBlob(std::string const& key, std::string const& v)
+{
+    back_->putCompressionDictionaryBlob(key, v);
+}
+
+std::optional<std::string> TieredCache::getLocateIndexBlob(std::string const& key)
+{
+    return back_->getLocateIndexBlob(key);
+}
+
+void TieredCache::putLocateIndexBlobs(std::vector<std::pair<std::string, std::string>> const& blobs)
+{
+    back_->putLocateIndexBlobs(blobs);
+}
+
+nlohmann::json TieredCache::getStatistics() const
+{
+    auto result = Cache::getStatistics();
+    result["promoted-tiles"] = promotedTiles_.load();
+    result["front-tier"] = front_->getStatistics();
+    result["back-tier"] = back_->getStatistics();
+    return result;
+}
+
+}
@@ -0,0 +1,280 @@
+#include "tracing.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <random>
+
+namespace mapget
+{
+
+namespace
+{
+
+constexpr auto hexDigits = "0123456789abcdef";
+
+thread_local TraceContext currentTraceContext;
+
+/** Random lowercase hex id with the given number of digits, which is not all zeros. */
+std::string randomHexId(size_t numDigits)
+{
+    thread_local std::mt19937_64 generator{std::random_device{}()};
+
+    std::string result(numDigits, '0');
+    while (result.find_first_not_of('0') == std::string::npos) {
+        for (auto i = 0u; i < numDigits; i += 16) {
+            auto bits = generator();
+            for (auto j = i; j < std::min<size_t>(i + 16, numDigits); ++j, bits >>= 4)
+                result[j] = hexDigits[bits & 0xf];
+        }
+    }
+    return result;
+}
+
+bool isHexId(std::string_view value, size_t numDigits)
+{
+    return value.size() == numDigits &&
+        value.find_first_not_of(hexDigits) == std::string_view::npos &&
+        value.find_first_not_of('0') != std::string_view::npos;
+}
+
+uint64_t unixNanoFrom(std::chrono::system_clock::time_point time)
+{
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count());
+}
+
+}  // namespace
+
+bool TraceContext::isValid() const
+{
+    return isHexId(traceId_, 32) && isHexId(spanId_, 16);
+}
+
+std::string TraceContext::toTraceParent() const
+{
+    return "00-" + traceId_ + "-" + spanId_ + (sampled_ ? "-01" : "-00");
+}
+
+std::optional<TraceContext> TraceContext::fromTraceParent(std::string_view value)
+{
+    // Format: version-traceid-spanid-flags, e.g.
+    // 00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01
+    if (value.size() < 55 || value[2] != '-' || value[35] != '-' || value[52] != '-')
+        return {};
+    // Later versions may append fields, version ff is invalid.
+    auto version = value.substr(0, 2);
+    auto flags = value.substr(53, 2);
+    if (version.find_first_not_of(hexDigits) != std::string_view::npos || version == "ff")
+        return {};
+    if (value.size() > 55 && (version == "00" || value[55] != '-'))
+        return {};
+    if (flags.find_first_not_of(hexDigits) != std::string_view::npos)
+        return {};
+
+    TraceContext result;
+    result.traceId_ = std::string(value.substr(3, 32));
+    result.spanId_ = std::string(value.substr(36, 16));
+    result.sampled_ = std::stoi(std::string(flags), nullptr, 16) & 1;
+    if (!result.isValid())
+        return {};
+    return result;
+}
+
+TraceContext const& TraceContext::current()
+{
+    return currentTraceContext;
+}
+
+TraceScope::TraceScope(TraceContext context) : previous_(std::move(currentTraceContext))
+{
+    currentTraceContext = std::move(context);
+}
+
+TraceScope::~TraceScope()
+{
+    currentTraceContext = std::move(previous_);
+}
+
+Tracer& Tracer::instance()
+{
+    static Tracer tracer;
+    return tracer;
+}
+
+Tracer::Tracer()
+{
+    if (auto bufferSize = std::getenv("MAPGET_TRACE_BUFFER_SIZE"))
+        maxBufferedSpans_ = std::strtoull(bufferSize, nullptr, 10);
+}
+
+void Tracer::enable(size_t maxBufferedSpans)
+{
+    std::unique_lock lock(mutex_);
+    maxBufferedSpans_ = maxBufferedSpans;
+    while (spans_.size() > maxBufferedSpans_) {
+        spans_.pop_front();
+        ++numDroppedSpans_;
+    }
+}
+
+bool Tracer::isEnabled() const
+{
+    return maxBufferedSpans_ > 0;
+}
+
+void Tracer::record(SpanData span)
+{
+    std::unique_lock lock(mutex_);
+    if (maxBufferedSpans_ == 0)
+        return;
+    if (spans_.size() >= maxBufferedSpans_) {
+        spans_.pop_front();
+        ++numDroppedSpans_;
+    }
+    spans_.emplace_back(std::move(span));
+}
+
+std::vector<SpanData> Tracer::takeSpans()
+{
+    std::unique_lock lock(mutex_);
+    std::vector<SpanData> result(
+        std::make_move_iterator(spans_.begin()),
+        std::make_move_iterator(spans_.end()));
+    spans_.clear();
+    return result;
+}
+
+size_t Tracer::numDroppedSpans() const
+{
+    return numDroppedSpans_;
+}
+
+nlohmann::json Tracer::toOtlpJson(std::vector<SpanData> const& spans)
+{
+    auto spansJson = nlohmann::json::array();
+    for (auto const& span : spans) {
+        auto attributesJson = nlohmann::json::array();
+        for (auto const& [key, value] : span.attributes_) {
+            // OTLP/JSON encodes 64-bit integers as strings.
+            auto valueJson = std::holds_alternative<int64_t>(value) ?
+                nlohmann::json{{"intValue", std::to_string(std::get<int64_t>(value))}} :
+                nlohmann::json{{"stringValue", std::get<std::string>(value)}};
+            attributesJson.push_back({{"key", key}, {"value", std::move(valueJson)}});
+        }
+
+        auto spanJson = nlohmann::json{
+            {"traceId", span.context_.traceId_},
+            {"spanId", span.context_.spanId_},
+            {"name", span.name_},
+            {"kind", static_cast<int>(span.kind_)},
+            {"startTimeUnixNano", std::to_string(span.startTimeUnixNano_)},
+            {"endTimeUnixNano", std::to_string(span.endTimeUnixNano_)},
+            {"attributes", std::move(attributesJson)}};
+        if (!span.parentSpanId_.empty())
+            spanJson["parentSpanId"] = span.parentSpanId_;
+        if (span.error_)
+            spanJson["status"] = {{"code", 2}, {"message", *span.error_}};
+        spansJson.push_back(std::move(spanJson));
+    }
+
+    return {
+        {"resourceSpans",
+         nlohmann::json::array({{
+             {"resource",
+              {{"attributes",
+                nlohmann::json::array(
+                    {{{"key", "service.name"}, {"value", {{"stringValue", "mapget"}}}}})}}},
+             {"scopeSpans",
+              nlohmann::json::array({{{"scope", {{"name", "mapget"}}}, {"spans", std::move(spansJson)}}})},
+         }})}};
+}
+
+Span::Span(std::string name, TraceContext const& parent, SpanKind kind) : context_(parent)
+{
+    if (!Tracer::instance().isEnabled() || (parent.isValid() && !parent.sampled_))
+        return;
+
+    auto& data = data_.emplace();
+    if (parent.isValid()) {
+        data.context_.traceId_ = parent.traceId_;
+        data.parentSpanId_ = parent.spanId_;
+    }
+    else {
+        data.context_.traceId_ = randomHexId(32);
+    }
+    data.context_.spanId_ = randomHexId(16);
+    data.name_ = std::move(name);
+    data.kind_ = kind;
+    data.startTimeUnixNano_ = unixNanoFrom(std::chrono::system_clock::now());
+    context_ = data.context_;
+}
+
+Span::Span(Span&& other) noexcept : data_(std::move(other.data_)), context_(std::move(other.context_))
+{
+    other.data_.reset();
+}
+
+Span& Span::operator=(Span&& other) noexcept
+{
+    if (this != &other) {
+        end();
+        data_ = std::move(other.data_);
+        context_ = std::move(other.context_);
+        other.data_.reset();
+    }
+    return *this;
+}
+
+Span::~Span()
+{
+    end();
+}
+
+bool Span::isRecording() const
+{
+    return data_.has_value();
+}
+
+TraceContext const& Span::context() const
+{
+    return context_;
+}
+
+void Span::setStartTime(std::chrono::steady_clock::time_point start)
+{
+    if (!data_)
+        return;
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    data_->startTimeUnixNano_ = unixNanoFrom(
+        std::chrono::system_clock::now() -
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(elapsed));
+}
+
+void Span::setAttribute(std::string key, std::string value)
+{
+    if (data_)
+        data_->attributes_.emplace_back(std::move(key), std::move(value));
+}
+
+void Span::setAttribute(std::string key, int64_t value)
+{
+    if (data_)
+        data_->attributes_.emplace_back(std::move(key), value);
+}
+
+void Span::setError(std::string message)
+{
+    if (data_)
+        data_->error_ = std::move(message);
+}
+
+void Span::end()
+{
+    if (!data_)
+        return;
+    data_->endTimeUnixNano_ = unixNanoFrom(std::chrono::system_clock::now());
+    Tracer::instance().record(std::move(*data_));
+    data_.reset();
+}
+
+}  // namespace mapget
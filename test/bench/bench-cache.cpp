@@ -0,0 +1,242 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/generators/catch_generators.hpp>
+
+#include "bench-tiles.h"
+#include "mapget/model/stream.h"
+#include "mapget/service/compression.h"
+#include "mapget/service/memcache.h"
+#include "mapget/service/rocksdbcache.h"
+#include "mapget/service/tieredcache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <random>
+#include <thread>
+
+#include <fmt/format.h>
+
+using namespace mapget;
+using namespace mapget::bench;
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+/** Workload which drives the tile blob methods of a Cache from several threads. */
+struct CacheWorkload
+{
+    enum class Distribution { Uniform, Zipfian };
+
+    size_t numThreads_ = 4;
+    double readShare_ = .9;  // Share of the operations which are reads, the others are writes
+    Distribution distribution_ = Distribution::Uniform;
+    double zipfExponent_ = .99;
+    size_t numKeys_ = 4096;  // Keys which are put before the measurement, and then read and written
+    size_t blobBytes_ = 32 * 1024;
+    bool compressed_ = false;  // Whether blobs are compressed like Cache::setCompressionLevel() does
+    std::chrono::milliseconds duration_{1000};
+    uint32_t seed_ = 1;
+
+    [[nodiscard]] std::string toString() const
+    {
+        return fmt::format(
+            "{} threads, {:.0f}% reads, {} keys, {} KiB blobs{}",
+            numThreads_,
+            readShare_ * 100,
+            distribution_ == Distribution::Uniform ? "uniform" : fmt::format("zipf({})", zipfExponent_),
+            blobBytes_ / 1024,
+            compressed_ ? ", zstd" : "");
+    }
+};
+
+struct CacheWorkloadReport
+{
+    size_t reads_ = 0;
+    size_t hits_ = 0;
+    size_t writes_ = 0;
+    double seconds_ = 0;
+    std::vector<double> readLatenciesUs_;
+    std::vector<double> writeLatenciesUs_;
+
+    [[nodiscard]] std::string toString()
+    {
+        std::sort(readLatenciesUs_.begin(), readLatenciesUs_.end());
+        std::sort(writeLatenciesUs_.begin(), writeLatenciesUs_.end());
+        auto percentile = [](std::vector<double> const& values, double p)
+        {
+            return values.empty() ? 0. : values[std::min(values.size() - 1, static_cast<size_t>(p * values.size()))];
+        };
+        return fmt::format(
+            "{:.0f} ops/s, hit ratio {:.3f}, read p50/p99/p999 {:.1f}/{:.1f}/{:.1f} us, "
+            "write p50/p99/p999 {:.1f}/{:.1f}/{:.1f} us",
+            static_cast<double>(reads_ + writes_) / seconds_,
+            reads_ ? static_cast<double>(hits_) / static_cast<double>(reads_) : 0.,
+            percentile(readLatenciesUs_, .5),
+            percentile(readLatenciesUs_, .99),
+            percentile(readLatenciesUs_, .999),
+            percentile(writeLatenciesUs_, .5),
+            percentile(writeLatenciesUs_, .99),
+            percentile(writeLatenciesUs_, .999));
+    }
+};
+
+/** Key index generator for a workload, which draws Zipfian keys from their CDF. */
+class KeyDistribution
+{
+public:
+    explicit KeyDistribution(CacheWorkload const& workload) : numKeys_(workload.numKeys_)
+    {
+        if (workload.distribution_ == CacheWorkload::Distribution::Uniform)
+            return;
+        cdf_.reserve(numKeys_);
+        double sum = 0;
+        for (size_t rank = 1; rank <= numKeys_; ++rank)
+            cdf_.push_back(sum += 1. / std::pow(static_cast<double>(rank), workload.zipfExponent_));
+        for (auto& p : cdf_)
+            p /= sum;
+    }
+
+    size_t operator()(std::mt19937& random) const
+    {
+        auto u = std::uniform_real_distribution<double>(0., 1.)(random);
+        if (cdf_.empty())
+            return std::min(static_cast<size_t>(u * static_cast<double>(numKeys_)), numKeys_ - 1);
+        return std::min(static_cast<size_t>(std::lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin()), numKeys_ - 1);
+    }
+
+private:
+    size_t numKeys_;
+    std::vector<double> cdf_;
+};
+
+/**
+ * Blobs of serialized road tiles, truncated or repeated to the blob size,
+ * so that compressed caches see realistic contents.
+ */
+std::vector<std::string> generateBlobs(size_t blobBytes, size_t count)
+{
+    std::vector<std::string> result;
+    auto strings = std::make_shared<StringPool>("BenchNode");
+    for (uint32_t i = 0; i < count; ++i) {
+        std::string message;
+        TileLayerStream::StringPoolOffsetMap offsets;
+        TileLayerStream::Writer writer{[&](auto&& msg, auto&& type) {
+            if (type == TileLayerStream::MessageType::TileFeatureLayer)
+                message = msg;
+        }, offsets};
+        writer.write(generateTile(BenchTileId, 500, strings, i));
+        auto& blob = result.emplace_back();
+        while (blob.size() < blobBytes)
+            blob += message;
+        blob.resize(blobBytes);
+    }
+    return result;
+}
+
+MapTileKey benchKey(size_t index)
+{
+    MapTileKey key;
+    key.mapId_ = "BenchMap";
+    key.layerId_ = "Roads";
+    key.tileId_ = TileId(static_cast<uint64_t>(index + 1));
+    return key;
+}
+
+CacheWorkloadReport runCacheWorkload(Cache& cache, CacheWorkload const& workload)
+{
+    auto const blobs = generateBlobs(workload.blobBytes_, 8);
+    std::unique_ptr<TileBlobCompression> compression;
+    if (workload.compressed_)
+        compression = std::make_unique<TileBlobCompression>(3, [](auto&&) { return std::nullopt; }, [](auto&&, auto&&) {});
+    auto encode = [&](MapTileKey const& key, std::string const& blob)
+    { return compression ? compression->compress(key, blob) : blob; };
+
+    std::vector<MapTileKey> keys;
+    for (size_t i = 0; i < workload.numKeys_; ++i) {
+        keys.push_back(benchKey(i));
+        cache.putTileLayerBlob(keys.back(), encode(keys.back(), blobs[i % blobs.size()]));
+    }
+
+    KeyDistribution keyDistribution(workload);
+    std::vector<CacheWorkloadReport> threadReports(workload.numThreads_);
+    std::vector<std::thread> threads;
+    auto const start = Clock::now();
+    auto const end = start + workload.duration_;
+    for (size_t t = 0; t < workload.numThreads_; ++t) {
+        threads.emplace_back([&, t]
+        {
+            auto& report = threadReports[t];
+            std::mt19937 random(workload.seed_ + static_cast<uint32_t>(t));
+            std::uniform_real_distribution<double> unit(0., 1.);
+            while (Clock::now() < end) {
+                auto index = keyDistribution(random);
+                auto const& key = keys[index];
+                auto opStart = Clock::now();
+                if (unit(random) < workload.readShare_) {
+                    auto blob = cache.getSharedTileLayerBlob(key);
+                    if (blob && compression)
+                        blob = compression->decompress(key, blob);
+                    report.readLatenciesUs_.push_back(
+                        std::chrono::duration<double, std::micro>(Clock::now() - opStart).count());
+                    ++report.reads_;
+                    report.hits_ += blob ? 1 : 0;
+                }
+                else {
+                    cache.putTileLayerBlob(key, encode(key, blobs[(index + report.writes_) % blobs.size()]));
+                    report.writeLatenciesUs_.push_back(
+                        std::chrono::duration<double, std::micro>(Clock::now() - opStart).count());
+                    ++report.writes_;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    CacheWorkloadReport result;
+    result.seconds_ = std::chrono::duration<double>(Clock::now() - start).count();
+    for (auto& report : threadReports) {
+        result.reads_ += report.reads_;
+        result.hits_ += report.hits_;
+        result.writes_ += report.writes_;
+        result.readLatenciesUs_.insert(result.readLatenciesUs_.end(), report.readLatenciesUs_.begin(), report.readLatenciesUs_.end());
+        result.writeLatenciesUs_.insert(result.writeLatenciesUs_.end(), report.writeLatenciesUs_.begin(), report.writeLatenciesUs_.end());
+    }
+    return result;
+}
+
+}  // namespace
+
+TEST_CASE("Cache workloads", "[bench.cache]")
+{
+    // The caches hold half of the keys, so that the key
+    // distribution decides about the hit ratio.
+    CacheWorkload workload;
+    auto const capacity = static_cast<uint32_t>(workload.numKeys_ / 2);
+    auto const rocksDbPath = (std::filesystem::temp_directory_path() / "mapget-bench-cache").string();
+
+    auto cacheType = GENERATE(as<std::string>(), "memory", "rocksdb", "tiered");
+    workload.numThreads_ = GENERATE(1, 8);
+    workload.readShare_ = GENERATE(.95, .5);
+    workload.distribution_ = GENERATE(CacheWorkload::Distribution::Uniform, CacheWorkload::Distribution::Zipfian);
+    workload.compressed_ = GENERATE(false, true);
+
+    Cache::Ptr cache;
+    if (cacheType == "memory")
+        cache = std::make_shared<MemCache>(capacity);
+    else if (cacheType == "rocksdb")
+        cache = std::make_shared<RocksDBCache>(capacity, rocksDbPath, true);
+    else
+        cache = std::make_shared<TieredCache>(
+            std::make_shared<MemCache>(capacity / 8),
+            std::make_shared<RocksDBCache>(capacity, rocksDbPath, true));
+
+    auto report = runCacheWorkload(*cache, workload);
+    fmt::print("{} cache, {}: {}\n", cacheType, workload.toString(), report.toString());
+    REQUIRE(report.reads_ + report.writes_ > 0);
+
+    cache.reset();
+    std::filesystem::remove_all(rocksDbPath);
+}
@@ -0,0 +1,184 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "bench-tiles.h"
+#include "mapget/model/stream.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+
+#include <fmt/format.h>
+#include <zstd.h>
+
+using namespace mapget;
+using namespace mapget::bench;
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+/** zstd levels at which the encoded tiles are compressed. */
+constexpr int CompressionLevels[] = {1, 3, 19};
+
+/** Encoding of a tile, and the decoding of its bytes, which returns the number of features. */
+struct TileFormat
+{
+    std::string name_;
+    std::function<std::string(TileFeatureLayer::Ptr const&)> encode_;
+    std::function<size_t(std::string const&)> decode_;
+};
+
+std::string writeTile(TileFeatureLayer::Ptr const& tile, bool compactGeometry)
+{
+    std::string result;
+    TileLayerStream::StringPoolOffsetMap stringOffsets;
+    TileLayerStream::Writer writer{[&](auto&& msg, auto&&) { result += msg; }, stringOffsets};
+    if (compactGeometry)
+        writer.setProtocolVersion(TileLayerStream::CompactGeometryProtocolVersion);
+    writer.write(tile);
+    return result;
+}
+
+size_t readTile(std::string const& bytes)
+{
+    size_t numFeatures = 0;
+    TileLayerStream::Reader reader{
+        [](auto&&, auto&&) { return roadLayerInfo(); },
+        [&](auto&& layer)
+        {
+            if (auto featureLayer = std::dynamic_pointer_cast<TileFeatureLayer>(layer))
+                numFeatures += featureLayer->size();
+        }};
+    reader.read(bytes);
+    return numFeatures;
+}
+
+// Number of features of a decoded JSON FeatureCollection.
+size_t countFeatures(nlohmann::json const& json)
+{
+    return json["features"].size();
+}
+
+std::vector<TileFormat> tileFormats()
+{
+    return {
+        {"simfil", [](auto&& tile) { return writeTile(tile, false); }, readTile},
+        {"simfil-quantized", [](auto&& tile) { return writeTile(tile, true); }, readTile},
+        {"json",
+         [](auto&& tile)
+         {
+             std::string result;
+             tile->writeJson(result);
+             return result;
+         },
+         [](auto&& bytes) { return countFeatures(nlohmann::json::parse(bytes)); }},
+        {"geojson",
+         [](auto&& tile)
+         {
+             std::string result;
+             tile->writeJson(result, JsonLayout::GeoJson);
+             return result;
+         },
+         [](auto&& bytes) { return countFeatures(nlohmann::json::parse(bytes)); }},
+        {"msgpack",
+         [](auto&& tile)
+         {
+             auto bytes = nlohmann::json::to_msgpack(tile->toJson());
+             return std::string(bytes.begin(), bytes.end());
+         },
+         [](auto&& bytes) { return countFeatures(nlohmann::json::from_msgpack(bytes)); }},
+        {"cbor",
+         [](auto&& tile)
+         {
+             auto bytes = nlohmann::json::to_cbor(tile->toJson());
+             return std::string(bytes.begin(), bytes.end());
+         },
+         [](auto&& bytes) { return countFeatures(nlohmann::json::from_cbor(bytes)); }},
+        {"bson",
+         [](auto&& tile)
+         {
+             auto bytes = nlohmann::json::to_bson(tile->toJson());
+             return std::string(bytes.begin(), bytes.end());
+         },
+         [](auto&& bytes) { return countFeatures(nlohmann::json::from_bson(bytes)); }},
+    };
+}
+
+/** Seconds per call of a function, which is repeated for at least 200 ms and three times. */
+double measure(std::function<void()> const& fun)
+{
+    size_t calls = 0;
+    auto const start = Clock::now();
+    auto elapsed = Clock::duration::zero();
+    while (calls < 3 || elapsed < std::chrono::milliseconds(200)) {
+        fun();
+        ++calls;
+        elapsed = Clock::now() - start;
+    }
+    return std::chrono::duration<double>(elapsed).count() / static_cast<double>(calls);
+}
+
+std::string zstdCompress(std::string const& bytes, int level)
+{
+    std::string result(ZSTD_compressBound(bytes.size()), '\0');
+    auto size = ZSTD_compress(result.data(), result.size(), bytes.data(), bytes.size(), level);
+    REQUIRE(!ZSTD_isError(size));
+    result.resize(size);
+    return result;
+}
+
+size_t zstdDecompress(std::string const& compressed, size_t size)
+{
+    std::string result(size, '\0');
+    return ZSTD_decompress(result.data(), result.size(), compressed.data(), compressed.size());
+}
+
+double megabytesPerSecond(size_t bytes, double seconds)
+{
+    return static_cast<double>(bytes) / 1e6 / seconds;
+}
+
+}  // namespace
+
+TEST_CASE("Tile formats", "[bench.formats]")
+{
+    // One JSON record per corpus tile and format is printed, and written
+    // to MAPGET_BENCH_FORMATS_REPORT, default bench-formats.jsonl.
+    auto reportPath = std::getenv("MAPGET_BENCH_FORMATS_REPORT");
+    std::ofstream report(reportPath ? reportPath : "bench-formats.jsonl");
+    REQUIRE(report);
+
+    for (auto numFeatures : {100, 1000, 5000}) {
+        auto tile = generateTile(BenchTileId, numFeatures);
+        for (auto const& format : tileFormats()) {
+            auto bytes = format.encode_(tile);
+            REQUIRE(format.decode_(bytes) == tile->size());
+
+            nlohmann::json record{
+                {"corpus", fmt::format("roads-{}", numFeatures)},
+                {"features", tile->size()},
+                {"format", format.name_},
+                {"bytes", bytes.size()},
+                {"encode-mb-per-s", megabytesPerSecond(bytes.size(), measure([&] { format.encode_(tile); }))},
+                {"decode-mb-per-s", megabytesPerSecond(bytes.size(), measure([&] { format.decode_(bytes); }))}};
+
+            for (auto level : CompressionLevels) {
+                auto compressed = zstdCompress(bytes, level);
+                REQUIRE(zstdDecompress(compressed, bytes.size()) == bytes.size());
+                auto prefix = fmt::format("zstd-{}-", level);
+                record[prefix + "bytes"] = compressed.size();
+                record[prefix + "ratio"] = static_cast<double>(bytes.size()) / static_cast<double>(compressed.size());
+                record[prefix + "compress-mb-per-s"] = megabytesPerSecond(
+                    bytes.size(), measure([&] { zstdCompress(bytes, level); }));
+                record[prefix + "decompress-mb-per-s"] = megabytesPerSecond(
+                    bytes.size(), measure([&] { zstdDecompress(compressed, bytes.size()); }));
+            }
+
+            auto line = record.dump();
+            fmt::print("{}\n", line);
+            report << line << "\n";
+        }
+    }
+}
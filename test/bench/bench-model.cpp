@@ -0,0 +1,167 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+
+#include "bench-tiles.h"
+#include "mapget/model/simfil-geometry.h"
+
+using namespace mapget;
+using namespace mapget::bench;
+
+TEST_CASE("Build tiles", "[bench.model]")
+{
+    auto batch = generateRoads(BenchTileId, 5000);
+
+    BENCHMARK("newFeature() for 5000 roads")
+    {
+        auto strings = std::make_shared<StringPool>("BenchNode");
+        auto tile = std::make_shared<TileFeatureLayer>(BenchTileId, "BenchNode", "BenchMap", roadLayerInfo(), strings);
+        auto const& ids = std::get<std::vector<int64_t>>(batch.idParts_[0].second);
+        std::vector<Point> points;
+        for (size_t i = 0; i < ids.size(); ++i) {
+            auto feature = tile->newFeature("Road", {{"roadId", ids[i]}});
+            points.clear();
+            for (auto p = batch.geometryOffsets_[i]; p < batch.geometryOffsets_[i + 1]; ++p)
+                points.emplace_back(batch.coordinates_[3 * p], batch.coordinates_[3 * p + 1]);
+            feature->addLine(points);
+            feature->attributes()->addField("name", std::string_view(std::get<std::vector<std::string>>(batch.attributes_[0].second)[i]));
+            feature->attributes()->addField("lanes", std::get<std::vector<int64_t>>(batch.attributes_[1].second)[i]);
+        }
+        return tile;
+    };
+
+    BENCHMARK("newFeatures() for 5000 roads")
+    {
+        auto strings = std::make_shared<StringPool>("BenchNode");
+        auto tile = std::make_shared<TileFeatureLayer>(BenchTileId, "BenchNode", "BenchMap", roadLayerInfo(), strings);
+        tile->newFeatures(batch);
+        return tile;
+    };
+}
+
+TEST_CASE("Find features", "[bench.model]")
+{
+    auto tile = generateTile(BenchTileId, 5000);
+    std::vector<std::string> ids;
+    for (auto i = 0; i < 5000; i += 7)
+        ids.push_back(fmt::format("Road.{}", i));
+
+    BENCHMARK("find() by id string")
+    {
+        size_t found = 0;
+        for (auto const& id : ids)
+            found += tile->find(id) ? 1 : 0;
+        return found;
+    };
+
+    BENCHMARK("find() by id parts")
+    {
+        size_t found = 0;
+        for (int64_t i = 0; i < 5000; i += 7)
+            found += tile->find("Road", KeyValueViewPairs{{"roadId", i}}) ? 1 : 0;
+        return found;
+    };
+
+    tile->setReadOnly();
+    auto const sw = BenchTileId.sw();
+    auto const ne = BenchTileId.ne();
+    Point const center = (sw + ne) * .5;
+    BENCHMARK("findIntersecting() a quarter of the tile")
+    {
+        return tile->findIntersecting(sw, center).size();
+    };
+}
+
+TEST_CASE("Evaluate queries", "[bench.model]")
+{
+    auto tile = generateTile(BenchTileId, 2000);
+    std::vector<model_ptr<Feature>> features;
+    for (auto const& feature : *tile)
+        features.push_back(feature);
+
+    Point const center = (BenchTileId.sw() + BenchTileId.ne()) * .5;
+    auto const bboxQuery = fmt::format(
+        "any(geo() within bbox({}, {}, {}, {}))",
+        BenchTileId.sw().x, BenchTileId.sw().y, center.x, center.y);
+
+    for (auto const& query : {
+             std::string("properties.lanes > 2"),
+             std::string("properties.surface == \"gravel\" and properties.speedLimit >= 60"),
+             std::string("**.name == \"Road 42\""),
+             bboxQuery}) {
+        BENCHMARK("evaluate() " + query)
+        {
+            size_t matches = 0;
+            for (auto& feature : features)
+                matches += feature->evaluate(query).toString() == "true" ? 1 : 0;
+            return matches;
+        };
+    }
+}
+
+TEST_CASE("Merge add-on tiles", "[bench.model]")
+{
+    // The add-on tile has the same features, with its own attributes
+    // and geometries, and a string pool of its own.
+    auto addOnTile = generateTile(BenchTileId, 2000, std::make_shared<StringPool>("AddOnNode"), 7);
+
+    BENCHMARK_ADVANCED("clone() 2000 add-on features into a tile")(Catch::Benchmark::Chronometer meter)
+    {
+        std::vector<TileFeatureLayer::Ptr> tiles;
+        for (auto i = 0; i < meter.runs(); ++i)
+            tiles.push_back(generateTile(BenchTileId, 2000));
+        meter.measure([&](int run)
+        {
+            auto& tile = tiles[run];
+            TileFeatureLayer::ClonedNodes clonedNodes;
+            for (auto const& feature : *addOnTile)
+                tile->clone(clonedNodes, addOnTile, *feature, feature->id()->typeId(), feature->id()->keyValuePairs());
+            return tile->size();
+        });
+    };
+}
+
+TEST_CASE("Geometry predicates", "[bench.model]")
+{
+    auto tile = generateTile(BenchTileId, 2000);
+    std::vector<LineString> lines;
+    for (auto const& feature : *tile)
+        lines.push_back({feature->firstGeometry().points_});
+
+    auto const sw = BenchTileId.sw();
+    auto const ne = BenchTileId.ne();
+    Point const center = (sw + ne) * .5;
+    BBox const bbox{sw, center};
+    Polygon const polygon{{LineString{{sw, {center.x, sw.y}, center, {sw.x, center.y}, sw}}}};
+
+    BENCHMARK("BBox::intersects() of 2000 lines")
+    {
+        size_t result = 0;
+        for (auto const& line : lines)
+            result += bbox.intersects(line) ? 1 : 0;
+        return result;
+    };
+
+    BENCHMARK("LineString::intersects() of 2000 line pairs")
+    {
+        size_t result = 0;
+        for (size_t i = 1; i < lines.size(); ++i)
+            result += lines[i - 1].intersects(lines[i]) ? 1 : 0;
+        return result;
+    };
+
+    BENCHMARK("Polygon::contains() of 2000 lines")
+    {
+        size_t result = 0;
+        for (auto const& line : lines)
+            result += polygon.contains(line) ? 1 : 0;
+        return result;
+    };
+
+    std::vector<Point> points;
+    for (auto const& line : lines)
+        points.insert(points.end(), line.points.begin(), line.points.end());
+    BENCHMARK("Polygon::contains() of all points at once")
+    {
+        return polygon.contains(points);
+    };
+}
@@ -0,0 +1,69 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+
+#include "bench-tiles.h"
+#include "mapget/model/stream.h"
+
+using namespace mapget;
+using namespace mapget::bench;
+
+namespace
+{
+
+// Serialize tiles with a fresh writer, so that each stream has the string pool.
+std::string writeTiles(std::vector<TileFeatureLayer::Ptr> const& tiles)
+{
+    std::string result;
+    TileLayerStream::StringPoolOffsetMap stringOffsets;
+    TileLayerStream::Writer writer{[&](auto&& msg, auto&&) { result += msg; }, stringOffsets};
+    for (auto const& tile : tiles)
+        writer.write(tile);
+    return result;
+}
+
+}
+
+TEST_CASE("Stream tiles", "[bench.stream]")
+{
+    // Neighbouring tiles of one source share its string pool.
+    auto strings = std::make_shared<StringPool>("BenchNode");
+    std::vector<TileFeatureLayer::Ptr> tiles;
+    for (uint32_t i = 0; i < 4; ++i)
+        tiles.push_back(generateTile(BenchTileId, 5000, strings, i));
+    auto bytes = writeTiles(tiles);
+
+    BENCHMARK("Writer::write() 4 tiles of 5000 roads")
+    {
+        return writeTiles(tiles).size();
+    };
+
+    BENCHMARK("Reader::read() 4 tiles of 5000 roads")
+    {
+        size_t numFeatures = 0;
+        TileLayerStream::Reader reader{
+            [](auto&&, auto&&) { return roadLayerInfo(); },
+            [&](auto&& layer)
+            {
+                if (auto featureLayer = std::dynamic_pointer_cast<TileFeatureLayer>(layer))
+                    numFeatures += featureLayer->size();
+            }};
+        reader.read(bytes);
+        return numFeatures;
+    };
+
+    BENCHMARK("Writer and Reader round trip in 64 KiB chunks")
+    {
+        size_t numFeatures = 0;
+        TileLayerStream::Reader reader{
+            [](auto&&, auto&&) { return roadLayerInfo(); },
+            [&](auto&& layer)
+            {
+                if (auto featureLayer = std::dynamic_pointer_cast<TileFeatureLayer>(layer))
+                    numFeatures += featureLayer->size();
+            }};
+        auto written = writeTiles(tiles);
+        for (size_t offset = 0; offset < written.size(); offset += 65536)
+            reader.read(std::string_view(written).substr(offset, 65536));
+        return numFeatures;
+    };
+}
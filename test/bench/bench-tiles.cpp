@@ -0,0 +1,88 @@
+#include "bench-tiles.h"
+
+#include <algorithm>
+#include <random>
+
+#include <fmt/format.h>
+
+namespace mapget::bench
+{
+
+std::shared_ptr<LayerInfo> roadLayerInfo()
+{
+    static auto info = LayerInfo::fromJson(R"({
+        "layerId": "Roads",
+        "type": "Features",
+        "featureTypes": [
+            {
+                "name": "Road",
+                "uniqueIdCompositions": [[
+                    {
+                        "partId": "roadId",
+                        "description": "Id of the road within its tile.",
+                        "datatype": "U32"
+                    }
+                ]]
+            }
+        ]
+    })"_json);
+    return info;
+}
+
+TileFeatureLayer::FeatureBatch generateRoads(TileId tileId, size_t numFeatures, uint32_t seed)
+{
+    static std::vector<std::string> const surfaces = {"asphalt", "concrete", "gravel", "cobblestone"};
+
+    std::mt19937 random(seed);
+    auto const sw = tileId.sw();
+    auto const ne = tileId.ne();
+    std::uniform_real_distribution<double> longitude(sw.x, ne.x);
+    std::uniform_real_distribution<double> latitude(sw.y, ne.y);
+    std::uniform_real_distribution<double> step(-(ne.x - sw.x) / 100., (ne.x - sw.x) / 100.);
+    std::uniform_int_distribution<uint32_t> numPoints(8, 24);
+    std::uniform_int_distribution<int64_t> lanes(1, 4);
+
+    TileFeatureLayer::FeatureBatch batch;
+    batch.typeIds_ = {"Road"};
+    std::vector<int64_t> roadIds, laneCounts, speedLimits;
+    std::vector<std::string> names, roadSurfaces;
+    batch.geometryOffsets_.push_back(0);
+    for (size_t i = 0; i < numFeatures; ++i) {
+        roadIds.push_back(static_cast<int64_t>(i));
+        laneCounts.push_back(lanes(random));
+        speedLimits.push_back(30 + 10 * (laneCounts.back() + static_cast<int64_t>(random() % 6)));
+        names.push_back(fmt::format("Road {}", i % 500));
+        roadSurfaces.push_back(surfaces[random() % surfaces.size()]);
+
+        auto x = longitude(random);
+        auto y = latitude(random);
+        auto n = numPoints(random);
+        for (uint32_t p = 0; p < n; ++p) {
+            batch.coordinates_.insert(batch.coordinates_.end(), {x, y, 0.});
+            x = std::clamp(x + step(random), sw.x, ne.x);
+            y = std::clamp(y + step(random), sw.y, ne.y);
+        }
+        batch.geometryOffsets_.push_back(batch.geometryOffsets_.back() + n);
+    }
+    batch.idParts_.emplace_back("roadId", std::move(roadIds));
+    batch.attributes_.emplace_back("name", std::move(names));
+    batch.attributes_.emplace_back("lanes", std::move(laneCounts));
+    batch.attributes_.emplace_back("speedLimit", std::move(speedLimits));
+    batch.attributes_.emplace_back("surface", std::move(roadSurfaces));
+    return batch;
+}
+
+TileFeatureLayer::Ptr generateTile(
+    TileId tileId,
+    size_t numFeatures,
+    std::shared_ptr<StringPool> strings,
+    uint32_t seed)
+{
+    if (!strings)
+        strings = std::make_shared<StringPool>("BenchNode");
+    auto tile = std::make_shared<TileFeatureLayer>(tileId, strings->nodeId_, "BenchMap", roadLayerInfo(), strings);
+    tile->newFeatures(generateRoads(tileId, numFeatures, seed));
+    return tile;
+}
+
+}
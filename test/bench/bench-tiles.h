@@ -0,0 +1,28 @@
+#pragma once
+
+#include "mapget/model/featurelayer.h"
+
+namespace mapget::bench
+{
+
+/** Layer info of generated tiles, with one Road type identified by a roadId. */
+std::shared_ptr<LayerInfo> roadLayerInfo();
+
+/**
+ * Columns of a tile of roads with realistic sizes: every road has a line
+ * of 8 to 24 points within the tile, a name, lane count, speed limit
+ * and surface attribute. The tile is the same for the same seed.
+ */
+TileFeatureLayer::FeatureBatch generateRoads(TileId tileId, size_t numFeatures, uint32_t seed = 42);
+
+/** Create a tile and fill it with generateRoads(). */
+TileFeatureLayer::Ptr generateTile(
+    TileId tileId,
+    size_t numFeatures,
+    std::shared_ptr<StringPool> strings = nullptr,
+    uint32_t seed = 42);
+
+/** Tile of the benchmarks, which is a zoom level 13 tile in Munich. */
+inline TileId const BenchTileId = TileId::fromWgs84(11.57, 48.14, 13);
+
+}
@@ -3,17 +3,96 @@
 #include <bitsery/adapter/stream.h>
 
 #include <catch2/catch_test_macros.hpp>
+#include <atomic>
 #include <chrono>
+#include <filesystem>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
+#include "httplib.h"
 #include "mapget/http-service/cli.h"
+#include "mapget/http-service/remote-cache.h"
 #include "mapget/log.h"
 #include "mapget/model/featurelayer.h"
 #include "mapget/model/info.h"
+#include "mapget/service/archive.h"
+#include "mapget/service/memcache.h"
+#include "mapget/service/memory.h"
 #include "mapget/service/rocksdbcache.h"
+#include "mapget/service/service.h"
+#include "mapget/service/tieredcache.h"
 
 using namespace mapget;
 
+namespace
+{
+
+// MemCache which keeps the compression dictionaries, like a persistent cache.
+struct DictionaryMemCache : public MemCache
+{
+    std::optional<std::string> getCompressionDictionaryBlob(std::string const& key) override
+    {
+        std::unique_lock lock(mutex_);
+        if (auto it = dictionaries_.find(key); it != dictionaries_.end())
+            return it->second;
+        return {};
+    }
+
+    void putCompressionDictionaryBlob(std::string const& key, std::string const& v) override
+    {
+        std::unique_lock lock(mutex_);
+        dictionaries_.emplace(key, v);
+    }
+
+    std::mutex mutex_;
+    std::map<std::string, std::string> dictionaries_;
+};
+
+// Info of a test data source, whose layers have a Way feature type with a wayId.
+DataSourceInfo makeTestInfo(
+    std::string const& nodeId,
+    std::string const& mapId,
+    std::vector<std::string> const& layerIds = {"WayLayer"})
+{
+    auto layers = nlohmann::json::object();
+    for (auto const& layerId : layerIds) {
+        layers[layerId] = nlohmann::json::parse(R"({
+            "featureTypes": [
+                {
+                    "name": "Way",
+                    "uniqueIdCompositions": [[{"partId": "wayId", "datatype": "U32"}]]
+                }
+            ]
+        })");
+    }
+    return DataSourceInfo::fromJson({{"nodeId", nodeId}, {"mapId", mapId}, {"layers", layers}});
+}
+
+// Tile of a test data source with numWays ways, whose ids count up from firstWayId.
+// Tiles without a string pool get their own one.
+TileFeatureLayer::Ptr makeTestTile(
+    DataSourceInfo const& info,
+    TileId tileId,
+    int64_t numWays = 0,
+    int64_t firstWayId = 0,
+    std::string const& layerId = "WayLayer",
+    std::shared_ptr<StringPool> strings = {})
+{
+    if (!strings)
+        strings = std::make_shared<StringPool>(info.nodeId_);
+    auto tile = std::make_shared<TileFeatureLayer>(
+        tileId, info.nodeId_, info.mapId_, info.getLayer(layerId), std::move(strings));
+    for (auto i = 0; i < numWays; ++i)
+        tile->newFeature("Way", {{"wayId", firstWayId + i}});
+    return tile;
+}
+
+}  // namespace
+
 TEST_CASE("RocksDBCache", "[Cache]")
 {
     mapget::setLogLevel("trace", log());
@@ -181,9 +260,11 @@ TEST_CASE("RocksDBCache", "[Cache]")
     SECTION("Store another tile at unlimited cache size") {
         auto cache = std::make_shared<mapget::RocksDBCache>(
             0, "mapget-cache", false);
+        REQUIRE(cache->getStatistics()["rocksdb-tiles"] == 1);
 
         // Insert another tile for the next test.
         cache->putTileLayer(tile);
+        REQUIRE(cache->getStatistics()["rocksdb-tiles"] == 2);
 
         // Make sure the previous tile is still there, since cache is unlimited.
         auto olderTile = cache->getTileLayer(otherTile->id(), otherInfo);
@@ -228,6 +309,57 @@ TEST_CASE("RocksDBCache", "[Cache]")
         REQUIRE(returnedEntry.value() == serializedMessage.str());
     }
 
+    SECTION("Tiles of one node are put concurrently") {
+        {
+            auto cache = std::make_shared<mapget::RocksDBCache>(0, "mapget-cache", true);
+            std::vector<std::thread> writers;
+            for (auto i = 0; i < 4; ++i) {
+                writers.emplace_back([&, i]() {
+                    auto concurrentTile = std::make_shared<TileFeatureLayer>(
+                        TileId::fromWgs84(42., 11. + i, 13), nodeId, mapId, layerInfo, strings);
+                    concurrentTile->newFeature("Way", {{"areaId", fmt::format("ConcurrentArea{}", i)}, {"wayId", i}});
+                    cache->putTileLayer(concurrentTile);
+                });
+            }
+            for (auto& writer : writers)
+                writer.join();
+        }
+
+        // The cached string pool covers the strings of all tiles.
+        auto cache = std::make_shared<mapget::RocksDBCache>(0, "mapget-cache", false);
+        REQUIRE(cache->getStringPool(nodeId)->highest() == strings->highest());
+        for (auto i = 0; i < 4; ++i) {
+            auto returnedTile = getFeatureLayer(cache, TileId::fromWgs84(42., 11. + i, 13), info);
+            REQUIRE(returnedTile->size() == 1);
+        }
+    }
+
+    SECTION("New strings are appended as string pool updates") {
+        {
+            auto cache = std::make_shared<mapget::RocksDBCache>(0, "mapget-cache", true);
+            tile->newFeature("Way", {{"areaId", "FirstArea"}, {"wayId", 1}});
+            cache->putTileLayer(tile);
+            REQUIRE(cache->getStringPoolUpdateBlobs(nodeId).empty());
+
+            tile->newFeature("Way", {{"areaId", "SecondArea"}, {"wayId", 2}});
+            cache->putTileLayer(tile);
+            REQUIRE(cache->getStringPoolUpdateBlobs(nodeId).size() == 1);
+
+            // Tiles without new strings do not add updates.
+            cache->putTileLayer(tile);
+            REQUIRE(cache->getStringPoolUpdateBlobs(nodeId).size() == 1);
+        }
+
+        // The updates are replayed onto the cached string pool.
+        auto cache = std::make_shared<mapget::RocksDBCache>(0, "mapget-cache", false);
+        REQUIRE(cache->getStringPool(nodeId)->highest() == strings->highest());
+        REQUIRE(getFeatureLayer(cache, tile->id(), info)->size() == 2);
+
+        // Writing the whole pool drops the updates.
+        cache->putStringPoolBlob(nodeId, *cache->getStringPoolBlob(nodeId));
+        REQUIRE(cache->getStringPoolUpdateBlobs(nodeId).empty());
+    }
+
     SECTION("Create cache under a custom path") {
         auto now = std::chrono::system_clock::now();
         auto epoch_time = std::chrono::system_clock::to_time_t(now);
@@ -247,4 +379,675 @@ TEST_CASE("RocksDBCache", "[Cache]")
             1024, test_cache.string(), true);
         REQUIRE(std::filesystem::exists(test_cache));
     }
+
+    SECTION("Oldest tiles are evicted in chunks") {
+        auto cache = std::make_shared<mapget::RocksDBCache>(32, "mapget-cache", true);
+        auto tileKey = [](uint16_t x) {
+            MapTileKey result;
+            result.mapId_ = "CacheMe";
+            result.layerId_ = "WayLayer";
+            result.tileId_ = TileId(x, 0, 5);
+            return result;
+        };
+
+        for (uint16_t x = 0; x < 32; ++x)
+            cache->putTileLayerBlob(tileKey(x), "tile");
+        cache->putTileLayerBlob(tileKey(0), "updated tile");
+        REQUIRE(cache->getStatistics()["rocksdb-tiles"] == 32);
+
+        // Exceeding the limit evicts the oldest tiles, and two more.
+        cache->putTileLayerBlob(tileKey(32), "tile");
+        REQUIRE(cache->getStatistics()["rocksdb-tiles"] == 30);
+        for (uint16_t x = 1; x <= 3; ++x)
+            REQUIRE(!cache->getTileLayerBlob(tileKey(x)));
+        REQUIRE(cache->getTileLayerBlob(tileKey(4)) == "tile");
+        REQUIRE(cache->getTileLayerBlob(tileKey(0)) == "updated tile");
+    }
+}
+
+TEST_CASE("LiveTiles", "[Cache]")
+{
+    auto info = makeTestInfo("LiveTestingNode", "LiveMap");
+    auto makeTile = [&info](TileId tileId) { return makeTestTile(info, tileId); };
+
+    SECTION("Hot tiles are returned without parsing") {
+        auto cache = std::make_shared<MemCache>();
+        auto tile = makeTile(TileId(1, 2, 3));
+        cache->putTileLayer(tile);
+
+        auto first = cache->getTileLayer(tile->id(), info);
+        auto second = cache->getTileLayer(tile->id(), info);
+        REQUIRE(!!first);
+        REQUIRE(first == second);
+        REQUIRE(cache->getStatistics()["live-tile-hits"] == 1);
+        REQUIRE(cache->getStatistics()["cache-hits"] == 2);
+
+        // Shared layers are read-only, the layer which was put is not.
+        REQUIRE(first->isReadOnly());
+        REQUIRE_THROWS(first->setError("Modified"));
+        REQUIRE(!tile->isReadOnly());
+
+        // Putting a tile again replaces its live object.
+        cache->putTileLayer(tile);
+        auto updated = cache->getTileLayer(tile->id(), info);
+        REQUIRE(!!updated);
+        REQUIRE(updated != first);
+    }
+
+    SECTION("Evicted tiles leave the live tier") {
+        auto cache = std::make_shared<MemCache>(1);
+        auto tile = makeTile(TileId(1, 2, 3));
+        auto otherTile = makeTile(TileId(2, 2, 3));
+        cache->putTileLayer(tile);
+        REQUIRE(!!cache->getTileLayer(tile->id(), info));
+        REQUIRE(cache->getStatistics()["live-tiles"] == 1);
+
+        cache->putTileLayer(otherTile);
+        REQUIRE(cache->getStatistics()["live-tiles"] == 0);
+        REQUIRE(!cache->getTileLayer(tile->id(), info));
+    }
+
+    SECTION("The live tier can be disabled") {
+        auto cache = std::make_shared<MemCache>();
+        cache->setMaxLiveTileBytes(0);
+        auto tile = makeTile(TileId(1, 2, 3));
+        cache->putTileLayer(tile);
+
+        auto first = cache->getTileLayer(tile->id(), info);
+        auto second = cache->getTileLayer(tile->id(), info);
+        REQUIRE(first != second);
+        REQUIRE(cache->getStatistics()["live-tiles"] == 0);
+        REQUIRE(cache->getStatistics()["live-tile-bytes"] == 0);
+    }
+}
+
+TEST_CASE("TileExpiry", "[Cache]")
+{
+    auto info = makeTestInfo("ExpiryTestingNode", "ExpiryMap");
+    auto makeTile = [&info](TileId tileId, std::optional<std::chrono::milliseconds> ttl) {
+        auto tile = makeTestTile(info, tileId);
+        tile->setTtl(ttl);
+        return tile;
+    };
+
+    auto cache = std::make_shared<MemCache>();
+    auto liveTile = makeTile(TileId(1, 0, 5), std::chrono::hours(1));
+    auto expiredTile = makeTile(TileId(2, 0, 5), std::chrono::milliseconds(0));
+    auto eternalTile = makeTile(TileId(3, 0, 5), std::nullopt);
+    for (auto const& tile : {liveTile, eternalTile, expiredTile})
+        cache->putTileLayer(tile);
+
+    SECTION("Expired tiles are misses") {
+        REQUIRE(!!cache->getTileLayer(liveTile->id(), info));
+        REQUIRE(!cache->getTileLayer(expiredTile->id(), info));
+        REQUIRE(!cache->getTileLayerMessage(expiredTile->id()));
+        REQUIRE(!!cache->getTileLayer(eternalTile->id(), info));
+        REQUIRE(cache->getStatistics()["cache-misses"] == 2);
+    }
+
+    SECTION("Expired tiles are swept") {
+        REQUIRE(cache->sweepExpiredTiles() == 1);
+        REQUIRE(cache->sweepExpiredTiles() == 0);
+        REQUIRE(!cache->getTileLayerBlob(expiredTile->id()));
+        REQUIRE(cache->getStatistics()["memcache-map-size"] == 2);
+        REQUIRE(cache->getStatistics()["expired-tiles"] == 1);
+    }
+
+    SECTION("Puts sweep expired tiles first") {
+        cache->putTileLayer(makeTile(TileId(4, 0, 5), std::nullopt));
+        REQUIRE(cache->getStatistics()["expired-tiles"] == 1);
+        REQUIRE(cache->getStatistics()["memcache-map-size"] == 3);
+    }
+
+    SECTION("Tiles which are put again expire by their new ttl") {
+        auto renewedTile = makeTile(expiredTile->tileId(), std::chrono::hours(1));
+        cache->putTileLayer(renewedTile);
+        REQUIRE(cache->sweepExpiredTiles() == 0);
+        REQUIRE(!!cache->getTileLayer(expiredTile->id(), info));
+    }
+}
+
+TEST_CASE("WriteBehind", "[Cache]")
+{
+    auto info = makeTestInfo("WriteBehindTestingNode", "WriteBehindMap");
+    auto makeTile = [&info](TileId tileId) { return makeTestTile(info, tileId); };
+
+    auto cache = std::make_shared<MemCache>();
+    cache->setMaxQueuedTileLayers(2);
+    auto tile = makeTile(TileId(1, 0, 5));
+
+    SECTION("Queued tiles are served until they are written") {
+        REQUIRE(cache->queueTileLayer(tile));
+        REQUIRE(!cache->queueTileLayer(makeTile(TileId(2, 0, 5))));
+        REQUIRE(cache->getTileLayer(tile->id(), info) == tile);
+        REQUIRE(!cache->getTileLayerBlob(tile->id()));
+        REQUIRE(cache->getStatistics()["queued-tiles"] == 2);
+
+        REQUIRE(cache->writeQueuedTileLayers() == 2);
+        REQUIRE(cache->writeQueuedTileLayers() == 0);
+        REQUIRE(!!cache->getTileLayerBlob(tile->id()));
+        REQUIRE(cache->getStatistics()["queued-tiles"] == 0);
+
+        // The writer is idle now, so it must be started again.
+        REQUIRE(cache->queueTileLayer(makeTile(TileId(3, 0, 5))));
+    }
+
+    SECTION("The oldest tiles are dropped if the queue is full") {
+        cache->queueTileLayer(tile);
+        cache->queueTileLayer(makeTile(TileId(2, 0, 5)));
+        cache->queueTileLayer(makeTile(TileId(3, 0, 5)));
+        REQUIRE(!cache->getTileLayer(tile->id(), info));
+        REQUIRE(cache->getStatistics()["dropped-tiles"] == 1);
+        REQUIRE(cache->writeQueuedTileLayers(1) == 1);
+        REQUIRE(cache->writeQueuedTileLayers(1) == 1);
+        REQUIRE(cache->getStatistics()["memcache-map-size"] == 2);
+    }
+
+    SECTION("Messages of queued tiles are written on demand") {
+        cache->queueTileLayer(tile);
+        REQUIRE(!!cache->getTileLayerMessage(tile->id()));
+        REQUIRE(cache->writeQueuedTileLayers() == 0);
+    }
+
+    SECTION("Tiles are put right away without write-behind") {
+        cache->setMaxQueuedTileLayers(0);
+        REQUIRE(!cache->queueTileLayer(tile));
+        REQUIRE(!!cache->getTileLayerBlob(tile->id()));
+    }
+}
+
+TEST_CASE("Compression", "[Cache]")
+{
+    auto info = makeTestInfo("CompressionTestingNode", "CompressionMap");
+    auto strings = std::make_shared<StringPool>(info.nodeId_);
+    auto makeTile = [&](uint16_t x)
+    { return makeTestTile(info, TileId(x, 0, 10), 8, x * 8, "WayLayer", strings); };
+
+    auto cache = std::make_shared<DictionaryMemCache>();
+    cache->setMaxLiveTileBytes(0);
+
+    // Tiles which were cached before compression was enabled stay readable.
+    auto uncompressedTile = makeTile(0);
+    cache->putTileLayer(uncompressedTile);
+    cache->setCompressionLevel(3);
+
+    // More tiles than sampled for a dictionary are put, so that tiles
+    // with and without dictionary are compressed.
+    auto numTiles = TileBlobCompression::DictionarySampleCount + 16;
+    for (auto x = 1u; x <= numTiles; ++x)
+        cache->putTileLayer(makeTile(x));
+
+    for (auto x = 0u; x <= numTiles; ++x) {
+        auto tile = cache->getTileLayer(MapTileKey(*makeTile(x)), info);
+        REQUIRE(!!tile);
+        REQUIRE(std::static_pointer_cast<TileFeatureLayer>(tile)->size() == 8);
+    }
+    REQUIRE(!!cache->getTileLayerMessage(MapTileKey(*makeTile(1))));
+
+    // Uncompressed blobs start with the protocol version.
+    REQUIRE(cache->getTileLayerBlob(MapTileKey(*uncompressedTile))->front() == 0);
+    REQUIRE(cache->getTileLayerBlob(MapTileKey(*makeTile(1)))->front() != 0);
+
+    auto stats = cache->getStatistics();
+    REQUIRE(stats["compressed-tiles"] == numTiles);
+    REQUIRE(stats["compression-output-bytes"].get<int64_t>() < stats["compression-input-bytes"].get<int64_t>());
+
+    // Compressed tiles stay readable once compression is disabled, including
+    // the ones which need the dictionary of their layer.
+    REQUIRE(!cache->dictionaries_.empty());
+    cache->setCompressionLevel(0);
+    for (auto x = 0u; x <= numTiles; ++x) {
+        auto tile = cache->getTileLayer(MapTileKey(*makeTile(x)), info);
+        REQUIRE(!!tile);
+        REQUIRE(std::static_pointer_cast<TileFeatureLayer>(tile)->size() == 8);
+    }
+}
+
+TEST_CASE("LayerStatistics", "[Cache]")
+{
+    auto info = makeTestInfo("StatisticsTestingNode", "StatisticsMap", {"WayLayer", "OtherLayer"});
+    auto strings = std::make_shared<StringPool>(info.nodeId_);
+    auto makeTile = [&](std::string const& layerId, uint16_t x)
+    { return makeTestTile(info, TileId(x, 0, 10), 0, 0, layerId, strings); };
+
+    auto cache = std::make_shared<MemCache>(2);
+    cache->setMaxLiveTileBytes(0);
+    cache->putTileLayer(makeTile("WayLayer", 1));
+    cache->putTileLayer(makeTile("WayLayer", 2));
+    cache->putTileLayer(makeTile("OtherLayer", 1));
+    REQUIRE(!!cache->getTileLayer(makeTile("WayLayer", 2)->id(), info));
+    REQUIRE(!cache->getTileLayer(makeTile("WayLayer", 1)->id(), info));
+    REQUIRE(!cache->getTileLayer(makeTile("OtherLayer", 2)->id(), info));
+
+    auto stats = cache->getStatistics()["layers"]["StatisticsMap"];
+    auto const& wayStats = stats["WayLayer"];
+    REQUIRE(wayStats["hits"] == 1);
+    REQUIRE(wayStats["misses"] == 1);
+    REQUIRE(wayStats["written-tiles"] == 2);
+    REQUIRE(wayStats["evicted-tiles"] == 1);
+    REQUIRE(wayStats["read-bytes"].get<int64_t>() > 0);
+    REQUIRE(wayStats["average-blob-bytes"] == wayStats["written-bytes"].get<int64_t>() / 2);
+
+    auto const& otherStats = stats["OtherLayer"];
+    REQUIRE(otherStats["hits"] == 0);
+    REQUIRE(otherStats["misses"] == 1);
+    REQUIRE(otherStats["written-tiles"] == 1);
+    REQUIRE(otherStats["evicted-tiles"] == 0);
+}
+
+TEST_CASE("MemCache", "[Cache]")
+{
+    auto tileKey = [](uint16_t x) {
+        MapTileKey result;
+        result.mapId_ = "CacheMe";
+        result.layerId_ = "WayLayer";
+        result.tileId_ = TileId(x, 0, 5);
+        return result;
+    };
+
+    SECTION("Least recently used tiles are evicted") {
+        MemCache cache(2);
+        cache.putTileLayerBlob(tileKey(1), "a");
+        cache.putTileLayerBlob(tileKey(2), "bb");
+        REQUIRE(cache.getTileLayerBlob(tileKey(1)) == "a");
+
+        cache.putTileLayerBlob(tileKey(3), "ccc");
+        REQUIRE(cache.getTileLayerBlob(tileKey(1)) == "a");
+        REQUIRE(!cache.getTileLayerBlob(tileKey(2)));
+        REQUIRE(cache.getStatistics()["memcache-map-size"] == 2);
+        REQUIRE(cache.getStatistics()["memcache-bytes"] == 4);
+    }
+
+    SECTION("Tiles are evicted to stay within the byte budget") {
+        MemCache cache(64, 1000);
+        for (uint16_t x = 0; x < 20; ++x)
+            cache.putTileLayerBlob(tileKey(x), std::string(100, 'x'));
+        REQUIRE(cache.getStatistics()["memcache-bytes"] == 1000);
+        REQUIRE(cache.getStatistics()["memcache-map-size"] == 10);
+        REQUIRE(!cache.getSharedTileLayerBlob(tileKey(9)));
+        REQUIRE(!!cache.getSharedTileLayerBlob(tileKey(10)));
+
+        // Blobs which exceed the budget of their shard are not cached.
+        cache.putTileLayerBlob(tileKey(200), std::string(1001, 'x'));
+        REQUIRE(!cache.getSharedTileLayerBlob(tileKey(200)));
+    }
+
+    SECTION("Blobs are updated and shared") {
+        MemCache cache(0);
+        cache.putTileLayerBlob(tileKey(1), "a");
+        cache.putTileLayerBlob(tileKey(1), "bb");
+        auto blob = cache.getSharedTileLayerBlob(tileKey(1));
+        REQUIRE(*blob == "bb");
+        REQUIRE(blob == cache.getSharedTileLayerBlob(tileKey(1)));
+        REQUIRE(cache.getStatistics()["memcache-bytes"] == 2);
+    }
+
+    SECTION("Tiles are evicted when the memory budget is under pressure") {
+        auto& budget = MemoryBudget::instance();
+        auto reservedBefore = budget.reserved(MemoryPool::CachedTiles);
+        {
+            MemCache cache(64);
+            for (uint16_t x = 0; x < 10; ++x)
+                cache.putTileLayerBlob(tileKey(x), std::string(100, 'x'));
+            REQUIRE(budget.reserved(MemoryPool::CachedTiles) == reservedBefore + 1000);
+
+            budget.setLimit(budget.reserved() - 300, 1.);
+            REQUIRE(budget.isUnderPressure());
+            REQUIRE(budget.reclaim() >= 300);
+            REQUIRE(!budget.isUnderPressure());
+            budget.setLimit(0);
+
+            // The least recently used tiles were evicted first.
+            REQUIRE(!cache.getSharedTileLayerBlob(tileKey(0)));
+            REQUIRE(cache.getStatistics()["memcache-map-size"] < 10);
+            REQUIRE(budget.reserved(MemoryPool::CachedTiles) ==
+                reservedBefore + cache.getStatistics()["memcache-bytes"].get<size_t>());
+        }
+        REQUIRE(budget.reserved(MemoryPool::CachedTiles) == reservedBefore);
+    }
+}
+
+TEST_CASE("TieredCache", "[Cache]")
+{
+    auto tileKey = [](uint16_t x) {
+        MapTileKey result;
+        result.mapId_ = "CacheMe";
+        result.layerId_ = "WayLayer";
+        result.tileId_ = TileId(x, 0, 5);
+        return result;
+    };
+
+    auto front = std::make_shared<MemCache>(1);
+    auto back = std::make_shared<MemCache>(0);
+    TieredCache cache(front, back);
+
+    SECTION("Tiles are written through to both tiers") {
+        cache.putTileLayerBlob(tileKey(1), "a");
+        REQUIRE(front->getTileLayerBlob(tileKey(1)) == "a");
+        REQUIRE(back->getTileLayerBlob(tileKey(1)) == "a");
+    }
+
+    SECTION("Tiles which are only in the back are promoted") {
+        cache.putTileLayerBlob(tileKey(1), "a");
+        cache.putTileLayerBlob(tileKey(2), "bb");
+        REQUIRE(!front->getTileLayerBlob(tileKey(1)));
+        REQUIRE(cache.getTileLayerBlob(tileKey(1)) == "a");
+        REQUIRE(front->getTileLayerBlob(tileKey(1)) == "a");
+        REQUIRE(cache.getTileLayerBlob(tileKey(1)) == "a");
+
+        auto stats = cache.getStatistics();
+        REQUIRE(stats["promoted-tiles"] == 1);
+        REQUIRE(stats["front-tier"]["memcache-map-size"] == 1);
+        REQUIRE(stats["back-tier"]["memcache-map-size"] == 2);
+    }
+
+    SECTION("Tiles are erased from both tiers") {
+        cache.putTileLayerBlob(tileKey(1), "a");
+        cache.eraseTileLayerBlob(tileKey(1));
+        REQUIRE(!cache.getTileLayerBlob(tileKey(1)));
+        REQUIRE(!back->getTileLayerBlob(tileKey(1)));
+    }
+}
+
+TEST_CASE("TileArchive", "[Cache]")
+{
+    auto info = makeTestInfo("ArchiveTestingNode", "ArchiveMap");
+    auto strings = std::make_shared<StringPool>(info.nodeId_);
+    auto makeTile = [&](TileId tileId, int numWays) {
+        auto tile = makeTestTile(info, tileId, numWays, 0, "WayLayer", strings);
+        for (auto i = 0; i < numWays; ++i)
+            tile->at(i)->attributes()->addField("name", fmt::format("Way {}", i));
+        return tile;
+    };
+    auto keyOf = [&](TileId tileId) {
+        MapTileKey key;
+        key.mapId_ = info.mapId_;
+        key.layerId_ = "WayLayer";
+        key.tileId_ = tileId;
+        return key;
+    };
+
+    auto path = (std::filesystem::temp_directory_path() / "mapget-test-archive.mgta").string();
+    {
+        auto writer = std::make_shared<TileArchiveWriter>(path);
+        writer->putTileLayer(makeTile(TileId(1, 2, 3), 3));
+        writer->putTileLayer(makeTile(TileId(2, 2, 3), 5));
+        writer->finish({info});
+    }
+    auto archive = std::make_shared<TileArchive>(path);
+    auto dataSource = std::make_shared<ArchiveDataSource>(archive, "");
+    Cache::Ptr cache = std::make_shared<MemCache>();
+
+    SECTION("Archived tiles are parsed with the archived strings") {
+        REQUIRE(archive->size() == 2);
+        REQUIRE(dataSource->info().mapId_ == info.mapId_);
+        auto layer = dataSource->get(keyOf(TileId(2, 2, 3)), cache, dataSource->info());
+        auto tile = std::dynamic_pointer_cast<TileFeatureLayer>(layer);
+        REQUIRE(!!tile);
+        REQUIRE(tile->size() == 5);
+        REQUIRE(tile->toJson().dump().find("Way 4") != std::string::npos);
+        REQUIRE(tile->strings() == cache->getStringPool(info.nodeId_));
+    }
+
+    SECTION("Archived messages are returned as they are") {
+        auto message = dataSource->getTileLayerMessage(keyOf(TileId(1, 2, 3)), cache);
+        REQUIRE(message.has_value());
+        REQUIRE(TileLayerStream::Reader::readTileLayerHeader(*message->message_).tileId_ == TileId(1, 2, 3));
+        REQUIRE(message->strings_ == cache->getStringPool(info.nodeId_));
+    }
+
+    SECTION("Tiles which are not archived are empty") {
+        REQUIRE(!dataSource->getTileLayerMessage(keyOf(TileId(3, 2, 3)), cache));
+        auto layer = dataSource->get(keyOf(TileId(3, 2, 3)), cache, dataSource->info());
+        REQUIRE(!!layer);
+        REQUIRE(std::static_pointer_cast<TileFeatureLayer>(layer)->size() == 0);
+    }
+
+    SECTION("The service forwards the archived messages") {
+        Service service(cache);
+        service.add(dataSource);
+        std::atomic_int numMessages = 0;
+        std::atomic_int numParsedTiles = 0;
+        auto request = std::make_shared<LayerTilesRequest>(
+            info.mapId_,
+            "WayLayer",
+            std::vector<TileId>{TileId(1, 2, 3), TileId(2, 2, 3)});
+        request->onTileLayerMessage([&](auto&&, auto&&) { ++numMessages; });
+        request->onFeatureLayer([&](auto&&) { ++numParsedTiles; });
+        REQUIRE(service.request({request}));
+        request->wait();
+        REQUIRE(request->getStatus() == RequestStatus::Success);
+        REQUIRE(numMessages == 2);
+        REQUIRE(numParsedTiles == 0);
+    }
+
+    SECTION("Unfinished archives cannot be opened") {
+        auto unfinishedPath = path + ".unfinished";
+        std::make_shared<TileArchiveWriter>(unfinishedPath)->putTileLayer(makeTile(TileId(1, 2, 3), 1));
+        REQUIRE_THROWS(TileArchive(unfinishedPath));
+        std::filesystem::remove(unfinishedPath);
+    }
+
+    dataSource.reset();
+    archive.reset();
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("LocateIndex", "[Cache]")
+{
+    auto info = makeTestInfo("LocateIndexTestingNode", "LocateIndexMap");
+
+    // Fills each tile with four ways, and counts the locate calls.
+    struct WayDataSource : public DataSource
+    {
+        DataSourceInfo info_;
+        std::atomic_int locateCount_ = 0;
+
+        DataSourceInfo info() override { return info_; }
+        void fill(TileFeatureLayer::Ptr const& tile) override
+        {
+            for (auto i = 0; i < 4; ++i)
+                tile->newFeature("Way", {{"wayId", tile->tileId().x() * 4 + i}});
+        }
+        void fill(TileSourceDataLayer::Ptr const&) override {}
+        std::vector<LocateResponse> locate(LocateRequest const& req) override
+        {
+            ++locateCount_;
+            return {};
+        }
+    };
+
+    auto cachePath = (std::filesystem::temp_directory_path() / "mapget-test-locate-index").string();
+    auto makeCache = [&](bool clearCache) {
+        auto cache = std::make_shared<RocksDBCache>(0, cachePath, clearCache);
+        cache->setLocateIndexEnabled(true);
+        return cache;
+    };
+    LocateRequest way9(info.mapId_, "Way", KeyValuePairs{{"wayId", 9}});
+
+    SECTION("Features of put tiles are indexed, and the index persists") {
+        {
+            auto cache = makeCache(true);
+            auto tile =
+                makeTestTile(info, TileId(2, 0, 10), 4, 8, "WayLayer", cache->getStringPool(info.nodeId_));
+            cache->putTileLayer(tile);
+            REQUIRE(cache->getStatistics()["locate-index-features"] == 4);
+            REQUIRE(!cache->lookupLocateIndex("OtherNode", way9));
+            REQUIRE(!cache->lookupLocateIndex(
+                info.nodeId_, LocateRequest(info.mapId_, "Way", KeyValuePairs{{"wayId", 12}})));
+        }
+        auto cache = makeCache(false);
+        auto entry = cache->lookupLocateIndex(info.nodeId_, way9);
+        REQUIRE(entry.has_value());
+        REQUIRE(entry->tileKey_.layerId_ == "WayLayer");
+        REQUIRE(entry->tileKey_.tileId_ == TileId(2, 0, 10));
+        REQUIRE(entry->layerVersion_ == Version().toString());
+
+        cache->setLocateIndexEnabled(false);
+        REQUIRE(!cache->lookupLocateIndex(info.nodeId_, way9));
+    }
+
+    SECTION("The service locates the features of cached tiles without the data source") {
+        auto dataSource = std::make_shared<WayDataSource>();
+        dataSource->info_ = info;
+        Service service(makeCache(true));
+        service.add(dataSource);
+
+        auto request = std::make_shared<LayerTilesRequest>(
+            info.mapId_, "WayLayer", std::vector<TileId>{TileId(2, 0, 10)});
+        REQUIRE(service.request({request}));
+        request->wait();
+
+        auto responses = service.locate(way9);
+        REQUIRE(responses.size() == 1);
+        REQUIRE(responses[0].tileKey_.tileId_ == TileId(2, 0, 10));
+        REQUIRE(service.locate(LocateRequest(info.mapId_, "Way", KeyValuePairs{{"wayId", 12}})).empty());
+        REQUIRE(dataSource->locateCount_ == 1);
+
+        // Entries of another layer version are not used.
+        service.remove(dataSource);
+        dataSource->info_.getLayer("WayLayer")->version_.major_ = 1;
+        service.add(dataSource);
+        REQUIRE(service.locate(way9).empty());
+        REQUIRE(dataSource->locateCount_ == 2);
+
+        auto stats = service.getStatistics()["locate-index"];
+        REQUIRE(stats["enabled"] == true);
+        REQUIRE(stats["hits"] == 1);
+        REQUIRE(stats["misses"] == 2);
+    }
+
+    std::filesystem::remove_all(cachePath);
+}
+
+TEST_CASE("RemoteCache", "[Cache]")
+{
+    auto info = makeTestInfo("RemoteTestingNode", "RemoteMap");
+    auto strings = std::make_shared<StringPool>(info.nodeId_);
+    auto makeTile = [&info](uint16_t x, std::shared_ptr<StringPool> const& tileStrings) {
+        auto tile = makeTestTile(info, TileId(x, 0, 10), 1, x, "WayLayer", tileStrings);
+        tile->at(0)->attributes()->addField(fmt::format("attribute{}", x), "value");
+        return tile;
+    };
+
+    auto storePath = std::filesystem::temp_directory_path() / "mapget-test-remote-cache";
+    auto const writeToken = "TheWriteToken";
+    CacheServer server(std::make_shared<RocksDBCache>(0, storePath.string(), true), true, writeToken);
+    server.go("127.0.0.1");
+    auto first = std::make_shared<RemoteCache>("127.0.0.1", server.port(), 1024, 0, writeToken);
+    auto second = std::make_shared<RemoteCache>("127.0.0.1", server.port(), 1024, 0, writeToken);
+    second->setMaxLiveTileBytes(0);
+
+    SECTION("Tiles are shared, and kept in the hot tier") {
+        auto tile = makeTile(1, strings);
+        first->putTileLayer(tile);
+        REQUIRE(!!second->getTileLayer(tile->id(), info));
+        REQUIRE(!!second->getTileLayer(tile->id(), info));
+        REQUIRE(!second->getTileLayer(makeTile(2, strings)->id(), info));
+
+        auto stats = second->getStatistics();
+        REQUIRE(stats["remote-hits"] == 1);
+        REQUIRE(stats["remote-misses"] == 1);
+        REQUIRE(stats["hot-tier"]["memcache-map-size"] == 1);
+    }
+
+    SECTION("String pools catch up with the strings of other instances") {
+        auto tile = makeTile(1, strings);
+        first->putTileLayer(tile);
+        REQUIRE(!!second->getTileLayer(tile->id(), info));
+
+        // The second tile adds an attribute name to the pool.
+        auto newTile = makeTile(2, strings);
+        first->putTileLayer(newTile);
+        REQUIRE(!!second->getTileLayer(newTile->id(), info));
+        REQUIRE(second->getStringPool(info.nodeId_)->highest() == strings->highest());
+        REQUIRE(second->getStatistics()["refreshed-string-pools"] == 1);
+    }
+
+    SECTION("Conflicting string pools disable the remote cache") {
+        first->putTileLayer(makeTile(1, strings));
+
+        // Another process assigned other strings to the same node id.
+        auto otherStrings = std::make_shared<StringPool>(info.nodeId_);
+        otherStrings->emplace("SomethingElse");
+        second->putTileLayer(makeTile(2, otherStrings));
+        REQUIRE(second->getStatistics()["remote-disabled"] == true);
+
+        // The tile is still in the hot tier, but not on the server.
+        REQUIRE(!!second->getTileLayerBlob(makeTile(2, otherStrings)->id()));
+        REQUIRE(!first->getTileLayerBlob(makeTile(2, strings)->id()));
+    }
+
+    SECTION("Writes need the token, and blobs which match their key") {
+        auto tile = makeTile(1, strings);
+        first->putTileLayer(tile);
+        auto blob = *first->getTileLayerBlob(tile->id());
+        auto tilePath = [](MapTileKey const& key)
+        { return "/cache/tile?key=" + httplib::detail::encode_query_param(key.toString()); };
+
+        httplib::Client client("127.0.0.1", server.port());
+        REQUIRE(client.Put(tilePath(tile->id()), blob, "application/binary")->status == 401);
+        REQUIRE(client.Delete(tilePath(tile->id()))->status == 401);
+
+        client.set_bearer_token_auth(writeToken);
+        REQUIRE(client.Put(tilePath(tile->id()), blob, "application/binary")->status == 200);
+        REQUIRE(client.Put("/cache/tile?key=NotAKey", blob, "application/binary")->status == 400);
+        REQUIRE(client.Put(tilePath(tile->id()), "NotATile", "application/binary")->status == 400);
+        REQUIRE(client.Put(tilePath(makeTile(2, strings)->id()), blob, "application/binary")->status == 400);
+        REQUIRE(client.Put("/cache/string-pool?node=TestingNode", "NotAPool", "application/binary")->status == 400);
+        REQUIRE(client.Get("/cache/tile?key=NotAKey")->status == 400);
+        REQUIRE(!second->getTileLayerBlob(makeTile(2, strings)->id()));
+    }
+
+    SECTION("Writes are rejected by read-only servers") {
+        auto readOnlyStorePath = std::filesystem::temp_directory_path() / "mapget-test-remote-cache-read-only";
+        CacheServer readOnlyServer(std::make_shared<RocksDBCache>(0, readOnlyStorePath.string(), true));
+        readOnlyServer.go("127.0.0.1");
+        auto cache = std::make_shared<RemoteCache>("127.0.0.1", readOnlyServer.port());
+        auto tile = makeTile(3, strings);
+        cache->putTileLayer(tile);
+        REQUIRE(cache->getStatistics()["remote-errors"].get<int64_t>() > 0);
+
+        auto otherCache = std::make_shared<RemoteCache>("127.0.0.1", readOnlyServer.port());
+        REQUIRE(!otherCache->getTileLayerBlob(tile->id()));
+        readOnlyServer.stop();
+    }
+
+    server.stop();
+}
+
+TEST_CASE("MapTileKey binary encoding", "[Cache]")
+{
+    MapTileKey key;
+    key.layer_ = LayerType::SourceData;
+    key.mapId_ = "Tropico";
+    key.layerId_ = "WayLayer";
+    key.tileId_ = TileId(0x0123456789abcdefull);
+
+    SECTION("Keys round-trip and hash like their components") {
+        auto binary = key.toBinary();
+        REQUIRE(binary.starts_with(MapTileKey::binaryLayerPrefix("Tropico", "WayLayer", LayerType::SourceData)));
+        REQUIRE(MapTileKey::fromBinary(binary) == key);
+        REQUIRE(MapTileKey::fromBinary(binary).hash() == key.hash());
+        REQUIRE(MapTileKey(key.toString()) == key);
+
+        auto otherKey = key;
+        otherKey.tileId_ = TileId(1);
+        REQUIRE(otherKey.hash() != key.hash());
+        REQUIRE_THROWS(MapTileKey::fromBinary(binary.substr(0, binary.size() - 1)));
+        REQUIRE_THROWS(MapTileKey::fromBinary("Tropico"));
+    }
+
+    SECTION("Keys of a map layer sort together by tile id") {
+        auto keyFor = [&](std::string layerId, uint64_t tileId) {
+            auto result = key;
+            result.layerId_ = std::move(layerId);
+            result.tileId_ = TileId(tileId);
+            return result.toBinary();
+        };
+        REQUIRE(keyFor("WayLayer", 1) < keyFor("WayLayer", 0x100));
+        REQUIRE(keyFor("WayLayer", 0x100) < keyFor("WayLayer", 0xff00000000000000ull));
+        REQUIRE(keyFor("WayLayer", 0xff00000000000000ull) < keyFor("WayLayerX", 0));
+        REQUIRE(keyFor("Way", 0xffffffffffffffffull) < keyFor("WayLayer", 0));
+    }
 }
@@ -4,6 +4,7 @@
 #include <filesystem>
 #include <fstream>
 #include <future>
+#include <thread>
 
 #include "utility.h"
 #include "mapget/http-service/cli.h"
@@ -18,6 +19,11 @@ using namespace mapget;
 
 struct TestDataSource : public DataSource
 {
+    TestDataSource() { ++numConstructed_; }
+
+    // Number of constructed instances, to check which config changes recreate them.
+    static inline std::atomic_int numConstructed_ = 0;
+
     DataSourceInfo info() override
     {
         return DataSourceInfo::fromJson(R"(
@@ -140,6 +146,19 @@ TEST_CASE("Datasource Config", "[DataSourceConfig]")
     REQUIRE(dataSourceInfos.size() == 1);
     REQUIRE(dataSourceInfos[0].mapId_ == "Catan");
 
+    // Adding a second datasource keeps the unchanged first one
+    auto numConstructed = TestDataSource::numConstructed_.load();
+    prepareNextUpdate();
+    {
+        std::ofstream out(tempConfigPath, std::ios_base::trunc);
+        out << "sources:\n  - type: TestDataSource\n  - type: TestDataSource\n    label: second\n";
+        out.close();
+    }
+    waitForUpdate(updateFuture);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    REQUIRE(service.info().size() == 2);
+    REQUIRE(TestDataSource::numConstructed_ == numConstructed + 1);
+
     // Removing the datasource
     prepareNextUpdate();
     {
@@ -155,3 +174,75 @@ TEST_CASE("Datasource Config", "[DataSourceConfig]")
     std::this_thread::sleep_for(std::chrono::seconds(2));
     DataSourceConfigService::get().end();
 }
+
+TEST_CASE("Parallel Datasource Config", "[DataSourceConfig]")
+{
+    setLogLevel("trace", log());
+
+    auto tempDir = fs::temp_directory_path() / test::generateTimestampedDirectoryName("mapget_test_parallel_config");
+    fs::create_directory(tempDir);
+    auto tempConfigPath = tempDir / "temp_config.yaml";
+
+    // Polls until the condition holds, or a timeout passes.
+    auto waitFor = [](auto&& condition)
+    {
+        auto waitUntil = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (!condition() && std::chrono::steady_clock::now() < waitUntil)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        return condition();
+    };
+
+    // The slow source starts once it is released, the failing one always throws.
+    std::atomic_bool isSlowReleased = false;
+    std::atomic_int numFailedAttempts = 0;
+    DataSourceConfigService::get().reset();
+    DataSourceConfigService::get().registerDataSourceType(
+        "TestDataSource",
+        [](const YAML::Node&) -> DataSource::Ptr
+        { return std::make_shared<TestDataSource>(); });
+    DataSourceConfigService::get().registerDataSourceType(
+        "SlowDataSource",
+        [&](const YAML::Node&) -> DataSource::Ptr
+        {
+            auto waitUntil = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+            while (!isSlowReleased && std::chrono::steady_clock::now() < waitUntil)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            return std::make_shared<TestDataSource>();
+        });
+    DataSourceConfigService::get().registerDataSourceType(
+        "FailingDataSource",
+        [&](const YAML::Node&) -> DataSource::Ptr
+        {
+            ++numFailedAttempts;
+            throw std::runtime_error("The failing data source failed.");
+        });
+
+    {
+        std::ofstream out(tempConfigPath, std::ios_base::trunc);
+        out << "sources:\n"
+               "  - type: SlowDataSource\n"
+               "  - type: FailingDataSource\n"
+               "  - type: TestDataSource\n";
+    }
+
+    {
+        Service service(std::make_shared<MemCache>(), true);
+        DataSourceConfigService::get().setConfigFilePath(tempConfigPath.string());
+
+        // The last source is served, while the first one is still starting.
+        REQUIRE(waitFor([&] { return service.info().size() == 1; }));
+        REQUIRE(!isSlowReleased);
+
+        // The failing source is retried, without affecting the others.
+        REQUIRE(waitFor([&] { return numFailedAttempts >= 2; }));
+        REQUIRE(service.info().size() == 1);
+
+        // The slow source is served once it has started.
+        isSlowReleased = true;
+        REQUIRE(waitFor([&] { return service.info().size() == 2; }));
+    }
+
+    // Cleanup
+    fs::remove_all(tempDir);
+    DataSourceConfigService::get().end();
+}
@@ -1,7 +1,9 @@
 #include <catch2/catch_test_macros.hpp>
 #include <filesystem>
 #include <iostream>
+#include <sstream>
 #include "mapget/log.h"
+#include "spdlog/sinks/ostream_sink.h"
 
 TEST_CASE("FileLogging", "[Logging]")
 {
@@ -38,3 +40,50 @@ TEST_CASE("FileLogging", "[Logging]")
         // is filled to maxsize, but that takes a lot of test runs).
     }
 }
+
+TEST_CASE("LazyLogging", "[Logging]")
+{
+    auto& logger = mapget::log();
+    auto previousLevel = logger.level();
+    auto evaluations = 0;
+    auto argument = [&]() { return ++evaluations; };
+
+    logger.set_level(spdlog::level::info);
+    MAPGET_LOG_DEBUG("Lazy argument: {}", argument());
+    REQUIRE(evaluations == 0);
+
+    logger.set_level(spdlog::level::debug);
+    MAPGET_LOG_DEBUG("Lazy argument: {}", argument());
+    REQUIRE(evaluations == 1);
+
+    logger.set_level(previousLevel);
+}
+
+TEST_CASE("AsyncSink", "[Logging]")
+{
+    std::ostringstream out;
+    auto target = std::make_shared<spdlog::sinks::ostream_sink_mt>(out);
+    target->set_pattern("%v");
+
+    SECTION("Flush waits for the queued messages")
+    {
+        auto sink = std::make_shared<mapget::AsyncSink>(target, 1024);
+        spdlog::logger logger("async-test", sink);
+        for (auto i = 0; i < 100; ++i)
+            logger.info("Message {}", i);
+        logger.flush();
+        REQUIRE(out.str().find("Message 99") != std::string::npos);
+        REQUIRE(sink->droppedMessages() == 0);
+    }
+
+    SECTION("A full queue drops the oldest messages")
+    {
+        auto sink = std::make_shared<mapget::AsyncSink>(target, 1);
+        spdlog::logger logger("async-test", sink);
+        for (auto i = 0; i < 1000; ++i)
+            logger.info("Message {}", i);
+        logger.flush();
+        REQUIRE(out.str().find("Message 999") != std::string::npos);
+        REQUIRE(sink->droppedMessages() < 1000);
+    }
+}
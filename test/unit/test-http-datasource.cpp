@@ -1,20 +1,87 @@
 #include <catch2/catch_test_macros.hpp>
+#include <algorithm>
+#include <condition_variable>
 #include <filesystem>
+#include <fstream>
+#include <future>
+#include <sstream>
+#include <thread>
 #include "httplib.h"
 #include "mapget/log.h"
 
 #include "utility.h"
+#include "mapget/detail/http-compression.h"
+#include "mapget/detail/shared-memory-ring.h"
 #include "mapget/http-datasource/datasource-client.h"
 #include "mapget/http-datasource/datasource-server.h"
 #include "mapget/http-service/http-client.h"
 #include "mapget/http-service/http-service.h"
+#include "mapget/http-service/load-generator.h"
 #include "mapget/model/stream.h"
 #include "mapget/service/config.h"
+#include "mapget/service/memcache.h"
 #include "mapget/http-service/cli.h"
+#include "mapget/http-service/cluster-peer.h"
 
 using namespace mapget;
 namespace fs = std::filesystem;
 
+namespace
+{
+
+/** In-process data source, which adds one attribute to a single way per tile. */
+struct AttributeDataSource : public DataSource
+{
+    explicit AttributeDataSource(std::string attributeName) : attributeName_(std::move(attributeName)) {}
+
+    DataSourceInfo info() override
+    {
+        return DataSourceInfo::fromJson(R"(
+        {
+            "nodeId": "InProcessNode",
+            "mapId": "Strings",
+            "layers": {
+                "WayLayer": {
+                    "featureTypes": [{
+                        "name": "Way",
+                        "uniqueIdCompositions": [[{"partId": "wayId", "datatype": "U32"}]]
+                    }]
+                }
+            }
+        }
+        )"_json);
+    }
+
+    void fill(TileFeatureLayer::Ptr const& tile) override
+    {
+        tile->newFeature("Way", {{"wayId", 1}})->attributes()->addField(attributeName_, "yes");
+    }
+
+    void fill(TileSourceDataLayer::Ptr const&) override {}
+
+    std::string attributeName_;
+};
+
+/** AttributeDataSource whose fills block until they are released. */
+struct BlockingAttributeDataSource : public AttributeDataSource
+{
+    BlockingAttributeDataSource() : AttributeDataSource("blockedAttribute") {}
+
+    void fill(TileFeatureLayer::Ptr const& tile) override
+    {
+        ++fillCount_;
+        auto waitUntil = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (isBlocking_ && std::chrono::steady_clock::now() < waitUntil)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        AttributeDataSource::fill(tile);
+    }
+
+    std::atomic_bool isBlocking_ = true;
+    std::atomic_int fillCount_ = 0;
+};
+
+}  // namespace
+
 TEST_CASE("HttpDataSource", "[HttpDataSource]")
 {
     setLogLevel("trace", log());
@@ -130,6 +197,198 @@ TEST_CASE("HttpDataSource", "[HttpDataSource]")
 
         REQUIRE(receivedTileCount == 1);
     }
+    SECTION("Fetch /tile conditionally")
+    {
+        httplib::Client cli("localhost", ds.port());
+        auto tileResponse = cli.Get("/tile?layer=WayLayer&tileId=1");
+        REQUIRE(tileResponse != nullptr);
+        REQUIRE(tileResponse->status == 200);
+        auto eTag = tileResponse->get_header_value("ETag");
+        REQUIRE(!eTag.empty());
+
+        // The tile is filled again with the same content, so it is not sent.
+        auto notModified = cli.Get("/tile?layer=WayLayer&tileId=1", {{"If-None-Match", eTag}});
+        REQUIRE(notModified != nullptr);
+        REQUIRE(notModified->status == 304);
+        REQUIRE(notModified->body.empty());
+
+        auto otherTile = cli.Get("/tile?layer=WayLayer&tileId=2", {{"If-None-Match", eTag}});
+        REQUIRE(otherTile != nullptr);
+        REQUIRE(otherTile->status == 200);
+    }
+    SECTION("Fetch /tile with zstd encoding")
+    {
+        httplib::Client cli("localhost", ds.port());
+        auto plainResponse = cli.Get("/tile?layer=WayLayer&tileId=1");
+        auto tileResponse = cli.Get("/tile?layer=WayLayer&tileId=1", {{"Accept-Encoding", "gzip, zstd"}});
+        REQUIRE(plainResponse != nullptr);
+        REQUIRE(tileResponse != nullptr);
+        REQUIRE(tileResponse->status == 200);
+        REQUIRE(tileResponse->get_header_value("Content-Encoding") == ZstdContentEncoding);
+
+        std::string body;
+        ZstdStreamDecompressor().decompress(tileResponse->body, body);
+        REQUIRE(body == plainResponse->body);
+    }
+
+    SECTION("Fetch /tiles")
+    {
+        httplib::Client cli("localhost", ds.port());
+        auto tilesResponse = cli.Get("/tiles?layer=WayLayer&tileIds=1,2,3", {{"Accept-Encoding", "zstd"}});
+        REQUIRE(tilesResponse != nullptr);
+        REQUIRE(tilesResponse->status == 200);
+        REQUIRE(tilesResponse->get_header_value("Content-Encoding") == ZstdContentEncoding);
+
+        // The tiles arrive in the order of their ids, and only the
+        // first one carries the strings which all of them use.
+        std::vector<uint64_t> receivedTileIds;
+        TileLayerStream::Reader reader(
+            [&](auto&& mapId, auto&& layerId) { return info.getLayer(std::string(layerId)); },
+            [&](auto&& tile) { receivedTileIds.push_back(tile->tileId().value_); });
+        std::string body;
+        ZstdStreamDecompressor().decompress(tilesResponse->body, body);
+        reader.read(body);
+
+        REQUIRE(receivedTileIds == std::vector<uint64_t>{1, 2, 3});
+        REQUIRE(dataSourceFeatureRequestCount == 3);
+    }
+    SECTION("Fetch a batch through RemoteDataSource")
+    {
+        RemoteDataSource remoteDataSource("localhost", ds.port());
+        // The scheduler batches jobs by the batch size of the server.
+        REQUIRE(remoteDataSource.info().maxBatchSize_ == info.maxBatchSize_);
+
+        std::vector<MapTileKey> keys;
+        for (uint64_t tileId : {1, 2, 3}) {
+            auto& key = keys.emplace_back();
+            key.mapId_ = "Tropico";
+            key.layerId_ = "WayLayer";
+            key.tileId_ = TileId(tileId);
+        }
+        Cache::Ptr cache = std::make_shared<MemCache>();
+        auto tiles = remoteDataSource.get(keys, cache, remoteDataSource.info());
+
+        REQUIRE(tiles.size() == 3);
+        for (auto i = 0u; i < tiles.size(); ++i) {
+            REQUIRE(tiles[i] != nullptr);
+            REQUIRE(tiles[i]->tileId() == keys[i].tileId_);
+            REQUIRE(std::static_pointer_cast<TileFeatureLayer>(tiles[i])->size() == 1);
+        }
+        REQUIRE(dataSourceFeatureRequestCount == 3);
+
+        // The batch is also fetched without blocking the caller.
+        std::promise<std::vector<TileLayer::Ptr>> asyncTiles;
+        remoteDataSource.getBatchAsync(
+            keys,
+            cache,
+            remoteDataSource.info(),
+            [&](std::vector<TileLayer::Ptr> layers) { asyncTiles.set_value(std::move(layers)); });
+        tiles = asyncTiles.get_future().get();
+        REQUIRE(tiles.size() == 3);
+        for (auto i = 0u; i < tiles.size(); ++i) {
+            REQUIRE(tiles[i] != nullptr);
+            REQUIRE(tiles[i]->tileId() == keys[i].tileId_);
+        }
+    }
+
+    SECTION("Cache and coalesce tiles in DataSourceServer")
+    {
+        DataSourceServer cachingDs(info);
+        std::atomic_uint32_t fillCount = 0;
+        cachingDs.onTileFeatureRequest(
+            [&](const auto& tile)
+            {
+                // Concurrent requests for the tile arrive meanwhile.
+                std::this_thread::sleep_for(std::chrono::milliseconds(200));
+                tile->newFeature("Way", {{"areaId", "Area42"}, {"wayId", 0}});
+                ++fillCount;
+            });
+        cachingDs.setCache(std::make_shared<MemCache>()).setFillThreadPoolSize(2);
+        cachingDs.go();
+
+        std::vector<std::thread> clients;
+        std::atomic_uint32_t okCount = 0;
+        for (auto i = 0; i < 4; ++i) {
+            clients.emplace_back([&] {
+                httplib::Client cli("localhost", cachingDs.port());
+                auto tileResponse = cli.Get("/tile?layer=WayLayer&tileId=1");
+                if (tileResponse && tileResponse->status == 200)
+                    ++okCount;
+            });
+        }
+        for (auto& client : clients)
+            client.join();
+        REQUIRE(okCount == 4);
+        REQUIRE(fillCount == 1);
+
+        // The cached tile is not filled again, but the other one is.
+        httplib::Client cli("localhost", cachingDs.port());
+        auto tilesResponse = cli.Get("/tiles?layer=WayLayer&tileIds=1,2");
+        REQUIRE(tilesResponse != nullptr);
+        REQUIRE(tilesResponse->status == 200);
+        std::vector<uint64_t> receivedTileIds;
+        TileLayerStream::Reader reader(
+            [&](auto&& mapId, auto&& layerId) { return info.getLayer(std::string(layerId)); },
+            [&](auto&& tile) { receivedTileIds.push_back(tile->tileId().value_); });
+        reader.read(tilesResponse->body);
+        REQUIRE(receivedTileIds == std::vector<uint64_t>{1, 2});
+        REQUIRE(fillCount == 2);
+        cachingDs.stop();
+    }
+
+    SECTION("Balance tiles over RemoteDataSource endpoints")
+    {
+        // An endpoint which does not answer anymore.
+        DataSourceServer stopped(info);
+        stopped.go();
+        auto stoppedPort = stopped.port();
+        stopped.stop();
+
+        // A replica, which has its own string pool.
+        auto replicaInfo = info;
+        replicaInfo.nodeId_ = "TropicoReplica";
+        DataSourceServer replica(replicaInfo);
+        std::atomic_uint32_t replicaRequestCount = 0;
+        replica.onTileFeatureRequest([&](auto const& tile) { ++replicaRequestCount; });
+        replica.go();
+
+        RemoteDataSource remoteDataSource(std::vector<HttpConnectionPool::Endpoint>{
+            {"localhost", stoppedPort},
+            {"localhost", ds.port()},
+            {"localhost", replica.port()}});
+        Cache::Ptr cache = std::make_shared<MemCache>();
+        for (uint64_t tileId : {1, 2, 3, 4}) {
+            MapTileKey key;
+            key.mapId_ = "Tropico";
+            key.layerId_ = "WayLayer";
+            key.tileId_ = TileId(tileId);
+            auto tile = remoteDataSource.get(key, cache, remoteDataSource.info());
+            REQUIRE(tile != nullptr);
+            REQUIRE(!tile->error());
+        }
+        REQUIRE(dataSourceFeatureRequestCount > 0);
+        REQUIRE(replicaRequestCount > 0);
+        REQUIRE(dataSourceFeatureRequestCount + replicaRequestCount == 4);
+
+        // The stopped endpoint is replaced, e.g. by a restarted process,
+        // and gets requests once it answered the health check.
+        auto restartedInfo = info;
+        restartedInfo.nodeId_ = "TropicoRestarted";
+        DataSourceServer restarted(restartedInfo);
+        std::atomic_uint32_t restartedRequestCount = 0;
+        restarted.onTileFeatureRequest([&](auto const& tile) { ++restartedRequestCount; });
+        restarted.go();
+        remoteDataSource.setEndpoint(0, {"localhost", restarted.port()});
+        for (uint64_t tileId : {5, 6, 7}) {
+            MapTileKey key;
+            key.mapId_ = "Tropico";
+            key.layerId_ = "WayLayer";
+            key.tileId_ = TileId(tileId);
+            REQUIRE(remoteDataSource.get(key, cache, remoteDataSource.info()) != nullptr);
+        }
+        REQUIRE(restartedRequestCount > 0);
+    }
+
     SECTION("Fetch /tile SourceData")
     {
         // Initialize an httplib client.
@@ -183,6 +442,20 @@ TEST_CASE("HttpDataSource", "[HttpDataSource]")
         REQUIRE(responseParsed.tileKey_.tileId_.value_ == 1);
     }
 
+    SECTION("Batched /locate through RemoteDataSource")
+    {
+        RemoteDataSource remoteDataSource("localhost", ds.port());
+        LocateRequest request("Tropico", "Way", KeyValuePairs{{"wayId", 0}});
+        auto responses = remoteDataSource.locate(std::vector<LocateRequest>{request, request});
+
+        REQUIRE(responses.size() == 2);
+        for (auto const& requestResponses : responses) {
+            REQUIRE(requestResponses.size() == 1);
+            REQUIRE(requestResponses[0].tileKey_.layerId_ == "WayLayer");
+            REQUIRE(requestResponses[0].tileKey_.tileId_.value_ == 1);
+        }
+    }
+
     SECTION("Query mapget HTTP service")
     {
         auto countReceivedTiles = [](auto& client, auto mapId, auto layerId, auto tiles) {
@@ -216,6 +489,27 @@ TEST_CASE("HttpDataSource", "[HttpDataSource]")
             REQUIRE(dataSourceFeatureRequestCount == 3);
         }
 
+        SECTION("Stream parallel requests through HttpClient")
+        {
+            HttpClient client("localhost", service.port(), 1, 2);
+
+            std::atomic_uint32_t receivedTileCount = 0;
+            std::vector<LayerTilesRequest::Ptr> requests;
+            for (uint64_t tileId : {1, 2, 3}) {
+                auto request = std::make_shared<LayerTilesRequest>(
+                    "Tropico",
+                    "WayLayer",
+                    std::vector<TileId>{TileId(tileId), TileId(tileId + 10)});
+                request->onFeatureLayer([&](auto&& tile) { ++receivedTileCount; });
+                requests.push_back(client.request(request));
+            }
+            for (auto const& request : requests) {
+                request->wait();
+                REQUIRE(request->getStatus() == RequestStatus::Success);
+            }
+            REQUIRE(receivedTileCount == 6);
+        }
+
         SECTION("Trigger 400 responses")
         {
             HttpClient client("localhost", service.port());
@@ -270,6 +564,196 @@ TEST_CASE("HttpDataSource", "[HttpDataSource]")
             REQUIRE(responseParsed.tileKey_.tileId_.value_ == 1);
         }
 
+        SECTION("Run /query through service")
+        {
+            httplib::Client client("localhost", service.port());
+            auto query = [&](std::string const& body)
+            {
+                auto response = client.Post("/query", body, "application/json");
+                REQUIRE(response != nullptr);
+                REQUIRE(response->status == 200);
+                std::vector<nlohmann::json> lines;
+                std::istringstream bodyStream(response->body);
+                for (std::string line; std::getline(bodyStream, line);)
+                    lines.emplace_back(nlohmann::json::parse(line));
+                return lines;
+            };
+
+            // The features of both tiles are selected.
+            auto features = query(R"({
+                "mapId": "Tropico",
+                "layerId": "WayLayer",
+                "tileIds": [1234, 5678],
+                "query": "any(geo() within bbox(41., 10., 43., 13.))"
+            })");
+            REQUIRE(features.size() == 2);
+            for (auto const& feature : features)
+                REQUIRE(feature["type"] == "Feature");
+
+            REQUIRE(query(R"({
+                "mapId": "Tropico",
+                "layerId": "WayLayer",
+                "tileIds": [1234],
+                "query": "any(geo() within bbox(0., 0., 1., 1.))"
+            })").empty());
+
+            // Values are returned per selected feature.
+            auto values = query(R"({
+                "mapId": "Tropico",
+                "layerId": "WayLayer",
+                "tileIds": [1234],
+                "query": "typeId",
+                "result": "values"
+            })");
+            REQUIRE(values.size() == 1);
+            REQUIRE(values[0]["featureId"] == "Way.Area42.0");
+            REQUIRE(values[0]["values"] == nlohmann::json::array({"Way"}));
+
+            // Only features which intersect the bbox are evaluated.
+            REQUIRE(!query(R"({
+                "mapId": "Tropico",
+                "layerId": "WayLayer",
+                "bbox": [41.9, 11.4, 42.1, 11.6],
+                "zoomLevel": 10,
+                "query": "true"
+            })").empty());
+            REQUIRE(query(R"({
+                "mapId": "Tropico",
+                "layerId": "WayLayer",
+                "bbox": [0.4, 0.4, 0.6, 0.6],
+                "zoomLevel": 10,
+                "query": "true"
+            })").empty());
+
+            auto unknownMap = client.Post(
+                "/query",
+                R"({"mapId": "UnknownMap", "layerId": "WayLayer", "tileIds": [1234], "query": "true"})",
+                "application/json");
+            REQUIRE(unknownMap != nullptr);
+            REQUIRE(unknownMap->status == 400);
+
+            // Boxes with too many tiles, and invalid zoom levels, are rejected.
+            for (auto const& invalid : {
+                     R"({"mapId": "Tropico", "layerId": "WayLayer", "bbox": [-180, -90, 180, 90], "zoomLevel": 15, "query": "true"})",
+                     R"({"mapId": "Tropico", "layerId": "WayLayer", "bbox": [41.9, 11.4, 42.1, 11.6], "zoomLevel": 16, "query": "true"})",
+                     R"({"mapId": "Tropico", "layerId": "WayLayer", "bbox": [41.9, 11.4, 42.1, 11.6], "zoomLevel": -1, "query": "true"})",
+                     R"({"mapId": "Tropico", "layerId": "WayLayer", "bbox": [41.9, 11.4], "zoomLevel": 10, "query": "true"})"}) {
+                auto response = client.Post("/query", invalid, "application/json");
+                REQUIRE(response != nullptr);
+                REQUIRE(response->status == 400);
+            }
+        }
+
+        SECTION("Stream tiles through a session")
+        {
+            std::mutex mutex;
+            std::condition_variable received;
+            std::string sessionId;
+            std::string body;
+
+            httplib::Request sessionRequest;
+            sessionRequest.method = "POST";
+            sessionRequest.path = "/session";
+            sessionRequest.set_header("Accept", "application/jsonl");
+            sessionRequest.set_header("Content-Type", "application/json");
+            sessionRequest.body = "{}";
+            sessionRequest.response_handler = [&](httplib::Response const& response)
+            {
+                std::lock_guard lock(mutex);
+                sessionId = response.get_header_value(HttpService::SessionIdHeader);
+                received.notify_all();
+                return true;
+            };
+            sessionRequest.content_receiver = [&](const char* data, size_t size, uint64_t, uint64_t)
+            {
+                std::lock_guard lock(mutex);
+                body.append(data, size);
+                received.notify_all();
+                return true;
+            };
+            httplib::Client sessionClient("localhost", service.port());
+            httplib::Response sessionResponse;
+            httplib::Error sessionError;
+            auto sessionThread = std::thread([&] { sessionClient.send(sessionRequest, sessionResponse, sessionError); });
+
+            auto receivedLines = [&] { return std::count(body.begin(), body.end(), '\n'); };
+            {
+                std::unique_lock lock(mutex);
+                REQUIRE(received.wait_for(lock, std::chrono::seconds(10), [&] { return !sessionId.empty(); }));
+            }
+
+            httplib::Client client("localhost", service.port());
+            auto update = [&](nlohmann::json const& request)
+            {
+                auto response = client.Post("/session/update", request.dump(), "application/json");
+                REQUIRE(response != nullptr);
+                return response;
+            };
+
+            // Requests of later updates are streamed over the same response.
+            for (auto tileId : {1234, 5678}) {
+                auto response = update({
+                    {"sessionId", sessionId},
+                    {"add", nlohmann::json::array({{{"mapId", "Tropico"}, {"layerId", "WayLayer"}, {"tileIds", {tileId}}}})}});
+                REQUIRE(response->status == 200);
+                REQUIRE(nlohmann::json::parse(response->body)["requestIds"].size() == 1);
+            }
+            {
+                std::unique_lock lock(mutex);
+                REQUIRE(received.wait_for(lock, std::chrono::seconds(10), [&] { return receivedLines() == 2; }));
+            }
+
+            REQUIRE(update({{"sessionId", sessionId}, {"cancel", {0}}, {"focus", {42., 11.}}})->status == 200);
+
+            // The open session holds a stream, so further streams are rejected.
+            service.setMaxStreams(1);
+            auto rejected = client.Post(
+                "/tiles",
+                R"({"requests": [{"mapId": "Tropico", "layerId": "WayLayer", "tileIds": [1234]}]})",
+                "application/json");
+            REQUIRE(rejected != nullptr);
+            REQUIRE(rejected->status == 503);
+            service.setMaxStreams(0);
+
+            REQUIRE(update({{"sessionId", sessionId}, {"close", true}})->status == 200);
+            sessionThread.join();
+            REQUIRE(sessionResponse.status == 200);
+            REQUIRE(receivedLines() == 2);
+
+            // The session is gone once it was closed.
+            REQUIRE(update({{"sessionId", sessionId}, {"close", true}})->status == 404);
+        }
+
+        SECTION("Replay viewports with the load generator")
+        {
+            LoadGenerator::Options options;
+            options.host_ = "localhost";
+            options.port_ = service.port();
+            options.mapId_ = "Tropico";
+            options.bbox_ = {11.5, 48.1, 11.6, 48.2};
+            options.numClients_ = 3;
+            options.duration_ = std::chrono::milliseconds(500);
+            options.viewportWidth_ = 2;
+            options.viewportHeight_ = 2;
+            options.thinkTime_ = std::chrono::milliseconds(50);
+            options.jsonlShare_ = .5;
+
+            // Without layers, all layers of the map are requested.
+            auto report = LoadGenerator(options).run();
+            REQUIRE(report.requests_ > 0);
+            REQUIRE(report.failedRequests_ == 0);
+            REQUIRE(
+                report.completedRequests_ + report.abortedRequests_ + report.rejectedRequests_ ==
+                report.requests_);
+            REQUIRE(report.tiles_ > 0);
+            REQUIRE(report.tileLatencies_.size() == report.tiles_);
+            REQUIRE(report.timesToFirstTile_.size() <= report.requests_);
+
+            auto summary = report.toJson();
+            REQUIRE(summary["tilesPerSecond"].get<double>() > 0);
+            REQUIRE(summary["tileLatencyMs"]["p50"] <= summary["tileLatencyMs"]["p999"]);
+        }
+
         service.stop();
         REQUIRE(service.isRunning() == false);
     }
@@ -286,6 +770,353 @@ TEST_CASE("HttpDataSource", "[HttpDataSource]")
     REQUIRE(ds.isRunning() == false);
 }
 
+TEST_CASE("HttpClusterPeer", "[HttpClusterPeer]")
+{
+    // The peer assigns the first free string id of the node to another
+    // string than this node, whose cache already has a tile of the node.
+    HttpService peerService;
+    peerService.add(std::make_shared<AttributeDataSource>("peerAttribute"));
+    peerService.go();
+
+    auto localSource = std::make_shared<AttributeDataSource>("localAttribute");
+    auto cache = std::make_shared<MemCache>();
+    auto localStrings = cache->getStringPool("InProcessNode");
+    auto localId = localStrings->emplace("localAttribute");
+
+    MapTileKey key;
+    key.mapId_ = "Strings";
+    key.layerId_ = "WayLayer";
+    key.tileId_ = TileId(1);
+    HttpClusterPeer peer("localhost", peerService.port());
+    auto info = localSource->info();
+
+    for (auto i = 0; i < 2; ++i) {
+        auto tiles = peer.get({key}, cache, info, {});
+        REQUIRE(tiles.size() == 1);
+        auto tile = std::dynamic_pointer_cast<TileFeatureLayer>(tiles[0]);
+        REQUIRE(tile);
+
+        // The forwarded tile uses the strings of the local cache,
+        // whose existing strings keep their ids.
+        REQUIRE(tile->strings() == localStrings);
+        REQUIRE(tile->at(0)->toJson()["properties"]["peerAttribute"] == "yes");
+        REQUIRE(localStrings->resolve(localId) == "localAttribute");
+        REQUIRE(localStrings->emplace("peerAttribute") != localId);
+    }
+
+    // The asynchronous variant runs on the request threads of the peer.
+    std::promise<std::vector<TileLayer::Ptr>> asyncTiles;
+    peer.getAsync(
+        {key},
+        cache,
+        info,
+        [&](std::vector<TileLayer::Ptr> layers) { asyncTiles.set_value(std::move(layers)); },
+        {});
+    auto tiles = asyncTiles.get_future().get();
+    REQUIRE(tiles.size() == 1);
+    auto asyncTile = std::dynamic_pointer_cast<TileFeatureLayer>(tiles[0]);
+    REQUIRE(asyncTile);
+    REQUIRE(asyncTile->strings() == localStrings);
+
+    // A peer which is gone yields null tiles.
+    peerService.stop();
+    std::promise<std::vector<TileLayer::Ptr>> failedTiles;
+    peer.getAsync(
+        {key},
+        cache,
+        info,
+        [&](std::vector<TileLayer::Ptr> layers) { failedTiles.set_value(std::move(layers)); },
+        {});
+    tiles = failedTiles.get_future().get();
+    REQUIRE(tiles.size() == 1);
+    REQUIRE(tiles[0] == nullptr);
+}
+
+TEST_CASE("HttpAdmissionControl", "[HttpAdmissionControl]")
+{
+    auto dataSource = std::make_shared<BlockingAttributeDataSource>();
+    HttpService service;
+    service.setAdmissionLimits(2, 0);
+    service.add(dataSource);
+    service.go();
+
+    // The first request is admitted, and its tiles stay queued while the fill blocks.
+    HttpClient client("localhost", service.port());
+    auto admitted = std::make_shared<LayerTilesRequest>(
+        "Strings",
+        "WayLayer",
+        std::vector<TileId>{TileId(1), TileId(2)});
+    client.request(admitted);
+    auto waitUntil = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (dataSource->fillCount_ == 0 && std::chrono::steady_clock::now() < waitUntil)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    REQUIRE(dataSource->fillCount_ > 0);
+
+    SECTION("Rejections tell the client when to retry")
+    {
+        httplib::Client cli("localhost", service.port());
+        auto res = cli.Post(
+            "/tiles",
+            R"({"requests": [{"mapId": "Strings", "layerId": "WayLayer", "tileIds": [3]}]})",
+            "application/json");
+        REQUIRE(res != nullptr);
+        REQUIRE(res->status == 429);
+        REQUIRE(res->get_header_value("Retry-After") == "1");
+    }
+
+    SECTION("HttpClient aborts rejected requests")
+    {
+        auto rejected = std::make_shared<LayerTilesRequest>(
+            "Strings",
+            "WayLayer",
+            std::vector<TileId>{TileId(3)});
+        client.request(rejected)->wait();
+        REQUIRE(rejected->getStatus() == RequestStatus::Aborted);
+    }
+
+    // The queued tiles of the admitted request are still delivered.
+    dataSource->isBlocking_ = false;
+    admitted->wait();
+    REQUIRE(admitted->getStatus() == RequestStatus::Success);
+
+    service.stop();
+}
+
+TEST_CASE("Warm", "[Warm]")
+{
+    auto info = DataSourceInfo::fromJson(R"(
+    {
+        "mapId": "Warmed",
+        "layers": {
+            "WayLayer": {
+                "featureTypes": [{
+                    "name": "Way",
+                    "uniqueIdCompositions": [[{"partId": "wayId", "datatype": "U32"}]]
+                }]
+            }
+        }
+    }
+    )"_json);
+
+    // Fills are slow, so that parallel batches overlap.
+    DataSourceServer ds(info);
+    std::atomic_int numFills = 0;
+    std::atomic_int numRunningFills = 0;
+    std::atomic_int maxRunningFills = 0;
+    ds.onTileFeatureRequest(
+        [&](auto const& tile)
+        {
+            auto running = ++numRunningFills;
+            auto max = maxRunningFills.load();
+            while (running > max && !maxRunningFills.compare_exchange_weak(max, running)) {
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            tile->newFeature("Way", {{"wayId", 1}});
+            --numRunningFills;
+            ++numFills;
+        });
+    ds.go();
+
+    auto tempDir = fs::temp_directory_path() / test::generateTimestampedDirectoryName("mapget_test_warm");
+    fs::create_directory(tempDir);
+    auto progressFile = (tempDir / "warm.progress").string();
+    auto numTiles = TileId::tilesInBBox({0., 0.}, {20., 20.}, 6).size();
+
+    REQUIRE(runFromCommandLine({
+        "warm",
+        "-m", "Warmed",
+        "-z", "6",
+        "-b", "0", "0", "20", "20",
+        "-d", fmt::format("localhost:{}", ds.port()),
+        "--batch-size", "1",
+        "--parallel-batches", "4",
+        "--progress-file", progressFile}) == 0);
+
+    // Each tile was filled once, by batches which ran at the same time.
+    REQUIRE(numFills == numTiles);
+    REQUIRE(maxRunningFills > 1);
+
+    // The progress covers all tiles, once all batches are done.
+    std::ifstream progress(progressFile);
+    std::string key;
+    size_t done = 0;
+    REQUIRE(progress >> key >> done);
+    REQUIRE(key == fmt::format("Warmed/{}", numTiles));
+    REQUIRE(done == numTiles);
+
+    ds.stop();
+    fs::remove_all(tempDir);
+}
+
+TEST_CASE("Warm from config", "[Warm]")
+{
+    auto info = DataSourceInfo::fromJson(R"(
+    {
+        "mapId": "WarmedFromConfig",
+        "layers": {
+            "WayLayer": {
+                "featureTypes": [{
+                    "name": "Way",
+                    "uniqueIdCompositions": [[{"partId": "wayId", "datatype": "U32"}]]
+                }]
+            }
+        }
+    }
+    )"_json);
+
+    DataSourceServer ds(info);
+    std::atomic_int numFills = 0;
+    ds.onTileFeatureRequest(
+        [&](auto const& tile)
+        {
+            tile->newFeature("Way", {{"wayId", 1}});
+            ++numFills;
+        });
+    ds.go();
+
+    // The data source is only known from the config, which
+    // the service makes its sources of in the background.
+    auto tempDir = fs::temp_directory_path() / test::generateTimestampedDirectoryName("mapget_test_warm_config");
+    fs::create_directory(tempDir);
+    auto tempConfigPath = tempDir / "warm_config.yaml";
+    {
+        std::ofstream out(tempConfigPath, std::ios_base::trunc);
+        out << fmt::format("sources:\n  - type: DataSourceHost\n    url: localhost:{}\n", ds.port());
+    }
+    DataSourceConfigService::get().reset();
+
+    REQUIRE(runFromCommandLine({
+        "--config", tempConfigPath.string(),
+        "warm",
+        "-m", "WarmedFromConfig",
+        "-z", "6",
+        "-b", "0", "0", "20", "20"}) == 0);
+    REQUIRE(numFills == TileId::tilesInBBox({0., 0.}, {20., 20.}, 6).size());
+
+    ds.stop();
+    DataSourceConfigService::get().end();
+    fs::remove_all(tempDir);
+}
+
+TEST_CASE("HttpCompression", "[HttpCompression]")
+{
+    SECTION("Accept-Encoding negotiation")
+    {
+        REQUIRE(acceptsEncoding("zstd", ZstdContentEncoding));
+        REQUIRE(acceptsEncoding("gzip, deflate, br, zstd", ZstdContentEncoding));
+        REQUIRE(acceptsEncoding("gzip;q=1.0, zstd;q=0.5", ZstdContentEncoding));
+        REQUIRE(acceptsEncoding("*", ZstdContentEncoding));
+        REQUIRE(!acceptsEncoding("", ZstdContentEncoding));
+        REQUIRE(!acceptsEncoding("gzip, deflate", ZstdContentEncoding));
+        REQUIRE(!acceptsEncoding("zstd;q=0", ZstdContentEncoding));
+    }
+
+    SECTION("Flushed chunks can be decoded progressively")
+    {
+        ZstdStreamCompressor compressor;
+        ZstdStreamDecompressor decompressor;
+        std::string decompressed;
+        std::string expected;
+        for (auto i = 0; i < 3; ++i) {
+            auto chunk = std::string(10000, static_cast<char>('a' + i));
+            expected += chunk;
+            std::string compressed;
+            compressor.compress(chunk, compressed, i == 2);
+            REQUIRE(compressed.size() < chunk.size());
+
+            // Every chunk is complete without the following ones.
+            decompressor.decompress(compressed, decompressed);
+            REQUIRE(decompressed == expected);
+        }
+    }
+
+    SECTION("Buffered chunks are decoded once flushed")
+    {
+        ZstdStreamCompressor compressor;
+        ZstdStreamDecompressor decompressor;
+        std::string compressed;
+        std::string expected;
+        for (auto i = 0; i < 3; ++i) {
+            auto chunk = std::string(10000, static_cast<char>('a' + i));
+            expected += chunk;
+            compressor.compressBuffered(chunk, compressed);
+        }
+        compressor.compress("", compressed);
+        REQUIRE(compressed.size() < expected.size());
+
+        std::string decompressed;
+        decompressor.decompress(compressed, decompressed);
+        REQUIRE(decompressed == expected);
+    }
+}
+
+#if !defined(_WIN32)
+TEST_CASE("SharedMemoryRing", "[SharedMemoryRing]")
+{
+    std::shared_ptr<SharedMemoryRing> ring = SharedMemoryRing::create(4096);
+    REQUIRE(ring != nullptr);
+    std::shared_ptr<SharedMemoryRing> reader = SharedMemoryRing::open(ring->name());
+    REQUIRE(reader->capacity() == ring->capacity());
+
+    SECTION("Frames are read in chunks of any size")
+    {
+        std::string body;
+        ring->writeFrame("first tile", body);
+        ring->writeFrame(std::string(10000, 'x'), body);  // Too large, sent inline
+        ring->writeFrame("third tile", body);
+
+        std::vector<std::string> received;
+        SharedMemoryRing::FrameReader frameReader(reader);
+        for (auto const& c : body)
+            frameReader.read({&c, 1}, [&](auto&& bytes) { received.emplace_back(bytes); });
+        REQUIRE(received == std::vector<std::string>{"first tile", std::string(10000, 'x'), "third tile"});
+    }
+
+    SECTION("Space of read regions is reused")
+    {
+        // The blobs fill the ring many times over, but none is sent inline.
+        for (auto i = 0; i < 100; ++i) {
+            auto blob = std::string(1000, static_cast<char>('a' + i % 26));
+            std::string body;
+            ring->writeFrame(blob, body);
+            REQUIRE(body.size() < blob.size());
+
+            std::string received;
+            SharedMemoryRing::FrameReader(reader).read(body, [&](auto&& bytes) { received = bytes; });
+            REQUIRE(received == blob);
+        }
+    }
+
+    SECTION("A full ring sends frames inline")
+    {
+        std::string unread;
+        for (auto i = 0; i < 4; ++i)
+            ring->writeFrame(std::string(1000, 'x'), unread);
+        std::string body;
+        ring->writeFrame(std::string(1000, 'y'), body);
+        REQUIRE(body.size() > 1000);
+    }
+
+    SECTION("Abandoned regions fail once they are reused")
+    {
+        ring->setAbandonedRegionTimeout(std::chrono::nanoseconds(0));
+
+        // Reused before it is read.
+        std::string abandoned;
+        ring->writeFrame(std::string(3000, 'a'), abandoned);
+        std::string body;
+        ring->writeFrame(std::string(3000, 'b'), body);
+        REQUIRE_THROWS(SharedMemoryRing::FrameReader(reader).read(abandoned, [](auto&&) {}));
+
+        // Reused while it is read.
+        REQUIRE_THROWS(SharedMemoryRing::FrameReader(reader).read(body, [&](auto&&) {
+            std::string otherBody;
+            ring->writeFrame(std::string(3000, 'c'), otherBody);
+        }));
+    }
+}
+#endif
+
 TEST_CASE("Configuration Endpoint Tests", "[Configuration]")
 {
     auto tempDir = fs::temp_directory_path() / test::generateTimestampedDirectoryName("mapget_test_http_config");
@@ -433,4 +433,22 @@ TEST_CASE("Attribute Validity", "[validity]") {
         ++validityIndex;
         return true;
     });
+
+    // The batch resolver shares the length tables, with the same results.
+    auto batchGeometries = validities->computeGeometries(geometryCollection);
+    REQUIRE(batchGeometries.size() == expectedGeometry.size());
+    for (auto i = 0; i < batchGeometries.size(); ++i) {
+        REQUIRE(batchGeometries[i].points_.size() == expectedGeometry[i].size());
+        for (auto pointIndex = 0; pointIndex < batchGeometries[i].points_.size(); ++pointIndex) {
+            using namespace Catch::Matchers;
+            REQUIRE_THAT(batchGeometries[i].points_[pointIndex].x, WithinRel(expectedGeometry[i][pointIndex].x));
+            REQUIRE_THAT(batchGeometries[i].points_[pointIndex].y, WithinRel(expectedGeometry[i][pointIndex].y));
+        }
+    }
+
+    // The cumulative lengths end at the length of the line.
+    auto lengths = linestringGeom->cumulativeLengths();
+    REQUIRE(lengths->size() == 3);
+    REQUIRE(lengths->front() == 0.);
+    REQUIRE_THAT(lengths->back(), Catch::Matchers::WithinRel(linestringGeom->length()));
 }
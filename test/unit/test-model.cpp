@@ -1,11 +1,18 @@
 #include <catch2/catch_test_macros.hpp>
 
+#include "mapget/model/binarylayer.h"
+#include "mapget/model/columnpages.h"
 #include "mapget/model/featurelayer.h"
+#include "mapget/model/sourcedata.h"
+#include "mapget/model/sourcedatalayer.h"
+#include "mapget/model/jsonwriter.h"
 #include "mapget/model/stream.h"
 #include "nlohmann/json.hpp"
 #include "mapget/log.h"
 #include "nlohmann/json_fwd.hpp"
 
+#include <thread>
+
 using namespace mapget;
 
 TEST_CASE("FeatureLayer", "[test.featurelayer]")
@@ -167,6 +174,32 @@ TEST_CASE("FeatureLayer", "[test.featurelayer]")
         REQUIRE(res == exp);
     }
 
+    SECTION("Write JSON without building it first")
+    {
+        std::string json;
+        tile->writeJson(json);
+        REQUIRE(nlohmann::json::parse(json) == tile->toJson());
+
+        // GeoJSON features only have the RFC 7946 members.
+        std::string geoJson;
+        tile->writeJson(geoJson, JsonLayout::GeoJson);
+        auto features = nlohmann::json::parse(geoJson)["features"];
+        REQUIRE(features.size() == 2);
+        auto feature1Json = feature1->toJson();
+        auto const& geoJsonFeature1 = features[1];
+        REQUIRE(geoJsonFeature1.size() == 4);
+        REQUIRE(geoJsonFeature1["type"] == "Feature");
+        REQUIRE(geoJsonFeature1["id"] == feature1Json["id"]);
+        REQUIRE(geoJsonFeature1["geometry"] == feature1Json["geometry"]);
+        REQUIRE(geoJsonFeature1["properties"]["typeId"] == "Way");
+        REQUIRE(geoJsonFeature1["properties"]["main_ingredient"] == "Pepper");
+
+        std::string escaped;
+        writeJsonString("a\"b\\c\n\x01", escaped);
+        REQUIRE(escaped == R"("a\"b\\c\n\u0001")");
+        REQUIRE(nlohmann::json::parse(escaped) == "a\"b\\c\n\x01");
+    }
+
     SECTION("Basic field access")
     {
         REQUIRE(feature1->typeId() == "Way");
@@ -182,6 +215,23 @@ TEST_CASE("FeatureLayer", "[test.featurelayer]")
                 .toString() == "true");
     }
 
+    SECTION("Evaluate a query on tiles with a shared string pool")
+    {
+        // The tiles share the compiled query, but evaluate it on their own features.
+        auto otherTile = std::make_shared<TileFeatureLayer>(
+            TileId::fromWgs84(42., 11., 13),
+            "TastyTomatoSaladNode",
+            "Tropico",
+            layerInfo,
+            strings);
+        auto otherFeature = otherTile->newFeature("Way", {{"areaId", "TheBestArea"}, {"wayId", 7}});
+        otherFeature->attributes()->addField("main_ingredient", "Tomato");
+
+        REQUIRE(feature1->evaluate("properties.main_ingredient").toString() == "Pepper");
+        REQUIRE(otherFeature->evaluate("properties.main_ingredient").toString() == "Tomato");
+        REQUIRE(feature1->evaluate("properties.main_ingredient").toString() == "Pepper");
+    }
+
     SECTION("Range-based for loop")
     {
         for (auto feature : *tile) {
@@ -247,6 +297,34 @@ TEST_CASE("FeatureLayer", "[test.featurelayer]")
         }
     }
 
+    SECTION("Lazy column decoding")
+    {
+        std::stringstream tileBytes;
+        tile->write(tileBytes);
+        auto parseTile = [&](std::stringstream& bytes) {
+            return std::make_shared<TileFeatureLayer>(
+                bytes,
+                [&](auto&& mapName, auto&& layerName) { return layerInfo; },
+                [&](auto&& nodeId) { return strings; });
+        };
+
+        // Columns which were not decoded are written out as they were read.
+        auto deserializedTile = parseTile(tileBytes);
+        std::stringstream rewrittenBytes;
+        deserializedTile->write(rewrittenBytes);
+        REQUIRE(rewrittenBytes.str() == tileBytes.str());
+
+        // A lookup only decodes the columns it needs, the others follow on access.
+        auto foundFeature = deserializedTile->find("Way.TheBestArea.42");
+        REQUIRE(foundFeature);
+        REQUIRE(foundFeature->addr() == feature1->addr());
+        REQUIRE(deserializedTile->toJson() == tile->toJson());
+
+        std::stringstream decodedBytes;
+        deserializedTile->write(decodedBytes);
+        REQUIRE(decodedBytes.str() == tileBytes.str());
+    }
+
     SECTION("Stream")
     {
         // We will write the same tile into the stream twice,
@@ -306,6 +384,154 @@ TEST_CASE("FeatureLayer", "[test.featurelayer]")
         REQUIRE(readTiles[2]->numRoots() == 3);
     }
 
+    SECTION("Compact geometry encoding")
+    {
+        auto pointsOf = [](TileFeatureLayer::Ptr const& layer) {
+            std::vector<Point> points;
+            for (auto feature : *layer) {
+                auto geometries = feature->geomOrNull();
+                if (!geometries)
+                    continue;
+                geometries->forEachGeometry([&](auto&& geometry) {
+                    geometry->forEachPoint([&](auto&& point) {
+                        points.push_back(point);
+                        return true;
+                    });
+                    return true;
+                });
+            }
+            return points;
+        };
+        auto parseTile = [&](std::string const& bytes) {
+            std::stringstream stream(bytes);
+            return std::make_shared<TileFeatureLayer>(
+                stream,
+                [&](auto&& mapName, auto&& layerName) { return layerInfo; },
+                [&](auto&& nodeId) { return strings; });
+        };
+
+        // A road-like line with closely spaced vertices.
+        auto road = tile->newFeature("Way", {{"wayId", 44}})->geom()->newGeometry(GeomType::Line, 1000);
+        for (auto i = 0; i < 1000; ++i)
+            road->append({41. + i * 1e-5, 10. + i * 2e-5, 0.});
+
+        std::stringstream rawBytes;
+        std::stringstream compactBytes;
+        tile->write(rawBytes);
+        tile->write(compactBytes, TileFeatureLayer::GeometryEncoding::QuantizedDelta);
+        REQUIRE(compactBytes.str().size() < rawBytes.str().size());
+
+        // The vertices are restored up to the quantization resolution.
+        auto expectedPoints = pointsOf(tile);
+        auto compactTile = parseTile(compactBytes.str());
+        auto compactPoints = pointsOf(compactTile);
+        REQUIRE(!expectedPoints.empty());
+        REQUIRE(compactPoints.size() == expectedPoints.size());
+        for (size_t i = 0; i < expectedPoints.size(); ++i) {
+            REQUIRE(std::abs(compactPoints[i].x - expectedPoints[i].x) < 1e-6);
+            REQUIRE(std::abs(compactPoints[i].y - expectedPoints[i].y) < 1e-6);
+            REQUIRE(std::abs(compactPoints[i].z - expectedPoints[i].z) < 1e-3);
+        }
+
+        // A compact tile can be written with raw geometry for older readers.
+        std::stringstream rewrittenBytes;
+        parseTile(compactBytes.str())->write(rewrittenBytes);
+        REQUIRE(pointsOf(parseTile(rewrittenBytes.str())).size() == expectedPoints.size());
+
+        // Writers only use the compact encoding for readers which support it.
+        std::vector<std::string> messages;
+        TileLayerStream::StringPoolOffsetMap stringOffsets;
+        TileLayerStream::Writer writer{[&](auto&& msg, auto&& type) { messages.push_back(msg); }, stringOffsets};
+        writer.setProtocolVersion(TileLayerStream::MinimumProtocolVersion);
+        writer.writeLayer(tile);
+        writer.setProtocolVersion(TileLayerStream::CurrentProtocolVersion);
+        writer.writeLayer(tile);
+        REQUIRE(messages.size() == 2);
+        REQUIRE(messages[0].substr(11) == rawBytes.str());
+        REQUIRE(messages[1].substr(11) == compactBytes.str());
+        REQUIRE_THROWS(writer.setProtocolVersion(Version{0, 1, 0}));
+    }
+
+    SECTION("Stream with parallel decoding")
+    {
+        std::stringstream byteStream;
+        TileLayerStream::StringPoolOffsetMap stringOffsets;
+        TileLayerStream::Writer layerWriter{[&](auto&& msg, auto&& type) { byteStream << msg; }, stringOffsets};
+        layerWriter.write(tile);
+        auto feature2 = tile->newFeature("Way", {{"wayId", 43}});
+        layerWriter.write(tile);
+
+        // Decode every layer on its own thread, and deliver the
+        // layers in the order in which they were written.
+        std::vector<std::thread> decodingThreads;
+        std::vector<TileFeatureLayer::Ptr> readTiles;
+        TileLayerStream::Reader reader{
+            [&](auto&& mapId, auto&& layerId) { return layerInfo; },
+            [&](auto&& layerPtr) {
+                if (auto featureLayer = std::dynamic_pointer_cast<TileFeatureLayer>(layerPtr))
+                    readTiles.push_back(featureLayer);
+            },
+        };
+        reader.setParallelDecoding([&](auto&& task) { decodingThreads.emplace_back(std::move(task)); });
+        reader.read(byteStream.str());
+        reader.wait();
+        for (auto& thread : decodingThreads)
+            thread.join();
+
+        REQUIRE(decodingThreads.size() == 2);
+        REQUIRE(readTiles.size() == 2);
+        REQUIRE(readTiles[0]->numRoots() == 2);
+        REQUIRE(readTiles[1]->numRoots() == 3);
+        REQUIRE(readTiles[1]->strings() == readTiles[0]->strings());
+    }
+
+    SECTION("Forward a serialized tile layer")
+    {
+        // Serialize the tile as a cache does, i.e. with a full string pool.
+        tile->setTtl(std::chrono::minutes(5));
+        std::string tileMessage;
+        TileLayerStream::StringPoolOffsetMap cacheStringOffsets;
+        TileLayerStream::Writer cacheWriter{[&](auto&& msg, auto&& type){
+            if (type == TileLayerStream::MessageType::TileFeatureLayer)
+                tileMessage = msg;
+        }, cacheStringOffsets, false};
+        cacheWriter.write(tile);
+        auto header = TileLayerStream::Reader::readTileLayerHeader(tileMessage);
+        REQUIRE(header.nodeId_ == "TastyTomatoSaladNode");
+        REQUIRE(header.tileId_ == tile->tileId());
+        REQUIRE(header.expiresAt() == tile->expiresAt());
+        REQUIRE(header.expiresAt() == tile->timestamp() + std::chrono::minutes(5));
+        REQUIRE_THROWS(TileLayerStream::Reader::readTileLayerHeader(tileMessage.substr(0, 20)));
+
+        // Forward the message twice. Only the first one needs the strings.
+        std::vector<TileLayerStream::MessageType> messageTypes;
+        std::stringstream byteStream;
+        TileLayerStream::StringPoolOffsetMap clientStringOffsets;
+        TileLayerStream::Writer layerWriter{[&](auto&& msg, auto&& type){
+            messageTypes.push_back(type);
+            byteStream << msg;
+        }, clientStringOffsets};
+        layerWriter.write(tileMessage, *strings);
+        layerWriter.write(tileMessage, *strings);
+        REQUIRE(messageTypes == std::vector{
+            TileLayerStream::MessageType::StringPool,
+            TileLayerStream::MessageType::TileFeatureLayer,
+            TileLayerStream::MessageType::TileFeatureLayer});
+
+        std::vector<TileFeatureLayer::Ptr> readTiles;
+        TileLayerStream::Reader reader{
+            [&](auto&& mapId, auto&& layerId) { return layerInfo; },
+            [&](auto&& layerPtr) {
+                if (auto featureLayer = std::dynamic_pointer_cast<TileFeatureLayer>(layerPtr))
+                    readTiles.push_back(featureLayer);
+            },
+        };
+        reader.read(byteStream.str());
+        REQUIRE(readTiles.size() == 2);
+        REQUIRE(readTiles[1]->numRoots() == tile->numRoots());
+        REQUIRE(nlohmann::to_string(readTiles[1]->toJson()) == nlohmann::to_string(tile->toJson()));
+    }
+
     SECTION("Find")
     {
         auto foundFeature01 = tile->find("Way", KeyValueViewPairs{{"areaId", "TheBestArea"}, {"wayId", 24}});
@@ -329,6 +555,525 @@ TEST_CASE("FeatureLayer", "[test.featurelayer]")
         auto foundFeature10 = tile->find("Way", KeyValueViewPairs{{"wayId", 42}});
         REQUIRE(!foundFeature10);
     }
+
+    SECTION("Find with optional id parts")
+    {
+        auto nodeLayerInfo = LayerInfo::fromJson(R"({
+            "layerId": "NodeLayer",
+            "type": "Features",
+            "featureTypes": [
+                {
+                    "name": "Node",
+                    "uniqueIdCompositions": [
+                        [
+                            {"partId": "areaId", "datatype": "STR", "isOptional": true},
+                            {"partId": "nodeId", "datatype": "U32"},
+                            {"partId": "version", "datatype": "U32", "isOptional": true}
+                        ]
+                    ]
+                }
+            ]
+        })"_json);
+        auto nodeTile = std::make_shared<TileFeatureLayer>(
+            TileId::fromWgs84(42., 11., 13),
+            "TastyTomatoSaladNode",
+            "Tropico",
+            nodeLayerInfo,
+            strings);
+
+        // The trailing optional part may be omitted, and optional parts
+        // are ignored when features are looked up.
+        auto node = nodeTile->newFeature("Node", {{"nodeId", 7}});
+        auto versionedNode = nodeTile->newFeature("Node", {{"areaId", "TheBestArea"}, {"nodeId", 8}, {"version", 2}});
+
+        auto foundNode = nodeTile->find("Node", KeyValueViewPairs{{"areaId", "MediocreArea"}, {"nodeId", 7}, {"version", 5}});
+        REQUIRE(foundNode);
+        REQUIRE(foundNode->addr() == node->addr());
+
+        auto foundVersionedNode = nodeTile->find("Node", KeyValueViewPairs{{"nodeId", 8}});
+        REQUIRE(foundVersionedNode);
+        REQUIRE(foundVersionedNode->addr() == versionedNode->addr());
+
+        REQUIRE(!nodeTile->find("Node", KeyValueViewPairs{{"nodeId", 9}}));
+        REQUIRE(!nodeTile->find("Node", KeyValueViewPairs{{"areaId", "TheBestArea"}}));
+    }
+
+    SECTION("Find intersecting features")
+    {
+        // Add a 20x20 grid of point features, with a spacing of 0.01 degrees.
+        // The geometries of feature1 span from (0, 0) to (43, 11).
+        for (auto i = 0; i < 400; ++i) {
+            auto feature = tile->newFeature("Way", {{"wayId", 2000 + i}});
+            feature->addPoint({i % 20 * 0.01, i / 20 * 0.01});
+        }
+
+        auto wayIds = [](std::vector<model_ptr<Feature>> const& features) {
+            std::vector<int64_t> result;
+            for (auto const& feature : features)
+                result.emplace_back(std::get<int64_t>(feature->id()->keyValuePairs().back().second));
+            return result;
+        };
+
+        auto gridQuery = [&]{ return wayIds(tile->findIntersecting({0.025, 0.025}, {0.055, 0.045})); };
+        auto lineQuery = [&]{ return wayIds(tile->findIntersecting({42., 10.}, {42.1, 10.1})); };
+        auto scannedGrid = gridQuery();
+        auto scannedLine = lineQuery();
+        REQUIRE(scannedGrid == std::vector<int64_t>{42, 2063, 2064, 2065, 2083, 2084, 2085});
+        REQUIRE(scannedLine == std::vector<int64_t>{42});
+        REQUIRE(tile->findIntersecting({50., 50.}, {60., 60.}).empty());
+
+        // The read-only layer uses its spatial index, which must agree with the scan.
+        tile->setReadOnly();
+        REQUIRE(gridQuery() == scannedGrid);
+        REQUIRE(lineQuery() == scannedLine);
+        REQUIRE(wayIds(tile->findIntersecting({0.085, 0.185}, {0.105, 0.195})) == std::vector<int64_t>{42, 2389, 2390});
+        REQUIRE(tile->findIntersecting({-1., -1.}, {50., 50.}).size() == 401);
+        REQUIRE(tile->findIntersecting({50., 50.}, {60., 60.}).empty());
+    }
+
+    SECTION("Find by attribute")
+    {
+        // Add ways with integer speed limits, and some with float ones.
+        for (auto i = 0; i < 100; ++i) {
+            auto feature = tile->newFeature("Way", {{"wayId", 3000 + i}});
+            if (i % 10 == 9)
+                feature->attributes()->addField("speedLimit", static_cast<double>(i) + .5);
+            else
+                feature->attributes()->addField("speedLimit", static_cast<int64_t>(i));
+        }
+
+        auto wayIds = [](std::vector<model_ptr<Feature>> const& features) {
+            std::vector<int64_t> result;
+            for (auto const& feature : features)
+                result.emplace_back(std::get<int64_t>(feature->id()->keyValuePairs().back().second));
+            return result;
+        };
+
+        auto columns = tile->attributeColumns("speedLimit");
+        REQUIRE(columns);
+        REQUIRE(columns->size() == 1);
+        REQUIRE(columns->front().typeId_ == "Way");
+        REQUIRE(columns->front().features_.size() == 100);
+        REQUIRE(std::holds_alternative<std::vector<double>>(columns->front().values_));
+
+        // Strict comparisons are scanned as non-strict ones.
+        auto filter = TileFeatureLayer::AttributeFilter::fromQuery("properties.speedLimit > 96");
+        REQUIRE(filter);
+        REQUIRE(filter->op_ == TileFeatureLayer::AttributeFilter::Op::Greater);
+        auto candidates = tile->findByAttribute(*filter);
+        REQUIRE(candidates);
+        REQUIRE(wayIds(*candidates) == std::vector<int64_t>{3096, 3097, 3098, 3099});
+
+        filter = TileFeatureLayer::AttributeFilter::fromQuery("properties.speedLimit == 19.5");
+        REQUIRE(filter);
+        REQUIRE(wayIds(*tile->findByAttribute(*filter)) == std::vector<int64_t>{3019});
+
+        // The read-only layer caches the columns, the scan agrees.
+        tile->setReadOnly();
+        REQUIRE(tile->attributeColumns("speedLimit") == tile->attributeColumns("speedLimit"));
+        filter = TileFeatureLayer::AttributeFilter::fromQuery("properties.speedLimit<=2");
+        REQUIRE(wayIds(*tile->findByAttribute(*filter)) == std::vector<int64_t>{3000, 3001, 3002});
+
+        // Attributes with other values have no columns.
+        REQUIRE(!tile->attributeColumns("main_ingredient"));
+        filter = TileFeatureLayer::AttributeFilter::fromQuery("properties.main_ingredient > 1");
+        REQUIRE(filter);
+        REQUIRE(!tile->findByAttribute(*filter));
+
+        REQUIRE(!TileFeatureLayer::AttributeFilter::fromQuery("properties.speedLimit != 80"));
+        REQUIRE(!TileFeatureLayer::AttributeFilter::fromQuery("properties.speedLimit > 80 and true"));
+        REQUIRE(!TileFeatureLayer::AttributeFilter::fromQuery("properties.layer > 1"));
+    }
+
+    SECTION("Memoized matching features")
+    {
+        auto firstWay = static_cast<uint32_t>(tile->size());
+        for (auto i = 0; i < 10; ++i)
+            tile->newFeature("Way", {{"wayId", 4000 + i}})->attributes()->addField("speedLimit", static_cast<int64_t>(i));
+        auto const scanQuery = "properties.speedLimit >= 7";
+        auto const otherQuery = "properties.speedLimit == 2 or properties.speedLimit == 5";
+        std::vector<uint32_t> const scanMatches{firstWay + 7, firstWay + 8, firstWay + 9};
+        std::vector<uint32_t> const otherMatches{firstWay + 2, firstWay + 5};
+
+        // Writable layers evaluate each query anew.
+        REQUIRE(*tile->matchingFeatures(scanQuery) == scanMatches);
+        REQUIRE(tile->matchingFeatures(scanQuery) != tile->matchingFeatures(scanQuery));
+
+        // Read-only layers memoize the results, which agree with the evaluation.
+        tile->setReadOnly();
+        auto memoized = tile->matchingFeatures(scanQuery);
+        REQUIRE(*memoized == scanMatches);
+        REQUIRE(tile->matchingFeatures(scanQuery) == memoized);
+        REQUIRE(*tile->matchingFeatures(otherQuery) == otherMatches);
+        REQUIRE(tile->matchingFeatures("properties.speedLimit > 100")->empty());
+
+        // Without memoization, the results are evaluated anew.
+        TileFeatureLayer::setMaxMemoizedQueries(0);
+        REQUIRE(tile->matchingFeatures(otherQuery) != tile->matchingFeatures(otherQuery));
+        TileFeatureLayer::setMaxMemoizedQueries(TileFeatureLayer::DefaultMaxMemoizedQueries);
+    }
+
+    SECTION("Find while the index grows")
+    {
+        // The first lookup builds the index table, which must
+        // pick up all features which are added afterwards.
+        REQUIRE(tile->find("Way.TheBestArea.24"));
+        std::vector<model_ptr<Feature>> features;
+        for (auto wayId = 1000; wayId < 1100; ++wayId) {
+            features.emplace_back(tile->newFeature("Way", {{"wayId", wayId}}));
+            REQUIRE(tile->find("Way", KeyValueViewPairs{{"areaId", "TheBestArea"}, {"wayId", wayId}}));
+        }
+        for (auto const& feature : features) {
+            auto found = tile->find(feature->id()->toString());
+            REQUIRE(found);
+            REQUIRE(found->addr() == feature->addr());
+        }
+        REQUIRE(!tile->find("Way.TheBestArea.1100"));
+
+        // A parsed layer builds its table from the serialized index.
+        std::stringstream tileBytes;
+        tile->write(tileBytes);
+        auto deserializedTile = std::make_shared<TileFeatureLayer>(
+            tileBytes,
+            [&](auto&&, auto&&) { return layerInfo; },
+            [&](auto&&) { return strings; });
+        for (auto const& feature : features) {
+            auto found = deserializedTile->find(feature->id()->toString());
+            REQUIRE(found);
+            REQUIRE(found->addr() == feature->addr());
+        }
+        REQUIRE(!deserializedTile->find("Way.MediocreArea.1000"));
+    }
+
+    SECTION("Geometry bounding boxes")
+    {
+        auto lineBox = line->bbox();
+        REQUIRE(lineBox);
+        REQUIRE(*lineBox == BBox{{41., 10.}, {43., 11.}});
+
+        // The polygons and meshes reach down to (0, 0) and up to z=3.
+        auto featureBox = feature1->bbox();
+        REQUIRE(featureBox);
+        REQUIRE(*featureBox == BBox{{0., 0., 0.}, {43., 11., 3.}});
+        REQUIRE(!feature0->bbox());
+        REQUIRE(!feature1->geom()->newGeometry(GeomType::Points)->bbox());
+
+        // A parsed layer computes the boxes, as they are not serialized.
+        std::stringstream tileBytes;
+        tile->write(tileBytes);
+        auto deserializedTile = std::make_shared<TileFeatureLayer>(
+            tileBytes,
+            [&](auto&&, auto&&) { return layerInfo; },
+            [&](auto&&) { return strings; });
+        auto deserializedBox = deserializedTile->at(1)->bbox();
+        REQUIRE(deserializedBox);
+        REQUIRE(*deserializedBox == *featureBox);
+    }
+
+    SECTION("Clone features of another layer")
+    {
+        auto auxStrings = std::make_shared<StringPool>("AuxNode");
+        auto auxTile = std::make_shared<TileFeatureLayer>(
+            TileId::fromWgs84(42., 11., 13), "AuxNode", "Tropico", layerInfo, auxStrings);
+        auto auxFeature = auxTile->newFeature("Way", {{"areaId", "TheBestArea"}, {"wayId", 42}});
+        auxFeature->attributes()->addField("topping", "Basil");
+        auto auxLine = auxFeature->geom()->newGeometry(GeomType::Line, 3);
+        auxLine->setName("centerline");
+        auxLine->append({42., 10.});
+        auxLine->append({42.5, 10.25});
+        auxLine->append({43., 10.5});
+        auto newFeature = auxTile->newFeature("Way", {{"areaId", "TheBestArea"}, {"wayId", 99}});
+        newFeature->addPoint({42.1, 10.1});
+
+        TileFeatureLayer::ClonedNodes clonedNodes;
+        for (auto const& feature : *auxTile)
+            tile->clone(clonedNodes, auxTile, *feature, feature->id()->typeId(), feature->id()->keyValuePairs());
+
+        // The aux data is appended to feature1, and the other feature is added.
+        REQUIRE(tile->size() == 3);
+        REQUIRE(feature1->evaluate("properties.topping").toString() == "Basil");
+        model_ptr<Geometry> clonedLine;
+        feature1->geom()->forEachGeometry([&](auto&& geometry) {
+            clonedLine = geometry;
+            return true;
+        });
+        REQUIRE(clonedLine->name() == "centerline");
+        REQUIRE(clonedLine->numPoints() == 3);
+        for (size_t i = 0; i < 3; ++i)
+            REQUIRE(clonedLine->pointAt(i) == auxLine->pointAt(i));
+        REQUIRE(*clonedLine->bbox() == *auxLine->bbox());
+        REQUIRE(tile->find("Way.TheBestArea.99"));
+    }
+
+    SECTION("Reserve columns from a size hint")
+    {
+        auto sizes = tile->sizeHint();
+        REQUIRE(sizes.features_ == 2);
+        REQUIRE(sizes.attributes_ == 1);
+        REQUIRE(sizes.attributeLayers_ == 1);
+        REQUIRE(sizes.validities_ == 1);
+        REQUIRE(sizes.relations_ == 0);
+
+        // Reserving does not add nodes, and the columns grow beyond the hint.
+        auto reservedTile = std::make_shared<TileFeatureLayer>(
+            TileId::fromWgs84(42., 11., 13), "TastyTomatoSaladNode", "Tropico", layerInfo, strings);
+        reservedTile->reserve({100, 10, 10, 100, 10, 10, 10});
+        REQUIRE(reservedTile->size() == 0);
+        REQUIRE(reservedTile->sizeHint().features_ == 0);
+        for (auto wayId = 0; wayId < 200; ++wayId)
+            reservedTile->newFeature("Way", {{"areaId", "TheBestArea"}, {"wayId", wayId}})->addPoint({42., 11.});
+        REQUIRE(reservedTile->sizeHint().features_ == 200);
+        REQUIRE(reservedTile->find("Way.TheBestArea.199"));
+
+        tile->setReadOnly();
+        REQUIRE_THROWS(tile->reserve(sizes));
+    }
+
+    SECTION("Create a batch of features")
+    {
+        // Three ways, the second one without geometry.
+        TileFeatureLayer::FeatureBatch batch;
+        batch.typeIds_ = {"Way"};
+        batch.idParts_.emplace_back("wayId", std::vector<int64_t>{100, 101, 102});
+        batch.coordinates_ = {42., 10., 0., 42.5, 10.5, 0., 43., 11., 1., 43.5, 11., 1., 44., 11.5, 1.};
+        batch.geometryOffsets_ = {0, 2, 2, 5};
+        batch.attributes_.emplace_back("name", std::vector<std::string>{"A", "B", "C"});
+        batch.attributes_.emplace_back("lanes", std::vector<int64_t>{1, 2, 3});
+        REQUIRE(batch.size() == 3);
+        REQUIRE(tile->newFeatures(batch) == 3);
+        REQUIRE(tile->size() == 5);
+
+        auto first = tile->find("Way.TheBestArea.100");
+        REQUIRE(first);
+        REQUIRE(first->firstGeometry().geomType_ == GeomType::Line);
+        REQUIRE(first->firstGeometry().points_ == std::vector<Point>{{42., 10.}, {42.5, 10.5}});
+        REQUIRE(first->evaluate("properties.name").toString() == "A");
+
+        auto second = tile->find("Way.TheBestArea.101");
+        REQUIRE(second);
+        REQUIRE(second->firstGeometry().points_.empty());
+        REQUIRE(second->evaluate("properties.lanes").toString() == "2");
+
+        auto third = tile->find("Way.TheBestArea.102");
+        REQUIRE(third);
+        REQUIRE(third->firstGeometry().points_.size() == 3);
+        REQUIRE(third->firstGeometry().points_[2] == Point{44., 11.5, 1.});
+
+        // A column with a missing row is rejected before any feature is added.
+        batch.attributes_.emplace_back("width", std::vector<double>{3.5, 3.});
+        REQUIRE_THROWS(tile->newFeatures(batch));
+        batch.attributes_.pop_back();
+        batch.geometryOffsets_ = {0, 2, 1, 5};
+        REQUIRE_THROWS(tile->newFeatures(batch));
+        REQUIRE(tile->size() == 5);
+    }
+
+    SECTION("Simplify geometries")
+    {
+        auto road = tile->newFeature("Way", {{"areaId", "TheBestArea"}, {"wayId", 77}});
+        auto roadLine = road->geom()->newGeometry(GeomType::Line, 5);
+        roadLine->append({42., 10.});
+        roadLine->append({42.25, 10.0001});
+        roadLine->append({42.5, 10.});
+        roadLine->append({42.75, 10.5});
+        roadLine->append({43., 10.});
+        auto roadPoints = road->geom()->newGeometry(GeomType::Points, 3);
+        roadPoints->append({42., 10.});
+        roadPoints->append({42.25, 10.0001});
+        roadPoints->append({42.5, 10.});
+
+        // Only the vertex which is within the tolerance is dropped.
+        auto simplifiedTile = tile->simplified(0.01);
+        auto simplifiedRoad = simplifiedTile->find("Way.TheBestArea.77");
+        REQUIRE(simplifiedRoad);
+        std::vector<model_ptr<Geometry>> geometries;
+        simplifiedRoad->geom()->forEachGeometry([&](auto&& geometry) {
+            geometries.push_back(geometry);
+            return true;
+        });
+        REQUIRE(geometries.size() == 2);
+        REQUIRE(geometries[0]->numPoints() == 4);
+        REQUIRE(geometries[0]->pointAt(0) == roadLine->pointAt(0));
+        REQUIRE(geometries[0]->pointAt(1) == roadLine->pointAt(2));
+        REQUIRE(geometries[0]->pointAt(3) == roadLine->pointAt(4));
+        REQUIRE(*geometries[0]->bbox() == *roadLine->bbox());
+        REQUIRE(geometries[1]->numPoints() == 3);
+
+        // The other features and the source layer are not changed.
+        REQUIRE(simplifiedTile->size() == tile->size());
+        REQUIRE(roadLine->numPoints() == 5);
+        REQUIRE(simplifiedTile->toJson()["features"][0] == tile->toJson()["features"][0]);
+    }
+
+    SECTION("Project features")
+    {
+        // A projection which keeps everything returns the layer itself.
+        REQUIRE(tile->projected({}) == tile);
+
+        TileFeatureLayer::Projection projection;
+        projection.excludeAttributeLayers_ = {"cheese"};
+        projection.geometry_ = false;
+        auto projectedTile = tile->projected(projection);
+        REQUIRE(projectedTile != tile);
+        REQUIRE(projectedTile->size() == 2);
+        auto projectedFeature = projectedTile->find("Way.TheBestArea.42");
+        REQUIRE(projectedFeature);
+        REQUIRE(projectedFeature->evaluate("properties.main_ingredient").toString() == "Pepper");
+        REQUIRE(!projectedFeature->attributeLayersOrNull());
+        REQUIRE(!projectedFeature->geomOrNull());
+        REQUIRE(feature1->geomOrNull());
+
+        // Feature type filters drop whole features.
+        auto withoutWays = tile->projected(
+            TileFeatureLayer::Projection::fromJson(R"({"featureTypes": {"exclude": ["Way"]}})"_json));
+        REQUIRE(withoutWays->size() == 0);
+        auto onlyWays = tile->projected(
+            TileFeatureLayer::Projection::fromJson(R"({"featureTypes": {"include": ["Way"]}, "sourceDataReferences": false})"_json));
+        REQUIRE(onlyWays->size() == 2);
+        REQUIRE_THROWS(TileFeatureLayer::Projection::fromJson(R"({"featureTypes": ["Way"]})"_json));
+    }
+
+    SECTION("Memory usage")
+    {
+        auto usage = tile->memoryUsage();
+        REQUIRE(usage["features"].get<uint64_t>() > 0);
+        REQUIRE(usage["geometries"].get<uint64_t>() > 0);
+        REQUIRE(usage["point-buffers"].get<uint64_t>() > 0);
+        REQUIRE(usage["simfil-pool"].get<uint64_t>() > 0);
+        REQUIRE(usage["string-pool"].get<uint64_t>() > 0);
+        uint64_t total = 0;
+        for (auto const& [column, bytes] : usage.items()) {
+            if (column != "total" && column != "string-pool")
+                total += bytes.get<uint64_t>();
+        }
+        REQUIRE(usage["total"].get<uint64_t>() == total);
+
+        tile->recordMemoryUsage();
+        REQUIRE(tile->info()["memory-usage"]["features"] == usage["features"]);
+
+        // Columns of a parsed layer are counted once they are decoded.
+        std::stringstream stream;
+        tile->write(stream);
+        auto readTile = std::make_shared<TileFeatureLayer>(
+            stream,
+            [&](auto&&, auto&&) { return layerInfo; },
+            [&](auto&&) { return strings; });
+        auto readUsage = readTile->memoryUsage();
+        REQUIRE(readUsage["features"].get<uint64_t>() == 0);
+        REQUIRE(readUsage["encoded-columns"].get<uint64_t>() > 0);
+        REQUIRE(readTile->find("Way.TheBestArea.42"));
+        REQUIRE(readTile->memoryUsage()["features"].get<uint64_t>() > 0);
+    }
+
+    SECTION("Build a tile in parallel shards")
+    {
+        auto bigTile = std::make_shared<TileFeatureLayer>(tile->tileId(), "TastyTomatoSaladNode", "Tropico", layerInfo, strings);
+        bigTile->setIdPrefix({{"areaId", "TheBestArea"}});
+        auto shards = bigTile->newShards(4);
+        REQUIRE(shards.size() == 4);
+        REQUIRE(shards[0]->strings() != strings);
+
+        std::vector<std::thread> builders;
+        for (size_t i = 0; i < shards.size(); ++i) {
+            builders.emplace_back([&shard = shards[i], i] {
+                for (auto j = 0; j < 100; ++j) {
+                    auto wayId = static_cast<int64_t>(i * 100 + j);
+                    auto feature = shard->newFeature("Way", {{"wayId", wayId}});
+                    feature->attributes()->addField(fmt::format("shard{}", i), wayId);
+                    feature->addLine({{41. + j * .001, 10.}, {41. + j * .001, 10.5}});
+                }
+            });
+        }
+        for (auto& builder : builders)
+            builder.join();
+
+        // Duplicate ids are merged into one feature.
+        shards[1]->newFeature("Way", {{"wayId", 7}})->attributes()->addField("duplicate", "yes");
+
+        bigTile->merge(shards);
+        REQUIRE(bigTile->size() == 400);
+        REQUIRE(bigTile->strings() == strings);
+        for (auto wayId = 0; wayId < 400; ++wayId) {
+            auto feature = bigTile->find(fmt::format("Way.TheBestArea.{}", wayId));
+            REQUIRE(feature);
+            REQUIRE(feature->evaluate(fmt::format("properties.shard{}", wayId / 100)).toString() == std::to_string(wayId));
+            REQUIRE(feature->geom()->numGeometries() == 1);
+        }
+        REQUIRE(bigTile->at(0)->id()->toString() == "Way.TheBestArea.0");
+        REQUIRE(bigTile->at(399)->id()->toString() == "Way.TheBestArea.399");
+        REQUIRE(bigTile->find("Way.TheBestArea.7")->evaluate("properties.duplicate").toString() == "yes");
+    }
+
+    SECTION("Delta against an older tile")
+    {
+        // The newer tile keeps feature1, changes feature0 and adds a feature.
+        auto newTile = std::make_shared<TileFeatureLayer>(tile->tileId(), "TastyTomatoSaladNode", "Tropico", layerInfo, strings);
+        newTile->setIdPrefix({{"areaId", "TheBestArea"}});
+        newTile->setTimestamp(tile->timestamp() + std::chrono::seconds(1));
+        TileFeatureLayer::ClonedNodes clonedNodes(true);
+        newTile->clone(clonedNodes, tile, *feature1, "Way", {{"wayId", 42}});
+        newTile->newFeature("Way", {{"wayId", 24}})->attributes()->addField("main_ingredient", "Tomato");
+        newTile->newFeature("Way", {{"wayId", 7}});
+
+        auto delta = newTile->delta(tile);
+        REQUIRE(delta->isDelta());
+        REQUIRE(delta->deltaBaseTimestamp() == tile->timestamp());
+        REQUIRE(delta->size() == 2);
+        REQUIRE(!delta->find("Way.TheBestArea.42"));
+        REQUIRE(delta->info()["delta"]["removedFeatures"].empty());
+
+        auto reverseDelta = tile->delta(newTile);
+        REQUIRE(reverseDelta->size() == 1);
+        REQUIRE(reverseDelta->info()["delta"]["removedFeatures"] == R"([
+            {"typeId": "Way", "idParts": [["areaId", "TheBestArea"], ["wayId", 7]]}
+        ])"_json);
+        auto restored = newTile->applyDelta(reverseDelta);
+        REQUIRE(restored->size() == 2);
+        REQUIRE(!restored->find("Way.TheBestArea.7"));
+
+        // Deltas survive serialization, and only apply to their base.
+        std::stringstream stream;
+        delta->write(stream);
+        auto readDelta = std::make_shared<TileFeatureLayer>(
+            stream,
+            [&](auto&&, auto&&) { return layerInfo; },
+            [&](auto&&) { return strings; });
+        REQUIRE_THROWS(newTile->applyDelta(readDelta));
+
+        auto patched = tile->applyDelta(readDelta);
+        REQUIRE(!patched->isDelta());
+        REQUIRE(patched->timestamp() == newTile->timestamp());
+        REQUIRE(patched->size() == 3);
+        for (auto const& feature : *newTile) {
+            auto patchedFeature = patched->find(feature->id()->toString());
+            REQUIRE(patchedFeature);
+            REQUIRE(patchedFeature->toJson() == feature->toJson());
+        }
+    }
+
+    SECTION("Entity tags")
+    {
+        // The tag survives serialization, and leaves out the info.
+        auto eTag = tile->eTag();
+        std::stringstream stream;
+        tile->write(stream);
+        auto readTile = std::make_shared<TileFeatureLayer>(
+            stream,
+            [&](auto&&, auto&&) { return layerInfo; },
+            [&](auto&&) { return strings; });
+        REQUIRE(readTile->eTag() == eTag);
+        tile->setInfo("Tomatoes", 3);
+        REQUIRE(tile->eTag() == eTag);
+
+        // A client which holds a tile with the same tag gets an empty delta.
+        auto unchanged = tile->unchangedDelta(readTile->timestamp());
+        REQUIRE(unchanged->size() == 0);
+        auto patched = readTile->applyDelta(unchanged);
+        REQUIRE(patched->size() == tile->size());
+
+        tile->newFeature("Way", {{"wayId", 99}});
+        REQUIRE(tile->eTag() != eTag);
+    }
 }
 
 // Helper function to compare two points with some tolerance
@@ -337,6 +1082,344 @@ void REQUIRE_EQUAL(const Point& p1, const Point& p2, double eps = 1e-6) {
     REQUIRE(std::abs(p1.y - p2.y) < eps);
 }
 
+TEST_CASE("SourceDataLayer", "[test.sourcedatalayer]")
+{
+    auto layerInfo = std::make_shared<LayerInfo>();
+    layerInfo->layerId_ = "SourceData-WayLayer";
+    layerInfo->type_ = LayerType::SourceData;
+    auto strings = std::make_shared<simfil::StringPool>("SourceDataNode");
+    auto layer = std::make_shared<TileSourceDataLayer>(TileId(12345), "SourceDataNode", "Tropico", layerInfo, strings);
+
+    // Way [0, 100) with a header [0, 40) and a body [40, 60),
+    // which holds a point [40, 50).
+    auto newCompound = [&](std::string_view schema, uint32_t offset, uint32_t size) {
+        auto compound = layer->newCompound(2);
+        compound->setSchemaName(schema);
+        compound->setSourceDataAddress(SourceDataAddress::fromBitPosition(offset, size));
+        return compound;
+    };
+    auto way = newCompound("Way", 0, 100);
+    auto header = newCompound("Header", 0, 40);
+    auto body = newCompound("Body", 40, 60 - 40);
+    auto point = newCompound("Point", 40, 10);
+    point->object()->addField("x", static_cast<int64_t>(42));
+    body->object()->addField("point", point);
+    body->object()->addField("name", "Main Street");
+    way->object()->addField("header", header);
+    way->object()->addField("body", body);
+    layer->addRoot(way);
+
+    auto schemasForAddress = [](TileSourceDataLayer::Ptr const& l, SourceDataAddress address) {
+        std::vector<std::string> result;
+        for (auto const& compound : l->compoundsForAddress(address))
+            result.emplace_back(compound->schemaName());
+        return result;
+    };
+
+    auto checkAddresses = [&](TileSourceDataLayer::Ptr const& l) {
+        using Schemas = std::vector<std::string>;
+        REQUIRE(schemasForAddress(l, SourceDataAddress::fromBitPosition(0, 100)) == Schemas{"Way"});
+        REQUIRE(schemasForAddress(l, SourceDataAddress::fromBitPosition(40, 60)) == Schemas{"Body"});
+        REQUIRE(schemasForAddress(l, SourceDataAddress::fromBitPosition(0, 60)) == Schemas{"Header", "Body"});
+        REQUIRE(schemasForAddress(l, SourceDataAddress::fromBitPosition(45, 2)) == Schemas{"Point"});
+        REQUIRE(schemasForAddress(l, SourceDataAddress::fromBitPosition(200, 2)).empty());
+    };
+
+    SECTION("Find compounds for addresses")
+    {
+        checkAddresses(layer);
+
+        // Read-only layers look the addresses up through an index.
+        std::stringstream stream;
+        layer->write(stream);
+        auto readLayer = std::make_shared<TileSourceDataLayer>(
+            stream,
+            [&](auto&&, auto&&) { return layerInfo; },
+            [&](auto&&) { return strings; });
+        readLayer->setReadOnly();
+        checkAddresses(readLayer);
+    }
+
+    SECTION("Extract compounds for addresses")
+    {
+        auto extracted = layer->extract({
+            SourceDataAddress::fromBitPosition(45, 2),
+            SourceDataAddress::fromBitPosition(40, 20),
+            SourceDataAddress::fromBitPosition(40, 10)});
+        REQUIRE(extracted->numRoots() == 2);
+        REQUIRE(extracted->tileId() == layer->tileId());
+        REQUIRE(extracted->sourceDataAddressFormat() == layer->sourceDataAddressFormat());
+
+        auto extractedPoint = extracted->resolveCompound(*extracted->root(0));
+        REQUIRE(extractedPoint->schemaName() == "Point");
+        REQUIRE(extractedPoint->sourceDataAddress().u64() == point->sourceDataAddress().u64());
+
+        auto extractedBody = extracted->resolveCompound(*extracted->root(1));
+        REQUIRE(extractedBody->schemaName() == "Body");
+        auto bodyJson = extractedBody->toJson();
+        REQUIRE(bodyJson["name"] == "Main Street");
+        REQUIRE(bodyJson["point"]["x"] == 42);
+    }
+}
+
+TEST_CASE("BinaryLayer", "[test.binarylayer]")
+{
+    auto layerInfo = std::make_shared<LayerInfo>();
+    layerInfo->layerId_ = "Elevation";
+    layerInfo->type_ = LayerType::Heightmap;
+    auto layer = std::make_shared<TileBinaryLayer>(TileId(12345), "RasterNode", "Tropico", layerInfo);
+    layer->setContentType("image/png");
+    layer->setMetadata({{"minHeight", -12.5}, {"maxHeight", 812.0}});
+    layer->setPayload(std::string("\x89PNG\0raster", 11));
+
+    auto checkLayer = [&](TileLayer::Ptr const& l) {
+        auto binaryLayer = std::dynamic_pointer_cast<TileBinaryLayer>(l);
+        REQUIRE(binaryLayer);
+        REQUIRE(binaryLayer->tileId() == layer->tileId());
+        REQUIRE(binaryLayer->contentType() == "image/png");
+        REQUIRE(binaryLayer->metadata() == layer->metadata());
+        REQUIRE(binaryLayer->payload() == layer->payload());
+        REQUIRE(binaryLayer->eTag() == layer->eTag());
+    };
+
+    std::string messages;
+    TileLayerStream::StringPoolOffsetMap stringOffsets;
+    TileLayerStream::Writer writer{
+        [&](auto&& msg, auto&& type)
+        {
+            REQUIRE(type == TileLayerStream::MessageType::TileBinaryLayer);
+            messages += msg;
+        },
+        stringOffsets};
+    writer.write(layer);
+
+    SECTION("Copied from unshared bytes")
+    {
+        TileLayer::Ptr readLayer;
+        TileLayerStream::Reader reader{[&](auto&&, auto&&) { return layerInfo; }, [&](auto&& l) { readLayer = l; }};
+        reader.read(messages);
+        checkLayer(readLayer);
+    }
+
+    SECTION("Sliced from shared bytes")
+    {
+        auto sharedMessages = std::make_shared<const std::string>(messages);
+        TileLayer::Ptr readLayer;
+        {
+            TileLayerStream::Reader reader{[&](auto&&, auto&&) { return layerInfo; }, [&](auto&& l) { readLayer = l; }};
+            reader.read(sharedMessages);
+        }
+        checkLayer(readLayer);
+
+        // The payload ends the message, where the layer refers to it.
+        auto payload = std::static_pointer_cast<TileBinaryLayer>(readLayer)->payload();
+        REQUIRE(payload.data() + payload.size() == sharedMessages->data() + sharedMessages->size());
+
+        // The layer keeps the bytes alive.
+        sharedMessages.reset();
+        checkLayer(readLayer);
+    }
+
+    SECTION("Header of the message")
+    {
+        auto header = TileLayerStream::Reader::readTileLayerHeader(messages);
+        REQUIRE(header.layerId_ == "Elevation");
+        REQUIRE(header.tileId_ == layer->tileId());
+    }
+
+    SECTION("JSON with base64 payload")
+    {
+        auto json = layer->toJson();
+        REQUIRE(json["contentType"] == "image/png");
+        REQUIRE(json["metadata"]["maxHeight"] == 812.0);
+        REQUIRE(json["payload"] == "iVBORwByYXN0ZXI=");
+    }
+}
+
+TEST_CASE("TileLayerStream Reader", "[test.stream]")
+{
+    auto layerInfo = std::make_shared<LayerInfo>();
+    layerInfo->layerId_ = "Elevation";
+    layerInfo->type_ = LayerType::Heightmap;
+
+    // Serialize binary layers, whose message sizes follow from their payloads.
+    auto writeLayer = [&](uint64_t tileId, std::string payload)
+    {
+        auto layer = std::make_shared<TileBinaryLayer>(TileId(tileId), "RasterNode", "Tropico", layerInfo);
+        layer->setPayload(std::move(payload));
+        std::string message;
+        TileLayerStream::StringPoolOffsetMap stringOffsets;
+        TileLayerStream::Writer writer{[&](auto&& msg, auto&&) { message += msg; }, stringOffsets};
+        writer.write(layer);
+        return message;
+    };
+
+    std::vector<std::string> readPayloads;
+    TileLayerStream::Reader reader{
+        [&](auto&&, auto&&) { return layerInfo; },
+        [&](auto&& l) { readPayloads.emplace_back(std::static_pointer_cast<TileBinaryLayer>(l)->payload()); }};
+
+    // Size of the version (6B), type (1B) and length (4B) of a message.
+    constexpr size_t headerSize = 11;
+
+    SECTION("Header and body in separate reads")
+    {
+        auto message = writeLayer(1, "raster");
+        reader.read(std::string_view(message).substr(0, headerSize));
+        REQUIRE(readPayloads.empty());
+        REQUIRE(!reader.eos());
+
+        reader.read(std::string_view(message).substr(headerSize, 3));
+        REQUIRE(!reader.eos());
+        reader.read(std::string_view(message).substr(headerSize + 3));
+        REQUIRE(reader.eos());
+        REQUIRE(readPayloads == std::vector<std::string>{"raster"});
+    }
+
+    SECTION("Parsed bytes are released before new bytes are appended")
+    {
+        auto first = writeLayer(1, "first");
+        auto second = writeLayer(2, "second");
+        auto third = writeLayer(3, "third");
+        auto bytes = first + second + third;
+
+        // Each read completes one message, and leaves the next one incomplete
+        // in the buffer, whose parsed bytes are then moved out of the way.
+        reader.read(std::string_view(bytes).substr(0, 5));
+        reader.read(std::string_view(bytes).substr(5, first.size()));
+        REQUIRE(readPayloads == std::vector<std::string>{"first"});
+        REQUIRE(!reader.eos());
+        reader.read(std::string_view(bytes).substr(first.size() + 5, second.size()));
+        REQUIRE(readPayloads == std::vector<std::string>{"first", "second"});
+        reader.read(std::string_view(bytes).substr(first.size() + second.size() + 5));
+        REQUIRE(readPayloads == std::vector<std::string>{"first", "second", "third"});
+        REQUIRE(reader.eos());
+    }
+
+    SECTION("Large buffers are released")
+    {
+        auto largePayload = std::string(TileLayerStream::Reader::MaxRetainedBufferBytes + 1024, 'x');
+        auto large = writeLayer(1, largePayload);
+        auto small = writeLayer(2, "small");
+
+        // The large message is buffered, as it arrives in two reads.
+        reader.read(std::string_view(large).substr(0, large.size() / 2));
+        reader.read(std::string_view(large).substr(large.size() / 2));
+        REQUIRE(reader.eos());
+        REQUIRE(readPayloads.size() == 1);
+        REQUIRE(readPayloads[0] == largePayload);
+        REQUIRE(reader.bufferCapacity() > TileLayerStream::Reader::MaxRetainedBufferBytes);
+
+        // The buffer is freed by the next read, as no bytes are pending.
+        reader.read(small);
+        REQUIRE(readPayloads.size() == 2);
+        REQUIRE(readPayloads[1] == "small");
+        REQUIRE(reader.bufferCapacity() <= TileLayerStream::Reader::MaxRetainedBufferBytes);
+    }
+}
+
+TEST_CASE("TileLayerStream Writer", "[test.stream]")
+{
+    auto layerInfo = std::make_shared<LayerInfo>();
+    layerInfo->layerId_ = "Elevation";
+    layerInfo->type_ = LayerType::Heightmap;
+    auto makeLayer = [&](uint64_t tileId, std::string payload)
+    {
+        auto layer = std::make_shared<TileBinaryLayer>(TileId(tileId), "RasterNode", "Tropico", layerInfo);
+        layer->setPayload(std::move(payload));
+        return layer;
+    };
+    auto largeLayer = makeLayer(1, std::string(1000, 'x'));
+    auto smallLayer = makeLayer(2, "small");
+    auto strings = std::make_shared<StringPool>("RasterNode");
+    auto stringId = strings->emplace("streamedString");
+
+    // Each message is passed as slices of the header and of the reused
+    // serialization buffer, which are concatenated by the caller.
+    std::string bytes;
+    std::vector<std::string> messages;
+    TileLayerStream::StringPoolOffsetMap stringOffsets;
+    TileLayerStream::Writer writer{
+        TileLayerStream::Writer::MessageSlicesFun(
+            [&](std::string_view header, std::string_view body, TileLayerStream::MessageType)
+            {
+                REQUIRE(header.size() == 11);
+                messages.emplace_back(std::string(header).append(body));
+                bytes.append(header).append(body);
+            }),
+        stringOffsets};
+    writer.write(largeLayer);
+    writer.writeStringPool("RasterNode", *strings);
+    writer.write(smallLayer);
+    REQUIRE(messages.size() == 3);
+
+    // The later, smaller messages do not contain bytes of the earlier ones.
+    TileLayerStream::StringPoolOffsetMap joinedStringOffsets;
+    std::string smallMessage;
+    TileLayerStream::Writer joiningWriter{[&](auto&& msg, auto&&) { smallMessage = msg; }, joinedStringOffsets};
+    joiningWriter.write(smallLayer);
+    REQUIRE(messages[2] == smallMessage);
+    REQUIRE(messages[1].find("xxxx") == std::string::npos);
+    REQUIRE(messages[2].find("xxxx") == std::string::npos);
+
+    // The concatenated slices are read back.
+    std::vector<std::string> readPayloads;
+    TileLayerStream::Reader reader{
+        [&](auto&&, auto&&) { return layerInfo; },
+        [&](auto&& l) { readPayloads.emplace_back(std::static_pointer_cast<TileBinaryLayer>(l)->payload()); }};
+    reader.read(bytes);
+    REQUIRE(reader.eos());
+    REQUIRE(readPayloads == std::vector<std::string>{std::string(1000, 'x'), "small"});
+    REQUIRE(reader.stringPoolCache()->getStringPool("RasterNode")->resolve(stringId) == "streamedString");
+}
+
+TEST_CASE("ColumnPagePool", "[test.columnpages]")
+{
+    ColumnAllocator<uint64_t> allocator;
+    auto statistic = [](char const* name) { return ColumnPagePool::getStatistics()[name].get<int64_t>(); };
+
+    SECTION("Pages are reused by the same thread")
+    {
+        auto page = allocator.allocate(512);
+        allocator.deallocate(page, 512);
+        auto reusedPages = statistic("reused-pages");
+        auto reusedPage = allocator.allocate(512);
+        REQUIRE(reusedPage == page);
+        REQUIRE(statistic("reused-pages") == reusedPages + 1);
+        allocator.deallocate(reusedPage, 512);
+    }
+
+    SECTION("Pages go back to the thread which allocated them")
+    {
+        auto page = allocator.allocate(512);
+        auto remotePages = statistic("remote-pages");
+        std::thread([&] { allocator.deallocate(page, 512); }).join();
+        REQUIRE(statistic("remote-pages") == remotePages + 1);
+        REQUIRE(allocator.allocate(512) == page);
+        allocator.deallocate(page, 512);
+    }
+
+    SECTION("Pages of a batch are returned at its end")
+    {
+        auto page = allocator.allocate(512);
+        auto pooledPages = statistic("pooled-pages");
+        {
+            ColumnPagePool::BatchRelease batchRelease;
+            allocator.deallocate(page, 512);
+            REQUIRE(statistic("pooled-pages") == pooledPages);
+        }
+        REQUIRE(statistic("pooled-pages") == pooledPages + 1);
+    }
+
+    SECTION("Small allocations are not pooled")
+    {
+        auto newPages = statistic("new-pages");
+        auto small = allocator.allocate(4);
+        REQUIRE(statistic("new-pages") == newPages);
+        allocator.deallocate(small, 4);
+    }
+}
+
 TEST_CASE("TileId", "[TileId]") {
     using namespace mapget;
 
@@ -400,4 +1483,43 @@ TEST_CASE("TileId", "[TileId]") {
         REQUIRE_THROWS(tile2.neighbor(2, 0));
         REQUIRE_THROWS(tile2.neighbor(-2, 0));
     }
+
+    SECTION("Tiles in bbox") {
+        using Tiles = std::vector<TileId>;
+        REQUIRE(TileId::tilesInBBox({-180, -90}, {180, 90}, 1) == Tiles{
+            {0, 0, 1}, {0, 1, 1}, {1, 1, 1}, {1, 0, 1}, {2, 0, 1}, {2, 1, 1}, {3, 1, 1}, {3, 0, 1}});
+        REQUIRE(TileId::tilesInBBox({-80, -10}, {-170, 10}, 1, TileId::Order::Morton) == Tiles{
+            {0, 0, 1}, {1, 0, 1}, {0, 1, 1}, {1, 1, 1}});
+        REQUIRE(TileId::tilesInBBox({10, 10}, {20, 20}, 1, TileId::Order::ColumnMajor) == Tiles{{2, 0, 1}});
+
+        // Tiles are counted without enumerating them.
+        REQUIRE(TileId::numTilesInBBox({-180, -90}, {180, 90}, 1) == 8);
+        REQUIRE(TileId::numTilesInBBox({-180, -90}, {180, 90}, TileId::MaxZoomLevel) == (1ull << 31));
+        REQUIRE(TileId::numTilesInBBox({10, 10}, {20, 20}, 1) == 1);
+        REQUIRE_THROWS(TileId::numTilesInBBox({10, 10}, {20, 20}, TileId::MaxZoomLevel + 1));
+        REQUIRE_THROWS(TileId::tilesInBBox({10, 10}, {20, 20}, TileId::MaxZoomLevel + 1));
+    }
+
+    SECTION("Tiles in polygon") {
+        using Tiles = std::vector<TileId>;
+        std::vector<Point> triangle{{-170, 80}, {-110, 80}, {-170, 10}};
+        REQUIRE(TileId::tilesInPolygon(triangle, 2, TileId::Order::ColumnMajor) == Tiles{
+            {0, 0, 2}, {0, 1, 2}, {1, 0, 2}});
+        REQUIRE(TileId::tilesInPolygon({}, 2).empty());
+    }
+
+    SECTION("Coverage") {
+        Coverage coverage{TileId(2, 2, 3), TileId(3, 3, 3), {true, false, false, false}};
+        REQUIRE(coverage.covers(TileId(2, 2, 3)));
+        REQUIRE(!coverage.covers(TileId(3, 2, 3)));
+        REQUIRE(coverage.covers(TileId(1, 1, 2)));
+        REQUIRE(!coverage.covers(TileId(1, 0, 2)));
+        REQUIRE(coverage.covers(TileId(4, 4, 4)));
+        REQUIRE(!coverage.covers(TileId(6, 4, 4)));
+
+        LayerInfo layerInfo;
+        REQUIRE(layerInfo.covers(TileId(6, 4, 4)));
+        layerInfo.coverage_.push_back(coverage);
+        REQUIRE(!layerInfo.covers(TileId(6, 4, 4)));
+    }
 }
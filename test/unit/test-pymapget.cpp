@@ -0,0 +1,79 @@
+#include <catch2/catch_test_macros.hpp>
+#include <pybind11/embed.h>
+
+#include <cmath>
+
+namespace py = pybind11;
+using namespace py::literals;
+using namespace std::string_literals;
+
+#include "binding/py-tileid.h"
+#include "binding/py-model.h"
+
+PYBIND11_EMBEDDED_MODULE(pymapget, m)
+{
+    bindTileId(m);
+    bindModel(m);
+}
+
+using namespace mapget;
+
+TEST_CASE("PythonGeometryBuffer", "[pymapget]")
+{
+    auto layerInfo = LayerInfo::fromJson(R"({
+        "layerId": "WayLayer",
+        "type": "Features",
+        "featureTypes": [{
+            "name": "Way",
+            "uniqueIdCompositions": [[{"partId": "wayId", "datatype": "U32"}]]
+        }]
+    })"_json);
+    auto strings = std::make_shared<StringPool>("PythonNode");
+    auto tile = std::make_shared<TileFeatureLayer>(
+        TileId::fromWgs84(42., 11., 13),
+        "PythonNode",
+        "Tropico",
+        layerInfo,
+        strings);
+    auto geometry = tile->newFeature("Way", {{"wayId", 1}})->geom()->newGeometry(GeomType::Line, 4);
+    geometry->append({42.1, 11.2, 0.});
+    geometry->append({42.3, 11.4, 5.5});
+    geometry->append({42.5, 11.1, -3.});
+    geometry->append({42.7, 11.6, 12.});
+
+    py::scoped_interpreter interpreter;
+    py::module_::import("pymapget");
+
+    // The points are an (N, 3) buffer of contiguous float64 coordinates.
+    auto points = py::cast(BoundGeometry(geometry)).attr("points")();
+    auto info = points.cast<py::buffer>().request();
+    REQUIRE(info.item_type_is_equivalent_to<double>());
+    REQUIRE(info.ndim == 2);
+    REQUIRE(info.shape == std::vector<py::ssize_t>{4, 3});
+    REQUIRE(info.strides == std::vector<py::ssize_t>{3 * sizeof(double), sizeof(double)});
+    REQUIRE(py::len(points) == 4);
+
+    auto const* coordinates = static_cast<double const*>(info.ptr);
+    for (auto i = 0u; i < geometry->numPoints(); ++i) {
+        auto point = geometry->pointAt(i);
+        REQUIRE(coordinates[i * 3] == point.x);
+        REQUIRE(coordinates[i * 3 + 1] == point.y);
+        REQUIRE(coordinates[i * 3 + 2] == point.z);
+    }
+
+    // Python sees the same shape, without copying the buffer.
+    auto view = py::module_::import("builtins").attr("memoryview")(points);
+    REQUIRE(view.attr("shape").cast<std::vector<py::ssize_t>>() == info.shape);
+    REQUIRE(view.attr("c_contiguous").cast<bool>());
+
+    // The buffer can be appended to another geometry, whose
+    // vertices are stored as float offsets from its first one.
+    auto copy = tile->newFeature("Way", {{"wayId", 2}})->geom()->newGeometry(GeomType::Line, 4);
+    py::cast(BoundGeometry(copy)).attr("append_points")(points);
+    REQUIRE(copy->numPoints() == geometry->numPoints());
+    for (auto i = 0u; i < geometry->numPoints(); ++i) {
+        REQUIRE(std::abs(copy->pointAt(i).x - geometry->pointAt(i).x) < 1e-6);
+        REQUIRE(std::abs(copy->pointAt(i).y - geometry->pointAt(i).y) < 1e-6);
+        REQUIRE(std::abs(copy->pointAt(i).z - geometry->pointAt(i).z) < 1e-6);
+    }
+}
@@ -0,0 +1,1290 @@
+#include <algorithm>
+#include <atomic>
+#include <catch2/catch_test_macros.hpp>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include "mapget/log.h"
+#include "mapget/service/allocations.h"
+#include "mapget/service/executor.h"
+#include "mapget/service/memcache.h"
+#include "mapget/service/metrics.h"
+#include "mapget/service/service.h"
+#include "mapget/service/tracing.h"
+
+using namespace mapget;
+
+namespace
+{
+
+struct CountingDataSource : public DataSource
+{
+    explicit CountingDataSource(int maxParallelJobs, int maxBatchSize = 1)
+    {
+        info_ = DataSourceInfo::fromJson(R"(
+        {
+            "nodeId": "CountingNode",
+            "mapId": "Counted",
+            "layers": {
+                "WayLayer": {
+                    "featureTypes": []
+                }
+            }
+        }
+        )"_json);
+        info_.maxParallelJobs_ = maxParallelJobs;
+        info_.maxBatchSize_ = maxBatchSize;
+    }
+
+    DataSourceInfo info() override { return info_; }
+
+    void fill(TileFeatureLayer::Ptr const& tile) override
+    {
+        {
+            std::unique_lock lock(filledTilesMutex_);
+            filledTiles_.push_back(tile->tileId());
+        }
+        auto running = ++runningFills_;
+        auto maxRunning = maxRunningFills_.load();
+        while (running > maxRunning && !maxRunningFills_.compare_exchange_weak(maxRunning, running)) {}
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        --runningFills_;
+        ++fillCount_;
+    }
+
+    void fill(TileSourceDataLayer::Ptr const&) override {}
+
+    void fill(std::vector<TileFeatureLayer::Ptr> const& tiles) override
+    {
+        maxBatchSize_ = std::max(maxBatchSize_.load(), static_cast<int>(tiles.size()));
+        DataSource::fill(tiles);
+    }
+
+    DataSourceInfo info_;
+    std::atomic_int fillCount_ = 0;
+    std::atomic_int runningFills_ = 0;
+    std::atomic_int maxRunningFills_ = 0;
+    std::atomic_int maxBatchSize_ = 0;
+    std::mutex filledTilesMutex_;
+    std::vector<TileId> filledTiles_;
+};
+
+struct AsyncCountingDataSource : public CountingDataSource
+{
+    using CountingDataSource::CountingDataSource;
+
+    void getAsync(
+        MapTileKey const& k,
+        Cache::Ptr const& cache,
+        DataSourceInfo const& info,
+        std::function<void(TileLayer::Ptr)> onResult,
+        CancellationToken::Ptr const& cancellation = {}) override
+    {
+        ++asyncGetCount_;
+        loader_.post([this, k, cachePtr = cache, info, onResult, cancellation]() mutable
+                     { onResult(get(k, cachePtr, info, cancellation)); });
+    }
+
+    std::atomic_int asyncGetCount_ = 0;
+    Executor loader_{2};
+};
+
+struct CancellableDataSource : public CountingDataSource
+{
+    CancellableDataSource() : CountingDataSource(1) {}
+
+    void fill(TileFeatureLayer::Ptr const& tile) override
+    {
+        ++fillCount_;
+        auto waitUntil = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (blockFills_ && !tile->isCancelled() && std::chrono::steady_clock::now() < waitUntil)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if (tile->isCancelled())
+            ++cancelledFills_;
+    }
+
+    std::atomic_bool blockFills_ = true;
+    std::atomic_int cancelledFills_ = 0;
+};
+
+struct LocatingDataSource : public CountingDataSource
+{
+    explicit LocatingDataSource(std::string nodeId) : CountingDataSource(1) { info_.nodeId_ = std::move(nodeId); }
+
+    std::vector<LocateResponse> locate(LocateRequest const& req) override
+    {
+        ++locateCount_;
+        LocateResponse response(req);
+        response.tileKey_.layerId_ = "WayLayer";
+        response.tileKey_.tileId_ = TileId(1, 2, 3);
+        return {response};
+    }
+
+    std::atomic_int locateCount_ = 0;
+};
+
+struct RelationDataSource : public CountingDataSource
+{
+    // Ways 1 and 2 are in the first tile, ways 3 and 4 in the second
+    // one. Way 1 leads to way 2, to way 3, and way 4 to an unknown way.
+    static inline TileId const FirstTile{0, 0, 1};
+    static inline TileId const SecondTile{1, 0, 1};
+
+    RelationDataSource() : CountingDataSource(1)
+    {
+        info_.layers_["WayLayer"] = LayerInfo::fromJson(R"({
+            "featureTypes": [{
+                "name": "Way",
+                "uniqueIdCompositions": [[{"partId": "wayId", "datatype": "I64"}]]
+            }]
+        })"_json, "WayLayer");
+    }
+
+    void fill(TileFeatureLayer::Ptr const& tile) override
+    {
+        ++fillCount_;
+        int64_t firstWayId = tile->tileId() == FirstTile ? 1 : 3;
+        for (auto wayId = firstWayId; wayId < firstWayId + 2; ++wayId) {
+            auto feature = tile->newFeature("Way", {{"wayId", wayId}});
+            feature->addRelation("next", "Way", {{"wayId", wayId == 4 ? 99 : wayId + 1}});
+        }
+    }
+
+    std::vector<LocateResponse> locate(LocateRequest const& req) override
+    {
+        ++locateCount_;
+        auto wayId = req.getIntIdPart("wayId");
+        if (!wayId || *wayId > 4)
+            return {};
+        LocateResponse response(req);
+        response.tileKey_.layerId_ = "WayLayer";
+        response.tileKey_.tileId_ = *wayId <= 2 ? FirstTile : SecondTile;
+        return {response};
+    }
+
+    std::atomic_int locateCount_ = 0;
+};
+
+struct AddOnDataSource : public CountingDataSource
+{
+    // Adds an attribute with a named validity to the first way of the
+    // RelationDataSource, with names which end with the given suffix.
+    AddOnDataSource(std::string nodeId, std::string suffix) : CountingDataSource(1), suffix_(std::move(suffix))
+    {
+        info_.nodeId_ = std::move(nodeId);
+        info_.isAddOn_ = true;
+        info_.layers_["WayLayer"] = RelationDataSource().info_.layers_["WayLayer"];
+    }
+
+    void fill(TileFeatureLayer::Ptr const& tile) override
+    {
+        ++fillCount_;
+        // A string which only this source has, so that the pools of the sources diverge.
+        tile->strings()->emplace("padding" + suffix_);
+        auto feature = tile->newFeature("Way", {{"wayId", 1}});
+        auto attribute = feature->attributeLayers()->newLayer("layer" + suffix_)->newAttribute("attribute" + suffix_);
+        attribute->validity()->newDirection(Validity::Direction::Positive)->setGeometryName("geometry" + suffix_);
+    }
+
+    std::string suffix_;
+};
+
+struct ChunkingDataSource : public RelationDataSource
+{
+    // Sends a chunk after each of three ways.
+    void fill(TileFeatureLayer::Ptr const& tile) override
+    {
+        ++fillCount_;
+        for (auto wayId = 1; wayId <= 3; ++wayId) {
+            tile->newFeature("Way", {{"wayId", wayId}});
+            tile->sendChunk();
+        }
+    }
+};
+
+struct RasterDataSource : public CountingDataSource
+{
+    RasterDataSource() : CountingDataSource(1)
+    {
+        info_.layers_.emplace("Elevation", LayerInfo::fromJson(R"({"type": "Heightmap"})"_json, "Elevation"));
+    }
+
+    void fill(TileBinaryLayer::Ptr const& tile) override
+    {
+        ++fillCount_;
+        tile->setContentType("application/octet-stream");
+        tile->setMetadata({{"resolution", 256}});
+        tile->setPayload(std::string(256, static_cast<char>(tile->tileId().x())));
+    }
+};
+
+struct FakeClusterPeer : public ClusterPeer
+{
+    std::vector<TileLayer::Ptr> get(
+        std::vector<MapTileKey> const& keys,
+        Cache::Ptr const& cache,
+        DataSourceInfo const& info,
+        std::vector<CancellationToken::Ptr> const& cancellations) override
+    {
+        if (failing_)
+            throw std::runtime_error("Peer is down.");
+        {
+            std::unique_lock lock(forwardedTilesMutex_);
+            for (auto const& key : keys)
+                forwardedTiles_.push_back(key);
+        }
+        auto peerCache = cache;
+        return dataSource_.get(keys, peerCache, info, cancellations);
+    }
+
+    CountingDataSource dataSource_{1};
+    std::atomic_bool failing_ = false;
+    std::mutex forwardedTilesMutex_;
+    std::vector<MapTileKey> forwardedTiles_;
+};
+
+struct BlockingCache : public MemCache
+{
+    // Blocks the first lookup, until it is released.
+    SharedBlob getSharedTileLayerBlob(MapTileKey const& k) override
+    {
+        if (!isBlocking_.exchange(false))
+            return MemCache::getSharedTileLayerBlob(k);
+        isBlocked_ = true;
+        auto waitUntil = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (!isReleased_ && std::chrono::steady_clock::now() < waitUntil)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return MemCache::getSharedTileLayerBlob(k);
+    }
+
+    std::atomic_bool isBlocking_ = true;
+    std::atomic_bool isBlocked_ = false;
+    std::atomic_bool isReleased_ = false;
+};
+
+auto makeRequest(std::vector<TileId> tiles, std::atomic_int& resultCount)
+{
+    auto request = std::make_shared<LayerTilesRequest>("Counted", "WayLayer", std::move(tiles));
+    request->onFeatureLayer([&resultCount](auto&&) { ++resultCount; });
+    return request;
+}
+
+}  // namespace
+
+TEST_CASE("Executor", "[Executor]")
+{
+    SECTION("All posted tasks are run")
+    {
+        std::atomic_int counter = 0;
+        {
+            Executor executor(4);
+            REQUIRE(executor.numThreads() == 4);
+            for (auto i = 0; i < 1000; ++i)
+                executor.post([&counter]() { ++counter; });
+            while (counter < 1000)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        REQUIRE(counter == 1000);
+    }
+
+    SECTION("Tasks may post further tasks")
+    {
+        std::atomic_int counter = 0;
+        Executor executor(2);
+        std::function<void(int)> postChain = [&](int remaining)
+        {
+            ++counter;
+            if (remaining > 0)
+                executor.post([&postChain, remaining]() { postChain(remaining - 1); });
+        };
+        executor.post([&postChain]() { postChain(99); });
+        while (counter < 100)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        executor.stop();
+        REQUIRE(counter == 100);
+    }
+}
+
+TEST_CASE("ServiceScheduling", "[Service]")
+{
+    setLogLevel("warn", log());
+
+    auto dataSource = std::make_shared<CountingDataSource>(3);
+    Service service(std::make_shared<MemCache>());
+    service.add(dataSource);
+
+    std::vector<TileId> tiles;
+    for (auto i = 0; i < 20; ++i)
+        tiles.emplace_back(TileId(i, 7, 5));
+
+    SECTION("Overlapping requests fill each tile once")
+    {
+        std::atomic_int resultCount = 0;
+        std::vector<LayerTilesRequest::Ptr> requests;
+        for (auto i = 0; i < 5; ++i)
+            requests.emplace_back(makeRequest(tiles, resultCount));
+        REQUIRE(service.request(requests));
+        for (auto const& request : requests) {
+            request->wait();
+            REQUIRE(request->getStatus() == RequestStatus::Success);
+        }
+        REQUIRE(resultCount == 5 * tiles.size());
+        REQUIRE(dataSource->fillCount_ == tiles.size());
+        REQUIRE(dataSource->maxRunningFills_ <= 3);
+
+        // A repeated request is served from the cache.
+        auto cachedRequest = makeRequest(tiles, resultCount);
+        REQUIRE(service.request({cachedRequest}));
+        cachedRequest->wait();
+        REQUIRE(dataSource->fillCount_ == tiles.size());
+    }
+
+    SECTION("Tiles closest to the focus are filled first")
+    {
+        std::vector<TileId> requestTiles = {TileId(0, 0, 1)};
+        for (auto i = 0; i < 20; ++i)
+            requestTiles.emplace_back(TileId(i, 9, 5));
+        auto focusTile = requestTiles[15];
+        auto fillsBefore = dataSource->fillCount_.load();
+
+        std::atomic_int resultCount = 0;
+        auto request = makeRequest(requestTiles, resultCount);
+        request->setFocus(focusTile.center());
+        REQUIRE(service.request({request}));
+        request->wait();
+        REQUIRE(resultCount == requestTiles.size());
+
+        // The low-zoom tile and the focused tile are among
+        // the first batch of parallel fills.
+        std::unique_lock lock(dataSource->filledTilesMutex_);
+        auto const& filledTiles = dataSource->filledTiles_;
+        auto fillPosition = [&](TileId const& tile)
+        { return std::find(filledTiles.begin(), filledTiles.end(), tile) - filledTiles.begin() - fillsBefore; };
+        REQUIRE(fillPosition(TileId(0, 0, 1)) < 3);
+        REQUIRE(fillPosition(focusTile) < 4);
+    }
+
+    SECTION("Clients share the jobs by the weights of their classes")
+    {
+        service.setClientClassWeight("interactive", 4);
+
+        // A batch client with many requests waits longer than a viewer with one.
+        std::atomic_int batchResultCount = 0;
+        std::vector<LayerTilesRequest::Ptr> batchRequests;
+        for (auto i = 0; i < 10; ++i) {
+            std::vector<TileId> batchTiles;
+            for (auto j = 0; j < 20; ++j)
+                batchTiles.emplace_back(TileId(i * 20 + j, 0, 8));
+            auto& request = batchRequests.emplace_back(makeRequest(batchTiles, batchResultCount));
+            request->clientId_ = "exporter";
+            request->clientClass_ = "batch";
+        }
+        REQUIRE(service.request(batchRequests));
+
+        std::atomic_int viewerResultCount = 0;
+        auto viewerRequest = makeRequest(tiles, viewerResultCount);
+        viewerRequest->clientId_ = "viewer";
+        viewerRequest->clientClass_ = "interactive";
+        REQUIRE(service.request({viewerRequest}));
+        viewerRequest->wait();
+        REQUIRE(viewerResultCount == tiles.size());
+        REQUIRE(batchResultCount < tiles.size());
+
+        auto statistics = service.getStatistics()["client-classes"];
+        REQUIRE(statistics["interactive"]["weight"] == 4.);
+        REQUIRE(statistics["interactive"]["scheduled-tiles"] == tiles.size());
+        REQUIRE(statistics["batch"]["queued-clients"] == 1);
+        for (auto const& request : batchRequests)
+            service.abort(request);
+    }
+
+    SECTION("Aborted requests are done")
+    {
+        std::atomic_int resultCount = 0;
+        auto request = makeRequest(tiles, resultCount);
+        REQUIRE(service.request({request}));
+        service.abort(request);
+        request->wait();
+        REQUIRE(request->isDone());
+        service.remove(dataSource);
+        REQUIRE(service.info().empty());
+    }
+}
+
+TEST_CASE("ServiceBatching", "[Service]")
+{
+    setLogLevel("warn", log());
+
+    auto dataSource = std::make_shared<CountingDataSource>(2, 4);
+    Service service(std::make_shared<MemCache>());
+    service.add(dataSource);
+
+    std::vector<TileId> tiles;
+    for (auto i = 0; i < 20; ++i)
+        tiles.emplace_back(TileId(i, 7, 5));
+
+    std::atomic_int resultCount = 0;
+    auto request = makeRequest(tiles, resultCount);
+    REQUIRE(service.request({request}));
+    request->wait();
+    REQUIRE(request->getStatus() == RequestStatus::Success);
+    REQUIRE(resultCount == tiles.size());
+    REQUIRE(dataSource->fillCount_ == tiles.size());
+    REQUIRE(dataSource->maxBatchSize_ == 4);
+}
+
+TEST_CASE("ServiceTileLayerMessages", "[Service]")
+{
+    setLogLevel("warn", log());
+
+    auto dataSource = std::make_shared<CountingDataSource>(2);
+    Service service(std::make_shared<MemCache>());
+    service.add(dataSource);
+
+    std::vector<TileId> tiles;
+    for (auto i = 0; i < 4; ++i)
+        tiles.emplace_back(TileId(i, 7, 5));
+
+    // Tiles which are not cached yet are passed as layers.
+    std::atomic_int resultCount = 0;
+    std::atomic_int messageCount = 0;
+    auto onMessage = [&messageCount](Cache::SharedBlob const& message, auto&& strings) {
+        REQUIRE(!message->empty());
+        REQUIRE(strings->nodeId_ == "CountingNode");
+        ++messageCount;
+    };
+    auto request = makeRequest(tiles, resultCount);
+    request->onTileLayerMessage(onMessage);
+    REQUIRE(service.request({request}));
+    request->wait();
+    REQUIRE(resultCount == tiles.size());
+    REQUIRE(messageCount == 0);
+
+    // Cached tiles are passed as messages.
+    resultCount = 0;
+    request = makeRequest(tiles, resultCount);
+    request->onTileLayerMessage(onMessage);
+    REQUIRE(service.request({request}));
+    request->wait();
+    REQUIRE(request->getStatus() == RequestStatus::Success);
+    REQUIRE(resultCount == 0);
+    REQUIRE(messageCount == tiles.size());
+    REQUIRE(dataSource->fillCount_ == tiles.size());
+}
+
+TEST_CASE("ServiceBinaryLayers", "[Service]")
+{
+    setLogLevel("warn", log());
+
+    auto dataSource = std::make_shared<RasterDataSource>();
+    Service service(std::make_shared<MemCache>());
+    service.add(dataSource);
+
+    std::vector<TileId> tiles{TileId(1, 7, 5), TileId(2, 7, 5)};
+    auto checkedTiles = 0;
+    auto onLayer = [&checkedTiles](TileBinaryLayer::Ptr const& tile) {
+        REQUIRE(!tile->error());
+        REQUIRE(tile->contentType() == "application/octet-stream");
+        REQUIRE(tile->metadata()["resolution"] == 256);
+        REQUIRE(tile->payload() == std::string(256, static_cast<char>(tile->tileId().x())));
+        ++checkedTiles;
+    };
+
+    // The second request is served from the cache.
+    for (auto i = 0; i < 2; ++i) {
+        auto request = std::make_shared<LayerTilesRequest>("Counted", "Elevation", tiles);
+        request->onBinaryLayer(onLayer);
+        REQUIRE(service.request({request}));
+        request->wait();
+        REQUIRE(request->getStatus() == RequestStatus::Success);
+    }
+    REQUIRE(checkedTiles == 2 * tiles.size());
+    REQUIRE(dataSource->fillCount_ == tiles.size());
+}
+
+TEST_CASE("ServiceWriteBehind", "[Service]")
+{
+    setLogLevel("warn", log());
+
+    auto cache = std::make_shared<MemCache>();
+    cache->setMaxQueuedTileLayers(16);
+    auto dataSource = std::make_shared<CountingDataSource>(2);
+
+    std::vector<TileId> tiles;
+    for (auto i = 0; i < 4; ++i)
+        tiles.emplace_back(TileId(i, 7, 5));
+
+    {
+        Service service(cache);
+        service.add(dataSource);
+
+        // Tiles are served from the cache while they may still be queued.
+        for (auto pass = 0; pass < 2; ++pass) {
+            std::atomic_int resultCount = 0;
+            auto request = makeRequest(tiles, resultCount);
+            REQUIRE(service.request({request}));
+            request->wait();
+            REQUIRE(resultCount == tiles.size());
+        }
+        REQUIRE(dataSource->fillCount_ == tiles.size());
+    }
+
+    // Queued tiles are written when the service is destroyed.
+    auto stats = cache->getStatistics();
+    REQUIRE(stats["queued-tiles"] == 0);
+    REQUIRE(stats["memcache-map-size"] == tiles.size());
+}
+
+TEST_CASE("ServiceAsyncDataSource", "[Service]")
+{
+    setLogLevel("warn", log());
+
+    auto dataSource = std::make_shared<AsyncCountingDataSource>(4);
+    Service service(std::make_shared<MemCache>());
+    service.add(dataSource);
+
+    std::vector<TileId> tiles;
+    for (auto i = 0; i < 20; ++i)
+        tiles.emplace_back(TileId(i, 7, 5));
+
+    std::atomic_int resultCount = 0;
+    auto request = makeRequest(tiles, resultCount);
+    REQUIRE(service.request({request}));
+    request->wait();
+    REQUIRE(request->getStatus() == RequestStatus::Success);
+    REQUIRE(resultCount == tiles.size());
+    REQUIRE(dataSource->asyncGetCount_ == tiles.size());
+    REQUIRE(dataSource->maxRunningFills_ <= 4);
+}
+
+TEST_CASE("ServicePrefetching", "[Service]")
+{
+    setLogLevel("warn", log());
+
+    auto dataSource = std::make_shared<CountingDataSource>(1);
+    Service service(std::make_shared<MemCache>());
+    service.setPrefetching(true);
+    service.add(dataSource);
+
+    std::atomic_int resultCount = 0;
+    auto request = makeRequest({TileId(5, 7, 5)}, resultCount);
+    REQUIRE(service.request({request}));
+    request->wait();
+
+    // Eight neighbors, one parent and four children are prefetched.
+    auto waitUntil = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (service.getStatistics()["prefetch"]["loaded-tiles"].get<int64_t>() < 13 &&
+           std::chrono::steady_clock::now() < waitUntil)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    REQUIRE(service.getStatistics()["prefetch"]["loaded-tiles"].get<int64_t>() == 13);
+    REQUIRE(dataSource->fillCount_ == 14);
+
+    // A neighbor is served from the cache.
+    auto neighborRequest = makeRequest({TileId(6, 7, 5), TileId(2, 3, 4)}, resultCount);
+    REQUIRE(service.request({neighborRequest}));
+    neighborRequest->wait();
+    REQUIRE(resultCount == 3);
+
+    auto stats = service.getStatistics()["prefetch"];
+    REQUIRE(stats["hits"].get<int64_t>() == 2);
+    REQUIRE(stats["misses"].get<int64_t>() == 1);
+}
+
+TEST_CASE("ServiceLocate", "[Service]")
+{
+    setLogLevel("warn", log());
+
+    auto firstDataSource = std::make_shared<LocatingDataSource>("FirstNode");
+    auto secondDataSource = std::make_shared<LocatingDataSource>("SecondNode");
+    Service service(std::make_shared<MemCache>());
+    service.add(firstDataSource);
+    service.add(secondDataSource);
+
+    LocateRequest request("Counted", "Way", KeyValuePairs{{"wayId", 42}});
+    REQUIRE(service.locate(request).size() == 2);
+    REQUIRE(firstDataSource->locateCount_ == 1);
+    REQUIRE(secondDataSource->locateCount_ == 1);
+
+    // The repeated locate is served from the cache.
+    REQUIRE(service.locate(request).size() == 2);
+    REQUIRE(firstDataSource->locateCount_ == 1);
+    REQUIRE(secondDataSource->locateCount_ == 1);
+
+    auto stats = service.getStatistics()["locate-cache"];
+    REQUIRE(stats["size"].get<int64_t>() == 2);
+    REQUIRE(stats["hits"].get<int64_t>() == 2);
+    REQUIRE(stats["misses"].get<int64_t>() == 2);
+
+    // The results of a removed data source are dropped.
+    service.remove(firstDataSource);
+    REQUIRE(service.getStatistics()["locate-cache"]["size"].get<int64_t>() == 1);
+    service.add(firstDataSource);
+    REQUIRE(service.locate(request).size() == 2);
+    REQUIRE(firstDataSource->locateCount_ == 2);
+    REQUIRE(secondDataSource->locateCount_ == 1);
+}
+
+TEST_CASE("ServiceRelations", "[Service]")
+{
+    setLogLevel("warn", log());
+
+    auto dataSource = std::make_shared<RelationDataSource>();
+    Service service(std::make_shared<MemCache>());
+    service.add(dataSource);
+
+    auto loadTile = [&](TileId tileId)
+    {
+        TileFeatureLayer::Ptr result;
+        auto request = std::make_shared<LayerTilesRequest>("Counted", "WayLayer", std::vector<TileId>{tileId});
+        request->onFeatureLayer([&result](auto&& tile) { result = tile; });
+        REQUIRE(service.request({request}));
+        request->wait();
+        REQUIRE(result);
+        return result;
+    };
+
+    // Batched locate answers each request, in order.
+    auto locations = service.locate(std::vector<LocateRequest>{
+        {"Counted", "Way", KeyValuePairs{{"wayId", 3}}},
+        {"Counted", "Way", KeyValuePairs{{"wayId", 99}}}});
+    REQUIRE(locations.size() == 2);
+    REQUIRE(locations[0].size() == 1);
+    REQUIRE(locations[0][0].tileKey_.tileId_ == RelationDataSource::SecondTile);
+    REQUIRE(locations[1].empty());
+
+    SECTION("Load the targets")
+    {
+        auto relations = service.resolveRelations(loadTile(RelationDataSource::FirstTile));
+        REQUIRE(relations.size() == 2);
+
+        // The local target is not located.
+        REQUIRE(relations[0].targets_.size() == 1);
+        REQUIRE(relations[0].targets_[0]->id()->toString() == "Way.2");
+        REQUIRE(relations[0].targetTiles_[0].tileId_ == RelationDataSource::FirstTile);
+
+        // The other target is located, and its tile is loaded.
+        REQUIRE(relations[1].targetTiles_.size() == 1);
+        REQUIRE(relations[1].targetTiles_[0].tileId_ == RelationDataSource::SecondTile);
+        REQUIRE(relations[1].targets_.size() == 1);
+        REQUIRE(relations[1].targets_[0]->id()->toString() == "Way.3");
+        REQUIRE(dataSource->fillCount_ == 2);
+
+        auto json = relations[1].serialize(true);
+        REQUIRE(json["sourceFeatureId"] == "Way.2");
+        REQUIRE(json["name"] == "next");
+        REQUIRE(json["targetFeatureId"] == "Way.3");
+        REQUIRE(json["targets"].size() == 1);
+    }
+
+    SECTION("Only locate the targets")
+    {
+        auto relations = service.resolveRelations(loadTile(RelationDataSource::SecondTile), false);
+        REQUIRE(relations.size() == 2);
+        REQUIRE(relations[0].targets_.size() == 1);
+        REQUIRE(relations[1].targetTiles_.empty());
+        REQUIRE(relations[1].targets_.empty());
+        REQUIRE(dataSource->fillCount_ == 1);
+    }
+}
+
+TEST_CASE("ServiceSlowConsumer", "[Service]")
+{
+    setLogLevel("warn", log());
+
+    auto dataSource = std::make_shared<CountingDataSource>(1);
+    Service service(std::make_shared<MemCache>());
+    service.add(dataSource);
+
+    // The callback of the first request blocks until the second request is
+    // done, which its results must not wait for, although a single worker
+    // loads the tiles of both requests.
+    std::atomic_bool secondIsDone = false;
+    auto first = std::make_shared<LayerTilesRequest>("Counted", "WayLayer", std::vector<TileId>{TileId(1, 1, 5)});
+    first->onFeatureLayer([&secondIsDone](auto&&)
+    {
+        auto waitUntil = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (!secondIsDone && std::chrono::steady_clock::now() < waitUntil)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    });
+    std::atomic_int secondResultCount = 0;
+    auto second = makeRequest({TileId(2, 1, 5), TileId(3, 1, 5)}, secondResultCount);
+
+    REQUIRE(service.request({first, second}));
+    second->wait();
+    REQUIRE(!first->isDone());
+    secondIsDone = true;
+    first->wait();
+
+    REQUIRE(first->getStatus() == RequestStatus::Success);
+    REQUIRE(second->getStatus() == RequestStatus::Success);
+    REQUIRE(secondResultCount == 2);
+    REQUIRE(dataSource->fillCount_ == 3);
+}
+
+TEST_CASE("ServiceCoveragePruning", "[Service]")
+{
+    setLogLevel("warn", log());
+
+    // The layer only has tiles on zoom level 5, in the columns and rows 0 to 3.
+    auto dataSource = std::make_shared<CountingDataSource>(1);
+    auto layerInfo = dataSource->info_.getLayer("WayLayer");
+    layerInfo->zoomLevels_ = {5};
+    layerInfo->coverage_ = {Coverage{TileId(0, 0, 5), TileId(3, 3, 5), {}}};
+    Service service(std::make_shared<MemCache>());
+    service.add(dataSource);
+
+    std::atomic_int numPrunedTiles = 0;
+    auto makeCoverageRequest = [&]() {
+        auto request = std::make_shared<LayerTilesRequest>(
+            "Counted", "WayLayer", std::vector<TileId>{TileId(1, 1, 5), TileId(10, 10, 5), TileId(1, 1, 6)});
+        request->onFeatureLayer([&](auto&& tile) {
+            if (tile->info().contains("pruned"))
+                ++numPrunedTiles;
+        });
+        return request;
+    };
+
+    auto request = makeCoverageRequest();
+    REQUIRE(service.request({request}));
+    request->wait();
+    REQUIRE(request->getStatus() == RequestStatus::Success);
+    REQUIRE(numPrunedTiles == 2);
+    REQUIRE(dataSource->fillCount_ == 1);
+    REQUIRE(service.getStatistics()["pruned-tiles"] == 2);
+
+    // The pruned tiles are cached.
+    auto repeatedRequest = makeCoverageRequest();
+    REQUIRE(service.request({repeatedRequest}));
+    repeatedRequest->wait();
+    REQUIRE(numPrunedTiles == 4);
+    REQUIRE(dataSource->fillCount_ == 1);
+    REQUIRE(service.getStatistics()["pruned-tiles"] == 2);
+}
+
+TEST_CASE("ServiceTileTimings", "[Service]")
+{
+    setLogLevel("warn", log());
+
+    auto dataSource = std::make_shared<CountingDataSource>(1);
+    auto addOnDataSource = std::make_shared<CountingDataSource>(1);
+    addOnDataSource->info_.nodeId_ = "CountingAddOnNode";
+    addOnDataSource->info_.isAddOn_ = true;
+    Service service(std::make_shared<MemCache>());
+    service.add(dataSource);
+    service.add(addOnDataSource);
+
+    std::atomic_int resultCount = 0;
+    auto request = makeRequest({TileId(0, 7, 5)}, resultCount);
+    std::vector<TileFeatureLayer::Ptr> tiles;
+    request->onFeatureLayer([&](auto&& tile) { tiles.push_back(tile); });
+    REQUIRE(service.request({request}));
+    request->wait();
+    REQUIRE(tiles.size() == 1);
+
+    auto info = tiles[0]->info();
+    for (auto const& key : {
+             "queue-wait-ms",
+             "fill-time-ms",
+             "add-on-merge-time-ms",
+             "serialize-time-ms",
+             "cache-write-time-ms",
+             "serialized-bytes"})
+    {
+        INFO(key);
+        REQUIRE(info.contains(key));
+        REQUIRE(info[key].get<double>() >= 0);
+    }
+    REQUIRE(info["serialized-bytes"].get<int64_t>() > 0);
+}
+
+TEST_CASE("ServiceCancellation", "[Service]")
+{
+    setLogLevel("warn", log());
+
+    auto dataSource = std::make_shared<CancellableDataSource>();
+    Service service(std::make_shared<MemCache>());
+    service.add(dataSource);
+
+    std::atomic_int resultCount = 0;
+    auto request = makeRequest({TileId(5, 7, 5)}, resultCount);
+    REQUIRE(service.request({request}));
+    while (dataSource->fillCount_ == 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    // Aborting the only request for the tile stops the running fill.
+    service.abort(request);
+    request->wait();
+    auto waitUntil = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (dataSource->cancelledFills_ == 0 && std::chrono::steady_clock::now() < waitUntil)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    REQUIRE(dataSource->cancelledFills_ == 1);
+    REQUIRE(service.getStatistics()["cancelled-jobs"].get<int64_t>() == 1);
+    REQUIRE(resultCount == 0);
+
+    // The cancelled tile was not cached, so it is filled again.
+    dataSource->blockFills_ = false;
+    auto repeatedRequest = makeRequest({TileId(5, 7, 5)}, resultCount);
+    REQUIRE(service.request({repeatedRequest}));
+    repeatedRequest->wait();
+    REQUIRE(repeatedRequest->getStatus() == RequestStatus::Success);
+    REQUIRE(resultCount == 1);
+    REQUIRE(dataSource->fillCount_ == 2);
+}
+
+TEST_CASE("ServiceInFlightTiles", "[Service]")
+{
+    setLogLevel("warn", log());
+
+    // The second job slot lets the second request be scheduled while the first fill runs.
+    auto dataSource = std::make_shared<CancellableDataSource>();
+    dataSource->info_.maxParallelJobs_ = 2;
+    Service service(std::make_shared<MemCache>());
+    service.add(dataSource);
+
+    std::atomic_int firstResultCount = 0;
+    auto first = makeRequest({TileId(6, 7, 5)}, firstResultCount);
+    REQUIRE(service.request({first}));
+    while (dataSource->fillCount_ == 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    // The duplicate request waits for the running job instead of queueing a fill.
+    std::atomic_int secondResultCount = 0;
+    auto second = makeRequest({TileId(6, 7, 5)}, secondResultCount);
+    REQUIRE(service.request({second}));
+    auto waitUntil = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (std::chrono::steady_clock::now() < waitUntil) {
+        auto statistics = service.getStatistics();
+        if (statistics["active-requests"] == 0 && statistics["pending-cache-lookups"] == 0)
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    REQUIRE(!second->isDone());
+
+    // Both requests get the result of the single fill.
+    dataSource->blockFills_ = false;
+    first->wait();
+    second->wait();
+    REQUIRE(first->getStatus() == RequestStatus::Success);
+    REQUIRE(second->getStatus() == RequestStatus::Success);
+    REQUIRE(firstResultCount == 1);
+    REQUIRE(secondResultCount == 1);
+    REQUIRE(dataSource->fillCount_ == 1);
+}
+
+TEST_CASE("ServiceRemovedDataSource", "[Service]")
+{
+    setLogLevel("warn", log());
+
+    auto dataSource = std::make_shared<CountingDataSource>(1);
+    auto cache = std::make_shared<BlockingCache>();
+    Service service(cache);
+    service.add(dataSource);
+
+    // The data source is removed while the first lookup batch of the
+    // request runs, so the lookup of its remaining tiles finds none.
+    std::vector<TileId> tiles;
+    for (uint16_t x = 0; x < 64; ++x)
+        tiles.emplace_back(x, 0, 10);
+    std::atomic_int resultCount = 0;
+    auto request = makeRequest(tiles, resultCount);
+    REQUIRE(service.request({request}));
+    while (!cache->isBlocked_)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    service.remove(dataSource);
+    cache->isReleased_ = true;
+
+    request->wait();
+    REQUIRE(request->getStatus() == RequestStatus::NoDataSource);
+    REQUIRE(service.info().empty());
+}
+
+TEST_CASE("ServiceAddOns", "[Service]")
+{
+    setLogLevel("warn", log());
+
+    auto dataSource = std::make_shared<RelationDataSource>();
+    auto firstAddOn = std::make_shared<AddOnDataSource>("FirstAddOnNode", "A");
+    auto secondAddOn = std::make_shared<AddOnDataSource>("SecondAddOnNode", "B");
+    Service service(std::make_shared<MemCache>());
+    service.add(dataSource);
+    service.add(firstAddOn);
+    service.add(secondAddOn);
+
+    auto loadTile = [&]()
+    {
+        TileFeatureLayer::Ptr result;
+        auto request = std::make_shared<LayerTilesRequest>(
+            "Counted", "WayLayer", std::vector<TileId>{RelationDataSource::FirstTile});
+        request->onFeatureLayer([&result](auto&& tile) { result = tile; });
+        REQUIRE(service.request({request}));
+        request->wait();
+        REQUIRE(result);
+        return result;
+    };
+
+    // The tiles of both add-ons are merged through one add-on string pool,
+    // in which the attribute and validity geometry names of each resolve.
+    // The merged tile is checked once as filled, and once from the cache.
+    for (auto const& tile : {loadTile(), loadTile()}) {
+        REQUIRE(tile->nodeId() == "CountingNode|add-ons");
+        REQUIRE(tile->size() == 2);
+        auto json = tile->find("Way", KeyValuePairs{{"wayId", 1}})->toJson().dump();
+        for (auto const& name : {"next", "layerA", "attributeA", "geometryA", "layerB", "attributeB", "geometryB"}) {
+            INFO(name);
+            REQUIRE(json.find(name) != std::string::npos);
+        }
+    }
+    REQUIRE(dataSource->fillCount_ == 1);
+    REQUIRE(firstAddOn->fillCount_ == 1);
+    REQUIRE(secondAddOn->fillCount_ == 1);
+}
+
+TEST_CASE("ServiceChunks", "[Service]")
+{
+    setLogLevel("warn", log());
+
+    auto dataSource = std::make_shared<ChunkingDataSource>();
+    Service service(std::make_shared<MemCache>());
+    service.add(dataSource);
+
+    SECTION("Chunks are only sent to requests which accept them")
+    {
+        std::vector<TileFeatureLayer::Ptr> chunks;
+        auto request = std::make_shared<LayerTilesRequest>(
+            "Counted", "WayLayer", std::vector<TileId>{RelationDataSource::FirstTile});
+        request->setChunks().onFeatureLayer([&chunks](auto&& layer) { chunks.push_back(layer); });
+        REQUIRE(service.request({request}));
+        request->wait();
+        REQUIRE(request->getStatus() == RequestStatus::Success);
+
+        // Three chunks with one way each, and an empty final one.
+        REQUIRE(chunks.size() == 4);
+        for (auto i = 0u; i < chunks.size(); ++i) {
+            REQUIRE(chunks[i]->chunkIndex() == i);
+            REQUIRE(chunks[i]->isFinalChunk() == (i == 3));
+            REQUIRE(chunks[i]->size() == (i < 3 ? 1 : 0));
+        }
+        REQUIRE(chunks[2]->find("Way", KeyValueViewPairs{{"wayId", 3}}));
+    }
+
+    SECTION("Other requests get the whole tile")
+    {
+        std::vector<TileFeatureLayer::Ptr> layers;
+        auto request = std::make_shared<LayerTilesRequest>(
+            "Counted", "WayLayer", std::vector<TileId>{RelationDataSource::FirstTile});
+        request->onFeatureLayer([&layers](auto&& layer) { layers.push_back(layer); });
+        REQUIRE(service.request({request}));
+        request->wait();
+        REQUIRE(layers.size() == 1);
+        REQUIRE(!layers[0]->chunkIndex());
+        REQUIRE(layers[0]->size() == 3);
+    }
+}
+
+TEST_CASE("ServiceDeadlines", "[Service]")
+{
+    setLogLevel("warn", log());
+
+    SECTION("Late tiles are neither loaded nor served from the cache")
+    {
+        auto dataSource = std::make_shared<CountingDataSource>(1);
+        Service service(std::make_shared<MemCache>());
+        service.add(dataSource);
+
+        std::atomic_int resultCount = 0;
+        auto request = makeRequest({TileId(0, 7, 5), TileId(1, 7, 5)}, resultCount);
+        request->setDeadline(TileId(1, 7, 5), std::chrono::steady_clock::now() - std::chrono::milliseconds(1));
+        REQUIRE(service.request({request}));
+        request->wait();
+        REQUIRE(request->getStatus() == RequestStatus::Expired);
+        REQUIRE(request->expiredTileCount() == 1);
+        REQUIRE(resultCount == 1);
+        REQUIRE(dataSource->fillCount_ == 1);
+
+        auto lateRequest = makeRequest({TileId(0, 7, 5)}, resultCount);
+        lateRequest->setDeadline(std::chrono::steady_clock::now());
+        REQUIRE(service.request({lateRequest}));
+        lateRequest->wait();
+        REQUIRE(lateRequest->getStatus() == RequestStatus::Expired);
+        REQUIRE(resultCount == 1);
+        REQUIRE(service.getStatistics()["late-tiles"].get<int64_t>() == 2);
+    }
+
+    SECTION("Running jobs are cancelled at the deadline")
+    {
+        auto dataSource = std::make_shared<CancellableDataSource>();
+        Service service(std::make_shared<MemCache>());
+        service.add(dataSource);
+
+        std::atomic_int resultCount = 0;
+        auto request = makeRequest({TileId(5, 7, 5)}, resultCount);
+        request->setDeadline(std::chrono::steady_clock::now() + std::chrono::milliseconds(50));
+        REQUIRE(service.request({request}));
+        request->wait();
+        REQUIRE(request->getStatus() == RequestStatus::Expired);
+        REQUIRE(dataSource->cancelledFills_ == 1);
+        REQUIRE(resultCount == 0);
+
+        // Requests without a deadline still get the tile.
+        dataSource->blockFills_ = false;
+        auto repeatedRequest = makeRequest({TileId(5, 7, 5)}, resultCount);
+        REQUIRE(service.request({repeatedRequest}));
+        repeatedRequest->wait();
+        REQUIRE(repeatedRequest->getStatus() == RequestStatus::Success);
+        REQUIRE(resultCount == 1);
+    }
+}
+
+TEST_CASE("ServiceCluster", "[Service]")
+{
+    setLogLevel("warn", log());
+
+    auto tileKey = [](auto i)
+    {
+        MapTileKey result;
+        result.layer_ = LayerType::Features;
+        result.mapId_ = "Counted";
+        result.layerId_ = "WayLayer";
+        result.tileId_ = TileId(i, 7, 12);
+        return result;
+    };
+
+    SECTION("Hash ring assigns tiles stably and evenly")
+    {
+        HashRing ring({"a:8080", "b:8080", "c:8080"});
+        HashRing sameRing({"a:8080", "b:8080", "c:8080"});
+        HashRing smallerRing({"a:8080", "c:8080"});
+
+        std::map<size_t, int> tilesPerNode;
+        for (auto i = 0; i < 3000; ++i) {
+            auto owner = ring.owner(tileKey(i));
+            REQUIRE(sameRing.owner(tileKey(i)) == owner);
+            ++tilesPerNode[owner];
+
+            // Removing a node only moves the tiles which it owned.
+            auto const& name = ring.nodes()[owner];
+            if (name != "b:8080")
+                REQUIRE(smallerRing.nodes()[smallerRing.owner(tileKey(i))] == name);
+        }
+        REQUIRE(tilesPerNode.size() == 3);
+        for (auto const& [node, numTiles] : tilesPerNode) {
+            REQUIRE(numTiles > 600);
+            REQUIRE(numTiles < 1400);
+        }
+    }
+
+    auto dataSource = std::make_shared<CountingDataSource>(2, 4);
+    auto peer = std::make_shared<FakeClusterPeer>();
+    Service service(std::make_shared<MemCache>());
+    service.add(dataSource);
+    service.setCluster("a:8080", {{"b:8080", peer}});
+
+    HashRing ring({"a:8080", "b:8080"});
+    std::vector<TileId> tiles;
+    size_t numPeerTiles = 0;
+    for (auto i = 0; i < 40; ++i) {
+        tiles.emplace_back(tileKey(i).tileId_);
+        if (ring.owner(tileKey(i)) == 1)
+            ++numPeerTiles;
+    }
+    REQUIRE(numPeerTiles > 0);
+    REQUIRE(numPeerTiles < tiles.size());
+
+    SECTION("Tiles of a peer are loaded by the peer")
+    {
+        std::atomic_int resultCount = 0;
+        auto request = makeRequest(tiles, resultCount);
+        REQUIRE(service.request({request}));
+        request->wait();
+        REQUIRE(resultCount == tiles.size());
+        REQUIRE(peer->forwardedTiles_.size() == numPeerTiles);
+        for (auto const& key : peer->forwardedTiles_)
+            REQUIRE(ring.owner(key) == 1);
+        REQUIRE(dataSource->fillCount_ == tiles.size() - numPeerTiles);
+        REQUIRE(service.getStatistics()["cluster"]["forwarded-tiles"].get<int64_t>() == numPeerTiles);
+
+        // Only the peer caches its tiles, so they are forwarded again.
+        auto repeatedRequest = makeRequest(tiles, resultCount);
+        REQUIRE(service.request({repeatedRequest}));
+        repeatedRequest->wait();
+        REQUIRE(peer->forwardedTiles_.size() == 2 * numPeerTiles);
+        REQUIRE(dataSource->fillCount_ == tiles.size() - numPeerTiles);
+    }
+
+    SECTION("Tiles of a failed peer are loaded locally")
+    {
+        peer->failing_ = true;
+        std::atomic_int resultCount = 0;
+        auto request = makeRequest(tiles, resultCount);
+        REQUIRE(service.request({request}));
+        request->wait();
+        REQUIRE(resultCount == tiles.size());
+        REQUIRE(dataSource->fillCount_ == tiles.size());
+        REQUIRE(service.getStatistics()["cluster"]["forward-failures"].get<int64_t>() == numPeerTiles);
+    }
+
+    SECTION("Forwarded requests are loaded locally")
+    {
+        std::atomic_int resultCount = 0;
+        auto request = makeRequest(tiles, resultCount);
+        request->clusterForwarded_ = true;
+        REQUIRE(service.request({request}));
+        request->wait();
+        REQUIRE(resultCount == tiles.size());
+        REQUIRE(peer->forwardedTiles_.empty());
+        REQUIRE(dataSource->fillCount_ == tiles.size());
+    }
+}
+
+TEST_CASE("Metrics", "[Service]")
+{
+    setLogLevel("warn", log());
+
+    SECTION("Histograms are written cumulatively")
+    {
+        Histogram histogram({1., 2.});
+        histogram.observe(0.5);
+        histogram.observe(1.5);
+        histogram.observe(3.);
+        REQUIRE(histogram.count() == 3);
+        REQUIRE(histogram.sum() == 5.);
+
+        std::ostringstream out;
+        MetricsWriter writer(out);
+        writer.family("test_seconds", "histogram", "Test histogram.");
+        writer.histogram("test_seconds", {{"source", "a\"b"}}, histogram);
+        REQUIRE(out.str() ==
+            "# HELP test_seconds Test histogram.\n"
+            "# TYPE test_seconds histogram\n"
+            "test_seconds_bucket{source=\"a\\\"b\",le=\"1\"} 1\n"
+            "test_seconds_bucket{source=\"a\\\"b\",le=\"2\"} 2\n"
+            "test_seconds_bucket{source=\"a\\\"b\",le=\"+Inf\"} 3\n"
+            "test_seconds_sum{source=\"a\\\"b\"} 5\n"
+            "test_seconds_count{source=\"a\\\"b\"} 3\n");
+    }
+
+    SECTION("Service metrics count served tiles")
+    {
+        auto dataSource = std::make_shared<CountingDataSource>(2);
+        Service service(std::make_shared<MemCache>());
+        service.add(dataSource);
+
+        std::vector<TileId> tiles;
+        for (auto i = 0; i < 10; ++i)
+            tiles.emplace_back(TileId(i, 7, 5));
+        std::atomic_int resultCount = 0;
+        for (auto i = 0; i < 2; ++i) {
+            auto request = makeRequest(tiles, resultCount);
+            REQUIRE(service.request({request}));
+            request->wait();
+        }
+
+        std::ostringstream out;
+        MetricsWriter writer(out);
+        service.writeMetrics(writer);
+        auto metrics = out.str();
+        REQUIRE(metrics.find(R"(mapget_tiles_served_total{source="CountingNode",map="Counted",origin="source"} 10)") != std::string::npos);
+        REQUIRE(metrics.find(R"(mapget_tiles_served_total{source="CountingNode",map="Counted",origin="cache"} 10)") != std::string::npos);
+        REQUIRE(metrics.find(R"(mapget_fill_duration_seconds_count{source="CountingNode",map="Counted"} 10)") != std::string::npos);
+        REQUIRE(metrics.find(R"(mapget_queue_wait_seconds_count{source="CountingNode",map="Counted"} 10)") != std::string::npos);
+        REQUIRE(metrics.find("# TYPE mapget_active_jobs gauge") != std::string::npos);
+    }
+}
+
+TEST_CASE("Tracing", "[Service]")
+{
+    setLogLevel("warn", log());
+
+    SECTION("Trace contexts are parsed from traceparent headers")
+    {
+        auto context = TraceContext::fromTraceParent("00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01");
+        REQUIRE(context);
+        REQUIRE(context->traceId_ == "4bf92f3577b34da6a3ce929d0e0e4736");
+        REQUIRE(context->spanId_ == "00f067aa0ba902b7");
+        REQUIRE(context->sampled_);
+        REQUIRE(context->toTraceParent() == "00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01");
+
+        REQUIRE(!TraceContext::fromTraceParent(""));
+        REQUIRE(!TraceContext::fromTraceParent("00-00000000000000000000000000000000-00f067aa0ba902b7-01"));
+        REQUIRE(!TraceContext::fromTraceParent("00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01-extra"));
+    }
+
+    SECTION("Tile spans belong to the trace of their request")
+    {
+        Tracer::instance().enable(1000);
+        Tracer::instance().takeSpans();
+
+        auto dataSource = std::make_shared<CountingDataSource>(2);
+        Service service(std::make_shared<MemCache>());
+        service.add(dataSource);
+
+        Span clientSpan("client");
+        std::atomic_int resultCount = 0;
+        auto request = makeRequest({TileId(0, 7, 5), TileId(1, 7, 5), TileId(2, 7, 5)}, resultCount);
+        request->traceContext_ = clientSpan.context();
+        REQUIRE(service.request({request}));
+        request->wait();
+        clientSpan.end();
+
+        auto spans = Tracer::instance().takeSpans();
+        Tracer::instance().enable(0);
+
+        std::map<std::string, int> spanCounts;
+        for (auto const& span : spans) {
+            REQUIRE(span.context_.traceId_ == clientSpan.context().traceId_);
+            ++spanCounts[span.name_];
+        }
+        REQUIRE(spanCounts["client"] == 1);
+        REQUIRE(spanCounts["mapget.queue"] == 3);
+        REQUIRE(spanCounts["mapget.datasource.get"] == 3);
+        REQUIRE(spanCounts["mapget.cache.put"] == 3);
+
+        auto otlp = Tracer::toOtlpJson(spans);
+        REQUIRE(otlp["resourceSpans"][0]["scopeSpans"][0]["spans"].size() == spans.size());
+    }
+}
+
+TEST_CASE("AllocationTracking", "[Service]")
+{
+    setLogLevel("warn", log());
+
+    SECTION("Nested scopes count their allocations for themselves")
+    {
+        auto fillScopes = AllocationScope::getStatistics()["fill"]["scopes"].get<uint64_t>();
+        {
+            AllocationScope fill(AllocationStage::Fill);
+            {
+                AllocationScope serialize(AllocationStage::Serialize);
+                auto values = std::make_unique<std::vector<int64_t>>(100);
+                if (AllocationScope::isEnabled()) {
+                    REQUIRE(serialize.counts().allocations_ >= 2);
+                    REQUIRE(serialize.counts().bytes_ >= 800);
+                }
+                else
+                    REQUIRE(serialize.counts().allocations_ == 0);
+            }
+            REQUIRE(fill.counts().allocations_ == 0);
+        }
+        REQUIRE(AllocationScope::getStatistics()["fill"]["scopes"].get<uint64_t>() == fillScopes + 1);
+    }
+
+    SECTION("Filled tiles carry their allocations")
+    {
+        auto dataSource = std::make_shared<CountingDataSource>(2);
+        Service service(std::make_shared<MemCache>());
+        service.add(dataSource);
+
+        std::atomic_int resultCount = 0;
+        auto request = makeRequest({TileId(0, 7, 5)}, resultCount);
+        std::vector<TileFeatureLayer::Ptr> tiles;
+        request->onFeatureLayer([&](auto&& tile) { tiles.push_back(tile); });
+        REQUIRE(service.request({request}));
+        request->wait();
+        REQUIRE(tiles.size() == 1);
+        REQUIRE(tiles[0]->info().contains("fill-allocations") == AllocationScope::isEnabled());
+        REQUIRE(service.getStatistics()["allocations"]["fill"]["scopes"].get<uint64_t>() > 0);
+    }
+}
@@ -1,6 +1,7 @@
 #include <catch2/catch_test_macros.hpp>
 
 #include "mapget/model/point.h"
+#include "mapget/model/simfil-geometry.h"
 #include "mapget/model/featurelayer.h"
 #include "mapget/model/stringpool.h"
 #include "simfil/model/nodes.h"
@@ -126,3 +127,43 @@ TEST_CASE("Linestring Intersection", "[simfil.geometry]")
     // Intersection outsides the start/end points
     REQUIRE_QUERY("linestring(point(0,0), point(1,1)) intersects linestring(point(2,0), point(2,1))", ValueType::Bool, false);
 }
+
+TEST_CASE("Polygon Point Batch", "[simfil.geometry]")
+{
+    // Square with a square hole.
+    Polygon polygon{{
+        LineString{{{0, 0}, {4, 0}, {4, 4}, {0, 4}}},
+        LineString{{{1, 1}, {2, 1}, {2, 2}, {1, 2}, {1, 1}}}}};
+
+    std::vector<Point> points{
+        {3, 3},      // Inside
+        {1.5, 1.5},  // In the hole
+        {5, 5},      // Outside
+        {0, 2},      // On an edge
+        {4, 4},      // On a vertex
+        {1, 1.5},    // On an edge of the hole
+        {-1, 2}};    // Outside, on the ray through an edge
+    REQUIRE(polygon.contains(points) == std::vector<uint8_t>{1, 0, 0, 1, 1, 0, 0});
+
+    // The batch agrees with the single point tests.
+    std::vector<Point> grid;
+    for (auto x = -0.75; x < 5.; x += 0.25)
+        for (auto y = -0.75; y < 5.; y += 0.25)
+            grid.emplace_back(x, y);
+    auto inside = polygon.contains(grid);
+    REQUIRE(inside.size() == grid.size());
+    for (size_t i = 0; i < grid.size(); ++i) {
+        INFO(grid[i].toString());
+        REQUIRE((inside[i] != 0) == polygon.contains(grid[i]));
+    }
+
+    REQUIRE(polygon.contains(LineString{{{0.5, 0.5}, {3.5, 0.5}, {3.5, 3.5}}}));
+    REQUIRE(!polygon.contains(LineString{{{0.5, 0.5}, {1.5, 1.5}}}));
+    REQUIRE(polygon.intersects(LineString{{{-1, -1}, {1.5, 1.5}}}));
+}
+
+TEST_CASE("Linestring BBox", "[simfil.geometry]")
+{
+    LineString line{{{-3, -2}, {-1, -5}}};
+    REQUIRE(line.bbox() == BBox{{-3, -5}, {-1, -2}});
+}